@@ -19,7 +19,7 @@ function (make_resources dst)
     set (versionTempPath ${CMAKE_SOURCE_DIR}/res/VERSION)
     file (WRITE ${versionTempPath} ${PROJECT_VERSION})
     execute_process (
-        COMMAND ${ZIP_EXECUTABLE} -1 ${dst} VERSION ${files}
+        COMMAND ${ZIP_EXECUTABLE} -1 -n .ttf:.otf:.fontpack ${dst} VERSION ${files}
         WORKING_DIRECTORY ${CMAKE_SOURCE_DIR}/res
         OUTPUT_QUIET
     )
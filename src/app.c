@@ -21,17 +21,32 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "app.h"
+#include "archivecache.h"
+#include "bench.h"
 #include "bookmarks.h"
 #include "defs.h"
 #include "resources.h"
 #include "feeds.h"
+#include "fontpack.h"
+#include "framepacer.h"
 #include "mimehooks.h"
 #include "gmcerts.h"
 #include "gmdocument.h"
 #include "gmutil.h"
 #include "history.h"
+#include "imagecache.h"
+#include "imagedecoder.h"
 #include "ipc.h"
+#include "jobs.h"
+#include "mempressure.h"
+#include "mirror.h"
 #include "periodic.h"
+#include "prefetch.h"
+#include "profiler.h"
+#include "requestbroker.h"
+#include "resolver.h"
+#include "respcache.h"
+#include "savequeue.h"
 #include "sitespec.h"
 #include "updater.h"
 #include "ui/certimportwidget.h"
@@ -49,12 +64,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "ui/window.h"
 #include "visited.h"
 
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/commandline.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/process.h>
 #include <the_Foundation/sortedarray.h>
+#include <the_Foundation/thread.h>
 #include <the_Foundation/time.h>
 #include <the_Foundation/version.h>
 #include <SDL.h>
@@ -119,6 +137,7 @@ struct Impl_App {
     iMainWindow *window;
     iPtrArray    popupWindows;
     iSortedArray tickers; /* per-frame callbacks, used for animations */
+    iSortedArray runningTickers; /* tickers being run in the current frame */
     uint32_t     lastTickerTime;
     uint32_t     elapsedSinceLastTicker;
     iBool        isRunning;
@@ -130,16 +149,23 @@ struct Impl_App {
     int          sleepTimer;
 #endif
     iAtomicInt   pendingRefresh;
+    iAtomicInt   pendingFullRefresh; /* refresh not limited to damaged widgets */
     iBool        isLoadingPrefs;
     iStringList *launchCommands;
+    iMutex       launchMutex; /* startup loaders may post commands from their threads */
     iBool        isFinishedLaunching;
     iTime        lastDropTime; /* for detecting drops of multiple items */
+    int          memoryTier; /* how much was released on the latest low memory warning */
+    uint32_t     memoryTierTime;
     int          autoReloadTimer;
     iPeriodic    periodic;
+    iFramePacer  pacer;
     int          warmupFrames; /* forced refresh just after resuming from background; FIXME: shouldn't be needed */
     /* Preferences: */
     iBool        commandEcho;         /* --echo */
     iBool        forceSoftwareRender; /* --sw */
+    iBool        isProfilingStartup;  /* --startup-profile */
+    iTime        startupPhaseTime;
     iRect        initialWindowRect;
     iPrefs       prefs;
 };
@@ -154,11 +180,18 @@ struct Impl_Ticker {
     iAny *context;
     iRoot *root;
     void (*callback)(iAny *);
+    enum iTickerPriority priority;
+    uint32_t due; /* SDL ticks; zero to run in the next frame */
 };
 
+
 static int cmp_Ticker_(const void *a, const void *b) {
     const iTicker *elems[2] = { a, b };
-    return iCmp(elems[0]->context, elems[1]->context);
+    const int cmp = iCmp(elems[0]->context, elems[1]->context);
+    if (cmp) {
+        return cmp;
+    }
+    return iCmp((const void *) elems[0]->callback, (const void *) elems[1]->callback);
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -227,7 +260,10 @@ static iString *serializePrefs_App_(const iApp *d) {
     appendFormat_String(str, "imageloadscroll arg:%d\n", d->prefs.loadImageInsteadOfScrolling);
     appendFormat_String(str, "cachesize.set arg:%d\n", d->prefs.maxCacheSize);
     appendFormat_String(str, "memorysize.set arg:%d\n", d->prefs.maxMemorySize);
+    appendFormat_String(str, "hibernate.set arg:%d\n", d->prefs.hibernateTabsAfter);
+    appendFormat_String(str, "mirrordepth.set arg:%d\n", d->prefs.mirrorDepth);
     appendFormat_String(str, "decodeurls arg:%d\n", d->prefs.decodeUserVisibleURLs);
+    appendFormat_String(str, "prefetchlinks arg:%d\n", d->prefs.prefetchLinks);
     appendFormat_String(str, "linewidth.set arg:%d\n", d->prefs.lineWidth);
     appendFormat_String(str, "linespacing.set arg:%f\n", d->prefs.lineSpacing);
     appendFormat_String(str, "returnkey.set arg:%d\n", d->prefs.returnKey);
@@ -415,11 +451,7 @@ static void loadPrefs_App_(iApp *d) {
 
 static void savePrefs_App_(const iApp *d) {
     iString *cfg = serializePrefs_App_(d);
-    iFile *f = new_File(prefsFileName_());
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        write_File(f, &cfg->chars);
-    }
-    iRelease(f);
+    write_SaveQueue(prefsFileName_(), &cfg->chars);
     delete_String(cfg);
 }
 
@@ -522,7 +554,9 @@ static iBool loadState_App_(iApp *d) {
                 if (flags & current_DocumentStateFlag) {
                     current[rootIndex] = doc;
                 }
-                deserializeState_DocumentWidget(doc, stream_File(f));
+                /* Background tabs get their page when first shown. */
+                deserializeState_DocumentWidget(doc, stream_File(f),
+                                                (flags & current_DocumentStateFlag) == 0);
                 doc = NULL;
             }
             else {
@@ -545,60 +579,59 @@ static iBool loadState_App_(iApp *d) {
 }
 
 static void saveState_App_(const iApp *d) {
-    iUnused(d);
-    trimCache_App();
+    /* The cache is already trimmed whenever a document changes or the limit is set. */
     iMainWindow *win = d->window;
     /* UI state is saved in binary because it is quite complex (e.g.,
        navigation history, cached content) and depends closely on the widget
        tree. The data is largely not reorderable and should not be modified
        by the user manually. */
-    iFile *f = newCStr_File(concatPath_CStr(dataDir_App_(), stateFileName_App_));
-    if (open_File(f, writeOnly_FileMode)) {
-        writeData_File(f, magicState_App_, 4);
-        writeU32_File(f, latest_FileVersion); /* version */
+    iBuffer *buf = new_Buffer();
+    if (openEmpty_Buffer(buf)) {
+        iStream *outs = stream_Buffer(buf);
+        writeData_Stream(outs, magicState_App_, 4);
+        writeU32_Stream(outs, latest_FileVersion); /* version */
         /* Begin with window state. */ {
-            writeData_File(f, magicWindow_App_, 4);
-            writeU32_File(f, win->splitMode);
-            writeU32_File(f, win->base.keyRoot == win->base.roots[0] ? 0 : 1);
+            writeData_Stream(outs, magicWindow_App_, 4);
+            writeU32_Stream(outs, win->splitMode);
+            writeU32_Stream(outs, win->base.keyRoot == win->base.roots[0] ? 0 : 1);
         }
         /* State of UI elements. */ {
             iForIndices(i, win->base.roots) {
                 const iRoot *root = win->base.roots[i];
                 if (root) {
-                    writeData_File(f, magicSidebar_App_, 4);
+                    writeData_Stream(outs, magicSidebar_App_, 4);
                     const iSidebarWidget *sidebar  = findChild_Widget(root->widget, "sidebar");
                     const iSidebarWidget *sidebar2 = findChild_Widget(root->widget, "sidebar2");
-                    writeU16_File(f, i |
-                                  (isVisible_Widget(sidebar)  ? 0x100 : 0) |
-                                  (isVisible_Widget(sidebar2) ? 0x200 : 0) |
-                                  (feedsMode_SidebarWidget(sidebar)  == unread_FeedsMode ? 0x400 : 0) |
-                                  (feedsMode_SidebarWidget(sidebar2) == unread_FeedsMode ? 0x800 : 0));
-                    writeU8_File(f,
-                                 mode_SidebarWidget(sidebar) |
-                                 (mode_SidebarWidget(sidebar2) << 4));
-                    writef_Stream(stream_File(f), width_SidebarWidget(sidebar));
-                    writef_Stream(stream_File(f), width_SidebarWidget(sidebar2));
-                    serialize_IntSet(closedFolders_SidebarWidget(sidebar), stream_File(f));
-                    serialize_IntSet(closedFolders_SidebarWidget(sidebar2), stream_File(f));
+                    writeU16_Stream(outs, i |
+                                    (isVisible_Widget(sidebar)  ? 0x100 : 0) |
+                                    (isVisible_Widget(sidebar2) ? 0x200 : 0) |
+                                    (feedsMode_SidebarWidget(sidebar)  == unread_FeedsMode ? 0x400 : 0) |
+                                    (feedsMode_SidebarWidget(sidebar2) == unread_FeedsMode ? 0x800 : 0));
+                    write8_Stream(outs,
+                                  mode_SidebarWidget(sidebar) |
+                                  (mode_SidebarWidget(sidebar2) << 4));
+                    writef_Stream(outs, width_SidebarWidget(sidebar));
+                    writef_Stream(outs, width_SidebarWidget(sidebar2));
+                    serialize_IntSet(closedFolders_SidebarWidget(sidebar), outs);
+                    serialize_IntSet(closedFolders_SidebarWidget(sidebar2), outs);
                 }
             }
         }
         iConstForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
             iAssert(isInstance_Object(i.object, &Class_DocumentWidget));
             const iWidget *widget = constAs_Widget(i.object);
-            writeData_File(f, magicTabDocument_App_, 4);
+            writeData_Stream(outs, magicTabDocument_App_, 4);
             int8_t flags = (document_Root(widget->root) == i.object ? current_DocumentStateFlag : 0);
             if (widget->root == win->base.roots[1]) {
                 flags |= rootIndex1_DocumentStateFlag;
             }
-            write8_File(f, flags);
-            serializeState_DocumentWidget(i.object, stream_File(f));
+            write8_Stream(outs, flags);
+            serializeState_DocumentWidget(i.object, outs);
         }
+        write_SaveQueue(concatPath_CStr(dataDir_App_(), stateFileName_App_), data_Buffer(buf));
     }
-    else {
-        fprintf(stderr, "[App] failed to save state: %s\n", strerror(errno));
-    }
-    iRelease(f);
+    iRelease(buf);
+    flush_ResponseCache(); /* the state refers to cached responses */
 }
 
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
@@ -615,6 +648,7 @@ static uint32_t checkAsleep_App_(uint32_t interval, void *param) {
 static uint32_t postAutoReloadCommand_App_(uint32_t interval, void *param) {
     iUnused(param);
     postCommand_Root(NULL, "document.autoreload");
+    postCommand_App("tabs.hibernate");
     return interval;
 }
 
@@ -697,7 +731,80 @@ static iBool hasCommandLineOpenableScheme_(const iRangecc uri) {
     return iFalse;
 }
 
+/* The user's data files don't depend on each other or the UI, so they are loaded in background
+   threads while the fonts, keys and preferences are being initialized. */
+
+iDeclareType(StartupLoader)
+
+struct Impl_StartupLoader {
+    const char *name;
+    void      (*load)(iApp *);
+    iThread *   thread;
+    double      seconds;
+};
+
+static void loadCerts_App_(iApp *d) {
+    d->certs = new_GmCerts(dataDir_App_());
+}
+
+static void loadVisited_App_(iApp *d) {
+    load_Visited(d->visited, dataDir_App_());
+}
+
+static void loadBookmarks_App_(iApp *d) {
+    load_Bookmarks(d->bookmarks, dataDir_App_());
+}
+
+static void loadMimeHooks_App_(iApp *d) {
+    load_MimeHooks(d->mimehooks, dataDir_App_());
+}
+
+static iThreadResult runStartupLoader_App_(iThread *thd) {
+    iStartupLoader *loader = userData_Thread(thd);
+    iTime           start;
+    setThreadName_Profiler("startup");
+    initCurrent_Time(&start);
+    iBeginCollect();
+    loader->load(&app_);
+    iEndCollect();
+    loader->seconds = elapsedSeconds_Time(&start);
+    return 0;
+}
+
+static void startLoaders_App_(iStartupLoader *loaders, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        loaders[i].thread = new_Thread(runStartupLoader_App_);
+        setUserData_Thread(loaders[i].thread, &loaders[i]);
+        start_Thread(loaders[i].thread);
+    }
+}
+
+static void profileStartupPhase_App_(iApp *d, const char *phase) {
+    /* Prints the time elapsed since the previous phase. */
+    if (d->isProfilingStartup) {
+        printf("[startup] %-18s %8.1f ms\n", phase, elapsedSeconds_Time(&d->startupPhaseTime) * 1000.0);
+        fflush(stdout);
+        initCurrent_Time(&d->startupPhaseTime);
+    }
+}
+
+static void finishLoaders_App_(iApp *d, iStartupLoader *loaders, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        join_Thread(loaders[i].thread);
+        iReleasePtr(&loaders[i].thread);
+    }
+    profileStartupPhase_App_(d, "wait for loaders");
+    if (d->isProfilingStartup) {
+        for (size_t i = 0; i < count; i++) {
+            printf("[startup]   (%-14s %8.1f ms in background)\n",
+                   loaders[i].name, loaders[i].seconds * 1000.0);
+        }
+        fflush(stdout);
+    }
+}
+
 static void init_App_(iApp *d, int argc, char **argv) {
+    initCurrent_Time(&d->startupPhaseTime);
 #if defined (iPlatformLinux)
     d->isRunningUnderWindowSystem = !iCmpStr(SDL_GetCurrentVideoDriver(), "x11") ||
                                     !iCmpStr(SDL_GetCurrentVideoDriver(), "wayland");
@@ -705,6 +812,8 @@ static void init_App_(iApp *d, int argc, char **argv) {
     d->isRunningUnderWindowSystem = iTrue;
 #endif
     d->isDarkSystemTheme = iTrue; /* will be updated by system later on, if supported */
+    init_Profiler();
+    initTimingStats_GmRequest();
     init_CommandLine(&d->args, argc, argv);
     /* Where was the app started from? We ask SDL first because the command line alone 
        cannot be relied on (behavior differs depending on OS). */ {
@@ -756,13 +865,14 @@ static void init_App_(iApp *d, int argc, char **argv) {
         defineValues_CommandLine(&d->args, windowHeight_CommandLineOption, 1);
         defineValuesN_CommandLine(&d->args, "new-tab", 0, 1);
         defineValues_CommandLine(&d->args, "tab-url", 0);
+        defineValues_CommandLine(&d->args, "startup-profile", 0);
         defineValues_CommandLine(&d->args, "sw", 0);
         defineValues_CommandLine(&d->args, "version;V", 0);
     }
     iStringList *openCmds = new_StringList();
     /* Handle command line options. */ {
         if (contains_CommandLine(&d->args, "help")) {
-            puts(cstr_Block(&blobArghelp_Resources));
+            puts(cstr_Block(load_Resources(&blobArghelp_Resources)));
             terminate_App_(0);
         }
         if (contains_CommandLine(&d->args, "version;V")) {
@@ -831,12 +941,15 @@ static void init_App_(iApp *d, int argc, char **argv) {
     d->isLoadingPrefs      = iFalse;
     d->warmupFrames        = 0;
     d->launchCommands      = new_StringList();
+    init_Mutex(&d->launchMutex);
     iZap(d->lastDropTime);
     init_SortedArray(&d->tickers, sizeof(iTicker), cmp_Ticker_);
+    init_SortedArray(&d->runningTickers, sizeof(iTicker), cmp_Ticker_);
     d->lastTickerTime         = SDL_GetTicks();
     d->elapsedSinceLastTicker = 0;
     d->commandEcho            = iClob(checkArgument_CommandLine(&d->args, "echo;E")) != NULL;
     d->forceSoftwareRender    = iClob(checkArgument_CommandLine(&d->args, "sw")) != NULL;
+    d->isProfilingStartup     = contains_CommandLine(&d->args, "startup-profile");
     d->initialWindowRect      = init_Rect(-1, -1, 900, 560);
 #if defined (iPlatformMsys)
     /* Must scale by UI scaling factor. */
@@ -851,23 +964,39 @@ static void init_App_(iApp *d, int argc, char **argv) {
         mulfv_I2(&d->initialWindowRect.size, iMax(factor, 1.0f));
     }
 #endif
+    profileStartupPhase_App_(d, "resources and args");
+    init_SaveQueue();
+    init_Jobs();
+    init_ImageDecoder();
+    init_ImageCache();
+    init_ArchiveCache();
     init_Prefs(&d->prefs);
     init_SiteSpec(dataDir_App_());
     setCStr_String(&d->prefs.strings[downloadDir_PrefsString], downloadDir_App_());
     set_Atomic(&d->pendingRefresh, iFalse);
+    set_Atomic(&d->pendingFullRefresh, iFalse);
     d->isRunning = iFalse;
     d->window    = NULL;
     d->mimehooks = new_MimeHooks();
-    d->certs     = new_GmCerts(dataDir_App_());
+    d->certs     = NULL; /* loaded in the background */
     d->visited   = new_Visited();
     d->bookmarks = new_Bookmarks();
     init_Periodic(&d->periodic);
+    init_FramePacer(&d->pacer);
 #if defined (iPlatformAppleDesktop)
     setupApplication_MacOS();
 #endif
 #if defined (iPlatformAppleMobile)
     setupApplication_iOS();
 #endif
+    profileStartupPhase_App_(d, "core");
+    iStartupLoader loaders[] = {
+        { "certs",     loadCerts_App_     },
+        { "visited",   loadVisited_App_   },
+        { "bookmarks", loadBookmarks_App_ },
+        { "mimehooks", loadMimeHooks_App_ },
+    };
+    startLoaders_App_(loaders, iElemCount(loaders));
     init_Keys();
     init_Fonts(dataDir_App_());
     loadPalette_Color(dataDir_App_());
@@ -885,11 +1014,12 @@ static void init_App_(iApp *d, int argc, char **argv) {
             d->initialWindowRect.size.y = toInt_String(value_CommandLineArg(arg, 0));
         }
     }
+    profileStartupPhase_App_(d, "fonts and prefs");
+    /* The window's widgets may refer to any of the user data. */
+    finishLoaders_App_(d, loaders, iElemCount(loaders));
     init_PtrArray(&d->popupWindows);
     d->window = new_MainWindow(d->initialWindowRect);
-    load_Visited(d->visited, dataDir_App_());
-    load_Bookmarks(d->bookmarks, dataDir_App_());
-    load_MimeHooks(d->mimehooks, dataDir_App_());
+    profileStartupPhase_App_(d, "window");
     if (isFirstRun) {
         /* Create the default bookmarks for a quick start. */
         add_Bookmarks(d->bookmarks,
@@ -903,12 +1033,20 @@ static void init_App_(iApp *d, int argc, char **argv) {
                       NULL,
                       0x1f306);
     }
+    init_Resolver();
+    init_ResponseCache(concatPath_CStr(dataDir_App_(), "cache"));
+    init_RequestBroker();
+    init_Prefetch();
     init_Feeds(dataDir_App_());
+    init_Mirror(concatPath_CStr(dataDir_App_(), "mirrors"));
+    init_MemoryPressure();
+    profileStartupPhase_App_(d, "network and feeds");
     /* Widget state init. */
     processEvents_App(postedEventsOnly_AppEventMode);
     if (!loadState_App_(d)) {
         postCommand_Root(NULL, "open url:about:help");
     }
+    profileStartupPhase_App_(d, "state");
     postCommand_Root(NULL, "~window.unfreeze");
     postCommand_Root(NULL, "font.reset");
     d->autoReloadTimer = SDL_AddTimer(60 * 1000, postAutoReloadCommand_App_, NULL);
@@ -918,7 +1056,9 @@ static void init_App_(iApp *d, int argc, char **argv) {
     d->lastEventTime = 0;
     d->sleepTimer    = SDL_AddTimer(1000, checkAsleep_App_, d);
 #endif
+    lock_Mutex(&d->launchMutex);
     d->isFinishedLaunching = iTrue;
+    unlock_Mutex(&d->launchMutex);
     /* Run any commands that were pending completion of launch. */ {
         iForEach(StringList, i, d->launchCommands) {
             postCommandString_Root(NULL, i.value);
@@ -943,15 +1083,26 @@ static void deinit_App(iApp *d) {
     }
     iAssert(isEmpty_PtrArray(&d->popupWindows));
     deinit_PtrArray(&d->popupWindows);
+    deleteSparePopup_Window();
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
     SDL_RemoveTimer(d->sleepTimer);
 #endif
     SDL_RemoveTimer(d->autoReloadTimer);
+    deinit_MemoryPressure();
     saveState_App_(d);
     savePrefs_App_(d);
     delete_MainWindow(d->window);
     d->window = NULL;
+    deinit_Jobs(); /* cancelled decodes may still be running */
+    deinit_ImageDecoder();
+    deinit_ImageCache();
     deinit_Feeds();
+    deinit_Prefetch();
+    deinit_RequestBroker();
+    deinit_Mirror(); /* joins the crawler; no more requests fall back to the archives */
+    deinit_ArchiveCache();
+    deinit_ResponseCache();
+    deinit_Resolver();
     save_Keys(dataDir_App_());
     deinit_Keys();
     deinit_Fonts();
@@ -964,13 +1115,18 @@ static void deinit_App(iApp *d) {
     delete_GmCerts(d->certs);
     save_MimeHooks(d->mimehooks);
     delete_MimeHooks(d->mimehooks);
+    deinit_SaveQueue(); /* everything saved above gets written */
     d->window = NULL;
     deinit_CommandLine(&d->args);
     iRelease(d->launchCommands);
+    deinit_Mutex(&d->launchMutex);
     delete_String(d->execPath);
+    deinit_Profiler();
+    deinitTimingStats_GmRequest();
 #if defined (LAGRANGE_ENABLE_IPC)
     deinit_Ipc();
 #endif
+    deinit_SortedArray(&d->runningTickers);
     deinit_SortedArray(&d->tickers);
     deinit_Periodic(&d->periodic);
     deinit_Lang();
@@ -1045,6 +1201,75 @@ const iString *downloadPathForUrl_App(const iString *url, const iString *mime) {
     return collect_String(savePath);
 }
 
+static void appendMemoryRow_App_(iString *page, const char *label, size_t bytes) {
+    appendFormat_String(page, "%-24s %10.2f MB\n", label, bytes / 1.0e6);
+}
+
+const iString *memoryPage_App(void) {
+    iApp *       d      = &app_;
+    iString *    page   = collectNew_String();
+    iObjectList *docs   = iClob(listDocuments_App(NULL));
+    iMemInfo     hist   = { 0, 0 };
+    size_t       docMem = 0, docTex = 0;
+    format_String(page, "# Memory usage\n");
+    appendFormat_String(page,
+                        "Approximate sizes of what each part of the app is currently holding. "
+                        "Texture memory is allocated by the GPU driver. Reload the page to "
+                        "update the figures.\n");
+    appendCStr_String(page, "## Tabs\n```\n");
+    appendFormat_String(page, "%8s %8s %8s %8s  %s\n", "Document", "Textures", "History",
+                        "Cached", "Tab");
+    iConstForEach(ObjectList, i, docs) {
+        const iDocumentWidget *doc  = i.object;
+        const iMemInfo         mem  = memoryUsage_History(history_DocumentWidget((iDocumentWidget *) doc));
+        const size_t           dmem = memorySize_GmDocument(document_DocumentWidget(doc));
+        const size_t           dtex = textureSize_DocumentWidget(doc);
+        appendFormat_String(page, "%8.2f %8.2f %8.2f %8.2f  %s\n",
+                            dmem / 1.0e6,
+                            dtex / 1.0e6,
+                            mem.memorySize / 1.0e6,
+                            mem.cacheSize / 1.0e6,
+                            cstr_String(bookmarkTitle_DocumentWidget(doc)));
+        docMem += dmem;
+        docTex += dtex;
+        hist.memorySize += mem.memorySize;
+        hist.cacheSize += mem.cacheSize;
+    }
+    appendCStr_String(page, "```\n(sizes in MB)\n");
+    appendCStr_String(page, "## Subsystems\n```\n");
+    appendMemoryRow_App_(page, "Documents", docMem);
+    appendMemoryRow_App_(page, "History (in memory)", hist.memorySize);
+    appendMemoryRow_App_(page, "History (cached)", hist.cacheSize);
+    appendMemoryRow_App_(page, "Image textures", memorySize_ImageCache());
+    appendMemoryRow_App_(page, "Document textures", docTex);
+    appendMemoryRow_App_(page, "Glyph cache textures",
+                         d->window ? glyphCacheMemorySize_Text(text_Window(d->window)) : 0);
+    /* Fonts */ {
+        size_t loaded, mapped;
+        memoryUsage_Fonts(&loaded, &mapped);
+        appendMemoryRow_App_(page, "Fonts (loaded)", loaded);
+        appendMemoryRow_App_(page, "Fonts (mapped)", mapped);
+    }
+    appendMemoryRow_App_(page, "Archive entries", memorySize_ArchiveCache());
+    appendMemoryRow_App_(page, "Feed entries", memorySize_Feeds());
+    appendMemoryRow_App_(page, "Visited URLs", memorySize_Visited(d->visited));
+    appendMemoryRow_App_(page, "Bookmarks", memorySize_Bookmarks(d->bookmarks));
+    appendCStr_String(page, "```\n");
+    appendFormat_String(page,
+                        "Across all tabs, history is trimmed to %d MB in memory and %d MB of "
+                        "cached responses.\n",
+                        d->prefs.maxMemorySize,
+                        d->prefs.maxCacheSize);
+    appendCStr_String(page, "## Actions\n");
+    appendCStr_String(page,
+                      "=> about:command?memory.trim%20history:1 Release the cached pages of all tabs\n"
+                      "=> about:command?memory.trim%20images:1 Destroy unused image textures\n"
+                      "=> about:command?memory.trim%20archives:1 Close cached archives\n"
+                      "=> about:command?memory.trim%20history:1%20images:1%20archives:1 "
+                      "Trim all of the above\n");
+    return page;
+}
+
 const iString *debugInfo_App(void) {
     extern char **environ; /* The environment variables. */
     iApp *d = &app_;
@@ -1062,6 +1287,8 @@ const iString *debugInfo_App(void) {
         appendFormat_String(msg, "Total cache: %.3f MB\n", total.cacheSize / 1.0e6f);
         appendFormat_String(msg, "Total memory: %.3f MB\n", total.memorySize / 1.0e6f);
     }
+    appendFormat_String(msg, "=> about:memory Memory usage\n");
+    appendFormat_String(msg, "=> about:network Network timing\n");
     appendFormat_String(msg, "## Documents\n");
     iForEach(ObjectList, k, docs) {
         iDocumentWidget *doc = k.object;
@@ -1069,6 +1296,7 @@ const iString *debugInfo_App(void) {
                             constAs_Widget(doc)->root == get_Window()->roots[0] ? 1 : 2,
                             indexOfChild_Widget(constAs_Widget(doc)->parent, k.object) + 1,
                             cstr_String(bookmarkTitle_DocumentWidget(doc)));
+        append_String(msg, collect_String(renderInfo_DocumentWidget(doc)));
         append_String(msg, collect_String(debugInfo_History(history_DocumentWidget(doc))));
     }
     appendCStr_String(msg, "## Environment\n```\n");
@@ -1095,58 +1323,120 @@ static void clearCache_App_(void) {
     }
 }
 
-void trimCache_App(void) {
-    iApp *d = &app_;
-    size_t cacheSize = 0;
-    const size_t limit = d->prefs.maxCacheSize * 1000000;
-    iObjectList *docs = listDocuments_App(NULL);
-    iForEach(ObjectList, i, docs) {
-        cacheSize += cacheSize_History(history_DocumentWidget(i.object));
+static iPtrArray *listHistories_App_(void) {
+    iPtrArray *hists = new_PtrArray();
+    iConstForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
+        pushBack_PtrArray(hists, history_DocumentWidget((iDocumentWidget *) i.object));
     }
-    init_ObjectListIterator(&i, docs);
-    iBool wasPruned = iFalse;
-    while (cacheSize > limit) {
+    return hists;
+}
+
+iDeclareType(TabUsage)
+
+struct Impl_TabUsage {
+    iDocumentWidget *doc;
+    uint32_t         lastShownTime;
+    size_t           memorySize;
+};
+
+static int cmpLastShown_TabUsage_(const void *a, const void *b) {
+    const uint32_t t1 = ((const iTabUsage *) a)->lastShownTime;
+    const uint32_t t2 = ((const iTabUsage *) b)->lastShownTime;
+    return t1 < t2 ? -1 : t1 > t2 ? 1 : 0;
+}
+
+static void hibernateTabs_App_(iApp *d) {
+    /* Background tabs that haven't been shown for a while are hibernated. If the rest still
+       use more memory than allowed, the least recently shown ones are hibernated, too. */
+    const uint32_t now       = SDL_GetTicks();
+    const uint32_t idleLimit = (uint32_t) d->prefs.hibernateTabsAfter * 60 * 1000;
+    const size_t   budget    = (size_t) d->prefs.maxMemorySize * 1000000;
+    size_t         total     = 0;
+    iArray         tabs;
+    init_Array(&tabs, sizeof(iTabUsage));
+    iForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
         iDocumentWidget *doc = i.object;
-        const size_t pruned = pruneLeastImportant_History(history_DocumentWidget(doc));
-        if (pruned) {
-            cacheSize -= pruned;
-            wasPruned = iTrue;
+        if (isVisible_Widget(doc) || isHibernating_GmDocument(document_DocumentWidget(doc))) {
+            continue;
         }
-        next_ObjectListIterator(&i);
-        if (!i.value) {
-            if (!wasPruned) break;
-            wasPruned = iFalse;
-            init_ObjectListIterator(&i, docs);
+        if (idleLimit && now - lastShownTime_DocumentWidget(doc) >= idleLimit &&
+            hibernate_DocumentWidget(doc)) {
+            continue;
         }
+        const iTabUsage usage = { doc, lastShownTime_DocumentWidget(doc),
+                                  memorySize_DocumentWidget(doc) };
+        pushBack_Array(&tabs, &usage);
+        total += usage.memorySize;
     }
-    iRelease(docs);
+    if (budget && total > budget) {
+        sort_Array(&tabs, cmpLastShown_TabUsage_);
+        iConstForEach(Array, t, &tabs) {
+            const iTabUsage *usage = t.value;
+            if (total <= budget) {
+                break;
+            }
+            if (hibernate_DocumentWidget(usage->doc)) {
+                total -= iMin(total, usage->memorySize);
+            }
+        }
+    }
+    deinit_Array(&tabs);
+}
+
+void trimCache_App(void) {
+    iPtrArray *hists = listHistories_App_();
+    trimCache_History(hists, app_.prefs.maxCacheSize * 1000000);
+    delete_PtrArray(hists);
 }
 
 void trimMemory_App(void) {
-    iApp *d = &app_;
-    size_t memorySize = 0;
-    const size_t limit = d->prefs.maxMemorySize * 1000000;
-    iObjectList *docs = listDocuments_App(NULL);
-    iForEach(ObjectList, i, docs) {
-        memorySize += memorySize_History(history_DocumentWidget(i.object));
-    }
-    init_ObjectListIterator(&i, docs);
-    iBool wasPruned = iFalse;
-    while (memorySize > limit) {
-        iDocumentWidget *doc = i.object;
-        const size_t pruned = pruneLeastImportantMemory_History(history_DocumentWidget(doc));
-        if (pruned) {
-            memorySize -= pruned;
-            wasPruned = iTrue;
-        }
-        next_ObjectListIterator(&i);
-        if (!i.value) {
-            if (!wasPruned) break;
-            wasPruned = iFalse;
-            init_ObjectListIterator(&i, docs);
+    iPtrArray *hists = listHistories_App_();
+    trimMemory_History(hists, app_.prefs.maxMemorySize * 1000000);
+    delete_PtrArray(hists);
+    hibernateTabs_App_(&app_);
+}
+
+enum iMemoryTier {
+    none_MemoryTier,
+    buffers_MemoryTier,   /* rendered pages of background tabs */
+    documents_MemoryTier, /* cached documents in the navigation history */
+    images_MemoryTier,    /* image textures not in use */
+    responses_MemoryTier, /* cached and prefetched responses, open archives */
+};
+
+static const uint32_t escalateDuration_MemoryTier_ = 10000; /* ms */
+
+static void releaseMemory_App_(iApp *d, enum iMemoryPressure pressure) {
+    /* Each tier also releases everything in the tiers before it. A warning that arrives
+       soon after the previous one means that wasn't enough. */
+    const uint32_t now  = SDL_GetTicks();
+    int            tier = pressure == critical_MemoryPressure ? responses_MemoryTier
+                                                               : buffers_MemoryTier;
+    if (d->memoryTier && now - d->memoryTierTime < escalateDuration_MemoryTier_) {
+        tier = iMin(iMax(tier, d->memoryTier + 1), responses_MemoryTier);
+    }
+    d->memoryTier     = tier;
+    d->memoryTierTime = now;
+    if (tier >= buffers_MemoryTier) {
+        iForEach(ObjectList, i, iClob(listDocuments_App(NULL))) {
+            if (!isVisible_Widget(i.object)) {
+                releaseBuffers_DocumentWidget(i.object);
+            }
         }
     }
-    iRelease(docs);
+    if (tier >= documents_MemoryTier) {
+        iPtrArray *hists = listHistories_App_();
+        trimMemory_History(hists, 0); /* current pages are kept */
+        delete_PtrArray(hists);
+    }
+    if (tier >= images_MemoryTier) {
+        trim_ImageCache();
+    }
+    if (tier >= responses_MemoryTier) {
+        clearCache_App_();
+        clear_Prefetch();
+        clear_ArchiveCache();
+    }
 }
 
 #if 0
@@ -1163,10 +1453,24 @@ iBool findCachedContent_App(const iString *url, iString *mime_out, iBlock *data_
 }
 #endif
 
-iLocalDef iBool isWaitingAllowed_App_(iApp *d) {
-    if (!isEmpty_Periodic(&d->periodic)) {
-        return iFalse;
+#define iInvalidTime_Ticker_ UINT32_MAX
+
+static uint32_t nextTickerDue_App_(const iApp *d) {
+    /* Returns zero if a ticker should run in the next frame. */
+    uint32_t due = iInvalidTime_Ticker_;
+    iConstForEach(Array, i, &d->tickers.values) {
+        const iTicker *ticker = i.value;
+        if (ticker->due == 0) {
+            return 0;
+        }
+        if (due == iInvalidTime_Ticker_ || SDL_TICKS_PASSED(due, ticker->due)) {
+            due = ticker->due;
+        }
     }
+    return due;
+}
+
+iLocalDef iBool isWaitingAllowed_App_(iApp *d) {
     if (d->warmupFrames > 0) {
         return iFalse;
     }
@@ -1175,14 +1479,24 @@ iLocalDef iBool isWaitingAllowed_App_(iApp *d) {
         return iFalse;
     }
 #endif
-    return !value_Atomic(&d->pendingRefresh) && isEmpty_SortedArray(&d->tickers);
+    return !value_Atomic(&d->pendingRefresh) && nextTickerDue_App_(d) != 0;
 }
 
 static iBool nextEvent_App_(iApp *d, enum iAppEventMode eventMode, SDL_Event *event) {
+    if (eventMode == waitForNewEvents_AppEventMode && value_Atomic(&d->pendingRefresh)) {
+        /* Without vsync, a frame is not drawn before the display is ready for it. */
+        const uint32_t untilFrame = untilNextFrame_FramePacer(&d->pacer);
+        if (untilFrame) {
+            return SDL_WaitEventTimeout(event, (int) untilFrame);
+        }
+    }
     if (eventMode == waitForNewEvents_AppEventMode && isWaitingAllowed_App_(d)) {
-        /* If there are periodic commands pending, wait only for a short while. */
-        if (!isEmpty_Periodic(&d->periodic)) {
-            return SDL_WaitEventTimeout(event, 500);
+        /* Periodic commands post an event when they are due, so no need to poll for them. */
+        /* Sleep until the next delayed ticker is due. */
+        const uint32_t due = nextTickerDue_App_(d);
+        if (due != iInvalidTime_Ticker_) {
+            const uint32_t now = SDL_GetTicks();
+            return SDL_WaitEventTimeout(event, SDL_TICKS_PASSED(now, due) ? 0 : (int) (due - now));
         }
         /* We may be allowed to block here until an event comes in. */
         if (isWaitingAllowed_App_(d)) {
@@ -1201,6 +1515,62 @@ static iPtrArray *listWindows_App_(const iApp *d, iPtrArray *windows) {
     return windows;
 }
 
+static void coalesceMouseMotion_App_(SDL_Event *ev) {
+    /* High-polling-rate mice may queue many motion events per frame. Only the latest position
+       matters, so consecutive motion events are merged into one. */
+    SDL_Event next;
+    while (SDL_PeepEvents(&next, 1, SDL_PEEKEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) == 1 &&
+           next.type == SDL_MOUSEMOTION &&
+           next.motion.windowID == ev->motion.windowID &&
+           next.motion.which == ev->motion.which &&
+           next.motion.state == ev->motion.state) {
+        SDL_PeepEvents(&next, 1, SDL_GETEVENT, SDL_MOUSEMOTION, SDL_MOUSEMOTION);
+        next.motion.xrel += ev->motion.xrel;
+        next.motion.yrel += ev->motion.yrel;
+        ev->motion = next.motion;
+    }
+}
+
+static void coalesceMouseWheel_App_(SDL_Event *ev) {
+    /* Trackpads may report scrolling at up to 1000 Hz. The deltas of consecutive wheel events
+       are summed so each frame gets a single scroll update. */
+#if defined (iPlatformAppleDesktop)
+    if (ev->wheel.which != 0) {
+        return; /* mouse wheel steps are normalized individually */
+    }
+#endif
+    SDL_Event next;
+    while (SDL_PeepEvents(&next, 1, SDL_PEEKEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) == 1 &&
+           next.type == SDL_MOUSEWHEEL &&
+           next.wheel.windowID == ev->wheel.windowID &&
+           next.wheel.which == ev->wheel.which &&
+           next.wheel.direction == ev->wheel.direction) {
+        SDL_PeepEvents(&next, 1, SDL_GETEVENT, SDL_MOUSEWHEEL, SDL_MOUSEWHEEL);
+        next.wheel.x += ev->wheel.x;
+        next.wheel.y += ev->wheel.y;
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+        next.wheel.preciseX += ev->wheel.preciseX;
+        next.wheel.preciseY += ev->wheel.preciseY;
+#endif
+        ev->wheel = next.wheel;
+    }
+}
+
+static void coalesceFingerMotion_App_(SDL_Event *ev) {
+    /* Like mouse motion, only the latest position of a finger matters. The relative motion
+       is accumulated. */
+    SDL_Event next;
+    while (SDL_PeepEvents(&next, 1, SDL_PEEKEVENT, SDL_FIRSTEVENT, SDL_LASTEVENT) == 1 &&
+           next.type == SDL_FINGERMOTION &&
+           next.tfinger.touchId == ev->tfinger.touchId &&
+           next.tfinger.fingerId == ev->tfinger.fingerId) {
+        SDL_PeepEvents(&next, 1, SDL_GETEVENT, SDL_FINGERMOTION, SDL_FINGERMOTION);
+        next.tfinger.dx += ev->tfinger.dx;
+        next.tfinger.dy += ev->tfinger.dy;
+        ev->tfinger = next.tfinger;
+    }
+}
+
 void processEvents_App(enum iAppEventMode eventMode) {
     iApp *d = &app_;
     iRoot *oldCurrentRoot = current_Root(); /* restored afterwards */
@@ -1224,7 +1594,7 @@ void processEvents_App(enum iAppEventMode eventMode) {
                 }
                 goto backToMainLoop;
             case SDL_APP_LOWMEMORY:
-                clearCache_App_();
+                releaseMemory_App_(d, critical_MemoryPressure);
                 break;
             case SDL_APP_WILLENTERFOREGROUND:
                 invalidate_Window(as_Window(d->window));
@@ -1245,11 +1615,13 @@ void processEvents_App(enum iAppEventMode eventMode) {
                 setFreezeDraw_MainWindow(d->window, iTrue);
                 savePrefs_App_(d);
                 saveState_App_(d);
+                flush_SaveQueue(); /* the app may be killed while in the background */
                 break;
             case SDL_APP_TERMINATING:
                 setFreezeDraw_MainWindow(d->window, iTrue);
                 savePrefs_App_(d);
                 saveState_App_(d);
+                flush_SaveQueue();
                 break;
             case SDL_DROPFILE: {
                 iBool wasUsed = processEvent_Window(as_Window(d->window), &ev);
@@ -1273,6 +1645,10 @@ void processEvents_App(enum iAppEventMode eventMode) {
                 break;
             }
             default: {
+                if (ev.type == SDL_USEREVENT && ev.user.code == periodic_UserEventCode) {
+                    dispatchCommands_Periodic(&d->periodic);
+                    continue;
+                }
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
                 if (ev.type == SDL_USEREVENT && ev.user.code == asleep_UserEventCode) {
                     if (SDL_GetTicks() - d->lastEventTime > idleThreshold_App_ &&
@@ -1293,6 +1669,15 @@ void processEvents_App(enum iAppEventMode eventMode) {
                 d->isIdling = iFalse;
 #endif
                 gotEvents = iTrue;
+                if (ev.type == SDL_MOUSEMOTION) {
+                    coalesceMouseMotion_App_(&ev);
+                }
+                else if (ev.type == SDL_MOUSEWHEEL) {
+                    coalesceMouseWheel_App_(&ev);
+                }
+                else if (ev.type == SDL_FINGERMOTION) {
+                    coalesceFingerMotion_App_(&ev);
+                }
                 /* Keyboard modifier mapping. */
                 if (ev.type == SDL_KEYDOWN || ev.type == SDL_KEYUP) {
                     /* Track Caps Lock state as a modifier. */
@@ -1370,6 +1755,7 @@ void processEvents_App(enum iAppEventMode eventMode) {
 #endif
                 /* Per-window processing. */
                 iBool wasUsed = iFalse;
+                start_ProfilerScope(events);
                 listWindows_App_(d, &windows);
                 iConstForEach(PtrArray, iter, &windows) {
                     iWindow *window = iter.ptr;
@@ -1381,6 +1767,7 @@ void processEvents_App(enum iAppEventMode eventMode) {
                     }
                     if (wasUsed) break;
                 }
+                stop_ProfilerScope(events);
                 setCurrent_Window(d->window);
                 if (!wasUsed) {
                     /* There may be a key binding for this. */
@@ -1450,27 +1837,56 @@ backToMainLoop:;
     setCurrent_Root(oldCurrentRoot);
 }
 
+static iBool isInputPending_App_(void) {
+    return SDL_HasEvents(SDL_KEYDOWN, SDL_MULTIGESTURE);
+}
+
 static void runTickers_App_(iApp *d) {
     const uint32_t now = SDL_GetTicks();
-    d->elapsedSinceLastTicker = (d->lastTickerTime ? now - d->lastTickerTime : 0);
-    d->lastTickerTime = now;
-    if (isEmpty_SortedArray(&d->tickers)) {
-        d->lastTickerTime = 0;
+    const uint32_t due = nextTickerDue_App_(d);
+    if (due == iInvalidTime_Ticker_ || (due && !SDL_TICKS_PASSED(now, due))) {
+        d->lastTickerTime = 0; /* nothing to run in this frame */
         return;
     }
-    /* Tickers may add themselves again, so we'll run off a copy. */
-    iSortedArray *pending = copy_SortedArray(&d->tickers);
-    clear_SortedArray(&d->tickers);
-    postRefresh_App();
-    iConstForEach(Array, i, &pending->values) {
-        const iTicker *ticker = i.value;
-        if (ticker->callback) {
-            setCurrent_Root(ticker->root); /* root might be NULL */
-            ticker->callback(ticker->context);
+    d->elapsedSinceLastTicker = (d->lastTickerTime ? now - d->lastTickerTime : 0);
+    d->lastTickerTime = now;
+    /* Tickers may add themselves again, so we'll run off the current set. */
+    iSortedArray swap  = d->runningTickers;
+    d->runningTickers  = d->tickers;
+    d->tickers         = swap;
+    iBool didRun       = iFalse;
+    start_ProfilerScope(tickers);
+    /* Time-critical tickers first. */
+    for (int prio = normal_TickerPriority; prio <= background_TickerPriority; prio++) {
+        const iBool yieldToInput = (prio == background_TickerPriority && isInputPending_App_());
+        iForEach(Array, i, &d->runningTickers.values) {
+            iTicker *ticker = i.value;
+            if (!ticker->callback || ticker->priority != prio) {
+                continue;
+            }
+            if ((ticker->due && !SDL_TICKS_PASSED(now, ticker->due)) || yieldToInput ||
+                (prio == background_TickerPriority &&
+                 isOverBudget_FramePacer(&d->pacer))) {
+                /* Postponed to a later frame, unless it was already added again. */
+                size_t pos;
+                if (!locate_SortedArray(&d->tickers, ticker, &pos)) {
+                    insert_SortedArray(&d->tickers, ticker);
+                }
+                continue;
+            }
+            iTicker run = *ticker;
+            ticker->callback = NULL; /* already run */
+            setCurrent_Root(run.root); /* root might be NULL */
+            run.callback(run.context);
+            didRun = iTrue;
         }
     }
+    stop_ProfilerScope(tickers);
     setCurrent_Root(NULL);
-    delete_SortedArray(pending);
+    clear_SortedArray(&d->runningTickers);
+    if (didRun) {
+        postRefresh_App();
+    }
     if (isEmpty_SortedArray(&d->tickers)) {
         d->lastTickerTime = 0;
     }
@@ -1481,7 +1897,9 @@ static int resizeWatcher_(void *user, SDL_Event *event) {
     if (event->type == SDL_WINDOWEVENT && event->window.event == SDL_WINDOWEVENT_SIZE_CHANGED) {
         const SDL_WindowEvent *winev = &event->window;
 #if defined (iPlatformMsys)
-        resetFonts_Text(text_Window(d->window)); {
+        /* Resizing resets the render targets. The glyphs are restored from their CPU-side
+           copies, and the UI buffers are invalidated without reapplying fonts. */
+        restoreGlyphCache_Text(text_Window(d->window)); {
             SDL_Event u = { .type = SDL_USEREVENT };
             u.user.code = command_UserEventCode;
             u.user.data1 = strdup("theme.changed auto:1");
@@ -1508,6 +1926,7 @@ static int run_App_(iApp *d) {
     while (d->isRunning) {
         dispatchCommands_Periodic(&d->periodic);
         processEvents_App(waitForNewEvents_AppEventMode);
+        beginFrame_FramePacer(&d->pacer);
         runTickers_App_(d);
         refresh_App();
         /* Change the widget tree while we are not iterating through it. */
@@ -1542,23 +1961,29 @@ void refresh_App(void) {
     }
     /* TODO: `pendingRefresh` should be window-specific. */
     if (exchange_Atomic(&d->pendingRefresh, iFalse)) {
+        const iBool isFull = exchange_Atomic(&d->pendingFullRefresh, iFalse);
+        const uint64_t frameStart = begin_Profiler();
+        beginRender_FramePacer(&d->pacer);
         /* Draw each window. */
         iConstForEach(PtrArray, j, &windows) {
             iWindow *win = j.ptr;
             setCurrent_Window(win);
+            if (isFull) {
+                damageAll_Window(win);
+            }
+            start_ProfilerScope(draw);
             switch (win->type) {
                 case main_WindowType:
-    //                iTime draw;
-    //                initCurrent_Time(&draw);
                     draw_MainWindow(as_MainWindow(win));
-    //                printf("draw: %lld \u03bcs\n", (long long) (elapsedSeconds_Time(&draw) * 1000000));
-    //                fflush(stdout);
                     break;
                 default:
                     draw_Window(win);
                     break;
             }
+            stop_ProfilerScope(draw);
         }
+        endRender_FramePacer(&d->pacer);
+        endFrame_Profiler(frameStart);
     }
     if (d->warmupFrames > 0) {
         d->warmupFrames--;
@@ -1619,12 +2044,21 @@ const iString *schemeProxy_App(iRangecc scheme) {
 
 int run_App(int argc, char **argv) {
     init_App_(&app_, argc, argv);
+#if defined (LAGRANGE_ENABLE_BENCHMARK)
+    const int rc = run_Benchmark();
+#else
     const int rc = run_App_(&app_);
+#endif
     deinit_App(&app_);
     return rc;
 }
 
 void postRefresh_App(void) {
+    set_Atomic(&app_.pendingFullRefresh, iTrue);
+    postDamagedRefresh_App();
+}
+
+void postDamagedRefresh_App(void) {
     iApp *d = &app_;
 #if defined (LAGRANGE_ENABLE_IDLE_SLEEP)
     d->isIdling = iFalse;
@@ -1649,10 +2083,13 @@ void postCommand_Root(iRoot *d, const char *command) {
     if (*command == '~') {
         /* Requires launch to be finished; defer it if needed. */
         command++;
+        lock_Mutex(&app_.launchMutex);
         if (!app_.isFinishedLaunching) {
             pushBackCStr_StringList(app_.launchCommands, command);
+            unlock_Mutex(&app_.launchMutex);
             return;
         }
+        unlock_Mutex(&app_.launchMutex);
     }
     SDL_Event ev = { .type = SDL_USEREVENT };
     ev.user.code = command_UserEventCode;
@@ -1714,19 +2151,40 @@ iAny *findWidget_App(const char *id) {
 
 void addTicker_App(iTickerFunc ticker, iAny *context) {
     iApp *d = &app_;
-    insert_SortedArray(&d->tickers, &(iTicker){ context, get_Root(), ticker });
+    insert_SortedArray(&d->tickers, &(iTicker){ context, get_Root(), ticker, normal_TickerPriority, 0 });
     postRefresh_App();
 }
 
 void addTickerRoot_App(iTickerFunc ticker, iRoot *root, iAny *context) {
     iApp *d = &app_;
-    insert_SortedArray(&d->tickers, &(iTicker){ context, root, ticker });
+    insert_SortedArray(&d->tickers, &(iTicker){ context, root, ticker, normal_TickerPriority, 0 });
     postRefresh_App();
 }
 
+void addBackgroundTicker_App(iTickerFunc ticker, iAny *context) {
+    iApp *d = &app_;
+    insert_SortedArray(&d->tickers,
+                       &(iTicker){ context, get_Root(), ticker, background_TickerPriority, 0 });
+    postRefresh_App();
+}
+
+void addDelayedTicker_App(iTickerFunc ticker, iAny *context, uint32_t delayMs) {
+    iApp *d = &app_;
+    /* No refresh needed; the main loop wakes up when the ticker is due. */
+    insert_SortedArray(&d->tickers,
+                       &(iTicker){ context, get_Root(), ticker, normal_TickerPriority,
+                                   iMax(1u, SDL_GetTicks() + delayMs) });
+}
+
 void removeTicker_App(iTickerFunc ticker, iAny *context) {
     iApp *d = &app_;
-    remove_SortedArray(&d->tickers, &(iTicker){ context, NULL, ticker });
+    const iTicker key = { context, NULL, ticker };
+    remove_SortedArray(&d->tickers, &key);
+    /* It may also be waiting to be run in the current frame. */
+    size_t pos;
+    if (locate_SortedArray(&d->runningTickers, &key, &pos)) {
+        ((iTicker *) at_Array(&d->runningTickers.values, pos))->callback = NULL;
+    }
 }
 
 void addPopup_App(iWindow *popup) {
@@ -1747,6 +2205,10 @@ iPeriodic *periodic_App(void) {
     return &app_.periodic;
 }
 
+iFramePacer *framePacer_App(void) {
+    return &app_.pacer;
+}
+
 iBool isLandscape_App(void) {
     const iInt2 size = size_Window(get_Window());
     return size.x > size.y;
@@ -1850,12 +2312,18 @@ static iBool handlePrefsCommands_(iWidget *d, const char *cmd) {
                          cstrText_InputWidget(findChild_Widget(d, "prefs.userfont")));
         postCommandf_App("decodeurls arg:%d",
                          isSelected_Widget(findChild_Widget(d, "prefs.decodeurls")));
+        postCommandf_App("prefetchlinks arg:%d",
+                         isSelected_Widget(findChild_Widget(d, "prefs.prefetchlinks")));
         postCommandf_App("searchurl address:%s",
                          cstrText_InputWidget(findChild_Widget(d, "prefs.searchurl")));
         postCommandf_App("cachesize.set arg:%d",
                          toInt_String(text_InputWidget(findChild_Widget(d, "prefs.cachesize"))));
         postCommandf_App("memorysize.set arg:%d",
                          toInt_String(text_InputWidget(findChild_Widget(d, "prefs.memorysize"))));
+        postCommandf_App("hibernate.set arg:%d",
+                         toInt_String(text_InputWidget(findChild_Widget(d, "prefs.hibernate"))));
+        postCommandf_App("mirrordepth.set arg:%d",
+                         toInt_String(text_InputWidget(findChild_Widget(d, "prefs.mirrordepth"))));
         postCommandf_App("ca.file path:%s",
                          cstrText_InputWidget(findChild_Widget(d, "prefs.ca.file")));
         postCommandf_App("ca.path path:%s",
@@ -2365,6 +2833,10 @@ iBool handleCommand_App(const char *cmd) {
         d->prefs.decodeUserVisibleURLs = arg_Command(cmd);
         return iTrue;
     }
+    else if (equal_Command(cmd, "prefetchlinks")) {
+        d->prefs.prefetchLinks = arg_Command(cmd);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "imageloadscroll")) {
         d->prefs.loadImageInsteadOfScrolling = arg_Command(cmd);
         return iTrue;
@@ -2553,6 +3025,69 @@ iBool handleCommand_App(const char *cmd) {
         postRefresh_App();
         return iTrue;
     }
+    else if (equal_Command(cmd, "profiler.toggle")) {
+        setEnabled_Profiler(!isEnabled_Profiler());
+        postRefresh_App();
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "profiler.save")) {
+        const char *path = concatPath_CStr(dataDir_App_(), "trace.json");
+        iString *   json = traceEvents_Profiler();
+        iFile *     f    = newCStr_File(path);
+        if (open_File(f, writeOnly_FileMode | text_FileMode)) {
+            write_File(f, &json->chars);
+            makeSimpleMessage_Widget("Profiler",
+                                     format_CStr("Trace events saved to:\n%s", path));
+        }
+        iRelease(f);
+        delete_String(json);
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "memory.pressure")) {
+        releaseMemory_App_(d, argLabel_Command(cmd, "level"));
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "memory.trim")) {
+        if (argLabel_Command(cmd, "history")) {
+            clearCache_App_();
+        }
+        if (argLabel_Command(cmd, "images")) {
+            trim_ImageCache();
+        }
+        if (argLabel_Command(cmd, "archives")) {
+            clear_ArchiveCache();
+        }
+        /* Show the updated figures. */
+        if (equal_String(url_DocumentWidget(document_App()), collectNewCStr_String("about:memory"))) {
+            postCommand_App("navigate.reload");
+        }
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "debug.trace.start")) {
+        setTracing_Profiler(iTrue);
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "debug.trace.stop")) {
+        if (!isTracing_Profiler()) {
+            return iTrue;
+        }
+        setTracing_Profiler(iFalse);
+        iDate now;
+        initCurrent_Date(&now);
+        const iString *path = collect_String(
+            concat_Path(downloadDir_App(),
+                        collect_String(format_Date(&now, "lagrange-trace_%Y-%m-%d_%H%M%S.json"))));
+        iString *json = traceEvents_Profiler();
+        iFile *  f    = new_File(path);
+        if (open_File(f, writeOnly_FileMode | text_FileMode)) {
+            write_File(f, &json->chars);
+            makeSimpleMessage_Widget("Profiler",
+                                     format_CStr("Trace saved to:\n%s", cstr_String(path)));
+        }
+        iRelease(f);
+        delete_String(json);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "prefs.hoverlink.toggle")) {
         d->prefs.hoverLink = !d->prefs.hoverLink;
         postRefresh_App();
@@ -2590,6 +3125,9 @@ iBool handleCommand_App(const char *cmd) {
         if (d->prefs.maxCacheSize <= 0) {
             d->prefs.maxCacheSize = 0;
         }
+        if (d->window) {
+            trimCache_App();
+        }
         return iTrue;
     }
     else if (equal_Command(cmd, "memorysize.set")) {
@@ -2599,6 +3137,18 @@ iBool handleCommand_App(const char *cmd) {
         }
         return iTrue;
     }
+    else if (equal_Command(cmd, "hibernate.set")) {
+        d->prefs.hibernateTabsAfter = iMax(0, arg_Command(cmd));
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "tabs.hibernate")) {
+        hibernateTabs_App_(d);
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "mirrordepth.set")) {
+        d->prefs.mirrorDepth = iClamp(arg_Command(cmd), 1, 9);
+        return iTrue;
+    }
     else if (equal_Command(cmd, "searchurl")) {
         iString *url = &d->prefs.strings[searchUrl_PrefsString];
         setCStr_String(url, suffixPtr_Command(cmd, "address"));
@@ -2965,7 +3515,12 @@ iBool handleCommand_App(const char *cmd) {
                             collectNewFormat_String("%d", d->prefs.maxCacheSize));
         setText_InputWidget(findChild_Widget(dlg, "prefs.memorysize"),
                             collectNewFormat_String("%d", d->prefs.maxMemorySize));
+        setText_InputWidget(findChild_Widget(dlg, "prefs.hibernate"),
+                            collectNewFormat_String("%d", d->prefs.hibernateTabsAfter));
+        setText_InputWidget(findChild_Widget(dlg, "prefs.mirrordepth"),
+                            collectNewFormat_String("%d", d->prefs.mirrorDepth));
         setToggle_Widget(findChild_Widget(dlg, "prefs.decodeurls"), d->prefs.decodeUserVisibleURLs);
+        setToggle_Widget(findChild_Widget(dlg, "prefs.prefetchlinks"), d->prefs.prefetchLinks);
         setText_InputWidget(findChild_Widget(dlg, "prefs.searchurl"), &d->prefs.strings[searchUrl_PrefsString]);
         setText_InputWidget(findChild_Widget(dlg, "prefs.ca.file"), &d->prefs.strings[caFile_PrefsString]);
         setText_InputWidget(findChild_Widget(dlg, "prefs.ca.path"), &d->prefs.strings[caPath_PrefsString]);
@@ -3072,6 +3627,32 @@ iBool handleCommand_App(const char *cmd) {
         save_Bookmarks(d->bookmarks, dataDir_App_());
         return iFalse;
     }
+    else if (equal_Command(cmd, "mirror.start")) {
+        const iDocumentWidget *doc = document_App();
+        if (doc && !isActive_Mirror()) {
+            start_Mirror(url_DocumentWidget(doc), d->prefs.mirrorDepth);
+        }
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "mirror.stop")) {
+        stop_Mirror();
+        return iTrue;
+    }
+    else if (equal_Command(cmd, "mirror.finished")) {
+        finished_Mirror();
+        const unsigned numSaved = arg_Command(cmd);
+        const char    *host     = suffixPtr_Command(cmd, "host");
+        if (numSaved) {
+            makeSimpleMessage_Widget("${heading.mirror}",
+                                     format_CStr(cstrCount_Lang("mirror.saved.n", numSaved),
+                                                 numSaved, host));
+        }
+        else {
+            makeSimpleMessage_Widget(orange_ColorEscape "${heading.mirror.failed}",
+                                     format_CStr(cstr_Lang("dlg.mirror.failed"), host));
+        }
+        return iFalse;
+    }
     else if (equal_Command(cmd, "feeds.refresh")) {
         refresh_Feeds();
         return iTrue;
@@ -32,6 +32,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 iDeclareType(Bookmarks)
 iDeclareType(DocumentWidget)
+iDeclareType(FramePacer)
 iDeclareType(GmCerts)
 iDeclareType(MainWindow)
 iDeclareType(MimeHooks)
@@ -61,6 +62,7 @@ enum iUserEventCode {
     command_UserEventCode = 1,
     refresh_UserEventCode,
     asleep_UserEventCode,
+    periodic_UserEventCode, /* a periodic command is due */
     /* The start of a potential touch tap event is notified via a custom event because
        sending SDL_MOUSEBUTTONDOWN would be premature: we don't know how long the tap will
        take, it could turn into a tap-and-hold for example. */
@@ -72,6 +74,7 @@ const iString *execPath_App     (void);
 const iString *dataDir_App      (void);
 const iString *downloadDir_App  (void);
 const iString *debugInfo_App    (void);
+const iString *memoryPage_App   (void);
 
 int         run_App                     (int argc, char **argv);
 void        rootOrder_App               (iRoot *roots[2]); /* TODO: max roots? */
@@ -93,6 +96,7 @@ iVisited *          visited_App         (void);
 iBookmarks *        bookmarks_App       (void);
 iMimeHooks *        mimeHooks_App       (void);
 iPeriodic *         periodic_App        (void);
+iFramePacer *       framePacer_App      (void);
 iDocumentWidget *   document_App        (void);
 iObjectList *       listDocuments_App   (const iRoot *rootOrNull); /* NULL for all roots */
 iStringSet *        listOpenURLs_App    (void); /* all tabs */
@@ -114,13 +118,21 @@ const iString *     downloadPathForUrl_App(const iString *url, const iString *mi
 
 typedef void (*iTickerFunc)(iAny *);
 
+enum iTickerPriority {
+    normal_TickerPriority,     /* every frame, e.g., animations */
+    background_TickerPriority, /* within the frame budget, and only when no input is pending */
+};
+
 iAny *      findWidget_App      (const char *id);
 void        addTicker_App       (iTickerFunc ticker, iAny *context);
 void        addTickerRoot_App   (iTickerFunc ticker, iRoot *root, iAny *context);
+void        addBackgroundTicker_App(iTickerFunc ticker, iAny *context);
+void        addDelayedTicker_App(iTickerFunc ticker, iAny *context, uint32_t delayMs);
 void        removeTicker_App    (iTickerFunc ticker, iAny *context);
 void        addPopup_App        (iWindow *popup);
 void        removePopup_App     (iWindow *popup);
 void        postRefresh_App     (void);
+void        postDamagedRefresh_App (void); /* only redraw regions damaged by widgets */
 void        postCommand_Root    (iRoot *, const char *command);
 void        postCommandf_Root   (iRoot *, const char *command, ...);
 void        postCommandf_App    (const char *command, ...);
@@ -0,0 +1,257 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "archivecache.h"
+
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/time.h>
+
+iDeclareType(ArchiveCache)
+iDeclareType(CachedArchive)
+iDeclareType(CachedEntry)
+
+enum iArchiveCacheLimits {
+    maxArchives_ArchiveCache = 4,
+#if defined (iPlatformMobile)
+    maxEntrySize_ArchiveCache = 8 * 1024 * 1024,
+#else
+    maxEntrySize_ArchiveCache = 32 * 1024 * 1024,
+#endif
+};
+
+struct Impl_CachedArchive {
+    iString   path;
+    size_t    size; /* file size when opened */
+    iTime     modified; /* file modification time when opened */
+    iArchive *arch;
+};
+
+static void init_CachedArchive(iCachedArchive *d, const iString *path) {
+    initCopy_String(&d->path, path);
+    d->size = 0;
+    iZap(d->modified);
+    d->arch = NULL;
+}
+
+static void deinit_CachedArchive(iCachedArchive *d) {
+    iRelease(d->arch);
+    deinit_String(&d->path);
+}
+
+iDefineTypeConstructionArgs(CachedArchive, (const iString *path), path)
+
+struct Impl_CachedEntry {
+    iString path;
+    iString entryPath;
+    iBlock  data;
+};
+
+static void init_CachedEntry(iCachedEntry *d, const iString *path, const iString *entryPath) {
+    initCopy_String(&d->path, path);
+    initCopy_String(&d->entryPath, entryPath);
+    init_Block(&d->data, 0);
+}
+
+static void deinit_CachedEntry(iCachedEntry *d) {
+    deinit_Block(&d->data);
+    deinit_String(&d->entryPath);
+    deinit_String(&d->path);
+}
+
+iDefineTypeConstructionArgs(CachedEntry, (const iString *path, const iString *entryPath),
+                            path, entryPath)
+
+/*----------------------------------------------------------------------------------------------*/
+
+struct Impl_ArchiveCache {
+    iMutex    mtx;
+    iPtrArray archives; /* iCachedArchive; most recently used last */
+    iPtrArray entries;  /* iCachedEntry; most recently used last */
+    size_t    entriesSize;
+};
+
+static iArchiveCache *cache_;
+
+static iCachedEntry *findEntry_ArchiveCache_(iArchiveCache *d, const iString *path,
+                                             const iString *entryPath) {
+    /* `mtx` must be locked. The found entry becomes the most recently used one. */
+    iForEach(PtrArray, i, &d->entries) {
+        iCachedEntry *entry = i.ptr;
+        if (equal_String(&entry->entryPath, entryPath) && equal_String(&entry->path, path)) {
+            remove_PtrArrayIterator(&i);
+            pushBack_PtrArray(&d->entries, entry);
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void forgetEntries_ArchiveCache_(iArchiveCache *d, const iString *path) {
+    /* `mtx` must be locked. */
+    iForEach(PtrArray, i, &d->entries) {
+        iCachedEntry *entry = i.ptr;
+        if (equal_String(&entry->path, path)) {
+            d->entriesSize -= size_Block(&entry->data);
+            delete_CachedEntry(entry);
+            remove_PtrArrayIterator(&i);
+        }
+    }
+}
+
+static iArchive *openLocked_ArchiveCache_(iArchiveCache *d, const iString *path) {
+    /* `mtx` must be locked. */
+    /* A rewritten archive may well have the same size. */
+    iFileInfo   *info     = new_FileInfo(path);
+    const iBool  isFound  = exists_FileInfo(info);
+    const size_t size     = isFound ? size_FileInfo(info) : 0;
+    const iTime  modified = isFound ? lastModified_FileInfo(info) : (iTime){ 0 };
+    iRelease(info);
+    if (!isFound) {
+        return NULL;
+    }
+    iForEach(PtrArray, i, &d->archives) {
+        iCachedArchive *ca = i.ptr;
+        if (equal_String(&ca->path, path)) {
+            remove_PtrArrayIterator(&i);
+            if (ca->size == size && ca->modified.ts.tv_sec == modified.ts.tv_sec &&
+                ca->modified.ts.tv_nsec == modified.ts.tv_nsec) {
+                pushBack_PtrArray(&d->archives, ca);
+                return ref_Object(ca->arch);
+            }
+            delete_CachedArchive(ca); /* modified since */
+            break;
+        }
+    }
+    /* Any previously decompressed entries may be out of date. */
+    forgetEntries_ArchiveCache_(d, path);
+    iArchive *arch = new_Archive();
+    if (!openFile_Archive(arch, path)) {
+        iRelease(arch);
+        return NULL;
+    }
+    iCachedArchive *ca = new_CachedArchive(path);
+    ca->size     = size;
+    ca->modified = modified;
+    ca->arch     = arch;
+    pushBack_PtrArray(&d->archives, ca);
+    if (size_PtrArray(&d->archives) > maxArchives_ArchiveCache) {
+        iCachedArchive *oldest = NULL;
+        take_PtrArray(&d->archives, 0, (void **) &oldest);
+        delete_CachedArchive(oldest);
+    }
+    return ref_Object(arch);
+}
+
+static iBlock *read_ArchiveCache_(iArchiveCache *d, const iString *path,
+                                  const iString *entryPath) {
+    /* `mtx` must be locked. */
+    iArchive *arch = openLocked_ArchiveCache_(d, path);
+    if (!arch) {
+        return NULL;
+    }
+    iCachedEntry *entry = findEntry_ArchiveCache_(d, path, entryPath);
+    if (entry) {
+        iRelease(arch);
+        return copy_Block(&entry->data);
+    }
+    const iBlock *data = data_Archive(arch, entryPath);
+    iBlock *      copy = data ? copy_Block(data) : NULL;
+    iRelease(arch);
+    if (copy && size_Block(copy) <= maxEntrySize_ArchiveCache / 4) {
+        entry = new_CachedEntry(path, entryPath);
+        set_Block(&entry->data, copy);
+        pushBack_PtrArray(&d->entries, entry);
+        d->entriesSize += size_Block(copy);
+        while (d->entriesSize > maxEntrySize_ArchiveCache) {
+            iCachedEntry *oldest = NULL;
+            take_PtrArray(&d->entries, 0, (void **) &oldest);
+            d->entriesSize -= size_Block(&oldest->data);
+            delete_CachedEntry(oldest);
+        }
+    }
+    return copy;
+}
+
+void init_ArchiveCache(void) {
+    iArchiveCache *d = iMalloc(ArchiveCache);
+    init_Mutex(&d->mtx);
+    init_PtrArray(&d->archives);
+    init_PtrArray(&d->entries);
+    d->entriesSize = 0;
+    cache_ = d;
+}
+
+void deinit_ArchiveCache(void) {
+    iArchiveCache *d = cache_;
+    iForEach(PtrArray, e, &d->entries) {
+        delete_CachedEntry(e.ptr);
+    }
+    deinit_PtrArray(&d->entries);
+    iForEach(PtrArray, a, &d->archives) {
+        delete_CachedArchive(a.ptr);
+    }
+    deinit_PtrArray(&d->archives);
+    deinit_Mutex(&d->mtx);
+    free(d);
+    cache_ = NULL;
+}
+
+iArchive *open_ArchiveCache(const iString *path) {
+    iArchiveCache *d = cache_;
+    lock_Mutex(&d->mtx);
+    iArchive *arch = openLocked_ArchiveCache_(d, path);
+    unlock_Mutex(&d->mtx);
+    return arch;
+}
+
+iBlock *readEntry_ArchiveCache(const iString *path, const iString *entryPath) {
+    iArchiveCache *d = cache_;
+    lock_Mutex(&d->mtx);
+    iBlock *data = read_ArchiveCache_(d, path, entryPath);
+    unlock_Mutex(&d->mtx);
+    return data;
+}
+
+size_t memorySize_ArchiveCache(void) {
+    iArchiveCache *d = cache_;
+    lock_Mutex(&d->mtx);
+    const size_t size = d->entriesSize;
+    unlock_Mutex(&d->mtx);
+    return size;
+}
+
+void clear_ArchiveCache(void) {
+    iArchiveCache *d = cache_;
+    lock_Mutex(&d->mtx);
+    iForEach(PtrArray, e, &d->entries) {
+        delete_CachedEntry(e.ptr);
+    }
+    clear_PtrArray(&d->entries);
+    d->entriesSize = 0;
+    iForEach(PtrArray, a, &d->archives) {
+        delete_CachedArchive(a.ptr); /* readers keep their own references */
+    }
+    clear_PtrArray(&d->archives);
+    unlock_Mutex(&d->mtx);
+}
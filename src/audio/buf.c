@@ -28,17 +28,71 @@ void init_InputBuf(iInputBuf *d) {
     init_Mutex(&d->mtx);
     init_Condition(&d->changed);
     init_Block(&d->data, 0);
-    d->isComplete = iTrue;
+    d->discarded   = 0;
+    d->isComplete  = iTrue;
+    d->isStreaming = iFalse;
+    init_Array(&d->seekIndex, sizeof(iSeekPoint));
 }
 
 void deinit_InputBuf(iInputBuf *d) {
+    deinit_Array(&d->seekIndex);
     deinit_Block(&d->data);
     deinit_Condition(&d->changed);
     deinit_Mutex(&d->mtx);
 }
 
 size_t size_InputBuf(const iInputBuf *d) {
-    return size_Block(&d->data);
+    return d->discarded + size_Block(&d->data);
+}
+
+void discard_InputBuf(iInputBuf *d, size_t pos) {
+    /* Memory is moved only after enough input has been consumed. */
+    const size_t minDiscard = 256 * 1024;
+    if (d->isStreaming && pos >= d->discarded + minDiscard) {
+        iAssert(pos <= size_InputBuf(d));
+        remove_Block(&d->data, 0, pos - d->discarded);
+        d->discarded = pos;
+    }
+}
+
+void addSeekPoint_InputBuf(iInputBuf *d, uint64_t sample, size_t pos, uint64_t minInterval) {
+    /* Points are kept sparse; ones too close to an existing neighbor are not needed. */
+    size_t index = size_Array(&d->seekIndex);
+    while (index > 0 && ((const iSeekPoint *) at_Array(&d->seekIndex, index - 1))->pos > pos) {
+        index--;
+    }
+    if (index > 0) {
+        const iSeekPoint *prev = at_Array(&d->seekIndex, index - 1);
+        if (prev->pos == pos || sample < prev->sample + minInterval) {
+            return;
+        }
+    }
+    if (index < size_Array(&d->seekIndex)) {
+        const iSeekPoint *next = at_Array(&d->seekIndex, index);
+        if (next->sample < sample + minInterval) {
+            return;
+        }
+    }
+    insert_Array(&d->seekIndex, index, &(iSeekPoint){ sample, pos });
+}
+
+iBool findSeekPoint_InputBuf(const iInputBuf *d, uint64_t sample, iSeekPoint *point_out) {
+    /* Finds the last point at or before `sample`. */
+    size_t lo = 0, hi = size_Array(&d->seekIndex);
+    while (lo < hi) {
+        const size_t mid = (lo + hi) / 2;
+        if (((const iSeekPoint *) constAt_Array(&d->seekIndex, mid))->sample <= sample) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo == 0) {
+        return iFalse;
+    }
+    *point_out = *(const iSeekPoint *) constAt_Array(&d->seekIndex, lo - 1);
+    return iTrue;
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -52,18 +106,20 @@ void init_SampleBuf(iSampleBuf *d, SDL_AudioFormat format, size_t numChannels, s
     d->sampleSize  = SDL_AUDIO_BITSIZE(format) / 8 * numChannels;
     d->count       = count + 1; /* considered empty if head==tail */
     d->data        = malloc(d->sampleSize * d->count);
-    d->head        = 0;
-    d->tail        = 0;
-    init_Condition(&d->moreNeeded);
+    set_Atomic(&d->head, 0);
+    set_Atomic(&d->tail, 0);
+    d->moreNeeded  = SDL_CreateSemaphore(0);
 }
 
 void deinit_SampleBuf(iSampleBuf *d) {
-    deinit_Condition(&d->moreNeeded);
+    SDL_DestroySemaphore(d->moreNeeded);
     free(d->data);
 }
 
 size_t size_SampleBuf(const iSampleBuf *d) {
-    return d->head - d->tail;
+    const size_t head = value_Atomic(&d->head);
+    const size_t tail = value_Atomic(&d->tail);
+    return (head + d->count - tail) % d->count;
 }
 
 size_t vacancy_SampleBuf(const iSampleBuf *d) {
@@ -76,7 +132,7 @@ iBool isFull_SampleBuf(const iSampleBuf *d) {
 
 void write_SampleBuf(iSampleBuf *d, const void *samples, const size_t n) {
     iAssert(n <= vacancy_SampleBuf(d));
-    const size_t headPos = d->head % d->count;
+    const size_t headPos = value_Atomic(&d->head);
     const size_t avail   = d->count - headPos;
     if (n > avail) {
         const char *in = samples;
@@ -87,12 +143,13 @@ void write_SampleBuf(iSampleBuf *d, const void *samples, const size_t n) {
     else {
         memcpy(ptr_SampleBuf_(d, headPos), samples, d->sampleSize * n);
     }
-    d->head += n;
+    /* Publish the samples only after they have been copied. */
+    set_Atomic(&d->head, (headPos + n) % d->count);
 }
 
 void read_SampleBuf(iSampleBuf *d, const size_t n, void *samples_out) {
     iAssert(n <= size_SampleBuf(d));
-    const size_t tailPos = d->tail % d->count;
+    const size_t tailPos = value_Atomic(&d->tail);
     const size_t avail   = d->count - tailPos;
     if (n > avail) {
         char *out = samples_out;
@@ -103,5 +160,16 @@ void read_SampleBuf(iSampleBuf *d, const size_t n, void *samples_out) {
     else {
         memcpy(samples_out, ptr_SampleBuf_(d, tailPos), d->sampleSize * n);
     }
-    d->tail += n;
+    set_Atomic(&d->tail, (tailPos + n) % d->count);
+}
+
+void signalMoreNeeded_SampleBuf(iSampleBuf *d) {
+    /* Posting a semaphore doesn't block, unlike signaling a condition under a mutex. */
+    if (SDL_SemValue(d->moreNeeded) == 0) {
+        SDL_SemPost(d->moreNeeded);
+    }
+}
+
+void waitMoreNeeded_SampleBuf(iSampleBuf *d) {
+    SDL_SemWait(d->moreNeeded);
 }
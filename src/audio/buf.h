@@ -22,13 +22,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #pragma once
 
+#include "the_Foundation/array.h"
 #include "the_Foundation/block.h"
+#include "the_Foundation/atomic.h"
 #include "the_Foundation/mutex.h"
 
 #include <SDL_audio.h>
+#include <SDL_mutex.h>
 
 iDeclareType(InputBuf)
 iDeclareType(SampleBuf)
+iDeclareType(SeekPoint)
 
 #if !defined (AUDIO_S24LSB)
 #   define AUDIO_S24LSB     0x8018  /* 24-bit integer samples */
@@ -37,27 +41,47 @@ iDeclareType(SampleBuf)
 #   define AUDIO_F64LSB     0x8140  /* 64-bit floating point samples */
 #endif
 
+/* Decoding can be restarted at `pos` and the output continues from `sample`. */
+struct Impl_SeekPoint {
+    uint64_t sample;
+    size_t   pos;
+};
+
 struct Impl_InputBuf {
     iMutex     mtx;
     iCondition changed;
     iBlock     data;
+    size_t     discarded;   /* bytes removed from the beginning of `data` */
     iBool      isComplete;
+    iBool      isStreaming; /* input is dropped after it has been decoded */
+    iArray     seekIndex;   /* iSeekPoint, ordered by position; found while decoding */
 };
 
 iDeclareTypeConstruction(InputBuf)
 
-size_t  size_InputBuf   (const iInputBuf *);
+size_t  size_InputBuf   (const iInputBuf *); /* including discarded bytes */
+void    discard_InputBuf(iInputBuf *, size_t pos);
+void    addSeekPoint_InputBuf   (iInputBuf *, uint64_t sample, size_t pos, uint64_t minInterval);
+iBool   findSeekPoint_InputBuf  (const iInputBuf *, uint64_t sample, iSeekPoint *point_out);
+
+iLocalDef const uint8_t *at_InputBuf(const iInputBuf *d, size_t pos) {
+    /* `pos` is an offset from the beginning of the stream. */
+    iAssert(pos >= d->discarded);
+    return constBegin_Block(&d->data) + (pos - d->discarded);
+}
 
 /*----------------------------------------------------------------------------------------------*/
 
+/* Single-producer, single-consumer ring buffer. The decoder thread writes and the audio
+   callback reads without any locking, so the callback never waits for the decoder. */
 struct Impl_SampleBuf {
     SDL_AudioFormat format;
     uint8_t         numChannels;
     uint8_t         sampleSize; /* as bytes; one sample includes values for all channels */
     void *          data;
     size_t          count;
-    size_t          head, tail;
-    iCondition      moreNeeded;
+    iAtomicInt      head, tail; /* positions in `data`; only the writer moves the head */
+    SDL_sem *       moreNeeded; /* posted by the reader */
 };
 
 iDeclareTypeConstructionArgs(SampleBuf, SDL_AudioFormat format, size_t numChannels, size_t count)
@@ -72,3 +96,5 @@ iLocalDef void *ptr_SampleBuf_(iSampleBuf *d, size_t pos) {
 
 void    write_SampleBuf     (iSampleBuf *, const void *samples, const size_t n);
 void    read_SampleBuf      (iSampleBuf *, const size_t n, void *samples_out);
+void    signalMoreNeeded_SampleBuf  (iSampleBuf *);
+void    waitMoreNeeded_SampleBuf    (iSampleBuf *);
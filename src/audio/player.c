@@ -23,6 +23,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "player.h"
 #include "buf.h"
 #include "lang.h"
+#include "profiler.h"
 
 #define STB_VORBIS_HEADER_ONLY
 #include "stb_vorbis.c"
@@ -60,6 +61,8 @@ struct Impl_ContentSpec {
     size_t            totalInputSize;
     uint64_t          totalSamples;
     size_t            inputStartPos;
+    size_t            seekPos;     /* where to continue decoding after a seek */
+    uint64_t          startSample; /* first sample decoded from `seekPos` */
 };
 
 iDeclareType(Decoder)
@@ -74,10 +77,12 @@ struct Impl_Decoder {
     size_t            totalInputSize;
     unsigned int      outputFreq;
     iSampleBuf        output;
-    iMutex            outputMutex;
     iArray            pendingOutput;
     uint64_t          currentSample;
     uint64_t          totalSamples; /* zero if unknown */
+    size_t            seekPos;
+    uint64_t          seekSample;
+    iBool             isResyncing;  /* sample position is uncertain after a seek */
     iMutex            tagMutex;
     iString           tags[max_PlayerTag];
     stb_vorbis *      vorbis;
@@ -93,12 +98,64 @@ enum iDecoderStatus {
     needMoreInput_DecoderStatus,
 };
 
+/* Sample conversions. These are simple loops over independent values without aliasing,
+   so the compiler vectorizes them. Integer gain is applied in 16.16 fixed point. */
+
+static int32_t fixedGain_(float gain) {
+    return (int32_t) (iClamp(gain, 0.0f, 1.0f) * 65536.0f);
+}
+
+static void convertF64_(const double *restrict in, float *restrict out, size_t count, float gain) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (float) in[i] * gain;
+    }
+}
+
+static void convertS24_(const uint8_t *restrict in, int16_t *restrict out, size_t count,
+                        float gain) {
+    /* The high 16 bits of each little-endian 24-bit value. */
+    const int32_t fixed = fixedGain_(gain);
+    for (size_t i = 0; i < count; i++) {
+        const int32_t value = (int16_t) (in[3 * i + 1] | (in[3 * i + 2] << 8));
+        out[i] = (int16_t) ((value * fixed) >> 16);
+    }
+}
+
+static void applyGainF32_(float *values, size_t count, float gain) {
+    if (gain == 1.0f) return;
+    for (size_t i = 0; i < count; i++) {
+        values[i] *= gain;
+    }
+}
+
+static void applyGainU8_(uint8_t *values, size_t count, float gain) {
+    const int32_t fixed = fixedGain_(gain);
+    if (fixed == 65536) return;
+    for (size_t i = 0; i < count; i++) {
+        values[i] = (uint8_t) ((((int32_t) values[i] - 127) * fixed >> 16) + 127);
+    }
+}
+
+static void applyGainS16_(int16_t *values, size_t count, float gain) {
+    const int32_t fixed = fixedGain_(gain);
+    if (fixed == 65536) return;
+    for (size_t i = 0; i < count; i++) {
+        values[i] = (int16_t) ((values[i] * fixed) >> 16);
+    }
+}
+
+static void applyGainS32_(int32_t *values, size_t count, float gain) {
+    if (gain == 1.0f) return;
+    for (size_t i = 0; i < count; i++) {
+        values[i] = (int32_t) (values[i] * (double) gain);
+    }
+}
+
 static enum iDecoderStatus decodeWav_Decoder_(iDecoder *d, iRanges inputRange) {
     const uint8_t numChannels     = d->output.numChannels;
     const size_t  inputSampleSize = numChannels * SDL_AUDIO_BITSIZE(d->inputFormat) / 8;
     const size_t  vacancy         = vacancy_SampleBuf(&d->output);
-    const size_t  inputBytePos    = inputSampleSize * d->inputPos;
-    const size_t  avail           = (inputRange.end - inputBytePos) / inputSampleSize;
+    const size_t  avail           = (inputRange.end - d->inputPos) / inputSampleSize;
     if (avail == 0) {
         return needMoreInput_DecoderStatus;
     }
@@ -106,68 +163,47 @@ static enum iDecoderStatus decodeWav_Decoder_(iDecoder *d, iRanges inputRange) {
     if (n == 0) {
         return ok_DecoderStatus;
     }
+    const size_t numValues = numChannels * n;
     void *samples = malloc(inputSampleSize * n);
     /* Get a copy of the input for further processing. */ {
         lock_Mutex(&d->input->mtx);
-        iAssert(inputSampleSize * d->inputPos < size_Block(&d->input->data));
-        memcpy(samples,
-               constData_Block(&d->input->data) + inputSampleSize * d->inputPos,
-               inputSampleSize * n);
-        d->inputPos += n;
+        iAssert(d->inputPos < size_InputBuf(d->input));
+        memcpy(samples, at_InputBuf(d->input, d->inputPos), inputSampleSize * n);
+        d->inputPos += inputSampleSize * n;
         unlock_Mutex(&d->input->mtx);
     }
-    /* Gain. */ {
-        const float gain = d->gain;
-        if (d->inputFormat == AUDIO_F64LSB) {
-            iAssert(d->output.format == AUDIO_F32);
-            double *inValue  = samples;
-            float * outValue = samples;
-            for (size_t count = numChannels * n; count; count--) {
-                *outValue++ = gain * *inValue++;
-            }
-        }
-        else if (d->inputFormat == AUDIO_F32) {
-            float *value = samples;
-            for (size_t count = numChannels * n; count; count--, value++) {
-                *value *= gain;
-            }
-        }
-        else if (d->inputFormat == AUDIO_S24LSB) {
-            iAssert(d->output.format == AUDIO_S16);
-            const char *inValue  = samples;
-            int16_t *   outValue = samples;
-            for (size_t count = numChannels * n; count; count--, inValue += 3, outValue++) {
-                memcpy(outValue, inValue, 2);
-                *outValue *= gain;
-            }
-        }
-        else {
-            switch (SDL_AUDIO_BITSIZE(d->output.format)) {
-                case 8: {
-                    uint8_t *value = samples;
-                    for (size_t count = numChannels * n; count; count--, value++) {
-                        *value = (int) (*value - 127) * gain + 127;
-                    }
-                    break;
-                }
-                case 16: {
-                    int16_t *value = samples;
-                    for (size_t count = numChannels * n; count; count--, value++) {
-                        *value *= gain;
-                    }
-                    break;
-                }
-                case 32: {
-                    int32_t *value = samples;
-                    for (size_t count = numChannels * n; count; count--, value++) {
-                        *value *= gain;
-                    }
-                    break;
-                }
-            }
+    /* Convert to the output format and apply gain. */
+    if (d->inputFormat == AUDIO_F64LSB) {
+        iAssert(d->output.format == AUDIO_F32);
+        float *converted = malloc(sizeof(float) * numValues);
+        convertF64_(samples, converted, numValues, d->gain);
+        free(samples);
+        samples = converted;
+    }
+    else if (d->inputFormat == AUDIO_S24LSB) {
+        iAssert(d->output.format == AUDIO_S16);
+        int16_t *converted = malloc(sizeof(int16_t) * numValues);
+        convertS24_(samples, converted, numValues, d->gain);
+        free(samples);
+        samples = converted;
+    }
+    else if (d->inputFormat == AUDIO_F32) {
+        applyGainF32_(samples, numValues, d->gain);
+    }
+    else {
+        switch (SDL_AUDIO_BITSIZE(d->output.format)) {
+            case 8:
+                applyGainU8_(samples, numValues, d->gain);
+                break;
+            case 16:
+                applyGainS16_(samples, numValues, d->gain);
+                break;
+            case 32:
+                applyGainS32_(samples, numValues, d->gain);
+                break;
         }
     }
-    iGuardMutex(&d->outputMutex, write_SampleBuf(&d->output, samples, n));
+    write_SampleBuf(&d->output, samples, n);
     d->currentSample += n;
     free(samples);
     return ok_DecoderStatus;
@@ -175,12 +211,10 @@ static enum iDecoderStatus decodeWav_Decoder_(iDecoder *d, iRanges inputRange) {
 
 static void writePending_Decoder_(iDecoder *d) {
     /* Write as much as we can. */
-    lock_Mutex(&d->outputMutex);
     size_t avail = vacancy_SampleBuf(&d->output);
     size_t n = iMin(avail, size_Array(&d->pendingOutput));
     write_SampleBuf(&d->output, constData_Array(&d->pendingOutput), n);
     removeN_Array(&d->pendingOutput, 0, n);
-    unlock_Mutex(&d->outputMutex);
     d->currentSample += n;
 }
 
@@ -193,9 +227,16 @@ static enum iDecoderStatus decodeVorbis_Decoder_(iDecoder *d) {
         d->vorbis = stb_vorbis_open_pushdata(
             constData_Block(input), size_Block(input), &consumed, &error, NULL);
         if (!d->vorbis) {
+            unlock_Mutex(&d->input->mtx);
             return needMoreInput_DecoderStatus;
         }
         d->inputPos += consumed;
+        if (d->seekPos > d->inputPos) {
+            /* Skip to the seek point; the decoder finds the next page from there. */
+            d->inputPos = d->seekPos;
+            stb_vorbis_flush_pushdata(d->vorbis);
+            d->isResyncing = iTrue;
+        }
         unlock_Mutex(&d->input->mtx);
         /* Check the metadata. */ {
             const stb_vorbis_comment com = stb_vorbis_get_comment(d->vorbis);
@@ -219,7 +260,7 @@ static enum iDecoderStatus decodeVorbis_Decoder_(iDecoder *d) {
             unlock_Mutex(&d->tagMutex);
         }
     }
-    if (d->totalSamples == 0 && d->input->isComplete) {
+    if (d->totalSamples == 0 && d->input->isComplete && !d->input->isStreaming) {
         /* Time to check the stream size. */
         lock_Mutex(&d->input->mtx);
         d->totalInputSize = size_Block(input);
@@ -238,11 +279,28 @@ static enum iDecoderStatus decodeVorbis_Decoder_(iDecoder *d) {
         lock_Mutex(&d->input->mtx);
         int     count     = 0;
         float **samples   = NULL;
-        int     remaining = d->inputPos < size_Block(input) ? size_Block(input) - d->inputPos : 0;
+        const size_t inputSize = size_InputBuf(d->input);
+        const size_t framePos  = d->inputPos;
+        int     remaining = d->inputPos < inputSize ? inputSize - d->inputPos : 0;
         int     consumed  = stb_vorbis_decode_frame_pushdata(
-            d->vorbis, constData_Block(input) + d->inputPos, remaining, NULL, &samples, &count);
+            d->vorbis, at_InputBuf(d->input, d->inputPos), remaining, NULL, &samples, &count);
         d->inputPos += consumed;
-        iAssert(d->inputPos <= size_Block(input));
+        iAssert(d->inputPos <= inputSize);
+        if (count > 0) {
+            const uint64_t pending = size_Array(&d->pendingOutput);
+            if (d->isResyncing) {
+                /* The granule position tells where we actually are. */
+                const int offset = stb_vorbis_get_sample_offset(d->vorbis);
+                if (offset >= 0 && (uint64_t) offset >= pending + count) {
+                    d->currentSample = offset - pending - count;
+                    d->isResyncing   = iFalse;
+                }
+            }
+            else if (!d->input->isStreaming) {
+                addSeekPoint_InputBuf(
+                    d->input, d->currentSample + pending, framePos, d->outputFreq);
+            }
+        }
         unlock_Mutex(&d->input->mtx);
         if (count == 0) {
             if (consumed == 0) {
@@ -251,14 +309,17 @@ static enum iDecoderStatus decodeVorbis_Decoder_(iDecoder *d) {
             }
             else continue;
         }
-        /* Apply gain. */ {
-            const float gain = d->gain;
-            float sample[2];
-            for (size_t i = 0; i < (size_t) count; ++i) {
-                for (size_t chan = 0; chan < d->output.numChannels; chan++) {
-                    sample[chan] = samples[chan][i] * gain;
+        /* Interleave the channels and apply gain. */ {
+            const float  gain        = d->gain;
+            const size_t numChannels = d->output.numChannels;
+            const size_t oldSize     = size_Array(&d->pendingOutput);
+            resize_Array(&d->pendingOutput, oldSize + count);
+            float *out = at_Array(&d->pendingOutput, oldSize);
+            for (size_t chan = 0; chan < numChannels; chan++) {
+                const float *in = samples[chan];
+                for (size_t i = 0; i < (size_t) count; ++i) {
+                    out[i * numChannels + chan] = in[i] * gain;
                 }
-                pushBack_Array(&d->pendingOutput, sample);
             }
         }
     }
@@ -275,7 +336,6 @@ static const char *mpegStr_(const mpg123_string *str) {
 enum iDecoderStatus decodeMpeg_Decoder_(iDecoder *d) {
     enum iDecoderStatus status = ok_DecoderStatus;
 #if defined (LAGRANGE_ENABLE_MPG123)
-    const iBlock *input = &d->input->data;
     if (!d->mpeg) {
         d->inputPos = 0;
         d->mpeg = mpg123_new(NULL, NULL);
@@ -285,11 +345,13 @@ enum iDecoderStatus decodeMpeg_Decoder_(iDecoder *d) {
     }
     /* Feed more input. */ {
         lock_Mutex(&d->input->mtx);
+        const size_t inputSize = size_InputBuf(d->input);
         if (d->input->isComplete) {
-            d->totalInputSize = size_Block(input);
+            d->totalInputSize = inputSize;
         }
-        if (d->inputPos < size_Block(input)) {
-            mpg123_feed(d->mpeg, constData_Block(input) + d->inputPos, size_Block(input) - d->inputPos);
+        if (d->inputPos < inputSize) {
+            /* mpg123 keeps its own copy of the data it has been fed. */
+            mpg123_feed(d->mpeg, at_InputBuf(d->input, d->inputPos), inputSize - d->inputPos);
             if (d->inputPos == 0) {
                 long r; int ch, enc;
                 mpg123_getformat(d->mpeg, &r, &ch, &enc);
@@ -297,7 +359,22 @@ enum iDecoderStatus decodeMpeg_Decoder_(iDecoder *d) {
                 iAssert(ch == d->output.numChannels);
                 iAssert(enc == MPG123_ENC_SIGNED_16);
             }
-            d->inputPos = size_Block(input);
+            d->inputPos = inputSize;
+            if (d->seekSample) {
+                /* mpg123 keeps an index of the frames and tells where the input continues. */
+                off_t inputOffset = 0;
+                const off_t pos =
+                    mpg123_feedseek(d->mpeg, d->seekSample, SEEK_SET, &inputOffset);
+                if (pos != MPG123_NEED_MORE) {
+                    d->seekSample    = 0;
+                    d->currentSample = iMax(pos, 0);
+                    if (pos >= 0 && (size_t) inputOffset < inputSize) {
+                        mpg123_feed(d->mpeg,
+                                    at_InputBuf(d->input, inputOffset),
+                                    inputSize - inputOffset);
+                    }
+                }
+            }
         }
         unlock_Mutex(&d->input->mtx);
     }
@@ -305,10 +382,7 @@ enum iDecoderStatus decodeMpeg_Decoder_(iDecoder *d) {
         int16_t buffer[512];
         size_t bytesRead = 0;
         const int rc = mpg123_read(d->mpeg, (uint8_t *) buffer, sizeof(buffer), &bytesRead);
-        const float gain = d->gain;
-        for (size_t i = 0; i < bytesRead / 2; i++) {
-            buffer[i] *= gain;
-        }
+        applyGainS16_(buffer, bytesRead / 2, d->gain);
         pushBackN_Array(&d->pendingOutput, buffer, bytesRead / 2 / d->output.numChannels);
         if (rc == MPG123_NEED_MORE) {
             status = needMoreInput_DecoderStatus;
@@ -343,6 +417,7 @@ enum iDecoderStatus decodeMpeg_Decoder_(iDecoder *d) {
 
 static iThreadResult run_Decoder_(iThread *thread) {
     iDecoder *d = userData_Thread(thread);
+    setThreadName_Profiler("audio decoder");
     while (d->type) {
         /* Check amount of data available. */
         lock_Mutex(&d->input->mtx);
@@ -366,6 +441,8 @@ static iThreadResult run_Decoder_(iThread *thread) {
             default:
                 break;
         }
+        /* When streaming, the decoded input is not needed any more. */
+        iGuardMutex(&d->input->mtx, discard_InputBuf(d->input, d->inputPos));
         if (status == needMoreInput_DecoderStatus) {
             lock_Mutex(&d->input->mtx);
             if (size_InputBuf(d->input) == inputSize) {
@@ -373,11 +450,8 @@ static iThreadResult run_Decoder_(iThread *thread) {
             }
             unlock_Mutex(&d->input->mtx);
         }
-        else {
-            iGuardMutex(
-                &d->outputMutex, if (isFull_SampleBuf(&d->output)) {
-                    wait_Condition(&d->output.moreNeeded, &d->outputMutex);
-                });
+        else if (isFull_SampleBuf(&d->output)) {
+            waitMoreNeeded_SampleBuf(&d->output);
         }
     }
     return 0;
@@ -391,8 +465,14 @@ void init_Decoder(iDecoder *d, iInputBuf *input, const iContentSpec *spec) {
     d->inputFormat    = spec->inputFormat;
     d->totalInputSize = spec->totalInputSize;
     d->outputFreq     = spec->output.freq;
-    d->currentSample  = 0;
+    d->currentSample  = spec->startSample;
     d->totalSamples   = spec->totalSamples;
+    d->seekPos        = spec->seekPos;
+    d->seekSample     = (spec->type == mpeg_DecoderType ? spec->startSample : 0);
+    d->isResyncing    = iFalse;
+    if (spec->type == wav_DecoderType && spec->seekPos) {
+        d->inputPos = spec->seekPos;
+    }
     init_Array(&d->pendingOutput, spec->output.channels * SDL_AUDIO_BITSIZE(spec->output.format) / 8);
     init_SampleBuf(&d->output,
                    spec->output.format,
@@ -408,7 +488,6 @@ void init_Decoder(iDecoder *d, iInputBuf *input, const iContentSpec *spec) {
     d->id3v1 = NULL;
     d->id3v2 = NULL;
 #endif
-    init_Mutex(&d->outputMutex);
     d->thread = new_Thread(run_Decoder_);
     setUserData_Thread(d->thread, d);
     start_Thread(d->thread);
@@ -416,11 +495,10 @@ void init_Decoder(iDecoder *d, iInputBuf *input, const iContentSpec *spec) {
 
 void deinit_Decoder(iDecoder *d) {
     d->type = none_DecoderType;
-    signal_Condition(&d->output.moreNeeded);
+    signalMoreNeeded_SampleBuf(&d->output);
     signal_Condition(&d->input->changed);
     join_Thread(d->thread);
     iRelease(d->thread);
-    deinit_Mutex(&d->outputMutex);
     deinit_SampleBuf(&d->output);
     deinit_Array(&d->pendingOutput);
     iForIndices(i, d->tags) {
@@ -628,15 +706,13 @@ static void writeOutputSamples_Player_(void *plr, Uint8 *stream, int len) {
     iAssert(d->decoder);
     const size_t sampleSize = sampleSize_Player_(d);
     const size_t count      = len / sampleSize;
-    lock_Mutex(&d->decoder->outputMutex);
     if (size_SampleBuf(&d->decoder->output) >= count) {
         read_SampleBuf(&d->decoder->output, count, stream);
     }
     else {
         memset(stream, d->spec.silence, len);
     }
-    signal_Condition(&d->decoder->output.moreNeeded);
-    unlock_Mutex(&d->decoder->outputMutex);
+    signalMoreNeeded_SampleBuf(&d->decoder->output);
 }
 
 void init_Player(iPlayer *d) {
@@ -701,6 +777,7 @@ void updateSourceData_Player(iPlayer *d, const iString *mimeType, const iBlock *
     switch (update) {
         case replace_PlayerUpdate:
             set_Block(&input->data, data);
+            clear_Array(&input->seekIndex);
             input->isComplete = iFalse;
             break;
         case append_PlayerUpdate: {
@@ -732,6 +809,31 @@ void updateSourceData_Player(iPlayer *d, const iString *mimeType, const iBlock *
     unlock_Mutex(&input->mtx);
 }
 
+void updateStreamData_Player(iPlayer *d, size_t offset, const iBlock *data, iBool isComplete) {
+    iInputBuf *input = d->data;
+    lock_Mutex(&input->mtx);
+    input->isStreaming = iTrue;
+    /* Only the part we don't already have is appended. */
+    const size_t end = size_InputBuf(input);
+    if (offset <= end && offset + size_Block(data) > end) {
+        appendData_Block(&input->data,
+                         constBegin_Block(data) + (end - offset),
+                         offset + size_Block(data) - end);
+    }
+    if (isComplete) {
+        input->isComplete = iTrue;
+    }
+    signal_Condition(&input->changed);
+    unlock_Mutex(&input->mtx);
+}
+
+iBool isStreaming_Player(const iPlayer *d) {
+    lock_Mutex(&d->data->mtx);
+    const iBool isStreaming = d->data->isStreaming;
+    unlock_Mutex(&d->data->mtx);
+    return isStreaming;
+}
+
 size_t sourceDataSize_Player(const iPlayer *d) {
     lock_Mutex(&d->data->mtx);
     const size_t size = size_Block(&d->data->data);
@@ -769,6 +871,81 @@ iBool start_Player(iPlayer *d) {
     return iTrue;
 }
 
+iBool isSeekable_Player(const iPlayer *d) {
+    if (d->avfPlayer || !isStarted_Player(d) || isStreaming_Player(d)) {
+        return iFalse;
+    }
+    return d->decoder->type == wav_DecoderType || d->decoder->type == vorbis_DecoderType ||
+           d->decoder->type == mpeg_DecoderType;
+}
+
+static void seekPoint_Player_(const iPlayer *d, iContentSpec *content, uint64_t sample) {
+    const iDecoder *dec = d->decoder;
+    content->startSample = sample;
+    if (content->type == wav_DecoderType) {
+        content->seekPos = content->inputStartPos +
+                           sample * content->output.channels *
+                               SDL_AUDIO_BITSIZE(content->inputFormat) / 8;
+        return;
+    }
+    if (content->type != vorbis_DecoderType) {
+        return; /* mpg123 seeks by itself */
+    }
+    /* Use the index of already decoded input. The decoder resyncs at the next page. */
+    iSeekPoint point = { 0, 0 };
+    lock_Mutex(&d->data->mtx);
+    const iBool isIndexed = findSeekPoint_InputBuf(d->data, sample, &point);
+    const size_t inputSize = size_InputBuf(d->data);
+    unlock_Mutex(&d->data->mtx);
+    if (sample >= point.sample + d->spec.freq && dec->totalSamples && dec->totalInputSize) {
+        /* Not decoded that far yet; estimate assuming a constant bitrate. */
+        const size_t estimate =
+            (size_t) ((double) sample / (double) dec->totalSamples * dec->totalInputSize);
+        if (estimate > point.pos && estimate < inputSize) {
+            content->seekPos = estimate;
+            return;
+        }
+    }
+    if (isIndexed) {
+        content->seekPos     = point.pos;
+        content->startSample = point.sample;
+    }
+    else {
+        content->startSample = 0;
+    }
+}
+
+iBool seek_Player(iPlayer *d, float time) {
+    if (!isSeekable_Player(d)) {
+        return iFalse;
+    }
+    iContentSpec content = contentSpec_Player_(d);
+    if (content.type != d->decoder->type || content.output.freq != d->spec.freq) {
+        return iFalse;
+    }
+    uint64_t sample = (uint64_t) (iMax(0.0f, time) * d->spec.freq);
+    if (d->decoder->totalSamples) {
+        sample = iMin(sample, d->decoder->totalSamples);
+    }
+    if (!content.totalSamples) {
+        content.totalSamples = d->decoder->totalSamples;
+    }
+    if (!content.totalInputSize) {
+        content.totalInputSize = d->decoder->totalInputSize;
+    }
+    seekPoint_Player_(d, &content, sample);
+    /* The callback must not see a decoder that is being destroyed. */
+    iDecoder *seeked = new_Decoder(d->data, &content);
+    seeked->gain = d->volume;
+    SDL_LockAudioDevice(d->device);
+    iDecoder *old = d->decoder;
+    d->decoder = seeked;
+    SDL_UnlockAudioDevice(d->device);
+    delete_Decoder(old);
+    setNotIdle_Player(d);
+    return iTrue;
+}
+
 void setPaused_Player(iPlayer *d, iBool isPaused) {
 #if defined (iPlatformAppleMobile)
     if (d->avfPlayer) {
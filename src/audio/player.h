@@ -48,10 +48,13 @@ enum iPlayerTag {
 
 void    updateSourceData_Player (iPlayer *, const iString *mimeType, const iBlock *data,
                                  enum iPlayerUpdate update);
+void    updateStreamData_Player (iPlayer *, size_t offset, const iBlock *data,
+                                 iBool isComplete); /* earlier input is discarded once decoded */
 size_t  sourceDataSize_Player   (const iPlayer *);
 
 iBool   	start_Player            (iPlayer *);
 void    	stop_Player             (iPlayer *);
+iBool   	seek_Player             (iPlayer *, float time); /* seconds */
 void    	setPaused_Player        (iPlayer *, iBool isPaused);
 void    	setVolume_Player        (iPlayer *, float volume);
 void    	setFlags_Player         (iPlayer *, int flags, iBool set);
@@ -61,6 +64,8 @@ int     	flags_Player            (const iPlayer *);
 const iString *tag_Player           (const iPlayer *, enum iPlayerTag tag);
 iBool   	isStarted_Player        (const iPlayer *);
 iBool   	isPaused_Player         (const iPlayer *);
+iBool   	isStreaming_Player      (const iPlayer *); /* can't be restarted */
+iBool   	isSeekable_Player       (const iPlayer *);
 float   	volume_Player           (const iPlayer *);
 float   	time_Player             (const iPlayer *);
 float   	duration_Player         (const iPlayer *);
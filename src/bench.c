@@ -0,0 +1,1492 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "bench.h"
+#include "app.h"
+#include "feedxml.h"
+#include "gmdocument.h"
+#include "gmrequest.h"
+#include "gmutil.h"
+#include "gopher.h"
+#include "imagedecoder.h"
+#include "markdown.h"
+#include "savequeue.h"
+#include "ui/text.h"
+#include "ui/window.h"
+#include "visited.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/stringlist.h>
+#include <the_Foundation/thread.h>
+#include <the_Foundation/time.h>
+#include <SDL.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined (iPlatformMsys)
+#  include <arpa/inet.h>
+#  include <ftw.h>
+#  include <netinet/in.h>
+#  include <poll.h>
+#  include <signal.h>
+#  include <sys/resource.h>
+#  include <sys/socket.h>
+#  include <sys/time.h>
+#  include <unistd.h>
+#endif
+#if defined (LAGRANGE_BENCH_TLS)
+#  include <the_Foundation/tlsrequest.h>
+#  include <openssl/pem.h>
+#  include <openssl/ssl.h>
+#endif
+
+/* Allocations are counted by wrapping the C library's allocator, so the ones made by
+   the_Foundation, SDL, and the other libraries are included. Only glibc exports the entry
+   points of its allocator; elsewhere the counts are reported as zero. */
+#if defined (__GLIBC__)
+#  define LAGRANGE_BENCH_COUNT_ALLOCS
+#  include <stdatomic.h>
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t num, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+
+static atomic_size_t numAllocs_;
+
+void *malloc(size_t size) {
+    atomic_fetch_add_explicit(&numAllocs_, 1, memory_order_relaxed);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t num, size_t size) {
+    atomic_fetch_add_explicit(&numAllocs_, 1, memory_order_relaxed);
+    return __libc_calloc(num, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    atomic_fetch_add_explicit(&numAllocs_, 1, memory_order_relaxed);
+    return __libc_realloc(ptr, size);
+}
+#endif
+
+static size_t numAllocs_Benchmark_(void) {
+#if defined (LAGRANGE_BENCH_COUNT_ALLOCS)
+    return atomic_load_explicit(&numAllocs_, memory_order_relaxed);
+#else
+    return 0;
+#endif
+}
+
+iDeclareType(Benchmark)
+iDeclareType(BenchDocument)
+iDeclareType(BenchPhase)
+iDeclareType(BenchResult)
+
+struct Impl_BenchDocument {
+    iString           name;
+    iString           source;
+    enum iSourceFormat format;
+    iBool             isGopher; /* source is a Gopher menu that must be converted first */
+    iBool             isImage;  /* source is encoded image data */
+};
+
+/* Timings of the repeats of one measurement. */
+struct Impl_BenchPhase {
+    iArray samples; /* double, milliseconds */
+    iTime  start;
+    size_t startAllocs;
+    size_t numAllocs; /* during all the samples */
+};
+
+struct Impl_BenchResult {
+    iString key; /* document, phase, and width */
+    double  median;
+    size_t  allocs; /* per repeat */
+};
+
+struct Impl_Benchmark {
+    iStringList *paths;      /* additional corpus files or directories */
+    iString *    outputPath; /* results are written here (default: stdout) */
+    iString *    findText;
+    int          widths[8];
+    size_t       numWidths;
+    int          repeats;
+    size_t       numRequests;  /* network suite; zero to skip */
+    size_t       concurrency;
+    size_t       responseSize; /* bytes per loopback response or Titan upload */
+    size_t       numFeedEntries;
+    size_t       numVisited;
+    iString *    baselinePath; /* earlier results to compare against */
+    double       threshold;    /* allowed slowdown of the median, in percent */
+    iArray *     results;      /* iBenchResult */
+    FILE *       out;
+};
+
+static iBenchmark bench_;
+
+/*----------------------------------------------------------------------------------------------*/
+/* Built-in corpus. The documents are generated so they don't need to be distributed with
+   the sources, and the results remain comparable between revisions. */
+
+static const char *latinWords_[] = {
+    "gemini", "capsule", "the", "orbit", "lagrange", "point", "of", "stable", "equilibrium",
+    "where", "a", "small", "object", "remains", "fixed", "relative", "to", "two", "larger",
+    "bodies", "and", "text", "flows", "quietly", "between", "links", "headings", "quotes",
+};
+
+static const char *cjkWords_[] = {
+    "拉格朗日", "点是", "天体力学", "中的", "一个", "平衡", "位置", "文档", "布局", "测试",
+    "日本語の", "文章を", "ここに", "書きます", "한국어", "문서", "입니다",
+};
+
+static const char *rtlWords_[] = {
+    "نقطة", "لاغرانج", "هي", "موقع", "في", "الفضاء", "النص", "العربي",
+    "נקודת", "לגראנז'", "היא", "מקום", "בחלל", "טקסט", "עברי",
+};
+
+static void appendWords_(iString *d, const char **words, size_t numWords, size_t count,
+                         unsigned *seed, const char *separator) {
+    for (size_t i = 0; i < count; i++) {
+        *seed = *seed * 1103515245u + 12345u;
+        if (i > 0) {
+            appendCStr_String(d, separator);
+        }
+        appendCStr_String(d, words[(*seed >> 16) % numWords]);
+    }
+}
+
+static void makeGemtext_(iString *d, size_t numSections) {
+    unsigned seed = 1;
+    for (size_t i = 0; i < numSections; i++) {
+        appendFormat_String(d, "## Section %zu\n\n", i + 1);
+        for (int p = 0; p < 3; p++) {
+            appendWords_(d, latinWords_, iElemCount(latinWords_), 60 + 20 * p, &seed, " ");
+            appendCStr_String(d, ".\n\n");
+        }
+        appendFormat_String(d, "=> gemini://example.com/%zu.gmi Link number %zu\n", i, i);
+        appendCStr_String(d, "* list item one\n* list item two\n> ");
+        appendWords_(d, latinWords_, iElemCount(latinWords_), 30, &seed, " ");
+        appendCStr_String(d, "\n\n");
+    }
+}
+
+static void makePreformatted_(iString *d, size_t numBlocks) {
+    for (size_t i = 0; i < numBlocks; i++) {
+        appendFormat_String(d, "```Block %zu\n", i + 1);
+        for (int y = 0; y < 40; y++) {
+            for (int x = 0; x < 100; x++) {
+                appendChar_String(d, "  .:-=+*#%@"[(x * 7 + y * 13 + (int) i) % 11]);
+            }
+            appendChar_String(d, '\n');
+        }
+        appendCStr_String(d, "```\n\n");
+    }
+}
+
+static void makeScript_(iString *d, const char **words, size_t numWords, const char *separator,
+                        size_t numParagraphs) {
+    unsigned seed = 7;
+    for (size_t i = 0; i < numParagraphs; i++) {
+        if (i % 10 == 0) {
+            appendCStr_String(d, "# ");
+            appendWords_(d, words, numWords, 3, &seed, separator);
+            appendCStr_String(d, "\n\n");
+        }
+        appendWords_(d, words, numWords, 80, &seed, separator);
+        appendCStr_String(d, "\n\n");
+    }
+}
+
+static void makeGopherMenu_(iString *d, size_t numItems) {
+    unsigned seed = 3;
+    for (size_t i = 0; i < numItems; i++) {
+        const char type = "01i7"[i % 4];
+        appendChar_String(d, type);
+        appendWords_(d, latinWords_, iElemCount(latinWords_), 6, &seed, " ");
+        appendFormat_String(d, "\t/item/%zu\texample.com\t70\r\n", i);
+    }
+    appendCStr_String(d, ".\r\n");
+}
+
+static void makeMarkdown_(iString *d, size_t numSections) {
+    unsigned seed = 5;
+    for (size_t i = 0; i < numSections; i++) {
+        appendFormat_String(d, "## Section %zu\n\n", i + 1);
+        appendWords_(d, latinWords_, iElemCount(latinWords_), 40, &seed, " ");
+        appendCStr_String(d, " with **bold**, _emphasis_, `code`, and a "
+                             "[link](https://example.com/page) inline.\n");
+        appendWords_(d, latinWords_, iElemCount(latinWords_), 40, &seed, " ");
+        appendCStr_String(d, "\n\n- first item\n- second item with ![image](img.png)\n\n"
+                             "```\nint main(void) { return 0; }\n```\n\n");
+    }
+}
+
+static void makeBitmap_(iBlock *d, int width, int height) {
+    /* Uncompressed 24-bit BMP with a gradient, so no image encoder is needed. */
+    const size_t rowSize = ((size_t) width * 3 + 3) & ~(size_t) 3;
+    const size_t size    = 54 + rowSize * height;
+    resize_Block(d, size);
+    uint8_t *bmp = data_Block(d);
+    memset(bmp, 0, size);
+    const uint32_t header[] = { size, 0, 54, 40, width, height };
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    iForIndices(i, header) {
+        for (int b = 0; b < 4; b++) {
+            bmp[2 + 4 * i + b] = (header[i] >> (8 * b)) & 0xff;
+        }
+    }
+    bmp[26] = 1;  /* planes */
+    bmp[28] = 24; /* bits per pixel */
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = bmp + 54 + rowSize * y;
+        for (int x = 0; x < width; x++) {
+            row[3 * x + 0] = x * 255 / width;
+            row[3 * x + 1] = y * 255 / height;
+            row[3 * x + 2] = (x ^ y) & 0xff;
+        }
+    }
+}
+
+static void initBuiltIn_BenchDocument_(iBenchDocument *d, const char *name,
+                                       enum iSourceFormat format) {
+    initCStr_String(&d->name, name);
+    init_String(&d->source);
+    d->format   = format;
+    d->isGopher = iFalse;
+    d->isImage  = iFalse;
+}
+
+static void deinit_BenchDocument_(iBenchDocument *d) {
+    deinit_String(&d->source);
+    deinit_String(&d->name);
+}
+
+static void makeCorpus_Benchmark_(const iBenchmark *d, iArray *docs) {
+    iBenchDocument doc;
+    initBuiltIn_BenchDocument_(&doc, "builtin:gemtext", gemini_SourceFormat);
+    makeGemtext_(&doc.source, 400);
+    pushBack_Array(docs, &doc);
+    initBuiltIn_BenchDocument_(&doc, "builtin:preformatted", gemini_SourceFormat);
+    makePreformatted_(&doc.source, 50);
+    pushBack_Array(docs, &doc);
+    initBuiltIn_BenchDocument_(&doc, "builtin:cjk", gemini_SourceFormat);
+    makeScript_(&doc.source, cjkWords_, iElemCount(cjkWords_), "", 200);
+    pushBack_Array(docs, &doc);
+    initBuiltIn_BenchDocument_(&doc, "builtin:rtl", gemini_SourceFormat);
+    makeScript_(&doc.source, rtlWords_, iElemCount(rtlWords_), " ", 200);
+    pushBack_Array(docs, &doc);
+    initBuiltIn_BenchDocument_(&doc, "builtin:gophermap", gemini_SourceFormat);
+    makeGopherMenu_(&doc.source, 2000);
+    doc.isGopher = iTrue;
+    pushBack_Array(docs, &doc);
+    initBuiltIn_BenchDocument_(&doc, "builtin:markdown", markdown_SourceFormat);
+    makeMarkdown_(&doc.source, 300);
+    pushBack_Array(docs, &doc);
+    initBuiltIn_BenchDocument_(&doc, "builtin:markdown-large", markdown_SourceFormat);
+    makeMarkdown_(&doc.source, 5000); /* like a big README or a concatenated docs tree */
+    pushBack_Array(docs, &doc);
+    initBuiltIn_BenchDocument_(&doc, "builtin:gradient.bmp", undefined_SourceFormat);
+    makeBitmap_(&doc.source.chars, 3000, 2000); /* a photo downscaled for display */
+    doc.isImage = iTrue;
+    pushBack_Array(docs, &doc);
+    /* User-provided files. */
+    iStringList *files = iClob(new_StringList());
+    iConstForEach(StringList, p, d->paths) {
+        iFileInfo *info = iClob(new_FileInfo(p.value));
+        if (isDirectory_FileInfo(info)) {
+            iConstForEach(DirFileInfo, e, iClob(directoryContents_FileInfo(info))) {
+                if (!isDirectory_FileInfo(e.value)) {
+                    pushBack_StringList(files, path_FileInfo(e.value));
+                }
+            }
+        }
+        else {
+            pushBack_StringList(files, p.value);
+        }
+    }
+    iConstForEach(StringList, f, files) {
+        const iString *path = f.value;
+        iFile *        file = iClob(new_File(path));
+        if (!open_File(file, readOnly_FileMode)) {
+            fprintf(stderr, "[bench] cannot read %s\n", cstr_String(path));
+            continue;
+        }
+        const char *mime = mediaType_Path(path);
+        if (startsWith_CStr(mime, "image/")) {
+            initBuiltIn_BenchDocument_(&doc, cstr_String(path), undefined_SourceFormat);
+            setBlock_String(&doc.source, collect_Block(readAll_File(file)));
+            doc.isImage = iTrue;
+            pushBack_Array(docs, &doc);
+            continue;
+        }
+        initBuiltIn_BenchDocument_(&doc, cstr_String(path),
+                                   startsWith_CStr(mime, "text/markdown") ? markdown_SourceFormat
+                                   : startsWith_CStr(mime, "text/gemini") ? gemini_SourceFormat
+                                                                           : plainText_SourceFormat);
+        setBlock_String(&doc.source, collect_Block(readAll_File(file)));
+        doc.isGopher = equalCase_Rangecc(baseName_Path(path), "gophermap") ||
+                       endsWithCase_String(path, ".gophermap");
+        if (doc.isGopher) {
+            doc.format = gemini_SourceFormat;
+        }
+        pushBack_Array(docs, &doc);
+    }
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void appendJsonString_(iString *d, const iString *str) {
+    appendChar_String(d, '"');
+    iConstForEach(String, i, str) {
+        const iChar ch = i.value;
+        if (ch == '"' || ch == '\\') {
+            appendChar_String(d, '\\');
+            appendChar_String(d, ch);
+        }
+        else if (ch < 0x20) {
+            appendFormat_String(d, "\\u%04x", (unsigned) ch);
+        }
+        else {
+            appendChar_String(d, ch);
+        }
+    }
+    appendChar_String(d, '"');
+}
+
+static void writeJsonString_(FILE *out, const iString *str) {
+    iString json;
+    init_String(&json);
+    appendJsonString_(&json, str);
+    fputs(cstr_String(&json), out);
+    deinit_String(&json);
+}
+
+static size_t peakMemoryKB_(void) {
+#if !defined (iPlatformMsys)
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return 0;
+    }
+#   if defined (iPlatformApple)
+    return usage.ru_maxrss / 1024; /* bytes */
+#   else
+    return usage.ru_maxrss;
+#   endif
+#else
+    return 0;
+#endif
+}
+
+static void init_BenchPhase_(iBenchPhase *d) {
+    init_Array(&d->samples, sizeof(double));
+    d->startAllocs = 0;
+    d->numAllocs   = 0;
+}
+
+static void deinit_BenchPhase_(iBenchPhase *d) {
+    deinit_Array(&d->samples);
+}
+
+static void begin_BenchPhase_(iBenchPhase *d) {
+    d->startAllocs = numAllocs_Benchmark_();
+    initCurrent_Time(&d->start);
+}
+
+static void end_BenchPhase_(iBenchPhase *d) {
+    const double ms = elapsedSeconds_Time(&d->start) * 1000.0;
+    d->numAllocs += numAllocs_Benchmark_() - d->startAllocs;
+    pushBack_Array(&d->samples, &ms);
+}
+
+static int cmpSample_(const void *a, const void *b) {
+    const double x = *(const double *) a, y = *(const double *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static const iString *resultKey_(const iString *name, const char *phase, int width) {
+    iString *key = collectNew_String();
+    appendJsonString_(key, name);
+    appendFormat_String(key, " %s %d", phase, width);
+    return key;
+}
+
+static void record_Benchmark_(const iBenchmark *d, const iString *name, const char *phase,
+                              int width, double median, size_t allocs) {
+    iBenchResult res;
+    initCopy_String(&res.key, resultKey_(name, phase, width));
+    res.median = median;
+    res.allocs = allocs;
+    pushBack_Array(d->results, &res);
+}
+
+static void report_Benchmark_(const iBenchmark *d, const iString *name, const char *phase,
+                              int width, iBenchPhase *timing, const iGmDocument *gmDoc) {
+    /* One JSON object per line. The samples are consumed. */
+    iArray *     samples = &timing->samples;
+    const size_t n       = size_Array(samples);
+    const size_t allocs  = n ? timing->numAllocs / n : 0;
+    double       mean = 0.0, median = 0.0, p95 = 0.0;
+    if (n) {
+        sort_Array(samples, cmpSample_);
+        const double *ms = constData_Array(samples);
+        for (size_t i = 0; i < n; i++) {
+            mean += ms[i];
+        }
+        mean /= n;
+        median = ms[n / 2];
+        p95    = ms[iMin(n - 1, n * 95 / 100)];
+    }
+    clear_Array(samples);
+    timing->numAllocs = 0;
+    fputs("{\"document\":", d->out);
+    writeJsonString_(d->out, name);
+    fprintf(d->out,
+            ",\"phase\":\"%s\",\"width\":%d,\"ms\":%.3f,\"median\":%.3f,\"p95\":%.3f,"
+            "\"allocs\":%zu,\"runs\":%zu,\"height\":%d,\"peakMemoryKB\":%zu}\n",
+            phase,
+            width,
+            mean,
+            median,
+            p95,
+            allocs,
+            gmDoc ? numRuns_GmDocument(gmDoc) : 0,
+            gmDoc ? size_GmDocument(gmDoc).y : 0,
+            peakMemoryKB_());
+    fflush(d->out);
+    record_Benchmark_(d, name, phase, width, median, allocs);
+}
+
+static void drawRun_Benchmark_(void *context, const iGmRun *run) {
+    const int *originY = context;
+    if (isMedia_GmRun(run) || isEmpty_Range(&run->text)) {
+        return;
+    }
+    drawRange_Text(run->font,
+                   addY_I2(topLeft_Rect(run->visBounds), -*originY),
+                   run->color,
+                   run->text);
+}
+
+static void render_Benchmark_(iGmDocument *doc, int viewHeight) {
+    /* Draw the entire document one view at a time, like scrolling through it. */
+    SDL_Renderer *render = renderer_Window(get_Window());
+    for (int y = 0; y < size_GmDocument(doc).y; y += viewHeight) {
+        SDL_SetRenderDrawColor(render, 0, 0, 0, 255);
+        SDL_RenderClear(render);
+        render_GmDocument(doc, (iRangei){ y, y + viewHeight }, drawRun_Benchmark_, &y);
+        SDL_RenderPresent(render);
+    }
+}
+
+static void runDocument_Benchmark_(const iBenchmark *d, const iBenchDocument *bdoc) {
+    iBenchPhase    timing;
+    const iString *source = &bdoc->source;
+    init_BenchPhase_(&timing);
+    if (bdoc->isGopher) {
+        iBlock *output = collect_Block(new_Block(0));
+        for (int r = 0; r < d->repeats; r++) {
+            begin_BenchPhase_(&timing);
+            iGopher gopher;
+            init_Gopher(&gopher);
+            gopher.type   = '1';
+            gopher.output = output;
+            clear_Block(output);
+            processResponse_Gopher(&gopher, utf8_String(source));
+            deinit_Gopher(&gopher);
+            end_BenchPhase_(&timing);
+        }
+        report_Benchmark_(d, &bdoc->name, "gopher", 0, &timing, NULL);
+        source = collect_String(newBlock_String(output));
+    }
+    if (bdoc->format == markdown_SourceFormat) {
+        /* Conversion to Gemtext, compared against the earlier converter. */
+        iString *gemtext = collectNew_String();
+        for (int r = 0; r < d->repeats; r++) {
+            begin_BenchPhase_(&timing);
+            convertToGemtext_Markdown(range_String(source), gemtext);
+            end_BenchPhase_(&timing);
+        }
+        report_Benchmark_(d, &bdoc->name, "markdown", 0, &timing, NULL);
+        for (int r = 0; r < d->repeats; r++) {
+            begin_BenchPhase_(&timing);
+            convertToGemtextRegExp_Markdown(range_String(source), gemtext);
+            end_BenchPhase_(&timing);
+        }
+        report_Benchmark_(d, &bdoc->name, "markdown-regexp", 0, &timing, NULL);
+    }
+    iGmDocument *doc = new_GmDocument();
+    setFormat_GmDocument(doc, bdoc->format);
+    const int firstWidth = d->widths[0];
+    /* Parsing (including normalization and Markdown conversion) and full layout. */
+    for (int r = 0; r < d->repeats; r++) {
+        begin_BenchPhase_(&timing);
+        setSource_GmDocument(doc, collectNew_String(), firstWidth, firstWidth,
+                             final_GmDocumentUpdate);
+        setSource_GmDocument(doc, source, firstWidth, firstWidth, final_GmDocumentUpdate);
+        continueLayout_GmDocument(doc, 0);
+        end_BenchPhase_(&timing);
+    }
+    report_Benchmark_(d, &bdoc->name, "parse", firstWidth, &timing, doc);
+    /* Relayout at different widths. */
+    for (size_t w = 0; w < d->numWidths; w++) {
+        const int width = d->widths[w];
+        for (int r = 0; r < d->repeats; r++) {
+            begin_BenchPhase_(&timing);
+            setWidth_GmDocument(doc, width + (r & 1), width + (r & 1)); /* force a change */
+            continueLayout_GmDocument(doc, 0);
+            end_BenchPhase_(&timing);
+        }
+        report_Benchmark_(d, &bdoc->name, "layout", width, &timing, doc);
+    }
+    /* Redo the layout at the same width, as happens when fonts or colors change. */
+    for (int r = 0; r < d->repeats; r++) {
+        begin_BenchPhase_(&timing);
+        redoLayout_GmDocument(doc);
+        continueLayout_GmDocument(doc, 0);
+        end_BenchPhase_(&timing);
+    }
+    const int lastWidth = d->widths[d->numWidths - 1];
+    report_Benchmark_(d, &bdoc->name, "relayout", lastWidth, &timing, doc);
+    /* Searching. */
+    for (int r = 0; r < d->repeats; r++) {
+        begin_BenchPhase_(&timing);
+        setFindText_GmDocument(doc, collectNew_String()); /* scan again */
+        setFindText_GmDocument(doc, d->findText);
+        numFound_GmDocument(doc);
+        end_BenchPhase_(&timing);
+    }
+    report_Benchmark_(d, &bdoc->name, "find", lastWidth, &timing, doc);
+    /* Text rendering. */
+    for (int r = 0; r < d->repeats; r++) {
+        begin_BenchPhase_(&timing);
+        render_Benchmark_(doc, 1000);
+        end_BenchPhase_(&timing);
+    }
+    report_Benchmark_(d, &bdoc->name, "render", lastWidth, &timing, doc);
+    iRelease(doc);
+    deinit_BenchPhase_(&timing);
+}
+
+static void runImage_Benchmark_(const iBenchmark *d, const iBenchDocument *bdoc) {
+    /* Decoding, downscaling, and styling in a decoder thread, up to a finished pixel buffer. */
+    const iString *mime  = collectNewCStr_String(mediaType_Path(&bdoc->name));
+    iBenchPhase    timing;
+    init_BenchPhase_(&timing);
+    for (int r = 0; r < d->repeats; r++) {
+        begin_BenchPhase_(&timing);
+        iImageDecodeJob *job = decode_ImageDecoder(mime, &bdoc->source.chars);
+        while (job && !isFinished_ImageDecodeJob(job)) {
+            SDL_Delay(0);
+        }
+        end_BenchPhase_(&timing);
+        cancel_ImageDecoder(job); /* deletes it */
+    }
+    report_Benchmark_(d, &bdoc->name, "decode", 0, &timing, NULL);
+    deinit_BenchPhase_(&timing);
+}
+
+static void countFeedEntry_(void *context, const iFeedXmlEntry *entry) {
+    iUnused(entry);
+    (*(size_t *) context)++;
+}
+
+static void runFeed_Benchmark_(const iBenchmark *d) {
+    iString *xml = collectNew_String();
+    appendCStr_String(xml,
+                      "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n"
+                      "<feed xmlns=\"http://www.w3.org/2005/Atom\">\n"
+                      "<title>Benchmark &amp; Feed</title>\n"
+                      "<subtitle>Generated entries</subtitle>\n");
+    for (size_t i = 0; i < d->numFeedEntries; i++) {
+        appendFormat_String(xml,
+                            "<entry>\n"
+                            "  <title>Entry %zu: &quot;%s&quot; &lt;%s&gt;</title>\n"
+                            "  <link href=\"gemini://example.com/posts/%zu.gmi\" rel=\"alternate\"/>\n"
+                            "  <updated>2024-%02zu-%02zuT12:00:00Z</updated>\n"
+                            "  <summary>%s %s %s</summary>\n"
+                            "</entry>\n",
+                            i,
+                            latinWords_[i % iElemCount(latinWords_)],
+                            latinWords_[(i + 3) % iElemCount(latinWords_)],
+                            i,
+                            1 + i % 12,
+                            1 + i % 28,
+                            latinWords_[(i + 1) % iElemCount(latinWords_)],
+                            latinWords_[(i + 5) % iElemCount(latinWords_)],
+                            latinWords_[(i + 7) % iElemCount(latinWords_)]);
+    }
+    appendCStr_String(xml, "</feed>\n");
+    iBenchPhase timing;
+    init_BenchPhase_(&timing);
+    size_t numEntries = 0;
+    for (int r = 0; r < d->repeats; r++) {
+        begin_BenchPhase_(&timing);
+        iFeedXml *feed = new_FeedXml(countFeedEntry_, &numEntries);
+        write_FeedXml(feed, range_String(xml));
+        finish_FeedXml(feed);
+        delete_FeedXml(feed);
+        end_BenchPhase_(&timing);
+    }
+    if (numEntries != d->numFeedEntries * d->repeats) {
+        fprintf(stderr, "[bench] feed parser found %zu entries instead of %zu\n",
+                numEntries / d->repeats, d->numFeedEntries);
+    }
+    report_Benchmark_(d, collectNewCStr_String("builtin:atom"), "feed", 0, &timing, NULL);
+    deinit_BenchPhase_(&timing);
+}
+
+static void runShaping_Benchmark_(const iBenchmark *d) {
+    /* Measuring lines of text, as layout does. With HarfBuzz, this is mostly shaping. The
+       first phase starts each repeat with an empty cache; the second one reuses the runs. */
+    static const struct {
+        const char * name;
+        const char **words;
+        size_t       numWords;
+        const char * separator;
+    } scripts_[] = {
+        { "builtin:shape-latin", latinWords_, iElemCount(latinWords_), " " },
+        { "builtin:shape-cjk",   cjkWords_,   iElemCount(cjkWords_),   ""  },
+        { "builtin:shape-rtl",   rtlWords_,   iElemCount(rtlWords_),   " " },
+    };
+    static const size_t numLines_ = 500;
+    iText *     text = current_Text();
+    iBenchPhase timing;
+    init_BenchPhase_(&timing);
+    iForIndices(s, scripts_) {
+        iStringList *lines = collectNew_StringList();
+        unsigned     seed  = 11;
+        for (size_t i = 0; i < numLines_; i++) {
+            iString line;
+            init_String(&line);
+            appendWords_(&line, scripts_[s].words, scripts_[s].numWords, 12, &seed,
+                         scripts_[s].separator);
+            pushBack_StringList(lines, &line);
+            deinit_String(&line);
+        }
+        const iString *name = collectNewCStr_String(scripts_[s].name);
+        for (int pass = 0; pass < 2; pass++) {
+            for (int r = 0; r < d->repeats; r++) {
+                if (pass == 0) {
+                    clearShapeCache_Text(text);
+                }
+                begin_BenchPhase_(&timing);
+                iConstForEach(StringList, i, lines) {
+                    measureRange_Text(paragraph_FontId, range_String(i.value));
+                }
+                end_BenchPhase_(&timing);
+            }
+            report_Benchmark_(d, name, pass == 0 ? "shape" : "shape-cached", 0, &timing, NULL);
+        }
+    }
+    deinit_BenchPhase_(&timing);
+}
+
+#if !defined (iPlatformMsys)
+static int removeEntry_(const char *path, const struct stat *st, int type, struct FTW *ftw) {
+    iUnused(st, type, ftw);
+    return remove(path);
+}
+
+static void removeTree_(const char *path) {
+    /* Contents first, then the directory itself. */
+    nftw(path, removeEntry_, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+static void runVisited_Benchmark_(const iBenchmark *d) {
+    /* Loading the history file, as done at launch. */
+    char dir[] = "/tmp/lagrange-bench-visited-XXXXXX";
+    if (!mkdtemp(dir)) {
+        fprintf(stderr, "[bench] cannot create a directory for the visited URLs\n");
+        return;
+    }
+    iVisited *visited = new_Visited();
+    for (size_t i = 0; i < d->numVisited; i++) {
+        visitUrl_Visited(visited,
+                         collectNewFormat_String("gemini://host%zu.example.com/%s/%zu.gmi",
+                                                 i % 500,
+                                                 latinWords_[i % iElemCount(latinWords_)],
+                                                 i),
+                         i % 10 == 0 ? kept_VisitedUrlFlag : 0);
+    }
+    save_Visited(visited, dir);
+    flush_SaveQueue();
+    iBenchPhase timing;
+    init_BenchPhase_(&timing);
+    for (int r = 0; r < d->repeats; r++) {
+        clear_Visited(visited);
+        begin_BenchPhase_(&timing);
+        load_Visited(visited, dir);
+        end_BenchPhase_(&timing);
+    }
+    report_Benchmark_(d, collectNewCStr_String("builtin:visited"), "load", 0, &timing, NULL);
+    deinit_BenchPhase_(&timing);
+    delete_Visited(visited);
+    removeTree_(dir);
+}
+#endif
+
+/*----------------------------------------------------------------------------------------------*/
+/* Request pipeline: a loopback server answers many concurrent GmRequests. Gemini and Titan
+   need a TLS server, so they are only measured when OpenSSL is available (see CMakeLists). */
+
+#if !defined (iPlatformMsys)
+
+iDeclareType(LoopbackServer)
+iDeclareType(LoopbackConnection)
+iDeclareType(NetBench)
+
+enum iLoopbackProtocol {
+    gopher_LoopbackProtocol,
+    gemini_LoopbackProtocol,
+    titan_LoopbackProtocol,
+};
+
+static const char *protocolNames_LoopbackServer_[] = { "gopher", "gemini", "titan" };
+
+static const size_t numServerThreads_LoopbackServer_ = 4;
+
+/* If no request finishes in this many seconds, the remaining ones are cancelled. */
+static const double requestTimeout_NetBench_ = 30.0;
+
+struct Impl_LoopbackServer {
+    int        fd;
+    uint16_t   port;
+    enum iLoopbackProtocol protocol;
+    iAtomicInt isRunning;
+    iBlock     response;
+    iThread *  threads[4];
+#if defined (LAGRANGE_BENCH_TLS)
+    SSL_CTX *  tls; /* NULL for Gopher */
+#endif
+};
+
+struct Impl_LoopbackConnection {
+    int   fd;
+#if defined (LAGRANGE_BENCH_TLS)
+    SSL * tls;
+#endif
+};
+
+struct Impl_NetBench {
+    iMutex     mtx;
+    iCondition finished;
+    iPtrArray  done; /* finished requests waiting to be collected */
+};
+
+static ssize_t receive_LoopbackConnection_(iLoopbackConnection *d, void *buf, size_t size) {
+#if defined (LAGRANGE_BENCH_TLS)
+    if (d->tls) {
+        const int n = SSL_read(d->tls, buf, (int) size);
+        return n > 0 ? n : -1;
+    }
+#endif
+    return recv(d->fd, buf, size, 0);
+}
+
+static void send_LoopbackConnection_(iLoopbackConnection *d, const iBlock *data) {
+    const char *ptr       = constData_Block(data);
+    size_t      remaining = size_Block(data);
+    while (remaining > 0) {
+#if defined (LAGRANGE_BENCH_TLS)
+        const ssize_t n = d->tls ? SSL_write(d->tls, ptr, (int) remaining)
+                                 : send(d->fd, ptr, remaining, 0);
+#else
+        const ssize_t n = send(d->fd, ptr, remaining, 0);
+#endif
+        if (n <= 0) break;
+        ptr += n;
+        remaining -= n;
+    }
+}
+
+static void serve_LoopbackConnection_(iLoopbackConnection *d, const iLoopbackServer *server) {
+    /* The selector or URL is not needed, just wait until the request line has been
+       received. A Titan upload is read in full before responding. */
+    char        buf[4096];
+    size_t      len = 0;
+    const char *eol = NULL;
+    while (len < sizeof(buf) - 1 && !eol) {
+        const ssize_t n = receive_LoopbackConnection_(d, buf + len, sizeof(buf) - 1 - len);
+        if (n <= 0) break;
+        len += n;
+        eol = memchr(buf, '\n', len);
+    }
+    if (!eol) {
+        return;
+    }
+    if (server->protocol == titan_LoopbackProtocol) {
+        buf[len] = 0;
+        const char *param = strstr(buf, ";size=");
+        const size_t size = param && param < eol ? strtoul(param + 6, NULL, 10) : 0;
+        size_t received = len - (eol + 1 - buf);
+        while (received < size) {
+            const ssize_t n =
+                receive_LoopbackConnection_(d, buf, iMin(sizeof(buf), size - received));
+            if (n <= 0) return;
+            received += n;
+        }
+    }
+    send_LoopbackConnection_(d, &server->response);
+}
+
+static iThreadResult serve_LoopbackServer_(iThread *thd) {
+    iLoopbackServer *d = userData_Thread(thd);
+    while (value_Atomic(&d->isRunning)) {
+        struct pollfd pfd = { d->fd, POLLIN, 0 };
+        if (poll(&pfd, 1, 100) <= 0) {
+            continue;
+        }
+        const int fd = accept(d->fd, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        /* A stalled client must not keep the server from stopping. */
+        const struct timeval timeout = { 5, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+        iLoopbackConnection conn = { .fd = fd };
+#if defined (LAGRANGE_BENCH_TLS)
+        if (d->tls) {
+            conn.tls = SSL_new(d->tls);
+            SSL_set_fd(conn.tls, fd);
+            if (SSL_accept(conn.tls) == 1) {
+                serve_LoopbackConnection_(&conn, d);
+                SSL_shutdown(conn.tls);
+            }
+            SSL_free(conn.tls);
+            close(fd);
+            continue;
+        }
+#endif
+        serve_LoopbackConnection_(&conn, d);
+        close(fd);
+    }
+    return 0;
+}
+
+#if defined (LAGRANGE_BENCH_TLS)
+static SSL_CTX *newTlsContext_LoopbackServer_(void) {
+    /* A throwaway self-signed certificate; the client trusts it on first use. */
+    iDate until;
+    initCurrent_Date(&until);
+    until.year++;
+    const iString *host = collectNewCStr_String("127.0.0.1");
+    const iTlsCertificateName names[] = {
+        { issuerCommonName_TlsCertificateNameType,  host },
+        { subjectCommonName_TlsCertificateNameType, host },
+        { 0, NULL }
+    };
+    iTlsCertificate *cert    = newSelfSignedRSA_TlsCertificate(2048, until, names);
+    const iString *  certPem = collect_String(pem_TlsCertificate(cert));
+    const iString *  keyPem  = collect_String(privateKeyPem_TlsCertificate(cert));
+    delete_TlsCertificate(cert);
+    SSL_CTX * ctx     = SSL_CTX_new(TLS_server_method());
+    BIO *     certBio = BIO_new_mem_buf(cstr_String(certPem), (int) size_String(certPem));
+    BIO *     keyBio  = BIO_new_mem_buf(cstr_String(keyPem), (int) size_String(keyPem));
+    X509 *    x509    = PEM_read_bio_X509(certBio, NULL, NULL, NULL);
+    EVP_PKEY *pkey    = PEM_read_bio_PrivateKey(keyBio, NULL, NULL, NULL);
+    const iBool isOk  = ctx && x509 && pkey && SSL_CTX_use_certificate(ctx, x509) == 1 &&
+                        SSL_CTX_use_PrivateKey(ctx, pkey) == 1;
+    X509_free(x509);
+    EVP_PKEY_free(pkey);
+    BIO_free(certBio);
+    BIO_free(keyBio);
+    if (!isOk) {
+        SSL_CTX_free(ctx);
+        return NULL;
+    }
+    return ctx;
+}
+#endif
+
+static iBool start_LoopbackServer_(iLoopbackServer *d, enum iLoopbackProtocol protocol,
+                                   size_t responseSize) {
+    iZap(*d);
+    d->protocol = protocol;
+#if defined (LAGRANGE_BENCH_TLS)
+    if (protocol != gopher_LoopbackProtocol) {
+        d->tls = newTlsContext_LoopbackServer_();
+        if (!d->tls) {
+            return iFalse;
+        }
+    }
+#else
+    if (protocol != gopher_LoopbackProtocol) {
+        return iFalse;
+    }
+#endif
+    d->fd = socket(AF_INET, SOCK_STREAM, 0);
+    const int reuse = 1;
+    struct sockaddr_in addr = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_LOOPBACK) };
+    socklen_t addrLen = sizeof(addr);
+    if (d->fd < 0 ||
+        setsockopt(d->fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(d->fd, (const struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(d->fd, 1024) != 0 ||
+        getsockname(d->fd, (struct sockaddr *) &addr, &addrLen) != 0) {
+        if (d->fd >= 0) {
+            close(d->fd);
+        }
+#if defined (LAGRANGE_BENCH_TLS)
+        SSL_CTX_free(d->tls);
+#endif
+        return iFalse;
+    }
+    d->port = ntohs(addr.sin_port);
+    iString *response = new_String();
+    if (protocol == gopher_LoopbackProtocol) {
+        while (size_String(response) < responseSize) {
+            makeGopherMenu_(response, 100);
+            /* Keep the terminator last. */
+            truncate_Block(&response->chars, size_String(response) - 3);
+        }
+        appendCStr_String(response, ".\r\n");
+    }
+    else if (protocol == gemini_LoopbackProtocol) {
+        setCStr_String(response, "20 text/gemini\r\n");
+        while (size_String(response) < responseSize) {
+            makeGemtext_(response, 1);
+        }
+    }
+    else {
+        /* The upload is the large part. */
+        setCStr_String(response, "20 text/gemini\r\n# Uploaded\n");
+    }
+    initCopy_Block(&d->response, utf8_String(response));
+    delete_String(response);
+    set_Atomic(&d->isRunning, iTrue);
+    for (size_t i = 0; i < numServerThreads_LoopbackServer_; i++) {
+        d->threads[i] = new_Thread(serve_LoopbackServer_);
+        setUserData_Thread(d->threads[i], d);
+        start_Thread(d->threads[i]);
+    }
+    return iTrue;
+}
+
+static void stop_LoopbackServer_(iLoopbackServer *d) {
+    set_Atomic(&d->isRunning, iFalse);
+    for (size_t i = 0; i < numServerThreads_LoopbackServer_; i++) {
+        join_Thread(d->threads[i]);
+        iRelease(d->threads[i]);
+    }
+    close(d->fd);
+    deinit_Block(&d->response);
+#if defined (LAGRANGE_BENCH_TLS)
+    SSL_CTX_free(d->tls);
+#endif
+}
+
+static void requestFinished_NetBench_(iAnyObject *obj, iGmRequest *req) {
+    /* Called in a request thread. */
+    iNetBench *d = obj;
+    lock_Mutex(&d->mtx);
+    pushBack_PtrArray(&d->done, req);
+    signal_Condition(&d->finished);
+    unlock_Mutex(&d->mtx);
+}
+
+static int cmpTiming_(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static iBool collect_NetBench_(iNetBench *d, iPtrArray *finished, double timeoutSeconds) {
+    /* Returns false if nothing finished before the timeout. */
+    iTime until;
+    initTimeout_Time(&until, timeoutSeconds);
+    lock_Mutex(&d->mtx);
+    while (isEmpty_PtrArray(&d->done)) {
+        waitTimeout_Condition(&d->finished, &d->mtx, &until);
+        if (isEmpty_PtrArray(&d->done) && elapsedSeconds_Time(&until) >= 0) {
+            break;
+        }
+    }
+    while (!isEmpty_PtrArray(&d->done)) {
+        void *req;
+        take_PtrArray(&d->done, 0, &req);
+        pushBack_PtrArray(finished, req);
+    }
+    unlock_Mutex(&d->mtx);
+    return !isEmpty_PtrArray(finished);
+}
+
+static void runLoopback_Benchmark_(const iBenchmark *d, enum iLoopbackProtocol protocol) {
+    const char *name = cstrCollect_String(
+        newFormat_String("loopback:%s", protocolNames_LoopbackServer_[protocol]));
+    iLoopbackServer server;
+    if (!start_LoopbackServer_(&server, protocol, d->responseSize)) {
+        fprintf(stderr, "[bench] cannot start the %s server\n", name);
+        return;
+    }
+    const iString *url =
+        protocol == gopher_LoopbackProtocol
+            ? collectNewFormat_String("gopher://127.0.0.1:%u/1/bench", server.port)
+            : collectNewFormat_String("%s://127.0.0.1:%u/bench.gmi",
+                                      protocolNames_LoopbackServer_[protocol], server.port);
+    const iBlock *upload =
+        collect_Block(new_Block(protocol == titan_LoopbackProtocol ? d->responseSize : 0));
+    iNetBench nb;
+    init_Mutex(&nb.mtx);
+    init_Condition(&nb.finished);
+    init_PtrArray(&nb.done);
+    /* Per-phase latencies in milliseconds. */
+    static const char *phaseNames[] = { "connected", "firstByte", "finished" };
+    iArray timings[iElemCount(phaseNames)];
+    iForIndices(i, timings) {
+        init_Array(&timings[i], sizeof(uint32_t));
+    }
+    iPtrArray active;
+    init_PtrArray(&active);
+    size_t numSubmitted = 0, numCompleted = 0, numFailed = 0, numTimedOut = 0;
+    uint64_t numBytes = 0;
+    iBool isCancelled = iFalse;
+    const size_t startAllocs = numAllocs_Benchmark_();
+    iTime start;
+    initCurrent_Time(&start);
+    while (numCompleted < d->numRequests) {
+        while (!isCancelled && numSubmitted < d->numRequests &&
+               size_PtrArray(&active) < d->concurrency) {
+            iGmRequest *req = new_GmRequest(certs_App());
+            iConnect(GmRequest, req, finished, &nb, requestFinished_NetBench_);
+            setUrl_GmRequest(req, url);
+            if (protocol == titan_LoopbackProtocol) {
+                setTitanData_GmRequest(req, collectNewCStr_String("text/plain"), upload,
+                                       collectNew_String());
+            }
+            submit_GmRequest(req);
+            pushBack_PtrArray(&active, req);
+            numSubmitted++;
+        }
+        iPtrArray finished;
+        init_PtrArray(&finished);
+        if (!collect_NetBench_(&nb, &finished, requestTimeout_NetBench_)) {
+            deinit_PtrArray(&finished);
+            if (isCancelled) {
+                /* Even cancelling did not finish these. They are leaked rather than
+                   released from under their threads. */
+                numTimedOut = size_PtrArray(&active);
+                iForEach(PtrArray, j, &active) {
+                    iDisconnect(GmRequest, j.ptr, finished, &nb, requestFinished_NetBench_);
+                }
+                fprintf(stderr, "[bench] %s: %zu requests did not finish\n", name, numTimedOut);
+                break;
+            }
+            fprintf(stderr, "[bench] %s: timed out, cancelling %zu requests\n", name,
+                    size_PtrArray(&active));
+            iForEach(PtrArray, i, &active) {
+                cancel_GmRequest(i.ptr);
+            }
+            /* Unsubmitted requests are counted as failed. */
+            numFailed += d->numRequests - numSubmitted;
+            numCompleted += d->numRequests - numSubmitted;
+            isCancelled = iTrue;
+            continue;
+        }
+        iForEach(PtrArray, i, &finished) {
+            iGmRequest *req = i.ptr;
+            const iGmResponse *resp = lockResponse_GmRequest(req);
+            if (resp->statusCode == success_GmStatusCode) {
+                const uint32_t phases[] = { resp->timing.connected,
+                                            resp->timing.firstByte,
+                                            resp->timing.finished };
+                iForIndices(p, phases) {
+                    pushBack_Array(&timings[p], &phases[p]);
+                }
+                numBytes += resp->timing.numBytes;
+            }
+            else {
+                numFailed++;
+            }
+            unlockResponse_GmRequest(req);
+            removeOne_PtrArray(&active, req);
+            iRelease(req);
+            numCompleted++;
+        }
+        deinit_PtrArray(&finished);
+    }
+    const double seconds = elapsedSeconds_Time(&start);
+    fprintf(d->out,
+            "{\"document\":\"%s\",\"phase\":\"requests\",\"requests\":%zu,"
+            "\"failed\":%zu,\"timedOut\":%zu,\"concurrency\":%zu,\"bytes\":%llu,\"ms\":%.3f,"
+            "\"perSecond\":%.1f,\"allocs\":%zu,\"peakMemoryKB\":%zu}\n",
+            name,
+            d->numRequests,
+            numFailed + numTimedOut,
+            numTimedOut,
+            d->concurrency,
+            (unsigned long long) numBytes,
+            seconds * 1000.0,
+            seconds > 0 ? d->numRequests / seconds : 0.0,
+            numAllocs_Benchmark_() - startAllocs,
+            peakMemoryKB_());
+    iForIndices(p, timings) {
+        iArray *t = &timings[p];
+        if (!isEmpty_Array(t)) {
+            sort_Array(t, cmpTiming_);
+            const uint32_t *values = constData_Array(t);
+            const size_t    n      = size_Array(t);
+            uint64_t sum = 0;
+            for (size_t i = 0; i < n; i++) {
+                sum += values[i];
+            }
+            fprintf(d->out,
+                    "{\"document\":\"%s\",\"phase\":\"%s\",\"mean\":%.2f,"
+                    "\"p50\":%u,\"p95\":%u,\"max\":%u}\n",
+                    name,
+                    phaseNames[p],
+                    (double) sum / n,
+                    values[n / 2],
+                    values[n * 95 / 100],
+                    values[n - 1]);
+            record_Benchmark_(d, collectNewCStr_String(name), phaseNames[p], 0,
+                              values[n / 2], 0);
+        }
+        deinit_Array(t);
+    }
+    fflush(d->out);
+    deinit_PtrArray(&active);
+    deinit_PtrArray(&nb.done);
+    deinit_Condition(&nb.finished);
+    deinit_Mutex(&nb.mtx);
+    stop_LoopbackServer_(&server);
+}
+
+static void runNetwork_Benchmark_(const iBenchmark *d) {
+    runLoopback_Benchmark_(d, gopher_LoopbackProtocol);
+#if defined (LAGRANGE_BENCH_TLS)
+    runLoopback_Benchmark_(d, gemini_LoopbackProtocol);
+    runLoopback_Benchmark_(d, titan_LoopbackProtocol);
+#else
+    fprintf(stderr, "[bench] built without OpenSSL; skipping the Gemini and Titan requests\n");
+#endif
+}
+
+#endif /* !iPlatformMsys */
+
+static iRangecc jsonField_(iRangecc line, const char *key) {
+    /* Raw text of a field's value in a line written by `report_Benchmark_`. A string value
+       includes its quotes and escapes. */
+    const char *text = cstr_Rangecc(line); /* collected, NULL-terminated */
+    const char *pat  = cstrFormat_String("\"%s\":", key);
+    const char *pos  = strstr(text, pat);
+    if (!pos) {
+        return iNullRange;
+    }
+    iRangecc    value = { pos + strlen(pat), pos + strlen(pat) };
+    const char *end   = text + size_Range(&line);
+    iBool isQuoted = (value.end < end && *value.end == '"');
+    for (value.end += isQuoted; value.end < end; value.end++) {
+        if (isQuoted) {
+            if (*value.end == '\\') {
+                value.end++;
+            }
+            else if (*value.end == '"') {
+                value.end++;
+                break;
+            }
+        }
+        else if (*value.end == ',' || *value.end == '}') {
+            break;
+        }
+    }
+    return value;
+}
+
+static const iBenchResult *findResult_Benchmark_(const iBenchmark *d, const iString *key) {
+    iConstForEach(Array, i, d->results) {
+        const iBenchResult *res = i.value;
+        if (equal_String(&res->key, key)) {
+            return res;
+        }
+    }
+    return NULL;
+}
+
+static int compareBaseline_Benchmark_(const iBenchmark *d) {
+    /* Returns the number of measurements whose median is slower than the baseline by more
+       than the threshold, or that allocate more by more than the threshold. Tiny absolute
+       differences are ignored as noise. */
+    static const double minDifferenceMs     = 0.05;
+    static const size_t minDifferenceAllocs = 16;
+    iFile *f = iClob(new_File(d->baselinePath));
+    if (!open_File(f, readOnly_FileMode | text_FileMode)) {
+        fprintf(stderr, "[bench] no baseline at %s; nothing to compare\n",
+                cstr_String(d->baselinePath));
+        return 0;
+    }
+    const iRangecc src = range_Block(collect_Block(readAll_File(f)));
+    iRangecc line = iNullRange;
+    int numRegressed = 0, numCompared = 0;
+    while (nextSplit_Rangecc(src, "\n", &line)) {
+        const iRangecc doc    = jsonField_(line, "document");
+        const iRangecc phase  = jsonField_(line, "phase");
+        iRangecc       median = jsonField_(line, "median");
+        if (!median.start) {
+            median = jsonField_(line, "p50");
+        }
+        if (!doc.start || size_Range(&phase) < 2 || !median.start) {
+            continue;
+        }
+        const iRangecc width = jsonField_(line, "width");
+        iString *key = collectNewRange_String(doc);
+        appendFormat_String(key, " %s %d",
+                            cstr_Rangecc((iRangecc){ phase.start + 1, phase.end - 1 }),
+                            width.start ? atoi(cstr_Rangecc(width)) : 0);
+        const iBenchResult *res = findResult_Benchmark_(d, key);
+        if (!res) {
+            continue;
+        }
+        const double base = strtod(cstr_Rangecc(median), NULL);
+        const double diff = res->median - base;
+        numCompared++;
+        if (base > 0.0 && diff > minDifferenceMs && diff * 100.0 / base > d->threshold) {
+            fprintf(stderr, "[bench] REGRESSION %s: median %.3f ms, baseline %.3f ms (+%.1f%%)\n",
+                    cstr_String(key), res->median, base, diff * 100.0 / base);
+            numRegressed++;
+        }
+        const iRangecc allocs = jsonField_(line, "allocs");
+        if (allocs.start) {
+            const size_t baseAllocs = strtoul(cstr_Rangecc(allocs), NULL, 10);
+            if (baseAllocs > 0 && res->allocs > baseAllocs + minDifferenceAllocs &&
+                (res->allocs - baseAllocs) * 100.0 / baseAllocs > d->threshold) {
+                fprintf(stderr, "[bench] REGRESSION %s: %zu allocations, baseline %zu (+%.1f%%)\n",
+                        cstr_String(key), res->allocs, baseAllocs,
+                        (res->allocs - baseAllocs) * 100.0 / baseAllocs);
+                numRegressed++;
+            }
+        }
+    }
+    fprintf(stderr, "[bench] compared %d measurements against %s: %d slower than %.1f%%\n",
+            numCompared, cstr_String(d->baselinePath), numRegressed, d->threshold);
+    return numRegressed;
+}
+
+int run_Benchmark(void) {
+    iBenchmark *d = &bench_;
+    d->out = stdout;
+    if (!isEmpty_String(d->outputPath)) {
+        d->out = fopen(cstr_String(d->outputPath), "w");
+        if (!d->out) {
+            fprintf(stderr, "[bench] cannot write %s\n", cstr_String(d->outputPath));
+            return 1;
+        }
+    }
+    d->results = new_Array(sizeof(iBenchResult));
+    iArray *docs = new_Array(sizeof(iBenchDocument));
+    makeCorpus_Benchmark_(d, docs);
+    iForEach(Array, i, docs) {
+        iBenchDocument *doc = i.value;
+        iBeginCollect();
+        if (doc->isImage) {
+            runImage_Benchmark_(d, doc);
+        }
+        else {
+            runDocument_Benchmark_(d, doc);
+        }
+        iEndCollect();
+        deinit_BenchDocument_(doc);
+    }
+    delete_Array(docs);
+    iBeginCollect();
+    runShaping_Benchmark_(d);
+    if (d->numFeedEntries) {
+        runFeed_Benchmark_(d);
+    }
+    if (d->numVisited) {
+#if !defined (iPlatformMsys)
+        runVisited_Benchmark_(d);
+#else
+        fprintf(stderr, "[bench] the visited URLs benchmark is not available on this platform\n");
+#endif
+    }
+    iEndCollect();
+    if (d->numRequests) {
+#if !defined (iPlatformMsys)
+        runNetwork_Benchmark_(d);
+#else
+        fprintf(stderr, "[bench] the network benchmark is not available on this platform\n");
+#endif
+    }
+    if (d->out != stdout) {
+        fclose(d->out);
+    }
+    int rc = 0;
+    if (!isEmpty_String(d->baselinePath)) {
+        iBeginCollect();
+        rc = compareBaseline_Benchmark_(d) ? 3 : 0;
+        iEndCollect();
+    }
+    iForEach(Array, r, d->results) {
+        deinit_String(&((iBenchResult *) r.value)->key);
+    }
+    delete_Array(d->results);
+    d->results = NULL;
+    return rc;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void parseWidths_Benchmark_(iBenchmark *d, const char *arg) {
+    d->numWidths = 0;
+    iRangecc seg = iNullRange;
+    while (nextSplit_Rangecc(range_CStr(arg), ",", &seg) && d->numWidths < iElemCount(d->widths)) {
+        const int width = atoi(cstr_Rangecc(seg));
+        if (width > 0) {
+            d->widths[d->numWidths++] = width;
+        }
+    }
+}
+
+static void printUsage_(void) {
+    puts("Usage: lagrange-bench [options] [files or directories]\n\n"
+         "Measures parsing, layout, searching, text shaping and rendering, feed parsing,\n"
+         "loading of visited URLs, and image decoding using a built-in corpus and any\n"
+         "additional documents given on the command line. Results are printed as JSON\n"
+         "objects, one per line, with the mean, median, and 95th percentile of the repeats.\n\n"
+         "  -o, --output FILE    Write the results to FILE.\n"
+         "  -w, --widths LIST    Comma-separated layout widths in pixels (default: 480,960,1920).\n"
+         "  -f, --find TEXT      Text to search for (default: \"the\").\n"
+         "  -r, --repeat N       Repeat each measurement N times (default: 3).\n"
+         "  -n, --network N      Also send N Gopher, Gemini, and Titan requests to loopback\n"
+         "                       servers.\n"
+         "  -c, --concurrency N  Number of simultaneous requests (default: 32).\n"
+         "  -s, --size BYTES     Size of each loopback response or upload (default: 65536).\n"
+         "      --feed N         Number of entries in the Atom feed (default: 2000; 0 skips).\n"
+         "      --visited N      Number of visited URLs to load (default: 20000; 0 skips).\n"
+         "  -b, --baseline FILE  Compare the medians against earlier results in FILE.\n"
+         "  -t, --threshold PCT  Allowed slowdown compared to the baseline (default: 10).\n\n"
+         "Images given on the command line are decoded. The exit code is 3 if any measurement\n"
+         "is slower than the baseline by more than the threshold.\n");
+}
+
+int main(int argc, char **argv) {
+    iBenchmark *d = &bench_;
+    init_Foundation();
+    d->paths      = new_StringList();
+    d->outputPath = new_String();
+    d->findText   = newCStr_String("the");
+    d->repeats    = 3;
+    d->concurrency  = 32;
+    d->responseSize = 64 * 1024;
+    d->numFeedEntries = 2000;
+    d->numVisited     = 20000;
+    d->baselinePath   = new_String();
+    d->threshold      = 10.0;
+    parseWidths_Benchmark_(d, "480,960,1920");
+    for (int i = 1; i < argc; i++) {
+        const char *arg     = argv[i];
+        const char *nextArg = i + 1 < argc ? argv[i + 1] : NULL;
+        if (!iCmpStr(arg, "-h") || !iCmpStr(arg, "--help")) {
+            printUsage_();
+            return 0;
+        }
+        else if ((!iCmpStr(arg, "-o") || !iCmpStr(arg, "--output")) && nextArg) {
+            setCStr_String(d->outputPath, nextArg);
+            i++;
+        }
+        else if ((!iCmpStr(arg, "-w") || !iCmpStr(arg, "--widths")) && nextArg) {
+            parseWidths_Benchmark_(d, nextArg);
+            i++;
+        }
+        else if ((!iCmpStr(arg, "-f") || !iCmpStr(arg, "--find")) && nextArg) {
+            setCStr_String(d->findText, nextArg);
+            i++;
+        }
+        else if ((!iCmpStr(arg, "-r") || !iCmpStr(arg, "--repeat")) && nextArg) {
+            d->repeats = iMax(1, atoi(nextArg));
+            i++;
+        }
+        else if ((!iCmpStr(arg, "-n") || !iCmpStr(arg, "--network")) && nextArg) {
+            d->numRequests = strtoul(nextArg, NULL, 10);
+            i++;
+        }
+        else if ((!iCmpStr(arg, "-c") || !iCmpStr(arg, "--concurrency")) && nextArg) {
+            d->concurrency = iMax(1u, strtoul(nextArg, NULL, 10));
+            i++;
+        }
+        else if ((!iCmpStr(arg, "-s") || !iCmpStr(arg, "--size")) && nextArg) {
+            d->responseSize = strtoul(nextArg, NULL, 10);
+            i++;
+        }
+        else if (!iCmpStr(arg, "--feed") && nextArg) {
+            d->numFeedEntries = strtoul(nextArg, NULL, 10);
+            i++;
+        }
+        else if (!iCmpStr(arg, "--visited") && nextArg) {
+            d->numVisited = strtoul(nextArg, NULL, 10);
+            i++;
+        }
+        else if ((!iCmpStr(arg, "-b") || !iCmpStr(arg, "--baseline")) && nextArg) {
+            setCStr_String(d->baselinePath, nextArg);
+            i++;
+        }
+        else if ((!iCmpStr(arg, "-t") || !iCmpStr(arg, "--threshold")) && nextArg) {
+            d->threshold = iMax(0.0, strtod(nextArg, NULL));
+            i++;
+        }
+        else {
+            pushBackCStr_StringList(d->paths, arg);
+        }
+    }
+    if (d->numWidths == 0) {
+        parseWidths_Benchmark_(d, "480,960,1920");
+    }
+#if !defined (iPlatformMsys)
+    /* Don't touch the user's configuration. The directory is removed before exiting. */
+    char tempDir[] = "/tmp/lagrange-bench-XXXXXX";
+    const iBool isTempDirCreated = (mkdtemp(tempDir) != NULL);
+    if (isTempDirCreated) {
+        setenv("XDG_CONFIG_HOME", tempDir, 1);
+    }
+    setenv("SDL_VIDEODRIVER", "dummy", 0);
+    signal(SIGPIPE, SIG_IGN); /* the loopback server may outlive a canceled request */
+#endif
+    SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+    if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_TIMER)) {
+        fprintf(stderr, "[SDL] init failed: %s\n", SDL_GetError());
+#if !defined (iPlatformMsys)
+        if (isTempDirCreated) {
+            removeTree_(tempDir);
+        }
+#endif
+        return -1;
+    }
+    char *appArgs[] = { argv[0], "--sw" };
+    const int rc = run_App(iElemCount(appArgs), appArgs);
+    SDL_Quit();
+#if !defined (iPlatformMsys)
+    if (isTempDirCreated) {
+        removeTree_(tempDir);
+    }
+#endif
+    delete_String(d->baselinePath);
+    delete_String(d->findText);
+    delete_String(d->outputPath);
+    iRelease(d->paths);
+    deinit_Foundation();
+    return rc;
+}
@@ -24,12 +24,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "visited.h"
 #include "gmrequest.h"
 #include "app.h"
+#include "savequeue.h"
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/hash.h>
+#include <the_Foundation/intset.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/regexp.h>
+#include <the_Foundation/sortedarray.h>
 #include <the_Foundation/stringset.h>
 #include <the_Foundation/toml.h>
 
@@ -40,6 +43,7 @@ void init_Bookmark(iBookmark *d) {
     iZap(d->when);
     d->parentId = 0;
     d->order = 0;
+    d->urlHash = 0;
 }
 
 void deinit_Bookmark(iBookmark *d) {
@@ -92,22 +96,110 @@ iBool filterInsideFolder_Bookmark(void *context, const iBookmark *bm) {
 static const char *oldFileName_Bookmarks_ = "bookmarks.txt";
 static const char *fileName_Bookmarks_    = "bookmarks.ini"; /* since v1.7 (TOML subset) */
 
+iDeclareType(BookmarkUrl)
+
+struct Impl_BookmarkUrl {
+    uint64_t hash; /* of the canonical URL, case insensitive */
+    uint32_t id;
+};
+
+static int cmp_BookmarkUrl_(const void *a, const void *b) {
+    const iBookmarkUrl *x = a, *y = b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return iCmp(x->id, y->id);
+}
+
+static uint64_t urlHash_Bookmarks_(const iString *url) {
+    /* FNV-1a of the canonical URL. URLs are compared case-insensitively. */
+    const iString *canon = canonicalUrl_String(url);
+    uint64_t hash = 14695981039346656037ull;
+    iConstForEach(String, i, canon) {
+        hash = (hash ^ (uint64_t) lower_Char(i.value)) * 1099511628211ull;
+    }
+    return hash;
+}
+
+iDeclareType(RemoteSource)
+
+struct Impl_RemoteSource {
+    uint32_t id;       /* bookmark ID of the source */
+    uint64_t bodyHash; /* of the latest imported response */
+};
+
+static int cmp_RemoteSource_(const void *a, const void *b) {
+    return iCmp(((const iRemoteSource *) a)->id, ((const iRemoteSource *) b)->id);
+}
+
+iDeclareType(RemoteLink)
+
+/* A remote bookmark belongs to all the sources that link to its URL. Its `parentId` is one
+   of them. */
+struct Impl_RemoteLink {
+    uint32_t bookmarkId;
+    uint32_t sourceId;
+};
+
+static int cmp_RemoteLink_(const void *a, const void *b) {
+    const iRemoteLink *x = a, *y = b;
+    const int cmp = iCmp(x->bookmarkId, y->bookmarkId);
+    return cmp ? cmp : iCmp(x->sourceId, y->sourceId);
+}
+
+static const size_t maxConcurrentRemoteRequests_Bookmarks_ = 4;
+
 struct Impl_Bookmarks {
     iMutex *  mtx;
     int       idEnum;
     iHash     bookmarks; /* bookmark ID is the hash key */
+    iSortedArray urls; /* BookmarkUrls, for finding bookmarks by URL */
     uint32_t  recentFolderId; /* recently interacted with */
     iPtrArray remoteRequests;   
+    iArray    pendingRemote;  /* IDs of remote sources waiting to be fetched */
+    iSortedArray remoteSources; /* RemoteSources that have been imported */
+    iSortedArray remoteLinks; /* RemoteLinks of the imported bookmarks */
+    iBool     isRemoteChanged; /* during the ongoing fetch */
 };
 
 iDefineTypeConstruction(Bookmarks)
 
+/* The URL index must be updated whenever bookmarks are added or removed, or their URL
+   is changed. `mtx` must be held. */
+
+static void indexUrl_Bookmarks_(iBookmarks *d, iBookmark *bm) {
+    bm->urlHash = urlHash_Bookmarks_(&bm->url);
+    insert_SortedArray(&d->urls, &(iBookmarkUrl){ bm->urlHash, id_Bookmark(bm) });
+}
+
+static void unindexUrl_Bookmarks_(iBookmarks *d, const iBookmark *bm) {
+    size_t pos;
+    if (locate_SortedArray(&d->urls, &(iBookmarkUrl){ bm->urlHash, id_Bookmark(bm) }, &pos)) {
+        remove_Array(&d->urls.values, pos);
+    }
+}
+
+static void rebuildUrlIndex_Bookmarks_(iBookmarks *d) {
+    clear_SortedArray(&d->urls);
+    iForEach(Hash, i, &d->bookmarks) {
+        iBookmark *bm = (iBookmark *) i.value;
+        bm->urlHash = urlHash_Bookmarks_(&bm->url);
+        pushBack_Array(&d->urls.values, &(iBookmarkUrl){ bm->urlHash, id_Bookmark(bm) });
+    }
+    sort_Array(&d->urls.values, cmp_BookmarkUrl_);
+}
+
 void init_Bookmarks(iBookmarks *d) {
     d->mtx = new_Mutex();
     d->idEnum = 0;
     init_Hash(&d->bookmarks);
+    init_SortedArray(&d->urls, sizeof(iBookmarkUrl), cmp_BookmarkUrl_);
     d->recentFolderId = 0;
     init_PtrArray(&d->remoteRequests);
+    init_Array(&d->pendingRemote, sizeof(uint32_t));
+    init_SortedArray(&d->remoteSources, sizeof(iRemoteSource), cmp_RemoteSource_);
+    init_SortedArray(&d->remoteLinks, sizeof(iRemoteLink), cmp_RemoteLink_);
+    d->isRemoteChanged = iFalse;
 }
 
 void deinit_Bookmarks(iBookmarks *d) {
@@ -117,8 +209,12 @@ void deinit_Bookmarks(iBookmarks *d) {
         iRelease(i.ptr);
     }
     deinit_PtrArray(&d->remoteRequests);
+    deinit_Array(&d->pendingRemote);
+    deinit_SortedArray(&d->remoteSources);
+    deinit_SortedArray(&d->remoteLinks);
     clear_Bookmarks(d);
     deinit_Hash(&d->bookmarks);
+    deinit_SortedArray(&d->urls);
     delete_Mutex(d->mtx);
 }
 
@@ -128,6 +224,9 @@ void clear_Bookmarks(iBookmarks *d) {
         delete_Bookmark((iBookmark *) i.value);
     }
     clear_Hash(&d->bookmarks);
+    clear_SortedArray(&d->urls);
+    clear_SortedArray(&d->remoteSources);
+    clear_SortedArray(&d->remoteLinks);
     d->idEnum = 0;
     unlock_Mutex(d->mtx);
 }
@@ -135,6 +234,7 @@ void clear_Bookmarks(iBookmarks *d) {
 static void insertId_Bookmarks_(iBookmarks *d, iBookmark *bookmark, int id) {
     bookmark->node.key = id;
     insert_Hash(&d->bookmarks, &bookmark->node);
+    indexUrl_Bookmarks_(d, bookmark);
 }
 
 static void insert_Bookmarks_(iBookmarks *d, iBookmark *bookmark) {
@@ -288,52 +388,52 @@ void load_Bookmarks(iBookmarks *d, const char *dirPath) {
     init_BookmarkLoader(&loader, d);
     load_BookmarkLoader(&loader, f);
     deinit_BookmarkLoader(&loader);
+    /* URLs were set after the bookmarks were inserted. */
+    lock_Mutex(d->mtx);
+    rebuildUrlIndex_Bookmarks_(d);
+    unlock_Mutex(d->mtx);
 }
 
 void save_Bookmarks(const iBookmarks *d, const char *dirPath) {
-    lock_Mutex(d->mtx);
     iRegExp *remotePattern = iClob(new_RegExp("\\bremote\\b", caseSensitive_RegExpOption));
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, fileName_Bookmarks_));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {        
-        iString *str = collectNew_String();
-        format_String(str, "recentfolder = %u\n\n", d->recentFolderId);
-        writeData_File(f, cstr_String(str), size_String(str));
-        iConstForEach(Hash, i, &d->bookmarks) {
-            const iBookmark *bm = (const iBookmark *) i.value;
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchString_RegExp(remotePattern, &bm->tags, &m)) {
-                /* Remote bookmarks are not saved. */
-                continue;
-            }
-            iBeginCollect();
-            format_String(str,
-                          "[%d]\n"
-                          "url = \"%s\"\n"
-                          "title = \"%s\"\n"
-                          "tags = \"%s\"\n"
-                          "icon = 0x%x\n"
-                          "created = %.0f  # %s\n",
-                          id_Bookmark(bm),
-                          cstrCollect_String(quote_String(&bm->url, iFalse)),
-                          cstrCollect_String(quote_String(&bm->title, iFalse)),
-                          cstrCollect_String(quote_String(&bm->tags, iFalse)),
-                          bm->icon,
-                          seconds_Time(&bm->when),
-                          cstrCollect_String(format_Time(&bm->when, "%Y-%m-%d")));
-            if (bm->parentId) {
-                appendFormat_String(str, "parent = %d\n", bm->parentId);
-            }
-            if (bm->order) {
-                appendFormat_String(str, "order = %d\n", bm->order);
-            }
-            appendCStr_String(str, "\n");
-            writeData_File(f, cstr_String(str), size_String(str));
-            iEndCollect();
-        }        
+    iString *str = new_String(); /* written in the background */
+    lock_Mutex(d->mtx);
+    format_String(str, "recentfolder = %u\n\n", d->recentFolderId);
+    iConstForEach(Hash, i, &d->bookmarks) {
+        const iBookmark *bm = (const iBookmark *) i.value;
+        iRegExpMatch m;
+        init_RegExpMatch(&m);
+        if (matchString_RegExp(remotePattern, &bm->tags, &m)) {
+            /* Remote bookmarks are not saved. */
+            continue;
+        }
+        iBeginCollect();
+        appendFormat_String(str,
+                            "[%d]\n"
+                            "url = \"%s\"\n"
+                            "title = \"%s\"\n"
+                            "tags = \"%s\"\n"
+                            "icon = 0x%x\n"
+                            "created = %.0f  # %s\n",
+                            id_Bookmark(bm),
+                            cstrCollect_String(quote_String(&bm->url, iFalse)),
+                            cstrCollect_String(quote_String(&bm->title, iFalse)),
+                            cstrCollect_String(quote_String(&bm->tags, iFalse)),
+                            bm->icon,
+                            seconds_Time(&bm->when),
+                            cstrCollect_String(format_Time(&bm->when, "%Y-%m-%d")));
+        if (bm->parentId) {
+            appendFormat_String(str, "parent = %d\n", bm->parentId);
+        }
+        if (bm->order) {
+            appendFormat_String(str, "order = %d\n", bm->order);
+        }
+        appendCStr_String(str, "\n");
+        iEndCollect();
     }
-    iRelease(f);
     unlock_Mutex(d->mtx);
+    write_SaveQueue(concatPath_CStr(dirPath, fileName_Bookmarks_), utf8_String(str));
+    delete_String(str);
 }
 
 static iRangei orderRange_Bookmarks_(const iBookmarks *d) {
@@ -383,8 +483,10 @@ iBool remove_Bookmarks(iBookmarks *d, uint32_t id) {
     if (bm) {
         /* Remove all the contained bookmarks as well. */
         iConstForEach(PtrArray, i, list_Bookmarks(d, NULL, filterInsideFolder_Bookmark, bm)) {
+            unindexUrl_Bookmarks_(d, i.ptr);
             delete_Bookmark((iBookmark *) remove_Hash(&d->bookmarks, id_Bookmark(i.ptr)));
         }
+        unindexUrl_Bookmarks_(d, bm);
         delete_Bookmark(bm);
     }
     unlock_Mutex(d->mtx);
@@ -449,10 +551,34 @@ iChar siteIcon_Bookmarks(const iBookmarks *d, const iString *url) {
     return icon;
 }
 
+size_t memorySize_Bookmarks(const iBookmarks *d) {
+    size_t size = 0;
+    lock_Mutex(d->mtx);
+    iConstForEach(Hash, i, &d->bookmarks) {
+        const iBookmark *bm = (const iBookmark *) i.value;
+        size += sizeof(iBookmark) + size_String(&bm->url) + size_String(&bm->title) +
+                size_String(&bm->tags);
+    }
+    size += size_Array(&d->urls.values) * sizeof(iBookmarkUrl);
+    unlock_Mutex(d->mtx);
+    return size;
+}
+
 iBookmark *get_Bookmarks(iBookmarks *d, uint32_t id) {
     return (iBookmark *) value_Hash(&d->bookmarks, id);
 }
 
+void setUrl_Bookmarks(iBookmarks *d, uint32_t id, const iString *url) {
+    lock_Mutex(d->mtx);
+    iBookmark *bm = get_Bookmarks(d, id);
+    if (bm) {
+        unindexUrl_Bookmarks_(d, bm);
+        set_String(&bm->url, url);
+        indexUrl_Bookmarks_(d, bm);
+    }
+    unlock_Mutex(d->mtx);
+}
+
 void reorder_Bookmarks(iBookmarks *d, uint32_t id, int newOrder) {
     lock_Mutex(d->mtx);
     iForEach(Hash, i, &d->bookmarks) {
@@ -473,16 +599,45 @@ iBool filterTagsRegExp_Bookmarks(void *regExp, const iBookmark *bm) {
     return matchString_RegExp(regExp, &bm->tags, &m);
 }
 
-static iBool matchUrl_(void *url, const iBookmark *bm) {
-    return equalCase_String(url, &bm->url);
+static uint32_t findUrl_Bookmarks_(const iBookmarks *d, const iString *url) {
+    /* `mtx` must be held. If there are many bookmarks with the same URL, the newest one
+       is returned. */
+    const uint64_t hash  = urlHash_Bookmarks_(url);
+    uint32_t       found = 0;
+    double         when  = 0.0;
+    size_t         pos;
+    locate_SortedArray(&d->urls, &(iBookmarkUrl){ hash, 0 }, &pos);
+    url = canonicalUrl_String(url);
+    for (; pos < size_SortedArray(&d->urls); pos++) {
+        const iBookmarkUrl *entry = constAt_SortedArray(&d->urls, pos);
+        if (entry->hash != hash) {
+            break;
+        }
+        const iBookmark *bm = value_Hash(&d->bookmarks, entry->id);
+        if (bm && equalCase_String(canonicalUrl_String(&bm->url), url) &&
+            (!found || seconds_Time(&bm->when) > when)) {
+            found = entry->id;
+            when  = seconds_Time(&bm->when);
+        }
+    }
+    return found;
 }
 
 uint32_t findUrl_Bookmarks(const iBookmarks *d, const iString *url) {
-    /* TODO: O(n), boo */
-    url = canonicalUrl_String(url);
-    const iPtrArray *found = list_Bookmarks(d, NULL, matchUrl_, (void *) url);
-    if (isEmpty_PtrArray(found)) return 0;
-    return id_Bookmark(constFront_PtrArray(found));
+    uint32_t id;
+    lock_Mutex(d->mtx);
+    id = findUrl_Bookmarks_(d, url);
+    unlock_Mutex(d->mtx);
+    return id;
+}
+
+void findUrls_Bookmarks(const iBookmarks *d, size_t count, const iString **urls,
+                        uint32_t *ids_out) {
+    lock_Mutex(d->mtx);
+    for (size_t i = 0; i < count; i++) {
+        ids_out[i] = urls[i] ? findUrl_Bookmarks_(d, urls[i]) : 0;
+    }
+    unlock_Mutex(d->mtx);
 }
 
 uint32_t recentFolder_Bookmarks(const iBookmarks *d) {
@@ -626,6 +781,147 @@ void remoteRequestFinished_Bookmarks_(iBookmarks *d, iGmRequest *req) {
     postCommandf_App("bookmarks.request.finished req:%p", req);
 }
 
+static uint64_t remoteHash_Bookmarks_(const iGmRequest *req) {
+    /* FNV-1a of the source URL and the response body. */
+    uint64_t hash = 14695981039346656037ull;
+    const iBlock *parts[2] = { &url_GmRequest(req)->chars, body_GmRequest(req) };
+    iForIndices(p, parts) {
+        const uint8_t *data = constData_Block(parts[p]);
+        for (size_t i = 0, n = size_Block(parts[p]); i < n; i++) {
+            hash = (hash ^ data[i]) * 1099511628211ull;
+        }
+    }
+    return hash;
+}
+
+static void startRemoteRequests_Bookmarks_(iBookmarks *d) {
+    /* `mtx` must be held. */
+    while (size_PtrArray(&d->remoteRequests) < maxConcurrentRemoteRequests_Bookmarks_ &&
+           !isEmpty_Array(&d->pendingRemote)) {
+        uint32_t sourceId;
+        take_Array(&d->pendingRemote, 0, &sourceId);
+        const iBookmark *bm = get_Bookmarks(d, sourceId);
+        if (!bm) {
+            continue; /* deleted while waiting */
+        }
+        iGmRequest *req  = new_GmRequest(certs_App());
+        uint32_t *  bmId = malloc(4);
+        *bmId            = sourceId;
+        setUserData_Object(req, bmId);
+        pushBack_PtrArray(&d->remoteRequests, req);
+        setUrl_GmRequest(req, &bm->url);
+        iConnect(GmRequest, req, finished, req, remoteRequestFinished_Bookmarks_);
+        submit_GmRequest(req);
+    }
+}
+
+static uint32_t linkingSource_Bookmarks_(const iBookmarks *d, uint32_t bookmarkId) {
+    /* Returns one of the sources that link to the bookmark, or zero if there are none. */
+    size_t pos = 0;
+    locate_SortedArray(&d->remoteLinks, &(iRemoteLink){ bookmarkId, 0 }, &pos);
+    if (pos < size_SortedArray(&d->remoteLinks)) {
+        const iRemoteLink *link = constAt_SortedArray(&d->remoteLinks, pos);
+        if (link->bookmarkId == bookmarkId) {
+            return link->sourceId;
+        }
+    }
+    return 0;
+}
+
+static void unlinkRemote_Bookmarks_(iBookmarks *d, uint32_t bookmarkId, uint32_t sourceId) {
+    /* The bookmark is deleted when no source links to it any more. Otherwise it is moved
+       under one of the remaining sources. `mtx` must be held. */
+    size_t pos;
+    if (locate_SortedArray(&d->remoteLinks, &(iRemoteLink){ bookmarkId, sourceId }, &pos)) {
+        remove_Array(&d->remoteLinks.values, pos);
+    }
+    iBookmark *bm = get_Bookmarks(d, bookmarkId);
+    if (!bm) {
+        return;
+    }
+    const uint32_t other = linkingSource_Bookmarks_(d, bookmarkId);
+    if (!other) {
+        unindexUrl_Bookmarks_(d, bm);
+        remove_Hash(&d->bookmarks, bookmarkId);
+        delete_Bookmark(bm);
+    }
+    else if (bm->parentId == sourceId) {
+        bm->parentId = other;
+    }
+}
+
+static iBool importRemote_Bookmarks_(iBookmarks *d, uint32_t sourceId, const iGmRequest *req) {
+    /* Updates the source's bookmarks to match the links in the response: existing ones are
+       kept, missing ones are removed, and new ones are added. Returns True if anything
+       changed. `mtx` must be held. */
+    iBool changed = iFalse;
+    iIntSet present;
+    init_IntSet(&present);
+    iRegExp *linkPattern = new_RegExp("^=>\\s*([^\\s]+)(\\s+(.*))?", 0);
+    iString src;
+    const iString *remoteTag = collectNewCStr_String("remote");
+    initBlock_String(&src, body_GmRequest(req));
+    iRangecc srcLine = iNullRange;
+    while (nextSplit_Rangecc(range_String(&src), "\n", &srcLine)) {
+        iRangecc line = srcLine;
+        trimEnd_Rangecc(&line);
+        iRegExpMatch m;
+        init_RegExpMatch(&m);
+        if (matchRange_RegExp(linkPattern, line, &m)) {
+            const iRangecc url    = capturedRange_RegExpMatch(&m, 1);
+            const iRangecc title  = capturedRange_RegExpMatch(&m, 3);
+            iString *      urlStr = newRange_String(url);
+            const iString *absUrl = canonicalUrl_String(absoluteUrl_String(url_GmRequest(req), urlStr));
+            iString *titleStr = newRange_String(title);
+            if (isEmpty_String(titleStr)) {
+                setRange_String(titleStr, urlHost_String(urlStr));
+            }
+            const uint32_t existingId = findUrl_Bookmarks_(d, absUrl);
+            if (!existingId) {
+                const uint32_t bmId = add_Bookmarks(d, absUrl, titleStr, remoteTag, 0x2913);
+                iBookmark *bm = get_Bookmarks(d, bmId);
+                bm->parentId = sourceId;
+                insert_SortedArray(&d->remoteLinks, &(iRemoteLink){ bmId, sourceId });
+                insert_IntSet(&present, bmId);
+                changed = iTrue;
+            }
+            else {
+                iBookmark *bm = get_Bookmarks(d, existingId);
+                if (hasTag_Bookmark(bm, remote_BookmarkTag)) {
+                    /* Already imported from this or another source. */
+                    insert_SortedArray(&d->remoteLinks, &(iRemoteLink){ existingId, sourceId });
+                    insert_IntSet(&present, existingId);
+                    if (bm->parentId == sourceId && !equal_String(&bm->title, titleStr)) {
+                        set_String(&bm->title, titleStr);
+                        changed = iTrue;
+                    }
+                }
+            }
+            delete_String(titleStr);
+            delete_String(urlStr);
+        }
+    }
+    deinit_String(&src);
+    iRelease(linkPattern);
+    /* Drop the ones that are no longer linked. */ {
+        iArray unlinked;
+        init_Array(&unlinked, sizeof(uint32_t));
+        iConstForEach(Array, i, &d->remoteLinks.values) {
+            const iRemoteLink *link = i.value;
+            if (link->sourceId == sourceId && !contains_IntSet(&present, link->bookmarkId)) {
+                pushBack_Array(&unlinked, &link->bookmarkId);
+            }
+        }
+        iConstForEach(Array, j, &unlinked) {
+            unlinkRemote_Bookmarks_(d, *(const uint32_t *) j.value, sourceId);
+            changed = iTrue;
+        }
+        deinit_Array(&unlinked);
+    }
+    deinit_IntSet(&present);
+    return changed;
+}
+
 void requestFinished_Bookmarks(iBookmarks *d, iGmRequest *req) {
     iBool found = iFalse;
     iForEach(PtrArray, i, &d->remoteRequests) {
@@ -636,47 +932,37 @@ void requestFinished_Bookmarks(iBookmarks *d, iGmRequest *req) {
         }
     }
     iAssert(found);
-    /* Parse all links in the result. */
+    const uint32_t sourceId = *(uint32_t *) userData_Object(req);
+    lock_Mutex(d->mtx);
     if (isSuccess_GmStatusCode(status_GmRequest(req))) {
-        iTime now;
-        initCurrent_Time(&now);
-        iRegExp *linkPattern = new_RegExp("^=>\\s*([^\\s]+)(\\s+(.*))?", 0);
-        iString src;
-        const iString *remoteTag = collectNewCStr_String("remote");
-        initBlock_String(&src, body_GmRequest(req));
-        iRangecc srcLine = iNullRange;
-        while (nextSplit_Rangecc(range_String(&src), "\n", &srcLine)) {
-            iRangecc line = srcLine;
-            trimEnd_Rangecc(&line);
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(linkPattern, line, &m)) {
-                const iRangecc url    = capturedRange_RegExpMatch(&m, 1);
-                const iRangecc title  = capturedRange_RegExpMatch(&m, 3);
-                iString *      urlStr = newRange_String(url);
-                const iString *absUrl = canonicalUrl_String(absoluteUrl_String(url_GmRequest(req), urlStr));
-                if (!findUrl_Bookmarks(d, absUrl)) {
-                    iString *titleStr = newRange_String(title);
-                    if (isEmpty_String(titleStr)) {
-                        setRange_String(titleStr, urlHost_String(urlStr));
-                    }
-                    const uint32_t bmId = add_Bookmarks(d, absUrl, titleStr, remoteTag, 0x2913);
-                    iBookmark *bm = get_Bookmarks(d, bmId);
-                    bm->parentId = *(uint32_t *) userData_Object(req);
-                    delete_String(titleStr);
-                }
-                delete_String(urlStr);
+        /* Unchanged sources don't need to be imported again. */
+        iRemoteSource rs = { sourceId, remoteHash_Bookmarks_(req) };
+        size_t pos;
+        if (locate_SortedArray(&d->remoteSources, &rs, &pos)) {
+            iRemoteSource *old = at_SortedArray(&d->remoteSources, pos);
+            if (old->bodyHash != rs.bodyHash) {
+                old->bodyHash = rs.bodyHash;
+                d->isRemoteChanged |= importRemote_Bookmarks_(d, sourceId, req);
             }
         }
-        deinit_String(&src);
-        iRelease(linkPattern);
+        else {
+            insert_SortedArray(&d->remoteSources, &rs);
+            d->isRemoteChanged |= importRemote_Bookmarks_(d, sourceId, req);
+        }
     }
     else {
-        /* TODO: Show error? */
+        /* TODO: Show error? The previously imported bookmarks are kept. */
     }
     free(userData_Object(req));
     iRelease(req);
-    if (isEmpty_PtrArray(&d->remoteRequests)) {
+    startRemoteRequests_Bookmarks_(d);
+    const iBool isFinished = isEmpty_PtrArray(&d->remoteRequests);
+    const iBool notify     = isFinished && d->isRemoteChanged;
+    if (isFinished) {
+        d->isRemoteChanged = iFalse;
+    }
+    unlock_Mutex(d->mtx);
+    if (notify) {
         postCommand_App("bookmarks.changed");
     }
 }
@@ -686,30 +972,58 @@ void fetchRemote_Bookmarks(iBookmarks *d) {
         return; /* Already ongoing. */
     }
     lock_Mutex(d->mtx);
-    /* Remove all current remote bookmarks. */ {
+    /* Remove remote bookmarks whose source is gone. */ {
         size_t numRemoved = 0;
+        iArray unlinked;
+        init_Array(&unlinked, sizeof(iRemoteLink));
+        iForEach(Array, k, &d->remoteLinks.values) {
+            const iRemoteLink *link = k.value;
+            if (!get_Bookmarks(d, link->bookmarkId)) {
+                /* Deleted along with another source; the source must be imported again. */
+                size_t pos;
+                if (locate_SortedArray(&d->remoteSources, &(iRemoteSource){ link->sourceId },
+                                       &pos)) {
+                    remove_Array(&d->remoteSources.values, pos);
+                }
+                remove_ArrayIterator(&k);
+            }
+            else if (!hasTag_Bookmark(get_Bookmarks(d, link->sourceId),
+                                      remoteSource_BookmarkTag)) {
+                pushBack_Array(&unlinked, link);
+            }
+        }
+        iConstForEach(Array, u, &unlinked) {
+            const iRemoteLink *link = u.value;
+            unlinkRemote_Bookmarks_(d, link->bookmarkId, link->sourceId);
+            numRemoved++;
+        }
+        deinit_Array(&unlinked);
         iForEach(Hash, i, &d->bookmarks) {
             iBookmark *bm = (iBookmark *) i.value;
-            if (hasTag_Bookmark(bm, remote_BookmarkTag)) {
+            if (hasTag_Bookmark(bm, remote_BookmarkTag) &&
+                !hasTag_Bookmark(get_Bookmarks(d, bm->parentId), remoteSource_BookmarkTag)) {
+                unindexUrl_Bookmarks_(d, bm);
                 remove_HashIterator(&i);
                 delete_Bookmark(bm);
                 numRemoved++;
             }
         }
+        iForEach(Array, j, &d->remoteSources.values) {
+            const iRemoteSource *rs = j.value;
+            if (!hasTag_Bookmark(get_Bookmarks(d, rs->id), remoteSource_BookmarkTag)) {
+                remove_ArrayIterator(&j);
+            }
+        }
         if (numRemoved) {
             postCommand_App("bookmarks.changed");
         }
     }
+    d->isRemoteChanged = iFalse;
+    clear_Array(&d->pendingRemote);
     iConstForEach(PtrArray, i, list_Bookmarks(d, NULL, isRemoteSource_Bookmark_, NULL)) {
-        const iBookmark *bm   = i.ptr;
-        iGmRequest *     req  = new_GmRequest(certs_App());
-        uint32_t *       bmId = malloc(4);
-        *bmId                 = id_Bookmark(bm);
-        setUserData_Object(req, bmId);
-        pushBack_PtrArray(&d->remoteRequests, req);
-        setUrl_GmRequest(req, &bm->url);
-        iConnect(GmRequest, req, finished, req, remoteRequestFinished_Bookmarks_);
-        submit_GmRequest(req);
+        const uint32_t sourceId = id_Bookmark(i.ptr);
+        pushBack_Array(&d->pendingRemote, &sourceId);
     }
+    startRemoteRequests_Bookmarks_(d);
     unlock_Mutex(d->mtx);
 }
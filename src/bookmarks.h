@@ -52,6 +52,7 @@ struct Impl_Bookmark {
     iTime when;
     uint32_t parentId; /* remote source or folder */
     int order;         /* sort order */
+    uint64_t urlHash;  /* key in the URL index of Bookmarks */
 };
 
 iLocalDef uint32_t  id_Bookmark         (const iBookmark *d) { return d->node.key; }
@@ -98,6 +99,7 @@ uint32_t    add_Bookmarks               (iBookmarks *, const iString *url, const
                                          const iString *tags, iChar icon);
 iBool       remove_Bookmarks            (iBookmarks *, uint32_t id);
 iBookmark * get_Bookmarks               (iBookmarks *, uint32_t id);
+void        setUrl_Bookmarks            (iBookmarks *, uint32_t id, const iString *url);
 void        reorder_Bookmarks           (iBookmarks *, uint32_t id, int newOrder);
 iBool       updateBookmarkIcon_Bookmarks(iBookmarks *, const iString *url, iChar icon);
 void        setRecentFolder_Bookmarks   (iBookmarks *, uint32_t folderId);
@@ -106,7 +108,10 @@ void        fetchRemote_Bookmarks       (iBookmarks *);
 void        requestFinished_Bookmarks   (iBookmarks *, iGmRequest *req);
 
 iChar       siteIcon_Bookmarks          (const iBookmarks *, const iString *url);
-uint32_t    findUrl_Bookmarks           (const iBookmarks *, const iString *url); /* O(n) */
+uint32_t    findUrl_Bookmarks           (const iBookmarks *, const iString *url);
+size_t      memorySize_Bookmarks        (const iBookmarks *); /* bytes, approximate */
+void        findUrls_Bookmarks          (const iBookmarks *, size_t count, const iString **urls,
+                                         uint32_t *ids_out);
 uint32_t    recentFolder_Bookmarks      (const iBookmarks *);
 
 iBool   filterTagsRegExp_Bookmarks      (void *regExp, const iBookmark *);
@@ -38,9 +38,13 @@ enum iFileVersion {
     serializedSidebarState_FileVersion  = 3,
     addedRecentUrlFlags_FileVersion     = 4,
     bookmarkFolderState_FileVersion     = 5,
+    addedLayoutSnapshots_FileVersion    = 6,
+    addedResponseTimings_FileVersion    = 7,
+    responseCacheKeys_FileVersion       = 8,
+    compressedResponses_FileVersion     = 9,
     /* meta */
     idents_FileVersion = 1, /* version used by GmCerts/idents.lgr */
-    latest_FileVersion = 5,
+    latest_FileVersion = 9,
 };
 
 enum iImageStyle {
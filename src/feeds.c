@@ -22,11 +22,16 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "feeds.h"
 #include "bookmarks.h"
+#include "feedxml.h"
 #include "gmrequest.h"
+#include "resolver.h"
 #include "visited.h"
 #include "lang.h"
 #include "app.h"
+#include "profiler.h"
+#include "savequeue.h"
 
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/hash.h>
 #include <the_Foundation/intset.h>
@@ -51,6 +56,7 @@ void init_FeedEntry(iFeedEntry *d) {
     init_String(&d->title);
     d->bookmarkId = 0;
     d->isHeading = iFalse;
+    init_Trigrams(&d->trigrams);
 }
 
 void deinit_FeedEntry(iFeedEntry *d) {
@@ -77,12 +83,15 @@ iBool isUnread_FeedEntry(const iFeedEntry *d) {
 
 /*----------------------------------------------------------------------------------------------*/
 
-static int requestTimeoutSeconds_FeedJob_ = 10.0f;
+static const double defaultTimeoutSeconds_FeedJob_ = 10.0;
+static const double minTimeoutSeconds_FeedJob_     = 5.0;
+static const double maxTimeoutSeconds_FeedJob_     = 30.0;
 
 struct Impl_FeedJob {
     iString     url;
     uint32_t    bookmarkId;
     iTime       startTime;
+    double      timeoutSeconds;
     iBool       isFirstUpdate; /* hasn't been checked ever before */
     iBool       checkHeadings;
     iBool       ignoreWeb;
@@ -96,6 +105,7 @@ static void init_FeedJob(iFeedJob *d, const iBookmark *bookmark) {
     d->request = NULL;
     init_PtrArray(&d->results);
     iZap(d->startTime);
+    d->timeoutSeconds = defaultTimeoutSeconds_FeedJob_;
     d->isFirstUpdate = iFalse;
     d->checkHeadings = hasTag_Bookmark(bookmark, headings_BookmarkTag);
     d->ignoreWeb     = hasTag_Bookmark(bookmark, ignoreWeb_BookmarkTag);
@@ -111,7 +121,11 @@ static void deinit_FeedJob(iFeedJob *d) {
 }
 
 static iBool isTimedOut_FeedJob_(iFeedJob *d) {
-    return elapsedSeconds_Time(&d->startTime) > requestTimeoutSeconds_FeedJob_;
+    return elapsedSeconds_Time(&d->startTime) > d->timeoutSeconds;
+}
+
+static iRangecc host_FeedJob_(const iFeedJob *d) {
+    return urlHost_String(&d->url);
 }
 
 iDefineTypeConstructionArgs(FeedJob, (const iBookmark *bm), bm)
@@ -119,27 +133,244 @@ iDefineTypeConstructionArgs(FeedJob, (const iBookmark *bm), bm)
 /*----------------------------------------------------------------------------------------------*/
 
 static const char *feedsFilename_Feeds_         = "feeds.txt";
-static const int   updateIntervalSeconds_Feeds_ = 4 * 60 * 60;
+static const char *journalFilename_Feeds_       = "feeds.journal";
+static const char *magicJournal_Feeds_          = "lgFJ";
+static const int   journalVersion_Feeds_        = 3; /* 2: sources have a load time,
+                                                          3: records have a length and checksum */
+static const int   compactIntervalSeconds_Feeds_ = 7 * 24 * 60 * 60;
+static const size_t maxJournalSize_Feeds_       = 1024 * 1024;
+static const int   checkIntervalSeconds_Feeds_  = 30 * 60; /* how often to look for due feeds */
+static const int   updateIntervalSeconds_Feeds_ = 4 * 60 * 60; /* default per feed */
+static const int   minIntervalSeconds_Feeds_    = 60 * 60;
+static const int   maxIntervalSeconds_Feeds_    = 24 * 60 * 60;
+static const size_t entriesPerPage_Feeds_       = 200; /* in about:feeds */
+
+iDeclareType(FeedSource)
+
+/* What has been learned about a subscription over time. */
+struct Impl_FeedSource {
+    uint32_t bookmarkId;
+    float    loadSeconds; /* moving average of fetch times; a timeout counts as the time waited */
+    uint32_t contentHash; /* of the latest successfully fetched body and parse settings */
+    size_t   contentSize;
+    int      intervalSeconds; /* adapted to how often the content changes */
+    iTime    lastCheckedAt;
+};
+
+static int cmp_FeedSource_(const void *a, const void *b) {
+    return iCmp(((const iFeedSource *) a)->bookmarkId, ((const iFeedSource *) b)->bookmarkId);
+}
+
+/* Changes since feeds.txt was written are appended to feeds.journal. */
+enum iFeedJournalRecord {
+    feed_FeedJournalRecord = 1, /* bookmark ID and URL, for mapping IDs on load */
+    entry_FeedJournalRecord,    /* added or updated */
+    removedEntry_FeedJournalRecord,
+    source_FeedJournalRecord,
+    refreshed_FeedJournalRecord,
+};
+
+static int cmp_FeedEntryPtr_(const void *a, const void *b) {
+    const iFeedEntry * const *elem[2] = { a, b };
+    const int cmp = cmpString_String(&(*elem[0])->url, &(*elem[1])->url);
+    if (cmp == 0) {
+        /* The same URL can be coming from different feeds. */
+        return iCmp((*elem[0])->bookmarkId, (*elem[1])->bookmarkId);
+    }
+    return cmp;
+}
+
+static int cmpTimeDescending_FeedEntryPtr_(const void *a, const void *b) {
+    const iFeedEntry * const *e1 = a, * const *e2 = b;
+    const int cmpPosted = -cmp_Time(&(*e1)->posted, &(*e2)->posted);
+    if (cmpPosted) return cmpPosted;
+    /* Posting timestamps may only be accurate to a day, so also sort by discovery time. */
+    const int cmpDiscovered = -cmp_Time(&(*e1)->discovered, &(*e2)->discovered);
+    if (cmpDiscovered) return cmpDiscovered;
+    return cmp_FeedEntryPtr_(a, b); /* unique order for the time index */
+}
 
 struct Impl_Feeds {
     iMutex *  mtx;
     iString   saveDir;
     iIntSet   previouslyCheckedFeeds; /* bookmark IDs */
     iTime     lastRefreshedAt;
+    iTime     lastCompactedAt; /* feeds.txt written in full */
+    iBuffer * journal; /* records not yet appended to the journal file (guarded by `mtx`) */
+    iBuffer * record; /* the record being written, before it is framed into `journal` */
+    size_t    journalSize; /* bytes in the journal file */
+    iIntSet   journaledFeeds; /* bookmark IDs whose feed record is in the journal file */
     int       refreshTimer;
     iThread * worker;
     iBool     stopWorker;
+    iMutex *  workerMtx;
+    iCondition workerWakeup; /* a request finished, or the worker should stop */
+    int       numWakeups;
     iPtrArray jobs; /* pending */
+    iSortedArray sources; /* FeedSources, sorted by bookmark ID; used by the worker */
     iSortedArray entries; /* pointers to all discovered feed entries, sorted by entry ID (URL) */
+    iSortedArray byTime;  /* the same entries, newest first */
+    uint32_t  generation; /* incremented when entries change */
+    iBool     isUnreadCounted;
+    uint32_t  unreadGeneration;
+    uint32_t  unreadVisitedGeneration;
+    size_t    numUnread;
 };
 
 static iFeeds feeds_;
 
-#define maxConcurrentRequests_Feeds 4
+#define minConcurrentRequests_Feeds  4
+#define maxConcurrentRequests_Feeds  16
+#define maxRequestsPerHost_Feeds     2
+
+/* The time index must be kept in sync with the entries. `mtx` must be held. */
+
+static void updateTrigrams_FeedEntry_(iFeedEntry *d) {
+    init_Trigrams(&d->trigrams);
+    add_Trigrams(&d->trigrams, range_String(&d->url));
+    add_Trigrams(&d->trigrams, range_String(&d->title));
+}
+
+static void insertEntry_Feeds_(iFeeds *d, iFeedEntry *entry) {
+    updateTrigrams_FeedEntry_(entry);
+    insert_SortedArray(&d->entries, &entry);
+    insert_SortedArray(&d->byTime, &entry);
+    d->generation++;
+}
+
+static void unindexEntry_Feeds_(iFeeds *d, iFeedEntry *entry) {
+    /* Must be called before the entry's timestamps are changed. */
+    size_t pos;
+    if (locate_SortedArray(&d->byTime, &entry, &pos)) {
+        remove_Array(&d->byTime.values, pos);
+    }
+    d->generation++;
+}
+
+static void reindexEntry_Feeds_(iFeeds *d, iFeedEntry *entry) {
+    updateTrigrams_FeedEntry_(entry); /* the title may have changed */
+    insert_SortedArray(&d->byTime, &entry);
+}
+
+static void rebuildIndex_Feeds_(iFeeds *d) {
+    clear_SortedArray(&d->byTime);
+    iConstForEach(Array, i, &d->entries.values) {
+        updateTrigrams_FeedEntry_(*(iFeedEntry **) i.value);
+        pushBack_Array(&d->byTime.values, i.value);
+    }
+    sort_Array(&d->byTime.values, cmpTimeDescending_FeedEntryPtr_);
+    d->generation++;
+}
+
+static void wakeUpWorker_Feeds_(iFeeds *d) {
+    lock_Mutex(d->workerMtx);
+    d->numWakeups++;
+    signal_Condition(&d->workerWakeup);
+    unlock_Mutex(d->workerMtx);
+}
+
+static void jobFinished_Feeds_(iAnyObject *obj, iGmRequest *req) {
+    /* Called in a request thread. */
+    iUnused(obj, req);
+    wakeUpWorker_Feeds_(&feeds_);
+}
+
+static iFeedSource *source_Feeds_(iFeeds *d, uint32_t bookmarkId) {
+    size_t pos;
+    const iFeedSource key = { .bookmarkId = bookmarkId };
+    if (!locate_SortedArray(&d->sources, &key, &pos)) {
+        iFeedSource src = key;
+        src.intervalSeconds = updateIntervalSeconds_Feeds_;
+        insert_SortedArray(&d->sources, &src);
+        locate_SortedArray(&d->sources, &key, &pos);
+    }
+    return at_SortedArray(&d->sources, pos);
+}
+
+static uint32_t contentHash_(const iBlock *data) {
+    /* FNV-1a; only used for noticing if a feed has changed. */
+    const uint8_t *bytes = constData_Block(data);
+    uint32_t hash = 0x811c9dc5;
+    for (size_t i = 0; i < size_Block(data); i++) {
+        hash = (hash ^ bytes[i]) * 0x01000193;
+    }
+    return hash;
+}
+
+static iStream *openRecord_Feeds_(iFeeds *d, int type, uint32_t bookmarkId) {
+    /* The record is written into `record` first, so it can be framed with its length and
+       checksum. Every record has an ID after the type. */
+    openEmpty_Buffer(d->record);
+    iStream *outs = stream_Buffer(d->record);
+    write8_Stream(outs, type);
+    writeU32_Stream(outs, bookmarkId);
+    return outs;
+}
+
+static void endRecord_Feeds_(iFeeds *d) {
+    /* `mtx` must be held. */
+    const iBlock *rec  = data_Buffer(d->record);
+    iStream      *outs = stream_Buffer(d->journal);
+    writeU32_Stream(outs, (uint32_t) size_Block(rec));
+    writeU32_Stream(outs, contentHash_(rec));
+    writeData_Stream(outs, constData_Block(rec), size_Block(rec));
+}
+
+static iStream *beginRecord_Feeds_(iFeeds *d, int type, uint32_t bookmarkId) {
+    /* `mtx` must be held. Bookmark IDs may change between sessions, so the URL of each
+       feed is recorded before any of its changes. */
+    if (bookmarkId && !contains_IntSet(&d->journaledFeeds, bookmarkId)) {
+        const iBookmark *bm = get_Bookmarks(bookmarks_App(), bookmarkId);
+        if (bm) {
+            serialize_String(&bm->url, openRecord_Feeds_(d, feed_FeedJournalRecord, bookmarkId));
+            endRecord_Feeds_(d);
+        }
+        insert_IntSet(&d->journaledFeeds, bookmarkId);
+    }
+    return openRecord_Feeds_(d, type, bookmarkId);
+}
+
+static void journalEntry_Feeds_(iFeeds *d, const iFeedEntry *entry) {
+    iStream *outs = beginRecord_Feeds_(d, entry_FeedJournalRecord, entry->bookmarkId);
+    writeU64_Stream(outs, integralSeconds_Time(&entry->posted));
+    writeU64_Stream(outs, integralSeconds_Time(&entry->discovered));
+    serialize_String(&entry->url, outs);
+    serialize_String(&entry->title, outs);
+    endRecord_Feeds_(d);
+}
+
+static void journalRemoval_Feeds_(iFeeds *d, const iFeedEntry *entry) {
+    iStream *outs = beginRecord_Feeds_(d, removedEntry_FeedJournalRecord, entry->bookmarkId);
+    serialize_String(&entry->url, outs);
+    endRecord_Feeds_(d);
+}
+
+static void journalSource_Feeds_(iFeeds *d, const iFeedSource *src) {
+    iStream *outs = beginRecord_Feeds_(d, source_FeedJournalRecord, src->bookmarkId);
+    writeU32_Stream(outs, src->contentHash);
+    writeU64_Stream(outs, src->contentSize);
+    write32_Stream(outs, src->intervalSeconds);
+    writeU64_Stream(outs, integralSeconds_Time(&src->lastCheckedAt));
+    writeU32_Stream(outs, (uint32_t) (src->loadSeconds * 1000)); /* milliseconds */
+    endRecord_Feeds_(d);
+}
+
+static iBool isDue_FeedSource_(const iFeedSource *d, const iTime *lastRefreshedAt) {
+    const iTime *checkedAt = isValid_Time(&d->lastCheckedAt) ? &d->lastCheckedAt
+                                                              : lastRefreshedAt;
+    if (!isValid_Time(checkedAt)) {
+        return iTrue;
+    }
+    /* Due if it would become due before the next check. */
+    return elapsedSeconds_Time(checkedAt) + checkIntervalSeconds_Feeds_ / 2 >=
+           d->intervalSeconds;
+}
 
 static void submit_FeedJob_(iFeedJob *d) {
     d->request = new_GmRequest(certs_App());
     setUrl_GmRequest(d->request, &d->url);
+    enableBuiltInFilters_GmRequest(d->request, iFalse); /* XML feeds are parsed directly */
+    iConnect(GmRequest, d->request, finished, d->request, jobFinished_Feeds_);
     initCurrent_Time(&d->startTime);
     submit_GmRequest(d->request);
 }
@@ -159,14 +390,33 @@ static const iPtrArray *listSubscriptions_(void) {
     return list_Bookmarks(bookmarks_App(), NULL, isSubscribed_, NULL);
 }
 
-static iFeedJob *startNextJob_Feeds_(iFeeds *d) {
-    if (isEmpty_PtrArray(&d->jobs)) {
-        return NULL;
+static iFeedJob *startNextJob_Feeds_(iFeeds *d, const iPtrArray *ongoing) {
+    /* Pick the first pending job whose host isn't already busy with our requests. */
+    iForEach(PtrArray, i, &d->jobs) {
+        iFeedJob *job = i.ptr;
+        const iRangecc host = host_FeedJob_(job);
+        size_t onHost = 0;
+        iConstForEach(PtrArray, j, ongoing) {
+            if (equalCase_Rangecc(host_FeedJob_(j.ptr), host)) {
+                onHost++;
+            }
+        }
+        if (onHost < maxRequestsPerHost_Feeds) {
+            remove_PtrArrayIterator(&i);
+            /* A feed that has been slow before gets some extra patience. */
+            lock_Mutex(d->mtx);
+            const iFeedSource *src = source_Feeds_(d, job->bookmarkId);
+            if (src->loadSeconds > 0) {
+                job->timeoutSeconds = iClamp(4.0 * src->loadSeconds,
+                                             minTimeoutSeconds_FeedJob_,
+                                             maxTimeoutSeconds_FeedJob_);
+            }
+            unlock_Mutex(d->mtx);
+            submit_FeedJob_(job);
+            return job;
+        }
     }
-    iFeedJob *job;
-    take_PtrArray(&d->jobs, 0, (void **) &job);
-    submit_FeedJob_(job);
-    return job;
+    return NULL;
 }
 
 static iBool isTrimmablePunctuation_(iChar c) {
@@ -198,206 +448,311 @@ static iBool isUrlIgnored_FeedJob_(const iFeedJob *d, iRangecc url) {
     return iFalse;
 }
 
+static iBool isDigits_(const char *s, size_t n) {
+    for (size_t i = 0; i < n; i++) {
+        if (!isdigit((unsigned char) s[i])) {
+            return iFalse;
+        }
+    }
+    return iTrue;
+}
+
+static int digitsValue_(const char *s, size_t n) {
+    int value = 0;
+    for (size_t i = 0; i < n; i++) {
+        value = value * 10 + (s[i] - '0');
+    }
+    return value;
+}
+
+static iBool parseFeedLink_(iRangecc line, iRangecc *url_out, iDate *date_out,
+                            iRangecc *title_out) {
+    /* Gemfeed link lines look like: "=> URL YYYY-MM-DD Title". */
+    const char *pos = line.start + 2;
+    if (size_Range(&line) < 2 || line.start[0] != '=' || line.start[1] != '>') {
+        return iFalse;
+    }
+    while (pos < line.end && isspace((unsigned char) *pos)) pos++;
+    const char *urlStart = pos;
+    while (pos < line.end && !isspace((unsigned char) *pos)) pos++;
+    if (pos == urlStart || pos == line.end) {
+        return iFalse;
+    }
+    *url_out = (iRangecc){ urlStart, pos };
+    while (pos < line.end && isspace((unsigned char) *pos)) pos++;
+    /* The date must be followed by something other than a digit. */
+    if (line.end - pos < 11 || !isDigits_(pos, 4) || pos[4] != '-' ||
+        !isDigits_(pos + 5, 2) || pos[5] > '1' || pos[7] != '-' ||
+        !isDigits_(pos + 8, 2) || pos[8] > '3' || isdigit((unsigned char) pos[10])) {
+        return iFalse;
+    }
+    iZap(*date_out);
+    date_out->year  = digitsValue_(pos, 4);
+    date_out->month = digitsValue_(pos + 5, 2);
+    date_out->day   = digitsValue_(pos + 8, 2);
+    date_out->hour  = 12; /* noon UTC */
+    *title_out = (iRangecc){ pos + 10, line.end };
+    return iTrue;
+}
+
+iDeclareType(FeedXmlParse)
+
+struct Impl_FeedXmlParse {
+    iFeedJob *job;
+    iTime     now;
+};
+
+static void addLink_FeedJob_(iFeedJob *d, iRangecc url, const iDate *date, iRangecc title,
+                             iTime *now) {
+    if (isUrlIgnored_FeedJob_(d, url)) {
+        return;
+    }
+    iTime perEntryAdjust;
+    initSeconds_Time(&perEntryAdjust, 1.0);
+    iFeedEntry *entry = new_FeedEntry();
+    entry->discovered = *now;
+    sub_Time(now, &perEntryAdjust);
+    entry->bookmarkId = d->bookmarkId;
+    setRange_String(&entry->url, url);
+    set_String(&entry->url,
+               canonicalUrl_String(absoluteUrl_String(url_GmRequest(d->request), &entry->url)));
+    setRange_String(&entry->title, title);
+    trimTitle_(&entry->title);
+    init_Time(&entry->posted, date);
+    pushBack_PtrArray(&d->results, entry);
+}
+
+static void addXmlEntry_FeedJob_(void *context, const iFeedXmlEntry *xmlEntry) {
+    iFeedXmlParse *parse = context;
+    addLink_FeedJob_(parse->job, range_String(&xmlEntry->url), &xmlEntry->date,
+                     range_String(&xmlEntry->title), &parse->now);
+}
+
 static void parseResult_FeedJob_(iFeedJob *d) {
     /* TODO: Should tell the user if the request failed. */
-    if (isSuccess_GmStatusCode(status_GmRequest(d->request))) {
+    if (isSuccess_GmStatusCode(status_GmRequest(d->request)) &&
+        isMimeType_FeedXml(meta_GmRequest(d->request))) {
+        /* Atom and RSS entries become feed entries without translating to gemtext first. */
+        iBeginCollect();
+        iFeedXmlParse parse = { d };
+        initCurrent_Time(&parse.now);
+        iFeedXml *xml = new_FeedXml(addXmlEntry_FeedJob_, &parse);
+        write_FeedXml(xml, range_Block(body_GmRequest(d->request)));
+        finish_FeedXml(xml);
+        delete_FeedXml(xml);
+        iEndCollect();
+    }
+    else if (isSuccess_GmStatusCode(status_GmRequest(d->request))) {
         iBeginCollect();
         iTime now;
         iTime perEntryAdjust;
         initSeconds_Time(&perEntryAdjust, 1.0);
         initCurrent_Time(&now);
-        iRegExp *linkPattern =
-            new_RegExp("^=>\\s*([^\\s]+)\\s+"
-                       "([0-9][0-9][0-9][0-9]-[0-1][0-9]-[0-3][0-9])"
-                       "([^0-9].*)",
-                       0);
-        iString src;
-        initBlock_String(&src, body_GmRequest(d->request));
-        iRangecc srcLine = iNullRange;
-        while (nextSplit_Rangecc(range_String(&src), "\n", &srcLine)) {
-            iRangecc line = srcLine;
+        /* Scan the body in place, one line at a time. */
+        const iRangecc body = range_Block(body_GmRequest(d->request));
+        for (const char *lineStart = body.start; lineStart < body.end; ) {
+            const char *lineEnd = memchr(lineStart, '\n', body.end - lineStart);
+            if (!lineEnd) {
+                lineEnd = body.end;
+            }
+            iRangecc line = { lineStart, lineEnd };
+            lineStart = lineEnd + 1;
             trimEnd_Rangecc(&line);
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (matchRange_RegExp(linkPattern, line, &m)) {
-                const iRangecc url   = capturedRange_RegExpMatch(&m, 1);
-                const iRangecc date  = capturedRange_RegExpMatch(&m, 2);
-                const iRangecc title = capturedRange_RegExpMatch(&m, 3);
-                if (isUrlIgnored_FeedJob_(d, url)) {
-                    continue;
+            iRangecc url, title;
+            iDate date;
+            if (parseFeedLink_(line, &url, &date, &title)) {
+                addLink_FeedJob_(d, url, &date, title, &now);
+            }
+            else if (d->checkHeadings && startsWith_Rangecc(line, "#")) {
+                while (*line.start == '#' && line.start < line.end) {
+                    line.start++;
                 }
+                trimStart_Rangecc(&line);
                 iFeedEntry *entry = new_FeedEntry();
-                entry->discovered = now;
-                sub_Time(&now, &perEntryAdjust);
+                entry->isHeading = iTrue;
+                entry->posted = now;
+                if (!d->isFirstUpdate) {
+                    entry->discovered = now;
+                    sub_Time(&now, &perEntryAdjust);
+                }
                 entry->bookmarkId = d->bookmarkId;
-                setRange_String(&entry->url, url);
-                set_String(&entry->url, canonicalUrl_String(absoluteUrl_String(url_GmRequest(d->request), &entry->url)));
-                setRange_String(&entry->title, title);
-                trimTitle_(&entry->title);
-                int year, month, day;
-                sscanf(date.start, "%04d-%02d-%02d", &year, &month, &day);
-                init_Time(
-                    &entry->posted,
-                    &(iDate){
-                        .year = year, .month = month, .day = day, .hour = 12 /* noon UTC */ });
+                iString *title = newRange_String(line);
+                set_String(&entry->title, title);
+                set_String(&entry->url, &d->url);
+                appendChar_String(&entry->url, '#');
+                append_String(&entry->url, collect_String(urlEncode_String(title)));
+                set_String(&entry->url, canonicalUrl_String(&entry->url));
+                delete_String(title);
                 pushBack_PtrArray(&d->results, entry);
             }
-            if (d->checkHeadings) {
-                init_RegExpMatch(&m);
-                if (startsWith_Rangecc(line, "#")) {
-                    while (*line.start == '#' && line.start < line.end) {
-                        line.start++;
-                    }
-                    trimStart_Rangecc(&line);
-                    iFeedEntry *entry = new_FeedEntry();
-                    entry->isHeading = iTrue;
-                    entry->posted = now;
-                    if (!d->isFirstUpdate) {
-                        entry->discovered = now;
-                        sub_Time(&now, &perEntryAdjust);
-                    }
-                    entry->bookmarkId = d->bookmarkId;
-                    iString *title = newRange_String(line);
-                    set_String(&entry->title, title);
-                    set_String(&entry->url, &d->url);
-                    appendChar_String(&entry->url, '#');
-                    append_String(&entry->url, collect_String(urlEncode_String(title)));
-                    set_String(&entry->url, canonicalUrl_String(&entry->url));
-                    delete_String(title);
-                    pushBack_PtrArray(&d->results, entry);
-                }
-            }
         }
-        deinit_String(&src);
-        iRelease(linkPattern);
         iEndCollect();
     }
 }
 
 static void save_Feeds_(iFeeds *d) {
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)));
-    if (open_File(f, write_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        iString *str = new_String();
-        format_String(str, "%llu\n# Feeds\n", integralSeconds_Time(&d->lastRefreshedAt));
-        write_File(f, utf8_String(str));
-        /* Index of feeds for IDs. */ {
-            iConstForEach(PtrArray, i, listSubscriptions_()) {
-                const iBookmark *bm = i.ptr;
-                format_String(str, "%08x %s\n", id_Bookmark(bm), cstr_String(&bm->url));
-                write_File(f, utf8_String(str));
-            }
+    /* `mtx` must be held. */
+    iString *str = new_String();
+    initCurrent_Time(&d->lastCompactedAt);
+    format_String(str, "%llu %llu\n# Feeds\n",
+                  integralSeconds_Time(&d->lastRefreshedAt),
+                  integralSeconds_Time(&d->lastCompactedAt));
+    /* Index of feeds for IDs. */ {
+        iConstForEach(PtrArray, i, listSubscriptions_()) {
+            const iBookmark *bm = i.ptr;
+            appendFormat_String(str, "%08x %s\n", id_Bookmark(bm), cstr_String(&bm->url));
         }
-        writeData_File(f, "# Entries\n", 10);
-        iTime now;
-        initCurrent_Time(&now);
-        iConstForEach(Array, i, &d->entries.values) {
-            const iFeedEntry *entry = *(const iFeedEntry **) i.value;
-            /* Heading entries are kept as long as they are present in the source. */
-            if (!entry->isHeading && isValid_Time(&entry->discovered) &&
-                secondsSince_Time(&now, &entry->discovered) > maxAge_Visited) {
-                continue; /* Forget entries discovered long ago. */
-            }
-            format_String(str, "%x\n%llu\n%llu\n%s\n%s\n",
-                          entry->bookmarkId,
-                          integralSeconds_Time(&entry->posted),
-                          integralSeconds_Time(&entry->discovered),
-                          cstr_String(&entry->url),
-                          cstr_String(&entry->title));
-            write_File(f, utf8_String(str));
-        }
-        delete_String(str);
-        close_File(f);
-        unlock_Mutex(d->mtx);
     }
-    iRelease(f);
+    appendCStr_String(str, "# Sources\n");
+    iConstForEach(Array, s, &d->sources.values) {
+        const iFeedSource *src = s.value;
+        appendFormat_String(str, "%08x %08x %zu %d %llu %u\n",
+                            src->bookmarkId,
+                            src->contentHash,
+                            src->contentSize,
+                            src->intervalSeconds,
+                            integralSeconds_Time(&src->lastCheckedAt),
+                            (unsigned) (src->loadSeconds * 1000));
+    }
+    appendCStr_String(str, "# Entries\n");
+    iTime now;
+    initCurrent_Time(&now);
+    iConstForEach(Array, i, &d->entries.values) {
+        const iFeedEntry *entry = *(const iFeedEntry **) i.value;
+        /* Heading entries are kept as long as they are present in the source. */
+        if (!entry->isHeading && isValid_Time(&entry->discovered) &&
+            secondsSince_Time(&now, &entry->discovered) > maxAge_Visited) {
+            continue; /* Forget entries discovered long ago. */
+        }
+        appendFormat_String(str, "%x\n%llu\n%llu\n%s\n%s\n",
+                            entry->bookmarkId,
+                            integralSeconds_Time(&entry->posted),
+                            integralSeconds_Time(&entry->discovered),
+                            cstr_String(&entry->url),
+                            cstr_String(&entry->title));
+    }
+    write_SaveQueue(cstrCollect_String(concatCStr_Path(&d->saveDir, feedsFilename_Feeds_)),
+                    utf8_String(str));
+    delete_String(str);
 }
 
-static iBool isHeadingEntry_FeedEntry_(const iFeedEntry *d) {
-    return contains_String(&d->url, '#');
+static void writeJournalHeader_Feeds_(iFeeds *d) {
+    /* `mtx` must be held. The journal only applies on top of the matching feeds.txt. */
+    iBuffer *header = new_Buffer();
+    openEmpty_Buffer(header);
+    iStream *outs = stream_Buffer(header);
+    writeData_Stream(outs, magicJournal_Feeds_, 4);
+    writeU32_Stream(outs, journalVersion_Feeds_);
+    writeU64_Stream(outs, integralSeconds_Time(&d->lastCompactedAt));
+    write_SaveQueue(cstrCollect_String(concatCStr_Path(&d->saveDir, journalFilename_Feeds_)),
+                    data_Buffer(header));
+    d->journalSize = size_Block(data_Buffer(header));
+    iRelease(header);
+    clear_IntSet(&d->journaledFeeds);
 }
 
-static iStringSet *listHeadingEntriesFrom_Feeds_(const iFeeds *d, uint32_t sourceId) {
-    iStringSet *set = new_StringSet();
-    iConstForEach(Array, i, &d->entries.values) {
-        const iFeedEntry *entry = *(const iFeedEntry **) i.value;
-        if (entry->bookmarkId == sourceId) {
-            insert_StringSet(set, &entry->url);
-        }
+static void compact_Feeds_(iFeeds *d) {
+    /* `mtx` must be held. Old entries are forgotten while writing feeds.txt. */
+    save_Feeds_(d);
+    writeJournalHeader_Feeds_(d);
+    openEmpty_Buffer(d->journal); /* included in feeds.txt */
+}
+
+static void appendJournal_Feeds_(iFeeds *d) {
+    /* `mtx` must be held. */
+    if (isEmpty_Block(data_Buffer(d->journal))) {
+        return;
+    }
+    if (d->journalSize == 0) {
+        compact_Feeds_(d); /* no valid journal file yet */
+        return;
+    }
+    append_SaveQueue(cstrCollect_String(concatCStr_Path(&d->saveDir, journalFilename_Feeds_)),
+                     data_Buffer(d->journal));
+    d->journalSize += size_Block(data_Buffer(d->journal));
+    openEmpty_Buffer(d->journal);
+}
+
+static void commit_Feeds_(iFeeds *d) {
+    /* Only the changes are written, unless it's time to compact the journal into feeds.txt. */
+    lock_Mutex(d->mtx);
+    if (!isValid_Time(&d->lastCompactedAt) || d->journalSize > maxJournalSize_Feeds_ ||
+        elapsedSeconds_Time(&d->lastCompactedAt) > compactIntervalSeconds_Feeds_) {
+        compact_Feeds_(d);
     }
-    return set;
+    else {
+        appendJournal_Feeds_(d);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+static iBool isHeadingEntry_FeedEntry_(const iFeedEntry *d) {
+    return contains_String(&d->url, '#');
 }
 
 static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId,
                                   iPtrArray *incoming) {
     /* Entries are removed from `incoming` if they are added to the Feeds entries array.
-       Anything remaining in `incoming` will be deleted afterwards. */
+       Anything remaining in `incoming` will be deleted afterwards. Everything that can be
+       done without looking at the existing entries is done before locking. */
     iBool gotNew = iFalse;
-    iTime now;
-    initCurrent_Time(&now);
     if (isHeadings) {
-        lock_Mutex(d->mtx);
-//        printf("Updating sourceID %d...\n", sourceId);
-        iStringSet *known = listHeadingEntriesFrom_Feeds_(d, sourceId);
-//        puts("  Known URLs:");
-//        iConstForEach(StringSet, ss, known) {
-//            printf("   {%s}\n", cstr_String(ss.value));
-//        }
         iStringSet *presentInSource = new_StringSet();
+        iConstForEach(PtrArray, p, incoming) {
+            insert_StringSet(presentInSource, &((const iFeedEntry *) p.ptr)->url);
+        }
+        lock_Mutex(d->mtx);
         /* Look for unknown entries. */
         iForEach(PtrArray, i, incoming) {
             iFeedEntry *entry = i.ptr;
-            insert_StringSet(presentInSource, &entry->url);
-            if (!contains_StringSet(known, &entry->url)) {
-//                printf("  {%s} is new\n", cstr_String(&entry->url));
-                insert_SortedArray(&d->entries, &entry);
+            size_t pos;
+            if (!locate_SortedArray(&d->entries, &entry, &pos)) {
+                insertEntry_Feeds_(d, entry);
+                journalEntry_Feeds_(d, entry);
                 gotNew = iTrue;
                 remove_PtrArrayIterator(&i);
             }
         }
-//        puts("  URLs present in source:");
-//        iConstForEach(StringSet, ps, presentInSource) {
-//            printf("    {%s}\n", cstr_String(ps.value));
-//        }
-//        puts("  URLs to purge:");
         /* All known entries that are no longer present in source must be deleted. */
         iForEach(Array, e, &d->entries.values) {
             iFeedEntry *entry = *(iFeedEntry **) e.value;
             if (entry->bookmarkId == sourceId &&
                 !contains_StringSet(presentInSource, &entry->url)) {
-//                printf("    {%s}\n", cstr_String(&entry->url));
+                journalRemoval_Feeds_(d, entry);
+                unindexEntry_Feeds_(d, entry);
                 delete_FeedEntry(entry);
                 remove_ArrayIterator(&e);
             }
         }
-//        puts("Done.");
-        iRelease(presentInSource);
-        iRelease(known);
         unlock_Mutex(d->mtx);
+        iRelease(presentInSource);
     }
     else {
+        /* Each unique URL is handled only once. */ {
+            iStringSet *handledUrls = new_StringSet();
+            iForEach(PtrArray, i, incoming) {
+                iFeedEntry *entry = i.ptr;
+                if (contains_StringSet(handledUrls, &entry->url)) {
+                    delete_FeedEntry(entry);
+                    remove_PtrArrayIterator(&i);
+                    continue;
+                }
+                insert_StringSet(handledUrls, &entry->url);
+            }
+            iRelease(handledUrls);
+        }
         /* All visited URLs still present in the source should be kept indefinitely so their
            read status remains correct. The Kept flag will be cleared after the URL has been
            discarded from the entry database and enough time has passed. */ {
-//            printf("updating entries from %d:\n", sourceId);
-            iForEach(PtrArray, i, incoming) {
+            iConstForEach(PtrArray, i, incoming) {
                 const iFeedEntry *entry = i.ptr;
-//                printf("marking as kept: {%s}\n", cstr_String(&entry->url));
                 setUrlKept_Visited(visited_App(), &entry->url, iTrue);
             }
         }
-        iStringSet *handledUrls = new_StringSet();
         lock_Mutex(d->mtx);
         iForEach(PtrArray, i, incoming) {
             iFeedEntry *entry = i.ptr;
             size_t pos;
-            if (contains_StringSet(handledUrls, &entry->url)) {
-                /* This is a duplicate. Each unique URL is handled only once. */
-                delete_FeedEntry(entry);
-                remove_PtrArrayIterator(&i);
-                continue;
-            }
-            insert_StringSet(handledUrls, &entry->url);
             if (locate_SortedArray(&d->entries, &entry, &pos)) {
                 iFeedEntry *existing = *(iFeedEntry **) at_SortedArray(&d->entries, pos);
                 iAssert(!isHeadingEntry_FeedEntry_(existing));
@@ -413,84 +768,164 @@ static iBool updateEntries_Feeds_(iFeeds *d, iBool isHeadings, uint32_t sourceId
                      newDate.day != oldDate.day)) {
                     changed = iTrue;
                 }
+                unindexEntry_Feeds_(d, existing);
                 set_String(&existing->title, &entry->title);
                 existing->posted     = entry->posted;
                 existing->discovered = entry->discovered; /* prevent discarding */
+                reindexEntry_Feeds_(d, existing);
                 delete_FeedEntry(entry);
                 if (changed) {
                     /* TODO: better to use a new flag for read feed entries? */
                     removeUrl_Visited(visited_App(), &existing->url);
+                    journalEntry_Feeds_(d, existing);
                     gotNew = iTrue;
                 }
             }
             else {
-                insert_SortedArray(&d->entries, &entry);
+                insertEntry_Feeds_(d, entry);
+                journalEntry_Feeds_(d, entry);
                 gotNew = iTrue;
             }
             remove_PtrArrayIterator(&i);
         }
         unlock_Mutex(d->mtx);
-        fflush(stdout);
-        iRelease(handledUrls);
     }
     return gotNew;
 }
 
+static void keepEntries_Feeds_(iFeeds *d, uint32_t sourceId) {
+    /* The source is unchanged, so its entries are all still present. */
+    iTime now;
+    initCurrent_Time(&now);
+    lock_Mutex(d->mtx);
+    iForEach(Array, i, &d->entries.values) {
+        iFeedEntry *entry = *(iFeedEntry **) i.value;
+        if (entry->bookmarkId == sourceId && !entry->isHeading) {
+            unindexEntry_Feeds_(d, entry);
+            entry->discovered = now; /* prevent discarding */
+            reindexEntry_Feeds_(d, entry);
+        }
+    }
+    unlock_Mutex(d->mtx);
+}
+
+static void learnLoadTime_FeedSource_(iFeedSource *d, float seconds) {
+    d->loadSeconds = d->loadSeconds > 0 ? 0.7f * d->loadSeconds + 0.3f * seconds : seconds;
+}
+
+static void timedOut_Feeds_(iFeeds *d, const iFeedJob *job) {
+    /* A slow source is given more time on the next check. */
+    lock_Mutex(d->mtx);
+    iFeedSource *src = source_Feeds_(d, job->bookmarkId);
+    learnLoadTime_FeedSource_(src, (float) job->timeoutSeconds);
+    journalSource_Feeds_(d, src);
+    unlock_Mutex(d->mtx);
+}
+
+static iBool checkUnchanged_Feeds_(iFeeds *d, const iFeedJob *job) {
+    /* Updates what is known about the source. Returns True if the fetched content is the
+       same as last time, in which case there is no need to parse it again. */
+    const iBlock  *body = body_GmRequest(job->request);
+    /* The entries also depend on how the content is parsed. */
+    uint32_t hash = contentHash_(body);
+    hash = (hash ^ (job->checkHeadings ? 1 : 0)) * 0x01000193;
+    hash = (hash ^ (job->ignoreWeb ? 1 : 0)) * 0x01000193;
+    const float elapsed = (float) elapsedSeconds_Time(&job->startTime);
+    iBool unchanged;
+    lock_Mutex(d->mtx);
+    iFeedSource *src = source_Feeds_(d, job->bookmarkId);
+    learnLoadTime_FeedSource_(src, elapsed);
+    unchanged = !job->isFirstUpdate && isValid_Time(&src->lastCheckedAt) &&
+                src->contentHash == hash && src->contentSize == size_Block(body);
+    /* Feeds that rarely change are checked less often. */
+    src->intervalSeconds = iClamp(unchanged ? src->intervalSeconds * 3 / 2
+                                            : src->intervalSeconds / 2,
+                                  minIntervalSeconds_Feeds_,
+                                  maxIntervalSeconds_Feeds_);
+    src->contentHash = hash;
+    src->contentSize = size_Block(body);
+    initCurrent_Time(&src->lastCheckedAt);
+    journalSource_Feeds_(d, src);
+    unlock_Mutex(d->mtx);
+    return unchanged;
+}
+
 static iThreadResult fetch_Feeds_(iThread *thread) {
     iFeeds *d = &feeds_;
     iUnused(thread);
-    iFeedJob *work[maxConcurrentRequests_Feeds]; /* We'll do a couple of concurrent requests. */
-    iZap(work);
+    setThreadName_Profiler("feeds");
+    iPtrArray *ongoing = new_PtrArray();
     iBool gotNew = iFalse;
     postCommand_App("feeds.update.started");
     const int totalJobs = size_PtrArray(&d->jobs);
+    /* Plenty of subscriptions can be fetched with more parallelism. */
+    const size_t maxConcurrent =
+        iClamp(totalJobs / 8, minConcurrentRequests_Feeds, maxConcurrentRequests_Feeds);
     int numFinishedJobs = 0;
     while (!d->stopWorker) {
         /* Start new jobs. */
-        iForIndices(i, work) {
-            if (!work[i]) {
-                work[i] = startNextJob_Feeds_(d);
-            }
+        while (size_PtrArray(ongoing) < maxConcurrent) {
+            iFeedJob *job = startNextJob_Feeds_(d, ongoing);
+            if (!job) break;
+            pushBack_PtrArray(ongoing, job);
         }
-        sleep_Thread(0.5); /* TODO: wait on a Condition so we can exit quickly */
+        /* Sleep until a request finishes. Timeouts are checked at least once a second. */
+        lock_Mutex(d->workerMtx);
+        if (d->numWakeups == 0 && !d->stopWorker) {
+            iTime until;
+            initTimeout_Time(&until, 1.0);
+            waitTimeout_Condition(&d->workerWakeup, d->workerMtx, &until);
+        }
+        d->numWakeups = 0;
+        unlock_Mutex(d->workerMtx);
         if (d->stopWorker) break;
-        size_t ongoing = 0;
         iBool doNotify = iFalse;
-        iForIndices(i, work) {
-            if (work[i]) {
-                if (isFinished_GmRequest(work[i]->request)) {
-                    /* TODO: Handle redirects. Need to resubmit the job with new URL. */
-                    parseResult_FeedJob_(work[i]);
-                    gotNew |= updateEntries_Feeds_(
-                        d, work[i]->checkHeadings, work[i]->bookmarkId, &work[i]->results);
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
-                    numFinishedJobs++;
-                    doNotify = iTrue;
-                }
-                else if (isTimedOut_FeedJob_(work[i])) {
-                    /* Maybe we'll get it next time! */
-                    delete_FeedJob(work[i]);
-                    work[i] = NULL;
-                    numFinishedJobs++;
-                    doNotify = iTrue;
+        iForEach(PtrArray, i, ongoing) {
+            iFeedJob *job = i.ptr;
+            if (isFinished_GmRequest(job->request)) {
+                /* TODO: Handle redirects. Need to resubmit the job with new URL. */
+                if (isSuccess_GmStatusCode(status_GmRequest(job->request)) &&
+                    checkUnchanged_Feeds_(d, job)) {
+                    keepEntries_Feeds_(d, job->bookmarkId);
                 }
                 else {
-                    ongoing++;
+                    parseResult_FeedJob_(job);
+                    gotNew |= updateEntries_Feeds_(d, job->checkHeadings, job->bookmarkId,
+                                                   &job->results);
                 }
-                /* TODO: abort job if it takes too long (> 15 seconds?) */
+                delete_FeedJob(job);
+                remove_PtrArrayIterator(&i);
+                numFinishedJobs++;
+                doNotify = iTrue;
+            }
+            else if (isTimedOut_FeedJob_(job)) {
+                /* Maybe we'll get it next time! */
+                timedOut_Feeds_(d, job);
+                delete_FeedJob(job);
+                remove_PtrArrayIterator(&i);
+                numFinishedJobs++;
+                doNotify = iTrue;
             }
         }
         if (doNotify) {
             postCommandf_App("feeds.update.progress arg:%d total:%d", numFinishedJobs, totalJobs);
         }
         /* Stop if everything has finished. */
-        if (ongoing == 0 && isEmpty_PtrArray(&d->jobs)) {
+        if (isEmpty_PtrArray(ongoing) && isEmpty_PtrArray(&d->jobs)) {
             break;
         }
     }
+    iForEach(PtrArray, j, ongoing) {
+        delete_FeedJob(j.ptr); /* stopped early */
+    }
+    delete_PtrArray(ongoing);
+    lock_Mutex(d->mtx);
     initCurrent_Time(&d->lastRefreshedAt);
-    save_Feeds_(d);
+    writeU64_Stream(beginRecord_Feeds_(d, refreshed_FeedJournalRecord, 0),
+                    integralSeconds_Time(&d->lastRefreshedAt));
+    endRecord_Feeds_(d);
+    unlock_Mutex(d->mtx);
+    commit_Feeds_(d);
     /* Check if there are visited URLs marked as Kept that can be cleared because they are no
        longer present in the database. */ {
         iStringSet *knownEntryUrls = new_StringSet();
@@ -501,9 +936,9 @@ static iThreadResult fetch_Feeds_(iThread *thread) {
         }
         unlock_Mutex(d->mtx);
         iConstForEach(PtrArray, j, listKept_Visited(visited_App())) {
-            iVisitedUrl *visUrl = j.ptr;
+            const iVisitedUrl *visUrl = j.ptr;
             if (!contains_StringSet(knownEntryUrls, &visUrl->url)) {
-                visUrl->flags &= ~kept_VisitedUrlFlag;
+                setUrlKept_Visited(visited_App(), &visUrl->url, iFalse);
 //                printf("unkept: {%s}\n", cstr_String(&visUrl->url));
             }
         }
@@ -514,13 +949,22 @@ static iThreadResult fetch_Feeds_(iThread *thread) {
     return 0;
 }
 
-static iBool startWorker_Feeds_(iFeeds *d) {
+static iBool startWorker_Feeds_(iFeeds *d, iBool onlyDue) {
     if (d->worker) {
         return iFalse; /* Refresh is already ongoing. */
     }
-    /* Queue up all the subscriptions for the worker. */
+    /* Queue up the subscriptions for the worker. */
     iConstForEach(PtrArray, i, listSubscriptions_()) {
         const iBookmark *bm = i.ptr;
+        if (onlyDue) {
+            lock_Mutex(d->mtx);
+            const iBool isDue = isDue_FeedSource_(source_Feeds_(d, id_Bookmark(bm)),
+                                                  &d->lastRefreshedAt);
+            unlock_Mutex(d->mtx);
+            if (!isDue) {
+                continue;
+            }
+        }
         iFeedJob *job = new_FeedJob(bm);
         if (!contains_IntSet(&d->previouslyCheckedFeeds, id_Bookmark(bm))) {
             job->isFirstUpdate = iTrue;
@@ -529,10 +973,13 @@ static iBool startWorker_Feeds_(iFeeds *d) {
             insert_IntSet(&d->previouslyCheckedFeeds, id_Bookmark(bm));
         }
         pushBack_PtrArray(&d->jobs, job);
+        /* Jobs are started a few at a time, so the lookups can mostly be done by then. */
+        prefetchUrl_Resolver(&bm->url);
     }
     if (!isEmpty_Array(&d->jobs)) {
         d->worker = new_Thread(fetch_Feeds_);
         d->stopWorker = iFalse;
+        d->numWakeups = 0;
         start_Thread(d->worker);
         return iTrue;
     }
@@ -541,13 +988,14 @@ static iBool startWorker_Feeds_(iFeeds *d) {
 
 static uint32_t refresh_Feeds_(uint32_t interval, void *data) {
     /* Called in the SDL timer thread, so let's start a worker thread for running the update. */
-    startWorker_Feeds_(&feeds_);
-    return 1000 * updateIntervalSeconds_Feeds_;
+    startWorker_Feeds_(&feeds_, iTrue);
+    return 1000 * checkIntervalSeconds_Feeds_;
 }
 
 static void stopWorker_Feeds_(iFeeds *d) {
     if (d->worker) {
         d->stopWorker = iTrue;
+        wakeUpWorker_Feeds_(d);
         join_Thread(d->worker);
         iReleasePtr(&d->worker);
     }
@@ -558,16 +1006,6 @@ static void stopWorker_Feeds_(iFeeds *d) {
     clear_PtrArray(&d->jobs);
 }
 
-static int cmp_FeedEntryPtr_(const void *a, const void *b) {
-    const iFeedEntry * const *elem[2] = { a, b };
-    const int cmp = cmpString_String(&(*elem[0])->url, &(*elem[1])->url);
-    if (cmp == 0) {
-        /* The same URL can be coming from different feeds. */
-        return iCmp((*elem[0])->bookmarkId, (*elem[1])->bookmarkId);
-    }
-    return cmp;
-}
-
 iDeclareType(FeedHashNode)
 
 struct Impl_FeedHashNode {
@@ -588,15 +1026,20 @@ static void load_Feeds_(iFeeds *d) {
                 section = 1;
                 continue;
             }
+            else if (equal_Rangecc(line, "# Sources")) {
+                section = 3;
+                continue;
+            }
             else if (equal_Rangecc(line, "# Entries")) {
                 section = 2;
                 continue;
             }
             switch (section) {
                 case 0: {
-                    unsigned long long ts = 0;
-                    sscanf(line.start, "%llu", &ts);
+                    unsigned long long ts = 0, compactedAt = 0;
+                    sscanf(line.start, "%llu %llu", &ts, &compactedAt);
                     d->lastRefreshedAt.ts.tv_sec = ts;
+                    d->lastCompactedAt.ts.tv_sec = compactedAt;
                     break;
                 }
                 case 1: {
@@ -668,6 +1111,27 @@ static void load_Feeds_(iFeeds *d) {
                     delete_String(url);
                     break;
                 }
+                case 3: {
+                    uint32_t id = 0, hash = 0;
+                    size_t size = 0;
+                    int interval = 0;
+                    unsigned long long checkedAt = 0;
+                    unsigned loadMs = 0; /* missing in older files */
+                    if (sscanf(line.start, "%08x %08x %zu %d %llu %u", &id, &hash, &size,
+                               &interval, &checkedAt, &loadMs) >= 5) {
+                        const iFeedHashNode *node = (iFeedHashNode *) value_Hash(feeds, id);
+                        if (node) {
+                            iFeedSource *src = source_Feeds_(d, node->bookmarkId);
+                            src->contentHash = hash;
+                            src->contentSize = size;
+                            src->intervalSeconds =
+                                iClamp(interval, minIntervalSeconds_Feeds_, maxIntervalSeconds_Feeds_);
+                            src->lastCheckedAt.ts.tv_sec = checkedAt;
+                            src->loadSeconds = loadMs / 1000.0f;
+                        }
+                    }
+                    break;
+                }
             }
         }
     aborted:
@@ -681,6 +1145,155 @@ static void load_Feeds_(iFeeds *d) {
     iRelease(f);
 }
 
+static iBool replayRecord_Feeds_(iFeeds *d, iStream *ins, uint32_t version, iHash *feeds,
+                                 iString *url) {
+    /* Applies one journal record. `feeds` maps journaled IDs to current bookmark IDs. */
+    const int type = read8_Stream(ins);
+    const uint32_t id = readU32_Stream(ins);
+    const iFeedHashNode *node = (const iFeedHashNode *) value_Hash(feeds, id);
+    switch (type) {
+        case feed_FeedJournalRecord: {
+            deserialize_String(url, ins);
+            free(remove_Hash(feeds, id));
+            const uint32_t bookmarkId = findUrl_Bookmarks(bookmarks_App(), url);
+            if (bookmarkId) {
+                iFeedHashNode *newNode = iMalloc(FeedHashNode);
+                newNode->node.key      = id;
+                newNode->bookmarkId    = bookmarkId;
+                insert_Hash(feeds, &newNode->node);
+                insert_IntSet(&d->previouslyCheckedFeeds, bookmarkId);
+            }
+            break;
+        }
+        case entry_FeedJournalRecord: {
+            iFeedEntry *entry = new_FeedEntry();
+            entry->posted.ts.tv_sec     = readU64_Stream(ins);
+            entry->discovered.ts.tv_sec = readU64_Stream(ins);
+            deserialize_String(&entry->url, ins);
+            deserialize_String(&entry->title, ins);
+            if (!node) {
+                delete_FeedEntry(entry);
+                break;
+            }
+            entry->bookmarkId = node->bookmarkId;
+            entry->isHeading  = isHeadingEntry_FeedEntry_(entry);
+            size_t pos;
+            if (locate_SortedArray(&d->entries, &entry, &pos)) {
+                iFeedEntry *existing = *(iFeedEntry **) at_SortedArray(&d->entries, pos);
+                set_String(&existing->title, &entry->title);
+                existing->posted     = entry->posted;
+                existing->discovered = entry->discovered;
+                delete_FeedEntry(entry);
+            }
+            else {
+                insert_SortedArray(&d->entries, &entry);
+            }
+            break;
+        }
+        case removedEntry_FeedJournalRecord: {
+            iFeedEntry *key = new_FeedEntry();
+            deserialize_String(&key->url, ins);
+            if (node) {
+                size_t pos;
+                key->bookmarkId = node->bookmarkId;
+                if (locate_SortedArray(&d->entries, &key, &pos)) {
+                    delete_FeedEntry(*(iFeedEntry **) at_SortedArray(&d->entries, pos));
+                    remove_Array(&d->entries.values, pos);
+                }
+            }
+            delete_FeedEntry(key);
+            break;
+        }
+        case source_FeedJournalRecord: {
+            const uint32_t hash      = readU32_Stream(ins);
+            const uint64_t size      = readU64_Stream(ins);
+            const int      interval  = read32_Stream(ins);
+            const uint64_t checkedAt = readU64_Stream(ins);
+            const uint32_t loadMs    = version >= 2 ? readU32_Stream(ins) : 0;
+            if (node) {
+                iFeedSource *src = source_Feeds_(d, node->bookmarkId);
+                src->contentHash = hash;
+                src->contentSize = (size_t) size;
+                src->intervalSeconds =
+                    iClamp(interval, minIntervalSeconds_Feeds_, maxIntervalSeconds_Feeds_);
+                src->lastCheckedAt.ts.tv_sec = checkedAt;
+                src->loadSeconds = loadMs / 1000.0f;
+            }
+            break;
+        }
+        case refreshed_FeedJournalRecord:
+            d->lastRefreshedAt.ts.tv_sec = readU64_Stream(ins);
+            break;
+        default:
+            return iFalse; /* corrupt */
+    }
+    return iTrue;
+}
+
+static void replayJournal_Feeds_(iFeeds *d) {
+    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, journalFilename_Feeds_)));
+    if (!open_File(f, readOnly_FileMode)) {
+        iRelease(f);
+        return;
+    }
+    iBlock  *data = readAll_File(f);
+    iBuffer *buf  = new_Buffer();
+    iStream *ins  = stream_Buffer(buf);
+    char     magic[4];
+    uint32_t version;
+    iRelease(f);
+    open_Buffer(buf, data);
+    if (readData_Stream(ins, 4, magic) == 4 && !memcmp(magic, magicJournal_Feeds_, 4) &&
+        (version = readU32_Stream(ins)) >= 1 && version <= (uint32_t) journalVersion_Feeds_ &&
+        readU64_Stream(ins) == (uint64_t) integralSeconds_Time(&d->lastCompactedAt)) {
+        iHash   *feeds  = new_Hash(); /* mapping from journaled IDs to current bookmark IDs */
+        iString *url    = new_String();
+        iBool    ok     = iTrue;
+        iBuffer *recBuf = new_Buffer();
+        iBlock  *rec    = new_Block(0);
+        while (ok && !atEnd_Buffer(buf)) {
+            if (version < 3) {
+                ok = replayRecord_Feeds_(d, ins, version, feeds, url);
+                continue;
+            }
+            /* A record that was not completely written, or is otherwise damaged, ends the
+               journal. */
+            const size_t remaining = size_Block(data) - pos_Stream(ins);
+            if (remaining < 8) {
+                ok = iFalse;
+                break;
+            }
+            const uint32_t size     = readU32_Stream(ins);
+            const uint32_t checksum = readU32_Stream(ins);
+            if (size < 5 || size > remaining - 8) {
+                ok = iFalse;
+                break;
+            }
+            resize_Block(rec, size);
+            readData_Stream(ins, size, data_Block(rec));
+            if (contentHash_(rec) != checksum) {
+                ok = iFalse;
+                break;
+            }
+            open_Buffer(recBuf, rec);
+            ok = replayRecord_Feeds_(d, stream_Buffer(recBuf), version, feeds, url);
+            close_Buffer(recBuf);
+        }
+        /* An older or damaged journal is compacted away before anything is appended to it. */
+        d->journalSize =
+            (ok && version == (uint32_t) journalVersion_Feeds_ ? size_Block(data) : 0);
+        delete_Block(rec);
+        iRelease(recBuf);
+        delete_String(url);
+        iForEach(Hash, i, feeds) {
+            free(i.value);
+        }
+        delete_Hash(feeds);
+    }
+    iRelease(buf);
+    delete_Block(data);
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 void init_Feeds(const char *saveDir) {
@@ -689,15 +1302,34 @@ void init_Feeds(const char *saveDir) {
     initCStr_String(&d->saveDir, saveDir);
     init_IntSet(&d->previouslyCheckedFeeds);
     iZap(d->lastRefreshedAt);
+    iZap(d->lastCompactedAt);
+    d->journal = new_Buffer();
+    openEmpty_Buffer(d->journal);
+    d->record = new_Buffer();
+    openEmpty_Buffer(d->record);
+    d->journalSize = 0;
+    init_IntSet(&d->journaledFeeds);
     d->worker = NULL;
+    d->workerMtx = new_Mutex();
+    init_Condition(&d->workerWakeup);
+    d->numWakeups = 0;
     init_PtrArray(&d->jobs);
+    init_SortedArray(&d->sources, sizeof(iFeedSource), cmp_FeedSource_);
     init_SortedArray(&d->entries, sizeof(iFeedEntry *), cmp_FeedEntryPtr_);
+    init_SortedArray(&d->byTime, sizeof(iFeedEntry *), cmpTimeDescending_FeedEntryPtr_);
+    d->generation = 0;
+    d->isUnreadCounted = iFalse;
+    d->unreadGeneration = 0;
+    d->unreadVisitedGeneration = 0;
+    d->numUnread = 0;
     load_Feeds_(d);
-    /* Update feeds if it has been a while. */
-    int intervalSec = updateIntervalSeconds_Feeds_;
+    replayJournal_Feeds_(d);
+    rebuildIndex_Feeds_(d);
+    /* Look for due feeds if it has been a while. */
+    int intervalSec = checkIntervalSeconds_Feeds_;
     if (isValid_Time(&d->lastRefreshedAt)) {
         const double elapsed = elapsedSeconds_Time(&d->lastRefreshedAt);
-        intervalSec = iMax(1, updateIntervalSeconds_Feeds_ - elapsed);
+        intervalSec = iMax(1, checkIntervalSeconds_Feeds_ - elapsed);
     }
     d->refreshTimer = SDL_AddTimer(1000 * intervalSec, refresh_Feeds_, NULL);
 }
@@ -706,8 +1338,18 @@ void deinit_Feeds(void) {
     iFeeds *d = &feeds_;
     SDL_RemoveTimer(d->refreshTimer);
     stopWorker_Feeds_(d);
+    /* Entries may have been removed after the last refresh. */
+    lock_Mutex(d->mtx);
+    appendJournal_Feeds_(d);
+    unlock_Mutex(d->mtx);
+    iRelease(d->record);
+    iRelease(d->journal);
+    deinit_IntSet(&d->journaledFeeds);
     iAssert(isEmpty_PtrArray(&d->jobs));
     deinit_PtrArray(&d->jobs);
+    deinit_SortedArray(&d->sources);
+    deinit_Condition(&d->workerWakeup);
+    delete_Mutex(d->workerMtx);
     deinit_String(&d->saveDir);
     delete_Mutex(d->mtx);
     iForEach(Array, i, &d->entries.values) {
@@ -715,11 +1357,12 @@ void deinit_Feeds(void) {
         delete_FeedEntry(*entry);
     }
     deinit_IntSet(&d->previouslyCheckedFeeds);
+    deinit_SortedArray(&d->byTime);
     deinit_SortedArray(&d->entries);
 }
 
 void refresh_Feeds(void) {
-    startWorker_Feeds_(&feeds_);
+    startWorker_Feeds_(&feeds_, iFalse);
 }
 
 void refreshFinished_Feeds(void) {
@@ -728,52 +1371,95 @@ void refreshFinished_Feeds(void) {
 
 void removeEntries_Feeds(uint32_t feedBookmarkId) {
     iFeeds *d = &feeds_;
+    lock_Mutex(d->mtx);
     iForEach(Array, i, &d->entries.values) {
         iFeedEntry **entry = i.value;
         if ((*entry)->bookmarkId == feedBookmarkId) {
+            journalRemoval_Feeds_(d, *entry);
+            unindexEntry_Feeds_(d, *entry);
             delete_FeedEntry(*entry);
             remove_ArrayIterator(&i);
         }
     }
-}
-
-static int cmpTimeDescending_FeedEntryPtr_(const void *a, const void *b) {
-    const iFeedEntry * const *e1 = a, * const *e2 = b;
-    const int cmpPosted = -cmp_Time(&(*e1)->posted, &(*e2)->posted);
-    if (cmpPosted) return cmpPosted;
-    /* Posting timestamps may only be accurate to a day, so also sort by discovery time. */
-    return -cmp_Time(&(*e1)->discovered, &(*e2)->discovered);
+    /* The entries must be parsed again on the next check. */
+    size_t pos;
+    if (locate_SortedArray(&d->sources, &(iFeedSource){ .bookmarkId = feedBookmarkId }, &pos)) {
+        remove_Array(&d->sources.values, pos);
+        journalSource_Feeds_(
+            d, &(iFeedSource){ .bookmarkId      = feedBookmarkId,
+                               .intervalSeconds = updateIntervalSeconds_Feeds_ });
+    }
+    unlock_Mutex(d->mtx);
 }
 
 const iPtrArray *listEntries_Feeds(void) {
     iFeeds *d = &feeds_;
     lock_Mutex(d->mtx);
     /* The worker will never delete feed entries so we can use the same ones. Just make a copy
-       of the array in case the worker modifies it. */
-    iPtrArray *list = collect_PtrArray(copy_Array(&d->entries.values));
+       of the array in case the worker modifies it. The index is already in time order. */
+    iPtrArray *list = collect_PtrArray(copy_Array(&d->byTime.values));
     unlock_Mutex(d->mtx);
-    sort_Array(list, cmpTimeDescending_FeedEntryPtr_);
     return list;
 }
 
+void search_Feeds(const iTrigrams *required, iFeedsSearchFunc func, void *context) {
+    iFeeds *d = &feeds_;
+    lock_Mutex(d->mtx);
+    iConstForEach(Array, i, &d->byTime.values) {
+        const iFeedEntry *entry = *(const iFeedEntry **) i.value;
+        if (contains_Trigrams(&entry->trigrams, required) && !func(context, entry)) {
+            break;
+        }
+    }
+    unlock_Mutex(d->mtx);
+}
+
+size_t memorySize_Feeds(void) {
+    iFeeds *d = &feeds_;
+    size_t size = 0;
+    lock_Mutex(d->mtx);
+    iConstForEach(Array, i, &d->entries.values) {
+        const iFeedEntry *entry = *(const iFeedEntry **) i.value;
+        size += sizeof(iFeedEntry) + size_String(&entry->url) + size_String(&entry->title);
+    }
+    size += (size_SortedArray(&d->entries) + size_SortedArray(&d->byTime)) * sizeof(void *);
+    unlock_Mutex(d->mtx);
+    return size;
+}
+
 size_t numSubscribed_Feeds(void) {
     return size_PtrArray(listSubscriptions_());
 }
 
 size_t numUnread_Feeds(void) {
+    iFeeds *d = &feeds_;
     size_t count = 0;
     size_t max = 100; /* match the number of items shown in the sidebar */
-    iConstForEach(PtrArray, i, listEntries_Feeds()) {
-        if (!max--) break;
-        const iFeedEntry *entry = i.ptr;
-        if (isValid_Time(&entry->discovered) && isUnread_FeedEntry(i.ptr)) {
-            count++;
+    const uint32_t visitedGen = generation_Visited(visited_App());
+    lock_Mutex(d->mtx);
+    /* The count only changes when the entries or the visited URLs do. */
+    if (d->isUnreadCounted && d->unreadGeneration == d->generation &&
+        d->unreadVisitedGeneration == visitedGen) {
+        count = d->numUnread;
+    }
+    else {
+        iConstForEach(Array, i, &d->byTime.values) {
+            if (!max--) break;
+            const iFeedEntry *entry = *(const iFeedEntry **) i.value;
+            if (isValid_Time(&entry->discovered) && isUnread_FeedEntry(entry)) {
+                count++;
+            }
         }
+        d->isUnreadCounted         = iTrue;
+        d->unreadGeneration        = d->generation;
+        d->unreadVisitedGeneration = visitedGen;
+        d->numUnread               = count;
     }
+    unlock_Mutex(d->mtx);
     return count;
 }
 
-const iString *entryListPage_Feeds(void) {
+const iString *entryListPage_Feeds(int page) {
     iFeeds *d = &feeds_;
     iString *src = collectNew_String();
     setCStr_String(src, translateCStr_Lang("# ${feeds.list.title}\n\n"));
@@ -796,13 +1482,32 @@ const iString *entryListPage_Feeds(void) {
                                                  : formatCStr_Lang("days.ago.n", elapsed / 1440));
         }
     }
+    /* Only the requested page is formatted; the time index is walked in place so the first
+       page takes the same time regardless of how many entries there are. */
+    const size_t first = (size_t) iMax(0, page) * entriesPerPage_Feeds_;
+    size_t       index = 0;
+    iBool        hasMore = iFalse;
     iDate on;
     iZap(on);
-    iConstForEach(PtrArray, i, listEntries_Feeds()) {
-        const iFeedEntry *entry = i.ptr;
+    if (page > 0) {
+        appendFormat_String(src,
+                            "\n=> about:feeds%s %s\n",
+                            page > 1 ? cstrCollect_String(newFormat_String("?page=%d", page))
+                                     : "",
+                            translateCStr_Lang("${feeds.list.newer}"));
+    }
+    iConstForEach(Array, i, &d->byTime.values) {
+        const iFeedEntry *entry = *(const iFeedEntry **) i.value;
         if (isHidden_FeedEntry(entry)) {
             continue; /* A hidden entry. */
         }
+        if (index++ < first) {
+            continue;
+        }
+        if (index > first + entriesPerPage_Feeds_) {
+            hasMore = iTrue;
+            break;
+        }
         iDate entryDate;
         init_Date(&entryDate, &entry->posted);
         if (on.year != entryDate.year || on.month != entryDate.month || on.day != entryDate.day) {
@@ -820,5 +1525,11 @@ const iString *entryListPage_Feeds(void) {
         }
     }
     unlock_Mutex(d->mtx);
+    if (hasMore) {
+        appendFormat_String(src,
+                            "\n=> about:feeds?page=%d %s\n",
+                            page + 2,
+                            translateCStr_Lang("${feeds.list.older}"));
+    }
     return src;
 }
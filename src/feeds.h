@@ -22,6 +22,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #pragma once
 
+#include "trigrams.h"
+
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/string.h>
 #include <the_Foundation/time.h>
@@ -36,6 +38,7 @@ struct Impl_FeedEntry {
     iString title;
     iBool isHeading; /* URL fragment points to a heading */
     uint32_t bookmarkId; /* note: runtime only, not a persistent ID */
+    iTrigrams trigrams; /* of URL and title, for lookups */
 };
 
 iLocalDef iBool isHidden_FeedEntry(const iFeedEntry *d) {
@@ -55,6 +58,12 @@ void    removeEntries_Feeds     (uint32_t feedBookmarkId);
 void    refreshFinished_Feeds   (void); /* called on "feeds.update.finished" */
 
 const iPtrArray *   listEntries_Feeds   (void);
-const iString *     entryListPage_Feeds (void);
+
+typedef iBool (*iFeedsSearchFunc)(void *context, const iFeedEntry *); /* return False to stop */
+
+void                search_Feeds        (const iTrigrams *required, iFeedsSearchFunc func,
+                                         void *context); /* newest first */
+const iString *     entryListPage_Feeds (int page); /* zero is the newest entries */
 size_t              numSubscribed_Feeds (void);
 size_t              numUnread_Feeds     (void);
+size_t              memorySize_Feeds    (void); /* bytes, approximate */
@@ -0,0 +1,515 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "feedxml.h"
+
+#include <the_Foundation/regexp.h>
+#include <ctype.h>
+
+iDeclareType(XmlToken)
+
+enum iXmlTokenType {
+    skip_XmlTokenType, /* comment, declaration, processing instruction */
+    text_XmlTokenType,
+    cdata_XmlTokenType,
+    start_XmlTokenType,
+    end_XmlTokenType,
+};
+
+struct Impl_XmlToken {
+    enum iXmlTokenType type;
+    iRangecc           name;    /* local name without a namespace prefix */
+    iRangecc           content; /* text, or the attributes of a start tag */
+    iBool              isEmpty; /* start tag is also the end tag */
+};
+
+static const char *find_(iRangecc range, const char *str) {
+    const size_t len = strlen(str);
+    for (const char *pos = range.start; pos && (size_t) (range.end - pos) >= len; pos++) {
+        pos = memchr(pos, str[0], range.end - pos - len + 1);
+        if (!pos) break;
+        if (!memcmp(pos, str, len)) {
+            return pos;
+        }
+    }
+    return NULL;
+}
+
+static iBool skipPast_(iRangecc *src, const char *start, const char *end, iRangecc *inner_out) {
+    const char *found = find_((iRangecc){ src->start + strlen(start), src->end }, end);
+    if (!found) {
+        return iFalse; /* need more data */
+    }
+    if (inner_out) {
+        *inner_out = (iRangecc){ src->start + strlen(start), found };
+    }
+    src->start = found + strlen(end);
+    return iTrue;
+}
+
+static iBool next_XmlToken_(iXmlToken *d, iRangecc *src, iBool isFinal) {
+    /* Returns False if `src` does not begin with a complete token. */
+    iZap(*d);
+    if (isEmpty_Range(src)) {
+        return iFalse;
+    }
+    if (*src->start != '<') {
+        const char *lt = memchr(src->start, '<', size_Range(src));
+        if (!lt) {
+            if (!isFinal) {
+                return iFalse;
+            }
+            lt = src->end;
+        }
+        d->type    = text_XmlTokenType;
+        d->content = (iRangecc){ src->start, lt };
+        src->start = lt;
+        return iTrue;
+    }
+    if (startsWith_Rangecc(*src, "<!--")) {
+        return skipPast_(src, "<!--", "-->", NULL);
+    }
+    if (startsWith_Rangecc(*src, "<![CDATA[")) {
+        d->type = cdata_XmlTokenType;
+        return skipPast_(src, "<![CDATA[", "]]>", &d->content);
+    }
+    if (startsWith_Rangecc(*src, "<?")) {
+        return skipPast_(src, "<?", "?>", NULL);
+    }
+    if (startsWith_Rangecc(*src, "<!")) {
+        return skipPast_(src, "<!", ">", NULL);
+    }
+    /* A tag; attribute values may contain '>'. */
+    const char *pos   = src->start + 1;
+    char        quote = 0;
+    for (; pos < src->end; pos++) {
+        if (quote) {
+            if (*pos == quote) quote = 0;
+        }
+        else if (*pos == '"' || *pos == '\'') {
+            quote = *pos;
+        }
+        else if (*pos == '>') {
+            break;
+        }
+    }
+    if (pos == src->end) {
+        return iFalse;
+    }
+    iRangecc inner = { src->start + 1, pos };
+    src->start = pos + 1;
+    if (*inner.start == '/') {
+        d->type = end_XmlTokenType;
+        inner.start++;
+    }
+    else {
+        d->type = start_XmlTokenType;
+        if (!isEmpty_Range(&inner) && inner.end[-1] == '/') {
+            d->isEmpty = iTrue;
+            inner.end--;
+        }
+    }
+    const char *nameEnd = inner.start;
+    while (nameEnd < inner.end && !isspace((unsigned char) *nameEnd)) {
+        nameEnd++;
+    }
+    d->name    = (iRangecc){ inner.start, nameEnd };
+    d->content = (iRangecc){ nameEnd, inner.end };
+    const char *colon = memchr(d->name.start, ':', size_Range(&d->name));
+    if (colon) {
+        d->name.start = colon + 1;
+    }
+    return iTrue;
+}
+
+static void appendDecoded_(iString *out, iRangecc text) {
+    /* Appends `text` with character and entity references replaced. */
+    while (!isEmpty_Range(&text)) {
+        const char *amp = memchr(text.start, '&', size_Range(&text));
+        if (!amp) {
+            appendCStrN_String(out, text.start, size_Range(&text));
+            break;
+        }
+        appendCStrN_String(out, text.start, amp - text.start);
+        text.start = amp + 1;
+        const char *semi = memchr(text.start, ';', iMin(size_Range(&text), 12u));
+        if (!semi) {
+            appendChar_String(out, '&');
+            continue;
+        }
+        const iRangecc ref = { text.start, semi };
+        iChar ch = 0;
+        if (equal_Rangecc(ref, "lt")) ch = '<';
+        else if (equal_Rangecc(ref, "gt")) ch = '>';
+        else if (equal_Rangecc(ref, "amp")) ch = '&';
+        else if (equal_Rangecc(ref, "quot")) ch = '"';
+        else if (equal_Rangecc(ref, "apos")) ch = '\'';
+        else if (size_Range(&ref) > 1 && ref.start[0] == '#') {
+            const iBool isHex = (ref.start[1] == 'x' || ref.start[1] == 'X');
+            ch = (iChar) strtoul(ref.start + (isHex ? 2 : 1), NULL, isHex ? 16 : 10);
+        }
+        if (ch) {
+            appendChar_String(out, ch);
+            text.start = semi + 1;
+        }
+        else {
+            appendChar_String(out, '&');
+        }
+    }
+}
+
+static iBool attribute_(iRangecc attribs, const char *name, iRangecc *value_out) {
+    const char *pos = attribs.start;
+    while (pos < attribs.end) {
+        while (pos < attribs.end && isspace((unsigned char) *pos)) pos++;
+        const char *nameStart = pos;
+        while (pos < attribs.end && *pos != '=' && !isspace((unsigned char) *pos)) pos++;
+        const iRangecc attrName = { nameStart, pos };
+        while (pos < attribs.end && isspace((unsigned char) *pos)) pos++;
+        if (pos == attribs.end || *pos != '=') {
+            if (pos == nameStart) pos++;
+            continue;
+        }
+        pos++;
+        while (pos < attribs.end && isspace((unsigned char) *pos)) pos++;
+        if (pos == attribs.end || (*pos != '"' && *pos != '\'')) {
+            break;
+        }
+        const char  quote      = *pos++;
+        const char *valueStart = pos;
+        while (pos < attribs.end && *pos != quote) pos++;
+        if (equal_Rangecc(attrName, name)) {
+            *value_out = (iRangecc){ valueStart, pos };
+            return iTrue;
+        }
+        pos++;
+    }
+    return iFalse;
+}
+
+static iBool parseDate_(const iString *text, iDate *date_out) {
+    /* Atom uses RFC 3339 and RSS uses RFC 822 dates. Only the day matters. */
+    static const char *months_[] = { "jan", "feb", "mar", "apr", "may", "jun",
+                                     "jul", "aug", "sep", "oct", "nov", "dec" };
+    iRangecc str = range_String(text);
+    trim_Rangecc(&str);
+    int year = 0, month = 0, day = 0;
+    if (size_Range(&str) >= 10 && isdigit((unsigned char) str.start[0]) && str.start[4] == '-' &&
+        str.start[7] == '-') {
+        year  = atoi(str.start);
+        month = atoi(str.start + 5);
+        day   = atoi(str.start + 8);
+    }
+    else {
+        const char *comma = memchr(str.start, ',', size_Range(&str));
+        if (comma) {
+            str.start = comma + 1;
+            trimStart_Rangecc(&str);
+        }
+        char monthName[4] = "";
+        if (sscanf(cstr_Rangecc(str), "%d %3s %d", &day, monthName, &year) != 3) {
+            return iFalse;
+        }
+        iForIndices(i, months_) {
+            if (!iCmpStrCase(monthName, months_[i])) {
+                month = (int) i + 1;
+                break;
+            }
+        }
+        if (year < 100) {
+            year += (year < 50 ? 2000 : 1900);
+        }
+    }
+    if (year < 1 || month < 1 || month > 12 || day < 1 || day > 31) {
+        return iFalse;
+    }
+    iZap(*date_out);
+    date_out->year  = year;
+    date_out->month = month;
+    date_out->day   = day;
+    date_out->hour  = 12; /* noon UTC */
+    return iTrue;
+}
+
+static void normalizeSpace_(iString *str) {
+    /* Titles must fit on one line. */
+    iString *norm = new_String();
+    iBool    wasSpace = iTrue;
+    iConstForEach(String, i, str) {
+        if (isSpace_Char(i.value)) {
+            if (!wasSpace) {
+                appendChar_String(norm, ' ');
+            }
+            wasSpace = iTrue;
+        }
+        else {
+            appendChar_String(norm, i.value);
+            wasSpace = iFalse;
+        }
+    }
+    trim_String(norm);
+    set_String(str, norm);
+    delete_String(norm);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+enum iFeedXmlFormat {
+    unknown_FeedXmlFormat,
+    atom_FeedXmlFormat,
+    rss_FeedXmlFormat,
+    invalid_FeedXmlFormat,
+};
+
+struct Impl_FeedXml {
+    iFeedXmlEntryFunc   entryFunc;
+    void *              context;
+    iBlock              pending; /* incomplete token at the end of the previous write */
+    enum iFeedXmlFormat format;
+    int                 depth;
+    int                 feedDepth;  /* depth of the element with the feed's title */
+    int                 entryDepth; /* zero when not inside an entry */
+    iString *           capture;    /* text content goes here */
+    int                 captureDepth;
+    iString             title;
+    iString             subtitle;
+    iFeedXmlEntry       entry;
+    iString             updated;
+    iString             published;
+    iBool               hasGeminiUrl;
+};
+
+iDefineTypeConstructionArgs(FeedXml, (iFeedXmlEntryFunc entryFunc, void *context),
+                            entryFunc, context)
+
+void init_FeedXml(iFeedXml *d, iFeedXmlEntryFunc entryFunc, void *context) {
+    d->entryFunc = entryFunc;
+    d->context   = context;
+    init_Block(&d->pending, 0);
+    d->format       = unknown_FeedXmlFormat;
+    d->depth        = 0;
+    d->feedDepth    = -1;
+    d->entryDepth   = 0;
+    d->capture      = NULL;
+    d->captureDepth = 0;
+    init_String(&d->title);
+    init_String(&d->subtitle);
+    init_String(&d->entry.title);
+    init_String(&d->entry.url);
+    iZap(d->entry.date);
+    init_String(&d->updated);
+    init_String(&d->published);
+    d->hasGeminiUrl = iFalse;
+}
+
+void deinit_FeedXml(iFeedXml *d) {
+    deinit_String(&d->published);
+    deinit_String(&d->updated);
+    deinit_String(&d->entry.url);
+    deinit_String(&d->entry.title);
+    deinit_String(&d->subtitle);
+    deinit_String(&d->title);
+    deinit_Block(&d->pending);
+}
+
+iBool isMimeType_FeedXml(const iString *mime) {
+    static iRegExp *xmlMime_;
+    if (!xmlMime_) {
+        xmlMime_ = new_RegExp("(application|text)/((atom|rss)\\+)?xml", caseInsensitive_RegExpOption);
+    }
+    iRegExpMatch m;
+    init_RegExpMatch(&m);
+    return matchString_RegExp(xmlMime_, mime, &m);
+}
+
+static void capture_FeedXml_(iFeedXml *d, iString *str) {
+    d->capture      = str;
+    d->captureDepth = d->depth;
+}
+
+static void startEntry_FeedXml_(iFeedXml *d) {
+    d->entryDepth = d->depth;
+    clear_String(&d->entry.title);
+    clear_String(&d->entry.url);
+    iZap(d->entry.date);
+    clear_String(&d->updated);
+    clear_String(&d->published);
+    d->hasGeminiUrl = iFalse;
+}
+
+static void finishEntry_FeedXml_(iFeedXml *d) {
+    iFeedXmlEntry *entry = &d->entry;
+    normalizeSpace_(&entry->title);
+    trim_String(&entry->url);
+    if (!isEmpty_String(&entry->title) && !isEmpty_String(&entry->url) &&
+        (parseDate_(&d->updated, &entry->date) || parseDate_(&d->published, &entry->date))) {
+        d->entryFunc(d->context, entry);
+    }
+    d->entryDepth = 0;
+}
+
+static void entryLink_FeedXml_(iFeedXml *d, iRangecc attribs) {
+    iRangecc href = iNullRange;
+    if (!attribute_(attribs, "href", &href)) {
+        /* RSS has the URL as the content. */
+        if (isEmpty_String(&d->entry.url)) {
+            capture_FeedXml_(d, &d->entry.url);
+        }
+        return;
+    }
+    if (d->hasGeminiUrl) {
+        return; /* we're happy with the first gemini URL */
+    }
+    iRangecc rel = iNullRange;
+    attribute_(attribs, "rel", &rel);
+    if (equal_Rangecc(rel, "self")) {
+        return; /* the entry's own feed document, not the entry */
+    }
+    const iBool isGemini = startsWithCase_Rangecc(href, "gemini:");
+    if (isGemini || isEmpty_String(&d->entry.url) || isEmpty_Range(&rel) ||
+        equal_Rangecc(rel, "alternate")) {
+        clear_String(&d->entry.url);
+        appendDecoded_(&d->entry.url, href);
+        d->hasGeminiUrl = isGemini;
+    }
+}
+
+static void startElement_FeedXml_(iFeedXml *d, iRangecc name, iRangecc attribs) {
+    d->depth++;
+    if (d->capture) {
+        return; /* markup inside text content */
+    }
+    if (d->depth == 1) {
+        iRangecc xmlns = iNullRange;
+        if (equal_Rangecc(name, "feed") && attribute_(attribs, "xmlns", &xmlns) &&
+            equal_Rangecc(xmlns, "http://www.w3.org/2005/Atom")) {
+            d->format    = atom_FeedXmlFormat;
+            d->feedDepth = 1;
+        }
+        else if (equal_Rangecc(name, "rss") || equal_Rangecc(name, "RDF")) {
+            d->format = rss_FeedXmlFormat;
+        }
+        else {
+            d->format = invalid_FeedXmlFormat;
+        }
+    }
+    else if (!d->entryDepth && (equal_Rangecc(name, "entry") || equal_Rangecc(name, "item"))) {
+        startEntry_FeedXml_(d);
+    }
+    else if (d->entryDepth && d->depth == d->entryDepth + 1) {
+        if (equal_Rangecc(name, "title")) {
+            capture_FeedXml_(d, &d->entry.title);
+        }
+        else if (equal_Rangecc(name, "link")) {
+            entryLink_FeedXml_(d, attribs);
+        }
+        else if (equal_Rangecc(name, "updated")) {
+            capture_FeedXml_(d, &d->updated);
+        }
+        else if ((equal_Rangecc(name, "published") || equal_Rangecc(name, "pubDate") ||
+                  equal_Rangecc(name, "date")) && isEmpty_String(&d->published)) {
+            capture_FeedXml_(d, &d->published);
+        }
+    }
+    else if (!d->entryDepth && d->format == rss_FeedXmlFormat && d->depth == 2 &&
+             equal_Rangecc(name, "channel")) {
+        d->feedDepth = 2;
+    }
+    else if (!d->entryDepth && d->depth == d->feedDepth + 1) {
+        if (equal_Rangecc(name, "title") && isEmpty_String(&d->title)) {
+            capture_FeedXml_(d, &d->title);
+        }
+        else if ((equal_Rangecc(name, "subtitle") || equal_Rangecc(name, "description")) &&
+                 isEmpty_String(&d->subtitle)) {
+            capture_FeedXml_(d, &d->subtitle);
+        }
+    }
+}
+
+static void endElement_FeedXml_(iFeedXml *d) {
+    if (d->capture && d->depth == d->captureDepth) {
+        d->capture = NULL;
+    }
+    if (d->entryDepth && d->depth == d->entryDepth) {
+        finishEntry_FeedXml_(d);
+    }
+    d->depth = iMax(0, d->depth - 1);
+}
+
+static void process_FeedXml_(iFeedXml *d, iRangecc *src, iBool isFinal) {
+    iXmlToken tok;
+    while (d->format != invalid_FeedXmlFormat && next_XmlToken_(&tok, src, isFinal)) {
+        switch (tok.type) {
+            case text_XmlTokenType:
+                if (d->capture) {
+                    appendDecoded_(d->capture, tok.content);
+                }
+                break;
+            case cdata_XmlTokenType:
+                if (d->capture) {
+                    appendCStrN_String(d->capture, tok.content.start, size_Range(&tok.content));
+                }
+                break;
+            case start_XmlTokenType:
+                startElement_FeedXml_(d, tok.name, tok.content);
+                if (tok.isEmpty) {
+                    endElement_FeedXml_(d);
+                }
+                break;
+            case end_XmlTokenType:
+                endElement_FeedXml_(d);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+void write_FeedXml(iFeedXml *d, iRangecc data) {
+    if (isEmpty_Block(&d->pending)) {
+        /* Parse in place; only an incomplete token at the end is copied. */
+        process_FeedXml_(d, &data, iFalse);
+        setData_Block(&d->pending, data.start, size_Range(&data));
+        return;
+    }
+    appendData_Block(&d->pending, data.start, size_Range(&data));
+    iRangecc src = range_Block(&d->pending);
+    process_FeedXml_(d, &src, iFalse);
+    remove_Block(&d->pending, 0, src.start - constBegin_Block(&d->pending));
+}
+
+iBool finish_FeedXml(iFeedXml *d) {
+    iRangecc src = range_Block(&d->pending);
+    process_FeedXml_(d, &src, iTrue);
+    clear_Block(&d->pending);
+    normalizeSpace_(&d->title);
+    normalizeSpace_(&d->subtitle);
+    return d->format == atom_FeedXmlFormat || d->format == rss_FeedXmlFormat;
+}
+
+const iString *title_FeedXml(const iFeedXml *d) {
+    return &d->title;
+}
+
+const iString *subtitle_FeedXml(const iFeedXml *d) {
+    return &d->subtitle;
+}
@@ -0,0 +1,51 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/string.h>
+#include <the_Foundation/time.h>
+
+/* Push parser for Atom and RSS feeds. The source can be written in pieces as it arrives;
+   entries are reported via a callback as soon as each one has been fully parsed, without
+   building a document tree. */
+
+iDeclareType(FeedXml)
+iDeclareType(FeedXmlEntry)
+
+struct Impl_FeedXmlEntry {
+    iString title;
+    iString url;   /* as written in the feed; may be relative */
+    iDate   date;
+};
+
+typedef void (*iFeedXmlEntryFunc)(void *context, const iFeedXmlEntry *entry);
+
+iDeclareTypeConstructionArgs(FeedXml, iFeedXmlEntryFunc entryFunc, void *context)
+
+iBool           isMimeType_FeedXml  (const iString *mime);
+
+void            write_FeedXml       (iFeedXml *, iRangecc data);
+iBool           finish_FeedXml      (iFeedXml *); /* returns True if the source was a feed */
+
+const iString * title_FeedXml       (const iFeedXml *);
+const iString * subtitle_FeedXml    (const iFeedXml *);
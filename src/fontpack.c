@@ -29,6 +29,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/array.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/regexp.h>
@@ -36,6 +37,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/stringlist.h>
 #include <the_Foundation/toml.h>
 
+#if !defined (iPlatformMsys)
+#   define LAGRANGE_MMAP_FONTS
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
+
 const char *mimeType_FontPack = "application/lagrange-fontpack+zip";
 
 float scale_FontSize(enum iFontSize size) {
@@ -69,38 +78,66 @@ void init_FontFile(iFontFile *d) {
     d->colIndex = 0;
     d->style = regular_FontStyle;
     init_Block(&d->sourceData, 0);
+    d->mapData = NULL;
+    d->mapSize = 0;
     iZap(d->stbInfo);
+    atomic_init(&d->isKerningReady, iFalse);
+    d->kernPairs      = NULL;
+    d->numKernPairs   = 0;
+    d->asciiGlyphs    = NULL;
+    d->numAsciiGlyphs = 0;
 #if defined (LAGRANGE_ENABLE_HARFBUZZ)
     d->hbBlob = NULL;
     d->hbFace = NULL;
-    d->hbFont = NULL;
+    atomic_init(&d->hbFont, NULL);
 #endif
 }
 
+static void setup_FontFile_(iFontFile *d) {
+    /* Only the table directory and basic metrics are read here. Glyph data is accessed
+       when glyphs are needed, so pages of a mapped file are read from disk on demand. */
+    const uint8_t *data   = data_FontFile(d);
+    const int      offset = stbtt_GetFontOffsetForIndex(data, d->colIndex);
+    stbtt_InitFont(&d->stbInfo, data, iMax(0, offset));
+    /* Basic metrics. */
+    stbtt_GetFontVMetrics(&d->stbInfo, &d->ascent, &d->descent, NULL);
+    stbtt_GetCodepointHMetrics(&d->stbInfo, 'M', &d->emAdvance, NULL);
+}
+
 static void load_FontFile_(iFontFile *d, const iBlock *data) {
     set_Block(&d->sourceData, data);
-#if 0
-    /* Count the number of available fonts. */
-    for (int i = 0; ; i++) {
-        if (stbtt_GetFontOffsetForIndex(constData_Block(&d->sourceData), i) < 0) {
-            printf("%s: contains %d fonts\n", cstr_String(&d->id), i);
-            break;
+    setup_FontFile_(d);
+}
+
+static iBool map_FontFile_(iFontFile *d, const iString *path) {
+    /* Memory-maps the font file, falling back to reading all of it. */
+#if defined (LAGRANGE_MMAP_FONTS)
+    const int fd = open(cstr_String(path), O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        void *mapped = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd); /* the mapping remains */
+        if (mapped != MAP_FAILED) {
+            d->mapData = mapped;
+            d->mapSize = st.st_size;
+            setup_FontFile_(d);
+            return iTrue;
         }
     }
 #endif
-    const size_t offset = stbtt_GetFontOffsetForIndex(constData_Block(&d->sourceData),
-                                                      d->colIndex);
-    stbtt_InitFont(&d->stbInfo, constData_Block(data), offset);
-    /* Basic metrics. */
-    stbtt_GetFontVMetrics(&d->stbInfo, &d->ascent, &d->descent, NULL);
-    stbtt_GetCodepointHMetrics(&d->stbInfo, 'M', &d->emAdvance, NULL);
-#if defined(LAGRANGE_ENABLE_HARFBUZZ)
-    /* HarfBuzz will read the font data. */
-    d->hbBlob = hb_blob_create(constData_Block(data), size_Block(&d->sourceData),
-                               HB_MEMORY_MODE_READONLY, NULL, NULL);
-    d->hbFace = hb_face_create(d->hbBlob, d->colIndex);
-    d->hbFont = hb_font_create(d->hbFace);
-#endif
+    iBool ok = iFalse;
+    iFile *f = new_File(path);
+    if (open_File(f, readOnly_FileMode)) {
+        iBlock *data = readAll_File(f);
+        load_FontFile_(d, data);
+        delete_Block(data);
+        ok = iTrue;
+    }
+    iRelease(f);
+    return ok;
 }
 
 static iBool detectMonospace_FontFile_(const iFontFile *d) {
@@ -114,13 +151,27 @@ static iBool detectMonospace_FontFile_(const iFontFile *d) {
 static void unload_FontFile_(iFontFile *d) {
 #if defined(LAGRANGE_ENABLE_HARFBUZZ)
     /* HarfBuzz objects. */
-    hb_font_destroy(d->hbFont);
+    hb_font_destroy(atomic_load_explicit(&d->hbFont, memory_order_relaxed));
     hb_face_destroy(d->hbFace);
     hb_blob_destroy(d->hbBlob);
-    d->hbFont = NULL;
+    atomic_store_explicit(&d->hbFont, NULL, memory_order_relaxed);
     d->hbFace = NULL;
     d->hbBlob = NULL;
 #endif
+#if defined (LAGRANGE_MMAP_FONTS)
+    if (d->mapData) {
+        munmap(d->mapData, d->mapSize);
+    }
+#endif
+    d->mapData = NULL;
+    d->mapSize = 0;
+    free(d->kernPairs);
+    free(d->asciiGlyphs);
+    d->kernPairs      = NULL;
+    d->numKernPairs   = 0;
+    d->asciiGlyphs    = NULL;
+    d->numAsciiGlyphs = 0;
+    atomic_store_explicit(&d->isKerningReady, iFalse, memory_order_relaxed);
     clear_Block(&d->sourceData);
     iZap(d->stbInfo);
 }
@@ -187,10 +238,125 @@ struct Impl_Fonts {
     iObjectList *files;
     iPtrArray specOrder; /* specs sorted by priority */
     iRegExp *indexPattern; /* collection index filename suffix */
+    iMutex *lazyMutex; /* for FontFile data created on demand */
 };
 
 static iFonts fonts_;
 
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+hb_font_t *hbFont_FontFile(const iFontFile *d) {
+    /* HarfBuzz is only set up for fonts that actually get used for shaping. The pointer is
+       published with release semantics so other threads see a fully created font. */
+    iFontFile *ff   = iConstCast(iFontFile *, d);
+    hb_font_t *font = atomic_load_explicit(&ff->hbFont, memory_order_acquire);
+    if (!font) {
+        lock_Mutex(fonts_.lazyMutex);
+        font = atomic_load_explicit(&ff->hbFont, memory_order_relaxed);
+        if (!font) {
+            ff->hbBlob = hb_blob_create(data_FontFile(d), size_FontFile(d),
+                                        HB_MEMORY_MODE_READONLY, NULL, NULL);
+            ff->hbFace = hb_face_create(ff->hbBlob, d->colIndex);
+            font       = hb_font_create(ff->hbFace);
+            atomic_store_explicit(&ff->hbFont, font, memory_order_release);
+        }
+        unlock_Mutex(fonts_.lazyMutex);
+    }
+    return font;
+}
+#endif
+
+static int cmpKernPair_(const void *a, const void *b) {
+    const uint32_t x = ((const iKernPair *) a)->glyphs;
+    const uint32_t y = ((const iKernPair *) b)->glyphs;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int cmpGlyphIndex_(const void *a, const void *b) {
+    return (int) *(const uint16_t *) a - (int) *(const uint16_t *) b;
+}
+
+static void setupKerning_FontFile_(iFontFile *d) {
+    /* The legacy `kern` table can be read in full. GPOS kerning can only be queried per
+       pair, so the pairs of printable ASCII glyphs are precomputed. */
+    iArray pairs;
+    init_Array(&pairs, sizeof(iKernPair));
+    if (d->stbInfo.gpos) {
+        d->asciiGlyphs = malloc(sizeof(uint16_t) * (127 - 32));
+        for (iChar ch = 32; ch < 127; ch++) {
+            const int glyph = findGlyphIndex_FontFile(d, ch);
+            if (glyph > 0 && glyph <= 0xffff) {
+                d->asciiGlyphs[d->numAsciiGlyphs++] = glyph;
+            }
+        }
+        qsort(d->asciiGlyphs, d->numAsciiGlyphs, sizeof(uint16_t), cmpGlyphIndex_);
+        for (size_t i = 0; i < d->numAsciiGlyphs; i++) {
+            for (size_t j = 0; j < d->numAsciiGlyphs; j++) {
+                const int kern =
+                    stbtt_GetGlyphKernAdvance(&d->stbInfo, d->asciiGlyphs[i], d->asciiGlyphs[j]);
+                if (kern) {
+                    pushBack_Array(&pairs,
+                                   &(iKernPair){ (uint32_t) d->asciiGlyphs[i] << 16 |
+                                                     d->asciiGlyphs[j],
+                                                 kern });
+                }
+            }
+        }
+    }
+    else if (d->stbInfo.kern) {
+        const int num = stbtt_GetKerningTableLength(&d->stbInfo);
+        if (num > 0) {
+            stbtt_kerningentry *entries = malloc(sizeof(stbtt_kerningentry) * num);
+            stbtt_GetKerningTable(&d->stbInfo, entries, num);
+            for (int i = 0; i < num; i++) {
+                if (entries[i].advance) {
+                    pushBack_Array(&pairs,
+                                   &(iKernPair){ (uint32_t) entries[i].glyph1 << 16 |
+                                                     entries[i].glyph2,
+                                                 entries[i].advance });
+                }
+            }
+            free(entries);
+        }
+    }
+    d->numKernPairs = size_Array(&pairs);
+    if (d->numKernPairs) {
+        d->kernPairs = malloc(sizeof(iKernPair) * d->numKernPairs);
+        memcpy(d->kernPairs, constData_Array(&pairs), sizeof(iKernPair) * d->numKernPairs);
+        qsort(d->kernPairs, d->numKernPairs, sizeof(iKernPair), cmpKernPair_);
+    }
+    deinit_Array(&pairs);
+}
+
+int kernAdvance_FontFile(const iFontFile *d, uint32_t glyph1, uint32_t glyph2) {
+    if (glyph1 > 0xffff || glyph2 > 0xffff) {
+        return 0;
+    }
+    iFontFile *ff = iConstCast(iFontFile *, d);
+    if (!atomic_load_explicit(&ff->isKerningReady, memory_order_acquire)) {
+        lock_Mutex(fonts_.lazyMutex);
+        if (!atomic_load_explicit(&ff->isKerningReady, memory_order_relaxed)) {
+            setupKerning_FontFile_(ff);
+            atomic_store_explicit(&ff->isKerningReady, iTrue, memory_order_release);
+        }
+        unlock_Mutex(fonts_.lazyMutex);
+    }
+    const iKernPair key   = { glyph1 << 16 | glyph2, 0 };
+    const iKernPair *pair = bsearch(&key, d->kernPairs, d->numKernPairs, sizeof(iKernPair),
+                                    cmpKernPair_);
+    if (pair) {
+        return pair->advance;
+    }
+    if (d->asciiGlyphs) {
+        /* Pairs outside the precomputed set are looked up from GPOS. */
+        const uint16_t g1 = glyph1, g2 = glyph2;
+        if (!bsearch(&g1, d->asciiGlyphs, d->numAsciiGlyphs, sizeof(uint16_t), cmpGlyphIndex_) ||
+            !bsearch(&g2, d->asciiGlyphs, d->numAsciiGlyphs, sizeof(uint16_t), cmpGlyphIndex_)) {
+            return stbtt_GetGlyphKernAdvance(&d->stbInfo, glyph1, glyph2);
+        }
+    }
+    return 0;
+}
+
 static void unloadFiles_Fonts_(iFonts *d) {
     /* TODO: Mark all files in font packs as not resident. */    
     clear_ObjectList(d->files);
@@ -305,21 +471,20 @@ void handleIniTable_FontPack_(void *context, const iString *table, iBool isStart
     }   
 }
 
-static iBlock *readFile_FontPack_(const iFontPack *d, const iString *path) {
-    iBlock *data = NULL;
+static iBool loadFile_FontPack_(const iFontPack *d, iFontFile *ff, const iString *path) {
     if (d->archive) {
         /* Loading from a ZIP archive. */
-        data = copy_Block(data_Archive(d->archive, path));
+        const iBlock *data = data_Archive(d->archive, path);
+        if (data) {
+            load_FontFile_(ff, data);
+            return iTrue;
+        }
     }
     else if (d->loadPath) {
         /* Loading from a regular file. */
-        iFile *srcFile = new_File(collect_String(concat_Path(d->loadPath, path)));
-        if (open_File(srcFile, readOnly_FileMode)) {
-            data = readAll_File(srcFile);
-        }
-        iRelease(srcFile);
+        return map_FontFile_(ff, collect_String(concat_Path(d->loadPath, path)));
     }
-    return data;
+    return iFalse;
 }
 
 static const char *styles_[max_FontStyle] = { "regular", "italic", "light", "semibold", "bold" };
@@ -400,21 +565,22 @@ void handleIniKeyValue_FontPack_(void *context, const iString *table, const iStr
                 iString *fontFileId = concat_Path(d->loadPath, cleanPath);
                 iAssert(!isEmpty_String(fontFileId));
                 /* FontFiles share source data blocks. The entire FontFiles can be reused, too, 
-                   if have the same collection index is in use. */
-                iBlock *data = NULL;
-                ff = findFile_Fonts_(&fonts_, fontFileId);
-                if (ff) {
-                    data = &ff->sourceData;
-                }
+                   if have the same collection index is in use. Mapped files are mapped
+                   again, which shares the same pages. */
+                iFontFile *existing = findFile_Fonts_(&fonts_, fontFileId);
+                ff = existing;
                 if (!ff || ff->colIndex != colIndex) {
-                    if (!data) {
-                        data = collect_Block(readFile_FontPack_(d, cleanPath));
+                    ff = new_FontFile();
+                    set_String(&ff->id, fontFileId);
+                    ff->colIndex = colIndex;
+                    if (existing && !existing->mapData) {
+                        load_FontFile_(ff, &existing->sourceData);
                     }
-                    if (data) {
-                        ff = new_FontFile();
-                        set_String(&ff->id, fontFileId);
-                        ff->colIndex = colIndex;
-                        load_FontFile_(ff, data);
+                    else if (!loadFile_FontPack_(d, ff, cleanPath)) {
+                        iRelease(ff);
+                        ff = NULL;
+                    }
+                    if (ff) {
                         pushBack_ObjectList(fonts_.files, ff); /* centralized ownership */
                         iRelease(ff);
                     }
@@ -581,6 +747,7 @@ static const iString *userFontsDirectory_Fonts_(const iFonts *d) {
 void init_Fonts(const char *userDir) {
     iFonts *d = &fonts_;
     d->indexPattern = new_RegExp(":([0-9]+)$", 0);    
+    d->lazyMutex = new_Mutex();
     initCStr_String(&d->userDir, userDir);
     const iString *userFontsDir = userFontsDirectory_Fonts_(d);
     makeDirs_Path(userFontsDir);
@@ -660,18 +827,16 @@ void init_Fonts(const char *userDir) {
         iForEach(DirFileInfo, entry, iClob(new_DirFileInfo(userFontsDirectory_Fonts_(d)))) {
             const iString *entryPath = path_FileInfo(entry.value);
             if (endsWithCase_String(entryPath, ".ttf")) {
-                iFile *f = new_File(entryPath);
-                iFontFile *font = NULL;
-                if (open_File(f, readOnly_FileMode)) {
-                    iBlock *data = readAll_File(f);
-                    font = new_FontFile();
-                    load_FontFile_(font, data);
+                iFontFile *font = new_FontFile();
+                if (map_FontFile_(font, entryPath)) {
                     set_String(&font->id, entryPath);
                     pushBack_ObjectList(fonts_.files, font); /* centralized ownership */
                     iRelease(font);
-                    delete_Block(data);
                 }
-                iRelease(f);
+                else {
+                    iRelease(font);
+                    font = NULL;
+                }
                 if (!font) {
                     fprintf(stderr, "[fonts] failed to load: %s\n", cstr_String(entryPath));
                     continue;
@@ -714,6 +879,7 @@ void deinit_Fonts(void) {
     deinit_PtrArray(&d->packs);
     iRelease(d->files);
     iRelease(d->indexPattern);
+    delete_Mutex(d->lazyMutex);
     deinit_String(&d->userDir);
 }
 
@@ -761,12 +927,13 @@ iString *infoText_FontPack(const iFontPack *d) {
         const iFontSpec *spec = i.ptr;
         pushBack_StringList(names, &spec->name);
         iForIndices(j, spec->styles) {
-            insert_PtrSet(uniqueFiles, spec->styles[j]->sourceData.i);
+            const iFontFile *ff = spec->styles[j];
+            if (!contains_PtrSet(uniqueFiles, data_FontFile(ff))) {
+                insert_PtrSet(uniqueFiles, data_FontFile(ff));
+                sizeInBytes += size_FontFile(ff);
+            }
         }
     }
-    iConstForEach(PtrSet, j, uniqueFiles) {
-        sizeInBytes += ((const iBlockData *) *j.value)->size;
-    }
     appendFormat_String(str, "%.1f ${mb} ", sizeInBytes / 1.0e6);
     if (size_PtrSet(uniqueFiles) > 1 || size_StringList(names) > 1) {
         appendFormat_String(str, "(");
@@ -1003,6 +1170,21 @@ void reload_Fonts(void) {
     delete_String(userDir);
 }
 
+void memoryUsage_Fonts(size_t *loaded_out, size_t *mapped_out) {
+    size_t loaded = 0, mapped = 0;
+    iConstForEach(ObjectList, i, fonts_.files) {
+        const iFontFile *ff = i.object;
+        if (ff->mapData) {
+            mapped += ff->mapSize;
+        }
+        else {
+            loaded += size_Block(&ff->sourceData);
+        }
+    }
+    if (loaded_out) *loaded_out = loaded;
+    if (mapped_out) *mapped_out = mapped;
+}
+
 void install_Fonts(const iString *packId, const iBlock *data) {
     if (!detect_FontPack(data)) {
         return;
@@ -1022,7 +1204,13 @@ void install_Fonts(const iString *packId, const iBlock *data) {
 
 void installFontFile_Fonts(const iString *fileName, const iBlock *data) {
     iFonts *d = &fonts_;
-    iFile *f = new_File(collect_String(concat_Path(userFontsDirectory_Fonts_(d), fileName)));
+    const iString *path = collect_String(concat_Path(userFontsDirectory_Fonts_(d), fileName));
+#if defined (LAGRANGE_MMAP_FONTS)
+    /* An existing file with the same name may be mapped; truncating it would invalidate
+       the mapping. The old contents remain accessible until the fonts are reloaded. */
+    unlink(cstr_String(path));
+#endif
+    iFile *f = new_File(path);
     if (open_File(f, writeOnly_FileMode)) {
         write_File(f, data);
     }
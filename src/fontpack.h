@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/archive.h>
 #include <the_Foundation/ptrarray.h>
 #include "stb_truetype.h"
+#include <stdatomic.h>
 
 #if defined (LAGRANGE_ENABLE_HARFBUZZ)
 #   include <hb.h>
@@ -72,6 +73,13 @@ float   scale_FontSize  (enum iFontSize size);
 
 /*----------------------------------------------------------------------------------------------*/
 
+iDeclareType(KernPair)
+
+struct Impl_KernPair {
+    uint32_t glyphs; /* first glyph index in the high 16 bits */
+    int32_t  advance;
+};
+
 iDeclareClass(FontFile)
 iDeclareObjectConstruction(FontFile)
     
@@ -80,18 +88,37 @@ struct Impl_FontFile {
     iString         id; /* for detecting when the same file is used in many places */
     int             colIndex;
     enum iFontStyle style;
-    iBlock          sourceData;
+    iBlock          sourceData; /* empty if the file is memory-mapped */
+    void *          mapData;
+    size_t          mapSize;
     stbtt_fontinfo  stbInfo;
 #if defined (LAGRANGE_ENABLE_HARFBUZZ)
-    hb_blob_t *hbBlob;
+    hb_blob_t *hbBlob; /* created when first used for shaping */
     hb_face_t *hbFace;
-    hb_font_t *hbFont;
+    _Atomic(hb_font_t *) hbFont; /* set last; may be read without locking */
 #endif
     /* Metrics: */
     int ascent, descent, emAdvance;
+    /* Kerning pairs are collected when kerning is first needed. */
+    atomic_bool isKerningReady; /* set after the pairs; may be read without locking */
+    iKernPair *kernPairs; /* sorted */
+    size_t     numKernPairs;
+    uint16_t * asciiGlyphs; /* sorted; GPOS pairs are only precomputed for these */
+    size_t     numAsciiGlyphs;
 };
 
 float   scaleForPixelHeight_FontFile    (const iFontFile *, int pixelHeight);
+int     kernAdvance_FontFile            (const iFontFile *, uint32_t glyph1, uint32_t glyph2);
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+hb_font_t * hbFont_FontFile             (const iFontFile *);
+#endif
+
+iLocalDef const void *data_FontFile(const iFontFile *d) {
+    return d->mapData ? d->mapData : constData_Block(&d->sourceData);
+}
+iLocalDef size_t size_FontFile(const iFontFile *d) {
+    return d->mapData ? d->mapSize : size_Block(&d->sourceData);
+}
 
 iLocalDef uint32_t findGlyphIndex_FontFile(const iFontFile *d, iChar ch) {
     return stbtt_FindGlyphIndex(&d->stbInfo, ch);
@@ -182,6 +209,7 @@ const iString *     infoPage_Fonts              (iRangecc query);
 void                install_Fonts               (const iString *fontId, const iBlock *data);
 void                installFontFile_Fonts       (const iString *fileName, const iBlock *data);
 void                reload_Fonts                (void);
+void                memoryUsage_Fonts           (size_t *loaded_out, size_t *mapped_out); /* bytes */
 
 iLocalDef iBool isInstalled_Fonts(const char *packId) {
     return pack_Fonts(packId) != NULL;
@@ -0,0 +1,92 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "framepacer.h"
+
+#include <SDL_timer.h>
+#include <math.h>
+
+static const double renderMargin_FramePacer_   = 1.0; /* ms of slack before the deadline */
+static const double minDeferredTime_FramePacer_ = 1.0; /* ms; deferred work always progresses */
+
+static double now_FramePacer_(void) {
+    return (double) SDL_GetPerformanceCounter() * 1000.0 / (double) SDL_GetPerformanceFrequency();
+}
+
+void init_FramePacer(iFramePacer *d) {
+    d->renderTime  = 0.0;
+    d->frameRender = 0.0;
+    d->frameStart  = d->animStart = d->windowStart = d->lastPresent = now_FramePacer_();
+    setDisplay_FramePacer(d, 60, iTrue);
+}
+
+void setDisplay_FramePacer(iFramePacer *d, int refreshRate, iBool isVsync) {
+    d->refreshRate = (refreshRate > 0 ? refreshRate : 60); /* zero if unknown */
+    d->isVsync     = isVsync;
+    d->interval    = 1000.0 / d->refreshRate;
+}
+
+void beginFrame_FramePacer(iFramePacer *d) {
+    const double now = now_FramePacer_();
+    /* When frames are drawn continuously, the frame began when the previous one was
+       presented. After idling, it begins now. */
+    d->frameStart = (now - d->lastPresent < d->interval ? d->lastPresent : now);
+    d->animStart  = now;
+}
+
+void beginRender_FramePacer(iFramePacer *d) {
+    d->windowStart = now_FramePacer_();
+    d->frameRender = 0.0;
+}
+
+void beginPresent_FramePacer(iFramePacer *d) {
+    /* Waiting for vsync is not included in the render time. Each window is measured on
+       its own, so the ones drawn earlier in the frame are not counted again. */
+    d->frameRender = iMax(d->frameRender, now_FramePacer_() - d->windowStart);
+}
+
+void endPresent_FramePacer(iFramePacer *d) {
+    d->lastPresent = d->windowStart = now_FramePacer_();
+}
+
+void endRender_FramePacer(iFramePacer *d) {
+    if (d->frameRender > 0.0) {
+        d->renderTime = (d->renderTime > 0.0 ? 0.9 * d->renderTime + 0.1 * d->frameRender
+                                             : d->frameRender);
+    }
+}
+
+iBool isOverBudget_FramePacer(const iFramePacer *d) {
+    const double now = now_FramePacer_();
+    if (now - d->animStart < minDeferredTime_FramePacer_) {
+        return iFalse;
+    }
+    return now > d->frameStart + d->interval - d->renderTime - renderMargin_FramePacer_;
+}
+
+uint32_t untilNextFrame_FramePacer(const iFramePacer *d) {
+    if (d->isVsync) {
+        return 0; /* presenting will block until the display is ready */
+    }
+    const double remaining = d->lastPresent + d->interval - now_FramePacer_();
+    return remaining > renderMargin_FramePacer_ ? (uint32_t) ceil(remaining) : 0;
+}
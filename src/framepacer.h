@@ -0,0 +1,55 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/defs.h>
+
+iDeclareType(FramePacer)
+
+/* Paces the main loop to the display refresh. Each frame has an input phase, an animation
+   phase (tickers), and a render phase that ends when the frame is presented. Work that
+   does not need to finish in the current frame, like prerendering and progressive layout,
+   is given the time that remains before rendering must begin to make the deadline. */
+struct Impl_FramePacer {
+    int    refreshRate;  /* Hz */
+    iBool  isVsync;      /* presenting waits for the display */
+    double interval;     /* ms between display refreshes */
+    double frameStart;
+    double animStart;
+    double windowStart;  /* rendering of the current window began */
+    double frameRender;  /* longest window of the current frame, in ms */
+    double renderTime;   /* recent average of `frameRender` */
+    double lastPresent;
+};
+
+void    init_FramePacer         (iFramePacer *);
+void    setDisplay_FramePacer   (iFramePacer *, int refreshRate, iBool isVsync);
+
+void    beginFrame_FramePacer   (iFramePacer *); /* input has been processed */
+void    beginRender_FramePacer  (iFramePacer *);
+void    beginPresent_FramePacer (iFramePacer *); /* each window */
+void    endPresent_FramePacer   (iFramePacer *);
+void    endRender_FramePacer    (iFramePacer *); /* all windows have been drawn */
+
+iBool       isOverBudget_FramePacer     (const iFramePacer *); /* defer non-critical work */
+uint32_t    untilNextFrame_FramePacer   (const iFramePacer *); /* ms; zero if may draw now */
@@ -21,6 +21,7 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "gempub.h"
+#include "archivecache.h"
 #include "gmutil.h"
 #include "lang.h"
 #include "defs.h"
@@ -30,7 +31,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "app.h"
 
 #include <the_Foundation/archive.h>
-#include <the_Foundation/file.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/regexp.h>
 
@@ -61,6 +61,7 @@ iDefineTypeConstruction(GempubNavLink)
     
 struct Impl_Gempub {
     iArchive *arch;
+    iString archivePath; /* empty if the archive was opened from memory */
     iString baseUrl;
     iString props[max_GempubProperty];
     iArray *navLinks; /* from index page */
@@ -106,6 +107,7 @@ static void parseNavigationLinks_Gempub_(const iGempub *d) {
     
 void init_Gempub(iGempub *d) {
     d->arch = NULL;
+    init_String(&d->archivePath);
     init_String(&d->baseUrl);
     iForIndices(i, d->props) {
         init_String(&d->props[i]);
@@ -122,13 +124,23 @@ void deinit_Gempub(iGempub *d) {
         deinit_String(&d->props[i]);
     }
     deinit_String(&d->baseUrl);
+    deinit_String(&d->archivePath);
     iRelease(d->arch);
 }
     
+static const iBlock *entryData_Gempub_(const iGempub *d, const iString *entryPath) {
+    if (!isEmpty_String(&d->archivePath)) {
+        /* The archive is shared with other users of the cache. */
+        iBlock *data = readEntry_ArchiveCache(&d->archivePath, entryPath);
+        return data ? collect_Block(data) : NULL;
+    }
+    return data_Archive(d->arch, entryPath);
+}
+
 static iBool parseMetadata_Gempub_(iGempub *d) {
     iAssert(isOpen_Archive(d->arch));
     /* Parse the metadata and check if the required contents are present. */
-    const iBlock *metadata = dataCStr_Archive(d->arch, "metadata.txt");
+    const iBlock *metadata = entryData_Gempub_(d, collectNewCStr_String("metadata.txt"));
     if (!metadata) {
         return iFalse;
     }
@@ -179,15 +191,19 @@ iBool open_Gempub(iGempub *d, const iBlock *data) {
 
 iBool openFile_Gempub(iGempub *d, const iString *path) {
     close_Gempub(d);
-    iFile *f = new_File(path);
-    if (open_File(f, readOnly_FileMode)) {
-        iBlock *data = readAll_File(f);
-        open_Gempub(d, data);
-        delete_Block(data);
-        setBaseUrl_Gempub(d, collect_String(makeFileUrl_String(path)));
+    /* Only the directory is read here. Entries are decompressed when needed, and the archive
+       stays open in the cache while the book is being read. */
+    d->arch = open_ArchiveCache(path);
+    if (!d->arch) {
+        return iFalse;
     }
-    iRelease(f);
-    return isOpen_Gempub(d);
+    set_String(&d->archivePath, path);
+    if (!parseMetadata_Gempub_(d)) {
+        close_Gempub(d);
+        return iFalse;
+    }
+    setBaseUrl_Gempub(d, collect_String(makeFileUrl_String(path)));
+    return iTrue;
 }
 
 iBool openUrl_Gempub(iGempub *d, const iString *url) {
@@ -203,6 +219,7 @@ void close_Gempub(iGempub *d) {
     if (d->arch) {
         iReleasePtr(&d->arch);
     }
+    clear_String(&d->archivePath);
     iForIndices(i, d->props) {
         clear_String(&d->props[i]);
     }
@@ -346,7 +363,7 @@ iBool preloadCoverImage_Gempub(const iGempub *d, iGmDocument *doc) {
             setData_Media(media_GmDocument(doc),
                           linkId,
                           collectNewCStr_String(mediaType_Path(linkUrl)),
-                          data_Archive(d->arch, imgEntryPath),
+                          entryData_Gempub_(d, imgEntryPath),
                           0);
             haveImage = iTrue;
         }
@@ -24,7 +24,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmutil.h"
 #include "defs.h"
 #include "app.h"
+#include "savequeue.h"
 
+#include <the_Foundation/atomic.h>
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
 #include <the_Foundation/mutex.h>
@@ -35,6 +38,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/stringlist.h>
 #include <the_Foundation/time.h>
 #include <ctype.h>
+#include <stdio.h>
 
 static const char *filename_GmCerts_          = "trusted.2.txt";
 static const char *identsDir_GmCerts_         = "idents";
@@ -172,6 +176,12 @@ iBool isUsedOnDomain_GmIdentity(const iGmIdentity *d, const iRangecc domain) {
     return iFalse;
 }
 
+static iAtomicInt usesGeneration_GmCerts_; /* incremented when any identity's use-URLs change */
+
+static void usesChanged_GmCerts_(void) {
+    add_Atomic(&usesGeneration_GmCerts_, 1);
+}
+
 void setUse_GmIdentity(iGmIdentity *d, const iString *url, iBool use) {
     if (use && isUsedOn_GmIdentity(d, url)) {
         return; /* Redudant. */
@@ -195,10 +205,12 @@ void setUse_GmIdentity(iGmIdentity *d, const iString *url, iBool use) {
     else {
         remove_StringSet(d->useUrls, url);
     }
+    usesChanged_GmCerts_();
 }
 
 void clearUse_GmIdentity(iGmIdentity *d) {
     clear_StringSet(d->useUrls);
+    usesChanged_GmCerts_();
 }
 
 const iString *name_GmIdentity(const iGmIdentity *d) {
@@ -218,48 +230,151 @@ struct Impl_GmCerts {
     iString saveDir;
     iStringHash *trusted;
     iPtrArray idents;
+    iArray  useTrie;       /* UseTrieNodes: case folded use-URL prefixes of all identities */
+    int     useTrieGeneration;
+    size_t  numAppended;   /* lines in the trust file that may have been superseded */
+};
+
+/* Use-URLs of all identities are kept in a trie so the identity for a URL is found in one
+   walk over the URL. Nodes refer to each other by index; zero means none, since the root
+   cannot be anyone's child or sibling. */
+
+iDeclareType(UseTrieNode)
+
+struct Impl_UseTrieNode {
+    uint32_t child;   /* first */
+    uint32_t sibling; /* next */
+    const iGmIdentity *ident; /* a use-URL ends at this node */
+    char ch;
 };
 
+static iUseTrieNode *node_GmCerts_(iGmCerts *d, uint32_t index) {
+    return at_Array(&d->useTrie, index);
+}
+
+static char foldCase_(char ch) {
+    return (char) tolower((unsigned char) ch);
+}
+
+static void insertUse_GmCerts_(iGmCerts *d, const iString *url, const iGmIdentity *ident) {
+    uint32_t node = 0;
+    for (const char *ch = constBegin_String(url); ch != constEnd_String(url); ch++) {
+        const char folded = foldCase_(*ch);
+        uint32_t   child  = node_GmCerts_(d, node)->child;
+        while (child && node_GmCerts_(d, child)->ch != folded) {
+            child = node_GmCerts_(d, child)->sibling;
+        }
+        if (!child) {
+            child = size_Array(&d->useTrie);
+            pushBack_Array(&d->useTrie,
+                           &(iUseTrieNode){ 0, node_GmCerts_(d, node)->child, NULL, folded });
+            node_GmCerts_(d, node)->child = child;
+        }
+        node = child;
+    }
+    iUseTrieNode *end = node_GmCerts_(d, node);
+    if (!end->ident) {
+        end->ident = ident; /* earlier identities take precedence */
+    }
+}
+
+static void updateUseTrie_GmCerts_(iGmCerts *d) {
+    /* `mtx` must be held. */
+    const int gen = value_Atomic(&usesGeneration_GmCerts_);
+    if (gen == d->useTrieGeneration && !isEmpty_Array(&d->useTrie)) {
+        return;
+    }
+    clear_Array(&d->useTrie);
+    pushBack_Array(&d->useTrie, &(iUseTrieNode){ 0, 0, NULL, 0 }); /* root */
+    iConstForEach(PtrArray, i, &d->idents) {
+        const iGmIdentity *ident = i.ptr;
+        iConstForEach(StringSet, j, ident->useUrls) {
+            insertUse_GmCerts_(d, j.value, ident);
+        }
+    }
+    d->useTrieGeneration = gen;
+}
+
+static const iGmIdentity *findUse_GmCerts_(iGmCerts *d, iRangecc prefix, iRangecc rest) {
+    /* Returns the identity with the longest use-URL that `prefix` + `rest` starts with. */
+    const iGmIdentity *found = NULL;
+    uint32_t node = 0;
+    const iRangecc parts[2] = { prefix, rest };
+    iForIndices(p, parts) {
+        for (const char *ch = parts[p].start; ch != parts[p].end; ch++) {
+            const char folded = foldCase_(*ch);
+            uint32_t   child  = node_GmCerts_(d, node)->child;
+            while (child && node_GmCerts_(d, child)->ch != folded) {
+                child = node_GmCerts_(d, child)->sibling;
+            }
+            if (!child) {
+                return found;
+            }
+            node = child;
+            if (node_GmCerts_(d, node)->ident) {
+                found = node_GmCerts_(d, node)->ident;
+            }
+        }
+    }
+    return found;
+}
+
 static const char *magicIdMeta_GmCerts_   = "lgL2";
 static const char *magicIdentity_GmCerts_ = "iden";
 
 iDefineTypeConstructionArgs(GmCerts, (const char *saveDir), saveDir)
 
 void saveIdentities_GmCerts(const iGmCerts *d) {
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, identsFilename_GmCerts_)));
-    if (open_File(f, writeOnly_FileMode)) {
-        writeData_File(f, magicIdMeta_GmCerts_, 4);
-        writeU32_File(f, idents_FileVersion); /* version */
-        iConstForEach(PtrArray, i, &d->idents) {
-            const iGmIdentity *ident = i.ptr;
-            if (~ident->flags & temporary_GmIdentityFlag) {
-                writeData_File(f, magicIdentity_GmCerts_, 4);
-                serialize_GmIdentity(ident, stream_File(f));
-            }
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    iStream *outs = stream_Buffer(buf);
+    writeData_Stream(outs, magicIdMeta_GmCerts_, 4);
+    writeU32_Stream(outs, idents_FileVersion); /* version */
+    lock_Mutex(d->mtx);
+    iConstForEach(PtrArray, i, &d->idents) {
+        const iGmIdentity *ident = i.ptr;
+        if (~ident->flags & temporary_GmIdentityFlag) {
+            writeData_Stream(outs, magicIdentity_GmCerts_, 4);
+            serialize_GmIdentity(ident, outs);
         }
     }
-    iRelease(f);
+    unlock_Mutex(d->mtx);
+    write_SaveQueue(cstrCollect_String(concatCStr_Path(&d->saveDir, identsFilename_GmCerts_)),
+                    data_Buffer(buf));
+    iRelease(buf);
+}
+
+/* The trust file is append-only: updated entries are written as new lines and the latest
+   line for each key is the one that applies when loading. The file is rewritten when there
+   are too many superseded lines. Verifying a certificate never has to wait for the disk. */
+
+static void formatTrust_GmCerts_(const iString *key, const iTrustEntry *trust, iString *out) {
+    appendFormat_String(out,
+                        "%s %ld %s\n",
+                        cstr_String(key),
+                        integralSeconds_Time(&trust->validUntil),
+                        cstrCollect_String(hexEncode_Block(&trust->fingerprint)));
 }
 
-static void save_GmCerts_(const iGmCerts *d) {
+static void saveTrust_GmCerts_(iGmCerts *d, const iString *key, const iTrustEntry *trust) {
+    /* `mtx` must be held. */
+    iString *str = new_String();
     iBeginCollect();
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, filename_GmCerts_)));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        iString line;
-        init_String(&line);
+    const char *path = cstrCollect_String(concatCStr_Path(&d->saveDir, filename_GmCerts_));
+    if (++d->numAppended > iMax(64u, size_StringHash(d->trusted))) {
+        /* Rewrite with a snapshot of all the trusted certificates. */
         iConstForEach(StringHash, i, d->trusted) {
-            const iTrustEntry *trust = value_StringHashNode(i.value);
-            format_String(&line,
-                          "%s %ld %s\n",
-                          cstr_String(key_StringHashConstIterator(&i)),
-                          integralSeconds_Time(&trust->validUntil),
-                          cstrCollect_String(hexEncode_Block(&trust->fingerprint)));
-            write_File(f, &line.chars);
+            formatTrust_GmCerts_(key_StringHashConstIterator(&i), value_StringHashNode(i.value), str);
         }
-        deinit_String(&line);
+        write_SaveQueue(path, utf8_String(str));
+        d->numAppended = 0;
+    }
+    else {
+        formatTrust_GmCerts_(key, trust, str);
+        append_SaveQueue(path, utf8_String(str));
     }
-    iRelease(f);
     iEndCollect();
+    delete_String(str);
 }
 
 static void loadIdentities_GmCerts_(iGmCerts *d) {
@@ -337,10 +452,12 @@ static void load_GmCerts_(iGmCerts *d) {
         iRegExp *      pattern = new_RegExp("([^\\s]+) ([0-9]+) ([a-z0-9]+)", 0);
         const iRangecc src     = range_Block(collect_Block(readAll_File(f)));
         iRangecc       line    = iNullRange;
+        size_t         numLines = 0;
         while (nextSplit_Rangecc(src, "\n", &line)) {
             iRegExpMatch m;
             init_RegExpMatch(&m);
             if (matchRange_RegExp(pattern, line, &m)) {
+                numLines++;
                 const iRangecc key    = capturedRange_RegExpMatch(&m, 1);
                 const iRangecc until  = capturedRange_RegExpMatch(&m, 2);
                 const iRangecc fp     = capturedRange_RegExpMatch(&m, 3);
@@ -354,6 +471,7 @@ static void load_GmCerts_(iGmCerts *d) {
                                                  &untilDate));
             }
         }
+        d->numAppended = numLines - size_StringHash(d->trusted); /* superseded lines */
         iRelease(pattern);
     }
     iRelease(f);
@@ -403,6 +521,9 @@ void init_GmCerts(iGmCerts *d, const char *saveDir) {
     initCStr_String(&d->saveDir, saveDir);
     d->trusted = new_StringHash();
     init_PtrArray(&d->idents);
+    init_Array(&d->useTrie, sizeof(iUseTrieNode));
+    d->useTrieGeneration = 0;
+    d->numAppended = 0;
     load_GmCerts_(d);
     setVerifyFunc_TlsRequest(verify_GmCerts_);
 }
@@ -416,6 +537,7 @@ void deinit_GmCerts(iGmCerts *d) {
         }
         deinit_PtrArray(&d->idents);
         iRelease(d->trusted);
+        deinit_Array(&d->useTrie);
         deinit_String(&d->saveDir);
     });
     delete_Mutex(d->mtx);
@@ -496,11 +618,11 @@ iBool checkTrust_GmCerts(iGmCerts *d, iRangecc domain, uint16_t port, const iTls
     }
     else {
         if (ok) {
-            insert_StringHash(d->trusted, &key, iClob(new_TrustEntry(fingerprint, &until)));
+            insert_StringHash(d->trusted, &key, iClob(trust = new_TrustEntry(fingerprint, &until)));
         }
     }
     if (ok) {
-        save_GmCerts_(d);
+        saveTrust_GmCerts_(d, &key, trust);
     }
     unlock_Mutex(d->mtx);
     delete_Block(fingerprint);
@@ -522,7 +644,7 @@ void setTrusted_GmCerts(iGmCerts *d, iRangecc domain, uint16_t port, const iBloc
     else {
         insert_StringHash(d->trusted, &key, iClob(trust = new_TrustEntry(fingerprint, validUntil)));
     }
-    save_GmCerts_(d);
+    saveTrust_GmCerts_(d, &key, trust);
     unlock_Mutex(d->mtx);
     deinit_String(&key);
 }
@@ -555,27 +677,17 @@ const iGmIdentity *identityForUrl_GmCerts(const iGmCerts *d, const iString *url)
     if (isEmpty_String(url)) {
         return NULL;
     }
+    iGmCerts *certs = iConstCast(iGmCerts *, d); /* the trie is updated as needed */
     lock_Mutex(d->mtx);
-    const iGmIdentity *found = NULL;
-    iConstForEach(PtrArray, i, &d->idents) {
-        const iGmIdentity *ident = i.ptr;
-        iConstForEach(StringSet, j, ident->useUrls) {
-            const iString *used = j.value;
-            if (startsWithCase_String(url, cstr_String(used))) {
-                found = ident;
-                goto done;
-            }
-        }
-    }
-done:
-    unlock_Mutex(d->mtx);
+    updateUseTrie_GmCerts_(certs);
+    const iGmIdentity *found = findUse_GmCerts_(certs, iNullRange, range_String(url));
     /* Fallback: Titan URLs use the Gemini identities, if not otherwise specified. */
     if (!found && startsWithCase_String(url, "titan://")) {
-        iString *mod = copy_String(url);
-        remove_Block(&mod->chars, 0, 5);
-        prependCStr_String(mod, "gemini");
-        found = identityForUrl_GmCerts(d, collect_String(mod));
+        found = findUse_GmCerts_(certs,
+                                 range_CStr("gemini"),
+                                 (iRangecc){ constBegin_String(url) + 5, constEnd_String(url) });
     }
+    unlock_Mutex(d->mtx);
     return found;
 }
 
@@ -648,6 +760,7 @@ void deleteIdentity_GmCerts(iGmCerts *d, iGmIdentity *identity) {
     }
     removeOne_PtrArray(&d->idents, identity);
     collect_GmIdentity(identity);
+    usesChanged_GmCerts_(); /* before other threads can see the new list of identities */
     unlock_Mutex(d->mtx);
 }
 
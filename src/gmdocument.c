@@ -23,7 +23,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmdocument.h"
 #include "gmtypesetter.h"
 #include "gmutil.h"
+#include "jobs.h"
 #include "lang.h"
+#include "markdown.h"
+#include "profiler.h"
+#include "sourcescan.h"
 #include "ui/color.h"
 #include "ui/text.h"
 #include "ui/metrics.h"
@@ -34,8 +38,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "app.h"
 #include "defs.h"
 
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/intset.h>
 #include <the_Foundation/ptrarray.h>
+#include <the_Foundation/sortedarray.h>
 #include <the_Foundation/regexp.h>
 #include <the_Foundation/stringset.h>
 
@@ -51,27 +57,90 @@ iBool isDark_GmDocumentTheme(enum iGmDocumentTheme d) {
 iDeclareType(GmLink)
 
 struct Impl_GmLink {
-    iString url; /* resolved */
+    iString url; /* resolved: absolute and canonical */
+    uint64_t urlHash; /* of `url`, for Visited lookups */
     iRangecc urlRange; /* URL in the source */
     iRangecc labelRange; /* label in the source */
     iRangecc labelIcon; /* special icon defined in the label text */
     iTime when;
     int flags;
+    uint8_t colors[max_GmLinkPart]; /* enum iColorId; depends on `flags` */
 };
 
 void init_GmLink(iGmLink *d) {
     init_String(&d->url);
+    d->urlHash = 0;
     d->urlRange = iNullRange;
     d->labelRange = iNullRange;
     iZap(d->when);
     d->flags = 0;
+    iZap(d->colors);
 }
 
 void deinit_GmLink(iGmLink *d) {
     deinit_String(&d->url);
 }
 
-iDefineTypeConstruction(GmLink)
+iLocalDef iBool isWWW_GmLinkScheme(enum iGmLinkScheme d) {
+    return d == http_GmLinkScheme || d == mailto_GmLinkScheme;
+}
+
+iLocalDef iBool isOldSchool_GmLinkScheme(enum iGmLinkScheme d) {
+    return d == gopher_GmLinkScheme || d == finger_GmLinkScheme;
+}
+
+static enum iColorId resolveColor_GmLink_(const iGmLink *link, enum iGmLinkPart part) {
+    const enum iGmLinkScheme scheme = scheme_GmLinkFlag(link->flags);
+    const iBool isUnsupported = (link->flags & supportedScheme_GmLinkFlag) == 0;
+    if (part == icon_GmLinkPart) {
+        if (isUnsupported) {
+            return tmBadLink_ColorId;
+        }
+        if (scheme != mailto_GmLinkScheme && link->flags & iconFromLabel_GmLinkFlag) {
+            return link->flags & visited_GmLinkFlag ? tmLinkCustomIconVisited_ColorId
+                                                    : tmLinkIcon_ColorId;
+        }
+        if (link->flags & visited_GmLinkFlag) {
+            return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkIconVisited_ColorId
+                   : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkIconVisited_ColorId
+                                                      : tmLinkIconVisited_ColorId;
+        }
+        return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkIcon_ColorId
+               : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkIcon_ColorId
+                                                  : tmLinkIcon_ColorId;
+    }
+    if (part == text_GmLinkPart) {
+        return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkText_ColorId
+               : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkText_ColorId
+                                                  : tmLinkText_ColorId;
+    }
+    if (part == textHover_GmLinkPart) {
+        return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkTextHover_ColorId
+               : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkTextHover_ColorId
+                                                  : tmLinkTextHover_ColorId;
+    }
+    if (part == domain_GmLinkPart) {
+        if (isUnsupported) {
+            return tmBadLink_ColorId;
+        }
+        return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkDomain_ColorId
+               : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkDomain_ColorId
+                                                  : tmLinkDomain_ColorId;
+    }
+    if (part == visited_GmLinkPart) {
+        return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkLastVisitDate_ColorId
+               : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkLastVisitDate_ColorId
+                                                  : tmLinkLastVisitDate_ColorId;
+    }
+    return tmLinkText_ColorId;
+}
+
+static void updateColors_GmLink_(iGmLink *d) {
+    /* Drawing only looks up the colors, so they are resolved whenever the flags change. */
+    for (int part = 0; part < max_GmLinkPart; part++) {
+        d->colors[part] = (uint8_t) resolveColor_GmLink_(d, part);
+    }
+}
 
 /*----------------------------------------------------------------------------------------------*/
 
@@ -151,6 +220,136 @@ static uint32_t themeHash_(const iBlock *data) {
 
 /*----------------------------------------------------------------------------------------------*/
 
+iDeclareType(GmNormState)
+iDeclareType(GmLayoutState)
+iDeclareType(GmLineLayout)
+
+/* Position of the last complete (newline-terminated) line of the source. Normalization of
+   appended content is resumed after this line. */
+struct Impl_GmNormState {
+    iBool  isValid;
+    iBool  isNormalized;
+    iBool  isPreformat;
+    size_t unormPos; /* end of the line in the unnormalized source */
+    size_t pos;      /* end of the normalized source up to and including the line */
+};
+
+/* State of the layout loop at the beginning of a source line. When more content is appended
+   to the source, layout is resumed from here instead of redoing all the lines. */
+struct Impl_GmLayoutState {
+    iBool            isValid;
+    iRangecc         prevLine; /* line preceding the resume point (NULL at beginning) */
+    size_t           numRuns;
+    size_t           numLinks;
+    size_t           numPreMeta;
+    iBool            hasTitle;
+    iInt2            pos;
+    iBool            isFirstText;
+    iBool            addQuoteIcon;
+    iBool            isPreformat;
+    int              preFont;
+    uint16_t         preId;
+    iBool            enableIndents;
+    enum iGmLineType prevType;
+    enum iGmLineType prevNonBlankType;
+    iBool            followsBlank;
+};
+
+/* Parameters of a line type that stay the same during a layout. They are resolved from the
+   prefs, theme, format, and width before the layout loop, which then looks them up by type. */
+struct Impl_GmLineLayout {
+    int font;
+    int color;
+    int rightMargin; /* pixels reserved for balancing lines horizontally */
+    int runFlags;
+    int topMargin[max_GmLineType]; /* pixels of space after each preceding line type */
+};
+
+iDeclareType(GmWrapLine)
+iDeclareType(GmWrapBlock)
+iDeclareType(GmWrapCache)
+
+struct Impl_GmWrapLine {
+    struct {
+        uint32_t start;
+        uint32_t end;
+    } range; /* relative to the start of the block */
+    iTextAttrib attrib;
+    int         origin;
+    int         advance;
+};
+
+/* Wrapped lines of one paragraph of the source. */
+struct Impl_GmWrapBlock {
+    uint32_t offset; /* position in the source */
+    uint32_t length;
+    int      font;
+    int      maxWidth;
+    int8_t   baseDir;
+    iBool    missingGlyphs;
+    uint32_t firstLine; /* index in the `lines` of the cache */
+    uint32_t numLines;
+};
+
+struct Impl_GmWrapCache {
+    iArray   blocks; /* sorted by offset */
+    iArray   lines;
+    size_t   numUnusedLines; /* lines of blocks that have been replaced */
+    uint32_t fontGeneration;
+    int      ansiFlags;
+};
+
+iDeclareType(GmPreSize)
+iDeclareType(GmPreSizeCache)
+
+/* Natural size of the contents of a preformatted block. */
+struct Impl_GmPreSize {
+    uint64_t hash; /* FNV-1a of the contents */
+    int      font;
+    iInt2    size;
+};
+
+/* Preformatted block sizes by contents, kept over source changes and relayouts. Blocks are
+   measured in full to decide whether they need horizontal scrolling, so this avoids running
+   the shaper through all the preformatted text of the document every time. */
+struct Impl_GmPreSizeCache {
+    iSortedArray sizes;
+    iArray       monoAdvances; /* int pairs: font, advance (zero if not monospaced) */
+    uint32_t     fontGeneration;
+    int          ansiFlags;
+};
+
+iDeclareType(GmRunSpan)
+iDeclareType(GmHitSpan)
+
+/* Search index of the runs' `visBounds`, stored separately from the runs so that finding the
+   first visible run doesn't need to touch the run data. Runs are mostly but not strictly in
+   vertical order, so the running maximum of the bottom edges is kept for binary searching.
+   The indices are in addition to the runs, so they are kept small. */
+struct Impl_GmRunSpan {
+    int32_t maxBottom; /* of this and all preceding runs */
+};
+
+/* Index of the non-decoration runs for hit testing, using `bounds`. */
+struct Impl_GmHitSpan {
+    int32_t  maxTop; /* of this and all preceding entries */
+    int32_t  maxBottom;
+    uint32_t run; /* index in `layout` */
+};
+
+iDeclareType(GmFindIndex)
+
+/* Offsets of all case-insensitive matches of the find query. The source is only scanned once
+   per query; typing more characters filters the existing matches, and new source content is
+   scanned when it arrives, so queries only read the index. */
+struct Impl_GmFindIndex {
+    iString query;
+    iArray  offsets; /* uint32_t, sorted; matches may overlap */
+    size_t  scannedSize; /* all matches within this many bytes of the source are known */
+};
+
+iDeclareType(GmLayoutJob)
+
 struct Impl_GmDocument {
     iObject object;
     enum iSourceFormat format;
@@ -163,9 +362,15 @@ struct Impl_GmDocument {
     iBool     enableCommandLinks; /* `about:command?` only allowed on selected pages */
     iBool     isLayoutInvalidated;
     iArray    layout; /* contents of source, laid out in document space */
-    iPtrArray links;
+    iArray    runSpans; /* GmRunSpan for each run in `layout` */
+    iArray    hitSpans; /* GmHitSpan for each non-decoration run in `layout` */
+    iArray    links; /* GmLink, parsed once per source and reused by each layout */
+    size_t    numReusableLinks; /* links parsed from the current source */
+    size_t    linkCursor; /* next link to be found by the layout in progress */
     iString   title; /* the first top-level title */
-    iArray    headings;
+    iArray    headings; /* found by scanning the source, independent of the layout */
+    size_t    headingsScanned; /* bytes of the source scanned for headings */
+    iBool     isHeadingScanPreformat; /* scanning stopped inside a preformatted block */
     iArray    preMeta; /* metadata about preformatted blocks */
     iGmTheme  theme;
     uint32_t  themeSeed;
@@ -175,18 +380,37 @@ struct Impl_GmDocument {
     int       warnings;
     iBool     isPaletteValid;
     iColor    palette[tmMax_ColorId]; /* copy of the color palette */
+    iGmNormState   normState;
+    iGmLayoutState layoutState;
+    int            layoutLimitY; /* huge documents are laid out lazily beyond this (temporary) */
+    int            viewLimitY; /* limit for new layouts, as of the latest extendLayout */
+    iBool          isLayoutIncomplete; /* rest of the height is estimated */
+    iGmLayoutJob * layoutJob; /* layout in progress in a background thread */
+    iBool          isBackgroundLayout; /* this is the document laid out by a `layoutJob` */
+    const iJob *   backgroundJob; /* checked for cancellation while laying out */
+    const iPrefs * prefs; /* copy owned by the `layoutJob`; NULL to use the app's */
+    iGmWrapCache   wrapCache; /* reused when laying out again, e.g., at a different width */
+    iGmPreSizeCache preSizes;
+    iBlock *       layoutSnapshot; /* restored into `wrapCache` by the next `setSource` */
+    iBool          isHibernating; /* runs released; restored from `layoutSnapshot` */
+    iGmFindIndex   findIndex;
 };
 
 iDefineObjectConstruction(GmDocument)
 
+static const iPrefs *prefs_GmDocument_(const iGmDocument *d) {
+    /* Background layouts must not read the preferences while the main thread changes them. */
+    return d->prefs ? d->prefs : prefs_App();
+}
+
 static iBool isForcedMonospace_GmDocument_(const iGmDocument *d) {
     const iRangecc scheme = urlScheme_String(&d->url);
     if (equalCase_Rangecc(scheme, "gemini")) {
-        return prefs_App()->monospaceGemini;
+        return prefs_GmDocument_(d)->monospaceGemini;
     }
     if (equalCase_Rangecc(scheme, "gopher") ||
         equalCase_Rangecc(scheme, "finger")) {
-        return prefs_App()->monospaceGopher;
+        return prefs_GmDocument_(d)->monospaceGopher;
     }
     return iFalse;
 }
@@ -204,10 +428,12 @@ static void initTheme_GmDocument_(iGmDocument *d) {
     };
     iGmTheme *theme = &d->theme;
     memcpy(theme->colors, defaultColors, sizeof(theme->colors));
-    const iPrefs *prefs    = prefs_App();
+    const iPrefs *prefs    = prefs_GmDocument_(d);
     const iBool   isMono   = isForcedMonospace_GmDocument_(d);
-    const iBool   isDarkBg = isDark_GmDocumentTheme(
-        isDark_ColorTheme(colorTheme_App()) ? prefs->docThemeDark : prefs->docThemeLight);
+    const iBool   isDarkUI = isDark_ColorTheme(prefs->theme);
+    const enum iGmDocumentTheme docTheme = isDarkUI ? prefs->docThemeDark : prefs->docThemeLight;
+    const iBool   isDarkBg =
+        (docTheme == gray_GmDocumentTheme ? isDarkUI : isDark_GmDocumentTheme(docTheme));
     const enum iFontId headingFont = isMono ? documentMonospace_FontId : documentHeading_FontId;
     const enum iFontId bodyFont    = isMono ? documentMonospace_FontId : documentBody_FontId;
     theme->fonts[text_GmLineType] = FONT_ID(bodyFont, regular_FontStyle, contentRegular_FontSize);
@@ -273,12 +499,124 @@ static int lastVisibleRunBottom_GmDocument_(const iGmDocument *d) {
         if (isEmpty_Range(&run->text)) {
             continue;
         }
-        return top_Rect(run->bounds) + height_Rect(run->bounds) * prefs_App()->lineSpacing;
+        return top_Rect(run->bounds) + height_Rect(run->bounds) * prefs_GmDocument_(d)->lineSpacing;
     }
     return 0;
 }
 
-static iInt2 measurePreformattedBlock_GmDocument_(const iGmDocument *d, const char *start, int font,
+static const size_t maxPreSizes_GmDocument_ = 4096;
+
+static int cmp_GmPreSize_(const void *a, const void *b) {
+    const iGmPreSize *x = a, *y = b;
+    if (x->hash != y->hash) {
+        return x->hash < y->hash ? -1 : 1;
+    }
+    return iCmp(x->font, y->font);
+}
+
+static void init_GmPreSizeCache_(iGmPreSizeCache *d) {
+    init_SortedArray(&d->sizes, sizeof(iGmPreSize), cmp_GmPreSize_);
+    init_Array(&d->monoAdvances, sizeof(int) * 2);
+    d->fontGeneration = 0;
+    d->ansiFlags      = 0;
+}
+
+static void deinit_GmPreSizeCache_(iGmPreSizeCache *d) {
+    deinit_Array(&d->monoAdvances);
+    deinit_SortedArray(&d->sizes);
+}
+
+static void validate_GmPreSizeCache_(iGmPreSizeCache *d, uint32_t fontGeneration, int ansiFlags) {
+    if (d->fontGeneration != fontGeneration || d->ansiFlags != ansiFlags) {
+        clear_SortedArray(&d->sizes);
+        clear_Array(&d->monoAdvances);
+        d->fontGeneration = fontGeneration;
+        d->ansiFlags      = ansiFlags;
+    }
+}
+
+static void copy_GmPreSizeCache_(iGmPreSizeCache *d, const iGmPreSizeCache *other) {
+    clear_SortedArray(&d->sizes);
+    pushBackN_Array(&d->sizes.values, constData_Array(&other->sizes.values),
+                    size_Array(&other->sizes.values));
+    clear_Array(&d->monoAdvances);
+    pushBackN_Array(&d->monoAdvances, constData_Array(&other->monoAdvances),
+                    size_Array(&other->monoAdvances));
+    d->fontGeneration = other->fontGeneration;
+    d->ansiFlags      = other->ansiFlags;
+}
+
+static int monoAdvance_GmPreSizeCache_(iGmPreSizeCache *d, int font) {
+    iConstForEach(Array, i, &d->monoAdvances) {
+        const int *entry = i.value;
+        if (entry[0] == font) {
+            return entry[1];
+        }
+    }
+    /* Narrow and wide glyphs have the same advance in a monospaced font. */
+    const int adv = measure_Text(font, "0").advance.x;
+    const int entry[2] = {
+        font,
+        adv > 0 && measure_Text(font, "i").advance.x == adv &&
+                measure_Text(font, "W").advance.x == adv
+            ? adv
+            : 0
+    };
+    pushBack_Array(&d->monoAdvances, entry);
+    return entry[1];
+}
+
+static iInt2 measurePreContents_GmDocument_(iGmDocument *d, iRangecc contents, int font) {
+    iGmPreSizeCache *cache = &d->preSizes;
+    iGmPreSize       key   = { .hash = 14695981039346656037ull, .font = font };
+    /* Plain ASCII lines are shaped predictably if the font is monospaced. */
+    iBool    isPlain     = iTrue;
+    size_t   numLines    = 0;
+    size_t   lastFilled  = iInvalidPos; /* line index */
+    iRangecc longest     = iNullRange;
+    size_t   lineStart   = 0;
+    const size_t len = size_Range(&contents);
+    for (size_t i = 0; i <= len; i++) {
+        const uint8_t ch = i < len ? (uint8_t) contents.start[i] : '\n';
+        if (i < len) {
+            key.hash = (key.hash ^ ch) * 1099511628211ull;
+        }
+        if (ch == '\n') {
+            if (i > lineStart) {
+                lastFilled = numLines;
+                if (i - lineStart > size_Range(&longest)) {
+                    longest = (iRangecc){ contents.start + lineStart, contents.start + i };
+                }
+            }
+            numLines++;
+            lineStart = i + 1;
+        }
+        else if (ch < 0x20 || ch >= 0x7f) {
+            isPlain = iFalse; /* tabs, escapes, and non-ASCII need to be shaped */
+        }
+    }
+    size_t pos;
+    if (locate_SortedArray(&cache->sizes, &key, &pos)) {
+        return ((const iGmPreSize *) constAt_SortedArray(&cache->sizes, pos))->size;
+    }
+    if (isPlain && lastFilled != iInvalidPos && monoAdvance_GmPreSizeCache_(cache, font)) {
+        /* Heights are multiples of the line height, ending at the last non-empty line. All
+           glyphs have the same advance, so the line with the most characters is the widest
+           (to within a side bearing). */
+        key.size = init_I2(measureRange_Text(font, longest).bounds.size.x,
+                           lineHeight_Text(font) * (int) (lastFilled + 1));
+    }
+    else {
+        key.size = measureRange_Text(font, contents).bounds.size;
+    }
+    if (size_SortedArray(&cache->sizes) >= maxPreSizes_GmDocument_) {
+        clear_SortedArray(&cache->sizes); /* sizes of earlier sources are likely unneeded */
+    }
+    insert_SortedArray(&cache->sizes, &key);
+    return key.size;
+}
+
+static iInt2 measurePreformattedBlock_GmDocument_(iGmDocument *d, const char *start, int font,
                                                   iRangecc *contents, const char **endPos) {
     const iRangecc content = { start, constEnd_String(&d->source) };
     iRangecc line = iNullRange;
@@ -292,7 +630,7 @@ static iInt2 measurePreformattedBlock_GmDocument_(const iGmDocument *d, const ch
         }
         contents->end = line.end;
     }
-    return measureRange_Text(font, *contents).bounds.size;
+    return measurePreContents_GmDocument_(d, *contents, font);
 }
 
 static void setScheme_GmLink_(iGmLink *d, enum iGmLinkScheme scheme) {
@@ -312,8 +650,37 @@ static iBool isAllowedLinkIcon_Char_(iChar icon) {
            icon == 0x2a2f /* close X */ || icon == 0x2b50;
 }
 
+static iRangecc label_GmLink_(const iGmLink *d) {
+    /* The part of the link line that gets shown. */
+    if (~d->flags & humanReadable_GmLinkFlag) {
+        return d->urlRange;
+    }
+    iRangecc label = d->labelRange;
+    if (d->flags & iconFromLabel_GmLinkFlag) {
+        label.start = d->labelIcon.end;
+        trimStart_Rangecc(&label);
+    }
+    return label;
+}
+
+static void truncateLinks_GmDocument_(iGmDocument *d, size_t count);
+
 static iRangecc addLink_GmDocument_(iGmDocument *d, iRangecc line, iGmLinkId *linkId) {
-    /* Returns the human-readable label of the link. */
+    /* Returns the human-readable label of the link. Links don't depend on the layout, so
+       the ones parsed from the same source by a previous layout are used as is. */
+    if (d->linkCursor < size_Array(&d->links)) {
+        iGmLink *link = at_Array(&d->links, d->linkCursor);
+        if (link->urlRange.start >= line.start && link->urlRange.start <= line.end) {
+            link->flags &= ~(content_GmLinkFlag | permanent_GmLinkFlag); /* set by the layout */
+            *linkId = ++d->linkCursor; /* index + 1 */
+            return label_GmLink_(link);
+        }
+        if (link->urlRange.start > line.end) {
+            *linkId = 0; /* wasn't accepted as a link the last time, either */
+            return line;
+        }
+        truncateLinks_GmDocument_(d, d->linkCursor);
+    }
     static iRegExp *pattern_;
     if (!pattern_) {
         pattern_ = newGemtextLink_RegExp();
@@ -321,14 +688,18 @@ static iRangecc addLink_GmDocument_(iGmDocument *d, iRangecc line, iGmLinkId *li
     iRegExpMatch m;
     init_RegExpMatch(&m);
     if (matchRange_RegExp(pattern_, line, &m)) {
-        iGmLink *link = new_GmLink();
+        pushBack_Array(&d->links, &(iGmLink){ 0 });
+        iGmLink *link = back_Array(&d->links);
+        init_GmLink(link);
         link->urlRange = capturedRange_RegExpMatch(&m, 1);
         setRange_String(&link->url, link->urlRange);
         set_String(&link->url, canonicalUrl_String(absoluteUrl_String(&d->url, &link->url)));
+        link->urlHash = urlHash_String(&link->url);
         if (startsWithCase_String(&link->url, "about:command")) {
             /* This is a special internal page that allows submitting UI events. */
             if (!d->enableCommandLinks) {
-                delete_GmLink(link);
+                deinit_GmLink(link);
+                popBack_Array(&d->links);
                 *linkId = 0;
                 return line;
             }
@@ -371,28 +742,27 @@ static iRangecc addLink_GmDocument_(iGmDocument *d, iRangecc line, iGmLinkId *li
             }
             /* Check the file name extension, if present. */
             if (!isEmpty_Range(&parts.path)) {
-                iString *path = newRange_String(parts.path);
-                if (endsWithCase_String(path, ".gif")  || endsWithCase_String(path, ".jpg") ||
-                    endsWithCase_String(path, ".jpeg") || endsWithCase_String(path, ".png") ||
-                    endsWithCase_String(path, ".tga")  || endsWithCase_String(path, ".psd") ||                    
+                const iRangecc path = parts.path;
+                if (endsWithCase_Rangecc(path, ".gif")  || endsWithCase_Rangecc(path, ".jpg") ||
+                    endsWithCase_Rangecc(path, ".jpeg") || endsWithCase_Rangecc(path, ".png") ||
+                    endsWithCase_Rangecc(path, ".tga")  || endsWithCase_Rangecc(path, ".psd") ||
 #if defined (LAGRANGE_ENABLE_WEBP)
-                    endsWithCase_String(path, ".webp") ||
+                    endsWithCase_Rangecc(path, ".webp") ||
 #endif
-                    endsWithCase_String(path, ".hdr")  || endsWithCase_String(path, ".pic")) {
+                    endsWithCase_Rangecc(path, ".hdr")  || endsWithCase_Rangecc(path, ".pic")) {
                     link->flags |= imageFileExtension_GmLinkFlag;
                 }
-                else if (endsWithCase_String(path, ".mp3") || endsWithCase_String(path, ".wav") ||
-                         endsWithCase_String(path, ".mid") || endsWithCase_String(path, ".ogg")) {
+                else if (endsWithCase_Rangecc(path, ".mp3") || endsWithCase_Rangecc(path, ".wav") ||
+                         endsWithCase_Rangecc(path, ".mid") || endsWithCase_Rangecc(path, ".ogg")) {
                     link->flags |= audioFileExtension_GmLinkFlag;
                 }
-                else if (endsWithCase_String(path, ".fontpack")) {
+                else if (endsWithCase_Rangecc(path, ".fontpack")) {
                     link->flags |= fontpackFileExtension_GmLinkFlag;
                 }
-                delete_String(path);
             }
             /* Check if visited. */
             if (cmpString_String(&link->url, &d->url)) {
-                link->when = urlVisitTime_Visited(visited_App(), &link->url);
+                link->when = urlHashVisitTime_Visited(visited_App(), link->urlHash);
                 if (isValid_Time(&link->when)) {
                     link->flags |= visited_GmLinkFlag;
                 }
@@ -401,8 +771,8 @@ static iRangecc addLink_GmDocument_(iGmDocument *d, iRangecc line, iGmLinkId *li
                 }
             }
         }
-        pushBack_PtrArray(&d->links, link);
-        *linkId = size_PtrArray(&d->links); /* index + 1 */
+        *linkId = size_Array(&d->links); /* index + 1 */
+        d->linkCursor = size_Array(&d->links);
         iRangecc desc = capturedRange_RegExpMatch(&m, 2);
         trim_Rangecc(&desc);
         link->labelRange = desc;
@@ -434,15 +804,17 @@ static iRangecc addLink_GmDocument_(iGmDocument *d, iRangecc line, iGmLinkId *li
         else {
             line = capturedRange_RegExpMatch(&m, 1); /* Show the URL. */
         }
+        updateColors_GmLink_(link);
     }
     return line;
 }
 
 static void clearLinks_GmDocument_(iGmDocument *d) {
-    iForEach(PtrArray, i, &d->links) {
-        delete_GmLink(i.ptr);
+    /* The array keeps its memory for the next layout. */
+    iForEach(Array, i, &d->links) {
+        deinit_GmLink(i.value);
     }
-    clear_PtrArray(&d->links);
+    clear_Array(&d->links);
 }
 
 static iBool isGopher_GmDocument_(const iGmDocument *d) {
@@ -453,7 +825,7 @@ static iBool isGopher_GmDocument_(const iGmDocument *d) {
 
 static void linkContentWasLaidOut_GmDocument_(iGmDocument *d, const iGmMediaInfo *mediaInfo,
                                               uint16_t linkId) {
-    iGmLink *link = at_PtrArray(&d->links, linkId - 1);
+    iGmLink *link = at_Array(&d->links, linkId - 1);
     link->flags |= content_GmLinkFlag;
     if (mediaInfo && mediaInfo->isPermanent) {
         link->flags |= permanent_GmLinkFlag;
@@ -461,7 +833,7 @@ static void linkContentWasLaidOut_GmDocument_(iGmDocument *d, const iGmMediaInfo
 }
 
 static iBool isNormalized_GmDocument_(const iGmDocument *d) {
-    const iPrefs *prefs = prefs_App();
+    const iPrefs *prefs = prefs_GmDocument_(d);
     if (d->format == plainText_SourceFormat) {
         return iTrue; /* tabs are always normalized in plain text */
     }
@@ -525,6 +897,7 @@ struct Impl_RunTypesetter {
     iBool  isPreformat;
     int    baseFont;
     int    baseColor;
+    float  lineSpacing;
 };
     
 static void init_RunTypesetter_(iRunTypesetter *d) {
@@ -593,12 +966,428 @@ static iBool typesetOneLine_RunTypesetter_(iWrapText *wrap, iRangecc wrapRange,
 //    printf("origin:%d isRTL:%d\n{%s}\n", origin, attrib.isBaseRTL, cstr_Rangecc(wrapRange));
     pushBack_Array(&d->layout, &d->run);
     d->run.flags &= ~startOfLine_GmRunFlag;
-    d->pos.y += lineHeight_Text(d->baseFont) * prefs_App()->lineSpacing;
+    d->pos.y += lineHeight_Text(d->baseFont) * d->lineSpacing;
     return iTrue; /* continue to next wrapped line */
 }
 
-static void doLayout_GmDocument_(iGmDocument *d) {
-    const iPrefs *prefs             = prefs_App();
+static void truncateLinks_GmDocument_(iGmDocument *d, size_t count) {
+    while (size_Array(&d->links) > count) {
+        deinit_GmLink(back_Array(&d->links));
+        popBack_Array(&d->links);
+    }
+}
+
+static const size_t lazyLayoutMinSize_GmDocument_ = 128 * 1024; /* bytes of source */
+
+static size_t countLines_(iRangecc range) {
+    size_t count = 0;
+    for (const char *pos = range.start;
+         (pos = memchr(pos, '\n', range.end - pos)) != NULL;
+         pos++) {
+        count++;
+    }
+    return count;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* Wrapping paragraphs is the most expensive part of the layout. The wrapped lines of each
+   paragraph are cached, so laying out again (e.g., when the width changes) only needs to wrap
+   the paragraphs whose wrapping actually changes. Before the layout loop, the paragraphs of a
+   large document that aren't in the cache are wrapped in worker threads using the parameters
+   the loop is expected to use. Vertical positions, margins, and link/media IDs are still
+   assigned serially in the loop. */
+
+iDeclareType(GmWrapJob)
+iDeclareType(GmPrewrap)
+
+static const size_t prewrapMinSize_GmDocument_    = 32 * 1024; /* bytes of source */
+static const size_t prewrapMinBlocks_GmDocument_  = 256;
+static const int    prewrapMaxThreads_GmDocument_ = 8;
+
+static void init_GmWrapCache_(iGmWrapCache *d) {
+    init_Array(&d->blocks, sizeof(iGmWrapBlock));
+    init_Array(&d->lines, sizeof(iGmWrapLine));
+    d->numUnusedLines = 0;
+    d->fontGeneration = 0;
+    d->ansiFlags      = 0;
+}
+
+static void deinit_GmWrapCache_(iGmWrapCache *d) {
+    deinit_Array(&d->lines);
+    deinit_Array(&d->blocks);
+}
+
+static void clear_GmWrapCache_(iGmWrapCache *d) {
+    clear_Array(&d->blocks);
+    clear_Array(&d->lines);
+    d->numUnusedLines = 0;
+}
+
+static void validate_GmWrapCache_(iGmWrapCache *d, uint32_t fontGeneration, int ansiFlags) {
+    if (d->fontGeneration != fontGeneration || d->ansiFlags != ansiFlags) {
+        clear_GmWrapCache_(d);
+        d->fontGeneration = fontGeneration;
+        d->ansiFlags      = ansiFlags;
+    }
+}
+
+static size_t lowerBound_GmWrapCache_(const iGmWrapCache *d, size_t offset) {
+    size_t first = 0, last = size_Array(&d->blocks);
+    while (first < last) {
+        const size_t mid = (first + last) / 2;
+        if (((const iGmWrapBlock *) constAt_Array(&d->blocks, mid))->offset < offset) {
+            first = mid + 1;
+        }
+        else {
+            last = mid;
+        }
+    }
+    return first;
+}
+
+static const iGmWrapBlock *find_GmWrapCache_(const iGmWrapCache *d, size_t offset, size_t length,
+                                             int font, int maxWidth) {
+    const size_t index = lowerBound_GmWrapCache_(d, offset);
+    if (index == size_Array(&d->blocks)) {
+        return NULL;
+    }
+    const iGmWrapBlock *block = constAt_Array(&d->blocks, index);
+    if (block->offset != offset || block->length != length || block->font != font) {
+        return NULL;
+    }
+    if (block->maxWidth == maxWidth) {
+        return block;
+    }
+    /* A line that didn't need wrapping comes out the same at any width where it still fits.
+       Right-to-left lines are aligned to the width, so those are wrapped again. */
+    if (block->numLines == 1) {
+        const iGmWrapLine *line = constAt_Array(&d->lines, block->firstLine);
+        if (line->range.start == 0 && line->range.end == length && !line->attrib.isBaseRTL &&
+            (block->maxWidth == 0 || line->advance < block->maxWidth) &&
+            (maxWidth == 0 || line->advance < maxWidth)) {
+            return block;
+        }
+    }
+    return NULL;
+}
+
+static void compact_GmWrapCache_(iGmWrapCache *d) {
+    iArray lines;
+    init_Array(&lines, sizeof(iGmWrapLine));
+    iForEach(Array, i, &d->blocks) {
+        iGmWrapBlock *block = i.value;
+        const size_t  first = size_Array(&lines);
+        if (block->numLines) {
+            pushBackN_Array(&lines, constAt_Array(&d->lines, block->firstLine), block->numLines);
+        }
+        block->firstLine = first;
+    }
+    iSwap(iArray, lines, d->lines);
+    deinit_Array(&lines);
+    d->numUnusedLines = 0;
+}
+
+static const iGmWrapBlock *insert_GmWrapCache_(iGmWrapCache *d, const iGmWrapBlock *block,
+                                               const iGmWrapLine *lines) {
+    iGmWrapBlock newBlock = *block;
+    newBlock.firstLine = size_Array(&d->lines);
+    if (newBlock.numLines) {
+        pushBackN_Array(&d->lines, lines, newBlock.numLines);
+    }
+    const size_t index = lowerBound_GmWrapCache_(d, newBlock.offset);
+    /* Blocks are mostly added in ascending order, so this is usually appending. */
+    if (index < size_Array(&d->blocks) &&
+        ((const iGmWrapBlock *) constAt_Array(&d->blocks, index))->offset == newBlock.offset) {
+        iGmWrapBlock *old = at_Array(&d->blocks, index);
+        d->numUnusedLines += old->numLines;
+        *old = newBlock;
+    }
+    else {
+        insert_Array(&d->blocks, index, &newBlock);
+    }
+    if (d->numUnusedLines > 4096 && d->numUnusedLines > size_Array(&d->lines) / 2) {
+        compact_GmWrapCache_(d);
+    }
+    return constAt_Array(&d->blocks, index);
+}
+
+static void merge_GmWrapCache_(iGmWrapCache *d, const iGmWrapCache *other) {
+    iConstForEach(Array, i, &other->blocks) {
+        const iGmWrapBlock *block = i.value;
+        insert_GmWrapCache_(d,
+                            block,
+                            block->numLines ? constAt_Array(&other->lines, block->firstLine)
+                                            : NULL);
+    }
+}
+
+static iBool recordLine_GmWrapCache_(iWrapText *wrap, iRangecc wrapRange, iTextAttrib attrib,
+                                     int origin, int advance) {
+    iArray *lines = wrap->context;
+    pushBack_Array(lines,
+                   &(iGmWrapLine){ { wrapRange.start - wrap->text.start,
+                                     wrapRange.end - wrap->text.start },
+                                   attrib,
+                                   origin,
+                                   advance });
+    return iTrue;
+}
+
+static void measure_GmWrapBlock_(iGmWrapBlock *d, const char *text, iArray *lines) {
+    iWrapText wrap = { .text     = { text, text + d->length },
+                       .maxWidth = d->maxWidth,
+                       .mode     = word_WrapTextMode,
+                       .wrapFunc = recordLine_GmWrapCache_,
+                       .context  = lines };
+    clear_Array(lines);
+    measure_WrapText(&wrap, d->font);
+    d->numLines = size_Array(lines);
+    d->baseDir  = wrap.baseDir;
+}
+
+static void replay_GmWrapBlock_(const iGmWrapBlock *d, const iArray *lines, iWrapText *wrap) {
+    wrap->baseDir = d->baseDir;
+    for (size_t i = 0; i < d->numLines; i++) {
+        const iGmWrapLine *line = constAt_Array(lines, d->firstLine + i);
+        if (!wrap->wrapFunc(wrap,
+                            (iRangecc){ wrap->text.start + line->range.start,
+                                        wrap->text.start + line->range.end },
+                            line->attrib,
+                            line->origin,
+                            line->advance)) {
+            break;
+        }
+    }
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+struct Impl_GmWrapJob {
+    iJob *       job;
+    iText *      text;
+    const char * source;
+    iArray       input; /* iGmWrapBlock */
+    iGmWrapCache result;
+};
+
+struct Impl_GmPrewrap {
+    iPtrArray jobs;
+    iArray    lines; /* for wrapping a paragraph in the layout thread */
+};
+
+static void run_GmWrapJob_(iJob *job, void *context) {
+    iGmWrapJob *d = context;
+    iArray      lines;
+    /* A job that hasn't started yet is run in the waiting thread, which is already
+       measuring text with the same settings. */
+    const iBool isNested = (current_Text() == d->text);
+    iUnused(job);
+    init_Array(&lines, sizeof(iGmWrapLine));
+    if (!isNested) {
+        beginMetrics_Text(d->text);
+        setAnsiFlags_Text(d->result.ansiFlags);
+    }
+    iForEach(Array, i, &d->input) {
+        iGmWrapBlock *block = i.value;
+        measure_GmWrapBlock_(block, d->source + block->offset, &lines);
+        block->missingGlyphs = checkMissing_Text();
+        insert_GmWrapCache_(&d->result, block, constData_Array(&lines));
+    }
+    if (!isNested) {
+        endMetrics_Text();
+    }
+    deinit_Array(&lines);
+}
+
+static void init_GmPrewrap_(iGmPrewrap *d) {
+    init_PtrArray(&d->jobs);
+    init_Array(&d->lines, sizeof(iGmWrapLine));
+}
+
+static void deinit_GmPrewrap_(iGmPrewrap *d) {
+    iForEach(PtrArray, i, &d->jobs) {
+        iGmWrapJob *job = i.ptr;
+        deinit_GmWrapCache_(&job->result);
+        deinit_Array(&job->input);
+        free(job);
+    }
+    deinit_PtrArray(&d->jobs);
+    deinit_Array(&d->lines);
+}
+
+static void predict_GmPrewrap_(iGmPrewrap *d, iGmDocument *doc, iRangecc contentLine,
+                               size_t maxLines, const float *indents, iBool isPreformat,
+                               iBool isFirstText) {
+    /* Guess the font and width of each paragraph the same way the layout loop does.
+       Links and preformatted blocks are left for the loop to wrap. */
+    const iPrefs * prefs         = prefs_GmDocument_(doc);
+    const iBool    isMono        = isForcedMonospace_GmDocument_(doc);
+    const iBool    isNormalized  = isNormalized_GmDocument_(doc);
+    const iBool    noRightMargin = doc->size.x <= 70 * gap_Text ||
+                                   doc->outsideMargin < 5 * gap_UI;
+    const iRangecc content       = range_String(&doc->source);
+    iText *        text          = current_Text();
+    iArray         blocks;
+    if (!text) {
+        return;
+    }
+    init_Array(&blocks, sizeof(iGmWrapBlock));
+    for (size_t n = 0; n < maxLines && nextSplit_Rangecc(content, "\n", &contentLine); n++) {
+        iRangecc line = contentLine;
+        if (*line.end == '\r') {
+            line.end--;
+        }
+        iGmWrapBlock block = { 0 };
+        if (doc->format == plainText_SourceFormat) {
+            const int indent = isGopher_GmDocument_(doc)
+                                   ? indents[preformatted_GmLineType] * gap_Text : 0;
+            block.font     = plainText_FontId;
+            block.maxWidth = prefs->plainTextWrap ? doc->size.x - indent : 0;
+        }
+        else if (isPreformat) {
+            if (startsWithSc_Rangecc(line, "```", &iCaseSensitive)) {
+                isPreformat = iFalse;
+            }
+            continue;
+        }
+        else {
+            const enum iGmLineType type = lineType_GmDocument_(doc, line);
+            if (type == preformatted_GmLineType) {
+                isPreformat = iTrue;
+                isFirstText = iFalse;
+                continue;
+            }
+            trimLine_Rangecc(&line, type, isNormalized);
+            if (isEmpty_Range(&line)) {
+                continue;
+            }
+            const iBool isLede = (type == text_GmLineType && isFirstText);
+            if (type != heading1_GmLineType) {
+                isFirstText = iFalse;
+            }
+            if (type == link_GmLineType) {
+                continue; /* the label and font depend on the link */
+            }
+            const int indent      = indents[type] * gap_Text;
+            const int rightMargin = noRightMargin ? 0
+                                    : (type == text_GmLineType || type == bullet_GmLineType ||
+                                       type == quote_GmLineType) ? 4 * gap_Text : 0;
+            block.font     = isLede && !isMono ? firstParagraph_FontId : doc->theme.fonts[type];
+            block.maxWidth = doc->size.x - indent - rightMargin;
+        }
+        if (isEmpty_Range(&line)) {
+            continue;
+        }
+        block.offset = line.start - content.start;
+        block.length = size_Range(&line);
+        if (!find_GmWrapCache_(&doc->wrapCache, block.offset, block.length, block.font,
+                               block.maxWidth)) {
+            pushBack_Array(&blocks, &block);
+        }
+    }
+    const size_t numBlocks = size_Array(&blocks);
+    const int    numJobs   = iMin((int) numWorkers_Jobs() + 1, prewrapMaxThreads_GmDocument_);
+    if (numJobs > 1 && numBlocks >= prewrapMinBlocks_GmDocument_) {
+        /* Each job gets a contiguous slice of the paragraphs. */
+        for (int i = 0; i < numJobs; i++) {
+            const size_t first = numBlocks * i / numJobs;
+            const size_t last  = numBlocks * (i + 1) / numJobs;
+            iGmWrapJob *job    = iMalloc(GmWrapJob);
+            job->text          = text;
+            job->source        = content.start;
+            init_Array(&job->input, sizeof(iGmWrapBlock));
+            pushBackN_Array(&job->input, constAt_Array(&blocks, first), last - first);
+            init_GmWrapCache_(&job->result);
+            job->result.ansiFlags = doc->theme.ansiEscapes;
+            job->job = submit_Jobs(interactive_JobPriority, run_GmWrapJob_, job, NULL);
+            pushBack_PtrArray(&d->jobs, job);
+        }
+        iForEach(PtrArray, j, &d->jobs) {
+            iGmWrapJob *job = j.ptr;
+            wait_Job(job->job);
+            release_Job(job->job);
+            job->job = NULL;
+            merge_GmWrapCache_(&doc->wrapCache, &job->result);
+        }
+    }
+    deinit_Array(&blocks);
+}
+
+static void wrap_GmDocument_(iGmDocument *d, iGmPrewrap *prewrap, iWrapText *wrap, int fontId) {
+    const size_t        offset = wrap->text.start - cstr_String(&d->source);
+    const size_t        length = size_Range(&wrap->text);
+    const iGmWrapBlock *block  = find_GmWrapCache_(&d->wrapCache, offset, length, fontId,
+                                                   wrap->maxWidth);
+    if (!block) {
+        /* Not predicted correctly, or the document is small. */
+        iGmWrapBlock newBlock = { .offset   = offset,
+                                  .length   = length,
+                                  .font     = fontId,
+                                  .maxWidth = wrap->maxWidth };
+        /* The missing glyphs flag is also needed for blocks that won't be measured again. */
+        if (checkMissing_Text()) {
+            d->warnings |= missingGlyphs_GmDocumentWarning;
+        }
+        measure_GmWrapBlock_(&newBlock, wrap->text.start, &prewrap->lines);
+        newBlock.missingGlyphs = checkMissing_Text();
+        block = insert_GmWrapCache_(&d->wrapCache, &newBlock, constData_Array(&prewrap->lines));
+    }
+    if (block->missingGlyphs) {
+        d->warnings |= missingGlyphs_GmDocumentWarning;
+    }
+    replay_GmWrapBlock_(block, &d->wrapCache.lines, wrap);
+}
+
+static void updateRunSpans_GmDocument_(iGmDocument *d, size_t firstNewRun) {
+    /* Runs before `firstNewRun` were kept as is. */
+    const size_t numRuns = size_Array(&d->layout);
+    const size_t first   = iMin(firstNewRun, size_Array(&d->runSpans));
+    resize_Array(&d->runSpans, numRuns);
+    iGmRunSpan *spans = data_Array(&d->runSpans);
+    for (size_t i = first; i < numRuns; i++) {
+        const iGmRun *run = constAt_Array(&d->layout, i);
+        spans[i].maxBottom =
+            iMax(bottom_Rect(run->visBounds), i > 0 ? spans[i - 1].maxBottom : INT32_MIN);
+    }
+    while (!isEmpty_Array(&d->hitSpans) &&
+           ((const iGmHitSpan *) constBack_Array(&d->hitSpans))->run >= first) {
+        popBack_Array(&d->hitSpans);
+    }
+    for (size_t i = first; i < numRuns; i++) {
+        const iGmRun *run = constAt_Array(&d->layout, i);
+        if (run->flags & decoration_GmRunFlag) {
+            continue;
+        }
+        const iGmHitSpan *prev = isEmpty_Array(&d->hitSpans) ? NULL
+                                                             : constBack_Array(&d->hitSpans);
+        pushBack_Array(&d->hitSpans,
+                       &(iGmHitSpan){
+                           .maxTop    = iMax(top_Rect(run->bounds), prev ? prev->maxTop : INT32_MIN),
+                           .maxBottom = iMax(bottom_Rect(run->bounds),
+                                             prev ? prev->maxBottom : INT32_MIN),
+                           .run       = i });
+    }
+}
+
+static size_t firstVisibleRun_GmDocument_(const iGmDocument *d, int top) {
+    /* Index of the first run whose bottom is at or below `top`. */
+    const iGmRunSpan *spans = constData_Array(&d->runSpans);
+    size_t first = 0, last = size_Array(&d->runSpans);
+    while (first < last) {
+        const size_t mid = (first + last) / 2;
+        if (spans[mid].maxBottom < top) {
+            first = mid + 1;
+        }
+        else {
+            last = mid;
+        }
+    }
+    return first;
+}
+
+static void runLayout_GmDocument_(iGmDocument *d, iBool isAppending) {
+    const iPrefs *prefs             = prefs_GmDocument_(d);
     const iBool   isMono            = isForcedMonospace_GmDocument_(d);
     const iBool   isGopher          = isGopher_GmDocument_(d);
     const iBool   isNarrow          = d->size.x < 90 * gap_Text;
@@ -609,6 +1398,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
 //        isDark_ColorTheme(colorTheme_App()) ? prefs->docThemeDark : prefs->docThemeLight);
     initTheme_GmDocument_(d);
     d->isLayoutInvalidated = iFalse;
+    d->isLayoutIncomplete  = iFalse;
     /* TODO: Collect these parameters into a GmTheme. */
     float indents[max_GmLineType] = { 5, 10, 5, isNarrow ? 5 : 10, 0, 0, 5, 5 };
     if (isExtremelyNarrow) {
@@ -627,6 +1417,29 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     static const float bottomMargin[max_GmLineType] = {
         0.0f, 0.25f, 1.0f, 0.5f, 1.5f, 0.5f, 0.25f, 0.25f
     };
+    const iBool isPlainText = (d->format == plainText_SourceFormat);
+    const float lineSpacing = prefs->lineSpacing;
+    const int   paraHeight  = lineHeight_Text(paragraph_FontId);
+    const int   linkGroupMargin = (int) (1.25f * paraHeight) * lineSpacing;
+    iGmLineLayout lineLayouts[max_GmLineType];
+    for (int type = 0; type < max_GmLineType; type++) {
+        iGmLineLayout *ll = &lineLayouts[type];
+        ll->font  = d->theme.fonts[type];
+        ll->color = d->theme.colors[isPlainText ? text_GmLineType : type];
+        ll->rightMargin =
+            (!isVeryNarrow && !isFullWidthImages &&
+             (type == text_GmLineType || type == bullet_GmLineType || type == quote_GmLineType)
+                 ? 4 * gap_Text
+                 : 0);
+        ll->runFlags = (type == quote_GmLineType && !prefs->quoteIcon ? quoteBorder_GmRunFlag : 0);
+        for (int prev = 0; prev < max_GmLineType; prev++) {
+            ll->topMargin[prev] =
+                (type == quote_GmLineType && prev == quote_GmLineType)
+                    ? 0 /* no margin between consecutive quote lines */
+                    : (int) (iMax(topMargin[type], bottomMargin[prev]) * paraHeight) *
+                          lineSpacing;
+        }
+    }
     static const char *arrow           = rightArrowhead_Icon;
     static const char *envelope        = envelope_Icon;
     static const char *bullet          = "\u2022";
@@ -637,18 +1450,39 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     static const char *pointingFinger  = "\U0001f449";
     static const char *uploadArrow     = upload_Icon;
     static const char *image           = photo_Icon;
-    clear_Array(&d->layout);
-    clearLinks_GmDocument_(d);
-    clear_Array(&d->headings);
     const iArray *oldPreMeta = collect_Array(copy_Array(&d->preMeta)); /* remember fold states */
-    clear_Array(&d->preMeta);
-    clear_String(&d->title);
+    const iGmLayoutState resume = d->layoutState;
+    d->layoutState.isValid = iFalse;
+    isAppending = isAppending && resume.isValid;
+    if (isAppending) {
+        /* Everything after the resume point will be laid out again. */
+        resize_Array(&d->layout, resume.numRuns);
+        truncateLinks_GmDocument_(d, resume.numLinks);
+        d->linkCursor = resume.numLinks;
+        resize_Array(&d->preMeta, resume.numPreMeta);
+        if (!resume.hasTitle) {
+            clear_String(&d->title);
+        }
+    }
+    else {
+        clear_Array(&d->layout);
+        truncateLinks_GmDocument_(d, d->numReusableLinks);
+        d->linkCursor = 0;
+        clear_Array(&d->preMeta);
+        clear_String(&d->title);
+    }
 //    clear_String(&d->bannerText);
     if (d->size.x <= 0 || isEmpty_String(&d->source)) {
+        clear_Array(&d->runSpans);
+        clear_Array(&d->hitSpans);
         return;
     }
-    updateOpenURLs_GmDocument_(d);
+    if (!d->isBackgroundLayout) {
+        updateOpenURLs_GmDocument_(d); /* app state is only accessible in the main thread */
+    }
     const iRangecc   content       = range_String(&d->source);
+    const char *     completeEnd   = content.start + (d->normState.isValid ? d->normState.pos : 0);
+    const size_t     firstNewRun   = size_Array(&d->layout);
     iRangecc         contentLine   = iNullRange;
     iInt2            pos           = zero_I2();
     iBool            isFirstText   = prefs->bigFirstParagraph;
@@ -662,14 +1496,84 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     enum iGmLineType prevType      = text_GmLineType;
     enum iGmLineType prevNonBlankType = text_GmLineType;
     iBool            followsBlank  = iFalse;
+    iBool            isOpenPre     = iFalse; /* closing ``` not received yet */
+    const iBool      isLazy        = d->layoutLimitY > 0 && !d->isBackgroundLayout &&
+                                     size_String(&d->source) >= lazyLayoutMinSize_GmDocument_;
     if (d->format == plainText_SourceFormat) {
         isPreformat = iTrue;
         isFirstText = iFalse;
     }
-    d->warnings &= ~missingGlyphs_GmDocumentWarning;
+    if (isAppending) {
+        contentLine      = resume.prevLine;
+        pos              = resume.pos;
+        isFirstText      = resume.isFirstText;
+        addQuoteIcon     = resume.addQuoteIcon;
+        isPreformat      = resume.isPreformat;
+        preFont          = resume.preFont;
+        preId            = resume.preId;
+        enableIndents    = resume.enableIndents;
+        prevType         = resume.prevType;
+        prevNonBlankType = resume.prevNonBlankType;
+        followsBlank     = resume.followsBlank;
+    }
+    else {
+        d->warnings &= ~missingGlyphs_GmDocumentWarning;
+    }
     checkMissing_Text(); /* clear the flag */
     setAnsiFlags_Text(d->theme.ansiEscapes);
-    while (nextSplit_Rangecc(content, "\n", &contentLine)) {
+    validate_GmWrapCache_(&d->wrapCache, fontGeneration_Text(current_Text()),
+                          d->theme.ansiEscapes);
+    validate_GmPreSizeCache_(&d->preSizes, fontGeneration_Text(current_Text()),
+                             d->theme.ansiEscapes);
+    iGmPrewrap prewrap;
+    init_GmPrewrap_(&prewrap);
+    if (content.end - (contentLine.end ? contentLine.end : content.start) >=
+        (ptrdiff_t) prewrapMinSize_GmDocument_) {
+        /* A lazy layout stops at the limit; every line is at least one line high. */
+        const size_t maxLines =
+            isLazy ? iMax(0, d->layoutLimitY - pos.y) / lineHeight_Text(paragraph_FontId) + 1
+                   : iInvalidSize;
+        predict_GmPrewrap_(&prewrap, d, contentLine, maxLines, indents, isPreformat,
+                           isFirstText);
+    }
+    for (;;) {
+        const iRangecc prevContentLine = contentLine;
+        if (d->backgroundJob && isCancelled_Job(d->backgroundJob)) {
+            /* The owner is waiting to discard the results. */
+            d->isLayoutIncomplete = iTrue;
+            break;
+        }
+        if (!nextSplit_Rangecc(content, "\n", &contentLine)) {
+            break;
+        }
+        /* Remember the state at the start of each complete line. The contents of a preformatted
+           block depend on its closing ```, so the block must be laid out as a whole. */
+        const iBool isResumable = contentLine.start <= completeEnd && !isOpenPre &&
+                                  (!isPreformat || d->format == plainText_SourceFormat);
+        if (isResumable) {
+            d->layoutState = (iGmLayoutState){ .isValid          = iTrue,
+                                               .prevLine         = prevContentLine,
+                                               .numRuns          = size_Array(&d->layout),
+                                               .numLinks         = d->linkCursor,
+                                               .numPreMeta       = size_Array(&d->preMeta),
+                                               .hasTitle         = !isEmpty_String(&d->title),
+                                               .pos              = pos,
+                                               .isFirstText      = isFirstText,
+                                               .addQuoteIcon     = addQuoteIcon,
+                                               .isPreformat      = isPreformat,
+                                               .preFont          = preFont,
+                                               .preId            = preId,
+                                               .enableIndents    = enableIndents,
+                                               .prevType         = prevType,
+                                               .prevNonBlankType = prevNonBlankType,
+                                               .followsBlank     = followsBlank };
+            if (isLazy && pos.y > d->layoutLimitY) {
+                /* The rest will be laid out later, when needed. */
+                d->isLayoutIncomplete = iTrue;
+                contentLine = prevContentLine;
+                break;
+            }
+        }
         iRangecc line = contentLine; /* `line` will be trimmed; modifying would confuse `nextSplit_Rangecc` */
         if (*line.end == '\r') {
             line.end--; /* trim CR always */
@@ -691,15 +1595,22 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                 preFont = preformatted_FontId;
                 /* Use a smaller font if the block contents are wide. */
                 iGmPreMeta meta = { .bounds = line };
+                const char *fenceEnd = NULL;
                 meta.pixelRect.size = measurePreformattedBlock_GmDocument_(
-                    d, line.start, preFont, &meta.contents, &meta.bounds.end);
+                    d, line.start, preFont, &meta.contents, &fenceEnd);
+                if (fenceEnd) {
+                    meta.bounds.end = fenceEnd;
+                }
+                else {
+                    isOpenPre = iTrue;
+                }
                 const float oversizeRatio =
                     meta.pixelRect.size.x /
                     (float) (d->size.x -
                              (enableIndents ? indents[preformatted_GmLineType] : 0) * gap_Text);
                 if (oversizeRatio > 1.0f) {
                     preFont--; /* one notch smaller in the font size */
-                    meta.pixelRect.size = measureRange_Text(preFont, meta.contents).bounds.size;                        
+                    meta.pixelRect.size = measurePreContents_GmDocument_(d, meta.contents, preFont);
                 }
                 trimLine_Rangecc(&line, type, isNormalized);
                 meta.altText = line; /* without the ``` */
@@ -724,13 +1635,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                 }
             }
             trimLine_Rangecc(&line, type, isNormalized);
-            run.font = d->theme.fonts[type];
-            /* Remember headings for the document outline. */
-            if (type == heading1_GmLineType || type == heading2_GmLineType || type == heading3_GmLineType) {
-                pushBack_Array(
-                    &d->headings,
-                    &(iGmHeading){ .text = line, .level = type - heading1_GmLineType });
-            }
+            run.font = lineLayouts[type].font;
         }
         else {
             /* Preformatted line. */
@@ -746,7 +1651,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             }
             run.mediaType = max_MediaType; /* preformatted block */
             run.mediaId = preId;
-            run.font = (d->format == plainText_SourceFormat ? plainText_FontId : preFont);
+            run.font = (isPlainText ? plainText_FontId : preFont);
             indent = indents[type];
         }
 #if 0
@@ -782,7 +1687,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                 run.flags          = quoteBorder_GmRunFlag | decoration_GmRunFlag;
                 pushBack_Array(&d->layout, &run);
             }
-            pos.y += lineHeight_Text(run.font) * prefs->lineSpacing;
+            pos.y += lineHeight_Text(run.font) * lineSpacing;
             prevType = type;
             if (type != quote_GmLineType) {
                 addQuoteIcon = prefs->quoteIcon;
@@ -803,26 +1708,20 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         }
         /* Check the margin vs. previous run. */
         if (!isPreformat || (prevType != preformatted_GmLineType)) {
-            int required =
-                iMax(topMargin[type], bottomMargin[prevType]) * lineHeight_Text(paragraph_FontId);
+            int required = lineLayouts[type].topMargin[prevType];
             if (type == link_GmLineType && prevNonBlankType == link_GmLineType && followsBlank) {
-                required = 1.25f * lineHeight_Text(paragraph_FontId);
-            }
-            if (type == quote_GmLineType && prevType == quote_GmLineType) {
-                /* No margin between consecutive quote lines. */
-                required = 0;
+                required = linkGroupMargin;
             }
             if (isEmpty_Array(&d->layout)) {
                 required = 0; /* top of document */
             }
-            required *= prefs->lineSpacing;
             int delta = pos.y - lastVisibleRunBottom_GmDocument_(d);
             if (delta < required) {
                 pos.y += (required - delta);
             }
         }
         /* Folded blocks are represented by a single run with the alt text. */
-        if (isPreformat && d->format != plainText_SourceFormat) {
+        if (isPreformat && !isPlainText) {
             const iGmPreMeta *meta = constAt_Array(&d->preMeta, preId - 1);
             if (meta->flags & folded_GmPreMetaFlag) {
                 const iBool isBlank = isEmpty_Range(&meta->altText);
@@ -901,7 +1800,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             icon.visBounds.pos  = pos;
             icon.visBounds.size = init_I2(indent * gap_Text, lineHeight_Text(run.font));
             icon.bounds         = zero_Rect(); /* just visual */
-            const iGmLink *link = constAt_PtrArray(&d->links, run.linkId - 1);
+            const iGmLink *link = constAt_Array(&d->links, run.linkId - 1);
             const enum iGmLinkScheme scheme = scheme_GmLinkFlag(link->flags);
             icon.text           = range_CStr(link->flags & query_GmLinkFlag    ? magnifyingGlass
                                              : scheme == titan_GmLinkScheme    ? uploadArrow
@@ -926,10 +1825,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             pushBack_Array(&d->layout, &icon);
         }
         run.lineType = type;
-        run.color    = d->theme.colors[type];
-        if (d->format == plainText_SourceFormat) {
-            run.color = d->theme.colors[text_GmLineType];
-        }
+        run.color    = lineLayouts[type].color;
         /* Special formatting for the first paragraph (e.g., subtitle, introduction, or lede). */
 //        int bigCount = 0;
         if (type == text_GmLineType && isFirstText) {
@@ -941,7 +1837,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
         else if (type != heading1_GmLineType) {
             isFirstText = iFalse;
         }
-        if (isPreformat && d->format != plainText_SourceFormat) {
+        if (isPreformat && !isPlainText) {
             /* Remember the top left coordinates of the block (first line of block). */
             iGmPreMeta *meta = at_Array(&d->preMeta, preId - 1);
             if (~meta->flags & topLeft_GmPreMetaFlag) {
@@ -956,20 +1852,12 @@ static void doLayout_GmDocument_(iGmDocument *d) {
             rts.run           = run;
             rts.pos           = pos;
             //rts.fonts         = fonts;
-            rts.isWordWrapped = (d->format == plainText_SourceFormat ? prefs->plainTextWrap
-                                                                     : !isPreformat);
+            rts.isWordWrapped = (isPlainText ? prefs->plainTextWrap : !isPreformat);
             rts.isPreformat   = isPreformat;
+            rts.lineSpacing   = lineSpacing;
             rts.layoutWidth   = d->size.x;
             rts.indent        = indent * gap_Text;
-            /* The right margin is used for balancing lines horizontally. */
-            if (isVeryNarrow || isFullWidthImages) {
-                rts.rightMargin = 0;
-            }
-            else {
-                rts.rightMargin = (type == text_GmLineType || type == bullet_GmLineType ||
-                                           type == quote_GmLineType
-                                       ? 4 : 0) * gap_Text;
-            }
+            rts.rightMargin   = lineLayouts[type].rightMargin;
             if (!isMono) {
 #if 0
                 /* Upper-level headings are typeset a bit tighter. */
@@ -986,9 +1874,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                     rts.run.font = paragraph_FontId;
                 }
             }
-            if (!prefs->quoteIcon && type == quote_GmLineType) {
-                rts.run.flags |= quoteBorder_GmRunFlag;
-            }
+            rts.run.flags |= lineLayouts[type].runFlags;
             for (;;) { /* need to retry if the font needs changing */
                 rts.run.flags |= startOfLine_GmRunFlag;
                 rts.baseFont  = rts.run.font;
@@ -1001,7 +1887,7 @@ static void doLayout_GmDocument_(iGmDocument *d) {
                                        .mode     = word_WrapTextMode,
                                        .wrapFunc = typesetOneLine_RunTypesetter_,
                                        .context  = &rts };
-                measure_WrapText(&wrapText, rts.run.font);
+                wrap_GmDocument_(d, &prewrap, &wrapText, rts.run.font);
                 if (!rts.run.isLede || size_Array(&rts.layout) <= maxLedeLines_) {
                     if (wrapText.baseDir < 0) {
                         /* Right-aligned paragraphs need margins and decorations to be flipped. */
@@ -1119,42 +2005,207 @@ static void doLayout_GmDocument_(iGmDocument *d) {
     }
 #endif
     d->size.y = pos.y;
+    if (d->isLayoutIncomplete) {
+        /* Estimate the remaining height based on the lines laid out so far. */
+        const char  *resumePos = contentLine.end ? contentLine.end : content.start;
+        const size_t numDone   = iMax(1u, countLines_((iRangecc){ content.start, resumePos }));
+        const size_t numLeft   = countLines_((iRangecc){ resumePos, content.end }) + 1;
+        d->size.y += (int) (numLeft * pos.y / numDone);
+    }
     if (checkMissing_Text()) {
         d->warnings |= missingGlyphs_GmDocumentWarning;
     }
+    deinit_GmPrewrap_(&prewrap);
     /* Go over the preformatted blocks and mark them wide if at least one run is wide. */ {
         /* TODO: Store the dimensions and ranges for later access. */
-        iForEach(Array, i, &d->layout) {
-            iGmRun *run = i.value;
+        for (size_t i = firstNewRun; i < size_Array(&d->layout); i++) {
+            iGmRun *run = at_Array(&d->layout, i);
             if (preId_GmRun(run) && run->flags & wide_GmRunFlag) {
                 iGmRunRange block = findPreformattedRange_GmDocument(d, run);
                 for (const iGmRun *j = block.start; j != block.end; j++) {
                     iConstCast(iGmRun *, j)->flags |= wide_GmRunFlag;
                 }
                 /* Skip to the end of the block. */
-                i.pos = block.end - (const iGmRun *) constData_Array(&d->layout) - 1;
+                i = block.end - (const iGmRun *) constData_Array(&d->layout) - 1;
             }
         }
     }
+    updateRunSpans_GmDocument_(d, firstNewRun);
+    d->numReusableLinks = size_Array(&d->links);
     setAnsiFlags_Text(allowAll_AnsiFlag);
 //    printf("[GmDocument] layout size: %zu runs (%zu bytes)\n",
 //           size_Array(&d->layout), size_Array(&d->layout) * sizeof(iGmRun));        
 }
 
-void init_GmDocument(iGmDocument *d) {
-    d->format = gemini_SourceFormat;
-    init_String(&d->unormSource);
-    init_String(&d->source);
-    init_String(&d->url);
-    init_String(&d->localHost);
-    d->outsideMargin = 0;
-    d->size = zero_I2();
+static void layout_GmDocument_(iGmDocument *d, iBool isAppending) {
+    start_ProfilerScope(docLayout);
+    runLayout_GmDocument_(d, isAppending);
+    stop_ProfilerScope(docLayout);
+    counter_Profiler("layoutRuns", size_Array(&d->layout));
+}
+
+static void layoutWithLimit_GmDocument_(iGmDocument *d, iBool isAppending, int limitY) {
+    /* The limit only applies to this layout. */
+    const int oldLimit = d->layoutLimitY;
+    d->layoutLimitY = limitY;
+    layout_GmDocument_(d, isAppending);
+    d->layoutLimitY = oldLimit;
+}
+
+static void restoreLayoutSnapshot_GmDocument_(iGmDocument *d);
+
+static void doLayout_GmDocument_(iGmDocument *d) {
+    if (d->isHibernating) {
+        d->isHibernating = iFalse;
+        if (d->layoutSnapshot) {
+            restoreLayoutSnapshot_GmDocument_(d);
+        }
+    }
+    layoutWithLimit_GmDocument_(d, iFalse, d->viewLimitY);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void init_GmFindIndex_(iGmFindIndex *d) {
+    init_String(&d->query);
+    init_Array(&d->offsets, sizeof(uint32_t));
+    d->scannedSize = 0;
+}
+
+static void deinit_GmFindIndex_(iGmFindIndex *d) {
+    deinit_Array(&d->offsets);
+    deinit_String(&d->query);
+}
+
+static void truncate_GmFindIndex_(iGmFindIndex *d, size_t size) {
+    /* The source is about to change after the first `size` bytes. */
+    const size_t len = size_String(&d->query);
+    if (size >= d->scannedSize) {
+        return;
+    }
+    while (!isEmpty_Array(&d->offsets) &&
+           *(const uint32_t *) constBack_Array(&d->offsets) + len > size) {
+        popBack_Array(&d->offsets);
+    }
+    d->scannedSize = size;
+}
+
+static char foldCase_(char c) {
+    /* Same as the case-insensitive comparison of the_Foundation: only ASCII is folded. */
+    return c >= 'A' && c <= 'Z' ? c + ('a' - 'A') : c;
+}
+
+static iBool equalFolded_(const char *text, const char *folded, size_t len) {
+    for (; len > 0; len--) {
+        if (foldCase_(*text++) != *folded++) {
+            return iFalse;
+        }
+    }
+    return iTrue;
+}
+
+static void scan_GmFindIndex_(iGmFindIndex *d, const iString *source) {
+    const char  *base   = constBegin_String(source);
+    const char  *needle = cstr_String(&d->query);
+    const size_t len    = size_String(&d->query);
+    const size_t size   = size_String(source);
+    if (d->scannedSize >= size) {
+        return;
+    }
+    if (len == 0 || size < len) {
+        d->scannedSize = size;
+        return;
+    }
+    /* Matches that end in the already scanned part are known. */
+    const char *start = base + (d->scannedSize >= len ? d->scannedSize - len + 1 : 0);
+    const char *last  = base + size - len; /* last possible start of a match */
+    /* Candidates for the first character are located with memchr(), which the C library
+       vectorizes. Both cases of a letter are looked for separately. */
+    const char  lower     = needle[0];
+    const char  upper     = (lower >= 'a' && lower <= 'z' ? lower - ('a' - 'A') : lower);
+    const char *nextLower = memchr(start, lower, last - start + 1);
+    const char *nextUpper = (upper != lower ? memchr(start, upper, last - start + 1) : NULL);
+    while (nextLower || nextUpper) {
+        const char *pos =
+            (!nextUpper || (nextLower && nextLower < nextUpper) ? nextLower : nextUpper);
+        if (equalFolded_(pos + 1, needle + 1, len - 1)) {
+            const uint32_t offset = (uint32_t) (pos - base);
+            pushBack_Array(&d->offsets, &offset);
+        }
+        const char **next = (pos == nextLower ? &nextLower : &nextUpper);
+        *next = (pos < last ? memchr(pos + 1, *pos, last - pos) : NULL);
+    }
+    d->scannedSize = size;
+}
+
+static void setQuery_GmFindIndex_(iGmFindIndex *d, const iString *source, const iString *text) {
+    const size_t len = size_String(text);
+    if (len == size_String(&d->query) && equalFolded_(cstr_String(text), cstr_String(&d->query), len)) {
+        return; /* same query */
+    }
+    const iBool isRefined =
+        !isEmpty_String(&d->query) && len > size_String(&d->query) &&
+        equalFolded_(cstr_String(text), cstr_String(&d->query), size_String(&d->query));
+    set_String(&d->query, text);
+    for (char *ch = data_Block(&d->query.chars); *ch; ch++) {
+        *ch = foldCase_(*ch);
+    }
+    if (isRefined) {
+        /* More characters were typed, so the new matches are a subset of the old ones. */
+        const char *base    = constBegin_String(source);
+        uint32_t   *offsets = data_Array(&d->offsets);
+        size_t      count   = 0;
+        for (size_t i = 0; i < size_Array(&d->offsets); i++) {
+            if (offsets[i] + len <= d->scannedSize &&
+                equalFolded_(base + offsets[i], cstr_String(&d->query), len)) {
+                offsets[count++] = offsets[i];
+            }
+        }
+        resize_Array(&d->offsets, count);
+    }
+    else {
+        clear_Array(&d->offsets);
+        d->scannedSize = 0;
+    }
+}
+
+static size_t lowerBound_GmFindIndex_(const iGmFindIndex *d, size_t offset) {
+    /* Index of the first match at or after `offset`. */
+    const uint32_t *offsets = constData_Array(&d->offsets);
+    size_t          low     = 0;
+    size_t          high    = size_Array(&d->offsets);
+    while (low < high) {
+        const size_t mid = (low + high) / 2;
+        if (offsets[mid] < offset) {
+            low = mid + 1;
+        }
+        else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+void init_GmDocument(iGmDocument *d) {
+    d->format = gemini_SourceFormat;
+    init_String(&d->unormSource);
+    init_String(&d->source);
+    init_String(&d->url);
+    init_String(&d->localHost);
+    d->outsideMargin = 0;
+    d->size = zero_I2();
     d->enableCommandLinks = iFalse;
     d->isLayoutInvalidated = iFalse;
     init_Array(&d->layout, sizeof(iGmRun));
-    init_PtrArray(&d->links);
+    init_Array(&d->runSpans, sizeof(iGmRunSpan));
+    init_Array(&d->hitSpans, sizeof(iGmHitSpan));
+    init_Array(&d->links, sizeof(iGmLink));
+    d->numReusableLinks = 0;
+    d->linkCursor = 0;
     init_String(&d->title);
     init_Array(&d->headings, sizeof(iGmHeading));
+    d->headingsScanned = 0;
+    d->isHeadingScanPreformat = iFalse;
     init_Array(&d->preMeta, sizeof(iGmPreMeta));
     d->themeSeed = 0;
     d->siteIcon = 0;
@@ -1163,16 +2214,39 @@ void init_GmDocument(iGmDocument *d) {
     d->warnings = 0;
     d->isPaletteValid = iFalse;
     iZap(d->palette);
+    iZap(d->normState);
+    iZap(d->layoutState);
+    d->layoutLimitY = 0;
+    d->viewLimitY = 0;
+    d->isLayoutIncomplete = iFalse;
+    d->layoutJob = NULL;
+    d->isBackgroundLayout = iFalse;
+    d->backgroundJob = NULL;
+    d->prefs = NULL;
+    init_GmWrapCache_(&d->wrapCache);
+    init_GmPreSizeCache_(&d->preSizes);
+    d->layoutSnapshot = NULL;
+    d->isHibernating = iFalse;
+    init_GmFindIndex_(&d->findIndex);
 }
 
+static void cancelLayoutJob_GmDocument_(iGmDocument *d);
+
 void deinit_GmDocument(iGmDocument *d) {
+    cancelLayoutJob_GmDocument_(d);
+    deinit_GmWrapCache_(&d->wrapCache);
+    deinit_GmPreSizeCache_(&d->preSizes);
+    deinit_GmFindIndex_(&d->findIndex);
+    delete_Block(d->layoutSnapshot);
     iReleasePtr(&d->openURLs);
     delete_Media(d->media);
     deinit_String(&d->title);
     clearLinks_GmDocument_(d);
-    deinit_PtrArray(&d->links);
+    deinit_Array(&d->links);
     deinit_Array(&d->preMeta);
     deinit_Array(&d->headings);
+    deinit_Array(&d->hitSpans);
+    deinit_Array(&d->runSpans);
     deinit_Array(&d->layout);
     deinit_String(&d->localHost);
     deinit_String(&d->url);
@@ -1236,6 +2310,70 @@ static void setDerivedThemeColors_(enum iGmDocumentTheme theme) {
               mix_Color(get_Color(tmLinkIconVisited_ColorId), get_Color(tmLinkIcon_ColorId), 0.20f));
 }
 
+/* Recently generated palettes. The palette depends on the seed, the document theme, the UI
+   palette the theme colors are picked from (affected by the UI theme and accent color), and
+   the saturation setting. Palettes are only generated in the main thread. */
+iDeclareType(GmPaletteKey)
+iDeclareType(GmCachedPalette)
+
+struct Impl_GmPaletteKey {
+    uint32_t              seed;
+    enum iGmDocumentTheme theme;
+    uint32_t              uiHash;
+    float                 saturation;
+};
+
+struct Impl_GmCachedPalette {
+    iGmPaletteKey key;
+    uint32_t      lastUsed; /* zero if unused */
+    iColor        palette[tmMax_ColorId];
+};
+
+#define numCachedPalettes_GmDocument_ 16
+
+static iGmCachedPalette cachedPalettes_[numCachedPalettes_GmDocument_];
+static uint32_t         paletteUseCounter_;
+
+static iGmPaletteKey paletteKey_GmDocument_(const iGmDocument *d, enum iGmDocumentTheme theme) {
+    uint32_t uiHash = 2166136261u; /* FNV-1a */
+    for (int i = 0; i < tmFirst_ColorId; i++) {
+        const iColor color = get_Color(i);
+        const uint8_t bytes[4] = { color.r, color.g, color.b, color.a };
+        for (size_t j = 0; j < sizeof(bytes); j++) {
+            uiHash = (uiHash ^ bytes[j]) * 16777619u;
+        }
+    }
+    return (iGmPaletteKey){ d->themeSeed, theme, uiHash, prefs_App()->saturation };
+}
+
+iLocalDef iBool equal_GmPaletteKey_(const iGmPaletteKey *d, const iGmPaletteKey *other) {
+    return d->seed == other->seed && d->theme == other->theme && d->uiHash == other->uiHash &&
+           d->saturation == other->saturation;
+}
+
+static const iColor *findCachedPalette_(const iGmPaletteKey *key) {
+    iForIndices(i, cachedPalettes_) {
+        iGmCachedPalette *cp = &cachedPalettes_[i];
+        if (cp->lastUsed && equal_GmPaletteKey_(&cp->key, key)) {
+            cp->lastUsed = ++paletteUseCounter_;
+            return cp->palette;
+        }
+    }
+    return NULL;
+}
+
+static void cachePalette_(const iGmPaletteKey *key, const iColor *palette) {
+    iGmCachedPalette *oldest = &cachedPalettes_[0];
+    iForIndices(i, cachedPalettes_) {
+        if (cachedPalettes_[i].lastUsed < oldest->lastUsed) {
+            oldest = &cachedPalettes_[i];
+        }
+    }
+    oldest->key      = *key;
+    oldest->lastUsed = ++paletteUseCounter_;
+    memcpy(oldest->palette, palette, sizeof(oldest->palette));
+}
+
 static void updateIconBasedOnUrl_GmDocument_(iGmDocument *d) {
     const iChar userIcon = siteIcon_Bookmarks(bookmarks_App(), &d->url);
     if (userIcon) {
@@ -1243,17 +2381,9 @@ static void updateIconBasedOnUrl_GmDocument_(iGmDocument *d) {
     }
 }
 
-void setThemeSeed_GmDocument(iGmDocument *d, const iBlock *seed) {
-    const iPrefs *        prefs = prefs_App();
-    enum iGmDocumentTheme theme = currentTheme_();
-    static const iChar siteIcons[] = {
-        0x203b,  0x2042,  0x205c,  0x2182,  0x25ed,  0x2600,  0x2601,  0x2604,  0x2605,  0x2606,
-        0x265c,  0x265e,  0x2690,  0x2691,  0x2693,  0x2698,  0x2699,  0x26f0,  0x270e,  0x2728,
-        0x272a,  0x272f,  0x2731,  0x2738,  0x273a,  0x273e,  0x2740,  0x2742,  0x2744,  0x2748,
-        0x274a,  0x2751,  0x2756,  0x2766,  0x27bd,  0x27c1,  0x27d0,  0x2b19,  0x1f300, 0x1f303,
-        0x1f306, 0x1f308, 0x1f30a, 0x1f319, 0x1f31f, 0x1f320, 0x1f340, 0x1f4cd, 0x1f4e1, 0x1f531,
-        0x1f533, 0x1f657, 0x1f659, 0x1f665, 0x1f668, 0x1f66b, 0x1f78b, 0x1f796, 0x1f79c,
-    };
+static void generatePalette_GmDocument_(const iGmDocument *d, enum iGmDocumentTheme theme) {
+    /* Sets up the global document palette for the site's theme seed. */
+    const iPrefs *prefs = prefs_App();
     /* Default colors. These are used on "about:" pages and local files, for example. */ {
         /* Link colors are generally the same in all themes. */
         set_Color(tmBadLink_ColorId, get_Color(red_ColorId));
@@ -1455,14 +2585,6 @@ void setThemeSeed_GmDocument(iGmDocument *d, const iBlock *seed) {
             }
         }
     }
-    if (seed && !isEmpty_Block(seed)) {
-        d->themeSeed = themeHash_(seed);
-        d->siteIcon  = siteIcons[(d->themeSeed >> 7) % iElemCount(siteIcons)];
-    }
-    else {
-        d->themeSeed = 0;
-        d->siteIcon  = 0;
-    }
     /* Set up colors. */
     if (d->themeSeed) {
         enum iHue {
@@ -1689,6 +2811,37 @@ void setThemeSeed_GmDocument(iGmDocument *d, const iBlock *seed) {
     }
     /* Derived colors. */
     setDerivedThemeColors_(theme);
+}
+
+void setThemeSeed_GmDocument(iGmDocument *d, const iBlock *seed) {
+    enum iGmDocumentTheme theme = currentTheme_();
+    static const iChar siteIcons[] = {
+        0x203b,  0x2042,  0x205c,  0x2182,  0x25ed,  0x2600,  0x2601,  0x2604,  0x2605,  0x2606,
+        0x265c,  0x265e,  0x2690,  0x2691,  0x2693,  0x2698,  0x2699,  0x26f0,  0x270e,  0x2728,
+        0x272a,  0x272f,  0x2731,  0x2738,  0x273a,  0x273e,  0x2740,  0x2742,  0x2744,  0x2748,
+        0x274a,  0x2751,  0x2756,  0x2766,  0x27bd,  0x27c1,  0x27d0,  0x2b19,  0x1f300, 0x1f303,
+        0x1f306, 0x1f308, 0x1f30a, 0x1f319, 0x1f31f, 0x1f320, 0x1f340, 0x1f4cd, 0x1f4e1, 0x1f531,
+        0x1f533, 0x1f657, 0x1f659, 0x1f665, 0x1f668, 0x1f66b, 0x1f78b, 0x1f796, 0x1f79c,
+    };
+    if (seed && !isEmpty_Block(seed)) {
+        d->themeSeed = themeHash_(seed);
+        d->siteIcon  = siteIcons[(d->themeSeed >> 7) % iElemCount(siteIcons)];
+    }
+    else {
+        d->themeSeed = 0;
+        d->siteIcon  = 0;
+    }
+    /* Generating the palette takes a lot of color conversions, so recently generated palettes
+       are reused. */
+    const iGmPaletteKey key = paletteKey_GmDocument_(d, theme);
+    const iColor *cached = findCachedPalette_(&key);
+    if (cached) {
+        memcpy(get_Root()->tmPalette, cached, sizeof(get_Root()->tmPalette));
+    }
+    else {
+        generatePalette_GmDocument_(d, theme);
+        cachePalette_(&key, get_Root()->tmPalette);
+    }
     /* Special exceptions. */
     if (seed) {
         if (equal_CStr(cstr_Block(seed), "gemini.circumlunar.space")) {
@@ -1719,11 +2872,80 @@ void invalidatePalette_GmDocument(iGmDocument *d) {
     d->isPaletteValid = iFalse;
 }
 
+static void truncateHeadings_GmDocument_(iGmDocument *d, size_t size, iBool isPreformat) {
+    /* The source is about to change after the first `size` bytes, which end a line. */
+    if (size >= d->headingsScanned) {
+        return;
+    }
+    const char *end = constBegin_String(&d->source) + size;
+    while (!isEmpty_Array(&d->headings) &&
+           ((const iGmHeading *) constBack_Array(&d->headings))->text.start >= end) {
+        popBack_Array(&d->headings);
+    }
+    d->headingsScanned        = size;
+    d->isHeadingScanPreformat = size ? isPreformat : iFalse;
+}
+
+static void updateHeadings_GmDocument_(iGmDocument *d) {
+    /* Headings only depend on line types, so the outline of a huge document is available
+       before it has been laid out. The lines are trimmed like in the layout. */
+    const iRangecc content = range_String(&d->source);
+    if (d->headingsScanned >= size_Range(&content)) {
+        return;
+    }
+    if (d->format == plainText_SourceFormat) {
+        d->headingsScanned = size_Range(&content);
+        return;
+    }
+    const iBool    isNormalized = isNormalized_GmDocument_(d);
+    const iRangecc rest         = { content.start + d->headingsScanned, content.end };
+    iBool          isPreformat  = d->isHeadingScanPreformat;
+    iRangecc       contentLine  = iNullRange;
+    while (nextSplit_Rangecc(rest, "\n", &contentLine)) {
+        iRangecc line = contentLine;
+        if (*line.end == '\r') {
+            line.end--;
+        }
+        if (isPreformat) {
+            if (d->format == gemini_SourceFormat &&
+                startsWithSc_Rangecc(line, "```", &iCaseSensitive)) {
+                isPreformat = iFalse;
+            }
+            continue;
+        }
+        const enum iGmLineType type = lineType_GmDocument_(d, line);
+        if (type == preformatted_GmLineType) {
+            isPreformat = iTrue;
+        }
+        else if (type >= heading1_GmLineType && type <= heading3_GmLineType) {
+            trimLine_Rangecc(&line, type, isNormalized);
+            pushBack_Array(&d->headings,
+                           &(iGmHeading){ .text = line, .level = type - heading1_GmLineType });
+        }
+    }
+    d->headingsScanned        = size_Range(&content);
+    d->isHeadingScanPreformat = isPreformat;
+}
+
+static void forgetResumeState_GmDocument_(iGmDocument *d) {
+    cancelLayoutJob_GmDocument_(d);
+    d->normState.isValid   = iFalse;
+    d->layoutState.isValid = iFalse;
+    clear_GmWrapCache_(&d->wrapCache); /* source offsets change */
+    truncate_GmFindIndex_(&d->findIndex, 0);
+    truncateHeadings_GmDocument_(d, 0, iFalse);
+    d->numReusableLinks = 0; /* links must be parsed again */
+}
+
 void setFormat_GmDocument(iGmDocument *d, enum iSourceFormat format) {
-    d->format = format;
+    if (d->format != format) {
+        d->format = format;
+        forgetResumeState_GmDocument_(d);
+    }
 }
 
 void setWidth_GmDocument(iGmDocument *d, int width, int canvasWidth) {
+    cancelLayoutJob_GmDocument_(d);
     d->size.x        = width;
     d->outsideMargin = iMax(0, (canvasWidth - width) / 2); /* distance to edge of the canvas */
     doLayout_GmDocument_(d); /* TODO: just flag need-layout and do it later */
@@ -1738,6 +2960,7 @@ iBool updateWidth_GmDocument(iGmDocument *d, int width, int canvasWidth) {
 }
 
 void redoLayout_GmDocument(iGmDocument *d) {
+    cancelLayoutJob_GmDocument_(d);
     doLayout_GmDocument_(d);
 }
 
@@ -1745,6 +2968,73 @@ void invalidateLayout_GmDocument(iGmDocument *d) {
     d->isLayoutInvalidated = iTrue;
 }
 
+iBool hibernate_GmDocument(iGmDocument *d) {
+    if (d->isHibernating || d->layoutJob || isEmpty_Array(&d->layout)) {
+        return iFalse;
+    }
+    /* Links, headings, and the title remain valid since they only depend on the source. */
+    iBlock *snapshot = layoutSnapshot_GmDocument(d);
+    if (snapshot) {
+        delete_Block(d->layoutSnapshot);
+        d->layoutSnapshot = snapshot;
+    }
+    clear_Array(&d->layout);
+    clear_Array(&d->runSpans);
+    clear_Array(&d->hitSpans);
+    clear_GmWrapCache_(&d->wrapCache);
+    d->layoutState.isValid = iFalse;
+    d->isLayoutInvalidated = iTrue;
+    d->isHibernating       = iTrue;
+    return iTrue;
+}
+
+iBool isHibernating_GmDocument(const iGmDocument *d) {
+    return d->isHibernating;
+}
+
+iBool isLayoutComplete_GmDocument(const iGmDocument *d) {
+    return !d->isLayoutIncomplete;
+}
+
+int layoutHeight_GmDocument(const iGmDocument *d) {
+    return d->isLayoutIncomplete ? d->layoutState.pos.y : d->size.y;
+}
+
+iBool extendLayout_GmDocument(iGmDocument *d, int minHeight) {
+    d->viewLimitY = minHeight; /* new layouts and appended content stop here, too */
+    if (!d->isLayoutIncomplete || d->layoutState.pos.y >= minHeight) {
+        return iFalse;
+    }
+    layoutWithLimit_GmDocument_(d, iTrue, minHeight); /* resumes where the previous layout stopped */
+    return iTrue;
+}
+
+iBool continueLayout_GmDocument(iGmDocument *d, int extraHeight) {
+    if (!d->isLayoutIncomplete) {
+        return iFalse;
+    }
+    layoutWithLimit_GmDocument_(d, iTrue, extraHeight > 0 ? d->layoutState.pos.y + extraHeight : 0);
+    return iTrue;
+}
+
+iBool layoutUntil_GmDocument(iGmDocument *d, const char *loc, int extraHeight) {
+    /* Layout positions depend on everything above, so the document is laid out up to `loc`.
+       The amount is doubled each time because estimating the remaining height is not free. */
+    iBool isExtended = iFalse;
+    int   amount     = iMax(1, extraHeight);
+    while (d->isLayoutIncomplete &&
+           loc >= (d->layoutState.prevLine.end ? d->layoutState.prevLine.end
+                                               : constBegin_String(&d->source))) {
+        continueLayout_GmDocument(d, amount);
+        amount *= 2;
+        isExtended = iTrue;
+    }
+    if (isExtended && extraHeight > 0) {
+        continueLayout_GmDocument(d, extraHeight); /* some content after `loc` */
+    }
+    return isExtended;
+}
+
 static void markLinkRunsVisited_GmDocument_(iGmDocument *d, const iIntSet *linkIds) {
     iForEach(Array, r, &d->layout) {
         iGmRun *run = r.value;
@@ -1759,20 +3049,61 @@ static void markLinkRunsVisited_GmDocument_(iGmDocument *d, const iIntSet *linkI
     }
 }
 
-iBool updateOpenURLs_GmDocument(iGmDocument *d) {
-    iBool wasChanged = iFalse;
+static void appendChangedURLs_(const iStringSet *urls, const iStringSet *others,
+                               iArray *hashes) {
+    iConstForEach(StringSet, i, urls) {
+        if (!contains_StringSet(others, i.value)) {
+            const uint64_t hash = urlHash_String(i.value);
+            pushBack_Array(hashes, &hash);
+        }
+    }
+}
+
+iBool updateOpenURLs_GmDocument(iGmDocument *d, iIntSet *changedLinks) {
+    /* Only links to URLs that were opened or closed since the last update need checking. */
+    iStringSet *oldURLs       = d->openURLs;
+    const iBool isIncremental = (oldURLs != NULL);
+    d->openURLs = NULL;
     updateOpenURLs_GmDocument_(d);
+    iArray changed;
+    init_Array(&changed, sizeof(uint64_t));
+    if (isIncremental) {
+        appendChangedURLs_(d->openURLs, oldURLs, &changed);
+        appendChangedURLs_(oldURLs, d->openURLs, &changed);
+        iRelease(oldURLs);
+        if (isEmpty_Array(&changed)) {
+            deinit_Array(&changed);
+            return iFalse;
+        }
+    }
+    iBool wasChanged = iFalse;
     iIntSet linkIds;
     init_IntSet(&linkIds);
-    iForEach(PtrArray, i, &d->links) {
-        iGmLink *link = i.ptr;
+    iForEach(Array, i, &d->links) {
+        iGmLink *link = i.value;
+        if (isIncremental) {
+            iBool isAffected = iFalse;
+            iConstForEach(Array, h, &changed) {
+                if (*(const uint64_t *) h.value == link->urlHash) {
+                    isAffected = iTrue;
+                    break;
+                }
+            }
+            if (!isAffected) {
+                continue;
+            }
+        }
         if (!equal_String(&link->url, &d->url)) {
             const iBool isOpen = contains_StringSet(d->openURLs, &link->url);
             if (isOpen ^ ((link->flags & isOpen_GmLinkFlag) != 0)) {
                 iChangeFlags(link->flags, isOpen_GmLinkFlag, isOpen);
                 if (isOpen) {
                     link->flags |= visited_GmLinkFlag;
-                    insert_IntSet(&linkIds, index_PtrArrayIterator(&i) + 1);
+                    insert_IntSet(&linkIds, index_ArrayIterator(&i) + 1);
+                }
+                updateColors_GmLink_(link);
+                if (changedLinks) {
+                    insert_IntSet(changedLinks, index_ArrayIterator(&i) + 1);
                 }
                 wasChanged = iTrue;
             }
@@ -1780,6 +3111,7 @@ iBool updateOpenURLs_GmDocument(iGmDocument *d) {
     }
     markLinkRunsVisited_GmDocument_(d, &linkIds);
     deinit_IntSet(&linkIds);
+    deinit_Array(&changed);
     return wasChanged;
 }
 
@@ -1787,337 +3119,339 @@ iLocalDef iBool isNormalizableSpace_(char ch) {
     return ch == ' ' || ch == '\t';
 }
 
-static void normalize_GmDocument(iGmDocument *d) {
-    iString *normalized = new_String();
-    iRangecc src = range_String(&d->source);
-    /* Check for a BOM. In UTF-8, the BOM can just be skipped if present. */ {
-        iChar ch = 0;
-        decodeBytes_MultibyteChar(src.start, src.end, &ch);
-        if (ch == 0xfeff) /* zero-width non-breaking space */ {
-            src.start += 3;
-        }
-    }
-    iRangecc line = iNullRange;
-    iBool isPreformat = iFalse;
-    if (d->format == plainText_SourceFormat) {
-        isPreformat = iTrue; /* Cannot be turned off. */
-    }
+static void normalizeLine_GmDocument_(iRangecc line, iBool isPreformat, iString *normalized) {
     const int preTabWidth = 4; /* TODO: user-configurable parameter */
-    iBool wasNormalized = iFalse;
-    iBool hasTabs = iFalse;
-    while (nextSplit_Rangecc(src, "\n", &line)) {
-        if (isPreformat) {
-            /* Replace any tab characters with spaces for visualization. */
-            for (const char *ch = line.start; ch != line.end; ch++) {
-                if (*ch == '\t') {
-                    int column = ch - line.start;
-                    int numSpaces = (column / preTabWidth + 1) * preTabWidth - column;
-                    while (numSpaces-- > 0) {
-                        appendCStrN_String(normalized, " ", 1);
-                    }
-                    hasTabs = iTrue;
-                    wasNormalized = iTrue;
-                }
-                else if (*ch != '\v') {
-                    appendCStrN_String(normalized, ch, 1);
-                }
-                else {
-                    hasTabs = iTrue;
-                    wasNormalized = iTrue;
+    if (isPreformat) {
+        /* Replace any tab characters with spaces for visualization. */
+        for (const char *ch = line.start; ch != line.end; ch++) {
+            if (*ch == '\t') {
+                int column = ch - line.start;
+                int numSpaces = (column / preTabWidth + 1) * preTabWidth - column;
+                while (numSpaces-- > 0) {
+                    appendCStrN_String(normalized, " ", 1);
                 }
             }
-            appendCStr_String(normalized, "\n");
-            if (d->format == gemini_SourceFormat &&
-                lineType_GmDocument_(d, line) == preformatted_GmLineType) {
-                isPreformat = iFalse;
+            else if (*ch != '\v') {
+                appendCStrN_String(normalized, ch, 1);
             }
-            continue;
         }
-        if (lineType_GmDocument_(d, line) == preformatted_GmLineType) {
-            isPreformat = iTrue;
-            appendRange_String(normalized, line);
-            appendCStr_String(normalized, "\n");
+        appendCStr_String(normalized, "\n");
+        return;
+    }
+    iBool isPrevSpace = iFalse;
+    int spaceCount = 0;
+    for (const char *ch = line.start; ch != line.end; ch++) {
+        char c = *ch;
+        if (c == '\v') {
             continue;
         }
-        iBool isPrevSpace = iFalse;
-        int spaceCount = 0;
-        for (const char *ch = line.start; ch != line.end; ch++) {
-            char c = *ch;
-            if (c == '\v') {
-                wasNormalized = iTrue;
-                continue;
-            }
-            if (isNormalizableSpace_(c)) {
-                if (isPrevSpace) {
-                    if (++spaceCount == 8) {
-                        /* There are several consecutive space characters. The author likely
-                           really wants to have some space here, so normalize to a tab stop. */
-                        popBack_Block(&normalized->chars);
-                        pushBack_Block(&normalized->chars, '\t');
-                    }
-                    wasNormalized = iTrue;
-                    continue; /* skip repeated spaces */
+        if (isNormalizableSpace_(c)) {
+            if (isPrevSpace) {
+                if (++spaceCount == 8) {
+                    /* There are several consecutive space characters. The author likely
+                       really wants to have some space here, so normalize to a tab stop. */
+                    popBack_Block(&normalized->chars);
+                    pushBack_Block(&normalized->chars, '\t');
                 }
-                if (c != ' ') {
-                    c = ' ';
-                    wasNormalized = iTrue;
-                }
-                isPrevSpace = iTrue;
+                continue; /* skip repeated spaces */
+            }
+            if (c != ' ') {
+                c = ' ';
+            }
+            isPrevSpace = iTrue;
+        }
+        else {
+            isPrevSpace = iFalse;
+            spaceCount = 0;
+        }
+        appendCStrN_String(normalized, &c, 1);
+    }
+    appendCStr_String(normalized, "\n");
+}
+
+static void detectAnsiEscapes_GmDocument_(iGmDocument *d, iRangecc line, int lineFlags) {
+    if (lineFlags & escape_SourceLineFlag && ~d->warnings & ansiEscapes_GmDocumentWarning &&
+        isAnsiEscape_SourceScanner(line)) {
+        d->warnings |= ansiEscapes_GmDocumentWarning;
+    }
+}
+
+static void normalize_GmDocument(iGmDocument *d, iBool detectEscapes) {
+    /* Normalizes `unormSource` into `source`. If the previous normalization state is still
+       valid, only the lines following the last complete line are processed. The scanner
+       flags the lines that normalization would change; runs of other lines are copied in
+       one go. If nothing changes, `source` shares the data of `unormSource`. */
+    iGmNormState *state = &d->normState;
+    const char   *begin = constBegin_String(&d->unormSource);
+    iRangecc      src   = range_String(&d->unormSource);
+    iBool         isPreformat;
+    if (state->isValid && state->isNormalized) {
+        truncate_GmFindIndex_(&d->findIndex, state->pos);
+        truncateHeadings_GmDocument_(d, state->pos, state->isPreformat);
+        truncate_Block(&d->source.chars, state->pos);
+        src.start = begin + state->unormPos + 1; /* continue after this line */
+        isPreformat = state->isPreformat;
+    }
+    else {
+        truncate_GmFindIndex_(&d->findIndex, 0);
+        truncateHeadings_GmDocument_(d, 0, iFalse);
+        clear_String(&d->source);
+        state->isValid = iFalse;
+        /* Check for a BOM. In UTF-8, the BOM can just be skipped if present. */ {
+            iChar ch = 0;
+            decodeBytes_MultibyteChar(src.start, src.end, &ch);
+            if (ch == 0xfeff) /* zero-width non-breaking space */ {
+                src.start += 3;
+            }
+        }
+        isPreformat = (d->format == plainText_SourceFormat); /* cannot be turned off in plain text */
+    }
+    const size_t   reserveSize = size_String(&d->source) + size_Range(&src) + 1;
+    iBool          isReserved  = iFalse;
+    const iBool    isGemini = (d->format == gemini_SourceFormat);
+    iSourceScanner scan;
+    iRangecc       line      = iNullRange;
+    int            flags     = 0;
+    const char    *copyStart = NULL; /* unchanged lines waiting to be appended */
+    init_SourceScanner(&scan, src);
+    while (nextLine_SourceScanner(&scan, &line, &flags)) {
+        const iBool isToggle = (lineType_GmDocument_(d, line) == preformatted_GmLineType);
+        if (detectEscapes) {
+            detectAnsiEscapes_GmDocument_(d, line, flags);
+        }
+        /* Preformatted lines only have their tabs expanded, and the opening ``` line is
+           kept as is. */
+        int changes = invalidUtf8_SourceLineFlag;
+        if (isPreformat) {
+            changes |= tabs_SourceLineFlag;
+        }
+        else if (!isToggle) {
+            changes |= tabs_SourceLineFlag | spaces_SourceLineFlag;
+        }
+        if (flags & changes) {
+            if (!isReserved) {
+                reserve_Block(&d->source.chars, reserveSize);
+                isReserved = iTrue;
+            }
+            if (copyStart) {
+                appendData_Block(&d->source.chars, copyStart, line.start - copyStart);
+                copyStart = NULL;
+            }
+            iString  valid;
+            iRangecc text = line;
+            init_String(&valid);
+            if (flags & invalidUtf8_SourceLineFlag) {
+                appendValidUtf8_String(&valid, line);
+                text = range_String(&valid);
+            }
+            if (flags & changes & ~invalidUtf8_SourceLineFlag) {
+                normalizeLine_GmDocument_(text, isPreformat, &d->source);
             }
             else {
-                isPrevSpace = iFalse;
-                spaceCount = 0;
+                appendRange_String(&d->source, text);
+                appendCStr_String(&d->source, "\n");
             }
-            appendCStrN_String(normalized, &c, 1);
+            deinit_String(&valid);
         }
-        appendCStr_String(normalized, "\n");
+        else if (!copyStart) {
+            copyStart = line.start;
+        }
+        if (isToggle && (!isPreformat || isGemini)) {
+            isPreformat = !isPreformat;
+        }
+        if (line.end < src.end) {
+            /* This line is complete, so it won't have to be normalized again. */
+            state->isValid      = iTrue;
+            state->isNormalized = iTrue;
+            state->isPreformat  = isPreformat;
+            state->unormPos     = line.end - begin;
+            state->pos          = size_String(&d->source) +
+                                  (copyStart ? (size_t) (line.end + 1 - copyStart) : 0);
+        }
+    }
+    if (copyStart == begin && line.end < src.end && isEmpty_String(&d->source)) {
+        /* Every line was kept as is and the source ends in a newline, like the normalized
+           source does. */
+        set_String(&d->source, &d->unormSource);
+    }
+    else if (copyStart) {
+        if (!isReserved) {
+            reserve_Block(&d->source.chars, reserveSize);
+        }
+        appendData_Block(&d->source.chars, copyStart, line.end - copyStart);
+        appendCStr_String(&d->source, "\n");
     }
-//    printf("hasTabs: %d\n", hasTabs);
-//    printf("wasNormalized: %d\n", wasNormalized);
-//    fflush(stdout);
-    set_String(&d->source, collect_String(normalized));
     //normalize_String(&d->source); /* NFC */
-//    printf("orig:%zu norm:%zu\n", size_String(&d->unormSource), size_String(&d->source));
     /* normalized source has an extra newline at the end */
-//    iAssert(wasNormalized || equal_String(&d->unormSource, &d->source));
+}
+
+static void updateUnnormalizedState_GmDocument_(iGmDocument *d) {
+    /* The source is used as-is, so it only matters where the last complete line ends. */
+    const size_t lastNewline = lastIndexOfCStr_String(&d->source, "\n");
+    iGmNormState *state = &d->normState;
+    state->isValid      = (lastNewline != iInvalidPos);
+    state->isNormalized = iFalse;
+    state->isPreformat  = iFalse;
+    state->unormPos     = state->isValid ? lastNewline : 0;
+    state->pos          = state->isValid ? lastNewline + 1 : 0;
 }
 
 void setUrl_GmDocument(iGmDocument *d, const iString *url) {
     url = canonicalUrl_String(url);
+    if (!equal_String(&d->url, url)) {
+        forgetResumeState_GmDocument_(d);
+    }
     set_String(&d->url, url);
     iUrl parts;
     init_Url(&parts, url);
     setRange_String(&d->localHost, parts.host);
     updateIconBasedOnUrl_GmDocument_(d);
-    if (!cmp_String(url, "about:fonts")) {
+    if (!cmp_String(url, "about:fonts") || !cmp_String(url, "about:memory")) {
         /* This is an interactive internal page. */
         d->enableCommandLinks = iTrue;
     }
 }
 
-static int replaceRegExp_String(iString *d, const iRegExp *regexp, const char *replacement,
-                                void (*matchHandler)(void *, const iRegExpMatch *),
-                                void *context) {
-    iRegExpMatch m;
-    iString      result;
-    int          numMatches = 0;
-    const char  *pos        = constBegin_String(d);
-    init_RegExpMatch(&m);
-    init_String(&result);
-    while (matchString_RegExp(regexp, d, &m)) {
-        appendRange_String(&result, (iRangecc){ pos, begin_RegExpMatch(&m) });
-        /* Replace any capture group back-references. */
-        for (const char *ch = replacement; *ch; ch++) {
-            if (*ch == '\\') {
-                ch++;
-                if (*ch == '\\') {
-                    appendCStr_String(&result, "\\");
-                }
-                else if (*ch >= '0' && *ch <= '9') {
-                    appendRange_String(&result, capturedRange_RegExpMatch(&m, *ch - '0'));
-                }
-            }
-            else {
-                appendData_Block(&result.chars, ch, 1);
-            }
-        }
-        if (matchHandler) {
-            matchHandler(context, &m);
-        }
-        pos = end_RegExpMatch(&m);
-        numMatches++;
+static void convertMarkdownToGemtext_GmDocument_(iGmDocument *d) {
+    iAssert(d->format == markdown_SourceFormat);
+    iString gemtext;
+    init_String(&gemtext);
+    convertToGemtext_Markdown(range_String(&d->source), &gemtext);
+    set_String(&d->source, &gemtext);
+    deinit_String(&gemtext);
+    d->format = gemini_SourceFormat;
+}
+
+static void scanAnsiEscapes_GmDocument_(iGmDocument *d, iRangecc src) {
+    /* Sources that are not normalized are not otherwise scanned. */
+    iSourceScanner scan;
+    iRangecc       line;
+    int            flags;
+    init_SourceScanner(&scan, src);
+    while (~d->warnings & ansiEscapes_GmDocumentWarning &&
+           nextLine_SourceScanner(&scan, &line, &flags)) {
+        detectAnsiEscapes_GmDocument_(d, line, flags);
     }
-    appendRange_String(&result, (iRangecc){ pos, constEnd_String(d) });
-    set_String(d, &result);
-    deinit_String(&result);
-    return numMatches;
 }
 
-iDeclareType(PendingLink)
-struct Impl_PendingLink {
-    iString *url;
-    iString *title;
-};
+static void rebaseRange_(iRangecc *range, const char *oldStart, size_t oldSize,
+                         const char *newStart) {
+    if (range->start && range->start >= oldStart && range->start <= oldStart + oldSize) {
+        range->end   = newStart + (range->end - oldStart);
+        range->start = newStart + (range->start - oldStart);
+    }
+}
 
-static void addPendingLink_(void *context, const iRegExpMatch *m) {
-    pushBack_Array(context, &(iPendingLink){
-        .url   = captured_RegExpMatch(m, 2),
-        .title = captured_RegExpMatch(m, 1)
-    });
-}
-
-static void addPendingNamedLink_(void *context, const iRegExpMatch *m) {
-    pushBack_Array(context, &(iPendingLink){
-        .url   = newFormat_String("[]%s", cstr_Rangecc(capturedRange_RegExpMatch(m, 2))),
-        .title = captured_RegExpMatch(m, 1)
-    });
-}
-
-static void flushPendingLinks_(iArray *links, const iString *source, iString *out) {
-    iRegExp *namePattern = new_RegExp("\n\\s*\\[(.+?)\\]\\s*:\\s*([^\n]+)", 0);
-    if (!endsWith_String(out, "\n")) {
-        appendCStr_String(out, "\n");
-    }
-    iForEach(Array, i, links) {
-        iPendingLink *pending = i.value;
-        const char *url = cstr_String(pending->url);
-        if (startsWith_CStr(url, "[]")) {
-            /* Find the matching named link. */
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            while (matchString_RegExp(namePattern, source, &m)) {
-                if (equal_Rangecc(capturedRange_RegExpMatch(&m, 1), url + 2)) {
-                    url = cstrCollect_String(captured_RegExpMatch(&m, 2));
-                    break;
-                }
-            }
-        }
-        appendFormat_String(out, "\n=> %s %s", url, cstr_String(pending->title));
-        delete_String(pending->url);
-        delete_String(pending->title);
+static void rebaseSource_GmDocument_(iGmDocument *d, const char *oldStart, size_t oldSize) {
+    /* The source buffer was reallocated. Everything that remained valid must now point to
+       the new buffer. Ranges that are not part of the source (e.g., decoration icons) are
+       left untouched. */
+    const char *newStart = constBegin_String(&d->source);
+    if (newStart == oldStart) {
+        return;
+    }
+    iForEach(Array, i, &d->layout) {
+        iGmRun *run = i.value;
+        rebaseRange_(&run->text, oldStart, oldSize, newStart);
     }
-    clear_Array(links);
-    iRelease(namePattern);
+    iForEach(Array, j, &d->links) {
+        iGmLink *link = j.value;
+        rebaseRange_(&link->urlRange, oldStart, oldSize, newStart);
+        rebaseRange_(&link->labelRange, oldStart, oldSize, newStart);
+        rebaseRange_(&link->labelIcon, oldStart, oldSize, newStart);
+    }
+    iForEach(Array, h, &d->headings) {
+        iGmHeading *head = h.value;
+        rebaseRange_(&head->text, oldStart, oldSize, newStart);
+    }
+    iForEach(Array, m, &d->preMeta) {
+        iGmPreMeta *meta = m.value;
+        rebaseRange_(&meta->bounds, oldStart, oldSize, newStart);
+        rebaseRange_(&meta->altText, oldStart, oldSize, newStart);
+        rebaseRange_(&meta->contents, oldStart, oldSize, newStart);
+    }
+    rebaseRange_(&d->layoutState.prevLine, oldStart, oldSize, newStart);
 }
 
-static void convertMarkdownToGemtext_GmDocument_(iGmDocument *d) {
-    iAssert(d->format == markdown_SourceFormat);
-    /* Get rid of indented preformats. */ {
-        iArray        *pendingLinks     = collectNew_Array(sizeof(iPendingLink));
-        const iRegExp *imageLinkPattern = iClob(new_RegExp("\n?!\\[(.+)\\]\\(([^)]+)\\)\n?", 0));
-        const iRegExp *linkPattern      = iClob(new_RegExp("\\[(.+?)\\]\\(([^)]+)\\)", 0));
-        const iRegExp *standaloneLinkPattern = iClob(new_RegExp("^[\\s*_]*\\[(.+?)\\]\\(([^)]+)\\)[\\s*_]*$", 0));
-        const iRegExp *namedLinkPattern = iClob(new_RegExp("\\[(.+?)\\]\\[(.+?)\\]", 0));
-        const iRegExp *namePattern      = iClob(new_RegExp("\\s*\\[(.+?)\\]\\s*:\\s*([^\n]+)", 0));
-        iString result;
-        init_String(&result);
-        replace_String(&d->source, "&nbsp;", "\u00a0");
-        replaceRegExp_String(&d->source, iClob(new_RegExp("```", 0)), "\n```\n", NULL, NULL);
-        iRangecc line = iNullRange;
-        iBool isPre = iFalse;
-        iBool isBlock = iFalse;
-        iBool isLastEmpty = iFalse;
-        while (nextSplit_Rangecc(range_String(&d->source), "\n", &line)) {
-            if (!isPre && !isBlock) {
-                if (equal_Rangecc(line, "```")) {
-                    isBlock = iTrue;
-                    appendCStr_String(&result, "\n```");
-                    continue;
-                }
-                if (*line.start == '#') {
-                    flushPendingLinks_(pendingLinks, &d->source, &result);
-                }
-                if (isEmpty_Range(&line)) {
-                    isLastEmpty = iTrue;
-                    continue;
-                }
-                if (isLastEmpty) {
-                    appendCStr_String(&result, "\n\n");
-                }
-                else if (size_Range(&line) >= 2 && isdigit(line.start[0]) &&
-                         (line.start[1] == '.' ||
-                          (isdigit(line.start[1]) && line.start[2] == '.'))) {
-                    appendCStr_String(&result, "\n\n");
-                }
-                else if (endsWith_String(&result, "  ") ||
-                         *line.start == '*' || *line.start == '>' || *line.start == '#' ||
-                         (*line.start == '|' && endsWith_String(&result, "|"))) {
-                    appendCStr_String(&result, "\n");
-                }
-                else {
-                    appendCStr_String(&result, " ");
-                }
-                isLastEmpty = iFalse;
-            }
-            else if (isBlock) {
-                if (equal_Rangecc(line, "```")) {
-                    isBlock = iFalse;
-                    appendCStr_String(&result, "\n```\n");
-                }
-                else {
-                    appendCStr_String(&result, "\n");
-                    appendRange_String(&result, line);
-                }
-                continue;
-            }
-            if (startsWith_Rangecc(line, "    ")) {
-                line.start += 4;
-                if (!isPre) {
-                    appendCStr_String(&result, "```\n");
-                    isPre = iTrue;
-                }
-            }
-            else if (isPre) {
-                if (!endsWith_String(&result, "\n")) {
-                    appendCStr_String(&result, "\n");
-                }
-                appendCStr_String(&result, "```\n");
-                if (equal_Rangecc(line, "```")) {
-                    line.start = line.end; /* don't repeat it */
-                }
-                isPre = iFalse;
-            }
-            if (isPre) {
-                appendRange_String(&result, line);
-                appendCStr_String(&result, "\n");
-            }
-            else {
-                iString ln;
-                initRange_String(&ln, line);
-                replaceRegExp_String(&ln, namePattern, "", NULL, 0);
-                replaceRegExp_String(&ln, standaloneLinkPattern, "\n=> \\2 \\1", NULL, NULL);
-                replaceRegExp_String(&ln, imageLinkPattern, "\n=> \\2 \\1\n", NULL, NULL);
-                replaceRegExp_String(&ln, namedLinkPattern, "\\1", addPendingNamedLink_, pendingLinks);
-                replaceRegExp_String(&ln, linkPattern, "\\1", addPendingLink_, pendingLinks);
-                replaceRegExp_String(&ln, iClob(new_RegExp("\\*\\*(.+?)\\*\\*", 0)), "\x1b[1m\\1\x1b[0m", NULL, NULL);
-                replaceRegExp_String(&ln, iClob(new_RegExp("__(.+?)__", 0)), "\x1b[1m\\1\x1b[0m", NULL, NULL);
-                replaceRegExp_String(&ln, iClob(new_RegExp("\\*(.+?)\\*", 0)), "\x1b[3m\\1\x1b[0m", NULL, NULL);
-                replaceRegExp_String(&ln, iClob(new_RegExp("\\b_([^_]+?)_\\b", 0)), "\x1b[3m\\1\x1b[0m", NULL, NULL);
-                replaceRegExp_String(&ln, iClob(new_RegExp("(?<!`)`([^`]+?)`(?!`)", 0)), "\x1b[11m\\1\x1b[0m", NULL, NULL);
-                replace_String(&ln, "\\_", "_");
-                append_String(&result, &ln);
-                deinit_String(&ln);
-            }
-        }
-        flushPendingLinks_(pendingLinks, &d->source, &result);
-        set_String(&d->source, &result);
-        deinit_String(&result);
-    }
-    /* Replace Markdown syntax with equivalent Gemtext, where possible. */
-    replaceRegExp_String(&d->source, iClob(new_RegExp("(\\s*\n){2,}", 0)), "\n\n", NULL, NULL); /* normalize paragraph breaks */
-    printf("Converted:\n%s", cstr_String(&d->source));
-    d->format = gemini_SourceFormat;
+static iBool canAppendSource_GmDocument_(const iGmDocument *d, const iString *source, int width,
+                                         int canvasWidth) {
+    const size_t oldSize = size_String(&d->unormSource);
+    return d->normState.isValid && d->layoutState.isValid && !d->isLayoutInvalidated &&
+           d->format != markdown_SourceFormat &&
+           d->normState.isNormalized == isNormalized_GmDocument_(d) &&
+           d->size.x == width && d->outsideMargin == iMax(0, (canvasWidth - width) / 2) &&
+           size_String(source) > oldSize &&
+           memcmp(constBegin_String(source), constBegin_String(&d->unormSource), oldSize) == 0;
+}
+
+static void appendSource_GmDocument_(iGmDocument *d, const iString *source) {
+    /* Only the lines following the last complete line are normalized and laid out. */
+    const char  *oldStart = constBegin_String(&d->source);
+    const size_t oldSize  = size_String(&d->source);
+    const size_t tailPos  = d->normState.unormPos;
+    /* `unormSource` is a private copy while streaming, so it grows in place. */
+    appendRange_String(&d->unormSource, (iRangecc){ constBegin_String(source) +
+                                                        size_String(&d->unormSource),
+                                                    constEnd_String(source) });
+    if (d->format == gemini_SourceFormat) {
+        d->theme.ansiEscapes = prefs_GmDocument_(d)->gemtextAnsiEscapes;
+    }
+    else {
+        d->theme.ansiEscapes = allowAll_AnsiFlag;
+    }
+    if (d->normState.isNormalized) {
+        normalize_GmDocument(d, iTrue);
+    }
+    else {
+        scanAnsiEscapes_GmDocument_(d, (iRangecc){ constBegin_String(&d->unormSource) + tailPos,
+                                                   constEnd_String(&d->unormSource) });
+        appendRange_String(&d->source, (iRangecc){ constBegin_String(source) + oldSize,
+                                                   constEnd_String(source) });
+        updateUnnormalizedState_GmDocument_(d);
+    }
+    rebaseSource_GmDocument_(d, oldStart, oldSize);
+    scan_GmFindIndex_(&d->findIndex, &d->source);
+    layoutWithLimit_GmDocument_(d, iTrue, d->viewLimitY);
 }
 
 void setSource_GmDocument(iGmDocument *d, const iString *source, int width, int canvasWidth,
                           enum iGmDocumentUpdate updateType) {
-    /* TODO: This API has been set up to allow partial/progressive updating of the content.
-       Currently the entire source is replaced every time, though. */
 //    printf("[GmDocument] source update (%zu bytes), width:%d, final:%d\n",
 //           size_String(source), width, updateType == final_GmDocumentUpdate);
+    cancelLayoutJob_GmDocument_(d);
     if (size_String(source) == size_String(&d->unormSource)) {
         iAssert(equal_String(source, &d->unormSource));
 //        printf("[GmDocument] source is unchanged!\n");
         return; /* Nothing to do. */
     }
+    /* Streamed content is appended to what we already have, so the lines that were complete
+       in the previous update can be kept as is. */
+    if (canAppendSource_GmDocument_(d, source, width, canvasWidth)) {
+        appendSource_GmDocument_(d, source);
+        return;
+    }
+    forgetResumeState_GmDocument_(d);
     /* Normalize and convert to Gemtext if needed. */
-    set_String(&d->unormSource, source);
-    set_String(&d->source, source);
-    /* Detect use of ANSI escapes. */ {
-        iRegExp *ansiEsc = new_RegExp("\x1b[[()]([0-9;AB]*?)[ABCDEFGHJKSTfimn]", 0);
-        iRegExpMatch m;
-        init_RegExpMatch(&m);
-        const iBool found = matchString_RegExp(ansiEsc, &d->unormSource, &m);
-        iChangeFlags(d->warnings, ansiEscapes_GmDocumentWarning, found);
-        iRelease(ansiEsc);
+    if (updateType == partial_GmDocumentUpdate) {
+        /* More is coming. Sharing the data would cause each further append to the response
+           body to copy all of it, so take a copy that is ours alone. */
+        setRange_String(&d->unormSource, range_String(source));
     }
+    else {
+        set_String(&d->unormSource, source);
+    }
+    set_String(&d->source, source);
+    d->warnings &= ~ansiEscapes_GmDocumentWarning;
+    iBool isConverted = iFalse; /* escapes in the source are not the author's */
     if (d->format == gemini_SourceFormat) {
-        d->theme.ansiEscapes = prefs_App()->gemtextAnsiEscapes;
+        d->theme.ansiEscapes = prefs_GmDocument_(d)->gemtextAnsiEscapes;
     }
     else if (d->format == markdown_SourceFormat) {
         /* Attempt a conversion to Gemtext when viewing local Markdown files. */
         if (equalCase_Rangecc(urlScheme_String(&d->url), "file")) {
+            scanAnsiEscapes_GmDocument_(d, range_String(&d->source));
             convertMarkdownToGemtext_GmDocument_(d);
+            isConverted = iTrue;
             set_String(&d->unormSource, &d->source); /* use the converted source from now on */
             d->theme.ansiEscapes = allowAll_AnsiFlag; /* escapes are used for styling */
         }
@@ -2129,11 +3463,259 @@ void setSource_GmDocument(iGmDocument *d, const iString *source, int width, int
         d->theme.ansiEscapes = allowAll_AnsiFlag;
     }
     if (isNormalized_GmDocument_(d)) {
-        normalize_GmDocument(d);
+        normalize_GmDocument(d, !isConverted);
+    }
+    else {
+        scanAnsiEscapes_GmDocument_(d, range_String(&d->unormSource));
+        updateUnnormalizedState_GmDocument_(d);
+    }
+    scan_GmFindIndex_(&d->findIndex, &d->source);
+    if (d->layoutSnapshot) {
+        restoreLayoutSnapshot_GmDocument_(d);
     }
     setWidth_GmDocument(d, width, canvasWidth); /* re-do layout */
 }
 
+/*----------------------------------------------------------------------------------------------*/
+
+struct Impl_GmLayoutJob {
+    iJob *       job;
+    iText *      text;
+    iGmDocument *owner;
+    iGmDocument *doc; /* settings copied from `owner`; only accessed by the worker while running */
+    iPrefs       prefs; /* only the settings that affect layout are valid */
+    iString      source;
+    int          width;
+    int          canvasWidth;
+};
+
+static void run_GmLayoutJob_(iJob *job, void *context) {
+    iGmLayoutJob *d = context;
+    d->doc->backgroundJob = job;
+    beginMetrics_Text(d->text);
+    setSource_GmDocument(d->doc, &d->source, d->width, d->canvasWidth, final_GmDocumentUpdate);
+    endMetrics_Text();
+}
+
+static iGmLayoutJob *new_GmLayoutJob_(iGmDocument *owner, const iString *source, int width,
+                                      int canvasWidth, iText *text) {
+    iGmLayoutJob *d = iMalloc(GmLayoutJob);
+    d->text  = text;
+    d->owner = owner;
+    d->doc   = new_GmDocument();
+    initCopy_String(&d->source, source);
+    d->width       = width;
+    d->canvasWidth = canvasWidth;
+    /* The new layout must match what a foreground layout would produce. */
+    iGmDocument *doc = d->doc;
+    doc->isBackgroundLayout = iTrue;
+    memcpy(&d->prefs, prefs_App(), sizeof(d->prefs)); /* strings are not copied */
+    doc->prefs              = &d->prefs;
+    doc->format             = owner->format;
+    doc->enableCommandLinks = owner->enableCommandLinks;
+    doc->theme              = owner->theme;
+    doc->themeSeed          = owner->themeSeed;
+    doc->siteIcon           = owner->siteIcon;
+    doc->openURLs           = listOpenURLs_App();
+    set_String(&doc->url, &owner->url);
+    set_String(&doc->localHost, &owner->localHost);
+    setLayoutSnapshot_GmDocument(doc, owner->layoutSnapshot);
+    copy_GmPreSizeCache_(&doc->preSizes, &owner->preSizes);
+    d->job = submit_Jobs(interactive_JobPriority,
+                         run_GmLayoutJob_,
+                         d,
+                         format_CStr("document.layout.finished doc:%p", owner));
+    return d;
+}
+
+static void delete_GmLayoutJob_(iGmLayoutJob *d) {
+    if (!cancel_Job(d->job)) {
+        wait_Job(d->job);
+    }
+    release_Job(d->job);
+    iRelease(d->doc);
+    deinit_String(&d->source);
+    free(d);
+}
+
+static void cancelLayoutJob_GmDocument_(iGmDocument *d) {
+    if (d->layoutJob) {
+        /* A running layout stops at the next line, and its results are discarded. */
+        delete_GmLayoutJob_(d->layoutJob);
+        d->layoutJob = NULL;
+    }
+}
+
+iBool setSourceInBackground_GmDocument(iGmDocument *d, const iString *source, int width,
+                                       int canvasWidth, iText *text) {
+    if (canAppendSource_GmDocument_(d, source, width, canvasWidth) ||
+        memorySize_Media(d->media) || numAudio_Media(d->media)) {
+        /* Appending is quick enough, and inline media are only available in this document. */
+        setSource_GmDocument(d, source, width, canvasWidth, final_GmDocumentUpdate);
+        return iFalse;
+    }
+    cancelLayoutJob_GmDocument_(d);
+    d->layoutJob = new_GmLayoutJob_(d, source, width, canvasWidth, text);
+    setLayoutSnapshot_GmDocument(d, NULL); /* handed over to the job */
+    return iTrue;
+}
+
+iBool isLayoutPending_GmDocument(const iGmDocument *d) {
+    return d->layoutJob != NULL;
+}
+
+iBool finishLayout_GmDocument(iGmDocument *d) {
+    iGmLayoutJob *job = d->layoutJob;
+    if (!job || !isFinished_Job(job->job)) {
+        return iFalse;
+    }
+    /* Swap in the new contents. The runs point to the source, so these go together. The old
+       contents get deleted with the job. */
+    iGmDocument *doc = job->doc;
+    iSwap(iString,        d->unormSource,         doc->unormSource);
+    iSwap(iString,        d->source,              doc->source);
+    iSwap(iArray,         d->layout,              doc->layout);
+    iSwap(iArray,         d->runSpans,            doc->runSpans);
+    iSwap(iArray,         d->hitSpans,            doc->hitSpans);
+    iSwap(iArray,         d->links,               doc->links);
+    iSwap(size_t,         d->numReusableLinks,    doc->numReusableLinks);
+    iSwap(size_t,         d->linkCursor,          doc->linkCursor);
+    iSwap(iStringSet *,   d->openURLs,            doc->openURLs); /* as checked by `links` */
+    iSwap(iString,        d->title,               doc->title);
+    iSwap(iArray,         d->headings,            doc->headings);
+    iSwap(size_t,         d->headingsScanned,     doc->headingsScanned);
+    iSwap(iBool,          d->isHeadingScanPreformat, doc->isHeadingScanPreformat);
+    iSwap(iArray,         d->preMeta,             doc->preMeta);
+    iSwap(iGmNormState,   d->normState,           doc->normState);
+    iSwap(iGmLayoutState, d->layoutState,         doc->layoutState);
+    iSwap(iGmWrapCache,   d->wrapCache,           doc->wrapCache);
+    iSwap(iGmPreSizeCache, d->preSizes,           doc->preSizes);
+    d->format              = doc->format;
+    d->size                = doc->size;
+    d->isLayoutIncomplete  = doc->isLayoutIncomplete;
+    d->outsideMargin       = doc->outsideMargin;
+    d->isLayoutInvalidated = doc->isLayoutInvalidated;
+    d->warnings            = doc->warnings;
+    d->theme.ansiEscapes   = doc->theme.ansiEscapes;
+    truncate_GmFindIndex_(&d->findIndex, 0); /* offsets were into the old source */
+    scan_GmFindIndex_(&d->findIndex, &d->source);
+    d->layoutJob = NULL;
+    delete_GmLayoutJob_(job);
+    return iTrue;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static const int32_t layoutSnapshotVersion_GmDocument_ = 1;
+
+static uint32_t sourceHash_GmDocument_(const iGmDocument *d) {
+    return themeHash_(&d->source.chars); /* any checksum will do */
+}
+
+iBlock *layoutSnapshot_GmDocument(const iGmDocument *d) {
+    const iText *text = current_Text();
+    if (d->isHibernating) {
+        return d->layoutSnapshot ? copy_Block(d->layoutSnapshot) : NULL;
+    }
+    if (!text || isEmpty_Array(&d->wrapCache.blocks) ||
+        d->wrapCache.fontGeneration != fontGeneration_Text(text)) {
+        return NULL;
+    }
+    iBuffer *buf = new_Buffer();
+    openEmpty_Buffer(buf);
+    iStream *outs = stream_Buffer(buf);
+    write32_Stream(outs, layoutSnapshotVersion_GmDocument_);
+    writeU32_Stream(outs, metricsKey_Text(text));
+    writeU32_Stream(outs, sourceHash_GmDocument_(d));
+    write32_Stream(outs, d->wrapCache.ansiFlags);
+    writeU32_Stream(outs, size_Array(&d->wrapCache.blocks));
+    iConstForEach(Array, i, &d->wrapCache.blocks) {
+        const iGmWrapBlock *block = i.value;
+        writeU32_Stream(outs, block->offset);
+        writeU32_Stream(outs, block->length);
+        write32_Stream(outs, block->font);
+        write32_Stream(outs, block->maxWidth);
+        write8_Stream(outs, block->baseDir);
+        write8_Stream(outs, block->missingGlyphs);
+        writeU32_Stream(outs, block->numLines);
+        for (size_t n = 0; n < block->numLines; n++) {
+            const iGmWrapLine *line = constAt_Array(&d->wrapCache.lines, block->firstLine + n);
+            writeU32_Stream(outs, line->range.start);
+            writeU32_Stream(outs, line->range.end);
+            write16_Stream(outs, line->attrib.fgColorId);
+            write16_Stream(outs, line->attrib.bgColorId);
+            writeU16_Stream(outs, (line->attrib.bold      ? iBit(1) : 0) |
+                                  (line->attrib.italic    ? iBit(2) : 0) |
+                                  (line->attrib.monospace ? iBit(3) : 0) |
+                                  (line->attrib.isBaseRTL ? iBit(4) : 0) |
+                                  (line->attrib.isRTL     ? iBit(5) : 0));
+            write32_Stream(outs, line->origin);
+            write32_Stream(outs, line->advance);
+        }
+    }
+    iBlock *snapshot = copy_Block(data_Buffer(buf));
+    iRelease(buf);
+    return snapshot;
+}
+
+void setLayoutSnapshot_GmDocument(iGmDocument *d, const iBlock *snapshot) {
+    delete_Block(d->layoutSnapshot);
+    d->layoutSnapshot = snapshot ? copy_Block(snapshot) : NULL;
+}
+
+static void restoreLayoutSnapshot_GmDocument_(iGmDocument *d) {
+    /* The snapshot is in use only if everything that affects wrapping is unchanged. */
+    const iText *text = current_Text();
+    iBuffer *buf = new_Buffer();
+    open_Buffer(buf, d->layoutSnapshot);
+    iStream *ins = stream_Buffer(buf);
+    if (text && read32_Stream(ins) == layoutSnapshotVersion_GmDocument_ &&
+        readU32_Stream(ins) == metricsKey_Text(text) &&
+        readU32_Stream(ins) == sourceHash_GmDocument_(d)) {
+        iGmWrapCache *cache = &d->wrapCache;
+        const size_t  srcSize = size_String(&d->source);
+        clear_GmWrapCache_(cache);
+        cache->ansiFlags      = read32_Stream(ins);
+        cache->fontGeneration = fontGeneration_Text(text);
+        for (size_t count = readU32_Stream(ins); count && !atEnd_Buffer(buf); count--) {
+            iGmWrapBlock block = { 0 };
+            block.offset        = readU32_Stream(ins);
+            block.length        = readU32_Stream(ins);
+            block.font          = read32_Stream(ins);
+            block.maxWidth      = read32_Stream(ins);
+            block.baseDir       = (int8_t) read8_Stream(ins);
+            block.missingGlyphs = read8_Stream(ins) != 0;
+            block.numLines      = readU32_Stream(ins);
+            block.firstLine     = size_Array(&cache->lines);
+            for (size_t n = 0; n < block.numLines; n++) {
+                iGmWrapLine line;
+                iZap(line);
+                line.range.start      = readU32_Stream(ins);
+                line.range.end        = readU32_Stream(ins);
+                line.attrib.fgColorId = read16_Stream(ins);
+                line.attrib.bgColorId = read16_Stream(ins);
+                const uint16_t flags  = readU16_Stream(ins);
+                line.attrib.bold      = (flags & iBit(1)) != 0;
+                line.attrib.italic    = (flags & iBit(2)) != 0;
+                line.attrib.monospace = (flags & iBit(3)) != 0;
+                line.attrib.isBaseRTL = (flags & iBit(4)) != 0;
+                line.attrib.isRTL     = (flags & iBit(5)) != 0;
+                line.origin           = read32_Stream(ins);
+                line.advance          = read32_Stream(ins);
+                pushBack_Array(&cache->lines, &line);
+            }
+            if (block.offset + block.length > srcSize) {
+                clear_GmWrapCache_(cache); /* corrupt */
+                break;
+            }
+            pushBack_Array(&cache->blocks, &block);
+        }
+    }
+    iRelease(buf);
+    delete_Block(d->layoutSnapshot);
+    d->layoutSnapshot = NULL;
+}
+
 void foldPre_GmDocument(iGmDocument *d, uint16_t preId) {
     if (preId > 0 && preId <= size_Array(&d->preMeta)) {
         iGmPreMeta *meta = at_Array(&d->preMeta, preId - 1);
@@ -2141,19 +3723,38 @@ void foldPre_GmDocument(iGmDocument *d, uint16_t preId) {
     }
 }
 
-void updateVisitedLinks_GmDocument(iGmDocument *d) {
+void updateVisitedLinks_GmDocument(iGmDocument *d, iIntSet *changedLinks) {
     iIntSet linkIds;
     init_IntSet(&linkIds);
-    iForEach(PtrArray, i, &d->links) {
-        iGmLink *link = i.ptr;
+    /* Look up all the unvisited links at once. */
+    const size_t numLinks = size_Array(&d->links);
+    uint64_t *hashes = malloc(sizeof(uint64_t) * iMax(1, numLinks));
+    size_t *indices = malloc(sizeof(size_t) * iMax(1, numLinks));
+    size_t count = 0;
+    iConstForEach(Array, i, &d->links) {
+        const iGmLink *link = i.value;
         if (~link->flags & visited_GmLinkFlag) {
-            iTime visitTime = urlVisitTime_Visited(visited_App(), &link->url);
-            if (isValid_Time(&visitTime)) {
-                link->flags |= visited_GmLinkFlag;
-                insert_IntSet(&linkIds, index_PtrArrayIterator(&i) + 1);
+            hashes[count]  = link->urlHash;
+            indices[count] = index_ArrayConstIterator(&i);
+            count++;
+        }
+    }
+    iTime *visitTimes = malloc(sizeof(iTime) * iMax(1, count));
+    urlHashVisitTimes_Visited(visited_App(), count, hashes, visitTimes);
+    for (size_t n = 0; n < count; n++) {
+        if (isValid_Time(&visitTimes[n])) {
+            iGmLink *link = at_Array(&d->links, indices[n]);
+            link->flags |= visited_GmLinkFlag;
+            updateColors_GmLink_(link);
+            insert_IntSet(&linkIds, indices[n] + 1);
+            if (changedLinks) {
+                insert_IntSet(changedLinks, indices[n] + 1);
             }
         }
     }
+    free(visitTimes);
+    free(indices);
+    free(hashes);
     markLinkRunsVisited_GmDocument_(d, &linkIds);
     deinit_IntSet(&linkIds);
 }
@@ -2167,21 +3768,12 @@ const iGmPreMeta *preMeta_GmDocument(const iGmDocument *d, uint16_t preId) {
 
 void render_GmDocument(const iGmDocument *d, iRangei visRangeY, iGmDocumentRenderFunc render,
                        void *context) {
-    iBool isInside = iFalse;
+    const iGmRun *runs    = constData_Array(&d->layout);
+    const size_t  numRuns = size_Array(&d->runSpans);
+    size_t        i       = firstVisibleRun_GmDocument_(d, visRangeY.start);
     setAnsiFlags_Text(d->theme.ansiEscapes);
-    /* TODO: Check lookup table for quick starting position. */
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
-        if (isInside) {
-            if (top_Rect(run->visBounds) > visRangeY.end) {
-                break;
-            }
-            render(context, run);
-        }
-        else if (bottom_Rect(run->visBounds) >= visRangeY.start) {
-            isInside = iTrue;
-            render(context, run);
-        }
+    for (; i < numRuns && top_Rect(runs[i].visBounds) <= visRangeY.end; i++) {
+        render(context, runs + i);
     }
     setAnsiFlags_Text(allowAll_AnsiFlag);
 }
@@ -2198,27 +3790,40 @@ const iGmRun *renderProgressive_GmDocument(const iGmDocument *d, const iGmRun *f
                                            size_t maxCount,
                                            iRangei visRangeY, iGmDocumentRenderFunc render,
                                            void *context) {
+    if (!isValidRun_GmDocument_(d, first)) {
+        return NULL;
+    }
+    const iGmRun *runs  = constData_Array(&d->layout);
+    const size_t  num   = size_Array(&d->runSpans);
+    size_t        index = first - runs;
     setAnsiFlags_Text(d->theme.ansiEscapes);
-    const iGmRun *run = first;
-    while (isValidRun_GmDocument_(d, run)) {
-        if ((dir < 0 && bottom_Rect(run->visBounds) < visRangeY.start) ||
-            (dir > 0 && top_Rect(run->visBounds) >= visRangeY.end)) {
+    while (index < num) { /* wraps around when going past the first run */
+        if ((dir < 0 && bottom_Rect(runs[index].visBounds) < visRangeY.start) ||
+            (dir > 0 && top_Rect(runs[index].visBounds) >= visRangeY.end)) {
             break;
         }
         if (maxCount-- == 0) {
             break;
         }
-        render(context, run);
-        run += dir;
+        render(context, runs + index);
+        index += dir;
     }
     setAnsiFlags_Text(allowAll_AnsiFlag);
-    return isValidRun_GmDocument_(d, run) ? run : NULL;
+    return index < num ? runs + index : NULL;
 }
 
 iInt2 size_GmDocument(const iGmDocument *d) {
     return d->size;
 }
 
+size_t numRuns_GmDocument(const iGmDocument *d) {
+    return size_Array(&d->layout);
+}
+
+const iGmRun *run_GmDocument(const iGmDocument *d, size_t index) {
+    return constAt_Array(&d->layout, index);
+}
+
 #if 0
 enum iGmDocumentBanner bannerType_GmDocument(const iGmDocument *d) {
     return d->bannerType;
@@ -2245,6 +3850,7 @@ const iString *bannerText_GmDocument(const iGmDocument *d) {
 #endif
 
 const iArray *headings_GmDocument(const iGmDocument *d) {
+    updateHeadings_GmDocument_(iConstCast(iGmDocument *, d));
     return &d->headings;
 }
 
@@ -2253,9 +3859,18 @@ const iString *source_GmDocument(const iGmDocument *d) {
 }
 
 size_t memorySize_GmDocument(const iGmDocument *d) {
-    return size_String(&d->unormSource) +
+    /* The unnormalized source usually shares its data with the normalized one. */
+    const iBool isSourceShared =
+        constData_Block(&d->unormSource.chars) == constData_Block(&d->source.chars);
+    return (isSourceShared ? 0 : size_String(&d->unormSource)) +
            size_String(&d->source) +
            size_Array(&d->layout) * sizeof(iGmRun) +
+           size_Array(&d->runSpans) * sizeof(iGmRunSpan) +
+           size_Array(&d->hitSpans) * sizeof(iGmHitSpan) +
+           size_Array(&d->wrapCache.blocks) * sizeof(iGmWrapBlock) +
+           size_Array(&d->wrapCache.lines) * sizeof(iGmWrapLine) +
+           size_SortedArray(&d->preSizes.sizes) * sizeof(iGmPreSize) +
+           size_Array(&d->findIndex.offsets) * sizeof(uint32_t) +
            size_Array(&d->links)  * sizeof(iGmLink) +
            memorySize_Media(d->media);
 }
@@ -2264,28 +3879,67 @@ int warnings_GmDocument(const iGmDocument *d) {
     return d->warnings;
 }
 
-iRangecc findText_GmDocument(const iGmDocument *d, const iString *text, const char *start) {
-    const char * src      = constBegin_String(&d->source);
-    const size_t startPos = (start ? start - src : 0);
-    const size_t pos =
-        indexOfCStrFromSc_String(&d->source, cstr_String(text), startPos, &iCaseInsensitive);
-    if (pos == iInvalidPos) {
+void setFindText_GmDocument(iGmDocument *d, const iString *text) {
+    setQuery_GmFindIndex_(&d->findIndex, &d->source, text);
+    scan_GmFindIndex_(&d->findIndex, &d->source);
+}
+
+static iRangecc foundRange_GmDocument_(const iGmDocument *d, const iGmFindIndex *index,
+                                       size_t pos) {
+    const char *start =
+        constBegin_String(&d->source) + constValue_Array(&index->offsets, pos, uint32_t);
+    return (iRangecc){ start, start + size_String(&index->query) };
+}
+
+iRangecc findText_GmDocument(const iGmDocument *d, const char *start) {
+    const iGmFindIndex *index = &d->findIndex;
+    const size_t        pos   = lowerBound_GmFindIndex_(
+        index, start ? start - constBegin_String(&d->source) : 0);
+    if (pos == size_Array(&index->offsets)) {
         return iNullRange;
     }
-    return (iRangecc){ src + pos, src + pos + size_String(text) };
+    return foundRange_GmDocument_(d, index, pos);
 }
 
-iRangecc findTextBefore_GmDocument(const iGmDocument *d, const iString *text, const char *before) {
-    iRangecc found = iNullRange;
-    const char *start = constBegin_String(&d->source);
+iRangecc findTextBefore_GmDocument(const iGmDocument *d, const char *before) {
+    const iGmFindIndex *index = &d->findIndex;
     if (!before) before = constEnd_String(&d->source);
-    while (start < before) {
-        iRangecc range = findText_GmDocument(d, text, start);
-        if (range.start == NULL || range.start >= before) break;
-        found = range;
-        start = range.end;
+    const size_t pos = lowerBound_GmFindIndex_(index, before - constBegin_String(&d->source));
+    if (pos == 0) {
+        return iNullRange;
+    }
+    return foundRange_GmDocument_(d, index, pos - 1);
+}
+
+size_t numFound_GmDocument(const iGmDocument *d) {
+    return size_Array(&d->findIndex.offsets);
+}
+
+size_t foundOrdinal_GmDocument(const iGmDocument *d, const char *loc) {
+    const iGmFindIndex *index = &d->findIndex;
+    const size_t        offset = loc - constBegin_String(&d->source);
+    const size_t        pos    = lowerBound_GmFindIndex_(index, offset);
+    if (pos < size_Array(&index->offsets) &&
+        constValue_Array(&index->offsets, pos, uint32_t) == offset) {
+        return pos;
+    }
+    return iInvalidPos;
+}
+
+void foundInRange_GmDocument(const iGmDocument *d, iRangecc range, iGmDocumentFoundFunc func,
+                             void *context) {
+    const iGmFindIndex *index = &d->findIndex;
+    const size_t        len   = size_String(&index->query);
+    const size_t        start = range.start - constBegin_String(&d->source);
+    /* Matches have the same length, so the ones overlapping the range are consecutive. */
+    for (size_t pos = lowerBound_GmFindIndex_(index, start >= len ? start - len + 1 : 0);
+         pos < size_Array(&index->offsets); pos++) {
+        const iRangecc found = foundRange_GmDocument_(d, index, pos);
+        if (found.start >= range.end) {
+            break;
+        }
+        func(context, found);
     }
-    return found;
 }
 
 iGmRunRange findPreformattedRange_GmDocument(const iGmDocument *d, const iGmRun *run) {
@@ -2306,30 +3960,42 @@ iGmRunRange findPreformattedRange_GmDocument(const iGmDocument *d, const iGmRun
 }
 
 const iGmRun *findRun_GmDocument(const iGmDocument *d, iInt2 pos) {
-    /* TODO: Perf optimization likely needed; use a block map? */
-    const iGmRun *last = NULL;
-    iBool isFirstNonDecoration = iTrue;
-    iConstForEach(Array, i, &d->layout) {
-        const iGmRun *run = i.value;
-        if (run->flags & decoration_GmRunFlag) continue;
-        const iRangei span = ySpan_Rect(run->bounds);
-        if (contains_Range(&span, pos.y)) {
-            last = run;
-            break;
+    /* The result is the first non-decoration run that contains the point, when all runs
+       before it start above the point. Otherwise, it is the last run that starts above the
+       point, or the first run if the point is above everything. */
+    const iGmHitSpan *spans = constData_Array(&d->hitSpans);
+    const size_t      num   = size_Array(&d->hitSpans);
+    if (num == 0) {
+        return NULL;
+    }
+    /* Entries before `below` start at or above the point. */
+    size_t first = 0, last = num;
+    while (first < last) {
+        const size_t mid = (first + last) / 2;
+        if (spans[mid].maxTop <= pos.y) {
+            first = mid + 1;
         }
-        if (isFirstNonDecoration && pos.y < top_Rect(run->bounds)) {
-            last = run;
-            break;
+        else {
+            last = mid;
         }
-        if (top_Rect(run->bounds) > pos.y) break; /* Below the point. */
-        last = run;
-        isFirstNonDecoration = iFalse;
     }
-//    if (last) {
-//        printf("found run at (%d,%d): %p [%s]\n", pos.x, pos.y, last, cstr_Rangecc(last->text));
-//        fflush(stdout);
-//    }
-    return last;
+    const size_t below = first;
+    if (below == 0) {
+        return constAt_Array(&d->layout, spans[0].run);
+    }
+    /* The first of those that extends below the point contains it. */
+    first = 0;
+    last  = below;
+    while (first < last) {
+        const size_t mid = (first + last) / 2;
+        if (spans[mid].maxBottom <= pos.y) {
+            first = mid + 1;
+        }
+        else {
+            last = mid;
+        }
+    }
+    return constAt_Array(&d->layout, spans[first < below ? first : below - 1].run);
 }
 
 iRangecc findLoc_GmDocument(const iGmDocument *d, iInt2 pos) {
@@ -2354,8 +4020,8 @@ const iGmRun *findRunAtLoc_GmDocument(const iGmDocument *d, const char *textCStr
 }
 
 static const iGmLink *link_GmDocument_(const iGmDocument *d, iGmLinkId id) {
-    if (id > 0 && id <= size_PtrArray(&d->links)) {
-        return constAt_PtrArray(&d->links, id - 1);
+    if (id > 0 && id <= size_Array(&d->links)) {
+        return constAt_Array(&d->links, id - 1);
     }
     return NULL;
 }
@@ -2396,71 +4062,13 @@ iMediaId linkAudio_GmDocument(const iGmDocument *d, iGmLinkId linkId) {
     return findLinkAudio_Media(d->media, linkId);
 }
 
-iLocalDef iBool isWWW_GmLinkScheme(enum iGmLinkScheme d) {
-    return d == http_GmLinkScheme || d == mailto_GmLinkScheme;
-}
-
-iLocalDef iBool isOldSchool_GmLinkScheme(enum iGmLinkScheme d) {
-    return d == gopher_GmLinkScheme || d == finger_GmLinkScheme;
-}
-
 enum iColorId linkColor_GmDocument(const iGmDocument *d, iGmLinkId linkId, enum iGmLinkPart part) {
     const iGmLink *link = link_GmDocument_(d, linkId);
-    if (!link) {
-        return none_ColorId;
-    }
-//    const int www_GmLinkFlag            = http_GmLinkFlag | mailto_GmLinkFlag;
-//    const int gopherOrFinger_GmLinkFlag = gopher_GmLinkFlag | finger_GmLinkFlag;
-    const enum iGmLinkScheme scheme = scheme_GmLinkFlag(link->flags);
-    if (link) {
-        const iBool isUnsupported = (link->flags & supportedScheme_GmLinkFlag) == 0;
-        if (part == icon_GmLinkPart) {
-            if (isUnsupported) {
-                return tmBadLink_ColorId;
-            }
-            if (scheme != mailto_GmLinkScheme && link->flags & iconFromLabel_GmLinkFlag) {
-                return link->flags & visited_GmLinkFlag ? tmLinkCustomIconVisited_ColorId
-                                                        : tmLinkIcon_ColorId;
-            }
-            if (link->flags & visited_GmLinkFlag) {
-                return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkIconVisited_ColorId
-                       : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkIconVisited_ColorId
-                                                          : tmLinkIconVisited_ColorId;
-            }
-            return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkIcon_ColorId
-                   : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkIcon_ColorId
-                                                      : tmLinkIcon_ColorId;
-        }
-        if (part == text_GmLinkPart) {
-            return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkText_ColorId
-                   : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkText_ColorId
-                                                      : tmLinkText_ColorId;
-        }
-        if (part == textHover_GmLinkPart) {
-            return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkTextHover_ColorId
-                   : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkTextHover_ColorId
-                                                      : tmLinkTextHover_ColorId;
-        }
-        if (part == domain_GmLinkPart) {
-            if (isUnsupported) {
-                return tmBadLink_ColorId;
-            }
-            return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkDomain_ColorId
-                   : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkDomain_ColorId
-                                                      : tmLinkDomain_ColorId;
-        }
-        if (part == visited_GmLinkPart) {
-            return isWWW_GmLinkScheme(scheme)         ? tmHypertextLinkLastVisitDate_ColorId
-                   : isOldSchool_GmLinkScheme(scheme) ? tmGopherLinkLastVisitDate_ColorId
-                                                      : tmLinkLastVisitDate_ColorId;
-        }
-    }
-    return tmLinkText_ColorId;
+    return link ? link->colors[part] : none_ColorId;
 }
 
 iBool isMediaLink_GmDocument(const iGmDocument *d, iGmLinkId linkId) {
-    const iString *dstUrl = absoluteUrl_String(&d->url, linkUrl_GmDocument(d, linkId));
-    const iRangecc scheme = urlScheme_String(dstUrl);
+    const iRangecc scheme = urlScheme_String(linkUrl_GmDocument(d, linkId));
     if (equalCase_Rangecc(scheme, "gemini") || equalCase_Rangecc(scheme, "gopher") ||
         equalCase_Rangecc(scheme, "finger") ||
         equalCase_Rangecc(scheme, "file") || willUseProxy_App(scheme)) {
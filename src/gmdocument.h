@@ -27,6 +27,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "media.h"
 
 #include <the_Foundation/array.h>
+#include <the_Foundation/intset.h>
 #include <the_Foundation/object.h>
 #include <the_Foundation/rect.h>
 #include <the_Foundation/string.h>
@@ -35,6 +36,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 iDeclareType(GmHeading)
 iDeclareType(GmPreMeta)
 iDeclareType(GmRun)
+iDeclareType(Text)
 
 enum iGmLineType {
     text_GmLineType,
@@ -186,17 +188,42 @@ void    setWidth_GmDocument     (iGmDocument *, int width, int canvasWidth);
 iBool   updateWidth_GmDocument  (iGmDocument *, int width, int canvasWidth);
 void    redoLayout_GmDocument   (iGmDocument *);
 void    invalidateLayout_GmDocument(iGmDocument *); /* will have to be redone later */
-iBool   updateOpenURLs_GmDocument(iGmDocument *);
+iBool   hibernate_GmDocument    (iGmDocument *); /* release runs until the next layout */
+iBool   isHibernating_GmDocument(const iGmDocument *);
+
+/* Huge documents are laid out lazily: only the part above the layout limit is laid out, and
+   the rest of the height is estimated from the number of remaining lines. */
+iBool   isLayoutComplete_GmDocument (const iGmDocument *);
+int     layoutHeight_GmDocument     (const iGmDocument *); /* height that is not estimated */
+iBool   extendLayout_GmDocument     (iGmDocument *, int minHeight); /* also limits new layouts */
+iBool   continueLayout_GmDocument   (iGmDocument *, int extraHeight); /* zero: everything */
+iBool   layoutUntil_GmDocument      (iGmDocument *, const char *loc, int extraHeight);
+iBool   updateOpenURLs_GmDocument(iGmDocument *, iIntSet *changedLinks); /* optional output */
 void    setUrl_GmDocument       (iGmDocument *, const iString *url);
 void    setSource_GmDocument    (iGmDocument *, const iString *source, int width, int canvasWidth,
                                  enum iGmDocumentUpdate updateType);
 void    foldPre_GmDocument      (iGmDocument *, uint16_t preId);
 
-void    updateVisitedLinks_GmDocument   (iGmDocument *); /* check all links for visited status */
+/* Background layout: the current layout remains valid and can be drawn until the finished
+   layout is swapped in with `finishLayout_GmDocument`. A "document.layout.finished doc:%p"
+   command is posted when that can be done. */
+iBool   setSourceInBackground_GmDocument(iGmDocument *, const iString *source, int width,
+                                         int canvasWidth, iText *text); /* false: done already */
+iBool   isLayoutPending_GmDocument      (const iGmDocument *);
+iBool   finishLayout_GmDocument         (iGmDocument *); /* returns true if layout was changed */
+
+/* Layout snapshots contain the wrapped lines of the paragraphs, so a layout can be restored
+   later (also in another session) without measuring the text again. A snapshot is only used
+   if the source, fonts, and sizes are the same. */
+iBlock *layoutSnapshot_GmDocument       (const iGmDocument *); /* NULL if there is no layout */
+void    setLayoutSnapshot_GmDocument    (iGmDocument *, const iBlock *snapshot); /* for next `setSource` */
+
+void    updateVisitedLinks_GmDocument   (iGmDocument *, iIntSet *changedLinks); /* check all links for visited status */
 void    invalidatePalette_GmDocument    (iGmDocument *);
 void    makePaletteGlobal_GmDocument    (const iGmDocument *); /* copies document colors to the global palette */
 
 typedef void (*iGmDocumentRenderFunc)(void *, const iGmRun *);
+typedef void (*iGmDocumentFoundFunc)(void *, iRangecc);
 
 iMedia *        media_GmDocument            (iGmDocument *);
 const iMedia *  constMedia_GmDocument       (const iGmDocument *);
@@ -209,13 +236,20 @@ const iGmRun *  renderProgressive_GmDocument(const iGmDocument *d, const iGmRun
                                              iRangei visRangeY, iGmDocumentRenderFunc render,
                                              void *context);
 iInt2           size_GmDocument             (const iGmDocument *);
+size_t          numRuns_GmDocument          (const iGmDocument *);
+const iGmRun *  run_GmDocument              (const iGmDocument *, size_t index);
 const iArray *  headings_GmDocument         (const iGmDocument *); /* array of GmHeadings */
 const iString * source_GmDocument           (const iGmDocument *);
 size_t          memorySize_GmDocument       (const iGmDocument *); /* bytes */
 int             warnings_GmDocument         (const iGmDocument *);
 
-iRangecc        findText_GmDocument                 (const iGmDocument *, const iString *text, const char *start);
-iRangecc        findTextBefore_GmDocument           (const iGmDocument *, const iString *text, const char *before);
+void            setFindText_GmDocument              (iGmDocument *, const iString *text);
+iRangecc        findText_GmDocument                 (const iGmDocument *, const char *start);
+iRangecc        findTextBefore_GmDocument           (const iGmDocument *, const char *before);
+size_t          numFound_GmDocument                 (const iGmDocument *);
+size_t          foundOrdinal_GmDocument             (const iGmDocument *, const char *loc);
+void            foundInRange_GmDocument             (const iGmDocument *, iRangecc range,
+                                                     iGmDocumentFoundFunc func, void *context);
 iGmRunRange     findPreformattedRange_GmDocument    (const iGmDocument *, const iGmRun *run);
 
 int             ansiEscapes_GmDocument              (const iGmDocument *);
@@ -228,12 +262,13 @@ enum iGmLinkPart {
     textHover_GmLinkPart,
     domain_GmLinkPart,
     visited_GmLinkPart,
+    max_GmLinkPart
 };
 
 const iGmRun *  findRun_GmDocument      (const iGmDocument *, iInt2 pos);
 iRangecc        findLoc_GmDocument      (const iGmDocument *, iInt2 pos);
 const iGmRun *  findRunAtLoc_GmDocument (const iGmDocument *, const char *loc);
-const iString * linkUrl_GmDocument      (const iGmDocument *, iGmLinkId linkId);
+const iString * linkUrl_GmDocument      (const iGmDocument *, iGmLinkId linkId); /* absolute, canonical */
 iRangecc        linkUrlRange_GmDocument (const iGmDocument *, iGmLinkId linkId);
 iRangecc        linkLabel_GmDocument    (const iGmDocument *, iGmLinkId linkId);
 iMediaId        linkImage_GmDocument    (const iGmDocument *, iGmLinkId linkId);
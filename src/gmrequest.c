@@ -25,7 +25,11 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "gmcerts.h"
 #include "gopher.h"
 #include "app.h" /* dataDir_App() */
+#include "archivecache.h"
 #include "mimehooks.h"
+#include "mirror.h"
+#include "profiler.h"
+#include "resolver.h"
 #include "feeds.h"
 #include "bookmarks.h"
 #include "ui/text.h"
@@ -42,6 +46,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/tlsrequest.h>
 
 #include <SDL_timer.h>
+#include <ctype.h>
 
 iDefineTypeConstruction(GmResponse)
 
@@ -54,6 +59,7 @@ void init_GmResponse(iGmResponse *d) {
     iZap(d->certValidUntil);
     init_String(&d->certSubject);
     iZap(d->when);
+    iZap(d->timing);
 }
 
 void initCopy_GmResponse(iGmResponse *d, const iGmResponse *other) {
@@ -65,6 +71,7 @@ void initCopy_GmResponse(iGmResponse *d, const iGmResponse *other) {
     d->certValidUntil = other->certValidUntil;
     initCopy_String(&d->certSubject, &other->certSubject);
     d->when = other->when;
+    d->timing = other->timing;
 }
 
 void deinit_GmResponse(iGmResponse *d) {
@@ -83,6 +90,7 @@ void clear_GmResponse(iGmResponse *d) {
     iZap(d->certValidUntil);
     clear_String(&d->certSubject);
     iZap(d->when);
+    iZap(d->timing);
 }
 
 iGmResponse *copy_GmResponse(const iGmResponse *d) {
@@ -91,21 +99,64 @@ iGmResponse *copy_GmResponse(const iGmResponse *d) {
     return copied;
 }
 
+static const size_t minCompressedSize_GmResponse_ = 1024;
+
+iBool isCompressible_GmResponse(const iGmResponse *d) {
+    /* Text compresses well; media formats are already compressed. */
+#if defined (iHaveZlib)
+    return size_Block(&d->body) >= minCompressedSize_GmResponse_ &&
+           startsWithCase_String(&d->meta, "text/");
+#else
+    iUnused(d);
+    return iFalse;
+#endif
+}
+
 void serialize_GmResponse(const iGmResponse *d, iStream *outs) {
     write32_Stream(outs, d->statusCode);
     serialize_String(&d->meta, outs);
-    serialize_Block(&d->body, outs);
+    /* Body, compressed if worthwhile. */ {
+        iBlock *compressed = NULL;
+#if defined (iHaveZlib)
+        if (isCompressible_GmResponse(d)) {
+            compressed = compress_Block(&d->body);
+            if (size_Block(compressed) >= size_Block(&d->body) * 9 / 10) {
+                delete_Block(compressed);
+                compressed = NULL;
+            }
+        }
+#endif
+        write8_Stream(outs, compressed ? 1 : 0);
+        serialize_Block(compressed ? compressed : &d->body, outs);
+        delete_Block(compressed);
+    }
     /* TODO: Add certificate fingerprint, but need to bump file version first. */
     write32_Stream(outs, d->certFlags & ~haveFingerprint_GmCertFlag);
     serialize_Date(&d->certValidUntil, outs);
     serialize_String(&d->certSubject, outs);
     writeU64_Stream(outs, d->when.ts.tv_sec);
+    writeU32_Stream(outs, d->timing.connected);
+    writeU32_Stream(outs, d->timing.firstByte);
+    writeU32_Stream(outs, d->timing.header);
+    writeU32_Stream(outs, d->timing.finished);
+    writeU64_Stream(outs, d->timing.numBytes);
 }
 
 void deserialize_GmResponse(iGmResponse *d, iStream *ins) {
     d->statusCode = read32_Stream(ins);
     deserialize_String(&d->meta, ins);
+    const iBool isCompressed =
+        version_Stream(ins) >= compressedResponses_FileVersion ? read8_Stream(ins) != 0 : iFalse;
     deserialize_Block(&d->body, ins);
+    if (isCompressed) {
+#if defined (iHaveZlib)
+        iBlock *body = decompress_Block(&d->body);
+        set_Block(&d->body, body);
+        delete_Block(body);
+#else
+        clear_Block(&d->body); /* can't be used */
+#endif
+    }
     d->certFlags = read32_Stream(ins);
     deserialize_Date(&d->certValidUntil, ins);
     deserialize_String(&d->certSubject, ins);
@@ -114,33 +165,78 @@ void deserialize_GmResponse(iGmResponse *d, iStream *ins) {
     if (version_Stream(ins) >= addedResponseTimestamps_FileVersion) {
         d->when.ts.tv_sec = readU64_Stream(ins);
     }
+    iZap(d->timing);
+    if (version_Stream(ins) >= addedResponseTimings_FileVersion) {
+        d->timing.connected = readU32_Stream(ins);
+        d->timing.firstByte = readU32_Stream(ins);
+        d->timing.header    = readU32_Stream(ins);
+        d->timing.finished  = readU32_Stream(ins);
+        d->timing.numBytes  = readU64_Stream(ins);
+    }
 }
 
 /*----------------------------------------------------------------------------------------------*/
 
 iDeclareType(TitanData)
 iDeclareTypeConstruction(TitanData)
+
+static const size_t titanReadChunkSize_GmRequest_ = 256 * 1024;
     
 struct Impl_TitanData {
     iBlock  data;
+    iFile * file; /* if set, the payload is read from here instead of `data` */
     iString mime;
     iString token;
+    size_t  headerSize; /* excluded from the reported upload progress */
 };
 
 iDefineTypeConstruction(TitanData)
 
 void init_TitanData(iTitanData *d) {
     init_Block(&d->data, 0);
+    d->file = NULL;
     init_String(&d->mime);
     init_String(&d->token);
+    d->headerSize = 0;
 }
 
 void deinit_TitanData(iTitanData *d) {
     deinit_String(&d->token);
     deinit_String(&d->mime);
+    iRelease(d->file);
     deinit_Block(&d->data);
 }
 
+static size_t payloadSize_TitanData_(const iTitanData *d) {
+    return d->file ? fileSize_FileInfo(path_File(d->file)) : size_Block(&d->data);
+}
+
+static iBool appendPayload_TitanData_(iTitanData *d, iBlock *content, size_t size) {
+    /* Returns False if `size` bytes could not be read, for example because the file was
+       truncated after its size was written in the header. */
+    if (!d->file) {
+        append_Block(content, &d->data);
+        return iTrue;
+    }
+    /* The file is read directly into the request content so there is only one copy of it
+       in memory. */
+    size_t total = 0;
+    reserve_Block(content, size_Block(content) + size);
+    char *chunk = malloc(titanReadChunkSize_GmRequest_);
+    while (total < size) {
+        const size_t num = readData_File(d->file, iMin(size - total, titanReadChunkSize_GmRequest_),
+                                         chunk);
+        if (num == 0) {
+            break;
+        }
+        appendData_Block(content, chunk, num);
+        total += num;
+    }
+    free(chunk);
+    iReleasePtr(&d->file);
+    return total == size;
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 static iAtomicInt idGen_;
@@ -165,24 +261,105 @@ struct Impl_GmRequest {
     iTlsRequest *        req;
     iGopher              gopher;
     iGmResponse *        resp;
+    iPtrArray            bodyChunks; /* received but not yet joined to resp->body */
+    size_t               chunksSize;
+    iFile *              downloadFile; /* body is written here instead of kept in memory */
+    size_t               downloadSize; /* bytes written to `downloadFile` */
+    size_t               takenSize;    /* bytes removed from the body by `takeBody_GmRequest()` */
     iBool                isFilterEnabled;
+    iBool                isBuiltInFilterEnabled;
     iBool                isRespLocked;
     iBool                isRespFiltered;
+    iFilterStream *      filterStream; /* streaming hook that produces the response */
     iAtomicInt           allowUpdate;
     iAudience *          updated;
     iAudience *          finished;
     iGmRequestProgressFunc sendProgress;
+    uint32_t             startTime; /* SDL ticks */
 };
 
 iDefineObjectConstructionArgs(GmRequest, (iGmCerts *certs), certs)
 iDefineAudienceGetter(GmRequest, updated)
 iDefineAudienceGetter(GmRequest, finished)
     
+static uint32_t elapsed_GmRequest_(const iGmRequest *d) {
+    return iMax(1u, SDL_GetTicks() - d->startTime); /* zero means "not yet" */
+}
+
+static void recordTiming_GmRequest_(const iGmRequest *d);
+#if defined (LAGRANGE_ENABLE_TLS_SESSION_CACHE)
+static iBool isSessionChanged_GmRequest_(const iString *host, uint16_t port,
+                                         const iGmIdentity *identity);
+#endif
+
+static void flushBody_GmRequest_(iGmRequest *d) {
+    /* Received data is kept as a list of chunks and only joined into the contiguous body
+       when someone actually looks at it, so the body grows once per access instead of once
+       per read. Must be called with `mtx` locked. */
+    if (isEmpty_PtrArray(&d->bodyChunks)) {
+        return;
+    }
+    iBlock *body = &d->resp->body;
+    reserve_Block(body, size_Block(body) + d->chunksSize);
+    iForEach(PtrArray, i, &d->bodyChunks) {
+        append_Block(body, i.ptr);
+        delete_Block(i.ptr);
+    }
+    clear_PtrArray(&d->bodyChunks);
+    d->chunksSize = 0;
+}
+
+static void writeDownload_GmRequest_(iGmRequest *d) {
+    /* Must be called with `mtx` locked. */
+    iAssert(d->downloadFile);
+    iBlock *body = &d->resp->body;
+    if (!isEmpty_Block(body)) {
+        writeData_File(d->downloadFile, constData_Block(body), size_Block(body));
+        d->downloadSize += size_Block(body);
+        clear_Block(body);
+    }
+    iForEach(PtrArray, i, &d->bodyChunks) {
+        writeData_File(d->downloadFile, constData_Block(i.ptr), size_Block(i.ptr));
+        delete_Block(i.ptr);
+    }
+    clear_PtrArray(&d->bodyChunks);
+    d->downloadSize += d->chunksSize;
+    d->chunksSize = 0;
+}
+
+static void clearBody_GmRequest_(iGmRequest *d) {
+    iForEach(PtrArray, i, &d->bodyChunks) {
+        delete_Block(i.ptr);
+    }
+    clear_PtrArray(&d->bodyChunks);
+    d->chunksSize = 0;
+    clear_Block(&d->resp->body);
+}
+
+static iBool useMirror_GmRequest_(iGmRequest *d) {
+    /* Without a network connection, a saved copy is better than an error.
+       Must be called with `mtx` locked. */
+    iGmResponse *mirrored = load_Mirror(&d->url);
+    if (!mirrored) {
+        return iFalse;
+    }
+    clearBody_GmRequest_(d);
+    d->resp->statusCode = mirrored->statusCode;
+    set_String(&d->resp->meta, &mirrored->meta);
+    set_Block(&d->resp->body, &mirrored->body);
+    d->resp->when = mirrored->when;
+    d->resp->certFlags = mirrored_GmCertFlag;
+    d->state = finished_GmRequestState;
+    delete_GmResponse(mirrored);
+    return iTrue;
+}
+
 static uint16_t port_GmRequest_(iGmRequest *d) {
     return urlPort_String(&d->url);
 }
     
 static void checkServerCertificate_GmRequest_(iGmRequest *d) {
+    /* Resumed TLS sessions keep the peer certificate, so it gets checked every time. */
     const iTlsCertificate *cert = d->req ? serverCertificate_TlsRequest(d->req) : NULL;
     iGmResponse *resp = d->resp;
     resp->certFlags = 0;
@@ -208,34 +385,70 @@ static void checkServerCertificate_GmRequest_(iGmRequest *d) {
     }
 }
 
+static const size_t maxMetaSize_GmRequest_ = 1024;
+
+static void appendBody_GmRequest_(iGmRequest *d, const iBlock *data, size_t offset) {
+    /* Must be called with `mtx` locked. */
+    const size_t size = size_Block(data) - offset;
+    if (size == 0) {
+        return;
+    }
+    if (d->downloadFile) {
+        writeData_File(d->downloadFile, constBegin_Block(data) + offset, size);
+        d->downloadSize += size;
+        return;
+    }
+    pushBack_PtrArray(&d->bodyChunks,
+                      offset == 0 ? copy_Block(data) /* shares the data */
+                                  : newData_Block(constBegin_Block(data) + offset, size));
+    d->chunksSize += size;
+}
+
+static int parseStatusCode_GmRequest_(iString *line) {
+    /* The line is expected to be "<2-digit code>[<space><meta>]". The code is removed so only
+       the meta is left. Returns zero if the line isn't valid. */
+    const char *start = constBegin_String(line);
+    const size_t size = size_String(line);
+    if (size < 2 || !isdigit((unsigned char) start[0]) || !isdigit((unsigned char) start[1])) {
+        return 0;
+    }
+    const int code = (start[0] - '0') * 10 + (start[1] - '0');
+    size_t metaPos = 2;
+    while (metaPos < size && isspace((unsigned char) start[metaPos])) {
+        metaPos++;
+    }
+    if (size - metaPos > maxMetaSize_GmRequest_) {
+        return 0;
+    }
+    remove_Block(&line->chars, 0, metaPos);
+    return code;
+}
+
+static int processFilteredData_GmRequest_(iGmRequest *d, const iBlock *data);
+
 static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
     iBool        notifyUpdate = iFalse;
     iBool        notifyDone   = iFalse;
     iGmResponse *resp         = d->resp;
     if (d->state == receivingHeader_GmRequestState) {
-        appendCStrN_String(&resp->meta, constData_Block(data), size_Block(data));
-        /* Check if the header line is complete. */
-        size_t endPos = indexOfCStr_String(&resp->meta, "\r\n");
-        if (endPos != iInvalidPos) {
-            /* Move remainder to the body. */
-            setData_Block(&resp->body,
-                          constBegin_String(&resp->meta) + endPos + 2,
-                          size_String(&resp->meta) - endPos - 2);
-            remove_Block(&resp->meta.chars, endPos, iInvalidSize);
-            /* Parse and remove the code. */
-            iRegExp *metaPattern = new_RegExp("^([0-9][0-9])(( )(.*))?", 0);
-            /* TODO: Empty <META> means no <SPACE>? Not according to the spec? */
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            int code = 0;
-            if (matchString_RegExp(metaPattern, &resp->meta, &m)) {
-                code = atoi(capturedRange_RegExpMatch(&m, 1).start);
-                remove_Block(&resp->meta.chars,
-                             0,
-                             capturedRange_RegExpMatch(&m, 1).end -
-                                 constBegin_String(&resp->meta)); /* leave just the <META> */
-                trimStart_String(&resp->meta);
+        /* Only the new data is scanned; a partial header line waits in `meta`. */
+        const char *begin   = constBegin_Block(data);
+        const char *lineEnd = memchr(begin, '\n', size_Block(data));
+        appendCStrN_String(&resp->meta, begin, lineEnd ? (size_t) (lineEnd - begin) : size_Block(data));
+        if (!lineEnd) {
+            /* Still incomplete. A valid header always fits in the limit ("NN " + meta + CR). */
+            if (size_String(&resp->meta) > maxMetaSize_GmRequest_ + 4) {
+                clear_String(&resp->meta);
+                resp->statusCode = invalidHeader_GmStatusCode;
+                d->state         = finished_GmRequestState;
+                notifyDone       = iTrue;
             }
+        }
+        else {
+            if (endsWith_String(&resp->meta, "\r")) {
+                truncate_Block(&resp->meta.chars, size_String(&resp->meta) - 1);
+            }
+            const int code = parseStatusCode_GmRequest_(&resp->meta);
             if (code == 0) {
                 clear_String(&resp->meta);
                 resp->statusCode = invalidHeader_GmStatusCode;
@@ -249,21 +462,80 @@ static int processIncomingData_GmRequest_(iGmRequest *d, const iBlock *data) {
                 resp->statusCode = code;
                 d->state         = receivingBody_GmRequestState;
                 notifyUpdate     = iTrue;
-                if (d->isFilterEnabled && willTryFilter_MimeHooks(mimeHooks_App(), &resp->meta)) {
+                if (!resp->timing.header) {
+                    resp->timing.header = elapsed_GmRequest_(d);
+                }
+                if (d->filterStream) {
+                    /* This is the header printed by the streaming hook. */
+                }
+                else if (d->isFilterEnabled && code == success_GmStatusCode &&
+                         (d->filterStream =
+                              startStream_MimeHooks(mimeHooks_App(), &resp->meta, &d->url)) != NULL) {
+                    /* From now on, the hook's output is parsed as the response. */
+                    clear_String(&resp->meta);
+                    resp->statusCode = 0;
+                    d->state         = receivingHeader_GmRequestState;
+                    iBlock *rest = newData_Block(lineEnd + 1, size_Block(data) - (lineEnd + 1 - begin));
+                    const int bits = processFilteredData_GmRequest_(d, rest);
+                    delete_Block(rest);
+                    notifyUpdate = (bits & 1) != 0;
+                    notifyDone   = (bits & 2) != 0;
+                    checkServerCertificate_GmRequest_(d);
+                    return (notifyUpdate ? 1 : 0) | (notifyDone ? 2 : 0);
+                }
+                else if (d->isFilterEnabled &&
+                         willTryFilter_MimeHooks(
+                             mimeHooks_App(), &resp->meta, d->isBuiltInFilterEnabled)) {
                     d->isRespFiltered = iTrue;
                 }
+                /* The rest is the beginning of the body. */
+                appendBody_GmRequest_(d, data, lineEnd + 1 - begin);
             }
             checkServerCertificate_GmRequest_(d);
-            iRelease(metaPattern);
         }
     }
     else if (d->state == receivingBody_GmRequestState) {
-        append_Block(&resp->body, data);
+        appendBody_GmRequest_(d, data, 0);
         notifyUpdate = iTrue;
     }
     return (notifyUpdate ? 1 : 0) | (notifyDone ? 2 : 0);
 }
 
+static int processFilteredData_GmRequest_(iGmRequest *d, const iBlock *data) {
+    /* Received data goes to the streaming hook, and whatever it has printed so far is parsed
+       as the response. Must be called with `mtx` locked. */
+    iBlock *  output = write_FilterStream(d->filterStream, data);
+    const int bits   = isEmpty_Block(output) ? 0 : processIncomingData_GmRequest_(d, output);
+    delete_Block(output);
+    return bits;
+}
+
+static iBlock *drainFilterStream_GmRequest_(iGmRequest *d, iBool isSuccess) {
+    /* The hook may take a while to exit, so its remaining output is read without holding
+       `mtx`. Only the request's own thread uses `filterStream` before it is deleted. */
+    lock_Mutex(d->mtx);
+    iFilterStream *filter = (isSuccess && (d->state == receivingHeader_GmRequestState ||
+                                           d->state == receivingBody_GmRequestState)
+                                 ? d->filterStream
+                                 : NULL);
+    unlock_Mutex(d->mtx);
+    return filter ? finish_FilterStream(filter) : NULL;
+}
+
+static void finishFilterStream_GmRequest_(iGmRequest *d, iBlock *rest) {
+    /* Must be called with `mtx` locked. `rest` is the output drained from the hook. */
+    if (d->filterStream) {
+        if (rest && !isEmpty_Block(rest)) {
+            processIncomingData_GmRequest_(d, rest);
+        }
+        delete_FilterStream(d->filterStream);
+        d->filterStream = NULL;
+    }
+    if (rest) {
+        delete_Block(rest);
+    }
+}
+
 static void readIncoming_GmRequest_(iGmRequest *d, iTlsRequest *req) {
     lock_Mutex(d->mtx);
     iGmResponse *resp = d->resp;
@@ -273,13 +545,21 @@ static void readIncoming_GmRequest_(iGmRequest *d, iTlsRequest *req) {
         unlock_Mutex(d->mtx);
         return;
     }
+    setThreadName_Profiler("TlsRequest");
+    start_ProfilerScope(request);
     iBlock *  data         = readAll_TlsRequest(req);
-    const int ubits        = processIncomingData_GmRequest_(d, data);
+    if (!resp->timing.firstByte) {
+        resp->timing.firstByte = elapsed_GmRequest_(d);
+    }
+    resp->timing.numBytes += size_Block(data);
+    const int ubits        = d->filterStream ? processFilteredData_GmRequest_(d, data)
+                                          : processIncomingData_GmRequest_(d, data);
     iBool     notifyUpdate = (ubits & 1) != 0;
     iBool     notifyDone   = (ubits & 2) != 0;
     initCurrent_Time(&resp->when);
     delete_Block(data);
     unlock_Mutex(d->mtx);
+    stop_ProfilerScope(request);
     if (notifyUpdate && !d->isRespFiltered) {
         const iBool allowed = exchange_Atomic(&d->allowUpdate, iFalse);
         if (allowed) {
@@ -293,20 +573,27 @@ static void readIncoming_GmRequest_(iGmRequest *d, iTlsRequest *req) {
 
 static void applyFilter_GmRequest_(iGmRequest *d) {
     iAssert(d->state == finished_GmRequestState);
-    iBlock *xbody = tryFilter_MimeHooks(mimeHooks_App(), &d->resp->meta, &d->resp->body, &d->url);
+    iBlock *xbody = tryFilter_MimeHooks(mimeHooks_App(),
+                                        &d->resp->meta,
+                                        &d->resp->body,
+                                        &d->url,
+                                        d->isBuiltInFilterEnabled);
     if (xbody) {
         lock_Mutex(d->mtx);
         clear_String(&d->resp->meta);
-        clear_Block(&d->resp->body);
+        clearBody_GmRequest_(d);
         d->state = receivingHeader_GmRequestState;
         processIncomingData_GmRequest_(d, xbody);
         d->state = finished_GmRequestState;
+        flushBody_GmRequest_(d);
         unlock_Mutex(d->mtx);
     }
 }
 
 static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
     iAssert(req == d->req);
+    iBlock *filterRest =
+        drainFilterStream_GmRequest_(d, status_TlsRequest(req) != error_TlsRequestStatus);
     lock_Mutex(d->mtx);
     /* There shouldn't be anything left to read. */ {
         iBlock *data = readAll_TlsRequest(req);
@@ -314,8 +601,15 @@ static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
         delete_Block(data);
         initCurrent_Time(&d->resp->when);
     }
+    finishFilterStream_GmRequest_(d, filterRest);
+    flushBody_GmRequest_(d);
+    iReleasePtr(&d->downloadFile); /* nothing more will be written */
+    d->resp->timing.finished = elapsed_GmRequest_(d);
     d->state = (status_TlsRequest(req) == error_TlsRequestStatus ? failure_GmRequestState
                                                                  : finished_GmRequestState);
+    if (d->state == finished_GmRequestState) {
+        recordTiming_GmRequest_(d);
+    }
     if (d->state == failure_GmRequestState) {
         if (!isVerified_TlsRequest(req)) {
             if (isExpired_TlsCertificate(serverCertificate_TlsRequest(req))) {
@@ -333,6 +627,9 @@ static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
         }
     }
     checkServerCertificate_GmRequest_(d);
+    if (d->state == failure_GmRequestState && !serverCertificate_TlsRequest(req)) {
+        useMirror_GmRequest_(d); /* never connected */
+    }
     unlock_Mutex(d->mtx);
     /* Check for mimehooks. */
     if (d->isRespFiltered && d->state == finished_GmRequestState) {
@@ -344,19 +641,19 @@ static void requestFinished_GmRequest_(iGmRequest *d, iTlsRequest *req) {
 static const iBlock *aboutPageSource_(iRangecc path, iRangecc query) {
     const iBlock *src = NULL;
     if (equalCase_Rangecc(path, "about")) {
-        return &blobAbout_Resources;
+        return load_Resources(&blobAbout_Resources);
     }
     if (equalCase_Rangecc(path, "lagrange")) {
-        return &blobLagrange_Resources;
+        return load_Resources(&blobLagrange_Resources);
     }
     if (equalCase_Rangecc(path, "help")) {
-        return &blobHelp_Resources;
+        return load_Resources(&blobHelp_Resources);
     }
     if (equalCase_Rangecc(path, "license")) {
-        return &blobLicense_Resources;
+        return load_Resources(&blobLicense_Resources);
     }
     if (equalCase_Rangecc(path, "version")) {
-        return &blobVersion_Resources;
+        return load_Resources(&blobVersion_Resources);
     }
     if (equalCase_Rangecc(path, "debug")) {
         return utf8_String(debugInfo_App());
@@ -365,7 +662,11 @@ static const iBlock *aboutPageSource_(iRangecc path, iRangecc query) {
         return utf8_String(infoPage_Fonts(query));
     }
     if (equalCase_Rangecc(path, "feeds")) {
-        return utf8_String(entryListPage_Feeds());
+        int page = 1;
+        if (startsWith_Rangecc(query, "?page=")) {
+            page = atoi(query.start + 6);
+        }
+        return utf8_String(entryListPage_Feeds(iMax(1, page) - 1));
     }
     if (equalCase_Rangecc(path, "bookmarks")) {
         return utf8_String(bookmarkListPage_Bookmarks(
@@ -374,6 +675,12 @@ static const iBlock *aboutPageSource_(iRangecc path, iRangecc query) {
             : equal_Rangecc(query, "?created") ? listByCreationTime_BookmarkListType
                                                : listByFolder_BookmarkListType));
     }
+    if (equalCase_Rangecc(path, "memory")) {
+        return utf8_String(memoryPage_App());
+    }
+    if (equalCase_Rangecc(path, "network")) {
+        return utf8_String(timingStatsPage_GmRequest());
+    }
     if (equalCase_Rangecc(path, "blank")) {
         return utf8_String(collectNewCStr_String("\n"));
     }
@@ -472,12 +779,20 @@ static void gopherRead_GmRequest_(iGmRequest *d, iSocket *socket) {
     lock_Mutex(d->mtx);
     d->resp->statusCode = success_GmStatusCode;
     iBlock *data = readAll_Socket(socket);
+    if (!d->resp->timing.firstByte) {
+        d->resp->timing.firstByte = elapsed_GmRequest_(d);
+    }
+    d->resp->timing.numBytes += size_Block(data);
     if (!isEmpty_Block(data)) {
-        processResponse_Gopher(&d->gopher, data);
+        notifyUpdate = processResponse_Gopher(&d->gopher, data);
+        if (d->downloadFile) {
+            writeDownload_GmRequest_(d);
+        }
     }
     delete_Block(data);
     unlock_Mutex(d->mtx);
-    if (notifyUpdate) {
+    /* Newly converted lines are shown as they arrive. */
+    if (notifyUpdate && exchange_Atomic(&d->allowUpdate, iFalse)) {
         iNotifyAudience(d, updated, GmRequestUpdated);
     }
 }
@@ -488,8 +803,14 @@ static void gopherDisconnected_GmRequest_(iGmRequest *d, iSocket *socket) {
     lock_Mutex(d->mtx);
     if (d->state != failure_GmRequestState) {
         d->state = finished_GmRequestState;
+        d->resp->timing.finished = elapsed_GmRequest_(d);
+        recordTiming_GmRequest_(d);
         notify = iTrue;
     }
+    if (d->downloadFile) {
+        writeDownload_GmRequest_(d);
+        iReleasePtr(&d->downloadFile);
+    }
     unlock_Mutex(d->mtx);
     if (notify) {
         iNotifyAudience(d, finished, GmRequestFinished);
@@ -507,13 +828,35 @@ static void gopherError_GmRequest_(iGmRequest *d, iSocket *socket, int error, co
     iNotifyAudience(d, finished, GmRequestFinished);
 }
 
+static iBool failIfUnresolvable_GmRequest_(iGmRequest *d, const iString *host, uint16_t port) {
+    /* A recent lookup of the host failed, so don't bother trying again yet. */
+    if (isUnresolvable_Resolver(host, port)) {
+        d->state            = failure_GmRequestState;
+        d->resp->statusCode = tlsFailure_GmStatusCode;
+        format_String(&d->resp->meta, "Host not found: %s", cstr_String(host));
+        iNotifyAudience(d, finished, GmRequestFinished);
+        return iTrue;
+    }
+    return iFalse;
+}
+
 static void beginGopherConnection_GmRequest_(iGmRequest *d, const iString *host, uint16_t port) {
+    if (failIfUnresolvable_GmRequest_(d, host, port)) {
+        return;
+    }
     clear_Block(&d->gopher.source);
     iGmResponse *resp = d->resp;
     d->gopher.meta   = &resp->meta;
     d->gopher.output = &resp->body;
     d->state         = receivingBody_GmRequestState;
-    d->gopher.socket = new_Socket(cstr_String(host), port);
+    iAddress *address = lookup_Resolver(host, port);
+    if (address) {
+        d->gopher.socket = newAddress_Socket(address);
+        iRelease(address);
+    }
+    else {
+        d->gopher.socket = new_Socket(cstr_String(host), port);
+    }
     iConnect(Socket, d->gopher.socket, readyRead,    d, gopherRead_GmRequest_);
     iConnect(Socket, d->gopher.socket, disconnected, d, gopherDisconnected_GmRequest_);
     iConnect(Socket, d->gopher.socket, error,        d, gopherError_GmRequest_);
@@ -533,9 +876,16 @@ void init_GmRequest(iGmRequest *d, iGmCerts *certs) {
     d->id    = add_Atomic(&idGen_, 1) + 1;
     d->identity = NULL;
     d->resp  = new_GmResponse();
+    init_PtrArray(&d->bodyChunks);
+    d->chunksSize   = 0;
+    d->downloadFile = NULL;
+    d->downloadSize = 0;
+    d->takenSize    = 0;
     d->isFilterEnabled = iTrue;
+    d->isBuiltInFilterEnabled = iTrue;
     d->isRespLocked    = iFalse;
     d->isRespFiltered  = iFalse;
+    d->filterStream    = NULL;
     set_Atomic(&d->allowUpdate, iTrue);
     init_String(&d->url);
     init_Gopher(&d->gopher);
@@ -545,6 +895,7 @@ void init_GmRequest(iGmRequest *d, iGmCerts *certs) {
     d->updated  = NULL;
     d->finished = NULL;
     d->sendProgress = NULL;
+    d->startTime    = 0;
     d->state    = initialized_GmRequestState;
 }
 
@@ -564,10 +915,14 @@ void deinit_GmRequest(iGmRequest *d) {
         unlock_Mutex(d->mtx);
     }
     iReleasePtr(&d->req);
+    delete_FilterStream(d->filterStream);
     delete_TitanData(d->titan);
     deinit_Gopher(&d->gopher);
     delete_Audience(d->finished);
     delete_Audience(d->updated);
+    clearBody_GmRequest_(d);
+    deinit_PtrArray(&d->bodyChunks);
+    iReleasePtr(&d->downloadFile);
     delete_GmResponse(d->resp);
     deinit_String(&d->url);
     delete_Mutex(d->mtx);
@@ -577,6 +932,10 @@ void enableFilters_GmRequest(iGmRequest *d, iBool enable) {
     d->isFilterEnabled = enable;
 }
 
+void enableBuiltInFilters_GmRequest(iGmRequest *d, iBool enable) {
+    d->isBuiltInFilterEnabled = enable;
+}
+
 void setUrl_GmRequest(iGmRequest *d, const iString *url) {
     set_String(&d->url, canonicalUrl_String(urlFragmentStripped_String(url)));
     /* Encode hostname to Punycode here because we want to submit the Punycode domain name
@@ -604,18 +963,40 @@ void setTitanData_GmRequest(iGmRequest *d, const iString *mime, const iBlock *pa
         d->titan = new_TitanData();   
     }
     set_Block(&d->titan->data, payload);
+    iReleasePtr(&d->titan->file);
     set_String(&d->titan->mime, mime);
     set_String(&d->titan->token, token);
 }
 
+iBool setTitanFile_GmRequest(iGmRequest *d, const iString *mime, const iString *path,
+                             const iString *token) {
+    iFile *f = new_File(path);
+    if (!open_File(f, readOnly_FileMode)) {
+        iRelease(f);
+        return iFalse;
+    }
+    setTitanData_GmRequest(d, mime, collect_Block(new_Block(0)), token);
+    d->titan->file = f;
+    return iTrue;
+}
+
 void setSendProgressFunc_GmRequest(iGmRequest *d, iGmRequestProgressFunc func) {
     d->sendProgress = func;
 }
 
 static void bytesSent_GmRequest_(iGmRequest *d, iTlsRequest *req, size_t sent, size_t toSend) {
     iUnused(req);
+    lock_Mutex(d->mtx);
+    if (!d->resp->timing.connected) {
+        d->resp->timing.connected = elapsed_GmRequest_(d);
+    }
+    unlock_Mutex(d->mtx);
     if (d->sendProgress) {
-        d->sendProgress(d, sent, toSend);
+        /* Only the payload counts as progress. */
+        const size_t headerSize = d->titan ? d->titan->headerSize : 0;
+        d->sendProgress(d,
+                        sent > headerSize ? sent - headerSize : 0,
+                        toSend > headerSize ? toSend - headerSize : 0);
     }
 }
 
@@ -631,6 +1012,21 @@ static int cmp_FileInfoPtr_(const iFileInfo **a, const iFileInfo **b) {
     return cmpStringCase_String(path_FileInfo(*a), path_FileInfo(*b));
 }
 
+static void appendDirectoryEntry_GmRequest_(iBlock *body, const iFileInfo *entry) {
+    /* Entries are written straight into the response body; nothing is left for the
+       garbage collector even in very large directories. */
+    const iString *entryPath = path_FileInfo(entry);
+    const iBool    isDir     = isDirectory_FileInfo(entry);
+    const iRangecc name      = baseName_Path(entryPath);
+    iString       *url       = makeFileUrl_String(entryPath);
+    appendCStr_Block(body, "=> ");
+    append_Block(body, utf8_String(url));
+    appendCStr_Block(body, isDir ? " " folder_Icon " " : " ");
+    appendData_Block(body, name.start, size_Range(&name));
+    appendCStr_Block(body, isDir ? iPathSeparator "\n" : "\n");
+    delete_String(url);
+}
+
 static const iString *directoryIndexPage_Archive_(const iArchive *d, const iString *entryPath) {
     static const char *names[] = { "index.gmi", "index.gemini" };
     iForIndices(i, names) {
@@ -644,6 +1040,25 @@ static const iString *directoryIndexPage_Archive_(const iArchive *d, const iStri
     return NULL;
 }
 
+void setDownloadFile_GmRequest(iGmRequest *d, iFile *file) {
+    lock_Mutex(d->mtx);
+    iAssert(!d->downloadFile);
+    if (d->state == receivingBody_GmRequestState || d->state == finished_GmRequestState) {
+        d->downloadFile = ref_Object(file);
+        writeDownload_GmRequest_(d);
+        if (d->state == finished_GmRequestState) {
+            iReleasePtr(&d->downloadFile);
+        }
+    }
+    unlock_Mutex(d->mtx);
+}
+
+iBool isDownloading_GmRequest(const iGmRequest *d) {
+    iBool downloading;
+    iGuardMutex(d->mtx, downloading = d->downloadSize > 0 || d->downloadFile != NULL);
+    return downloading;
+}
+
 void submit_GmRequest(iGmRequest *d) {
     iAssert(d->state == initialized_GmRequestState);
     if (d->state != initialized_GmRequestState) {
@@ -652,6 +1067,8 @@ void submit_GmRequest(iGmRequest *d) {
     set_Atomic(&d->allowUpdate, iTrue);
     iGmResponse *resp = d->resp;
     clear_GmResponse(resp);
+    d->startTime = SDL_GetTicks();
+    flow_Profiler(begin_ProfilerFlow, "request", d->id);
 #if !defined (NDEBUG)
     printf("[GmRequest] URL: %s\n", cstr_String(&d->url)); fflush(stdout);
 #endif
@@ -711,16 +1128,15 @@ void submit_GmRequest(iGmRequest *d) {
                 pushBack_PtrArray(sortedInfo, ref_Object(entry.value));
             }
             sort_Array(sortedInfo, (int (*)(const void *, const void *)) cmp_FileInfoPtr_);
+            /* The header goes in first and each entry is appended to the body as it is
+               formatted. Reserve roughly enough up front to avoid repeated growth. */
+            set_Block(&resp->body, utf8_String(page));
+            reserve_Block(&resp->body,
+                          size_String(page) + size_PtrArray(sortedInfo) * (size_String(path) + 64));
             iForEach(PtrArray, s, sortedInfo) {
-                const iFileInfo *entry = s.ptr;
-                appendFormat_String(page, "=> %s %s%s%s\n",
-                                    cstrCollect_String(makeFileUrl_String(path_FileInfo(entry))),
-                                    isDirectory_FileInfo(entry) ? folder_Icon " " : "",
-                                    cstr_Rangecc(baseName_Path(path_FileInfo(entry))),
-                                    isDirectory_FileInfo(entry) ? iPathSeparator : "");
-                iRelease(entry);
+                appendDirectoryEntry_GmRequest_(&resp->body, s.ptr);
+                iRelease(s.ptr);
             }
-            set_Block(&resp->body, utf8_String(page));
         }
         else if (open_File(f, readOnly_FileMode)) {
             resp->statusCode = success_GmStatusCode;
@@ -734,8 +1150,9 @@ void submit_GmRequest(iGmRequest *d) {
             /* It could be a path inside an archive. */
             const iString *container = findContainerArchive_Path(path);
             if (container) {
-                iArchive *arch = iClob(new_Archive());
-                if (openFile_Archive(arch, container)) {
+                iArchive *arch = open_ArchiveCache(container);
+                if (arch) {
+                    iClob(arch);
                     iString *entryPath = collect_String(copy_String(path));
                     remove_Block(&entryPath->chars, 0, size_String(container) + 1); /* last slash, too */
                     iBool isDir = isDirectory_Archive(arch, entryPath);
@@ -824,11 +1241,12 @@ void submit_GmRequest(iGmRequest *d) {
                         delete_String(page);
                     }
                     else {
-                        const iBlock *data = data_Archive(arch, entryPath);
+                        iBlock *data = readEntry_ArchiveCache(container, entryPath);
                         if (data) {
                             resp->statusCode = success_GmStatusCode;
                             setCStr_String(&resp->meta, mediaType_Path(entryPath));
                             set_Block(&resp->body, data);
+                            delete_Block(data);
                         }
                         else {
                             resp->statusCode = failedToOpenFile_GmStatusCode;
@@ -912,6 +1330,9 @@ void submit_GmRequest(iGmRequest *d) {
         iNotifyAudience(d, finished, GmRequestFinished);
         return;
     }
+    if (failIfUnresolvable_GmRequest_(d, host, port ? port : GEMINI_DEFAULT_PORT)) {
+        return;
+    }
     d->state = receivingHeader_GmRequestState;
     d->req = new_TlsRequest();
     if (d->identity) {
@@ -923,24 +1344,44 @@ void submit_GmRequest(iGmRequest *d) {
     if (port == 0) {
         port = GEMINI_DEFAULT_PORT; /* default Gemini port */
     }
+#if defined (LAGRANGE_ENABLE_TLS_SESSION_CACHE)
+    if (isSessionChanged_GmRequest_(host, port, d->identity)) {
+        /* The session cached for this host was negotiated with a different certificate.
+           Other hosts lose theirs too, since the cache can only be cleared as a whole. */
+        clearSessionCache_TlsRequest();
+    }
+#endif
     setHost_TlsRequest(d->req, host, port);
     /* Titan requests can have an arbitrary payload. */
     if (isTitan_GmRequest_(d)) {
         iBlock content;
         init_Block(&content, 0);
         if (d->titan) {
+            const size_t   payloadSize = payloadSize_TitanData_(d->titan);
+            const iString *filePath =
+                d->titan->file ? collect_String(copy_String(path_File(d->titan->file))) : NULL;
             printf_Block(&content,
                          "%s;mime=%s;size=%zu",
                          cstr_String(&d->url),
                          cstr_String(&d->titan->mime),
-                         size_Block(&d->titan->data));
+                         payloadSize);
             if (!isEmpty_String(&d->titan->token)) {
                 appendCStr_Block(&content, ";token=");
                 append_Block(&content,
                              utf8_String(collect_String(urlEncode_String(&d->titan->token))));
             }
             appendCStr_Block(&content, "\r\n");
-            append_Block(&content, &d->titan->data);
+            d->titan->headerSize = size_Block(&content);
+            if (!appendPayload_TitanData_(d->titan, &content, payloadSize)) {
+                /* The server would accept the incomplete file as is. */
+                deinit_Block(&content);
+                iReleasePtr(&d->req);
+                resp->statusCode = failedToOpenFile_GmStatusCode;
+                set_String(&resp->meta, filePath);
+                d->state = finished_GmRequestState;
+                iNotifyAudience(d, finished, GmRequestFinished);
+                return;
+            }
         }
         else {
             /* Empty data. */
@@ -969,6 +1410,7 @@ iGmResponse *lockResponse_GmRequest(iGmRequest *d) {
     iAssert(!d->isRespLocked);
     lock_Mutex(d->mtx);
     d->isRespLocked = iTrue;
+    flushBody_GmRequest_(d);
     return d->resp;
 }
 
@@ -1016,10 +1458,23 @@ const iBlock *body_GmRequest(const iGmRequest *d) {
 
 size_t bodySize_GmRequest(const iGmRequest *d) {
     size_t size;
-    iGuardMutex(d->mtx, size = size_Block(&d->resp->body));
+    iGuardMutex(d->mtx,
+                size = size_Block(&d->resp->body) + d->chunksSize + d->downloadSize +
+                       d->takenSize);
     return size;
 }
 
+size_t takeBody_GmRequest(iGmRequest *d, iBlock *body_out) {
+    lock_Mutex(d->mtx);
+    flushBody_GmRequest_(d);
+    const size_t offset = d->takenSize;
+    set_Block(body_out, &d->resp->body);
+    d->takenSize += size_Block(&d->resp->body);
+    clear_Block(&d->resp->body);
+    unlock_Mutex(d->mtx);
+    return offset;
+}
+
 const iString *url_GmRequest(const iGmRequest *d) {
     return &d->url;
 }
@@ -1037,3 +1492,211 @@ iDate certExpirationDate_GmRequest(const iGmRequest *d) {
 }
 
 iDefineClass(GmRequest)
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(HostTiming)
+
+#define numSamples_HostTiming_  32
+
+struct Impl_HostTiming {
+    iString  host;
+    size_t   count; /* number of requests recorded */
+    uint32_t firstByte[numSamples_HostTiming_];
+    uint32_t finished[numSamples_HostTiming_];
+};
+
+static const size_t maxHosts_TimingStats_ = 64;
+static iMutex *     timingStatsMtx_;
+static iPtrArray    timingStats_; /* HostTimings, oldest first */
+
+#if defined (LAGRANGE_ENABLE_TLS_SESSION_CACHE)
+iDeclareType(HostSession)
+
+/* The TLS session cache is keyed by host and port only, but client certificates apply per
+   URL. The certificate presented in the latest handshake with each host is remembered, so
+   cached sessions only need to be invalidated when a different one is about to be used. */
+struct Impl_HostSession {
+    iString hostPort;
+    iBlock  fingerprint; /* empty if no client certificate */
+};
+
+static iPtrArray hostSessions_; /* HostSessions, least recently used first */
+static iBool     isHostSessionEvicted_;
+#endif
+
+void initTimingStats_GmRequest(void) {
+    timingStatsMtx_ = new_Mutex();
+    init_PtrArray(&timingStats_);
+#if defined (LAGRANGE_ENABLE_TLS_SESSION_CACHE)
+    init_PtrArray(&hostSessions_);
+    isHostSessionEvicted_ = iFalse;
+#endif
+}
+
+void deinitTimingStats_GmRequest(void) {
+    iForEach(PtrArray, i, &timingStats_) {
+        iHostTiming *ht = i.ptr;
+        deinit_String(&ht->host);
+        free(ht);
+    }
+    deinit_PtrArray(&timingStats_);
+#if defined (LAGRANGE_ENABLE_TLS_SESSION_CACHE)
+    iForEach(PtrArray, j, &hostSessions_) {
+        iHostSession *hs = j.ptr;
+        deinit_String(&hs->hostPort);
+        deinit_Block(&hs->fingerprint);
+        free(hs);
+    }
+    deinit_PtrArray(&hostSessions_);
+#endif
+    delete_Mutex(timingStatsMtx_);
+    timingStatsMtx_ = NULL;
+}
+
+#if defined (LAGRANGE_ENABLE_TLS_SESSION_CACHE)
+static iBool isSessionChanged_GmRequest_(const iString *host, uint16_t port,
+                                         const iGmIdentity *identity) {
+    /* Records the certificate for the upcoming handshake with `host`. Returns true if a
+       session cached for the host may have been negotiated with a different one. */
+    if (!timingStatsMtx_) {
+        return iTrue;
+    }
+    const iBlock *fingerprint = identity ? &identity->fingerprint : collect_Block(new_Block(0));
+    iString *     hostPort    = collectNewFormat_String("%s:%u", cstr_String(host), port);
+    iBool         isChanged   = iFalse;
+    iHostSession *hs          = NULL;
+    lock_Mutex(timingStatsMtx_);
+    iForEach(PtrArray, i, &hostSessions_) {
+        iHostSession *entry = i.ptr;
+        if (equal_String(&entry->hostPort, hostPort)) {
+            hs = entry;
+            remove_PtrArrayIterator(&i);
+            break;
+        }
+    }
+    if (hs) {
+        isChanged = cmp_Block(&hs->fingerprint, fingerprint) != 0;
+        set_Block(&hs->fingerprint, fingerprint);
+    }
+    else {
+        /* A forgotten host may still have a session in the cache. */
+        isChanged = isHostSessionEvicted_;
+        if (size_PtrArray(&hostSessions_) >= maxHosts_TimingStats_) {
+            iHostSession *oldest = NULL;
+            take_PtrArray(&hostSessions_, 0, (void **) &oldest);
+            deinit_String(&oldest->hostPort);
+            deinit_Block(&oldest->fingerprint);
+            free(oldest);
+            isHostSessionEvicted_ = iTrue;
+        }
+        hs = iMalloc(HostSession);
+        initCopy_String(&hs->hostPort, hostPort);
+        initCopy_Block(&hs->fingerprint, fingerprint);
+    }
+    pushBack_PtrArray(&hostSessions_, hs);
+    unlock_Mutex(timingStatsMtx_);
+    return isChanged;
+}
+#endif
+
+static void recordTiming_GmRequest_(const iGmRequest *d) {
+    /* Called with `d->mtx` locked. */
+    const iGmTiming *timing = &d->resp->timing;
+    if (!timingStatsMtx_ || !timing->firstByte) {
+        return;
+    }
+    const iRangecc host = urlHost_String(&d->url);
+    if (isEmpty_Range(&host)) {
+        return;
+    }
+    lock_Mutex(timingStatsMtx_);
+    iHostTiming *ht = NULL;
+    iForEach(PtrArray, i, &timingStats_) {
+        if (equalCase_Rangecc(range_String(&((iHostTiming *) i.ptr)->host), host)) {
+            ht = i.ptr;
+            break;
+        }
+    }
+    if (!ht) {
+        if (size_PtrArray(&timingStats_) >= maxHosts_TimingStats_) {
+            take_PtrArray(&timingStats_, 0, (void **) &ht);
+            deinit_String(&ht->host);
+        }
+        else {
+            ht = malloc(sizeof(iHostTiming));
+        }
+        initRange_String(&ht->host, host);
+        ht->count = 0;
+        pushBack_PtrArray(&timingStats_, ht);
+    }
+    const size_t index = ht->count++ % numSamples_HostTiming_;
+    ht->firstByte[index] = timing->firstByte;
+    ht->finished[index]  = timing->finished;
+    unlock_Mutex(timingStatsMtx_);
+}
+
+static int cmp_Uint32_(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static uint32_t percentile_(const uint32_t *samples, size_t count, float fraction) {
+    uint32_t sorted[numSamples_HostTiming_];
+    memcpy(sorted, samples, sizeof(uint32_t) * count);
+    qsort(sorted, count, sizeof(uint32_t), cmp_Uint32_);
+    return sorted[(size_t) (fraction * (count - 1) + 0.5f)];
+}
+
+uint32_t hostLatency_GmRequest(const iString *url) {
+    uint32_t latency = 0;
+    const iRangecc host = urlHost_String(url);
+    if (!timingStatsMtx_ || isEmpty_Range(&host)) {
+        return 0;
+    }
+    lock_Mutex(timingStatsMtx_);
+    iConstForEach(PtrArray, i, &timingStats_) {
+        const iHostTiming *ht = i.ptr;
+        if (equalCase_Rangecc(range_String(&ht->host), host)) {
+            latency = percentile_(ht->finished, iMin(ht->count, numSamples_HostTiming_), 0.5f);
+            break;
+        }
+    }
+    unlock_Mutex(timingStatsMtx_);
+    return latency;
+}
+
+const iString *timingStatsPage_GmRequest(void) {
+    iString *page = collectNew_String();
+    format_String(page, "# Network timing\n");
+    appendFormat_String(page,
+                        "Median and 90th percentile of the latest %d requests per host, in "
+                        "milliseconds. The time to first byte includes looking up the host, "
+                        "connecting, and the TLS handshake.\n\n",
+                        numSamples_HostTiming_);
+    if (!timingStatsMtx_) {
+        return page;
+    }
+    lock_Mutex(timingStatsMtx_);
+    if (isEmpty_PtrArray(&timingStats_)) {
+        appendCStr_String(page, "No requests have finished yet.\n");
+    }
+    else {
+        appendFormat_String(page, "```\n%-30s %5s %7s %7s %7s %7s\n",
+                            "Host", "Count", "TTFB", "TTFB90", "Total", "Total90");
+        iReverseConstForEach(PtrArray, i, &timingStats_) {
+            const iHostTiming *ht = i.ptr;
+            const size_t n = iMin(ht->count, numSamples_HostTiming_);
+            appendFormat_String(page, "%-30s %5zu %7u %7u %7u %7u\n",
+                                cstr_String(&ht->host),
+                                ht->count,
+                                percentile_(ht->firstByte, n, 0.5f),
+                                percentile_(ht->firstByte, n, 0.9f),
+                                percentile_(ht->finished, n, 0.5f),
+                                percentile_(ht->finished, n, 0.9f));
+        }
+        appendCStr_String(page, "```\n");
+    }
+    unlock_Mutex(timingStatsMtx_);
+    return page;
+}
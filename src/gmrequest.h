@@ -23,6 +23,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #pragma once
 
 #include <the_Foundation/audience.h>
+#include <the_Foundation/file.h>
 #include <the_Foundation/tlsrequest.h>
 
 #include "gmutil.h"
@@ -30,6 +31,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 iDeclareType(GmCerts)
 iDeclareType(GmIdentity)
 iDeclareType(GmResponse)
+iDeclareType(GmTiming)
 
 enum iGmCertFlag {
     available_GmCertFlag         = iBit(1), /* certificate provided by server */
@@ -38,6 +40,16 @@ enum iGmCertFlag {
     domainVerified_GmCertFlag    = iBit(4), /* cert matches server domain */
     haveFingerprint_GmCertFlag   = iBit(5),
     authorityVerified_GmCertFlag = iBit(6),
+    mirrored_GmCertFlag          = iBit(7), /* saved offline copy; no server was contacted */
+};
+
+/* Milliseconds since the request was submitted. Zero if the phase was not reached. */
+struct Impl_GmTiming {
+    uint32_t connected; /* request sent: lookup, connection and TLS handshake done */
+    uint32_t firstByte;
+    uint32_t header;
+    uint32_t finished;
+    uint64_t numBytes;  /* received, including the header */
 };
 
 struct Impl_GmResponse {
@@ -49,12 +61,14 @@ struct Impl_GmResponse {
     iDate              certValidUntil;
     iString            certSubject;
     iTime              when;
+    iGmTiming          timing;
 };
 
 iDeclareTypeConstruction(GmResponse)
 iDeclareTypeSerialization(GmResponse)
 
 iGmResponse *       copy_GmResponse             (const iGmResponse *);
+iBool               isCompressible_GmResponse   (const iGmResponse *); /* text body of some size */
 
 /*----------------------------------------------------------------------------------------------*/
 
@@ -69,11 +83,15 @@ iDeclareAudienceGetter(GmRequest, finished)
 typedef void (*iGmRequestProgressFunc)(iGmRequest *, size_t current, size_t total);
 
 void                enableFilters_GmRequest     (iGmRequest *, iBool enable);
+void                enableBuiltInFilters_GmRequest  (iGmRequest *, iBool enable); /* e.g., feed XML */
 void                setUrl_GmRequest            (iGmRequest *, const iString *url);
 void                setIdentity_GmRequest       (iGmRequest *, const iGmIdentity *id);
 void                setTitanData_GmRequest      (iGmRequest *, const iString *mime,
                                                  const iBlock *payload, const iString *token);
+iBool               setTitanFile_GmRequest      (iGmRequest *, const iString *mime,
+                                                 const iString *path, const iString *token);
 void                setSendProgressFunc_GmRequest(iGmRequest *, iGmRequestProgressFunc func);
+void                setDownloadFile_GmRequest   (iGmRequest *, iFile *file);
 void                submit_GmRequest            (iGmRequest *);
 void                cancel_GmRequest            (iGmRequest *);
 
@@ -86,7 +104,14 @@ enum iGmStatusCode  status_GmRequest            (const iGmRequest *);
 const iString *     meta_GmRequest              (const iGmRequest *);
 const iBlock  *     body_GmRequest              (const iGmRequest *);
 size_t              bodySize_GmRequest          (const iGmRequest *);
+size_t              takeBody_GmRequest          (iGmRequest *, iBlock *body_out); /* returns offset */
+iBool               isDownloading_GmRequest     (const iGmRequest *);
 const iString *     url_GmRequest               (const iGmRequest *);
 
 int                 certFlags_GmRequest         (const iGmRequest *);
 iDate               certExpirationDate_GmRequest(const iGmRequest *);
+
+void                initTimingStats_GmRequest   (void);
+void                deinitTimingStats_GmRequest (void);
+const iString *     timingStatsPage_GmRequest   (void);
+uint32_t            hostLatency_GmRequest       (const iString *url); /* median ms, zero if unknown */
@@ -28,12 +28,55 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/object.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/regexp.h>
-#include <the_Foundation/regexp.h>
+#include <ctype.h>
+#include <string.h>
 
 iRegExp *newGemtextLink_RegExp(void) {
     return new_RegExp("=>\\s*([^\\s]+)(\\s.*)?", 0);
 }
 
+static void parseAuthority_Url_(iUrl *d, iRangecc auth) {
+    /* Optional user info, a host name or a bracketed IPv6 address, and an optional port. */
+    const char *pos = auth.start;
+    const char *at  = memchr(pos, '@', size_Range(&auth));
+    if (at && at != pos) {
+        pos = at + 1;
+    }
+    const char *hostEnd = pos;
+    if (hostEnd != auth.end && *hostEnd == '[') {
+        /* IP literal, possibly with a zone identifier. */
+        const char *close = memchr(hostEnd, ']', auth.end - hostEnd);
+        hostEnd = (close && close - pos > 1 ? close + 1 : pos);
+    }
+    else {
+        while (hostEnd != auth.end && *hostEnd != ':' && *hostEnd != '[' && *hostEnd != ']') {
+            hostEnd++;
+        }
+    }
+    if (hostEnd == pos) {
+        /* Not a valid host; the whole authority is used as is. */
+        d->host = auth;
+        d->port = (iRangecc){ auth.end, auth.end };
+        return;
+    }
+    d->host = (iRangecc){ pos, hostEnd };
+    d->port = (iRangecc){ hostEnd, hostEnd };
+    if (hostEnd != auth.end && *hostEnd == ':') {
+        const char *portEnd = hostEnd + 1;
+        while (portEnd != auth.end && isdigit((unsigned char) *portEnd)) {
+            portEnd++;
+        }
+        if (portEnd != hostEnd + 1) {
+            d->port = (iRangecc){ hostEnd + 1, portEnd };
+        }
+    }
+    /* Remove brackets from an IPv6 literal. */
+    if (size_Range(&d->host) > 2 && d->host.start[0] == '[' && d->host.end[-1] == ']') {
+        d->host.start++;
+        d->host.end--;
+    }
+}
+
 void init_Url(iUrl *d, const iString *text) {
     if (!text) {
         iZap(*d);
@@ -47,38 +90,63 @@ void init_Url(iUrl *d, const iString *text) {
         d->path   = (iRangecc){ cstr + 7, constEnd_String(text) };
         return;
     }
-    static iRegExp *urlPattern_;
-    static iRegExp *authPattern_;
-    if (!urlPattern_) {
-        urlPattern_  = new_RegExp("^(([-.+a-z0-9]+):)?(//([^/?#]*))?"
-                                 "([^?#]*)(\\?([^#]*))?(#(.*))?",
-                                 caseInsensitive_RegExpOption);
-        authPattern_ = new_RegExp("(([^@]+)@)?(([^:\\[\\]]+)"
-                                  "|(\\[[0-9a-f:]+\\]))(:([0-9]+))?",
-                                  caseInsensitive_RegExpOption);
-    }
+    /* Single pass equivalent of the regular expression
+       ^(([-.+a-z0-9]+):)?(//([^/?#]*))?([^?#]*)(\?([^#]*))?(#(.*))?
+       (see RFC 3986, Appendix B). Components that are not present are empty ranges at
+       the position where they would appear. */
+    const char *pos = constBegin_String(text);
+    const char *end = constEnd_String(text);
     iZap(*d);
-    iRegExpMatch m;
-    init_RegExpMatch(&m);
-    if (matchString_RegExp(urlPattern_, text, &m)) {
-        d->scheme   = capturedRange_RegExpMatch(&m, 2);
-        d->host     = capturedRange_RegExpMatch(&m, 4);
-        d->port     = (iRangecc){ d->host.end, d->host.end };
-        d->path     = capturedRange_RegExpMatch(&m, 5);
-        d->query    = capturedRange_RegExpMatch(&m, 6);
-        d->fragment = capturedRange_RegExpMatch(&m, 8); /* starts with a hash */
-        /* Check if the authority contains a port. */
-        init_RegExpMatch(&m);
-        if (matchRange_RegExp(authPattern_, d->host, &m)) {
-            d->host = capturedRange_RegExpMatch(&m, 3);
-            d->port = capturedRange_RegExpMatch(&m, 7);
+    /* Scheme. */ {
+        const char *ch = pos;
+        while (ch != end && (isalnum((unsigned char) *ch) || *ch == '-' || *ch == '.' ||
+                             *ch == '+')) {
+            ch++;
+        }
+        if (ch != pos && ch != end && *ch == ':') {
+            d->scheme = (iRangecc){ pos, ch };
+            pos = ch + 1;
         }
-        /* Remove brackets from an IPv6 literal. */
-        if (size_Range(&d->host) > 2 && d->host.start[0] == '[' && d->host.end[-1] == ']') {
-            d->host.start++;
-            d->host.end--;
+        else {
+            d->scheme = (iRangecc){ pos, pos };
+        }
+    }
+    /* Authority. */
+    if (end - pos >= 2 && pos[0] == '/' && pos[1] == '/') {
+        pos += 2;
+        const char *authEnd = pos;
+        while (authEnd != end && *authEnd != '/' && *authEnd != '?' && *authEnd != '#') {
+            authEnd++;
         }
+        parseAuthority_Url_(d, (iRangecc){ pos, authEnd });
+        pos = authEnd;
     }
+    else {
+        d->host = (iRangecc){ pos, pos };
+        d->port = d->host;
+    }
+    /* Path. */
+    d->path.start = pos;
+    while (pos != end && *pos != '?' && *pos != '#') {
+        pos++;
+    }
+    d->path.end = pos;
+    /* Query, including the question mark. */
+    d->query.start = pos;
+    if (pos != end && *pos == '?') {
+        while (pos != end && *pos != '#') {
+            pos++;
+        }
+    }
+    d->query.end = pos;
+    /* Fragment, including the hash. */
+    d->fragment.start = pos;
+    if (pos != end && *pos == '#') {
+        while (pos != end && *pos != '\n') {
+            pos++;
+        }
+    }
+    d->fragment.end = pos;
 }
 
 uint16_t port_Url(const iUrl *d) {
@@ -682,6 +750,15 @@ const iString *canonicalUrl_String(const iString *d) {
     return canon ? collect_String(canon) : d;
 }
 
+uint64_t urlHash_String(const iString *canonicalUrl) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (const char *ch = constBegin_String(canonicalUrl); ch != constEnd_String(canonicalUrl);
+         ch++) {
+        hash = (hash ^ (uint8_t) *ch) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
 iRangecc mediaTypeWithoutParameters_Rangecc(iRangecc mime) {
     iRangecc part = iNullRange;
     nextSplit_Rangecc(mime, ";", &part);
@@ -771,6 +848,10 @@ static const struct {
       { 0x1f520, /* ABCD */
         "${error.glyphs}",
         "${error.glyphs.msg}" } },
+    { offlineCopy_GmStatusCode,
+      { 0x1f4e6, /* package */
+        "${error.offline}",
+        "${error.offline.msg}" } },
     { temporaryFailure_GmStatusCode,
       { 0x1f50c, /* electric plug */
         "${error.temporary}",
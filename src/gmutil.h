@@ -47,6 +47,7 @@ enum iGmStatusCode {
     tlsServerCertificateNotVerified_GmStatusCode,
     ansiEscapes_GmStatusCode,
     missingGlyphs_GmStatusCode,
+    offlineCopy_GmStatusCode,
 
     none_GmStatusCode                      = 0,
     /* general status code categories */
@@ -134,6 +135,7 @@ iString *       localFilePathFromUrl_String(const iString *);
 void            urlEncodeSpaces_String  (iString *);
 const iString * withSpacesEncoded_String(const iString *);
 const iString * canonicalUrl_String     (const iString *);
+uint64_t        urlHash_String          (const iString *canonicalUrl); /* FNV-1a */
 
 const char *    mediaType_Path                      (const iString *path);
 const char *    mediaTypeFromFileExtension_String   (const iString *);
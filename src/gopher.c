@@ -26,14 +26,6 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 iDefineTypeConstruction(Gopher)
 
-iLocalDef iBool isCRLFLineTerminator_(const char *str) {
-    return str[0] == '\r' && str[1] == '\n';
-}
-
-iLocalDef iBool isLineTerminator_(const char *str) {
-    return isCRLFLineTerminator_(str) || str[0] == '\n';
-}
-
 iLocalDef iBool isDiagram_(char ch) {
     return strchr("^*_-=~/|\\<>()[]{}", ch) != NULL;
 }
@@ -97,21 +89,27 @@ static void setPre_Gopher_(iGopher *d, iBool pre) {
 }
 
 static iBool convertSource_Gopher_(iGopher *d) {
+    /* Only complete lines are converted, and each of them just once: the converted part of
+       the source is dropped, and the search for the end of an incomplete line continues
+       where it left off. */
     iBool    converted = iFalse;
     iRangecc body      = range_Block(&d->source);
-    iRegExp *pattern   = new_RegExp("(.)([^\t]*)\t([^\t]*)\t([^\t]*)\t([0-9]+)", 0);
+    if (!d->menuPattern) {
+        d->menuPattern = new_RegExp("(.)([^\t]*)\t([^\t]*)\t([^\t]*)\t([0-9]+)", 0);
+    }
+    iRegExp *pattern = d->menuPattern;
+    const char *scan = body.start + d->scanPos;
     for (;;) {
         /* Find the end of the line. */
-        iRangecc line = { body.start, body.start };
-        while (line.end < body.end - 1 && !isLineTerminator_(line.end)) {
-            line.end++;
-        }
-        if (line.end >= body.end - 1 || !isLineTerminator_(line.end)) {
+        const char *lineEnd = memchr(scan, '\n', body.end - scan);
+        if (!lineEnd) {
             /* Not a complete line. More may be coming later. */
             break;
         }
-        body.start = line.end + (isCRLFLineTerminator_(line.end) ? 2 : 1);
+        iRangecc line = { body.start, lineEnd };
+        body.start = scan = lineEnd + 1;
         trimEnd_Rangecc(&line);
+        const size_t outputSize = size_Block(d->output);
         iRegExpMatch m;
         init_RegExpMatch(&m);
         if (matchRange_RegExp(pattern, line, &m)) {
@@ -177,6 +175,7 @@ static iBool convertSource_Gopher_(iGopher *d) {
                     break;
             }
             delete_String(buf);
+            converted |= (size_Block(d->output) != outputSize);
         }
         else {
 #if !defined (NDEBUG)
@@ -184,9 +183,9 @@ static iBool convertSource_Gopher_(iGopher *d) {
 #endif
         }
     }
-    iRelease(pattern);
     /* Remove the part of the source that was successfully converted. */
     remove_Block(&d->source, 0, body.start - constBegin_Block(&d->source));
+    d->scanPos = size_Block(&d->source);
     return converted;
 }
 
@@ -194,6 +193,8 @@ void init_Gopher(iGopher *d) {
     d->socket = NULL;
     d->type = 0;
     init_Block(&d->source, 0);
+    d->scanPos = 0;
+    d->menuPattern = NULL;
     d->needQueryArgs = iFalse;
     d->isPre = iFalse;
     d->meta = NULL;
@@ -201,6 +202,7 @@ void init_Gopher(iGopher *d) {
 }
 
 void deinit_Gopher(iGopher *d) {
+    iRelease(d->menuPattern);
     deinit_Block(&d->source);
     iReleasePtr(&d->socket);
 }
@@ -264,6 +266,7 @@ void open_Gopher(iGopher *d, const iString *url) {
             break;
     }
     d->isPre = iFalse;
+    d->scanPos = 0;
     open_Socket(d->socket);
     const iString *reqPath =
         collect_String(urlDecodeExclude_String(collectNewRange_String(parts.path), "\t"));
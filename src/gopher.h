@@ -32,7 +32,9 @@ iDeclareType(Gopher)
 struct Impl_Gopher {
     iSocket *socket;
     char     type;
-    iBlock   source;
+    iBlock   source;  /* not yet converted */
+    size_t   scanPos; /* the source has no line terminators before this */
+    iRegExp *menuPattern;
     iBool    isPre;
     iBool    needQueryArgs;
     iString *meta;
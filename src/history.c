@@ -21,12 +21,14 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "history.h"
+#include "respcache.h"
 #include "ui/root.h"
 #include "app.h"
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
+#include <the_Foundation/sortedarray.h>
 #include <the_Foundation/stringset.h>
 #include <math.h>
 
@@ -36,7 +38,11 @@ void init_RecentUrl(iRecentUrl *d) {
     init_String(&d->url);
     d->normScrollY    = 0;
     d->cachedResponse = NULL;
+    d->cacheKey       = 0;
+    d->compressedBody = NULL;
+    d->contentFilter  = NULL;
     d->cachedDoc      = NULL;
+    d->cachedLayout   = NULL;
     d->flags.openedFromSidebar = iFalse;
 }
 
@@ -44,6 +50,9 @@ void deinit_RecentUrl(iRecentUrl *d) {
     iRelease(d->cachedDoc);
     deinit_String(&d->url);
     delete_GmResponse(d->cachedResponse);
+    delete_Block(d->compressedBody);
+    delete_Block(d->contentFilter);
+    delete_Block(d->cachedLayout);
 }
 
 iDefineTypeConstruction(RecentUrl)
@@ -53,7 +62,11 @@ iRecentUrl *copy_RecentUrl(const iRecentUrl *d) {
     set_String(&copy->url, &d->url);
     copy->normScrollY    = d->normScrollY;
     copy->cachedResponse = d->cachedResponse ? copy_GmResponse(d->cachedResponse) : NULL;
+    copy->cacheKey       = d->cacheKey;
+    copy->compressedBody = d->compressedBody ? copy_Block(d->compressedBody) : NULL;
+    copy->contentFilter  = d->contentFilter ? copy_Block(d->contentFilter) : NULL;
     copy->cachedDoc      = ref_Object(d->cachedDoc);
+    copy->cachedLayout   = d->cachedLayout ? copy_Block(d->cachedLayout) : NULL;
     copy->flags          = d->flags;
     return copy;
 }
@@ -64,14 +77,181 @@ size_t cacheSize_RecentUrl(const iRecentUrl *d) {
         size += size_String(&d->cachedResponse->meta);
         size += size_Block(&d->cachedResponse->body);
     }
+    if (d->compressedBody) {
+        size += size_Block(d->compressedBody);
+    }
+    if (d->cachedLayout) {
+        size += size_Block(d->cachedLayout);
+    }
     return size;    
 }
 
+static void releaseCachedDoc_RecentUrl_(iRecentUrl *d) {
+    /* The layout can still be restored quickly from the snapshot. */
+    if (d->cachedDoc && d->cachedResponse) {
+        iBlock *snapshot = layoutSnapshot_GmDocument(d->cachedDoc);
+        if (snapshot) {
+            delete_Block(d->cachedLayout);
+            d->cachedLayout = snapshot;
+        }
+    }
+    iReleasePtr(&d->cachedDoc);
+}
+
+/* The content filter is a bit set of hashed, ASCII case folded trigrams of the response
+   body. A search term whose trigrams are not all present cannot match, so the body does
+   not need to be scanned (or decompressed). */
+
+static const size_t minFilterBits_RecentUrl_ = 1024;
+static const size_t maxFilterBits_RecentUrl_ = 65536;
+
+static uint8_t foldCase_(uint8_t ch) {
+    return ch >= 'A' && ch <= 'Z' ? ch + ('a' - 'A') : ch;
+}
+
+static uint32_t trigramBit_(const uint8_t *chars, size_t numBits) {
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    for (int i = 0; i < 3; i++) {
+        hash = (hash ^ foldCase_(chars[i])) * 16777619u;
+    }
+    return hash & (numBits - 1);
+}
+
+static void updateContentFilter_RecentUrl_(iRecentUrl *d) {
+    delete_Block(d->contentFilter);
+    d->contentFilter = NULL;
+    const iGmResponse *resp = d->cachedResponse;
+    if (!resp || d->compressedBody ||
+        category_GmStatusCode(resp->statusCode) != categorySuccess_GmStatusCode ||
+        !startsWithCase_String(&resp->meta, "text/")) {
+        return;
+    }
+    const size_t   size  = size_Block(&resp->body);
+    const uint8_t *chars = constData_Block(&resp->body);
+    size_t numBits = minFilterBits_RecentUrl_;
+    while (numBits < size && numBits < maxFilterBits_RecentUrl_) {
+        numBits <<= 1;
+    }
+    d->contentFilter = new_Block(numBits / 8);
+    fill_Block(d->contentFilter, 0);
+    uint8_t *bits = data_Block(d->contentFilter);
+    for (size_t i = 0; i + 2 < size; i++) {
+        const uint32_t bit = trigramBit_(chars + i, numBits);
+        bits[bit >> 3] |= 1 << (bit & 7);
+    }
+}
+
+static iBool mayContain_RecentUrl_(const iRecentUrl *d, const iString *words) {
+    if (!d->contentFilter || !words) {
+        return iTrue;
+    }
+    const size_t   numBits = size_Block(d->contentFilter) * 8;
+    const uint8_t *bits    = constData_Block(d->contentFilter);
+    iRangecc word = iNullRange;
+    while (nextSplit_Rangecc(range_String(words), " ", &word)) {
+        for (const uint8_t *ch = (const uint8_t *) word.start; ch + 2 < (const uint8_t *) word.end;
+             ch++) {
+            if ((ch[0] | ch[1] | ch[2]) & 0x80) {
+                continue; /* non-ASCII may be case folded differently by the pattern */
+            }
+            const uint32_t bit = trigramBit_(ch, numBits);
+            if (~bits[bit >> 3] & (1 << (bit & 7))) {
+                return iFalse;
+            }
+        }
+    }
+    return iTrue;
+}
+
+static void decompress_RecentUrl_(iRecentUrl *d) {
+#if defined (iHaveZlib)
+    if (d->compressedBody) {
+        iBlock *body = decompress_Block(d->compressedBody);
+        set_Block(&d->cachedResponse->body, body);
+        delete_Block(body);
+        delete_Block(d->compressedBody);
+        d->compressedBody = NULL;
+    }
+#else
+    iUnused(d);
+#endif
+}
+
+static iGmResponse *decompressedCopy_RecentUrl_(const iRecentUrl *d) {
+    /* Returns NULL if the response isn't compressed. */
+    iGmResponse *copy = NULL;
+#if defined (iHaveZlib)
+    if (d->compressedBody) {
+        copy = copy_GmResponse(d->cachedResponse);
+        iBlock *body = decompress_Block(d->compressedBody);
+        set_Block(&copy->body, body);
+        delete_Block(body);
+    }
+#else
+    iUnused(d);
+#endif
+    return copy;
+}
+
+static iBool compress_RecentUrl_(iRecentUrl *d) {
+    /* Returns True if the body was compressed. Compressed bodies take less of the cache
+       budget; they are decompressed when navigating back to the page. */
+#if defined (iHaveZlib)
+    if (d->cachedResponse && !d->compressedBody && isCompressible_GmResponse(d->cachedResponse)) {
+        const iBlock *body = &d->cachedResponse->body;
+        iBlock *compressed = compress_Block(body);
+        if (size_Block(compressed) < size_Block(body) * 9 / 10) {
+            /* The state file refers to the disk cache, so store it there while it's at hand. */
+            if (!contains_ResponseCache(d->cacheKey)) {
+                d->cacheKey = store_ResponseCache(d->cachedResponse);
+            }
+            d->compressedBody = compressed;
+            clear_Block(&d->cachedResponse->body);
+            return iTrue;
+        }
+        delete_Block(compressed);
+    }
+#else
+    iUnused(d);
+#endif
+    return iFalse;
+}
+
+static void loadCachedResponse_RecentUrl_(iRecentUrl *d) {
+    decompress_RecentUrl_(d);
+    if (!d->cachedResponse && d->cacheKey) {
+        d->cachedResponse = load_ResponseCache(d->cacheKey);
+        if (!d->cachedResponse) {
+            d->cacheKey = 0; /* has been evicted */
+        }
+    }
+    if (d->cachedResponse && !d->contentFilter) {
+        updateContentFilter_RecentUrl_(d);
+    }
+}
+
+static void dropCachedResponse_RecentUrl_(iRecentUrl *d) {
+    /* The response remains available on disk, if there is room. */
+    if (d->cachedResponse && !contains_ResponseCache(d->cacheKey)) {
+        decompress_RecentUrl_(d);
+        d->cacheKey = store_ResponseCache(d->cachedResponse);
+    }
+    delete_GmResponse(d->cachedResponse);
+    d->cachedResponse = NULL;
+    delete_Block(d->compressedBody);
+    d->compressedBody = NULL;
+    delete_Block(d->contentFilter);
+    d->contentFilter = NULL;
+}
+
 size_t memorySize_RecentUrl(const iRecentUrl *d) {
     size_t size = cacheSize_RecentUrl(d);
     if (d->cachedDoc) {
         size += memorySize_GmDocument(d->cachedDoc);
     }
+    if (d->contentFilter) {
+        size += size_Block(d->contentFilter);
+    }
     return size;
 }
 
@@ -174,9 +354,39 @@ void serialize_History(const iHistory *d, iStream *outs) {
         serialize_String(&item->url, outs);
         write32_Stream(outs, item->normScrollY * 1.0e6f);
         writeU16_Stream(outs, item->flags.openedFromSidebar ? iBit(1) : 0);
-        if (item->cachedResponse) {
-            write8_Stream(outs, 1);
-            serialize_GmResponse(item->cachedResponse, outs);
+        /* Response bodies are stored in the disk cache when they arrive, so the state file
+           only refers to them. Ones that didn't fit in the disk cache are written here. */
+        iGmResponse *full = NULL;
+        uint64_t cacheKey = 0;
+        if (contains_ResponseCache(item->cacheKey)) {
+            cacheKey = item->cacheKey;
+        }
+        else if (item->cachedResponse) {
+            full = decompressedCopy_RecentUrl_(item);
+        }
+        if (item->cachedResponse || cacheKey) {
+            if (cacheKey) {
+                write8_Stream(outs, 2);
+                writeU64_Stream(outs, cacheKey);
+            }
+            else {
+                write8_Stream(outs, 1);
+                serialize_GmResponse(full ? full : item->cachedResponse, outs);
+            }
+            delete_GmResponse(full);
+            /* Layout snapshot. */ {
+                iBlock *snapshot = item->cachedDoc ? layoutSnapshot_GmDocument(item->cachedDoc)
+                                                   : NULL;
+                const iBlock *layout = snapshot ? snapshot : item->cachedLayout;
+                if (layout) {
+                    write8_Stream(outs, 1);
+                    serialize_Block(layout, outs);
+                }
+                else {
+                    write8_Stream(outs, 0);
+                }
+                delete_Block(snapshot);
+            }
         }
         else {
             write8_Stream(outs, 0);
@@ -202,9 +412,19 @@ void deserialize_History(iHistory *d, iStream *ins) {
                 item.flags.openedFromSidebar = iTrue;
             }
         }
-        if (read8_Stream(ins)) {
-            item.cachedResponse = new_GmResponse();
-            deserialize_GmResponse(item.cachedResponse, ins);
+        const int cached = read8_Stream(ins);
+        if (cached) {
+            if (cached == 2) {
+                item.cacheKey = readU64_Stream(ins); /* loaded when needed */
+            }
+            else {
+                item.cachedResponse = new_GmResponse();
+                deserialize_GmResponse(item.cachedResponse, ins);
+            }
+            if (version_Stream(ins) >= addedLayoutSnapshots_FileVersion && read8_Stream(ins)) {
+                item.cachedLayout = new_Block(0);
+                deserialize_Block(item.cachedLayout, ins);
+            }
         }
         pushBack_Array(&d->recent, &item);
     }
@@ -251,6 +471,7 @@ iRecentUrl *findUrl_History(iHistory *d, const iString *url) {
     lock_Mutex(d->mtx);
     iReverseForEach(Array, i, &d->recent) {
         if (cmpStringCase_String(url, &((iRecentUrl *) i.value)->url) == 0) {
+            loadCachedResponse_RecentUrl_(i.value);
             unlock_Mutex(d->mtx);
             return i.value;
         }
@@ -384,9 +605,14 @@ void setCachedResponse_History(iHistory *d, const iGmResponse *response) {
     if (item) {
         delete_GmResponse(item->cachedResponse);
         item->cachedResponse = NULL;
+        item->cacheKey       = 0;
+        delete_Block(item->compressedBody);
+        item->compressedBody = NULL;
         if (category_GmStatusCode(response->statusCode) == categorySuccess_GmStatusCode) {
             item->cachedResponse = copy_GmResponse(response);
+            item->cacheKey       = store_ResponseCache(response); /* once per response */
         }
+        updateContentFilter_RecentUrl_(item);
     }
     unlock_Mutex(d->mtx);
 }
@@ -435,7 +661,17 @@ void clearCache_History(iHistory *d) {
             delete_GmResponse(url->cachedResponse);
             url->cachedResponse = NULL;
         }
+        if (url->cacheKey) {
+            remove_ResponseCache(url->cacheKey);
+            url->cacheKey = 0;
+        }
+        delete_Block(url->compressedBody);
+        url->compressedBody = NULL;
+        delete_Block(url->contentFilter);
+        url->contentFilter = NULL;
         iReleasePtr(&url->cachedDoc); /* release all cached documents and media as well */
+        delete_Block(url->cachedLayout);
+        url->cachedLayout = NULL;
     }
     unlock_Mutex(d->mtx);
 }
@@ -451,68 +687,134 @@ void invalidateCachedLayout_History(iHistory *d) {
     unlock_Mutex(d->mtx);
 }
 
-size_t pruneLeastImportant_History(iHistory *d) {
-    size_t delta  = 0;
-    size_t chosen = iInvalidPos;
-    double score  = 0.0f;
-    iTime now;
-    initCurrent_Time(&now);
-    lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        if (url->cachedResponse) {
-            const double urlScore =
-                cacheSize_RecentUrl(url) *
-                pow(secondsSince_Time(&now, &url->cachedResponse->when) / 60.0, 1.25);
-            if (urlScore > score) {
-                chosen = index_ArrayConstIterator(&i);
-                score  = urlScore;
-            }
-        }
+/*----------------------------------------------------------------------------------------------*/
+
+/* Eviction is done globally across all tabs' histories: every cached item is a candidate in
+   a single queue ordered by how much is gained by evicting it (size) weighed against how
+   likely it is to be needed again (age) and how long it would take to get it back on screen
+   (refetch latency, relayout). */
+
+iDeclareType(EvictionCandidate)
+
+struct Impl_EvictionCandidate {
+    iHistory *history;
+    size_t    index;    /* in `history->recent` */
+    size_t    size;
+    double    score;
+};
+
+static int cmp_EvictionCandidate_(const void *a, const void *b) {
+    const iEvictionCandidate *x = a, *y = b;
+    /* Ascending, so the best candidate is at the back of the queue. */
+    return x->score < y->score ? -1 : x->score > y->score ? 1 : 0;
+}
+
+static const double layoutBytesPerMs_History_ = 10000.0; /* rough cost of laying out source */
+
+static double relayoutCost_RecentUrl_(const iRecentUrl *d, iBool haveSnapshot) {
+    /* Milliseconds. Restoring a layout snapshot is much cheaper than laying out from scratch. */
+    double bytes = 0.0;
+    if (d->cachedResponse) {
+        bytes = d->compressedBody ? size_Block(d->compressedBody) * 4.0 /* approximately */
+                                  : size_Block(&d->cachedResponse->body);
     }
-    if (chosen != iInvalidPos) {
-        iRecentUrl *url = at_Array(&d->recent, chosen);
-        delta = cacheSize_RecentUrl(url);
-        delete_GmResponse(url->cachedResponse);
-        url->cachedResponse = NULL;
-        iReleasePtr(&url->cachedDoc);
+    return bytes / layoutBytesPerMs_History_ * (haveSnapshot ? 0.1 : 1.0);
+}
+
+static double refetchCost_RecentUrl_(const iRecentUrl *d) {
+    /* Milliseconds. Responses that were written in the disk cache are quick to load. */
+    if (d->cachedResponse && !(d->compressedBody && contains_ResponseCache(d->cacheKey))) {
+        return d->cachedResponse->timing.finished ? d->cachedResponse->timing.finished
+                                                  : hostLatency_GmRequest(&d->url);
     }
-    unlock_Mutex(d->mtx);
-    return delta;
+    return 0.0;
+}
+
+static double evictionScore_RecentUrl_(const iRecentUrl *d, size_t size, iBool isMemory,
+                                       const iTime *now) {
+    const double age = d->cachedResponse
+                           ? pow(secondsSince_Time(now, &d->cachedResponse->when) / 60.0, 1.25)
+                           : 1.0;
+    const double cost = isMemory ? relayoutCost_RecentUrl_(d, iTrue)
+                                 : refetchCost_RecentUrl_(d) + relayoutCost_RecentUrl_(d, iFalse);
+    return size * age / (1.0 + cost / 1000.0);
+}
+
+static size_t pruneCache_RecentUrl_(iRecentUrl *d) {
+    const size_t before = cacheSize_RecentUrl(d);
+    /* Compressing the body is tried first; it is dropped entirely the next time. */
+    if (!compress_RecentUrl_(d)) {
+        dropCachedResponse_RecentUrl_(d);
+        iReleasePtr(&d->cachedDoc);
+        delete_Block(d->cachedLayout);
+        d->cachedLayout = NULL;
+    }
+    const size_t after = cacheSize_RecentUrl(d);
+    return before > after ? before - after : 0;
 }
 
-size_t pruneLeastImportantMemory_History(iHistory *d) {
-    size_t delta  = 0;
-    size_t chosen = iInvalidPos;
-    double score  = 0.0f;
+static size_t pruneMemory_RecentUrl_(iRecentUrl *d) {
+    const size_t before = memorySize_RecentUrl(d);
+    releaseCachedDoc_RecentUrl_(d);
+    const size_t after = memorySize_RecentUrl(d);
+    return before > after ? before - after : 0;
+}
+
+static void trim_History_(const iPtrArray *histories, size_t limit, iBool isMemory) {
     iTime now;
     initCurrent_Time(&now);
-    lock_Mutex(d->mtx);
-    iConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        if (d->recentPos == size_Array(&d->recent) - index_ArrayConstIterator(&i) - 1) {
-            continue; /* Not the current navigation position. */
-        }
-        if (url->cachedDoc) {
-            const double urlScore =
-                memorySize_RecentUrl(url) *
-                (url->cachedResponse
-                     ? pow(secondsSince_Time(&now, &url->cachedResponse->when) / 60.0, 1.25)
-                     : 1.0);
-            if (urlScore > score) {
-                chosen = index_ArrayConstIterator(&i);
-                score  = urlScore;
+    iSortedArray queue;
+    init_SortedArray(&queue, sizeof(iEvictionCandidate), cmp_EvictionCandidate_);
+    /* The totals are gathered in the same pass that fills the queue, and then updated
+       as items are evicted. */
+    size_t total = 0;
+    iConstForEach(PtrArray, h, histories) {
+        iHistory *hist = h.ptr;
+        lock_Mutex(hist->mtx);
+        iConstForEach(Array, i, &hist->recent) {
+            const iRecentUrl *url  = i.value;
+            const size_t      size = isMemory ? memorySize_RecentUrl(url) : cacheSize_RecentUrl(url);
+            total += size;
+            if (isMemory ? !url->cachedDoc : !url->cachedResponse) {
+                continue;
+            }
+            if (isMemory &&
+                hist->recentPos == size_Array(&hist->recent) - index_ArrayConstIterator(&i) - 1) {
+                continue; /* Not the current navigation position. */
             }
+            pushBack_Array(&queue.values, &(iEvictionCandidate){
+                hist, index_ArrayConstIterator(&i), size,
+                evictionScore_RecentUrl_(url, size, isMemory, &now) });
         }
+        unlock_Mutex(hist->mtx);
     }
-    if (chosen != iInvalidPos) {
-        iRecentUrl *url = at_Array(&d->recent, chosen);
-        const size_t before = memorySize_RecentUrl(url);
-        iReleasePtr(&url->cachedDoc);
-        delta = before - memorySize_RecentUrl(url);
+    if (total > limit) {
+        sort_Array(&queue.values, cmp_EvictionCandidate_);
     }
-    unlock_Mutex(d->mtx);
-    return delta;
+    while (total > limit && !isEmpty_Array(&queue.values)) {
+        iEvictionCandidate cand = *(const iEvictionCandidate *) back_Array(&queue.values);
+        popBack_Array(&queue.values);
+        lock_Mutex(cand.history->mtx);
+        iRecentUrl *url = at_Array(&cand.history->recent, cand.index);
+        const size_t pruned = isMemory ? pruneMemory_RecentUrl_(url) : pruneCache_RecentUrl_(url);
+        total -= iMin(total, pruned);
+        if (!isMemory && url->cachedResponse) {
+            /* Compressed; remains a candidate with its new size. */
+            cand.size  = cacheSize_RecentUrl(url);
+            cand.score = evictionScore_RecentUrl_(url, cand.size, isMemory, &now);
+            insert_SortedArray(&queue, &cand);
+        }
+        unlock_Mutex(cand.history->mtx);
+    }
+    deinit_SortedArray(&queue);
+}
+
+void trimCache_History(const iPtrArray *histories, size_t limit) {
+    trim_History_(histories, limit, iFalse);
+}
+
+void trimMemory_History(const iPtrArray *histories, size_t limit) {
+    trim_History_(histories, limit, iTrue);
 }
 
 void invalidateTheme_History(iHistory *d) {
@@ -526,18 +828,28 @@ void invalidateTheme_History(iHistory *d) {
     unlock_Mutex(d->mtx);
 }
 
-const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pattern) {
+const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pattern,
+                                          const iString *words) {
     iStringArray *urls = iClob(new_StringArray());
     lock_Mutex(d->mtx);
     iStringSet inserted;
     init_StringSet(&inserted);
-    iReverseConstForEach(Array, i, &d->recent) {
-        const iRecentUrl *url = i.value;
-        const iGmResponse *resp = url->cachedResponse;
-        if (resp && category_GmStatusCode(resp->statusCode) == categorySuccess_GmStatusCode) {
-            if (indexOfCStrSc_String(&resp->meta, "text/", &iCaseInsensitive) == iInvalidPos) {
+    iReverseForEach(Array, i, iConstCast(iArray *, &d->recent)) {
+        iRecentUrl *url = i.value;
+        if (url->cachedResponse && !url->contentFilter && !url->compressedBody) {
+            updateContentFilter_RecentUrl_(url); /* for example, deserialized */
+        }
+        if (!mayContain_RecentUrl_(url, words)) {
+            continue;
+        }
+        if (url->cachedResponse &&
+            category_GmStatusCode(url->cachedResponse->statusCode) == categorySuccess_GmStatusCode) {
+            if (indexOfCStrSc_String(&url->cachedResponse->meta, "text/", &iCaseInsensitive) ==
+                iInvalidPos) {
                 continue;
             }
+            iGmResponse *full = decompressedCopy_RecentUrl_(url);
+            const iGmResponse *resp = full ? full : url->cachedResponse;
             iRegExpMatch m;
             init_RegExpMatch(&m);
             if (matchRange_RegExp(pattern, range_Block(&resp->body), &m)) {
@@ -570,6 +882,7 @@ const iStringArray *searchContents_History(const iHistory *d, const iRegExp *pat
                 }
                 deinit_String(&entry);
             }
+            delete_GmResponse(full);
         }
     }
     deinit_StringSet(&inserted);
@@ -38,7 +38,11 @@ struct Impl_RecentUrl {
     iString      url;
     float        normScrollY;    /* normalized to document height */
     iGmResponse *cachedResponse; /* kept in memory for quicker back navigation */
+    uint64_t     cacheKey;       /* response stored in ResponseCache; loaded when needed */
+    iBlock *     compressedBody; /* body of `cachedResponse` while compressed (body is empty) */
+    iBlock *     contentFilter;  /* trigrams of the cached text, for skipping non-matches in searches */
     iGmDocument *cachedDoc;      /* cached copy of the presentation: layout and media (not serialized) */
+    iBlock *     cachedLayout;   /* layout snapshot of `cachedDoc`, kept when the doc is released */
     struct {
         uint8_t openedFromSidebar : 1;
     } flags;
@@ -73,15 +77,16 @@ iRecentUrl *mostRecentUrl_History       (iHistory *);
 iRecentUrl *findUrl_History             (iHistory *, const iString *url);
 
 void        clearCache_History                  (iHistory *);
-size_t      pruneLeastImportant_History         (iHistory *);
-size_t      pruneLeastImportantMemory_History   (iHistory *);
+void        trimCache_History                   (const iPtrArray *histories, size_t limit);
+void        trimMemory_History                  (const iPtrArray *histories, size_t limit);
 void        invalidateTheme_History             (iHistory *); /* theme has changed, cached contents need updating */
 void        invalidateCachedLayout_History      (iHistory *);
 
 iBool       atLatest_History            (const iHistory *);
 iBool       atOldest_History            (const iHistory *);
 
-const iStringArray *   searchContents_History   (const iHistory *, const iRegExp *pattern); /* chronologically ascending */
+const iStringArray *   searchContents_History   (const iHistory *, const iRegExp *pattern,
+                                                 const iString *words); /* chronologically ascending */
 
 const iString *
             url_History                 (const iHistory *, size_t pos);
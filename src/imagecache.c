@@ -0,0 +1,150 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "imagecache.h"
+#include "ui/paint.h" /* size_SDLTexture */
+
+#include <the_Foundation/ptrarray.h>
+
+struct Impl_ImageCacheEntry {
+    uint64_t     key;
+    SDL_Texture *texture;
+    size_t       numBytes;
+    int          refCount;
+    uint32_t     lastUsed;
+};
+
+iDeclareType(ImageCache)
+
+struct Impl_ImageCache {
+    iPtrArray entries; /* TODO: Use a hash if there are lots of images. */
+    size_t    totalSize;
+    uint32_t  useCounter;
+};
+
+#if defined (iPlatformMobile)
+static const size_t budget_ImageCache_ = 64 * 1000000; /* bytes of texture memory */
+#else
+static const size_t budget_ImageCache_ = 256 * 1000000;
+#endif
+
+static iImageCache cache_;
+
+void init_ImageCache(void) {
+    iImageCache *d = &cache_;
+    init_PtrArray(&d->entries);
+    d->totalSize  = 0;
+    d->useCounter = 0;
+}
+
+void deinit_ImageCache(void) {
+    iImageCache *d = &cache_;
+    /* The textures were destroyed along with the renderer. */
+    iForEach(PtrArray, i, &d->entries) {
+        free(i.ptr);
+    }
+    deinit_PtrArray(&d->entries);
+}
+
+static void evict_ImageCache_(iImageCache *d, size_t budget) {
+    while (d->totalSize > budget) {
+        /* Drop the least recently used entry that is not in use. */
+        const iImageCacheEntry *oldest = NULL;
+        size_t oldestPos = iInvalidPos;
+        iConstForEach(PtrArray, i, &d->entries) {
+            const iImageCacheEntry *entry = i.ptr;
+            if (entry->refCount == 0 &&
+                (!oldest || (int32_t) (entry->lastUsed - oldest->lastUsed) < 0)) {
+                oldest    = entry;
+                oldestPos = index_PtrArrayConstIterator(&i);
+            }
+        }
+        if (!oldest) {
+            break; /* everything is in use */
+        }
+        iImageCacheEntry *entry = NULL;
+        take_PtrArray(&d->entries, oldestPos, (void **) &entry);
+        d->totalSize -= entry->numBytes;
+        SDL_DestroyTexture(entry->texture);
+        free(entry);
+    }
+}
+
+iImageCacheEntry *acquire_ImageCache(uint64_t key) {
+    iImageCache *d = &cache_;
+    iForEach(PtrArray, i, &d->entries) {
+        iImageCacheEntry *entry = i.ptr;
+        if (entry->key == key) {
+            entry->refCount++;
+            entry->lastUsed = ++d->useCounter;
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+iImageCacheEntry *insert_ImageCache(uint64_t key, SDL_Texture *tex) {
+    iImageCache *d = &cache_;
+    iImageCacheEntry *entry = acquire_ImageCache(key);
+    if (entry) {
+        /* Someone else decoded the same image in the meantime. */
+        SDL_DestroyTexture(tex);
+        return entry;
+    }
+    const iInt2 texSize = size_SDLTexture(tex);
+    Uint32 format;
+    SDL_QueryTexture(tex, &format, NULL, NULL, NULL);
+    entry = malloc(sizeof(iImageCacheEntry));
+    entry->key      = key;
+    entry->texture  = tex;
+    entry->numBytes = SDL_BYTESPERPIXEL(format) * texSize.x * texSize.y;
+    entry->refCount = 1;
+    entry->lastUsed = ++d->useCounter;
+    pushBack_PtrArray(&d->entries, entry);
+    d->totalSize += entry->numBytes;
+    evict_ImageCache_(d, budget_ImageCache_);
+    return entry;
+}
+
+void release_ImageCache(iImageCacheEntry *entry) {
+    if (entry) {
+        iAssert(entry->refCount > 0);
+        entry->refCount--;
+        evict_ImageCache_(&cache_, budget_ImageCache_);
+    }
+}
+
+SDL_Texture *texture_ImageCacheEntry(const iImageCacheEntry *d) {
+    return d->texture;
+}
+
+size_t memorySize_ImageCacheEntry(const iImageCacheEntry *d) {
+    return d->numBytes;
+}
+
+size_t memorySize_ImageCache(void) {
+    return cache_.totalSize;
+}
+
+void trim_ImageCache(void) {
+    evict_ImageCache_(&cache_, 0);
+}
@@ -0,0 +1,46 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/defs.h>
+#include <SDL_render.h>
+
+/* App-wide cache of image textures, shared by all documents. Images are identified by a hash
+   of their source data and decoding parameters (see `cacheKey_ImageDecoder()`). Entries are
+   reference counted; unused ones are kept around until the total size exceeds the budget,
+   so going back in history or seeing the same image on another page doesn't need decoding. */
+
+iDeclareType(ImageCacheEntry)
+
+void                init_ImageCache     (void);
+void                deinit_ImageCache   (void); /* after the renderer has been destroyed */
+
+iImageCacheEntry *  acquire_ImageCache  (uint64_t key); /* NULL if not cached */
+iImageCacheEntry *  insert_ImageCache   (uint64_t key, SDL_Texture *tex); /* acquired */
+void                release_ImageCache  (iImageCacheEntry *);
+
+SDL_Texture *       texture_ImageCacheEntry     (const iImageCacheEntry *);
+size_t              memorySize_ImageCacheEntry  (const iImageCacheEntry *);
+
+size_t              memorySize_ImageCache   (void); /* bytes of texture memory */
+void                trim_ImageCache         (void); /* destroy all entries not in use */
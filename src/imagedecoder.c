@@ -0,0 +1,436 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "imagedecoder.h"
+#include "app.h"
+#include "jobs.h"
+#include "prefs.h"
+#include "profiler.h"
+#include "ui/color.h"
+#include "ui/window.h"
+#include "stb_image.h"
+#include "stb_image_resize.h"
+
+#if defined (LAGRANGE_ENABLE_WEBP)
+#   include <webp/decode.h>
+#endif
+
+#include <the_Foundation/mutex.h>
+#include <SDL_hints.h>
+
+enum iImageDecodeState {
+    queued_ImageDecodeState,
+    decoding_ImageDecodeState,
+    finished_ImageDecodeState,
+    cancelled_ImageDecodeState, /* deleted by the worker when done */
+};
+
+iDeclareType(ImageDecodeParams)
+
+/* Everything that affects the decoded pixels besides the source data. These are captured in
+   the main thread because the palette and the window can't be accessed in a worker. */
+struct Impl_ImageDecodeParams {
+    enum iImageStyle style;
+    iColor           dark;
+    iColor           light;
+    iColor           colorize;
+    iInt2            maxSize; /* of the texture */
+};
+
+static void init_ImageDecodeParams_(iImageDecodeParams *d) {
+    iZap(*d);
+    d->style = prefs_App()->imageStyle;
+    if (d->style != original_ImageStyle) {
+        d->dark     = get_Color(tmBackground_ColorId);
+        d->light    = get_Color(tmParagraph_ColorId);
+        d->colorize = get_Color(d->style == textColorized_ImageStyle ? tmParagraph_ColorId
+                                                                     : tmPreformatted_ColorId);
+    }
+    /* Resize down to min(maximum texture size, window size). */ {
+        iWindow *window = get_Window();
+        SDL_Rect dispRect;
+        SDL_GetDisplayBounds(SDL_GetWindowDisplayIndex(window->win), &dispRect);
+        d->maxSize = coord_Window(window, dispRect.w, dispRect.h);
+        if (!isEqual_I2(maxTextureSize_Window(window), zero_I2())) {
+            d->maxSize = min_I2(d->maxSize, maxTextureSize_Window(window));
+        }
+    }
+}
+
+struct Impl_ImageDecodeJob {
+    iString            mime;
+    iBlock             data;
+    iImageDecodeParams params;
+    iBool              isPreview;
+    iBool              isOpaque;
+    enum iImageDecodeState state;
+    iInt2              texSize;
+    uint8_t *          pixels; /* RGBA; NULL if decoding failed */
+    iJob *             job;
+};
+
+static void init_ImageDecodeJob(iImageDecodeJob *d, const iString *mime, const iBlock *data) {
+    initCopy_String(&d->mime, mime);
+    initCopy_Block(&d->data, data);
+    init_ImageDecodeParams_(&d->params);
+    d->isPreview = iFalse;
+    d->isOpaque  = iFalse;
+    d->state     = queued_ImageDecodeState;
+    d->texSize   = zero_I2();
+    d->pixels    = NULL;
+    d->job       = NULL;
+}
+
+static void deinit_ImageDecodeJob(iImageDecodeJob *d) {
+    release_Job(d->job);
+    free(d->pixels);
+    deinit_Block(&d->data);
+    deinit_String(&d->mime);
+}
+
+iDefineTypeConstructionArgs(ImageDecodeJob, (const iString *mime, const iBlock *data), mime, data)
+
+static void applyImageStyle_ImageDecodeJob_(const iImageDecodeJob *d, uint8_t *imgData) {
+    if (d->params.style == original_ImageStyle) {
+        return;
+    }
+    /* The styles only depend on the HSL luminance of the pixel, i.e., (max + min) / 2 of the
+       RGB components. The output colors are therefore precomputed for each possible sum. */
+    uint8_t lut[511][3];
+    if (d->params.style == bgFg_ImageStyle) {
+        iColor dark  = d->params.dark;
+        iColor light = d->params.light;
+        if (hsl_Color(dark).lum > hsl_Color(light).lum) {
+            iSwap(iColor, dark, light);
+        }
+        iForIndices(i, lut) {
+            const float t = i / 510.0f;
+            const float s = 1.0f - t;
+            lut[i][0] = dark.r * s + light.r * t;
+            lut[i][1] = dark.g * s + light.g * t;
+            lut[i][2] = dark.b * s + light.b * t;
+        }
+    }
+    else {
+        iColor colorize = (iColor){ 255, 255, 255, 255 };
+        float  brighten = 0.0f;
+        if (d->params.style != grayscale_ImageStyle) {
+            colorize = d->params.colorize;
+            /* Compensate for change in mid-tones. */
+            const int colMax = iMax(iMax(colorize.r, colorize.g), colorize.b);
+            brighten = iClamp(1.0f - (colorize.r + colorize.g + colorize.b) / (colMax * 3), 0.0f, 0.5f);
+        }
+        const iHSLColor hslColorize = hsl_Color(colorize);
+        iForIndices(i, lut) {
+            iHSLColor out = { hslColorize.hue, hslColorize.sat, i / 510.0f, 1.0f };
+            out.lum = powf(out.lum, 1.0f + brighten * 2);
+            iColor outRgb = rgb_HSLColor(out);
+            lut[i][0] = powf(outRgb.r / 255.0f, 1.0f - brighten * 0.75f) * 255;
+            lut[i][1] = powf(outRgb.g / 255.0f, 1.0f - brighten * 0.75f) * 255;
+            lut[i][2] = powf(outRgb.b / 255.0f, 1.0f - brighten * 0.75f) * 255;
+        }
+    }
+    uint8_t *pos = imgData;
+    for (size_t numPixels = (size_t) d->texSize.x * d->texSize.y; numPixels > 0; numPixels--) {
+        const int r = pos[0], g = pos[1], b = pos[2];
+        const uint8_t *out = lut[iMax(iMax(r, g), b) + iMin(iMin(r, g), b)];
+        pos[0] = out[0];
+        pos[1] = out[1];
+        pos[2] = out[2];
+        pos += 4;
+    }
+}
+
+static uint8_t *halve_(const uint8_t *imgData, iInt2 size, iInt2 *size_out) {
+    /* Box filter, i.e., one level down the mip chain. An odd last row or column is dropped. */
+    const iInt2 half = divi_I2(size, 2);
+    uint8_t    *out  = malloc(4 * half.x * half.y);
+    uint8_t    *dst  = out;
+    for (int y = 0; y < half.y; y++) {
+        const uint8_t *row0 = imgData + 4 * size.x * (2 * y);
+        const uint8_t *row1 = row0 + 4 * size.x;
+        for (int x = 0; x < half.x; x++, row0 += 8, row1 += 8) {
+            for (int c = 0; c < 4; c++) {
+                *dst++ = (row0[c] + row0[c + 4] + row1[c] + row1[c + 4] + 2) / 4;
+            }
+        }
+    }
+    *size_out = half;
+    return out;
+}
+
+static void decode_ImageDecodeJob_(iImageDecodeJob *d) {
+    const iBlock *data   = &d->data;
+    uint8_t      *imgData = NULL;
+    iInt2         size    = zero_I2();
+    if (cmp_String(&d->mime, "image/webp") == 0) {
+#if defined (LAGRANGE_ENABLE_WEBP)
+        imgData = WebPDecodeRGBA(constData_Block(data), size_Block(data), &size.x, &size.y);
+#endif        
+    }
+    else {
+        imgData = stbi_load_from_memory(
+            constData_Block(data), size_Block(data), &size.x, &size.y, NULL, 4);
+        if (!imgData && !d->isPreview) {
+            fprintf(stderr, "[ImageDecoder] image load failed: %s\n", stbi_failure_reason());
+        }
+    }
+    if (!imgData) {
+        return;
+    }
+    iInt2 scaled = size;
+    if (scaled.x > d->params.maxSize.x) {
+        scaled.y = scaled.y * d->params.maxSize.x / scaled.x;
+        scaled.x = d->params.maxSize.x;
+    }
+    if (scaled.y > d->params.maxSize.y) {
+        scaled.x = scaled.x * d->params.maxSize.y / scaled.y;
+        scaled.y = d->params.maxSize.y;
+    }
+    /* Large reductions are mostly done by halving, which is much cheaper than resampling
+       the full image with a wide filter kernel. */
+    while (size.x / 2 >= scaled.x && size.y / 2 >= scaled.y && size.x / 2 && size.y / 2) {
+        uint8_t *half = halve_(imgData, size, &size);
+        free(imgData);
+        imgData = half;
+    }
+    if (!isEqual_I2(scaled, size)) {
+        uint8_t *scaledImgData = malloc(scaled.x * scaled.y * 4);
+        stbir_resize_uint8(imgData, size.x, size.y, 4 * size.x,
+                           scaledImgData, scaled.x, scaled.y, scaled.x * 4, 4);
+        free(imgData);
+        imgData = scaledImgData;
+    }
+    /* Styling is done after downscaling since it's a per-pixel operation. */
+    d->texSize = scaled;
+    applyImageStyle_ImageDecodeJob_(d, imgData);
+    /* Opaque images don't need an alpha channel. */
+    const size_t numPixels = (size_t) scaled.x * scaled.y;
+    d->isOpaque = iTrue;
+    for (size_t i = 0; i < numPixels; i++) {
+        if (imgData[4 * i + 3] != 0xff) {
+            d->isOpaque = iFalse;
+            break;
+        }
+    }
+#if defined (iPlatformMobile)
+    if (d->isOpaque) {
+        /* Halve the texture memory use. The packed pixels are written over the beginning of
+           the same buffer. */
+        uint16_t *out = (uint16_t *) imgData;
+        for (size_t i = 0; i < numPixels; i++) {
+            const uint8_t *in = imgData + 4 * i;
+            out[i] = (uint16_t) (((in[0] >> 3) << 11) | ((in[1] >> 2) << 5) | (in[2] >> 3));
+        }
+    }
+#endif
+    d->pixels = imgData;
+}
+
+iBool isPreview_ImageDecodeJob(const iImageDecodeJob *d) {
+    return d->isPreview;
+}
+
+SDL_Texture *makeTexture_ImageDecodeJob(const iImageDecodeJob *d, SDL_Renderer *render) {
+    if (!d->pixels) {
+        return NULL;
+    }
+    int    depth  = 32;
+    Uint32 format = d->isOpaque ? SDL_PIXELFORMAT_BGR888 : SDL_PIXELFORMAT_ABGR8888;
+#if defined (iPlatformMobile)
+    if (d->isOpaque) {
+        depth  = 16;
+        format = SDL_PIXELFORMAT_RGB565;
+    }
+#endif
+    /* Without an alpha channel, the texture is also drawn without blending. */
+    SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
+        d->pixels, d->texSize.x, d->texSize.y, depth, d->texSize.x * depth / 8, format);
+    /* TODO: In multiwindow case, all windows must have the same shared renderer?
+       Or at least a shared context. */
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1"); /* linear scaling */
+    SDL_Texture *tex = SDL_CreateTextureFromSurface(render, surface);
+    SDL_FreeSurface(surface);
+    return tex;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(ImageDecoder)
+
+struct Impl_ImageDecoder {
+    iMutex mtx; /* guards the job states */
+};
+
+static iImageDecoder decoder_;
+
+iBool isFinished_ImageDecodeJob(const iImageDecodeJob *d) {
+    /* Locking also makes the decoded pixels visible to this thread. */
+    lock_Mutex(&decoder_.mtx);
+    const iBool isFinished = (d->state == finished_ImageDecodeState);
+    unlock_Mutex(&decoder_.mtx);
+    return isFinished;
+}
+
+static void run_ImageDecoder_(iJob *job, void *context) {
+    iImageDecoder   *d      = &decoder_;
+    iImageDecodeJob *decode = context;
+    iUnused(job);
+    lock_Mutex(&d->mtx);
+    if (decode->state == cancelled_ImageDecodeState) {
+        delete_ImageDecodeJob(decode);
+        unlock_Mutex(&d->mtx);
+        return;
+    }
+    decode->state = decoding_ImageDecodeState;
+    unlock_Mutex(&d->mtx);
+    decode_ImageDecodeJob_(decode);
+    lock_Mutex(&d->mtx);
+    if (decode->state == cancelled_ImageDecodeState) {
+        delete_ImageDecodeJob(decode);
+    }
+    else {
+        decode->state = finished_ImageDecodeState;
+        postCommand_App("media.decoded");
+    }
+    unlock_Mutex(&d->mtx);
+}
+
+static void discard_ImageDecoder_(iJob *job, void *context) {
+    /* The job pool was shut down before decoding started. */
+    iImageDecoder   *d      = &decoder_;
+    iImageDecodeJob *decode = context;
+    iUnused(job);
+    lock_Mutex(&d->mtx);
+    if (decode->state == cancelled_ImageDecodeState) {
+        delete_ImageDecodeJob(decode);
+    }
+    else {
+        decode->state = finished_ImageDecodeState; /* failed; the owner deletes it */
+    }
+    unlock_Mutex(&d->mtx);
+}
+
+void init_ImageDecoder(void) {
+    init_Mutex(&decoder_.mtx);
+}
+
+void deinit_ImageDecoder(void) {
+    /* Called after `deinit_Jobs`, so no decodes are running any more. */
+    deinit_Mutex(&decoder_.mtx);
+}
+
+iBool imageSize_ImageDecoder(const iString *mime, const iBlock *data, iInt2 *size_out) {
+    /* Only the header is parsed, so the layout can be done before decoding. */
+    *size_out = zero_I2();
+    if (cmp_String(mime, "image/webp") == 0) {
+#if defined (LAGRANGE_ENABLE_WEBP)
+        return WebPGetInfo(constData_Block(data), size_Block(data), &size_out->x, &size_out->y) != 0;
+#else
+        return iFalse;
+#endif
+    }
+    return stbi_info_from_memory(
+               constData_Block(data), size_Block(data), &size_out->x, &size_out->y, NULL) != 0;
+}
+
+static void submit_ImageDecoder_(iImageDecoder *d, iImageDecodeJob *job) {
+    /* Images are decoded when they are about to be shown. */
+    iUnused(d);
+    job->job = submitDiscardable_Jobs(
+        interactive_JobPriority, run_ImageDecoder_, discard_ImageDecoder_, job, NULL);
+}
+
+static uint64_t hash_ImageDecoder_(uint64_t hash, const void *data, size_t size) {
+    /* FNV-1a */
+    const uint8_t *bytes = data;
+    for (size_t pos = 0; pos < size; pos++) {
+        hash = (hash ^ bytes[pos]) * 0x100000001b3ull;
+    }
+    return hash;
+}
+
+uint64_t contentHash_ImageDecoder(const iBlock *data) {
+    /* This is done in the main thread, so large images are only sampled: the length, the
+       header and the end, and evenly spaced chunks between them. */
+    static const size_t maxFullSize_ = 64 * 1024;
+    static const size_t edgeSize_    = 4096;
+    static const size_t chunkSize_   = 1024;
+    static const size_t numChunks_   = 32;
+    const uint8_t *bytes = constData_Block(data);
+    const size_t   size  = size_Block(data);
+    uint64_t       hash  = hash_ImageDecoder_(0xcbf29ce484222325ull, &size, sizeof(size));
+    if (size <= maxFullSize_) {
+        return hash_ImageDecoder_(hash, bytes, size);
+    }
+    hash = hash_ImageDecoder_(hash, bytes, edgeSize_);
+    const size_t span = size - 2 * edgeSize_ - chunkSize_;
+    for (size_t i = 0; i < numChunks_; i++) {
+        hash = hash_ImageDecoder_(hash, bytes + edgeSize_ + span * i / (numChunks_ - 1),
+                                  chunkSize_);
+    }
+    return hash_ImageDecoder_(hash, bytes + size - edgeSize_, edgeSize_);
+}
+
+uint64_t cacheKey_ImageDecoder(uint64_t contentHash) {
+    /* The source data and the decoding parameters. */
+    iImageDecodeParams params;
+    init_ImageDecodeParams_(&params);
+    return hash_ImageDecoder_(contentHash, &params, sizeof(params));
+}
+
+iImageDecodeJob *decode_ImageDecoder(const iString *mime, const iBlock *data) {
+    iImageDecodeJob *job = new_ImageDecodeJob(mime, data);
+    submit_ImageDecoder_(&decoder_, job);
+    return job;
+}
+
+iImageDecodeJob *decodePreview_ImageDecoder(const iString *mime, const iBlock *partialData) {
+    /* Only JPEG can be previewed: when the truncated data is terminated with an EOI marker,
+       the decoder fills in the missing entropy-coded data with zeros. Baseline images are
+       then decoded down to the last received row, and progressive images at the quality of
+       the scans received so far. */
+    if (cmp_String(mime, "image/jpeg") && cmp_String(mime, "image/jpg")) {
+        return NULL;
+    }
+    static const char eoiMarker_[2] = { '\xff', '\xd9' };
+    iImageDecodeJob *job = new_ImageDecodeJob(mime, partialData);
+    job->isPreview = iTrue;
+    appendData_Block(&job->data, eoiMarker_, sizeof(eoiMarker_));
+    submit_ImageDecoder_(&decoder_, job);
+    return job;
+}
+
+void cancel_ImageDecoder(iImageDecodeJob *job) {
+    iImageDecoder *d = &decoder_;
+    if (!job) {
+        return;
+    }
+    lock_Mutex(&d->mtx);
+    if (job->state == finished_ImageDecodeState || cancel_Job(job->job)) {
+        delete_ImageDecodeJob(job);
+    }
+    else {
+        job->state = cancelled_ImageDecodeState; /* worker will delete it */
+    }
+    unlock_Mutex(&d->mtx);
+}
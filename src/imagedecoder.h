@@ -0,0 +1,48 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/block.h>
+#include <the_Foundation/string.h>
+#include <the_Foundation/vec2.h>
+#include <SDL_render.h>
+
+/* Images are decoded, styled, and downscaled in background threads. Only creating the
+   texture from the decoded pixels is done in the main thread. When a job finishes, a
+   "media.decoded" command is posted. */
+
+iDeclareType(ImageDecodeJob)
+
+void            init_ImageDecoder       (void);
+void            deinit_ImageDecoder     (void);
+
+iBool           imageSize_ImageDecoder  (const iString *mime, const iBlock *data, iInt2 *size_out);
+uint64_t        contentHash_ImageDecoder(const iBlock *data); /* samples large images */
+uint64_t        cacheKey_ImageDecoder   (uint64_t contentHash); /* includes current style */
+iImageDecodeJob *decode_ImageDecoder    (const iString *mime, const iBlock *data);
+iImageDecodeJob *decodePreview_ImageDecoder (const iString *mime, const iBlock *partialData);
+void            cancel_ImageDecoder     (iImageDecodeJob *); /* job is deleted */
+
+iBool           isFinished_ImageDecodeJob   (const iImageDecodeJob *);
+iBool           isPreview_ImageDecodeJob    (const iImageDecodeJob *);
+SDL_Texture *   makeTexture_ImageDecodeJob  (const iImageDecodeJob *, SDL_Renderer *render);
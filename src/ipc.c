@@ -41,20 +41,17 @@ struct Impl_Ipc {
 
 static iIpc ipc_;
 
+static void initPlatform_Ipc_(void);
+
 static const char *lockFilePath_(const iIpc *d) {
     return concatPath_CStr(cstr_String(&d->dir), ".pid");
 }
 
-static const char *inputFilePath_(const iIpc *d, int pid) {
-    return concatPath_CStr(cstr_String(&d->dir),
-                           format_CStr(".run.%d.cfg", pid ? pid : currentId_Process()));
-}
-
 void init_Ipc(const char *runDir) {
     iIpc *d = &ipc_;
     initCStr_String(&d->dir, runDir);
     d->isListening = iFalse;
-    signal(SIGUSR1, SIG_IGN);
+    initPlatform_Ipc_();
 }
 
 static void doStopListening_Ipc_(iIpc *d) {
@@ -99,127 +96,296 @@ static void postCommands_Ipc_(const iBlock *cmds) {
 
 /*----------------------------------------------------------------------------------------------*/
 #if !defined (iPlatformMsys)
+/* Other instances connect to a Unix domain socket. Each message is framed with the payload
+   size and the sender's process ID. The connection is kept open until the response has been
+   written, so nothing needs to be written to disk. */
 
-void deinit_Ipc(void) {
-    iIpc *d = &ipc_;
-    signal(SIGUSR1, SIG_IGN);
-    doStopListening_Ipc_(d);
-    deinit_String(&d->dir);
+#include <the_Foundation/thread.h>
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static const size_t maxMessageSize_Ipc_ = 4 * 1024 * 1024;
+
+iDeclareType(IpcConnection)
+
+struct Impl_IpcConnection {
+    iProcessId pid;    /* sender of the commands */
+    int        fd;
+    iString    output; /* response to send */
+};
+
+static iThread *listenThread_;
+static int      listenSocket_ = -1;
+static iMutex   connectionsMutex_;
+static iArray   connections_; /* iIpcConnection[]; waiting for `ipc.signal` */
+
+static const char *socketPath_(const iIpc *d) {
+    return concatPath_CStr(cstr_String(&d->dir), ".socket");
 }
 
-static void handleUserSignal_(int sig) {
-    iIpc *d = &ipc_;
-    iAssert(sig == SIGUSR1);
-    iUnused(sig);
-    const char *path = inputFilePath_(d, 0);
-    iFile *f = newCStr_File(path);
-    if (open_File(f, readOnly_FileMode)) {
-        postCommands_Ipc_(collect_Block(readAll_File(f)));
+static iBool initAddress_Ipc_(const iIpc *d, struct sockaddr_un *addr) {
+    const char *path = socketPath_(d);
+    iZap(*addr);
+    addr->sun_family = AF_UNIX;
+    if (strlen(path) >= sizeof(addr->sun_path)) {
+        return iFalse;
     }
-    iRelease(f);
-    remove(path);
+    strcpy(addr->sun_path, path);
+    return iTrue;
 }
 
-void listen_Ipc(void) {
-    iIpc *d = &ipc_;
-    signal(SIGUSR1, handleUserSignal_);
-    doListen_Ipc_(d);
+static void setReceiveTimeout_(int fd, int seconds) {
+    struct timeval tv = { seconds, 0 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
 }
 
-iDeclareType(IpcResponse)
+static iBool writeAll_(int fd, const void *data, size_t size) {
+    const char *ptr = data;
+    while (size > 0) {
+        const ssize_t num = write(fd, ptr, size);
+        if (num < 0 && errno == EINTR) {
+            continue;
+        }
+        if (num <= 0) {
+            return iFalse;
+        }
+        ptr  += num;
+        size -= num;
+    }
+    return iTrue;
+}
 
-struct Impl_IpcResponse {
-    iString *output;
-    iBool success;
-    iMutex mtx;
-    iCondition finished;
-};
+static iBool readAll_(int fd, void *data, size_t size) {
+    char *ptr = data;
+    while (size > 0) {
+        const ssize_t num = read(fd, ptr, size);
+        if (num < 0 && errno == EINTR) {
+            continue;
+        }
+        if (num <= 0) {
+            return iFalse; /* closed or timed out */
+        }
+        ptr  += num;
+        size -= num;
+    }
+    return iTrue;
+}
 
-static void init_IpcResponse(iIpcResponse *d) {
-    d->output = new_String();
-    d->success = iFalse;
-    init_Mutex(&d->mtx);
-    init_Condition(&d->finished);
+static iBool writeFrame_(int fd, const iBlock *payload) {
+    const uint32_t header[2] = { htonl((uint32_t) size_Block(payload)),
+                                 htonl((uint32_t) currentId_Process()) };
+    return writeAll_(fd, header, sizeof(header)) &&
+           writeAll_(fd, constData_Block(payload), size_Block(payload));
 }
 
-static void deinit_IpcResponse(iIpcResponse *d) {
-    deinit_Condition(&d->finished);
-    deinit_Mutex(&d->mtx);
-    delete_String(d->output);
+static iBlock *readFrame_(int fd, iProcessId *sender) {
+    uint32_t header[2];
+    if (!readAll_(fd, header, sizeof(header))) {
+        return NULL;
+    }
+    const size_t size = ntohl(header[0]);
+    if (size > maxMessageSize_Ipc_) {
+        return NULL;
+    }
+    iBlock *payload = new_Block(size);
+    if (!readAll_(fd, data_Block(payload), size)) {
+        delete_Block(payload);
+        return NULL;
+    }
+    if (sender) {
+        *sender = (iProcessId) ntohl(header[1]);
+    }
+    return payload;
 }
 
-iDefineTypeConstruction(IpcResponse)
+static int connect_Ipc_(const iIpc *d) {
+    struct sockaddr_un addr;
+    if (!initAddress_Ipc_(d, &addr)) {
+        return -1;
+    }
+    const int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    if (connect(fd, (const struct sockaddr *) &addr, sizeof(addr)) != 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
 
-static iIpcResponse *response_;
+static iString *commandMessage_Ipc_(const iString *input, enum iIpcWrite type) {
+    iString *msg = copy_String(input);
+    if (type != response_IpcWrite) {
+        appendFormat_String(msg, "\nipc.signal arg:%d%s\n", currentId_Process(),
+                            type == commandAndRaise_IpcWrite ? " raise:1" : "");
+    }
+    return msg;
+}
 
-static void handleSignal_IpcResponse_(int sig) {
-    iUnused(sig);
-    iAssert(response_);
-    iIpcResponse *d = response_;
-    lock_Mutex(&d->mtx);
-    iFile *f = newCStr_File(inputFilePath_(&ipc_, 0));
-    if (open_File(f, text_FileMode | readOnly_FileMode)) {
-        iBlock *input = readAll_File(f);
-        close_File(f);
-        remove(cstr_String(path_File(f)));
-        setBlock_String(d->output, input);
-        d->success = iTrue;
-        delete_Block(input);
+static iIpcConnection *findConnection_Ipc_(iProcessId pid) {
+    /* `connectionsMutex_` must be locked. */
+    iForEach(Array, i, &connections_) {
+        iIpcConnection *conn = i.value;
+        if (conn->pid == pid) {
+            return conn;
+        }
     }
-    iRelease(f);
-    signal_Condition(&d->finished);
-    unlock_Mutex(&d->mtx);
+    return NULL;
+}
+
+static void closeConnection_Ipc_(iIpcConnection *conn) {
+    close(conn->fd);
+    deinit_String(&conn->output);
+    remove_Array(&connections_, indexOf_Array(&connections_, conn));
+}
+
+static iThreadResult listen_Ipc_(iThread *thd) {
+    iIpc *d = &ipc_;
+    iUnused(thd);
+    while (d->isListening) {
+        struct pollfd pfd = { listenSocket_, POLLIN, 0 };
+        if (poll(&pfd, 1, 250) <= 0) {
+            continue;
+        }
+        const int fd = accept(listenSocket_, NULL, NULL);
+        if (fd < 0) {
+            continue;
+        }
+        setReceiveTimeout_(fd, 1);
+        iProcessId sender = 0;
+        iBlock *   cmds   = readFrame_(fd, &sender);
+        if (!cmds) {
+            close(fd);
+            continue;
+        }
+        /* The connection stays open until `ipc.signal` sends the response. */
+        lock_Mutex(&connectionsMutex_);
+        iIpcConnection conn = { .pid = sender, .fd = fd };
+        init_String(&conn.output);
+        pushBack_Array(&connections_, &conn);
+        unlock_Mutex(&connectionsMutex_);
+        postCommands_Ipc_(cmds);
+        delete_Block(cmds);
+    }
+    return 0;
+}
+
+static void initPlatform_Ipc_(void) {
+    signal(SIGPIPE, SIG_IGN); /* the other instance may close the connection first */
+    init_Mutex(&connectionsMutex_);
+    init_Array(&connections_, sizeof(iIpcConnection));
+}
+
+void deinit_Ipc(void) {
+    iIpc *d = &ipc_;
+    doStopListening_Ipc_(d);
+    if (listenThread_) {
+        join_Thread(listenThread_);
+        iReleasePtr(&listenThread_);
+    }
+    if (listenSocket_ >= 0) {
+        close(listenSocket_);
+        listenSocket_ = -1;
+        remove(socketPath_(d));
+    }
+    lock_Mutex(&connectionsMutex_);
+    while (!isEmpty_Array(&connections_)) {
+        closeConnection_Ipc_(back_Array(&connections_));
+    }
+    unlock_Mutex(&connectionsMutex_);
+    deinit_Array(&connections_);
+    deinit_Mutex(&connectionsMutex_);
+    deinit_String(&d->dir);
+}
+
+void listen_Ipc(void) {
+    iIpc *d = &ipc_;
+    struct sockaddr_un addr;
+    if (!initAddress_Ipc_(d, &addr)) {
+        return;
+    }
+    listenSocket_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listenSocket_ < 0) {
+        return;
+    }
+    remove(addr.sun_path); /* left behind by an instance that didn't exit cleanly */
+    if (bind(listenSocket_, (const struct sockaddr *) &addr, sizeof(addr)) != 0 ||
+        listen(listenSocket_, 8) != 0) {
+        close(listenSocket_);
+        listenSocket_ = -1;
+        return;
+    }
+    doListen_Ipc_(d);
+    listenThread_ = new_Thread(listen_Ipc_);
+    start_Thread(listenThread_);
 }
 
 iBool write_Ipc(iProcessId pid, const iString *input, enum iIpcWrite type) {
     if (!pid) return iFalse;
-    iBool ok = iFalse;
-    iFile *f = newCStr_File(inputFilePath_(&ipc_, pid));
-    if (open_File(f, text_FileMode | append_FileMode)) {
-        write_File(f, utf8_String(input));
-        if (type != response_IpcWrite) {
-            printf_Stream(stream_File(f), "\nipc.signal arg:%d%s\n", currentId_Process(),
-                          type == commandAndRaise_IpcWrite ? " raise:1" : "");
+    if (type == response_IpcWrite) {
+        /* Collected until the response is sent by `signal_Ipc()`. */
+        iBool ok = iFalse;
+        lock_Mutex(&connectionsMutex_);
+        iIpcConnection *conn = findConnection_Ipc_(pid);
+        if (conn) {
+            append_String(&conn->output, input);
+            ok = iTrue;
         }
-        close_File(f);
-        ok = iTrue;
+        unlock_Mutex(&connectionsMutex_);
+        return ok;
     }
-    iRelease(f);
+    const int fd = connect_Ipc_(&ipc_);
+    if (fd < 0) {
+        return iFalse;
+    }
+    iString *msg = commandMessage_Ipc_(input, type);
+    const iBool ok = writeFrame_(fd, utf8_String(msg));
+    delete_String(msg);
+    close(fd);
     return ok;
 }
 
 iString *communicate_Ipc(const iString *command, iBool requestRaise) {
-    const iProcessId dst = check_Ipc();
-    if (dst) {
-        if (write_Ipc(dst, command, requestRaise ? commandAndRaise_IpcWrite : command_IpcWrite)) {
-            response_ = new_IpcResponse();
-            signal(SIGUSR1, handleSignal_IpcResponse_);
-            lock_Mutex(&response_->mtx);
-            if (kill(dst, SIGUSR1) == 0) {
-                iTime until;
-                initTimeout_Time(&until, 1.0);
-                waitTimeout_Condition(&response_->finished, &response_->mtx, &until);
-            }
-            unlock_Mutex(&response_->mtx);
-            if (!response_->success) {
-                delete_IpcResponse(response_);
-                response_ = NULL;
-            }
-        }
+    if (!check_Ipc()) {
+        return NULL;
+    }
+    const int fd = connect_Ipc_(&ipc_);
+    if (fd < 0) {
+        return NULL;
     }
-    signal(SIGUSR1, SIG_IGN);
-    if (response_) {
-        iString *result = copy_String(response_->output);
-        trimEnd_String(result);
-        delete_IpcResponse(response_);
-        response_ = NULL;
-        return result;
+    iString *result = NULL;
+    iString *msg    = commandMessage_Ipc_(command,
+                                          requestRaise ? commandAndRaise_IpcWrite : command_IpcWrite);
+    if (writeFrame_(fd, utf8_String(msg))) {
+        setReceiveTimeout_(fd, 1);
+        iBlock *output = readFrame_(fd, NULL);
+        if (output) {
+            result = newBlock_String(output);
+            trimEnd_String(result);
+            delete_Block(output);
+        }
     }
-    return NULL;
+    delete_String(msg);
+    close(fd);
+    return result;
 }
 
 void signal_Ipc(iProcessId pid) {
-    kill(pid, SIGUSR1);
+    /* All the commands have been handled, so the response is complete. */
+    lock_Mutex(&connectionsMutex_);
+    iIpcConnection *conn = findConnection_Ipc_(pid);
+    if (conn) {
+        writeFrame_(conn->fd, utf8_String(&conn->output));
+        closeConnection_Ipc_(conn);
+    }
+    unlock_Mutex(&connectionsMutex_);
 }
 
 #endif
@@ -257,6 +423,10 @@ static iThreadResult readSlotThread_Ipc_(iThread *thd) {
     return 0;
 }
 
+static void initPlatform_Ipc_(void) {
+    /* Nothing needed for mailslots. */
+}
+
 static const char *slotName_(int pid) {
     return format_CStr("\\\\.\\mailslot\\fi.skyjake.Lagrange\\%u", pid);
 }
@@ -0,0 +1,291 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "jobs.h"
+#include "app.h"
+#include "profiler.h"
+
+#include <the_Foundation/atomic.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/thread.h>
+#include <SDL_cpuinfo.h>
+
+enum iJobState {
+    queued_JobState,
+    running_JobState,
+    finished_JobState,
+    discarded_JobState, /* cancelled or dropped from the queue without running */
+};
+
+struct Impl_Job {
+    iJobFunc          func;
+    iJobFunc          discardFunc; /* may be NULL */
+    void *            context;
+    enum iJobPriority priority;
+    enum iJobState    state; /* protected by the pool mutex */
+    iAtomicInt        isCancelled;
+    iAtomicInt        refCount; /* the submitter, and the pool until the job is done */
+    char *            finishedCommand;
+};
+
+iDeclareType(Jobs)
+
+struct Impl_Jobs {
+    iMutex     mtx;
+    iCondition jobAvailable;
+    iCondition jobDone;
+    iPtrArray  queues[max_JobPriority]; /* oldest first */
+    size_t     numQueued;
+    iPtrArray  workers; /* started as needed */
+    size_t     maxWorkers;
+    size_t     numIdle;
+    size_t     numWaiting; /* threads blocked in `wait_Job` */
+    iBool      isQuitting;
+};
+
+static const int maxWorkers_Jobs_ = 16;
+
+static iJobs jobs_;
+
+static void delete_Job_(iJob *d) {
+    free(d->finishedCommand);
+    free(d);
+}
+
+void release_Job(iJob *d) {
+    if (d && add_Atomic(&d->refCount, -1) == 1) {
+        delete_Job_(d);
+    }
+}
+
+static void notifyDone_Jobs_(iJobs *d) {
+    for (size_t i = 0; i < d->numWaiting; i++) {
+        signal_Condition(&d->jobDone);
+    }
+}
+
+static iJob *take_Jobs_(iJobs *d) {
+    iForIndices(i, d->queues) {
+        if (!isEmpty_PtrArray(&d->queues[i])) {
+            iJob *job = NULL;
+            take_PtrArray(&d->queues[i], 0, (void **) &job);
+            d->numQueued--;
+            return job;
+        }
+    }
+    return NULL;
+}
+
+static void run_Jobs_(iJobs *d, iJob *job) {
+    /* Called with the mutex locked. The pool's reference is released when done. */
+    job->state = running_JobState;
+    unlock_Mutex(&d->mtx);
+    job->func(job, job->context);
+    lock_Mutex(&d->mtx);
+    job->state = finished_JobState;
+    notifyDone_Jobs_(d);
+    unlock_Mutex(&d->mtx);
+    if (job->finishedCommand && !isCancelled_Job(job)) {
+        postCommand_App(job->finishedCommand);
+    }
+    release_Job(job);
+    lock_Mutex(&d->mtx);
+}
+
+static iThreadResult worker_Jobs_(iThread *thread) {
+    iJobs *d = userData_Thread(thread);
+    setThreadName_Profiler("job worker");
+    lock_Mutex(&d->mtx);
+    for (;;) {
+        iJob *job = NULL;
+        while (!d->isQuitting && (job = take_Jobs_(d)) == NULL) {
+            d->numIdle++;
+            wait_Condition(&d->jobAvailable, &d->mtx);
+            d->numIdle--;
+        }
+        if (d->isQuitting) {
+            break;
+        }
+        run_Jobs_(d, job);
+    }
+    unlock_Mutex(&d->mtx);
+    return 0;
+}
+
+void init_Jobs(void) {
+    iJobs *d = &jobs_;
+    init_Mutex(&d->mtx);
+    init_Condition(&d->jobAvailable);
+    init_Condition(&d->jobDone);
+    iForIndices(i, d->queues) {
+        init_PtrArray(&d->queues[i]);
+    }
+    d->numQueued  = 0;
+    init_PtrArray(&d->workers);
+    d->maxWorkers = iClamp(SDL_GetCPUCount() - 1, 1, maxWorkers_Jobs_);
+    d->numIdle    = 0;
+    d->numWaiting = 0;
+    d->isQuitting = iFalse;
+}
+
+void deinit_Jobs(void) {
+    iJobs *d = &jobs_;
+    iPtrArray discarded;
+    init_PtrArray(&discarded);
+    lock_Mutex(&d->mtx);
+    d->isQuitting = iTrue;
+    iForIndices(i, d->queues) {
+        iForEach(PtrArray, j, &d->queues[i]) {
+            iJob *job = j.ptr;
+            job->state = discarded_JobState;
+            pushBack_PtrArray(&discarded, job);
+        }
+        clear_PtrArray(&d->queues[i]);
+    }
+    d->numQueued = 0;
+    notifyDone_Jobs_(d);
+    for (size_t i = 0; i < size_PtrArray(&d->workers); i++) {
+        signal_Condition(&d->jobAvailable);
+    }
+    unlock_Mutex(&d->mtx);
+    iForEach(PtrArray, j, &discarded) {
+        iJob *job = j.ptr;
+        if (job->discardFunc) {
+            job->discardFunc(job, job->context);
+        }
+        release_Job(job);
+    }
+    deinit_PtrArray(&discarded);
+    iForEach(PtrArray, t, &d->workers) {
+        join_Thread(t.ptr);
+        iRelease(t.ptr);
+    }
+    deinit_PtrArray(&d->workers);
+    iForIndices(i, d->queues) {
+        deinit_PtrArray(&d->queues[i]);
+    }
+    deinit_Condition(&d->jobDone);
+    deinit_Condition(&d->jobAvailable);
+    deinit_Mutex(&d->mtx);
+}
+
+size_t numWorkers_Jobs(void) {
+    return jobs_.maxWorkers;
+}
+
+iJob *submit_Jobs(enum iJobPriority priority, iJobFunc func, void *context,
+                  const char *finishedCommand) {
+    return submitDiscardable_Jobs(priority, func, NULL, context, finishedCommand);
+}
+
+iJob *submitDiscardable_Jobs(enum iJobPriority priority, iJobFunc func, iJobFunc discardFunc,
+                             void *context, const char *finishedCommand) {
+    iJobs *d   = &jobs_;
+    iJob  *job = iMalloc(Job);
+    iBool  isDiscarded = iFalse;
+    job->func            = func;
+    job->discardFunc     = discardFunc;
+    job->context         = context;
+    job->priority        = priority;
+    job->state           = queued_JobState;
+    job->finishedCommand = finishedCommand ? iDupStr(finishedCommand) : NULL;
+    set_Atomic(&job->isCancelled, iFalse);
+    set_Atomic(&job->refCount, 2);
+    lock_Mutex(&d->mtx);
+    if (d->isQuitting) {
+        job->state = discarded_JobState;
+        set_Atomic(&job->refCount, 1);
+        isDiscarded = iTrue;
+    }
+    else {
+        pushBack_PtrArray(&d->queues[priority], job);
+        d->numQueued++;
+        /* Idle workers that haven't woken up yet will pick up the earlier jobs. */
+        if (d->numQueued > d->numIdle && size_PtrArray(&d->workers) < d->maxWorkers) {
+            iThread *thread = new_Thread(worker_Jobs_);
+            setUserData_Thread(thread, d);
+            start_Thread(thread);
+            pushBack_PtrArray(&d->workers, thread);
+        }
+        else {
+            signal_Condition(&d->jobAvailable);
+        }
+    }
+    unlock_Mutex(&d->mtx);
+    if (isDiscarded && discardFunc) {
+        discardFunc(job, context);
+    }
+    return job;
+}
+
+iBool cancel_Job(iJob *job) {
+    iJobs *d          = &jobs_;
+    iBool  isDequeued = iFalse;
+    if (!job) {
+        return iFalse;
+    }
+    lock_Mutex(&d->mtx);
+    set_Atomic(&job->isCancelled, iTrue);
+    if (job->state == queued_JobState) {
+        removeOne_PtrArray(&d->queues[job->priority], job);
+        d->numQueued--;
+        job->state = discarded_JobState;
+        notifyDone_Jobs_(d);
+        isDequeued = iTrue;
+    }
+    unlock_Mutex(&d->mtx);
+    if (isDequeued) {
+        release_Job(job); /* the pool's reference */
+    }
+    return isDequeued;
+}
+
+void wait_Job(iJob *job) {
+    iJobs *d = &jobs_;
+    lock_Mutex(&d->mtx);
+    if (job->state == queued_JobState) {
+        /* Rather than block, do the work here. This also lets a job wait on jobs it has
+           submitted when all the workers are busy. */
+        removeOne_PtrArray(&d->queues[job->priority], job);
+        d->numQueued--;
+        run_Jobs_(d, job);
+    }
+    while (job->state == running_JobState) {
+        d->numWaiting++;
+        wait_Condition(&d->jobDone, &d->mtx);
+        d->numWaiting--;
+    }
+    unlock_Mutex(&d->mtx);
+}
+
+iBool isFinished_Job(const iJob *job) {
+    iJobs *d = &jobs_;
+    lock_Mutex(&d->mtx);
+    const iBool isFinished = (job->state == finished_JobState);
+    unlock_Mutex(&d->mtx);
+    return isFinished;
+}
+
+iBool isCancelled_Job(const iJob *job) {
+    return value_Atomic(&job->isCancelled) != 0;
+}
@@ -0,0 +1,63 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/defs.h>
+
+/* Shared pool of worker threads for background jobs. There is one worker per core (minus
+   the main thread), started as needed. Queued jobs run in priority order, oldest first.
+   A job may be cancelled: a queued job is never run, and a running one can check
+   `isCancelled_Job` to stop early. When a job finishes without being cancelled, its
+   command is posted to the main thread. */
+
+enum iJobPriority {
+    interactive_JobPriority, /* the user is waiting for the result */
+    prefetch_JobPriority,    /* likely to be needed soon */
+    background_JobPriority,
+    max_JobPriority
+};
+
+iDeclareType(Job)
+
+typedef void (*iJobFunc)(iJob *, void *context);
+
+void    init_Jobs           (void);
+void    deinit_Jobs         (void); /* queued jobs are discarded, running ones waited for */
+
+size_t  numWorkers_Jobs     (void);
+
+/* The returned job must be released by the caller. `finishedCommand` may be NULL. */
+iJob *  submit_Jobs         (enum iJobPriority priority, iJobFunc func, void *context,
+                             const char *finishedCommand);
+/* `discardFunc` is called instead of `func` if the pool is shut down before the job runs,
+   so the context can be freed. */
+iJob *  submitDiscardable_Jobs  (enum iJobPriority priority, iJobFunc func,
+                                 iJobFunc discardFunc, void *context,
+                                 const char *finishedCommand);
+
+iBool   cancel_Job          (iJob *); /* returns True if the job was dequeued before it ran */
+void    wait_Job            (iJob *); /* a queued job is run in the calling thread */
+void    release_Job         (iJob *);
+
+iBool   isFinished_Job      (const iJob *);
+iBool   isCancelled_Job     (const iJob *);
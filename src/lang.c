@@ -25,11 +25,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "prefs.h"
 #include "app.h"
 
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/sortedarray.h>
 #include <the_Foundation/string.h>
 
 iDeclareType(Lang)
 iDeclareType(MsgStr)
+iDeclareType(Translation)
 
 struct Impl_MsgStr {
     iRangecc id; /* these point to null-terminated strings in resources */
@@ -52,9 +54,25 @@ enum iPluralType {
     oneFewMany_PluralType,
 };
 
+/* A recently translated string with ${...} IDs. Menus, dialogs, and the sidebar translate
+   the same labels every time they are rebuilt. */
+struct Impl_Translation {
+    uint32_t hash; /* zero if unused */
+    iString *source;
+    iString *result;
+};
+
+enum {
+    numTranslations_Lang_ = 512, /* power of two */
+};
+
 struct Impl_Lang {
     iSortedArray *messages;
+    uint32_t *    index; /* message position + 1 by hash of ID (open addressing), zero if free */
+    size_t        indexMask;
     enum iPluralType pluralType;
+    iMutex        translationsMutex; /* translations may be requested from any thread */
+    iTranslation  translations[numTranslations_Lang_];
 };
 
 static iLang lang_;
@@ -80,8 +98,57 @@ static size_t pluralIndex_Lang_(const iLang *d, int n) {
     }
 }
 
+static uint32_t hash_Lang_(iRangecc str) {
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    for (const char *ch = str.start; ch != str.end; ch++) {
+        hash = (hash ^ (uint8_t) *ch) * 16777619u;
+    }
+    return hash;
+}
+
+static void clearTranslations_Lang_(iLang *d, iBool isShutdown) {
+    lock_Mutex(&d->translationsMutex);
+    iForIndices(i, d->translations) {
+        iTranslation *tr = &d->translations[i];
+        if (tr->hash) {
+            delete_String(tr->source);
+            if (isShutdown) {
+                delete_String(tr->result);
+            }
+            else {
+                collect_String(tr->result); /* may still be in use */
+            }
+        }
+    }
+    iZap(d->translations);
+    unlock_Mutex(&d->translationsMutex);
+}
+
 static void clear_Lang_(iLang *d) {
     clear_SortedArray(d->messages);
+    free(d->index);
+    d->index     = NULL;
+    d->indexMask = 0;
+    clearTranslations_Lang_(d, iFalse);
+}
+
+static void buildIndex_Lang_(iLang *d) {
+    /* Messages are looked up by ID in constant time. The table is at most half full. */
+    const size_t count = size_SortedArray(d->messages);
+    size_t capacity = 64;
+    while (capacity < count * 2) {
+        capacity *= 2;
+    }
+    d->index     = calloc(capacity, sizeof(uint32_t));
+    d->indexMask = capacity - 1;
+    for (size_t pos = 0; pos < count; pos++) {
+        const iMsgStr *msg = constAt_SortedArray(d->messages, pos);
+        size_t i = hash_Lang_(msg->id) & d->indexMask;
+        while (d->index[i]) {
+            i = (i + 1) & d->indexMask;
+        }
+        d->index[i] = (uint32_t) pos + 1;
+    }
 }
 
 static void load_Lang_(iLang *d, const char *id) {
@@ -129,6 +196,7 @@ static void load_Lang_(iLang *d, const char *id) {
     else {
         d->pluralType = notEqualToOne_PluralType;
     }
+    data = load_Resources(data);
     iMsgStr msg;
     for (const char *ptr = constBegin_Block(data); ptr != constEnd_Block(data); ptr++) {
         msg.id.start = ptr;
@@ -146,18 +214,25 @@ static void load_Lang_(iLang *d, const char *id) {
 //        printf("ID:%s\n", msg.id.start);
         pushBack_Array(&d->messages->values, &msg);
     }
+    buildIndex_Lang_(d);
 }
 
 void init_Lang(void) {
     iLang *d = &lang_;
     d->messages = new_SortedArray(sizeof(iMsgStr), cmp_MsgStr_);
+    d->index     = NULL;
+    d->indexMask = 0;
+    init_Mutex(&d->translationsMutex);
+    iZap(d->translations);
     setCurrent_Lang("en");
 }
 
 void deinit_Lang(void) {
     iLang *d = &lang_;
+    clearTranslations_Lang_(d, iTrue);
     clear_Lang_(d);
     delete_SortedArray(d->messages);
+    deinit_Mutex(&d->translationsMutex);
 }
 
 void setCurrent_Lang(const char *language) {
@@ -168,11 +243,14 @@ void setCurrent_Lang(const char *language) {
 
 static iBool find_Lang_(iRangecc msgId, iRangecc *str_out) {
     const iLang *d = &lang_;
-    size_t pos;
-    const iMsgStr key = { .id = msgId };
-    if (locate_SortedArray(d->messages, &key, &pos)) {
-        *str_out = ((const iMsgStr *) at_SortedArray(d->messages, pos))->str;
-        return iTrue;
+    if (d->index) {
+        for (size_t i = hash_Lang_(msgId) & d->indexMask; d->index[i]; i = (i + 1) & d->indexMask) {
+            const iMsgStr *msg = constAt_SortedArray(d->messages, d->index[i] - 1);
+            if (equalRange_Rangecc(msg->id, msgId)) {
+                *str_out = msg->str;
+                return iTrue;
+            }
+        }
     }
     fprintf(stderr, "[Lang] missing: %s\n", cstr_Rangecc(msgId)); fflush(stderr);
     //    iAssert(iFalse);
@@ -242,9 +320,32 @@ const char *translateCStr_Lang(const char *textWithIds) {
     if (strstr(textWithIds, "${") == NULL) {
         return textWithIds; /* nothing to replace */
     }
-    iString *text = collectNewCStr_String(textWithIds);
+    iLang         *d      = &lang_;
+    const iRangecc source = range_CStr(textWithIds);
+    const uint32_t hash   = iMax(1u, hash_Lang_(source));
+    iTranslation  *tr     = &d->translations[hash & (numTranslations_Lang_ - 1)];
+    const char    *result = NULL;
+    lock_Mutex(&d->translationsMutex);
+    if (tr->hash == hash && equal_Rangecc(range_String(tr->source), textWithIds)) {
+        result = cstr_String(tr->result);
+    }
+    unlock_Mutex(&d->translationsMutex);
+    if (result) {
+        return result;
+    }
+    iString *text = newCStr_String(textWithIds);
     translate_Lang(text);
-    return cstr_String(text);
+    lock_Mutex(&d->translationsMutex);
+    if (tr->hash) {
+        delete_String(tr->source);
+        collect_String(tr->result); /* the caller of the replaced one may still be using it */
+    }
+    tr->hash   = hash;
+    tr->source = newRange_String(source);
+    tr->result = text;
+    result     = cstr_String(text);
+    unlock_Mutex(&d->translationsMutex);
+    return result;
 }
 
 const char *formatCStr_Lang(const char *formatMsgId, int count) {
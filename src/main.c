@@ -66,6 +66,10 @@ int main(int argc, char **argv) {
                           "ECDHE-RSA-CHACHA20-POLY1305:"
                           "ECDHE-RSA-AES128-GCM-SHA256:"
                           "DHE-RSA-AES256-GCM-SHA384");
+#if defined (LAGRANGE_ENABLE_TLS_SESSION_CACHE)
+    /* Repeated requests to the same host can skip the full handshake. */
+    setSessionCacheEnabled_TlsRequest(iTrue);
+#endif
     SDL_SetHint(SDL_HINT_VIDEO_ALLOW_SCREENSAVER, "1");
     SDL_SetHint(SDL_HINT_MAC_CTRL_CLICK_EMULATE_RIGHT_CLICK, "1");
     SDL_SetHint(SDL_HINT_VIDEO_X11_NET_WM_BYPASS_COMPOSITOR, "0");
@@ -0,0 +1,737 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "markdown.h"
+
+#include <the_Foundation/array.h>
+#include <ctype.h>
+#include <string.h>
+
+#if defined (LAGRANGE_ENABLE_BENCHMARK)
+#   include <the_Foundation/regexp.h>
+#endif
+
+iDeclareType(MarkdownConverter)
+iDeclareType(MarkdownLink)
+iDeclareType(MarkdownLinkScan)
+iDeclareType(MarkdownRef)
+
+enum iMarkdownDelim {
+    asterisk_MarkdownDelim,
+    doubleAsterisk_MarkdownDelim,
+    underscore_MarkdownDelim,
+    doubleUnderscore_MarkdownDelim,
+    code_MarkdownDelim,
+    max_MarkdownDelim
+};
+
+static const int maxInlineDepth_Markdown_ = 8; /* nested styles */
+
+struct Impl_MarkdownLink {
+    iRangecc title;
+    iRangecc url;     /* reference name if `isNamed` */
+    iBool    isNamed;
+};
+
+/* What earlier failed link searches found out about the rest of the text. This keeps the
+   conversion linear when brackets don't form links, e.g., "[[[[]". */
+struct Impl_MarkdownLinkScan {
+    const char *retryPos;  /* brackets before this would find the same failing `]` */
+    iBool       noBracket; /* no `]` in the rest of the text */
+    iBool       noParen;   /* no `)` */
+    iBool       noSquare;  /* no `]` after a `][` */
+};
+
+struct Impl_MarkdownRef {
+    iRangecc name;
+    iRangecc url;
+};
+
+struct Impl_MarkdownConverter {
+    iRangecc source;
+    iString *out;
+    iArray   links; /* pending; written at the end of the section */
+    iArray   refs;  /* reference definitions; found when first needed */
+    iBool    isRefsFound;
+};
+
+static iBool isSpace_(char ch) {
+    return ch == ' ' || ch == '\t' || ch == '\r';
+}
+
+static iBool isWordChar_(char ch) {
+    return isalnum((unsigned char) ch) || ch == '_';
+}
+
+static iRangecc trimmed_(iRangecc range) {
+    while (range.start < range.end && isSpace_(*range.start)) {
+        range.start++;
+    }
+    while (range.end > range.start && isSpace_(range.end[-1])) {
+        range.end--;
+    }
+    return range;
+}
+
+static const char *findChar_(const char *start, const char *end, char ch) {
+    return start < end ? memchr(start, ch, end - start) : NULL;
+}
+
+static void appendText_(iString *out, iRangecc text) {
+    /* Copied as is, apart from non-breaking space entities. */
+    while (text.start < text.end) {
+        const char *amp = findChar_(text.start, text.end, '&');
+        if (!amp) {
+            appendRange_String(out, text);
+            return;
+        }
+        appendRange_String(out, (iRangecc){ text.start, amp });
+        if (text.end - amp >= 6 && !memcmp(amp, "&nbsp;", 6)) {
+            appendCStr_String(out, "\u00a0");
+            text.start = amp + 6;
+        }
+        else {
+            appendCStr_String(out, "&");
+            text.start = amp + 1;
+        }
+    }
+}
+
+static char lastChar_(const iString *out) {
+    return isEmpty_String(out) ? 0 : constEnd_String(out)[-1];
+}
+
+static void appendBreak_(iString *out, int count) {
+    /* Ends the current line. Trailing spaces are dropped, and there is never more than one
+       empty line in a row. */
+    if (isEmpty_String(out)) {
+        return;
+    }
+    size_t len = size_String(out);
+    while (len > 0 && isSpace_(constBegin_String(out)[len - 1])) {
+        len--;
+    }
+    truncate_Block(&out->chars, len);
+    const char *begin     = constBegin_String(out);
+    const char *end       = constEnd_String(out);
+    int         numBreaks = 0;
+    while (numBreaks < count && end - numBreaks > begin && end[-numBreaks - 1] == '\n') {
+        numBreaks++;
+    }
+    for (; numBreaks < count; numBreaks++) {
+        appendCStr_String(out, "\n");
+    }
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static iBool parseRef_(iRangecc line, iMarkdownRef *ref) {
+    /* [name]: url */
+    line = trimmed_(line);
+    if (line.start == line.end || *line.start != '[') {
+        return iFalse;
+    }
+    const char *close = findChar_(line.start + 1, line.end, ']');
+    if (!close || close == line.start + 1) {
+        return iFalse;
+    }
+    iRangecc rest = trimmed_((iRangecc){ close + 1, line.end });
+    if (rest.start == rest.end || *rest.start != ':') {
+        return iFalse;
+    }
+    rest = trimmed_((iRangecc){ rest.start + 1, rest.end });
+    if (rest.start == rest.end) {
+        return iFalse;
+    }
+    ref->name = (iRangecc){ line.start + 1, close };
+    ref->url  = rest;
+    return iTrue;
+}
+
+static iBool parseLink_(const char *start, const char *end, iMarkdownLink *link_out,
+                        const char **next, iMarkdownLinkScan *scan) {
+    /* `start` is at the opening bracket: [title](url) or [title][name] */
+    iAssert(*start == '[');
+    if (scan->noBracket || start < scan->retryPos) {
+        return iFalse;
+    }
+    const char *close = findChar_(start + 1, end, ']');
+    if (!close) {
+        scan->noBracket = iTrue;
+        return iFalse;
+    }
+    /* Any bracket before `close` finds the same `]`, so it would fail the same way. */
+    if (close == start + 1 || close + 1 >= end || (close[1] != '(' && close[1] != '[')) {
+        scan->retryPos = close;
+        return iFalse;
+    }
+    const char        terminator = (close[1] == '(' ? ')' : ']');
+    iBool *           noMore     = (terminator == ')' ? &scan->noParen : &scan->noSquare);
+    const char *const urlStart   = close + 2;
+    const char *      urlEnd     = *noMore ? NULL : findChar_(urlStart, end, terminator);
+    if (!urlEnd || urlEnd == urlStart) {
+        if (!urlEnd) {
+            *noMore = iTrue;
+        }
+        scan->retryPos = close;
+        return iFalse;
+    }
+    link_out->title   = (iRangecc){ start + 1, close };
+    link_out->url     = (iRangecc){ urlStart, urlEnd };
+    link_out->isNamed = (terminator == ']');
+    *next = urlEnd + 1;
+    return iTrue;
+}
+
+static const char *findClosingDelim_(const char *inner, const char *end, char ch, size_t len) {
+    /* The closing delimiter must follow at least one character that isn't whitespace. */
+    for (const char *pos = inner + 1; pos + len <= end; pos++) {
+        pos = findChar_(pos, end, ch);
+        if (!pos || pos + len > end) {
+            break;
+        }
+        if (isSpace_(pos[-1])) {
+            continue;
+        }
+        if (len == 2) {
+            if (pos[1] == ch) {
+                return pos;
+            }
+            continue;
+        }
+        if (ch == '*') {
+            if (pos[-1] != '*' && (pos + 1 == end || pos[1] != '*')) {
+                return pos;
+            }
+        }
+        else if (pos + 1 == end || !isWordChar_(pos[1])) {
+            return pos; /* intraword underscores are not emphasis */
+        }
+    }
+    return NULL;
+}
+
+static void convertInline_MarkdownConverter_(iMarkdownConverter *d, iRangecc text,
+                                             iBool allowLinks, int depth) {
+    iString *   out    = d->out;
+    const char *lit    = text.start; /* pending literal text */
+    const char *pos    = text.start;
+    iBool       noMore[max_MarkdownDelim]; /* earlier search failed, so later ones would, too */
+    iMarkdownLinkScan linkScan;
+    iZap(noMore);
+    iZap(linkScan);
+#define flushLiteral_() appendText_(out, (iRangecc){ lit, pos })
+    while (pos < text.end) {
+        const char ch = *pos;
+        if (ch == '\\' && pos + 1 < text.end && pos[1] == '_') {
+            flushLiteral_();
+            lit = ++pos; /* the underscore is shown */
+            pos++;
+            continue;
+        }
+        if (ch == '`' && !noMore[code_MarkdownDelim]) {
+            if ((pos > text.start && pos[-1] == '`') || (pos + 1 < text.end && pos[1] == '`')) {
+                pos++; /* longer runs of backticks are shown as is */
+                continue;
+            }
+            const char *close = findChar_(pos + 1, text.end, '`');
+            if (!close) {
+                noMore[code_MarkdownDelim] = iTrue;
+            }
+            else if (close > pos + 1 && (close + 1 == text.end || close[1] != '`')) {
+                flushLiteral_();
+                appendCStr_String(out, "\x1b[11m");
+                appendText_(out, (iRangecc){ pos + 1, close });
+                appendCStr_String(out, "\x1b[0m");
+                lit = pos = close + 1;
+                continue;
+            }
+            pos++;
+            continue;
+        }
+        if (allowLinks && !linkScan.noBracket &&
+            ((ch == '!' && pos + 1 < text.end && pos[1] == '[') || ch == '[')) {
+            const iBool   isImage = (ch == '!');
+            iMarkdownLink link;
+            const char *  next;
+            if (parseLink_(pos + isImage, text.end, &link, &next, &linkScan)) {
+                flushLiteral_();
+                if (isImage && !link.isNamed) {
+                    /* Images are shown as links of their own. */
+                    appendBreak_(out, 1);
+                    appendCStr_String(out, "=> ");
+                    appendRange_String(out, link.url);
+                    appendCStr_String(out, " ");
+                    appendText_(out, link.title);
+                    appendBreak_(out, 1);
+                    while (next < text.end && isSpace_(*next)) {
+                        next++;
+                    }
+                }
+                else {
+                    if (isImage) {
+                        appendCStr_String(out, "!");
+                    }
+                    convertInline_MarkdownConverter_(d, link.title, iFalse, depth + 1);
+                    pushBack_Array(&d->links, &link);
+                }
+                lit = pos = next;
+                continue;
+            }
+            pos++;
+            continue;
+        }
+        if (ch == '*' || ch == '_') {
+            const size_t len   = (pos + 1 < text.end && pos[1] == ch ? 2 : 1);
+            const int    delim = (ch == '*' ? asterisk_MarkdownDelim : underscore_MarkdownDelim) +
+                                 (len == 2 ? 1 : 0);
+            const char  *inner = pos + len;
+            const iBool  canOpen =
+                depth < maxInlineDepth_Markdown_ && !noMore[delim] && inner < text.end &&
+                !isSpace_(*inner) &&
+                (ch == '*' || pos == text.start || !isWordChar_(pos[-1]));
+            if (canOpen) {
+                const char *close = findClosingDelim_(inner, text.end, ch, len);
+                if (close) {
+                    flushLiteral_();
+                    appendCStr_String(out, len == 2 ? "\x1b[1m" : "\x1b[3m");
+                    convertInline_MarkdownConverter_(d, (iRangecc){ inner, close }, allowLinks,
+                                                     depth + 1);
+                    appendCStr_String(out, "\x1b[0m");
+                    lit = pos = close + len;
+                    continue;
+                }
+                noMore[delim] = iTrue;
+            }
+            pos += len;
+            continue;
+        }
+        pos++;
+    }
+    flushLiteral_();
+#undef flushLiteral_
+}
+
+static const iMarkdownRef *findRef_MarkdownConverter_(iMarkdownConverter *d, iRangecc name) {
+    if (!d->isRefsFound) {
+        /* Reference definitions may appear anywhere, so they are looked up only when needed. */
+        iRangecc line = iNullRange;
+        while (nextSplit_Rangecc(d->source, "\n", &line)) {
+            iMarkdownRef ref;
+            if (parseRef_(line, &ref)) {
+                pushBack_Array(&d->refs, &ref);
+            }
+        }
+        d->isRefsFound = iTrue;
+    }
+    iConstForEach(Array, i, &d->refs) {
+        const iMarkdownRef *ref = i.value;
+        if (equalRangeCase_Rangecc(ref->name, name)) {
+            return ref;
+        }
+    }
+    return NULL;
+}
+
+static void flushLinks_MarkdownConverter_(iMarkdownConverter *d) {
+    if (isEmpty_Array(&d->links)) {
+        return;
+    }
+    appendBreak_(d->out, 2);
+    iConstForEach(Array, i, &d->links) {
+        const iMarkdownLink *link = i.value;
+        iRangecc             url  = link->url;
+        if (link->isNamed) {
+            const iMarkdownRef *ref = findRef_MarkdownConverter_(d, url);
+            if (!ref) {
+                continue; /* undefined */
+            }
+            url = ref->url;
+        }
+        appendCStr_String(d->out, "=> ");
+        appendRange_String(d->out, url);
+        appendCStr_String(d->out, " ");
+        appendText_(d->out, link->title);
+        appendCStr_String(d->out, "\n");
+    }
+    clear_Array(&d->links);
+}
+
+static iBool isFence_(iRangecc line, iRangecc *info) {
+    size_t indent = 0;
+    while (indent < 3 && line.start < line.end && *line.start == ' ') {
+        line.start++;
+        indent++;
+    }
+    if (size_Range(&line) >= 3 && (startsWith_Rangecc(line, "```") ||
+                                   startsWith_Rangecc(line, "~~~"))) {
+        const char  ch = *line.start;
+        const char *p  = line.start;
+        while (p < line.end && *p == ch) {
+            p++;
+        }
+        if (info) {
+            *info = trimmed_((iRangecc){ p, line.end });
+        }
+        return iTrue;
+    }
+    return iFalse;
+}
+
+static iBool isStandaloneLink_(iRangecc line, iMarkdownLink *link) {
+    /* A link that is alone on its line, possibly emphasized. */
+    while (line.start < line.end && (isSpace_(*line.start) || *line.start == '*' ||
+                                     *line.start == '_')) {
+        line.start++;
+    }
+    while (line.end > line.start && (isSpace_(line.end[-1]) || line.end[-1] == '*' ||
+                                     line.end[-1] == '_')) {
+        line.end--;
+    }
+    const char *      next;
+    iMarkdownLinkScan scan;
+    iZap(scan);
+    return line.start < line.end && *line.start == '[' &&
+           parseLink_(line.start, line.end, link, &next, &scan) && !link->isNamed &&
+           next == line.end;
+}
+
+static iBool isNumbered_(iRangecc line) {
+    const char *p = line.start;
+    while (p < line.end && p - line.start < 3 && isdigit((unsigned char) *p)) {
+        p++;
+    }
+    return p > line.start && p < line.end && *p == '.';
+}
+
+void convertToGemtext_Markdown(iRangecc source, iString *out) {
+    iMarkdownConverter d = { .source = source, .out = out };
+    init_Array(&d.links, sizeof(iMarkdownLink));
+    init_Array(&d.refs, sizeof(iMarkdownRef));
+    clear_String(out);
+    reserve_Block(&out->chars, size_Range(&source) + size_Range(&source) / 8);
+    iBool    isFenced    = iFalse;
+    iBool    isIndented  = iFalse;
+    iBool    isLastEmpty = iFalse;
+    iRangecc line        = iNullRange;
+    while (nextSplit_Rangecc(source, "\n", &line)) {
+        if (line.end > line.start && line.end[-1] == '\r') {
+            line.end--;
+        }
+        iRangecc info;
+        if (isFenced) {
+            if (isFence_(line, NULL)) {
+                appendCStr_String(out, "\n```\n");
+                isFenced    = iFalse;
+                isLastEmpty = iFalse;
+            }
+            else {
+                appendCStr_String(out, "\n");
+                appendText_(out, line);
+            }
+            continue;
+        }
+        if (isIndented) {
+            if (startsWith_Rangecc(line, "    ")) {
+                appendText_(out, (iRangecc){ line.start + 4, line.end });
+                appendCStr_String(out, "\n");
+                continue;
+            }
+            appendCStr_String(out, "```\n");
+            isIndented = iFalse; /* this line is converted normally */
+        }
+        if (isFence_(line, &info)) {
+            appendBreak_(out, isLastEmpty ? 2 : 1);
+            appendCStr_String(out, "```");
+            appendRange_String(out, info);
+            isFenced = iTrue;
+            continue;
+        }
+        const iRangecc content = trimmed_(line);
+        if (isEmpty_Range(&content)) {
+            isLastEmpty = iTrue;
+            continue;
+        }
+        if (startsWith_Rangecc(line, "    ") && (isLastEmpty || lastChar_(out) == '\n' ||
+                                                isEmpty_String(out))) {
+            appendBreak_(out, isLastEmpty ? 2 : 1);
+            appendCStr_String(out, "```\n");
+            appendText_(out, (iRangecc){ line.start + 4, line.end });
+            appendCStr_String(out, "\n");
+            isIndented  = iTrue;
+            isLastEmpty = iFalse;
+            continue;
+        }
+        iMarkdownRef ref;
+        if (parseRef_(line, &ref)) {
+            continue; /* used when the links are written */
+        }
+        line = content;
+        const char  first     = *line.start;
+        const iBool isHeading = (first == '#');
+        const iBool isBullet  = ((first == '-' || first == '+' || first == '*') &&
+                                 size_Range(&line) > 1 && line.start[1] == ' ');
+        if (isHeading) {
+            flushLinks_MarkdownConverter_(&d);
+        }
+        /* Separate from the previous line. */
+        if (isLastEmpty) {
+            appendBreak_(out, 2);
+        }
+        else if (endsWith_String(out, "  ") || isHeading || isBullet || isNumbered_(line) ||
+                 first == '>' ||
+                 first == '*' || (first == '|' && lastChar_(out) == '|')) {
+            appendBreak_(out, 1);
+        }
+        else if (!isEmpty_String(out) && lastChar_(out) != '\n') {
+            appendCStr_String(out, " ");
+        }
+        isLastEmpty = iFalse;
+        iMarkdownLink link;
+        if (isStandaloneLink_(line, &link)) {
+            appendBreak_(out, 1);
+            appendCStr_String(out, "=> ");
+            appendRange_String(out, link.url);
+            appendCStr_String(out, " ");
+            convertInline_MarkdownConverter_(&d, link.title, iFalse, 0);
+            appendBreak_(out, 1);
+            continue;
+        }
+        if (isBullet) {
+            appendCStr_String(out, "* ");
+            line.start += 2;
+        }
+        convertInline_MarkdownConverter_(&d, line, iTrue, 0);
+        if (isHeading) {
+            appendBreak_(out, 1);
+        }
+    }
+    if (isFenced) {
+        appendCStr_String(out, "\n```\n");
+    }
+    else if (isIndented) {
+        appendCStr_String(out, "```\n");
+    }
+    flushLinks_MarkdownConverter_(&d);
+    appendBreak_(out, 1);
+    deinit_Array(&d.refs);
+    deinit_Array(&d.links);
+}
+
+#if defined (LAGRANGE_ENABLE_BENCHMARK)
+/*----------------------------------------------------------------------------------------------*/
+/* The earlier regular expression based converter, kept for comparison in benchmarks. */
+
+static int replaceRegExp_String(iString *d, const iRegExp *regexp, const char *replacement,
+                                void (*matchHandler)(void *, const iRegExpMatch *),
+                                void *context) {
+    iRegExpMatch m;
+    iString      result;
+    int          numMatches = 0;
+    const char  *pos        = constBegin_String(d);
+    init_RegExpMatch(&m);
+    init_String(&result);
+    while (matchString_RegExp(regexp, d, &m)) {
+        appendRange_String(&result, (iRangecc){ pos, begin_RegExpMatch(&m) });
+        /* Replace any capture group back-references. */
+        for (const char *ch = replacement; *ch; ch++) {
+            if (*ch == '\\') {
+                ch++;
+                if (*ch == '\\') {
+                    appendCStr_String(&result, "\\");
+                }
+                else if (*ch >= '0' && *ch <= '9') {
+                    appendRange_String(&result, capturedRange_RegExpMatch(&m, *ch - '0'));
+                }
+            }
+            else {
+                appendData_Block(&result.chars, ch, 1);
+            }
+        }
+        if (matchHandler) {
+            matchHandler(context, &m);
+        }
+        pos = end_RegExpMatch(&m);
+        numMatches++;
+    }
+    appendRange_String(&result, (iRangecc){ pos, constEnd_String(d) });
+    set_String(d, &result);
+    deinit_String(&result);
+    return numMatches;
+}
+
+iDeclareType(PendingLink)
+struct Impl_PendingLink {
+    iString *url;
+    iString *title;
+};
+
+static void addPendingLink_(void *context, const iRegExpMatch *m) {
+    pushBack_Array(context, &(iPendingLink){
+        .url   = captured_RegExpMatch(m, 2),
+        .title = captured_RegExpMatch(m, 1)
+    });
+}
+
+static void addPendingNamedLink_(void *context, const iRegExpMatch *m) {
+    pushBack_Array(context, &(iPendingLink){
+        .url   = newFormat_String("[]%s", cstr_Rangecc(capturedRange_RegExpMatch(m, 2))),
+        .title = captured_RegExpMatch(m, 1)
+    });
+}
+
+static void flushPendingLinks_(iArray *links, const iString *source, iString *out) {
+    iRegExp *namePattern = new_RegExp("\n\\s*\\[(.+?)\\]\\s*:\\s*([^\n]+)", 0);
+    if (!endsWith_String(out, "\n")) {
+        appendCStr_String(out, "\n");
+    }
+    iForEach(Array, i, links) {
+        iPendingLink *pending = i.value;
+        const char *url = cstr_String(pending->url);
+        if (startsWith_CStr(url, "[]")) {
+            /* Find the matching named link. */
+            iRegExpMatch m;
+            init_RegExpMatch(&m);
+            while (matchString_RegExp(namePattern, source, &m)) {
+                if (equal_Rangecc(capturedRange_RegExpMatch(&m, 1), url + 2)) {
+                    url = cstrCollect_String(captured_RegExpMatch(&m, 2));
+                    break;
+                }
+            }
+        }
+        appendFormat_String(out, "\n=> %s %s", url, cstr_String(pending->title));
+        delete_String(pending->url);
+        delete_String(pending->title);
+    }
+    clear_Array(links);
+    iRelease(namePattern);
+}
+
+void convertToGemtextRegExp_Markdown(iRangecc source, iString *out) {
+    iString *src = collect_String(newRange_String(source));
+    /* Get rid of indented preformats. */ {
+        iArray        *pendingLinks     = collectNew_Array(sizeof(iPendingLink));
+        const iRegExp *imageLinkPattern = iClob(new_RegExp("\n?!\\[(.+)\\]\\(([^)]+)\\)\n?", 0));
+        const iRegExp *linkPattern      = iClob(new_RegExp("\\[(.+?)\\]\\(([^)]+)\\)", 0));
+        const iRegExp *standaloneLinkPattern = iClob(new_RegExp("^[\\s*_]*\\[(.+?)\\]\\(([^)]+)\\)[\\s*_]*$", 0));
+        const iRegExp *namedLinkPattern = iClob(new_RegExp("\\[(.+?)\\]\\[(.+?)\\]", 0));
+        const iRegExp *namePattern      = iClob(new_RegExp("\\s*\\[(.+?)\\]\\s*:\\s*([^\n]+)", 0));
+        iString result;
+        init_String(&result);
+        replace_String(src, "&nbsp;", "\u00a0");
+        replaceRegExp_String(src, iClob(new_RegExp("```", 0)), "\n```\n", NULL, NULL);
+        iRangecc line = iNullRange;
+        iBool isPre = iFalse;
+        iBool isBlock = iFalse;
+        iBool isLastEmpty = iFalse;
+        while (nextSplit_Rangecc(range_String(src), "\n", &line)) {
+            if (!isPre && !isBlock) {
+                if (equal_Rangecc(line, "```")) {
+                    isBlock = iTrue;
+                    appendCStr_String(&result, "\n```");
+                    continue;
+                }
+                if (*line.start == '#') {
+                    flushPendingLinks_(pendingLinks, src, &result);
+                }
+                if (isEmpty_Range(&line)) {
+                    isLastEmpty = iTrue;
+                    continue;
+                }
+                if (isLastEmpty) {
+                    appendCStr_String(&result, "\n\n");
+                }
+                else if (size_Range(&line) >= 2 && isdigit(line.start[0]) &&
+                         (line.start[1] == '.' ||
+                          (isdigit(line.start[1]) && line.start[2] == '.'))) {
+                    appendCStr_String(&result, "\n\n");
+                }
+                else if (endsWith_String(&result, "  ") ||
+                         *line.start == '*' || *line.start == '>' || *line.start == '#' ||
+                         (*line.start == '|' && endsWith_String(&result, "|"))) {
+                    appendCStr_String(&result, "\n");
+                }
+                else {
+                    appendCStr_String(&result, " ");
+                }
+                isLastEmpty = iFalse;
+            }
+            else if (isBlock) {
+                if (equal_Rangecc(line, "```")) {
+                    isBlock = iFalse;
+                    appendCStr_String(&result, "\n```\n");
+                }
+                else {
+                    appendCStr_String(&result, "\n");
+                    appendRange_String(&result, line);
+                }
+                continue;
+            }
+            if (startsWith_Rangecc(line, "    ")) {
+                line.start += 4;
+                if (!isPre) {
+                    appendCStr_String(&result, "```\n");
+                    isPre = iTrue;
+                }
+            }
+            else if (isPre) {
+                if (!endsWith_String(&result, "\n")) {
+                    appendCStr_String(&result, "\n");
+                }
+                appendCStr_String(&result, "```\n");
+                if (equal_Rangecc(line, "```")) {
+                    line.start = line.end; /* don't repeat it */
+                }
+                isPre = iFalse;
+            }
+            if (isPre) {
+                appendRange_String(&result, line);
+                appendCStr_String(&result, "\n");
+            }
+            else {
+                iString ln;
+                initRange_String(&ln, line);
+                replaceRegExp_String(&ln, namePattern, "", NULL, 0);
+                replaceRegExp_String(&ln, standaloneLinkPattern, "\n=> \\2 \\1", NULL, NULL);
+                replaceRegExp_String(&ln, imageLinkPattern, "\n=> \\2 \\1\n", NULL, NULL);
+                replaceRegExp_String(&ln, namedLinkPattern, "\\1", addPendingNamedLink_, pendingLinks);
+                replaceRegExp_String(&ln, linkPattern, "\\1", addPendingLink_, pendingLinks);
+                replaceRegExp_String(&ln, iClob(new_RegExp("\\*\\*(.+?)\\*\\*", 0)), "\x1b[1m\\1\x1b[0m", NULL, NULL);
+                replaceRegExp_String(&ln, iClob(new_RegExp("__(.+?)__", 0)), "\x1b[1m\\1\x1b[0m", NULL, NULL);
+                replaceRegExp_String(&ln, iClob(new_RegExp("\\*(.+?)\\*", 0)), "\x1b[3m\\1\x1b[0m", NULL, NULL);
+                replaceRegExp_String(&ln, iClob(new_RegExp("\\b_([^_]+?)_\\b", 0)), "\x1b[3m\\1\x1b[0m", NULL, NULL);
+                replaceRegExp_String(&ln, iClob(new_RegExp("(?<!`)`([^`]+?)`(?!`)", 0)), "\x1b[11m\\1\x1b[0m", NULL, NULL);
+                replace_String(&ln, "\\_", "_");
+                append_String(&result, &ln);
+                deinit_String(&ln);
+            }
+        }
+        flushPendingLinks_(pendingLinks, src, &result);
+        set_String(src, &result);
+        deinit_String(&result);
+    }
+    /* Replace Markdown syntax with equivalent Gemtext, where possible. */
+    replaceRegExp_String(src, iClob(new_RegExp("(\\s*\n){2,}", 0)), "\n\n", NULL, NULL); /* normalize paragraph breaks */
+    set_String(out, src);
+}
+
+#endif /* LAGRANGE_ENABLE_BENCHMARK */
@@ -23,21 +23,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "media.h"
 #include "gmdocument.h"
 #include "gmrequest.h"
+#include "imagecache.h"
+#include "imagedecoder.h"
+#include "requestbroker.h"
 #include "ui/window.h"
 #include "ui/paint.h" /* size_SDLTexture */
 #include "audio/player.h"
 #include "app.h"
-#include "stb_image.h"
-#include "stb_image_resize.h"
-
-#if defined (LAGRANGE_ENABLE_WEBP)
-#   include <webp/decode.h>
-#endif
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/stringlist.h>
-#include <SDL_hints.h>
 #include <SDL_render.h>
 #include <SDL_timer.h>
 
@@ -69,131 +65,131 @@ iDeclareType(GmImage)
 struct Impl_GmImage {
     iGmMediaProps props;
     iBlock        partialData; /* cleared when image is converted to texture */
+    iBlock        source;      /* compressed data, kept if worth decoding again after eviction */
     iInt2         size;
     size_t        numBytes;
-    SDL_Texture * texture;
+    SDL_Texture * texture;     /* preview while loading */
+    iImageCacheEntry *cached;  /* the complete image */
+    uint64_t      contentHash; /* of `source`, computed once */
+    uint64_t      cacheKey;
+    iImageDecodeJob *decoding;
+    uint32_t      previewTime; /* when the latest preview was started */
+    iBool         isFailed;
 };
 
 void init_GmImage(iGmImage *d, const iBlock *data) {
     init_GmMediaProps_(&d->props);
     initCopy_Block(&d->partialData, data);
+    init_Block(&d->source, 0);
     d->size     = zero_I2();
     d->numBytes = 0;
     d->texture  = NULL;
+    d->cached   = NULL;
+    d->contentHash = 0;
+    d->cacheKey = 0;
+    d->decoding = NULL;
+    d->previewTime = 0;
+    d->isFailed = iFalse;
 }
 
 void deinit_GmImage(iGmImage *d) {
+    cancel_ImageDecoder(d->decoding);
     deinit_Block(&d->partialData);
+    deinit_Block(&d->source);
     SDL_DestroyTexture(d->texture);
+    release_ImageCache(d->cached);
     deinit_GmMediaProps_(&d->props);
 }
 
-static void applyImageStyle_(enum iImageStyle style, iInt2 size, uint8_t *imgData) {
-    if (style == original_ImageStyle) {
-        return;
-    }
-    uint8_t *pos       = imgData;
-    size_t   numPixels = size.x * size.y;
-    float    brighten  = 0.0f;
-    if (style == bgFg_ImageStyle) {
-        iColor dark  = get_Color(tmBackground_ColorId);
-        iColor light = get_Color(tmParagraph_ColorId);
-        if (hsl_Color(dark).lum > hsl_Color(light).lum) {
-            iSwap(iColor, dark, light);
-        }        
-        while (numPixels-- > 0) {
-            iHSLColor hsl = hsl_Color((iColor){ pos[0], pos[1], pos[2], 255 });
-            const float s = 1.0f - hsl.lum;
-            const float t = hsl.lum;
-            pos[0] = dark.r * s + light.r * t;
-            pos[1] = dark.g * s + light.g * t;
-            pos[2] = dark.b * s + light.b * t;
-            pos += 4;
-        }        
-        return;
-    }
-    iColor colorize = (iColor){ 255, 255, 255, 255 };
-    if (style != grayscale_ImageStyle) {
-        colorize = get_Color(style == textColorized_ImageStyle ? tmParagraph_ColorId
-                                                               : tmPreformatted_ColorId);
-        /* Compensate for change in mid-tones. */
-        const int colMax = iMax(iMax(colorize.r, colorize.g), colorize.b);
-        brighten = iClamp(1.0f - (colorize.r + colorize.g + colorize.b) / (colMax * 3), 0.0f, 0.5f);
+static void load_GmImage_(iGmImage *d) {
+    cancel_ImageDecoder(d->decoding);
+    d->decoding = NULL;
+    release_ImageCache(d->cached);
+    d->cacheKey = cacheKey_ImageDecoder(d->contentHash); /* style may have changed */
+    d->cached   = acquire_ImageCache(d->cacheKey);
+    if (d->cached) {
+        SDL_DestroyTexture(d->texture); /* the preview */
+        d->texture = NULL;
     }
-    iHSLColor hslColorize = hsl_Color(colorize);
-    while (numPixels-- > 0) {
-        iHSLColor hsl = hsl_Color((iColor){ pos[0], pos[1], pos[2], 255 });
-        iHSLColor out = { hslColorize.hue, hslColorize.sat, hsl.lum, 1.0f };
-        out.lum = powf(out.lum, 1.0f + brighten * 2);
-        iColor outRgb = rgb_HSLColor(out);
-        pos[0] = powf(outRgb.r / 255.0f, 1.0f - brighten * 0.75f) * 255;
-        pos[1] = powf(outRgb.g / 255.0f, 1.0f - brighten * 0.75f) * 255;
-        pos[2] = powf(outRgb.b / 255.0f, 1.0f - brighten * 0.75f) * 255;
-        pos += 4;
+    else {
+        d->decoding = decode_ImageDecoder(&d->props.mime, &d->source);
     }
 }
 
+static void evict_GmImage_(iGmImage *d) {
+    cancel_ImageDecoder(d->decoding);
+    d->decoding = NULL;
+    release_ImageCache(d->cached);
+    d->cached = NULL;
+}
+
+static iBool isEvicted_GmImage_(const iGmImage *d) {
+    return !d->cached && !d->decoding && !d->isFailed && !isEmpty_Block(&d->source);
+}
+
 void makeTexture_GmImage(iGmImage *d) {
-    iBlock *data     = &d->partialData;
-    d->numBytes      = size_Block(data);
-    uint8_t *imgData = NULL;
-    if (cmp_String(&d->props.mime, "image/webp") == 0) {
-#if defined (LAGRANGE_ENABLE_WEBP)
-        imgData = WebPDecodeRGBA(constData_Block(data), size_Block(data), &d->size.x, &d->size.y);
-#endif        
+    iBlock *data = &d->partialData;
+    d->numBytes  = size_Block(data);
+    d->isFailed  = iFalse;
+    set_Block(&d->source, data);
+    /* The size is known from the header, so the document can be laid out while the pixels
+       are decoded in the background. */
+    if (!imageSize_ImageDecoder(&d->props.mime, data, &d->size)) {
+        d->size = zero_I2();
+        d->isFailed = iTrue;
+        clear_Block(&d->source);
     }
     else {
-        imgData = stbi_load_from_memory(
-            constData_Block(data), size_Block(data), &d->size.x, &d->size.y, NULL, 4);
-        if (!imgData) {
-            fprintf(stderr, "[media] image load failed: %s\n", stbi_failure_reason());
-        }
+        d->contentHash = contentHash_ImageDecoder(&d->source);
+        load_GmImage_(d);
     }
-    if (!imgData) {
-        d->size    = zero_I2();
-        d->texture = NULL;
+    clear_Block(data);
+}
+
+static void updatePreview_GmImage_(iGmImage *d) {
+    /* Each preview decodes all the data received so far, so they are started at a limited
+       rate and only one at a time. */
+    const static uint32_t previewInterval_ = 250;
+    if (isEqual_I2(d->size, zero_I2()) &&
+        !imageSize_ImageDecoder(&d->props.mime, &d->partialData, &d->size)) {
+        return; /* header not received yet */
     }
-    else {
-        applyImageStyle_(prefs_App()->imageStyle, d->size, imgData);        
-        /* TODO: Save some memory by checking if the alpha channel is actually in use. */
-        iWindow *window  = get_Window();
-        iInt2    texSize = d->size;
-        /* Resize down to min(maximum texture size, window size). */ {
-            SDL_Rect dispRect;
-            SDL_GetDisplayBounds(SDL_GetWindowDisplayIndex(window->win), &dispRect);
-            const iInt2 maxSize = min_I2(isEqual_I2(maxTextureSize_Window(window), zero_I2()) ?
-                                         texSize : maxTextureSize_Window(window),
-                                         coord_Window(window, dispRect.w, dispRect.h));
-            iInt2 scaled = d->size;
-            if (scaled.x > maxSize.x) {
-                scaled.y = scaled.y * maxSize.x / scaled.x;
-                scaled.x = maxSize.x;
-            }
-            if (scaled.y > maxSize.y) {
-                scaled.x = scaled.x * maxSize.y / scaled.y;
-                scaled.y = maxSize.y;
-            }
-            if (!isEqual_I2(scaled, d->size)) {
-                uint8_t *scaledImgData = malloc(scaled.x * scaled.y * 4);
-                stbir_resize_uint8(imgData, d->size.x, d->size.y, 4 * d->size.x,
-                                   scaledImgData, scaled.x, scaled.y, scaled.x * 4, 4);
-                free(imgData);
-                imgData = scaledImgData;
-                texSize = scaled;
-                /* We keep d->size for the UI. */
+    const uint32_t now = SDL_GetTicks();
+    if (d->decoding || now - d->previewTime < previewInterval_) {
+        return;
+    }
+    d->decoding = decodePreview_ImageDecoder(&d->props.mime, &d->partialData);
+    d->previewTime = now;
+}
+
+static iBool finishDecoding_GmImage_(iGmImage *d) {
+    if (!d->decoding || !isFinished_ImageDecodeJob(d->decoding)) {
+        return iFalse;
+    }
+    SDL_Texture *tex = makeTexture_ImageDecodeJob(d->decoding, renderer_Window(get_Window()));
+    /* A failed preview keeps showing the previous one. */
+    const iBool isPreview = isPreview_ImageDecodeJob(d->decoding);
+    const iBool changed   = (tex || !isPreview);
+    if (changed) {
+        SDL_DestroyTexture(d->texture);
+        d->texture = NULL;
+        if (isPreview) {
+            d->texture = tex;
+        }
+        else if (tex) {
+            d->cached = insert_ImageCache(d->cacheKey, tex);
+            /* Evicting is only worthwhile if the texture is much larger than the source. */
+            if ((size_t) d->size.x * d->size.y * 4 < 4 * size_Block(&d->source)) {
+                clear_Block(&d->source);
             }
         }
-        /* Create the texture. */
-        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(
-            imgData, texSize.x, texSize.y, 32, texSize.x * 4, SDL_PIXELFORMAT_ABGR8888);
-        /* TODO: In multiwindow case, all windows must have the same shared renderer?
-           Or at least a shared context. */
-        SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "1"); /* linear scaling */
-        d->texture = SDL_CreateTextureFromSurface(renderer_Window(window), surface);
-        SDL_FreeSurface(surface);
-        free(imgData);
+        else {
+            d->isFailed = iTrue;
+        }
     }
-    clear_Block(data);
+    cancel_ImageDecoder(d->decoding);
+    d->decoding = NULL;
+    return changed;
 }
 
 iDefineTypeConstructionArgs(GmImage, (const iBlock *data), data)
@@ -266,15 +262,10 @@ void deinit_GmDownload(iGmDownload *d) {
     delete_String(d->path);
 }
 
-static void writeToFile_GmDownload_(iGmDownload *d, const iBlock *data) {
+static void updateRate_GmDownload_(iGmDownload *d, uint64_t numBytes) {
     const static unsigned rateInterval_ = 1000;
-    iAssert(d->file);
-    writeData_File(d->file,
-                   constBegin_Block(data) + d->numBytes,
-                   size_Block(data) - d->numBytes);
-    const size_t newBytes = size_Block(data) - d->numBytes;
-    d->numBytes = size_Block(data);
-    d->rateNumBytes += newBytes;
+    d->rateNumBytes += numBytes - d->numBytes;
+    d->numBytes = numBytes;
     const uint32_t now = SDL_GetTicks();
     if (now - d->rateStartTime > rateInterval_) {
         const double elapsed = (double) (now - d->rateStartTime) / 1000.0;
@@ -284,6 +275,14 @@ static void writeToFile_GmDownload_(iGmDownload *d, const iBlock *data) {
     }
 }
 
+static void writeToFile_GmDownload_(iGmDownload *d, const iBlock *data) {
+    iAssert(d->file);
+    writeData_File(d->file,
+                   constBegin_Block(data) + d->numBytes,
+                   size_Block(data) - d->numBytes);
+    updateRate_GmDownload_(d, size_Block(data));
+}
+
 iDefineTypeConstruction(GmDownload)
 
 /*----------------------------------------------------------------------------------------------*/
@@ -327,13 +326,15 @@ size_t memorySize_Media(const iMedia *d) {
     size_t memSize = 0;
     iConstForEach(PtrArray, i, &d->items[image_MediaType]) {
         const iGmImage *img = i.ptr;
-        if (img->texture) {
+        if (img->cached) {
+            /* Shared with other documents, but counting it here lets the history free it. */
+            memSize += memorySize_ImageCacheEntry(img->cached);
+        }
+        else if (img->texture) {
             const iInt2 texSize = size_SDLTexture(img->texture);
             memSize += 4 * texSize.x * texSize.y; /* RGBA */
         }
-        else {
-            memSize += size_Block(&img->partialData);
-        }
+        memSize += size_Block(&img->partialData) + size_Block(&img->source);
     }
     iConstForEach(PtrArray, a, &d->items[audio_MediaType]) {
         const iGmAudio *audio = a.ptr;
@@ -341,10 +342,7 @@ size_t memorySize_Media(const iMedia *d) {
             memSize += sourceDataSize_Player(audio->player);
         }
     }
-    iConstForEach(PtrArray, n, &d->items[download_MediaType]) {
-        const iGmDownload *down = n.ptr;
-        memSize += down->numBytes;
-    }
+    /* Downloads are written to disk as they arrive. */
     return memSize; 
 }
 
@@ -392,6 +390,9 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
             if (!isPartial) {
                 makeTexture_GmImage(img);
             }
+            else {
+                updatePreview_GmImage_(img);
+            }
         }
     }
     else if (existing.type == audio_MediaType) {
@@ -435,6 +436,10 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
     }
     else if (!isDeleting) {
         if (startsWith_String(mime, "image/")) {
+            iInt2 size;
+            if (isPartial && !imageSize_ImageDecoder(mime, data, &size)) {
+                return iFalse; /* can't be laid out until the size is known */
+            }
             /* Copy the image to a texture. */
             iGmImage *img = new_GmImage(data);
             img->props.linkId = linkId; /* TODO: use a hash? */
@@ -444,6 +449,9 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
             if (!isPartial) {
                 makeTexture_GmImage(img);
             }
+            else {
+                updatePreview_GmImage_(img);
+            }
             isNew = iTrue;
         }
         else if (startsWith_String(mime, "audio/")) {
@@ -465,6 +473,15 @@ iBool setData_Media(iMedia *d, iGmLinkId linkId, const iString *mime, const iBlo
     return isNew;
 }
 
+void streamData_Media(iMedia *d, iGmLinkId linkId, size_t offset, const iBlock *data,
+                      iBool isComplete) {
+    const iMediaId existing = findMediaForLink_Media(d, linkId, audio_MediaType);
+    if (existing.id) {
+        iGmAudio *audio = at_PtrArray(&d->items[audio_MediaType], index_MediaId(existing));
+        updateStreamData_Player(audio->player, offset, data, isComplete);
+    }
+}
+
 static iMediaId findMediaPtr_Media_(const iPtrArray *items, enum iMediaType mediaType, iGmLinkId linkId) {
     iConstForEach(PtrArray, i, items) {
         const iGmMediaProps *props = i.ptr;
@@ -492,6 +509,10 @@ iMediaId findMediaForLink_Media(const iMedia *d, iGmLinkId linkId, enum iMediaTy
     return mid;
 }
 
+size_t numImages_Media(const iMedia *d) {
+    return size_PtrArray(&d->items[image_MediaType]);
+}
+
 size_t numAudio_Media(const iMedia *d) {
     return size_PtrArray(&d->items[audio_MediaType]);
 }
@@ -511,11 +532,53 @@ SDL_Texture *imageTexture_Media(const iMedia *d, iMediaId imageId) {
     const size_t index = index_MediaId(imageId);
     if (index < size_PtrArray(&d->items[image_MediaType])) {
         const iGmImage *img = constAt_PtrArray(&d->items[image_MediaType], index);
-        return img->texture;
+        return img->cached ? texture_ImageCacheEntry(img->cached) : img->texture;
     }
     return NULL;
 }
 
+iBool isImageDecoding_Media(const iMedia *d, iMediaId imageId) {
+    iAssert(imageId.type == image_MediaType);
+    const size_t index = index_MediaId(imageId);
+    if (index < size_PtrArray(&d->items[image_MediaType])) {
+        const iGmImage *img = constAt_PtrArray(&d->items[image_MediaType], index);
+        return img->decoding != NULL || !isEmpty_Block(&img->partialData) ||
+               isEvicted_GmImage_(img);
+    }
+    return iFalse;
+}
+
+iBool finishDecoding_Media(iMedia *d) {
+    iBool changed = iFalse;
+    iForEach(PtrArray, i, &d->items[image_MediaType]) {
+        changed |= finishDecoding_GmImage_(i.ptr);
+    }
+    return changed;
+}
+
+void retainImages_Media(iMedia *d, const iArray *nearImageIds) {
+    iForEach(PtrArray, i, &d->items[image_MediaType]) {
+        iGmImage *img = i.ptr;
+        if (isEmpty_Block(&img->source) || img->isFailed) {
+            continue; /* still loading, or nothing to show */
+        }
+        const uint16_t id = index_PtrArrayIterator(&i) + 1;
+        iBool isNear = iFalse;
+        iConstForEach(Array, n, nearImageIds) {
+            if (*(const uint16_t *) n.value == id) {
+                isNear = iTrue;
+                break;
+            }
+        }
+        if (isNear && isEvicted_GmImage_(img)) {
+            load_GmImage_(img);
+        }
+        else if (!isNear && !isEvicted_GmImage_(img)) {
+            evict_GmImage_(img);
+        }
+    }
+}
+
 iBool info_Media(const iMedia *d, iMediaId mediaId, iGmMediaInfo *info_out) {
     /* TODO: Use a hash. */
     const size_t index = index_MediaId(mediaId);
@@ -582,6 +645,34 @@ void pauseAllPlayers_Media(const iMedia *d, iBool setPaused) {
     }
 }
 
+iFile *openDownload_Media(iMedia *d, iGmLinkId linkId, const iString *mime) {
+    const iMediaId existing = findMediaForLink_Media(d, linkId, download_MediaType);
+    if (!existing.id) {
+        return NULL;
+    }
+    iGmDownload *dl = at_PtrArray(&d->items[download_MediaType], index_MediaId(existing));
+    if (isEmpty_String(&dl->props.mime)) {
+        set_String(&dl->props.mime, mime);
+    }
+    if (!dl->file && !dl->path) {
+        if (!openFile_GmDownload_(dl)) {
+            iReleasePtr(&dl->file);
+        }
+    }
+    return dl->file;
+}
+
+void updateDownload_Media(iMedia *d, iGmLinkId linkId, uint64_t numBytes, iBool isFinished) {
+    const iMediaId existing = findMediaForLink_Media(d, linkId, download_MediaType);
+    if (existing.id) {
+        iGmDownload *dl = at_PtrArray(&d->items[download_MediaType], index_MediaId(existing));
+        updateRate_GmDownload_(dl, numBytes);
+        if (isFinished && dl->file) {
+            closeFile_GmDownload_(dl);
+        }
+    }
+}
+
 void downloadStats_Media(const iMedia *d, iMediaId downloadId, const iString **path_out,
                          float *bytesPerSecond_out, iBool *isFinished_out) {
     iAssert(downloadId.type == download_MediaType);
@@ -615,20 +706,33 @@ void init_MediaRequest(iMediaRequest *d, iDocumentWidget *doc, unsigned int link
                        const iString *url, iBool enableFilters) {
     d->doc    = doc;
     d->linkId = linkId;
-    d->req    = new_GmRequest(certs_App());
-    setUrl_GmRequest(d->req, url);
-    enableFilters_GmRequest(d->req, enableFilters);
-    iConnect(GmRequest, d->req, updated, d, updated_MediaRequest_);
-    iConnect(GmRequest, d->req, finished, d, finished_MediaRequest_);
-    submit_GmRequest(d->req);
+    d->isStreaming = iFalse;
+    d->isSubmitted = iFalse;
+    /* Unfiltered media requests are downloads that write the body to a file as it arrives. */
+    d->req = subscribe_RequestBroker(url,
+                                     enableFilters ? filtered_RequestBrokerFlag
+                                                   : exclusive_RequestBrokerFlag,
+                                     d,
+                                     updated_MediaRequest_,
+                                     finished_MediaRequest_);
 }
 
 void deinit_MediaRequest(iMediaRequest *d) {
-    iDisconnect(GmRequest, d->req, updated, d, updated_MediaRequest_);
-    iDisconnect(GmRequest, d->req, finished, d, finished_MediaRequest_);
+    unsubscribe_RequestBroker(d->req, d);
     iRelease(d->req);
 }
 
+void submit_MediaRequest(iMediaRequest *d) {
+    if (!d->isSubmitted) {
+        d->isSubmitted = iTrue;
+        submit_RequestBroker(d->req);
+    }
+}
+
+iBool isActive_MediaRequest(const iMediaRequest *d) {
+    return d->isSubmitted && !isFinished_GmRequest(d->req);
+}
+
 iDefineObjectConstructionArgs(MediaRequest,
                               (iDocumentWidget *doc, unsigned int linkId, const iString *url,
                                iBool enableFilters),
@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "fontpack.h"
 
 #include <the_Foundation/block.h>
+#include <the_Foundation/file.h>
 #include <the_Foundation/string.h>
 #include <the_Foundation/vec2.h>
 #include <SDL_render.h>
@@ -70,6 +71,10 @@ iLocalDef size_t index_MediaId(const iMediaId mediaId) {
 void            clear_Media             (iMedia *);
 iBool           setUrl_Media            (iMedia *, uint16_t linkId, enum iMediaType mediaType, const iString *url);
 iBool           setData_Media           (iMedia *, uint16_t linkId, const iString *mime, const iBlock *data, int flags);
+void            streamData_Media        (iMedia *, uint16_t linkId, size_t offset, const iBlock *data,
+                                         iBool isComplete);
+iFile *         openDownload_Media      (iMedia *, uint16_t linkId, const iString *mime);
+void            updateDownload_Media    (iMedia *, uint16_t linkId, uint64_t numBytes, iBool isFinished);
 
 size_t          memorySize_Media        (const iMedia *);
 iMediaId        findMediaForLink_Media  (const iMedia *, uint16_t linkId, enum iMediaType mediaType);
@@ -99,7 +104,11 @@ iLocalDef iBool downloadInfo_Media(const iMedia *d, uint16_t mediaId, iGmMediaIn
 
 iInt2           imageSize_Media         (const iMedia *, iMediaId imageId);
 SDL_Texture *   imageTexture_Media      (const iMedia *, iMediaId imageId);
+iBool           isImageDecoding_Media   (const iMedia *, iMediaId imageId); /* or still loading */
+iBool           finishDecoding_Media    (iMedia *); /* returns True if textures were created */
+void            retainImages_Media      (iMedia *, const iArray *nearImageIds); /* uint16_t ids */
 
+size_t          numImages_Media         (const iMedia *);
 size_t          numAudio_Media          (const iMedia *);
 iPlayer *       audioPlayer_Media       (const iMedia *, iMediaId audioId);
 void            pauseAllPlayers_Media   (const iMedia *, iBool setPaused);
@@ -119,7 +128,12 @@ struct Impl_MediaRequest {
     iDocumentWidget *doc;
     unsigned int     linkId;    
     iGmRequest *     req;
+    iBool            isStreaming; /* body is taken from `req` as it arrives */
+    iBool            isSubmitted; /* waits for a free slot in the document's scheduler */
 };
 
 iDeclareObjectConstructionArgs(MediaRequest, iDocumentWidget *doc, unsigned int linkId,
                                const iString *url, iBool enableFilters)
+
+void    submit_MediaRequest     (iMediaRequest *);
+iBool   isActive_MediaRequest   (const iMediaRequest *);
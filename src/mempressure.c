@@ -0,0 +1,279 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "mempressure.h"
+#include "app.h"
+
+#if defined (iPlatformLinux)
+#   include "profiler.h"
+#   include <the_Foundation/thread.h>
+#   include <errno.h>
+#   include <fcntl.h>
+#   include <poll.h>
+#   include <stdio.h>
+#   include <string.h>
+#   include <unistd.h>
+#endif
+
+#if defined (iPlatformAppleDesktop)
+#   include <dispatch/dispatch.h>
+#endif
+
+static void post_MemoryPressure_(enum iMemoryPressure level) {
+    postCommandf_App("memory.pressure level:%d", level);
+}
+
+#if defined (iPlatformLinux)
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(MemoryWatcher)
+
+enum iMemoryWatchSource {
+    somePsi_MemoryWatchSource,
+    fullPsi_MemoryWatchSource,
+    cgroupEvents_MemoryWatchSource,
+    quit_MemoryWatchSource,
+    max_MemoryWatchSource
+};
+
+struct Impl_MemoryWatcher {
+    iThread *thread;
+    int      fds[max_MemoryWatchSource]; /* -1 if not available */
+    int      quitPipe[2];
+    unsigned long numHigh; /* counters in `memory.events` */
+    unsigned long numMax;
+};
+
+static iMemoryWatcher watcher_;
+
+/* Stalls of 150 ms (some) or 100 ms (full) within a two second window. Unprivileged
+   processes may only use windows that are multiples of two seconds. */
+static const char *somePsiTrigger_MemoryWatcher_ = "some 150000 2000000";
+static const char *fullPsiTrigger_MemoryWatcher_ = "full 100000 2000000";
+
+static int openPsiTrigger_MemoryWatcher_(const char *trigger) {
+    const int fd = open("/proc/pressure/memory", O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return -1; /* kernel without PSI */
+    }
+    if (write(fd, trigger, strlen(trigger) + 1) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int openCgroupEvents_MemoryWatcher_(void) {
+    /* Only the unified (v2) hierarchy has a single "0::" entry. */
+    char  line[512];
+    char  path[600];
+    int   fd = -1;
+    FILE *f  = fopen("/proc/self/cgroup", "r");
+    if (!f) {
+        return -1;
+    }
+    while (fgets(line, sizeof(line), f)) {
+        if (strncmp(line, "0::", 3) == 0) {
+            line[strcspn(line, "\n")] = 0;
+            snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.events", line + 3);
+            fd = open(path, O_RDONLY | O_CLOEXEC);
+            break;
+        }
+    }
+    fclose(f);
+    return fd;
+}
+
+static enum iMemoryPressure readCgroupEvents_MemoryWatcher_(iMemoryWatcher *d) {
+    /* Reaching `memory.high` means the kernel is already reclaiming our memory; reaching
+       `memory.max` means allocations are failing or the OOM killer is near. */
+    char    buf[512];
+    ssize_t len = pread(d->fds[cgroupEvents_MemoryWatchSource], buf, sizeof(buf) - 1, 0);
+    if (len <= 0) {
+        return none_MemoryPressure;
+    }
+    buf[len] = 0;
+    unsigned long numHigh = d->numHigh, numMax = d->numMax;
+    for (const char *pos = buf; *pos; ) {
+        sscanf(pos, "high %lu", &numHigh);
+        sscanf(pos, "max %lu", &numMax);
+        const char *lineEnd = strchr(pos, '\n');
+        if (!lineEnd) {
+            break;
+        }
+        pos = lineEnd + 1;
+    }
+    enum iMemoryPressure level = none_MemoryPressure;
+    if (numMax > d->numMax) {
+        level = critical_MemoryPressure;
+    }
+    else if (numHigh > d->numHigh) {
+        level = moderate_MemoryPressure;
+    }
+    d->numHigh = numHigh;
+    d->numMax  = numMax;
+    return level;
+}
+
+static iThreadResult run_MemoryWatcher_(iThread *thread) {
+    iMemoryWatcher *d = userData_Thread(thread);
+    struct pollfd   pfds[max_MemoryWatchSource];
+    setThreadName_Profiler("memory watcher");
+    for (;;) {
+        int num = 0;
+        iForIndices(i, d->fds) {
+            if (d->fds[i] >= 0) {
+                /* PSI triggers and cgroup files signal changes as priority events. */
+                pfds[num++] = (struct pollfd){ d->fds[i],
+                                               i == quit_MemoryWatchSource ? POLLIN : POLLPRI,
+                                               0 };
+            }
+        }
+        if (poll(pfds, num, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+        enum iMemoryPressure level = none_MemoryPressure;
+        for (int i = 0; i < num; i++) {
+            const int fd = pfds[i].fd;
+            if (!pfds[i].revents) {
+                continue;
+            }
+            if (fd == d->fds[quit_MemoryWatchSource]) {
+                return 0;
+            }
+            if (pfds[i].revents & (POLLERR | POLLNVAL) &&
+                fd != d->fds[cgroupEvents_MemoryWatchSource]) {
+                /* The trigger is no longer usable. (Changes in cgroup files are also
+                   reported as errors.) */
+                iForIndices(j, d->fds) {
+                    if (d->fds[j] == fd) {
+                        close(fd);
+                        d->fds[j] = -1;
+                    }
+                }
+                continue;
+            }
+            if (fd == d->fds[somePsi_MemoryWatchSource]) {
+                level = iMax(level, moderate_MemoryPressure);
+            }
+            else if (fd == d->fds[fullPsi_MemoryWatchSource]) {
+                level = critical_MemoryPressure;
+            }
+            else if (fd == d->fds[cgroupEvents_MemoryWatchSource]) {
+                level = iMax(level, readCgroupEvents_MemoryWatcher_(d));
+            }
+        }
+        if (level != none_MemoryPressure) {
+            post_MemoryPressure_(level);
+        }
+    }
+    return 0;
+}
+
+static void init_MemoryWatcher_(iMemoryWatcher *d) {
+    iZap(*d);
+    d->fds[somePsi_MemoryWatchSource] = openPsiTrigger_MemoryWatcher_(somePsiTrigger_MemoryWatcher_);
+    d->fds[fullPsi_MemoryWatchSource] = openPsiTrigger_MemoryWatcher_(fullPsiTrigger_MemoryWatcher_);
+    d->fds[cgroupEvents_MemoryWatchSource] = openCgroupEvents_MemoryWatcher_();
+    d->fds[quit_MemoryWatchSource] = -1;
+    if (d->fds[cgroupEvents_MemoryWatchSource] >= 0) {
+        readCgroupEvents_MemoryWatcher_(d); /* earlier events don't count */
+    }
+    if (d->fds[somePsi_MemoryWatchSource] < 0 && d->fds[fullPsi_MemoryWatchSource] < 0 &&
+        d->fds[cgroupEvents_MemoryWatchSource] < 0) {
+        return; /* nothing to watch */
+    }
+    if (pipe(d->quitPipe) == 0) {
+        d->fds[quit_MemoryWatchSource] = d->quitPipe[0];
+        d->thread = new_Thread(run_MemoryWatcher_);
+        setUserData_Thread(d->thread, d);
+        start_Thread(d->thread);
+    }
+}
+
+static void deinit_MemoryWatcher_(iMemoryWatcher *d) {
+    if (d->thread) {
+        const char quit = 0;
+        if (write(d->quitPipe[1], &quit, 1) == 1) {
+            join_Thread(d->thread);
+        }
+        iReleasePtr(&d->thread);
+        close(d->quitPipe[1]);
+    }
+    iForIndices(i, d->fds) {
+        if (d->fds[i] >= 0) {
+            close(d->fds[i]);
+            d->fds[i] = -1;
+        }
+    }
+}
+#endif /* Linux */
+
+#if defined (iPlatformAppleDesktop)
+/*----------------------------------------------------------------------------------------------*/
+
+static dispatch_source_t pressureSource_;
+
+static void handlePressure_MacOS_(void *context) {
+    iUnused(context);
+    const unsigned long flags = dispatch_source_get_data(pressureSource_);
+    if (flags & DISPATCH_MEMORYPRESSURE_CRITICAL) {
+        post_MemoryPressure_(critical_MemoryPressure);
+    }
+    else if (flags & DISPATCH_MEMORYPRESSURE_WARN) {
+        post_MemoryPressure_(moderate_MemoryPressure);
+    }
+}
+#endif /* macOS */
+
+void init_MemoryPressure(void) {
+#if defined (iPlatformLinux)
+    init_MemoryWatcher_(&watcher_);
+#endif
+#if defined (iPlatformAppleDesktop)
+    pressureSource_ = dispatch_source_create(
+        DISPATCH_SOURCE_TYPE_MEMORYPRESSURE,
+        0,
+        DISPATCH_MEMORYPRESSURE_WARN | DISPATCH_MEMORYPRESSURE_CRITICAL,
+        dispatch_get_global_queue(DISPATCH_QUEUE_PRIORITY_DEFAULT, 0));
+    if (pressureSource_) {
+        dispatch_source_set_event_handler_f(pressureSource_, handlePressure_MacOS_);
+        dispatch_resume(pressureSource_);
+    }
+#endif
+}
+
+void deinit_MemoryPressure(void) {
+#if defined (iPlatformLinux)
+    deinit_MemoryWatcher_(&watcher_);
+#endif
+#if defined (iPlatformAppleDesktop)
+    if (pressureSource_) {
+        dispatch_source_cancel(pressureSource_);
+        dispatch_release(pressureSource_);
+        pressureSource_ = NULL;
+    }
+#endif
+}
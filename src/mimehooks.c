@@ -22,16 +22,59 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "mimehooks.h"
 #include "defs.h"
+#include "feedxml.h"
 #include "gmutil.h"
 #include "gempub.h"
 #include "app.h"
+#include "profiler.h"
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/process.h>
 #include <the_Foundation/stringlist.h>
-#include <the_Foundation/xml.h>
+#include <the_Foundation/thread.h>
+
+/* Persistent filters are started once and then kept running. Each response is sent as a
+   frame: the MIME type, the request URL, and the body size on separate lines, followed by
+   the body. The filter replies with the output size on a line followed by the output, which
+   is a complete "20" response. A size of zero means the filter declined. */
+
+static const char *persistentKeyword_FilterHook_ = "persistent";
+static const char *streamingKeyword_FilterHook_  = "streaming";
+
+enum iFilterPoolLimits {
+    maxProcesses_FilterPool = 4,
+    replyTimeoutMs_FilterPool = 30000,
+};
+
+struct Impl_FilterPool {
+    iMutex     mtx;
+    iCondition available;
+    iPtrArray  idle; /* iProcess, waiting for the next frame */
+    int        numProcesses;
+};
+
+static iFilterPool *new_FilterPool_(void) {
+    iFilterPool *d = iMalloc(FilterPool);
+    init_Mutex(&d->mtx);
+    init_Condition(&d->available);
+    init_PtrArray(&d->idle);
+    d->numProcesses = 0;
+    return d;
+}
+
+static void delete_FilterPool_(iFilterPool *d) {
+    iForEach(PtrArray, i, &d->idle) {
+        kill_Process(i.ptr);
+        iRelease(i.ptr);
+    }
+    deinit_PtrArray(&d->idle);
+    deinit_Condition(&d->available);
+    deinit_Mutex(&d->mtx);
+    free(d);
+}
 
 iDefineTypeConstruction(FilterHook)
 
@@ -39,10 +82,15 @@ void init_FilterHook(iFilterHook *d) {
     init_String(&d->label);
     init_String(&d->mimePattern);
     init_String(&d->command);
-    d->mimeRegex = NULL;
+    d->mimeRegex   = NULL;
+    d->pool        = NULL;
+    d->isStreaming = iFalse;
 }
 
 void deinit_FilterHook(iFilterHook *d) {
+    if (d->pool) {
+        delete_FilterPool_(d->pool);
+    }
     iRelease(d->mimeRegex);
     deinit_String(&d->command);
     deinit_String(&d->mimePattern);
@@ -56,11 +104,144 @@ void setMimePattern_FilterHook(iFilterHook *d, const iString *pattern) {
 }
 
 void setCommand_FilterHook(iFilterHook *d, const iString *command) {
-    set_String(&d->command, command);
+    iRangecc cmd = range_String(command);
+    iRangecc seg = iNullRange;
+    if (nextSplit_Rangecc(cmd, ";", &seg)) {
+        /* The rest of the line after a mode keyword is the actual command. */
+        if (equal_Rangecc(seg, persistentKeyword_FilterHook_)) {
+            cmd.start = iMin(seg.end + 1, cmd.end);
+            if (!d->pool) {
+                d->pool = new_FilterPool_();
+            }
+        }
+        else if (equal_Rangecc(seg, streamingKeyword_FilterHook_)) {
+            cmd.start = iMin(seg.end + 1, cmd.end);
+            d->isStreaming = iTrue;
+        }
+    }
+    setRange_String(&d->command, cmd);
 }
 
-iBlock *run_FilterHook_(const iFilterHook *d, const iString *mime, const iBlock *body,
-                        const iString *requestUrl) {
+static iProcess *startPersistent_FilterHook_(const iFilterHook *d) {
+    iProcess *   proc = new_Process();
+    iStringList *args = new_StringList();
+    iRangecc     seg  = iNullRange;
+    while (nextSplit_Rangecc(range_String(&d->command), ";", &seg)) {
+        pushBackRange_StringList(args, seg);
+    }
+    setArguments_Process(proc, args);
+    iRelease(args);
+    if (!start_Process(proc)) {
+        iRelease(proc);
+        return NULL;
+    }
+    return proc;
+}
+
+static iProcess *acquireProcess_FilterHook_(const iFilterHook *d) {
+    iFilterPool *pool = d->pool;
+    iProcess *   proc = NULL;
+    lock_Mutex(&pool->mtx);
+    while (isEmpty_PtrArray(&pool->idle) && pool->numProcesses == maxProcesses_FilterPool) {
+        wait_Condition(&pool->available, &pool->mtx);
+    }
+    if (!isEmpty_PtrArray(&pool->idle)) {
+        take_PtrArray(&pool->idle, size_PtrArray(&pool->idle) - 1, (void **) &proc);
+    }
+    else {
+        pool->numProcesses++;
+    }
+    unlock_Mutex(&pool->mtx);
+    if (!proc) {
+        /* Start a new one outside the lock so other requests can proceed meanwhile. */
+        proc = startPersistent_FilterHook_(d);
+        if (!proc) {
+            iGuardMutex(&pool->mtx, pool->numProcesses--);
+            signal_Condition(&pool->available);
+        }
+    }
+    return proc;
+}
+
+static void releaseProcess_FilterHook_(const iFilterHook *d, iProcess *proc, iBool isUsable) {
+    iFilterPool *pool = d->pool;
+    if (!isUsable) {
+        /* Out of sync or dead; a new process is started when needed. */
+        kill_Process(proc);
+        iRelease(proc);
+    }
+    lock_Mutex(&pool->mtx);
+    if (isUsable) {
+        pushBack_PtrArray(&pool->idle, proc);
+    }
+    else {
+        pool->numProcesses--;
+    }
+    signal_Condition(&pool->available);
+    unlock_Mutex(&pool->mtx);
+}
+
+static iBlock *readReply_FilterHook_(iProcess *proc) {
+    /* Returns NULL if the process died or does not answer in time. */
+    iBlock * buf       = new_Block(0);
+    size_t   frameSize = iInvalidSize;
+    size_t   headerEnd = 0;
+    uint32_t waited    = 0;
+    for (;;) {
+        if (frameSize == iInvalidSize) {
+            const char *nl = memchr(constData_Block(buf), '\n', size_Block(buf));
+            if (nl) {
+                headerEnd = nl - constData_Block(buf) + 1;
+                frameSize = strtoul(constData_Block(buf), NULL, 10);
+            }
+        }
+        if (frameSize != iInvalidSize && size_Block(buf) >= headerEnd + frameSize) {
+            remove_Block(buf, 0, headerEnd);
+            truncate_Block(buf, frameSize);
+            return buf;
+        }
+        iBlock *out = readOutput_Process(proc);
+        if (isEmpty_Block(out)) {
+            if (!isRunning_Process(proc) || waited >= replyTimeoutMs_FilterPool) {
+                delete_Block(out);
+                break;
+            }
+            sleep_Thread(0.005);
+            waited += 5;
+        }
+        append_Block(buf, out);
+        delete_Block(out);
+    }
+    delete_Block(buf);
+    return NULL;
+}
+
+static iBlock *runPersistent_FilterHook_(const iFilterHook *d, const iString *mime,
+                                         const iBlock *body, const iString *requestUrl) {
+    iProcess *proc = acquireProcess_FilterHook_(d);
+    if (!proc) {
+        return NULL;
+    }
+    iBlock *frame = new_Block(0);
+    printf_Block(frame, "%s\n%s\n%zu\n", cstr_String(mime), cstr_String(requestUrl),
+                 size_Block(body));
+    append_Block(frame, body);
+    iBlock *output = NULL;
+    if (writeInput_Process(proc, frame) == size_Block(frame)) {
+        output = readReply_FilterHook_(proc);
+    }
+    delete_Block(frame);
+    releaseProcess_FilterHook_(d, proc, output != NULL);
+    if (output && !startsWith_Rangecc(range_Block(output), "20")) {
+        /* Declined, or didn't produce valid output. */
+        delete_Block(output);
+        output = NULL;
+    }
+    return output;
+}
+
+static iProcess *newProcess_FilterHook_(const iFilterHook *d, const iString *mime,
+                                        const iString *requestUrl) {
     iProcess *   proc = new_Process();
     iStringList *args = new_StringList();
     iRangecc     seg  = iNullRange;
@@ -79,7 +260,16 @@ iBlock *run_FilterHook_(const iFilterHook *d, const iString *mime, const iBlock
             iClob(newStrings_StringList(
                 collectNewFormat_String("REQUEST_URL=%s", cstr_String(requestUrl)), NULL)));
     }
-    iBlock *output = NULL;
+    return proc;
+}
+
+iBlock *run_FilterHook_(const iFilterHook *d, const iString *mime, const iBlock *body,
+                        const iString *requestUrl) {
+    if (d->pool) {
+        return runPersistent_FilterHook_(d, mime, body, requestUrl);
+    }
+    iProcess *proc   = newProcess_FilterHook_(d, mime, requestUrl);
+    iBlock *  output = NULL;
     if (start_Process(proc)) {
         writeInput_Process(proc, body);
         output = readOutputUntilClosed_Process(proc);
@@ -95,110 +285,95 @@ iBlock *run_FilterHook_(const iFilterHook *d, const iString *mime, const iBlock
 
 /*----------------------------------------------------------------------------------------------*/
 
-static iRegExp *xmlMimePattern_(void) {
-    static iRegExp *xmlMime_;
-    if (!xmlMime_) {
-        xmlMime_ = new_RegExp("(application|text)/(atom\\+)?xml", caseInsensitive_RegExpOption);
+/* A streaming hook gets the body in pieces as they arrive, and its output is read while
+   it is still running. The hook cannot decline: whatever it prints is the response. */
+
+struct Impl_FilterStream {
+    iProcess *proc;
+};
+
+static iFilterStream *new_FilterStream_(iProcess *proc) {
+    iFilterStream *d = iMalloc(FilterStream);
+    d->proc = proc;
+    return d;
+}
+
+void delete_FilterStream(iFilterStream *d) {
+    if (d) {
+        if (isRunning_Process(d->proc)) {
+            kill_Process(d->proc);
+        }
+        iRelease(d->proc);
+        free(d);
     }
-    return xmlMime_;
 }
 
-static iBlock *translateAtomXmlToGeminiFeed_(const iString *mime, const iBlock *source,
+static const size_t inputChunkSize_FilterStream_ = 4096; /* fits in any pipe buffer */
+
+iBlock *write_FilterStream(iFilterStream *d, const iBlock *data) {
+    /* Writing blocks when the hook's input pipe is full, and the hook blocks when its output
+       pipe is full. The input is therefore written in small pieces, and the output printed
+       so far is collected after each one. */
+    iBlock *output = readOutput_Process(d->proc);
+    for (size_t pos = 0; pos < size_Block(data); pos += inputChunkSize_FilterStream_) {
+        iBlock piece;
+        initData_Block(&piece,
+                       constBegin_Block(data) + pos,
+                       iMin(inputChunkSize_FilterStream_, size_Block(data) - pos));
+        writeInput_Process(d->proc, &piece);
+        deinit_Block(&piece);
+        iBlock *more = readOutput_Process(d->proc);
+        append_Block(output, more);
+        delete_Block(more);
+    }
+    return output;
+}
+
+iBlock *finish_FilterStream(iFilterStream *d) {
+    /* Closes the input so the hook sees the end of the body, and waits for it to exit. */
+    return readOutputUntilClosed_Process(d->proc);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+static void appendFeedLink_(void *context, const iFeedXmlEntry *entry) {
+    appendFormat_String(context, "=> %s %04d-%02d-%02d - %s\n",
+                        cstr_String(&entry->url),
+                        entry->date.year,
+                        entry->date.month,
+                        entry->date.day,
+                        cstr_String(&entry->title));
+}
+
+static iBlock *translateFeedXmlToGeminiFeed_(const iString *mime, const iBlock *source,
                                              const iString *requestUrl) {
     iUnused(requestUrl); /* TODO: Use for what? */
-    iRegExpMatch m;
-    init_RegExpMatch(&m);
-    if (!matchString_RegExp(xmlMimePattern_(), mime, &m)) {
+    if (!isMimeType_FeedXml(mime)) {
         return NULL;
     }
-    iBlock *      output = NULL;
-    iXmlDocument *doc    = new_XmlDocument();
-    iString       src;
-    initBlock_String(&src, source); /* assume it's UTF-8 */
-    if (!parse_XmlDocument(doc, &src)) {
-        goto finished;
-    }
-    const iXmlElement *feed = &doc->root;
-    if (!equal_Rangecc(feed->name, "feed")) {
-        goto finished;
-    }
-    if (!equal_Rangecc(attribute_XmlElement(feed, "xmlns"), "http://www.w3.org/2005/Atom")) {
-        goto finished;
-    }
-    iString *title = collect_String(decodedContent_XmlElement(child_XmlElement(feed, "title")));
-    if (isEmpty_String(title)) {
-        goto finished;
-    }
-    iString *subtitle = collect_String(decodedContent_XmlElement(child_XmlElement(feed, "subtitle")));
-    iString out;
-    init_String(&out);
-    format_String(&out,
-                  "20 text/gemini\r\n"
-                  "# %s\n\n",
-                  cstr_String(title));
-    if (!isEmpty_String(subtitle)) {
-        appendFormat_String(&out, "## %s\n\n", cstr_String(subtitle));
-    }
-    appendCStr_String(&out, cstr_Lang("feeds.atom.translated"));
-    appendCStr_String(&out, "\n\n");
-    iRegExp *datePattern =
-        iClob(new_RegExp("^([0-9][0-9][0-9][0-9]-[0-1][0-9]-[0-3][0-9])(T|\\s).*", caseSensitive_RegExpOption));
-    iBeginCollect();
-    iConstForEach(PtrArray, i, &feed->children) {
-        iEndCollect();
-        iBeginCollect();
-        const iXmlElement *entry = i.ptr;
-        if (!equal_Rangecc(entry->name, "entry")) {
-            continue;
+    iBlock *  output = NULL;
+    iString   links;
+    init_String(&links);
+    iFeedXml *xml = new_FeedXml(appendFeedLink_, &links);
+    write_FeedXml(xml, range_Block(source)); /* assume it's UTF-8 */
+    if (finish_FeedXml(xml) && !isEmpty_String(title_FeedXml(xml))) {
+        iString out;
+        init_String(&out);
+        format_String(&out,
+                      "20 text/gemini\r\n"
+                      "# %s\n\n",
+                      cstr_String(title_FeedXml(xml)));
+        if (!isEmpty_String(subtitle_FeedXml(xml))) {
+            appendFormat_String(&out, "## %s\n\n", cstr_String(subtitle_FeedXml(xml)));
         }
-        title = collect_String(decodedContent_XmlElement(child_XmlElement(entry, "title")));
-        if (isEmpty_String(title)) {
-            continue;
-        }
-        const iString *published =
-            collect_String(decodedContent_XmlElement(child_XmlElement(entry, "published")));
-        const iString *updated =
-            collect_String(decodedContent_XmlElement(child_XmlElement(entry, "updated")));
-        iRegExpMatch m;
-        init_RegExpMatch(&m);
-        if (!matchString_RegExp(datePattern, updated, &m)) {
-            init_RegExpMatch(&m);
-            if (!matchString_RegExp(datePattern, published, &m)) {
-                continue;
-            }
-        }
-        iRangecc url = iNullRange;
-        iConstForEach(PtrArray, j, &entry->children) {
-            const iXmlElement *link = j.ptr;
-            if (!equal_Rangecc(link->name, "link")) {
-                continue;
-            }
-            const iRangecc href = attribute_XmlElement(link, "href");
-            const iRangecc rel  = attribute_XmlElement(link, "rel");
-            const iRangecc type = attribute_XmlElement(link, "type");
-            if (startsWithCase_Rangecc(href, "gemini:")) {
-                url = href;
-                /* We're happy with the first gemini URL. */
-                /* TODO: Are we? */
-                break;
-            }
-            url = href;
-            iUnused(rel, type);
-        }
-        if (isEmpty_Range(&url)) {
-            continue;
-        }
-        appendFormat_String(&out, "=> %s %s - %s\n",
-                            cstr_Rangecc(url),
-                            cstr_Rangecc(capturedRange_RegExpMatch(&m, 1)),
-                            cstr_String(title));
-    }
-    iEndCollect();
-    output = copy_Block(utf8_String(&out));
-    deinit_String(&out);
-finished:
-    delete_XmlDocument(doc);
-    deinit_String(&src);
+        appendCStr_String(&out, cstr_Lang("feeds.atom.translated"));
+        appendCStr_String(&out, "\n\n");
+        append_String(&out, &links);
+        output = copy_Block(utf8_String(&out));
+        deinit_String(&out);
+    }
+    delete_FeedXml(xml);
+    deinit_String(&links);
     return output;
 }
 
@@ -243,7 +418,7 @@ static iBool checkGemPub_(const iString *mime, const iString *requestUrl) {
             startsWithCase_String(mime, mimeType_Gempub));
 }
 
-iBool willTryFilter_MimeHooks(const iMimeHooks *d, const iString *mime) {
+iBool willTryFilter_MimeHooks(const iMimeHooks *d, const iString *mime, iBool withBuiltIn) {
     /* TODO: Combine this function with tryFilter_MimeHooks! */
     iRegExpMatch m;
     iConstForEach(PtrArray, i, &d->filters) {
@@ -254,38 +429,53 @@ iBool willTryFilter_MimeHooks(const iMimeHooks *d, const iString *mime) {
         }
     }
     /* Built-in filters. */
-    init_RegExpMatch(&m);
-    if (matchString_RegExp(xmlMimePattern_(), mime, &m)) {
-        return iTrue;
-    }
-    return iFalse;
+    return withBuiltIn && isMimeType_FeedXml(mime);
 }
 
 iBlock *tryFilter_MimeHooks(const iMimeHooks *d, const iString *mime, const iBlock *body,
-                            const iString *requestUrl) {
+                            const iString *requestUrl, iBool withBuiltIn) {
     iRegExpMatch m;
     iConstForEach(PtrArray, i, &d->filters) {
         const iFilterHook *xc = i.ptr;
         init_RegExpMatch(&m);
         if (matchString_RegExp(xc->mimeRegex, mime, &m)) {
+            start_ProfilerScope(filter);
             iBlock *result = run_FilterHook_(xc, mime, body, requestUrl);
+            stop_ProfilerScope(filter);
             if (result) {
                 return result;
             }
         }
     }
     /* Built-in filters. */
+    if (!withBuiltIn) {
+        return NULL;
+    }
     if (checkGemPub_(mime, requestUrl)) {
         iBlock *result = translateGemPubCoverPage_(body, requestUrl);
         if (result) {
             return result;
         }
     }
-    init_RegExpMatch(&m);
-    if (matchString_RegExp(xmlMimePattern_(), mime, &m)) {
-        iBlock *result = translateAtomXmlToGeminiFeed_(mime, body, requestUrl);
-        if (result) {
-            return result;
+    return translateFeedXmlToGeminiFeed_(mime, body, requestUrl);
+}
+
+iFilterStream *startStream_MimeHooks(const iMimeHooks *d, const iString *mime,
+                                     const iString *requestUrl) {
+    iRegExpMatch m;
+    iConstForEach(PtrArray, i, &d->filters) {
+        const iFilterHook *xc = i.ptr;
+        init_RegExpMatch(&m);
+        if (matchString_RegExp(xc->mimeRegex, mime, &m)) {
+            if (!xc->isStreaming) {
+                /* This hook comes first, and it wants the entire body. */
+                return NULL;
+            }
+            iProcess *proc = newProcess_FilterHook_(xc, mime, requestUrl);
+            if (start_Process(proc)) {
+                return new_FilterStream_(proc);
+            }
+            iRelease(proc);
         }
     }
     return NULL;
@@ -342,7 +532,10 @@ const iString *debugInfo_MimeHooks(const iMimeHooks *d) {
     size_t index = 0;
     iConstForEach(PtrArray, i, &d->filters) {
         const iFilterHook *filter = i.ptr;
-        appendFormat_String(str, "### %d: %s\n", index, cstr_String(&filter->label));
+        appendFormat_String(str, "### %d: %s%s\n", index, cstr_String(&filter->label),
+                            filter->pool          ? " (persistent)"
+                            : filter->isStreaming ? " (streaming)"
+                                                  : "");
         appendFormat_String(str, "MIME regex:\n```\n%s\n```\n", cstr_String(&filter->mimePattern));
         iStringList *args = iClob(split_String(&filter->command, ";"));
         if (isEmpty_StringList(args)) {
@@ -28,26 +28,37 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/string.h>
 
 iDeclareType(FilterHook)
+iDeclareType(FilterPool)
+iDeclareType(FilterStream)
 iDeclareTypeConstruction(FilterHook)
 
 struct Impl_FilterHook {
-    iString  label;
-    iString  mimePattern;
-    iRegExp *mimeRegex;
-    iString  command;
+    iString      label;
+    iString      mimePattern;
+    iRegExp *    mimeRegex;
+    iString      command;
+    iFilterPool *pool; /* resident processes; NULL if a process is started for each response */
+    iBool        isStreaming; /* body is piped in as it arrives */
 };
 
 void    setMimePattern_FilterHook   (iFilterHook *, const iString *pattern);
 void    setCommand_FilterHook       (iFilterHook *, const iString *command);
 
+void    delete_FilterStream         (iFilterStream *);
+iBlock *write_FilterStream          (iFilterStream *, const iBlock *data); /* returns new output */
+iBlock *finish_FilterStream         (iFilterStream *); /* returns rest of the output; blocks until the hook exits */
+
 /*----------------------------------------------------------------------------------------------*/
 
 iDeclareType(MimeHooks)
 iDeclareTypeConstruction(MimeHooks)
 
-iBool       willTryFilter_MimeHooks (const iMimeHooks *, const iString *mime);
+iBool       willTryFilter_MimeHooks (const iMimeHooks *, const iString *mime, iBool withBuiltIn);
 iBlock *    tryFilter_MimeHooks     (const iMimeHooks *, const iString *mime,
-                                     const iBlock *body, const iString *requestUrl);
+                                     const iBlock *body, const iString *requestUrl,
+                                     iBool withBuiltIn);
+iFilterStream *startStream_MimeHooks(const iMimeHooks *, const iString *mime,
+                                     const iString *requestUrl); /* NULL if not streaming */
 
 void        load_MimeHooks          (iMimeHooks *, const char *saveDir);
 void        save_MimeHooks          (const iMimeHooks *);
@@ -0,0 +1,595 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "mirror.h"
+#include "app.h"
+#include "archivecache.h"
+#include "gmcerts.h"
+#include "gmutil.h"
+#include "profiler.h"
+#include "resolver.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/fileinfo.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/stringset.h>
+#include <the_Foundation/thread.h>
+#include <the_Foundation/time.h>
+#include <SDL_timer.h>
+#include <stdio.h>
+
+static const size_t   maxPages_Mirror_       = 2000;
+static const size_t   maxConcurrent_Mirror_  = 2;   /* all requests go to the same host */
+static const uint32_t minInterval_Mirror_    = 250; /* ms between starting requests */
+static const uint32_t timeout_Mirror_        = 30 * 1000; /* ms */
+static const int      maxSlowDown_Mirror_    = 60;  /* seconds */
+static const size_t   maxBodySize_Mirror_    = 16 * 1024 * 1024;
+static const uint32_t maxArchiveSize_Mirror_ = 0xf0000000; /* no Zip64 */
+static const char *   mimeTypesEntry_Mirror_ = ".mimetypes"; /* entry name, tab, response meta */
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* Minimal writer for uncompressed zip archives. */
+
+iDeclareType(ZipEntry)
+iDeclareType(ZipWriter)
+
+struct Impl_ZipEntry {
+    iString  name;
+    uint32_t crc;
+    uint32_t size;
+    uint32_t offset;
+};
+
+struct Impl_ZipWriter {
+    iFile *    file;
+    iArray     entries; /* iZipEntry */
+    iStringSet *names;
+    uint16_t   dosTime;
+    uint16_t   dosDate;
+    uint32_t   pos;
+};
+
+static uint32_t crc32_(const void *data, size_t size) {
+    static uint32_t table_[256];
+    if (!table_[1]) {
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; k++) {
+                c = (c & 1 ? 0xedb88320 : 0) ^ (c >> 1);
+            }
+            table_[i] = c;
+        }
+    }
+    uint32_t crc = 0xffffffff;
+    const uint8_t *bytes = data;
+    for (size_t i = 0; i < size; i++) {
+        crc = table_[(crc ^ bytes[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffff;
+}
+
+static void appendU16_(iBlock *d, uint16_t value) {
+    const uint8_t le[2] = { value & 0xff, value >> 8 };
+    appendData_Block(d, le, 2);
+}
+
+static void appendU32_(iBlock *d, uint32_t value) {
+    const uint8_t le[4] = { value & 0xff, (value >> 8) & 0xff, (value >> 16) & 0xff, value >> 24 };
+    appendData_Block(d, le, 4);
+}
+
+static iBool open_ZipWriter_(iZipWriter *d, const iString *path) {
+    d->file = new_File(path);
+    if (!open_File(d->file, writeOnly_FileMode)) {
+        iReleasePtr(&d->file);
+        return iFalse;
+    }
+    init_Array(&d->entries, sizeof(iZipEntry));
+    d->names = new_StringSet();
+    d->pos   = 0;
+    iDate now;
+    initCurrent_Date(&now);
+    d->dosTime = (uint16_t) ((now.hour << 11) | (now.minute << 5) | (now.second / 2));
+    d->dosDate = (uint16_t) (((iMax(1980, now.year) - 1980) << 9) | (now.month << 5) | now.day);
+    return iTrue;
+}
+
+static iBool add_ZipWriter_(iZipWriter *d, const iString *name, const iBlock *data) {
+    if (contains_StringSet(d->names, name) || size_Array(&d->entries) >= 0xffff ||
+        d->pos + size_Block(data) + 1024 > maxArchiveSize_Mirror_) {
+        return iFalse;
+    }
+    iZipEntry entry;
+    initCopy_String(&entry.name, name);
+    entry.crc    = crc32_(constData_Block(data), size_Block(data));
+    entry.size   = (uint32_t) size_Block(data);
+    entry.offset = d->pos;
+    iBlock *header = new_Block(0);
+    appendU32_(header, 0x04034b50);
+    appendU16_(header, 20);     /* version needed */
+    appendU16_(header, 0x0800); /* UTF-8 names */
+    appendU16_(header, 0);      /* stored */
+    appendU16_(header, d->dosTime);
+    appendU16_(header, d->dosDate);
+    appendU32_(header, entry.crc);
+    appendU32_(header, entry.size);
+    appendU32_(header, entry.size);
+    appendU16_(header, (uint16_t) size_String(name));
+    appendU16_(header, 0);
+    append_Block(header, utf8_String(name));
+    write_File(d->file, header);
+    write_File(d->file, data);
+    d->pos += size_Block(header) + size_Block(data);
+    delete_Block(header);
+    insert_StringSet(d->names, name);
+    pushBack_Array(&d->entries, &entry);
+    return iTrue;
+}
+
+static void close_ZipWriter_(iZipWriter *d) {
+    iBlock *dir = new_Block(0);
+    iConstForEach(Array, i, &d->entries) {
+        const iZipEntry *entry = i.value;
+        appendU32_(dir, 0x02014b50);
+        appendU16_(dir, 20);     /* version made by */
+        appendU16_(dir, 20);     /* version needed */
+        appendU16_(dir, 0x0800); /* UTF-8 names */
+        appendU16_(dir, 0);      /* stored */
+        appendU16_(dir, d->dosTime);
+        appendU16_(dir, d->dosDate);
+        appendU32_(dir, entry->crc);
+        appendU32_(dir, entry->size);
+        appendU32_(dir, entry->size);
+        appendU16_(dir, (uint16_t) size_String(&entry->name));
+        appendU16_(dir, 0);      /* extra field */
+        appendU16_(dir, 0);      /* comment */
+        appendU16_(dir, 0);      /* disk number */
+        appendU16_(dir, 0);      /* internal attributes */
+        appendU32_(dir, 0);      /* external attributes */
+        appendU32_(dir, entry->offset);
+        append_Block(dir, utf8_String(&entry->name));
+    }
+    const size_t dirSize = size_Block(dir);
+    appendU32_(dir, 0x06054b50);
+    appendU16_(dir, 0);
+    appendU16_(dir, 0);
+    appendU16_(dir, (uint16_t) size_Array(&d->entries));
+    appendU16_(dir, (uint16_t) size_Array(&d->entries));
+    appendU32_(dir, (uint32_t) dirSize);
+    appendU32_(dir, d->pos);
+    appendU16_(dir, 0);      /* comment */
+    write_File(d->file, dir);
+    delete_Block(dir);
+    close_File(d->file);
+    iReleasePtr(&d->file);
+    iForEach(Array, j, &d->entries) {
+        deinit_String(&((iZipEntry *) j.value)->name);
+    }
+    deinit_Array(&d->entries);
+    iRelease(d->names);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(MirrorJob)
+
+struct Impl_MirrorJob {
+    iString     url;
+    int         depth;
+    iGmRequest *request;
+    uint32_t    startTime;
+};
+
+static void init_MirrorJob(iMirrorJob *d, const iString *url, int depth) {
+    initCopy_String(&d->url, url);
+    d->depth     = depth;
+    d->request   = NULL;
+    d->startTime = 0;
+}
+
+static void deinit_MirrorJob(iMirrorJob *d) {
+    if (d->request) {
+        cancel_GmRequest(d->request);
+        iRelease(d->request);
+    }
+    deinit_String(&d->url);
+}
+
+iDefineTypeConstructionArgs(MirrorJob, (const iString *url, int depth), url, depth)
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(Mirror)
+
+struct Impl_Mirror {
+    iString     dir;
+    iThread *   worker;
+    iBool       stopWorker;
+    iMutex *    workerMtx;
+    iCondition  workerWakeup; /* a request finished, or the worker should stop */
+    int         numWakeups;
+    iString     host;
+    int         maxDepth;
+    iPtrArray   pending; /* breadth-first */
+    iStringSet *known;   /* every URL ever queued */
+    uint32_t    pausedUntil; /* server asked us to slow down */
+};
+
+static iMirror mirror_;
+
+static void wakeUpWorker_Mirror_(iMirror *d) {
+    lock_Mutex(d->workerMtx);
+    d->numWakeups++;
+    signal_Condition(&d->workerWakeup);
+    unlock_Mutex(d->workerMtx);
+}
+
+static void jobFinished_Mirror_(iAnyObject *obj, iGmRequest *req) {
+    /* Called in a request thread. */
+    iUnused(obj, req);
+    wakeUpWorker_Mirror_(&mirror_);
+}
+
+static iString *entryName_Mirror_(const iString *url) {
+    /* Entry names are the exact URL paths, so relative links keep working inside the
+       archive. Only directories need a file name. */
+    iUrl parts;
+    init_Url(&parts, url);
+    iString *name = newRange_String(parts.path);
+    if (startsWith_String(name, "/")) {
+        remove_Block(&name->chars, 0, 1);
+    }
+    if (isEmpty_String(name) || endsWith_String(name, "/")) {
+        appendCStr_String(name, "index.gmi");
+    }
+    return name;
+}
+
+static void enqueue_Mirror_(iMirror *d, const iString *url, int depth, iBool toFront) {
+    if (!equalCase_Rangecc(urlScheme_String(url), "gemini") ||
+        !equalCase_Rangecc(urlHost_String(url), cstr_String(&d->host)) ||
+        indexOf_String(url, '?') != iInvalidPos || indexOfCStr_String(url, "/../") != iInvalidPos ||
+        size_StringSet(d->known) >= maxPages_Mirror_) {
+        return;
+    }
+    if (!toFront) {
+        if (contains_StringSet(d->known, url)) {
+            return; /* already seen */
+        }
+        insert_StringSet(d->known, url);
+    }
+    iMirrorJob *job = new_MirrorJob(url, depth);
+    if (toFront) {
+        insert_Array(&d->pending, 0, &job);
+    }
+    else {
+        pushBack_PtrArray(&d->pending, job);
+    }
+}
+
+static void enqueueLinks_Mirror_(iMirror *d, const iMirrorJob *job, const iBlock *body) {
+    iRangecc line = iNullRange;
+    while (nextSplit_Rangecc(range_Block(body), "\n", &line)) {
+        if (size_Range(&line) < 3 || line.start[0] != '=' || line.start[1] != '>') {
+            continue;
+        }
+        const char *pos = line.start + 2;
+        while (pos < line.end && isSpace_Char(*pos)) pos++;
+        const char *start = pos;
+        while (pos < line.end && !isSpace_Char(*pos)) pos++;
+        if (pos == start) {
+            continue;
+        }
+        iString *link = newRange_String((iRangecc){ start, pos });
+        enqueue_Mirror_(d,
+                        canonicalUrl_String(
+                            urlFragmentStripped_String(absoluteUrl_String(&job->url, link))),
+                        job->depth + 1,
+                        iFalse);
+        delete_String(link);
+    }
+}
+
+static iBool startNextJob_Mirror_(iMirror *d, iPtrArray *ongoing) {
+    iMirrorJob *job;
+    if (isEmpty_PtrArray(&d->pending)) {
+        return iFalse;
+    }
+    take_PtrArray(&d->pending, 0, (void **) &job);
+    job->request   = new_GmRequest(certs_App());
+    job->startTime = SDL_GetTicks();
+    setUrl_GmRequest(job->request, &job->url);
+    enableFilters_GmRequest(job->request, iFalse); /* save what the server sent */
+    iConnect(GmRequest, job->request, finished, job->request, jobFinished_Mirror_);
+    submit_GmRequest(job->request);
+    pushBack_PtrArray(ongoing, job);
+    return iTrue;
+}
+
+static iBool save_Mirror_(iMirror *d, iZipWriter *zip, iMirrorJob *job, iString *mimeTypes) {
+    /* Returns True if the response was written to the archive. Only content from a trusted
+       server is kept, since the copy is later shown without a certificate to check. */
+    const iGmRequest *   req  = job->request;
+    const enum iGmStatusCode code = status_GmRequest(req);
+    if (isSuccess_GmStatusCode(code) && certFlags_GmRequest(req) & trusted_GmCertFlag &&
+        bodySize_GmRequest(req) <= maxBodySize_Mirror_) {
+        const iBool isGemtext = startsWith_String(meta_GmRequest(req), "text/gemini");
+        iString *name = entryName_Mirror_(&job->url);
+        const iBool isSaved = add_ZipWriter_(zip, name, body_GmRequest(req));
+        if (isSaved) {
+            /* Extensionless paths don't tell what the content is. */
+            appendFormat_String(mimeTypes, "%s\t%s\n", cstr_String(name),
+                                cstr_String(meta_GmRequest(req)));
+        }
+        delete_String(name);
+        if (isSaved && isGemtext && job->depth < d->maxDepth) {
+            enqueueLinks_Mirror_(d, job, body_GmRequest(req));
+        }
+        return isSaved;
+    }
+    if (category_GmStatusCode(code) == categoryRedirect_GmStatusCode) {
+        enqueue_Mirror_(d,
+                        canonicalUrl_String(absoluteUrl_String(&job->url, meta_GmRequest(req))),
+                        job->depth,
+                        iFalse);
+    }
+    else if (code == slowDown_GmStatusCode) {
+        const int seconds = iClamp(toInt_String(meta_GmRequest(req)), 1, maxSlowDown_Mirror_);
+        d->pausedUntil = SDL_GetTicks() + 1000 * seconds;
+        enqueue_Mirror_(d, &job->url, job->depth, iTrue); /* try again */
+    }
+    return iFalse;
+}
+
+static iString *hostArchivePath_Mirror_(const iMirror *d, const iString *host) {
+    iString *path = concat_Path(&d->dir, host);
+    appendCStr_String(path, ".zip");
+    return path;
+}
+
+static iThreadResult crawl_Mirror_(iThread *thread) {
+    iMirror *d = &mirror_;
+    iUnused(thread);
+    setThreadName_Profiler("mirror");
+    iString *path    = hostArchivePath_Mirror_(d, &d->host);
+    iString *tmpPath = newFormat_String("%s.part", cstr_String(path));
+    iZipWriter zip;
+    if (!open_ZipWriter_(&zip, tmpPath)) {
+        postCommandf_App("mirror.finished arg:0 host:%s", cstr_String(&d->host));
+        delete_String(tmpPath);
+        delete_String(path);
+        return 0;
+    }
+    iPtrArray *ongoing   = new_PtrArray();
+    iString   *mimeTypes = new_String();
+    size_t     numSaved  = 0;
+    size_t     numDone   = 0;
+    uint32_t   lastStart = 0;
+    postCommandf_App("mirror.progress arg:0 total:1 host:%s", cstr_String(&d->host));
+    while (!d->stopWorker) {
+        const uint32_t now = SDL_GetTicks();
+        /* Politeness: the host sees at most a couple of requests at a time, spaced apart. */
+        if (size_PtrArray(ongoing) < maxConcurrent_Mirror_ && now - lastStart >= minInterval_Mirror_ &&
+            (int32_t) (now - d->pausedUntil) >= 0 && startNextJob_Mirror_(d, ongoing)) {
+            lastStart = now;
+        }
+        lock_Mutex(d->workerMtx);
+        if (d->numWakeups == 0 && !d->stopWorker) {
+            iTime until;
+            initTimeout_Time(&until, minInterval_Mirror_ / 1000.0);
+            waitTimeout_Condition(&d->workerWakeup, d->workerMtx, &until);
+        }
+        d->numWakeups = 0;
+        unlock_Mutex(d->workerMtx);
+        if (d->stopWorker) break;
+        iBool doNotify = iFalse;
+        iForEach(PtrArray, i, ongoing) {
+            iMirrorJob *job = i.ptr;
+            if (isFinished_GmRequest(job->request) ||
+                SDL_GetTicks() - job->startTime > timeout_Mirror_) {
+                if (isFinished_GmRequest(job->request) && save_Mirror_(d, &zip, job, mimeTypes)) {
+                    numSaved++;
+                }
+                delete_MirrorJob(job);
+                remove_PtrArrayIterator(&i);
+                numDone++;
+                doNotify = iTrue;
+            }
+        }
+        if (doNotify) {
+            postCommandf_App("mirror.progress arg:%zu total:%zu host:%s",
+                             numDone,
+                             numDone + size_PtrArray(ongoing) + size_PtrArray(&d->pending),
+                             cstr_String(&d->host));
+        }
+        if (isEmpty_PtrArray(ongoing) && isEmpty_PtrArray(&d->pending)) {
+            break;
+        }
+        recycle_Garbage();
+    }
+    iForEach(PtrArray, j, ongoing) {
+        delete_MirrorJob(j.ptr); /* stopped early */
+    }
+    delete_PtrArray(ongoing);
+    if (numSaved) {
+        add_ZipWriter_(&zip, collectNewCStr_String(mimeTypesEntry_Mirror_), utf8_String(mimeTypes));
+    }
+    delete_String(mimeTypes);
+    close_ZipWriter_(&zip);
+    /* A partial crawl still replaces the previous mirror if it saved anything. */
+    if (numSaved) {
+#if defined (iPlatformMsys)
+        remove(cstr_String(path)); /* rename doesn't replace existing files */
+#endif
+        if (rename(cstr_String(tmpPath), cstr_String(path)) != 0) {
+            numSaved = 0;
+        }
+    }
+    else {
+        remove(cstr_String(tmpPath));
+    }
+    postCommandf_App("mirror.finished arg:%zu host:%s", numSaved, cstr_String(&d->host));
+    delete_String(tmpPath);
+    delete_String(path);
+    return 0;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+void init_Mirror(const char *dir) {
+    iMirror *d = &mirror_;
+    initCStr_String(&d->dir, dir);
+    d->worker     = NULL;
+    d->stopWorker = iFalse;
+    d->workerMtx  = new_Mutex();
+    init_Condition(&d->workerWakeup);
+    d->numWakeups = 0;
+    init_String(&d->host);
+    d->maxDepth = 0;
+    init_PtrArray(&d->pending);
+    d->known       = new_StringSet();
+    d->pausedUntil = 0;
+}
+
+static void clearJobs_Mirror_(iMirror *d) {
+    iForEach(PtrArray, i, &d->pending) {
+        delete_MirrorJob(i.ptr);
+    }
+    clear_PtrArray(&d->pending);
+    iRelease(d->known);
+    d->known = new_StringSet();
+}
+
+void deinit_Mirror(void) {
+    iMirror *d = &mirror_;
+    stop_Mirror();
+    clearJobs_Mirror_(d);
+    iRelease(d->known);
+    deinit_PtrArray(&d->pending);
+    deinit_String(&d->host);
+    deinit_Condition(&d->workerWakeup);
+    delete_Mutex(d->workerMtx);
+    deinit_String(&d->dir);
+}
+
+iBool start_Mirror(const iString *url, int depth) {
+    iMirror *d = &mirror_;
+    if (d->worker || !equalCase_Rangecc(urlScheme_String(url), "gemini")) {
+        return iFalse;
+    }
+    makeDirs_Path(&d->dir);
+    clearJobs_Mirror_(d);
+    setRange_String(&d->host, urlHost_String(url));
+    d->maxDepth    = iMax(0, depth);
+    d->pausedUntil = 0;
+    enqueue_Mirror_(d, canonicalUrl_String(urlFragmentStripped_String(url)), 0, iFalse);
+    if (isEmpty_PtrArray(&d->pending)) {
+        return iFalse;
+    }
+    prefetchUrl_Resolver(url);
+    d->stopWorker = iFalse;
+    d->numWakeups = 0;
+    d->worker     = new_Thread(crawl_Mirror_);
+    start_Thread(d->worker);
+    return iTrue;
+}
+
+void stop_Mirror(void) {
+    iMirror *d = &mirror_;
+    if (d->worker) {
+        d->stopWorker = iTrue;
+        wakeUpWorker_Mirror_(d);
+        finished_Mirror();
+    }
+}
+
+void finished_Mirror(void) {
+    iMirror *d = &mirror_;
+    if (d->worker) {
+        join_Thread(d->worker);
+        iReleasePtr(&d->worker);
+    }
+}
+
+iBool isActive_Mirror(void) {
+    return mirror_.worker != NULL;
+}
+
+iString *archivePath_Mirror(const iString *url) {
+    iString *host = newRange_String(urlHost_String(url));
+    iString *path = NULL;
+    if (!isEmpty_String(host)) {
+        path = hostArchivePath_Mirror_(&mirror_, host);
+        if (!fileExists_FileInfo(path)) {
+            delete_String(path);
+            path = NULL;
+        }
+    }
+    delete_String(host);
+    return path;
+}
+
+iGmResponse *load_Mirror(const iString *url) {
+    /* May be called from any thread. */
+    iUrl parts;
+    init_Url(&parts, url);
+    if (!isEmpty_Range(&parts.query) || !equalCase_Rangecc(parts.scheme, "gemini")) {
+        return NULL;
+    }
+    iString *path = archivePath_Mirror(url);
+    if (!path) {
+        return NULL;
+    }
+    iGmResponse *resp = NULL;
+    iString     *name = entryName_Mirror_(url);
+    iBlock      *data = readEntry_ArchiveCache(path, name);
+    if (data) {
+        resp = new_GmResponse();
+        resp->statusCode = success_GmStatusCode;
+        setCStr_String(&resp->meta, mediaType_Path(name));
+        iString *typesName = newCStr_String(mimeTypesEntry_Mirror_);
+        iBlock  *types     = readEntry_ArchiveCache(path, typesName);
+        delete_String(typesName);
+        if (types) {
+            iRangecc line = iNullRange;
+            while (nextSplit_Rangecc(range_Block(types), "\n", &line)) {
+                if (size_Range(&line) > size_String(name) &&
+                    line.start[size_String(name)] == '\t' &&
+                    startsWith_Rangecc(line, cstr_String(name))) {
+                    setRange_String(&resp->meta,
+                                    (iRangecc){ line.start + size_String(name) + 1, line.end });
+                    break;
+                }
+            }
+            delete_Block(types);
+        }
+        set_Block(&resp->body, data);
+        initCurrent_Time(&resp->when);
+        delete_Block(data);
+    }
+    delete_String(name);
+    delete_String(path);
+    return resp;
+}
@@ -33,13 +33,17 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 iDeclareType(PeriodicCommand)
 
 struct Impl_PeriodicCommand {
-    iAny *  context;
-    iString command;
+    iAny *   context;
+    iString  command;
+    uint32_t due; /* SDL ticks */
 };
 
+static const uint32_t postingInterval_Periodic_ = 500;
+
 static void init_PeriodicCommand(iPeriodicCommand *d, iAny *context, const char *command) {
     d->context = context;
     initCStr_String(&d->command, command);
+    d->due     = SDL_GetTicks() + postingInterval_Periodic_;
 }
 
 static void deinit_PeriodicCommand(iPeriodicCommand *d) {
@@ -55,7 +59,73 @@ iDefineTypeConstructionArgs(PeriodicCommand, (iAny *ctx, const char *cmd), ctx,
 
 /*----------------------------------------------------------------------------------------------*/
 
-static const uint32_t postingInterval_Periodic_ = 500;
+iDeclareType(PeriodicTimer)
+
+/* Each scheduled timer has a token, so the callback can tell whether the timer has been
+   replaced while it was waiting for the mutex. The token is freed by the callback, or by
+   whoever removes the timer before it fires. */
+struct Impl_PeriodicTimer {
+    iPeriodic *periodic;
+};
+
+static uint32_t postWakeup_Periodic_(uint32_t interval, void *param) {
+    /* Called in the timer thread. */
+    iPeriodicTimer *token = param;
+    iPeriodic      *d     = token->periodic;
+    lock_Mutex(d->mutex);
+    if (d->timerToken == token) {
+        d->timer      = 0;
+        d->timerToken = NULL;
+    }
+    unlock_Mutex(d->mutex);
+    free(token);
+    SDL_Event ev = { .type = SDL_USEREVENT };
+    ev.user.code = periodic_UserEventCode;
+    SDL_PushEvent(&ev);
+    iUnused(interval);
+    return 0; /* one-shot; rescheduled after dispatching */
+}
+
+static void removeTimer_Periodic_(iPeriodic *d) {
+    /* Mutex must be locked. */
+    if (d->timer) {
+        if (SDL_RemoveTimer(d->timer)) {
+            free(d->timerToken); /* callback won't be called */
+        }
+        d->timer      = 0;
+        d->timerToken = NULL;
+    }
+}
+
+static void schedule_Periodic_(iPeriodic *d) {
+    /* Mutex must be locked. */
+    if (isEmpty_SortedArray(&d->commands)) {
+        removeTimer_Periodic_(d);
+        return;
+    }
+    uint32_t due = ((const iPeriodicCommand *) constAt_SortedArray(&d->commands, 0))->due;
+    iConstForEach(Array, i, &d->commands.values) {
+        const iPeriodicCommand *pc = i.value;
+        if (SDL_TICKS_PASSED(due, pc->due)) {
+            due = pc->due;
+        }
+    }
+    if (d->timer && d->timerDue == due) {
+        return; /* already scheduled */
+    }
+    removeTimer_Periodic_(d);
+    const uint32_t  now   = SDL_GetTicks();
+    iPeriodicTimer *token = iMalloc(PeriodicTimer);
+    token->periodic = d;
+    d->timerDue     = due;
+    d->timerToken   = token;
+    d->timer        = SDL_AddTimer(
+        SDL_TICKS_PASSED(now, due) ? 1 : due - now, postWakeup_Periodic_, token);
+    if (!d->timer) {
+        free(token);
+        d->timerToken = NULL;
+    }
+}
 
 static void removePending_Periodic_(iPeriodic *d) {
     iForEach(PtrSet, i, &d->pendingRemoval) {
@@ -74,16 +144,16 @@ static iBool isDispatching_;
 
 iBool dispatchCommands_Periodic(iPeriodic *d) {
     const uint32_t now = SDL_GetTicks();
-    if (now - d->lastPostTime < postingInterval_Periodic_) {
-        return iFalse;
-    }
-    d->lastPostTime = now;
     iBool wasPosted = iFalse;
     lock_Mutex(d->mutex);
     isDispatching_ = iTrue;
     iAssert(isEmpty_PtrSet(&d->pendingRemoval));
-    iConstForEach(Array, i, &d->commands.values) {
-        const iPeriodicCommand *pc = i.value;
+    iForEach(Array, i, &d->commands.values) {
+        iPeriodicCommand *pc = i.value;
+        if (!SDL_TICKS_PASSED(now, pc->due)) {
+            continue;
+        }
+        pc->due = now + postingInterval_Periodic_;
         iAssert(isInstance_Object(pc->context, &Class_Widget));
         const SDL_UserEvent ev = {
             .type  = SDL_USEREVENT,
@@ -100,6 +170,7 @@ iBool dispatchCommands_Periodic(iPeriodic *d) {
     removePending_Periodic_(d);
     setCurrent_Root(NULL);
     isDispatching_ = iFalse;
+    schedule_Periodic_(d);
     unlock_Mutex(d->mutex);
     return wasPosted;
 }
@@ -107,11 +178,16 @@ iBool dispatchCommands_Periodic(iPeriodic *d) {
 void init_Periodic(iPeriodic *d) {
     d->mutex = new_Mutex();
     init_SortedArray(&d->commands, sizeof(iPeriodicCommand), cmp_PeriodicCommand_);
-    d->lastPostTime = 0;
+    d->timer      = 0;
+    d->timerToken = NULL;
+    d->timerDue   = 0;
     init_PtrSet(&d->pendingRemoval);
 }
 
 void deinit_Periodic(iPeriodic *d) {
+    lock_Mutex(d->mutex);
+    removeTimer_Periodic_(d);
+    unlock_Mutex(d->mutex);
     deinit_PtrSet(&d->pendingRemoval);
     iForEach(Array, i, &d->commands.values) {
         deinit_PeriodicCommand(i.value);
@@ -132,6 +208,7 @@ void add_Periodic(iPeriodic *d, iAny *context, const char *command) {
         iPeriodicCommand pc;
         init_PeriodicCommand(&pc, context, command);
         insert_SortedArray(&d->commands, &pc);
+        schedule_Periodic_(d);
     }
     unlock_Mutex(d->mutex);
 }
@@ -141,6 +218,7 @@ void remove_Periodic(iPeriodic *d, iAny *context) {
     insert_PtrSet(&d->pendingRemoval, context);
     if (!isDispatching_) {
         removePending_Periodic_(d);
+        schedule_Periodic_(d);
     }
     unlock_Mutex(d->mutex);
 }
@@ -25,15 +25,19 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/ptrset.h>
 #include <the_Foundation/sortedarray.h>
+#include <SDL_timer.h>
 
 iDeclareType(Periodic)
 iDeclareType(Thread)
 
-/* Animation utility. Not per frame but several times per second. Thread safe. */
+/* Animation utility. Not per frame but several times per second. Thread safe.
+   A timer wakes up the main loop when the earliest command is due. */
 struct Impl_Periodic {
     iMutex *     mutex;
     iSortedArray commands;
-    uint32_t     lastPostTime;
+    SDL_TimerID  timer;
+    void *       timerToken; /* identifies the scheduled timer in its callback */
+    uint32_t     timerDue;
     iPtrSet      pendingRemoval; /* contexts */
 };
 
@@ -0,0 +1,215 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "prefetch.h"
+#include "app.h"
+#include "gmcerts.h"
+#include "gmutil.h"
+
+#include <the_Foundation/ptrarray.h>
+#include <SDL_timer.h>
+
+static const uint32_t lifetime_Prefetch_      = 60 * 1000; /* ms */
+static const size_t   maxEntries_Prefetch_    = 16;
+static const size_t   maxOngoing_Prefetch_    = 4;
+static const size_t   maxOngoingPerHost_Prefetch_ = 2;
+static const size_t   maxBodySize_Prefetch_   = 512 * 1024;
+
+iDeclareType(PrefetchEntry)
+
+struct Impl_PrefetchEntry {
+    iString      url;
+    iString      host;
+    const void * context;
+    iGmRequest * request;
+    uint32_t     startTime;
+};
+
+static void init_PrefetchEntry(iPrefetchEntry *d, const iString *url, const void *context) {
+    initCopy_String(&d->url, url);
+    initRange_String(&d->host, urlHost_String(url));
+    d->context   = context;
+    d->request   = new_GmRequest(certs_App());
+    d->startTime = SDL_GetTicks();
+    setUrl_GmRequest(d->request, url);
+}
+
+static void deinit_PrefetchEntry(iPrefetchEntry *d) {
+    cancel_GmRequest(d->request);
+    iRelease(d->request);
+    deinit_String(&d->host);
+    deinit_String(&d->url);
+}
+
+iDefineTypeConstructionArgs(PrefetchEntry, (const iString *url, const void *context), url, context)
+
+static iBool isUsable_PrefetchEntry_(const iPrefetchEntry *d) {
+    /* Only complete pages are kept; anything else will be requested again normally. */
+    if (!isFinished_GmRequest(d->request) || status_GmRequest(d->request) != success_GmStatusCode ||
+        !startsWith_String(meta_GmRequest(d->request), "text/") ||
+        bodySize_GmRequest(d->request) > maxBodySize_Prefetch_) {
+        return iFalse;
+    }
+    if (equalCase_Rangecc(urlScheme_String(&d->url), "gemini")) {
+        /* The page is shown without the user having seen any certificate warnings, so the
+           server must have checked out fully. Otherwise the normal request will warn. */
+        const int required = trusted_GmCertFlag | domainVerified_GmCertFlag |
+                             timeVerified_GmCertFlag;
+        if ((certFlags_GmRequest(d->request) & required) != required) {
+            return iFalse;
+        }
+    }
+    return iTrue;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(Prefetch)
+
+struct Impl_Prefetch {
+    iPtrArray entries; /* oldest first */
+};
+
+static iPrefetch prefetch_;
+
+static size_t find_Prefetch_(const iPrefetch *d, const iString *url) {
+    for (size_t i = 0; i < size_PtrArray(&d->entries); i++) {
+        const iPrefetchEntry *entry = constAt_PtrArray(&d->entries, i);
+        if (equal_String(&entry->url, url)) {
+            return i;
+        }
+    }
+    return iInvalidPos;
+}
+
+static void removeExpired_Prefetch_(iPrefetch *d) {
+    const uint32_t now = SDL_GetTicks();
+    iForEach(PtrArray, i, &d->entries) {
+        iPrefetchEntry *entry = i.ptr;
+        const iBool isDone = isFinished_GmRequest(entry->request);
+        if (now - entry->startTime > lifetime_Prefetch_ ||
+            (isDone && !isUsable_PrefetchEntry_(entry)) ||
+            (!isDone && bodySize_GmRequest(entry->request) > maxBodySize_Prefetch_)) {
+            delete_PrefetchEntry(entry);
+            remove_PtrArrayIterator(&i);
+        }
+    }
+}
+
+static iBool isAllowed_Prefetch_(const iPrefetch *d, const iString *url) {
+    const iRangecc scheme = urlScheme_String(url);
+    if (!equalCase_Rangecc(scheme, "gemini") && !equalCase_Rangecc(scheme, "file")) {
+        return iFalse;
+    }
+    if (identityForUrl_GmCerts(certs_App(), url)) {
+        return iFalse; /* the server may do something on the user's behalf */
+    }
+    const iRangecc host      = urlHost_String(url);
+    size_t         ongoing   = 0;
+    size_t         onThisHost = 0;
+    iConstForEach(PtrArray, i, &d->entries) {
+        const iPrefetchEntry *entry = i.ptr;
+        if (!isFinished_GmRequest(entry->request)) {
+            ongoing++;
+            if (equalCase_Rangecc(range_String(&entry->host), host)) {
+                onThisHost++;
+            }
+        }
+    }
+    return ongoing < maxOngoing_Prefetch_ && onThisHost < maxOngoingPerHost_Prefetch_;
+}
+
+void init_Prefetch(void) {
+    init_PtrArray(&prefetch_.entries);
+}
+
+void deinit_Prefetch(void) {
+    iPrefetch *d = &prefetch_;
+    iForEach(PtrArray, i, &d->entries) {
+        delete_PrefetchEntry(i.ptr);
+    }
+    deinit_PtrArray(&d->entries);
+}
+
+void prefetch_Prefetch(const iString *url, const void *context) {
+    iPrefetch *d = &prefetch_;
+    if (!prefs_App()->prefetchLinks || !url || isEmpty_String(url)) {
+        return;
+    }
+    url = canonicalUrl_String(urlFragmentStripped_String(url));
+    removeExpired_Prefetch_(d);
+    if (find_Prefetch_(d, url) != iInvalidPos || !isAllowed_Prefetch_(d, url)) {
+        return;
+    }
+    if (size_PtrArray(&d->entries) >= maxEntries_Prefetch_) {
+        iPrefetchEntry *oldest;
+        take_PtrArray(&d->entries, 0, (void **) &oldest);
+        delete_PrefetchEntry(oldest);
+    }
+    iPrefetchEntry *entry = new_PrefetchEntry(url, context);
+    pushBack_PtrArray(&d->entries, entry);
+    submit_GmRequest(entry->request);
+}
+
+void cancel_Prefetch(const void *context) {
+    iPrefetch *d = &prefetch_;
+    iForEach(PtrArray, i, &d->entries) {
+        iPrefetchEntry *entry = i.ptr;
+        if (entry->context == context && !isFinished_GmRequest(entry->request)) {
+            delete_PrefetchEntry(entry);
+            remove_PtrArrayIterator(&i);
+        }
+    }
+}
+
+iGmResponse *take_Prefetch(const iString *url) {
+    iPrefetch *d = &prefetch_;
+    if (isEmpty_PtrArray(&d->entries)) {
+        return NULL;
+    }
+    removeExpired_Prefetch_(d);
+    /* Entries are stored without the fragment, which only affects where the page is shown. */
+    const size_t index = find_Prefetch_(d, canonicalUrl_String(urlFragmentStripped_String(url)));
+    if (index == iInvalidPos) {
+        return NULL;
+    }
+    iPrefetchEntry *entry = at_PtrArray(&d->entries, index);
+    if (!isFinished_GmRequest(entry->request)) {
+        return NULL; /* still loading; the page is fetched as usual */
+    }
+    iGmResponse *resp = copy_GmResponse(lockResponse_GmRequest(entry->request));
+    unlockResponse_GmRequest(entry->request);
+    remove_Array(&d->entries, index);
+    delete_PrefetchEntry(entry);
+    return resp;
+}
+
+void clear_Prefetch(void) {
+    iPrefetch *d = &prefetch_;
+    iForEach(PtrArray, i, &d->entries) {
+        iPrefetchEntry *entry = i.ptr;
+        if (isFinished_GmRequest(entry->request)) {
+            delete_PrefetchEntry(entry);
+            remove_PtrArrayIterator(&i);
+        }
+    }
+}
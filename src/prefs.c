@@ -55,8 +55,11 @@ void init_Prefs(iPrefs *d) {
     d->addBookmarksToBottom   = iTrue;
     d->warnAboutMissingGlyphs = iTrue;
     d->decodeUserVisibleURLs  = iTrue;
+    d->prefetchLinks          = iFalse;
     d->maxCacheSize      = 10;
     d->maxMemorySize     = 200;
+    d->hibernateTabsAfter = 30;
+    d->mirrorDepth       = 2;
     setCStr_String(&d->strings[uiFont_PrefsString], "default");
     setCStr_String(&d->strings[headingFont_PrefsString], "default");
     setCStr_String(&d->strings[bodyFont_PrefsString], "default");
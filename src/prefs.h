@@ -86,8 +86,11 @@ struct Impl_Prefs {
     iBool            warnAboutMissingGlyphs;
     /* Network */
     iBool            decodeUserVisibleURLs;
+    iBool            prefetchLinks;
     int              maxCacheSize; /* MB */
     int              maxMemorySize; /* MB */
+    int              hibernateTabsAfter; /* minutes; zero to disable */
+    int              mirrorDepth; /* link levels saved for offline reading */
     /* Style */
     iStringSet *     disabledFontPacks;
     iBool            fontSmoothing;
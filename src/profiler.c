@@ -0,0 +1,494 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "profiler.h"
+#include "ui/paint.h"
+#include "ui/text.h"
+#include "ui/window.h"
+#include "app.h"
+
+#include <the_Foundation/atomic.h>
+#include <the_Foundation/mutex.h>
+#include <SDL_thread.h>
+#include <SDL_timer.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+iDeclareType(ProfilerBuffer)
+iDeclareType(ProfilerEvent)
+
+enum iProfilerEventType {
+    scope_ProfilerEventType,
+    counter_ProfilerEventType,
+    flow_ProfilerEventType,
+};
+
+struct Impl_ProfilerEvent {
+    uint64_t    start;    /* μs since init */
+    uint32_t    duration; /* μs */
+    uint8_t     type;
+    uint8_t     scope;    /* scope; flow step */
+    const char *name;     /* counter or flow */
+    int64_t     value;    /* counter value; flow ID */
+};
+
+/* Only the owner thread writes to a buffer. `count` is updated after the event has been
+   written, so readers can copy the events and then check which ones were overwritten.
+   Buffers are never freed. When the owner exits, the buffer is taken over by the next new
+   thread that needs one of the same size. */
+struct Impl_ProfilerBuffer {
+    uint32_t        thread;
+    const char *    name;
+    unsigned        capacity;
+    iAtomicInt      isFree; /* owner has exited */
+    iAtomicInt      first; /* index of the owner's first event */
+    iAtomicInt      count; /* total number recorded */
+    iProfilerEvent  events[1];
+};
+
+#define maxEvents_Profiler_         32768 /* main thread */
+#define maxThreadEvents_Profiler_   4096
+#define maxBuffers_Profiler_        64
+#define maxFrames_Profiler_         240
+
+enum iProfilerMode {
+    overlay_ProfilerMode = iBit(1),
+    trace_ProfilerMode   = iBit(2),
+};
+
+static const char *scopeNames_Profiler_[max_ProfilerScope] = {
+    "layout", "draw", "glyphCache", "events", "tickers", "request", "frame", "docLayout",
+    "filter",
+};
+
+static struct {
+    iAtomicInt       mode;
+    iMutex *         mtx; /* buffer registration, frames */
+    uint64_t         baseTicks;
+    uint64_t         freq;
+    uint32_t         mainThread;
+    uint64_t         resetTime; /* μs; earlier events are ignored */
+    iProfilerBuffer *buffers[maxBuffers_Profiler_];
+    iAtomicInt       numBuffers;
+    iAtomicInt       numDropped; /* threads beyond `maxBuffers_Profiler_` */
+    pthread_key_t    exitKey; /* frees the buffer when its owner exits */
+    iProfilerEvent * snapshot; /* main thread only */
+    uint32_t         frames[maxFrames_Profiler_]; /* μs */
+    size_t           numFrames;
+} profiler_;
+
+static _Thread_local iProfilerBuffer *threadBuffer_;
+static _Thread_local const char *     threadName_;
+static _Thread_local iBool            isThreadDropped_; /* too many threads */
+
+static uint64_t microseconds_Profiler_(uint64_t ticks) {
+    return (ticks - profiler_.baseTicks) * 1000000 / profiler_.freq;
+}
+
+static uint64_t now_Profiler_(void) {
+    return microseconds_Profiler_(SDL_GetPerformanceCounter());
+}
+
+static void threadExited_Profiler_(void *buf) {
+    /* Called in the exiting thread. */
+    set_Atomic(&((iProfilerBuffer *) buf)->isFree, iTrue);
+}
+
+void init_Profiler(void) {
+    set_Atomic(&profiler_.mode, 0);
+    profiler_.mtx        = new_Mutex();
+    profiler_.baseTicks  = SDL_GetPerformanceCounter();
+    profiler_.freq       = SDL_GetPerformanceFrequency();
+    profiler_.mainThread = (uint32_t) SDL_ThreadID();
+    profiler_.resetTime  = 0;
+    profiler_.snapshot   = malloc(sizeof(iProfilerEvent) * maxEvents_Profiler_);
+    profiler_.numFrames  = 0;
+    set_Atomic(&profiler_.numBuffers, 0);
+    set_Atomic(&profiler_.numDropped, 0);
+    pthread_key_create(&profiler_.exitKey, threadExited_Profiler_);
+    threadName_ = "main";
+}
+
+void deinit_Profiler(void) {
+    set_Atomic(&profiler_.mode, 0);
+    /* Threads still running may be holding on to their buffers, so they are not freed.
+       This is only called when the app is shutting down. */
+    pthread_key_delete(profiler_.exitKey);
+    free(profiler_.snapshot);
+    profiler_.snapshot = NULL;
+    delete_Mutex(profiler_.mtx);
+    profiler_.mtx = NULL;
+}
+
+static iBool isRecording_Profiler_(void) {
+    return value_Atomic(&profiler_.mode) != 0;
+}
+
+static void setMode_Profiler_(int mode, iBool enable) {
+    const int old = value_Atomic(&profiler_.mode);
+    if (enable && (mode == trace_ProfilerMode || !old)) {
+        /* Start with fresh data. */
+        profiler_.resetTime = now_Profiler_();
+        lock_Mutex(profiler_.mtx);
+        profiler_.numFrames = 0;
+        unlock_Mutex(profiler_.mtx);
+        set_Atomic(&profiler_.numDropped, 0);
+    }
+    set_Atomic(&profiler_.mode, enable ? old | mode : old & ~mode);
+}
+
+iBool isEnabled_Profiler(void) {
+    return (value_Atomic(&profiler_.mode) & overlay_ProfilerMode) != 0;
+}
+
+void setEnabled_Profiler(iBool enable) {
+    setMode_Profiler_(overlay_ProfilerMode, enable);
+}
+
+iBool isTracing_Profiler(void) {
+    return (value_Atomic(&profiler_.mode) & trace_ProfilerMode) != 0;
+}
+
+void setTracing_Profiler(iBool trace) {
+    setMode_Profiler_(trace_ProfilerMode, trace);
+}
+
+void setThreadName_Profiler(const char *name) {
+    threadName_ = name;
+    if (threadBuffer_) {
+        threadBuffer_->name = name;
+    }
+}
+
+static iProfilerBuffer *threadBuffer_Profiler_(void) {
+    if (threadBuffer_ || isThreadDropped_) {
+        return threadBuffer_;
+    }
+    const uint32_t thread   = (uint32_t) SDL_ThreadID();
+    const unsigned capacity =
+        thread == profiler_.mainThread ? maxEvents_Profiler_ : maxThreadEvents_Profiler_;
+    iProfilerBuffer *buf = NULL;
+    lock_Mutex(profiler_.mtx);
+    const int numBuffers = value_Atomic(&profiler_.numBuffers);
+    /* A buffer whose owner has exited. Its earlier events are not shown as ours. */
+    for (int i = 0; i < numBuffers && !buf; i++) {
+        if (value_Atomic(&profiler_.buffers[i]->isFree) &&
+            profiler_.buffers[i]->capacity == capacity) {
+            buf = profiler_.buffers[i];
+            set_Atomic(&buf->isFree, iFalse);
+        }
+    }
+    if (!buf && numBuffers < maxBuffers_Profiler_) {
+        buf = calloc(1, sizeof(iProfilerBuffer) + sizeof(iProfilerEvent) * (capacity - 1));
+        buf->capacity = capacity;
+        set_Atomic(&buf->count, 0);
+        profiler_.buffers[numBuffers] = buf;
+        set_Atomic(&profiler_.numBuffers, numBuffers + 1); /* published */
+    }
+    if (buf) {
+        buf->thread = thread;
+        buf->name   = threadName_;
+        set_Atomic(&buf->first, value_Atomic(&buf->count));
+        pthread_setspecific(profiler_.exitKey, buf);
+    }
+    unlock_Mutex(profiler_.mtx);
+    threadBuffer_    = buf;
+    isThreadDropped_ = (buf == NULL);
+    return buf;
+}
+
+static void record_Profiler_(const iProfilerEvent *ev) {
+    iProfilerBuffer *buf = threadBuffer_Profiler_();
+    if (!buf) {
+        add_Atomic(&profiler_.numDropped, 1);
+        return;
+    }
+    const unsigned n = (unsigned) value_Atomic(&buf->count);
+    buf->events[n % buf->capacity] = *ev;
+    set_Atomic(&buf->count, (int) (n + 1));
+}
+
+static size_t snapshot_ProfilerBuffer_(const iProfilerBuffer *d, iProfilerEvent *events_out) {
+    /* Oldest first. Events the owner overwrote while they were being copied are dropped. */
+    const unsigned first = (unsigned) value_Atomic(&d->first);
+    const unsigned end   = (unsigned) value_Atomic(&d->count);
+    const unsigned begin = iMax(first, end > d->capacity ? end - d->capacity : 0);
+    for (unsigned i = begin; i < end; i++) {
+        events_out[i - begin] = d->events[i % d->capacity];
+    }
+    const unsigned after = (unsigned) value_Atomic(&d->count);
+    size_t         skip  = 0;
+    if (after - begin > d->capacity) {
+        skip = iMin(end - begin, after - begin - d->capacity);
+        memmove(events_out, events_out + skip, sizeof(iProfilerEvent) * (end - begin - skip));
+    }
+    size_t num = end - begin - skip;
+    /* Drop the ones from before the latest reset. */
+    size_t first = 0;
+    while (first < num && events_out[first].start < profiler_.resetTime) {
+        first++;
+    }
+    if (first) {
+        memmove(events_out, events_out + first, sizeof(iProfilerEvent) * (num - first));
+    }
+    return num - first;
+}
+
+uint64_t begin_Profiler(void) {
+    return isRecording_Profiler_() ? SDL_GetPerformanceCounter() : 0;
+}
+
+void end_Profiler(enum iProfilerScope scope, uint64_t beginTime) {
+    if (!beginTime || !isRecording_Profiler_()) {
+        return;
+    }
+    const uint64_t start = microseconds_Profiler_(beginTime);
+    const uint64_t end   = now_Profiler_();
+    record_Profiler_(&(iProfilerEvent){ .start    = start,
+                                        .duration = (uint32_t) (end - start),
+                                        .type     = scope_ProfilerEventType,
+                                        .scope    = (uint8_t) scope });
+}
+
+void endFrame_Profiler(uint64_t beginTime) {
+    if (!beginTime || !isRecording_Profiler_()) {
+        return;
+    }
+    const uint64_t start    = microseconds_Profiler_(beginTime);
+    const uint32_t duration = (uint32_t) (now_Profiler_() - start);
+    record_Profiler_(&(iProfilerEvent){ .start    = start,
+                                        .duration = duration,
+                                        .type     = scope_ProfilerEventType,
+                                        .scope    = frame_ProfilerScope });
+    lock_Mutex(profiler_.mtx);
+    profiler_.frames[profiler_.numFrames++ % maxFrames_Profiler_] = duration;
+    unlock_Mutex(profiler_.mtx);
+}
+
+void counter_Profiler(const char *name, int64_t value) {
+    if (isTracing_Profiler()) {
+        record_Profiler_(&(iProfilerEvent){ .start = now_Profiler_(),
+                                            .type  = counter_ProfilerEventType,
+                                            .name  = name,
+                                            .value = value });
+    }
+}
+
+void flow_Profiler(enum iProfilerFlow step, const char *name, uint32_t id) {
+    if (isTracing_Profiler() && id) {
+        record_Profiler_(&(iProfilerEvent){ .start = now_Profiler_(),
+                                            .type  = flow_ProfilerEventType,
+                                            .scope = (uint8_t) step,
+                                            .name  = name,
+                                            .value = id });
+    }
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(ProfilerStats)
+
+struct Impl_ProfilerStats {
+    int      scope;
+    uint64_t total;
+    uint32_t count;
+    uint32_t max;
+};
+
+static int cmpDuration_(const void *a, const void *b) {
+    const uint32_t x = *(const uint32_t *) a, y = *(const uint32_t *) b;
+    return x < y ? -1 : x > y ? 1 : 0;
+}
+
+static int cmpTotal_ProfilerStats_(const void *a, const void *b) {
+    const iProfilerStats *x = a, *y = b;
+    return x->total > y->total ? -1 : x->total < y->total ? 1 : 0;
+}
+
+static float percentile_(const uint32_t *sorted, size_t count, int pct) {
+    if (count == 0) {
+        return 0.0f;
+    }
+    return sorted[iMin(count - 1, count * pct / 100)] / 1000.0f;
+}
+
+void draw_Profiler(void) {
+    if (!isEnabled_Profiler()) {
+        return;
+    }
+    uint32_t       frames[maxFrames_Profiler_]; /* chronological */
+    uint32_t       sorted[maxFrames_Profiler_];
+    iProfilerStats stats[max_ProfilerScope];
+    size_t         numFrames;
+    iZap(stats);
+    for (int i = 0; i < max_ProfilerScope; i++) {
+        stats[i].scope = i;
+    }
+    /* Gather the recent data. */ {
+        const uint64_t now = now_Profiler_();
+        lock_Mutex(profiler_.mtx);
+        numFrames = iMin(profiler_.numFrames, maxFrames_Profiler_);
+        for (size_t i = 0; i < numFrames; i++) {
+            frames[i] = profiler_.frames[(profiler_.numFrames - numFrames + i) % maxFrames_Profiler_];
+        }
+        unlock_Mutex(profiler_.mtx);
+        const int numBuffers = value_Atomic(&profiler_.numBuffers);
+        for (int b = 0; b < numBuffers; b++) {
+            const size_t numEvents =
+                snapshot_ProfilerBuffer_(profiler_.buffers[b], profiler_.snapshot);
+            for (size_t i = 0; i < numEvents; i++) {
+                const iProfilerEvent *ev = &profiler_.snapshot[i];
+                if (ev->type != scope_ProfilerEventType || ev->scope == frame_ProfilerScope ||
+                    ev->start + 1000000 < now) {
+                    continue; /* only the last second */
+                }
+                iProfilerStats *st = &stats[ev->scope];
+                st->total += ev->duration;
+                st->count++;
+                st->max = iMax(st->max, ev->duration);
+            }
+        }
+    }
+    memcpy(sorted, frames, sizeof(uint32_t) * numFrames);
+    qsort(sorted, numFrames, sizeof(uint32_t), cmpDuration_);
+    qsort(stats, max_ProfilerScope, sizeof(iProfilerStats), cmpTotal_ProfilerStats_);
+    /* Draw the overlay. */
+    iPaint p;
+    init_Paint(&p);
+    const iWindow *win        = get_Window();
+    const int      font       = uiLabelSmall_FontId;
+    const int      lineHeight = lineHeight_Text(font);
+    const int      graphHeight = 10 * gap_UI;
+    const iRect    panel      = { init_I2(win->size.x - 60 * gap_UI - gap_UI, 6 * gap_UI),
+                                  init_I2(60 * gap_UI,
+                                          graphHeight + lineHeight * (1 + max_ProfilerScope) +
+                                              3 * gap_UI) };
+    fillRect_Paint(&p, panel, black_ColorId);
+    drawRect_Paint(&p, panel, gray50_ColorId);
+    const iRect graph = { addY_I2(topLeft_Rect(panel), gap_UI),
+                          init_I2(width_Rect(panel), graphHeight) };
+    const float fullScale = 50000.0f; /* μs */
+    const int   barWidth  = iMax(1, width_Rect(graph) / maxFrames_Profiler_);
+    for (size_t i = 0; i < numFrames; i++) {
+        const int h = iMin(graphHeight, (int) (frames[i] / fullScale * graphHeight));
+        fillRect_Paint(&p,
+                       (iRect){ init_I2(right_Rect(graph) - (int) (numFrames - i) * barWidth,
+                                        bottom_Rect(graph) - h),
+                                init_I2(barWidth, h) },
+                       frames[i] < 16667 ? green_ColorId
+                       : frames[i] < 33333 ? yellow_ColorId : red_ColorId);
+    }
+    drawHLine_Paint(&p,
+                    init_I2(left_Rect(graph), bottom_Rect(graph) - graphHeight / 3),
+                    width_Rect(graph),
+                    gray50_ColorId); /* 60 FPS budget */
+    iInt2 pos = init_I2(left_Rect(panel) + gap_UI, bottom_Rect(graph) + gap_UI);
+    draw_Text(font, pos, white_ColorId, "frame p50 %.1f  p95 %.1f  p99 %.1f  max %.1f ms",
+              percentile_(sorted, numFrames, 50),
+              percentile_(sorted, numFrames, 95),
+              percentile_(sorted, numFrames, 99),
+              numFrames ? sorted[numFrames - 1] / 1000.0f : 0.0f);
+    pos.y += lineHeight;
+    draw_Text(font, pos, gray75_ColorId, "last second:");
+    for (int i = 0; i < max_ProfilerScope; i++) {
+        const iProfilerStats *st = &stats[i];
+        if (st->scope == frame_ProfilerScope) {
+            continue; /* shown in the graph */
+        }
+        pos.y += lineHeight;
+        draw_Text(font, pos, st->count ? white_ColorId : gray50_ColorId,
+                  "%-10s %7.1f ms  %5u calls  max %.1f ms",
+                  scopeNames_Profiler_[st->scope],
+                  st->total / 1000.0f,
+                  st->count,
+                  st->max / 1000.0f);
+    }
+}
+
+static void appendThreadName_Profiler_(iString *json, const iProfilerBuffer *buf) {
+    appendFormat_String(json,
+                        ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,"
+                        "\"args\":{\"name\":\"",
+                        buf->thread);
+    if (buf->name) {
+        appendCStr_String(json, buf->name);
+    }
+    else {
+        appendFormat_String(json, "thread %u", buf->thread);
+    }
+    appendCStr_String(json, "\"}}");
+}
+
+iString *traceEvents_Profiler(void) {
+    static const char *flowPhases[] = { "s", "t", "f" };
+    iString *json = new_String();
+    appendCStr_String(json, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    appendCStr_String(json,
+                      "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,"
+                      "\"args\":{\"name\":\"Lagrange\"}}");
+    const int numBuffers = value_Atomic(&profiler_.numBuffers);
+    for (int b = 0; b < numBuffers; b++) {
+        const iProfilerBuffer *buf = profiler_.buffers[b];
+        appendThreadName_Profiler_(json, buf);
+        const size_t numEvents = snapshot_ProfilerBuffer_(buf, profiler_.snapshot);
+        for (size_t i = 0; i < numEvents; i++) {
+            const iProfilerEvent *ev = &profiler_.snapshot[i];
+            switch (ev->type) {
+                case scope_ProfilerEventType:
+                    appendFormat_String(json,
+                                        ",\n{\"name\":\"%s\",\"cat\":\"lagrange\",\"ph\":\"X\","
+                                        "\"ts\":%llu,\"dur\":%u,\"pid\":1,\"tid\":%u}",
+                                        scopeNames_Profiler_[ev->scope],
+                                        (unsigned long long) ev->start,
+                                        ev->duration,
+                                        buf->thread);
+                    break;
+                case counter_ProfilerEventType:
+                    appendFormat_String(json,
+                                        ",\n{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%llu,"
+                                        "\"pid\":1,\"tid\":%u,\"args\":{\"value\":%lld}}",
+                                        ev->name,
+                                        (unsigned long long) ev->start,
+                                        buf->thread,
+                                        (long long) ev->value);
+                    break;
+                case flow_ProfilerEventType:
+                    /* Flows bind to the enclosing scope on the same thread. */
+                    appendFormat_String(json,
+                                        ",\n{\"name\":\"%s\",\"cat\":\"flow\",\"ph\":\"%s\","
+                                        "\"id\":%lld,\"ts\":%llu,\"pid\":1,\"tid\":%u%s}",
+                                        ev->name,
+                                        flowPhases[ev->scope],
+                                        (long long) ev->value,
+                                        (unsigned long long) ev->start,
+                                        buf->thread,
+                                        ev->scope == end_ProfilerFlow ? ",\"bp\":\"e\"" : "");
+                    break;
+            }
+        }
+    }
+    appendFormat_String(json,
+                        "\n],\"otherData\":{\"droppedEvents\":%d}}\n",
+                        value_Atomic(&profiler_.numDropped));
+    return json;
+}
@@ -0,0 +1,70 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/string.h>
+
+/* Lightweight profiler for attributing frame time to subsystems. Each thread records into
+   its own ring buffer without locking. The recent timings can be shown as an overlay, and
+   a trace can be captured and saved in the Chrome trace event format (chrome://tracing,
+   Perfetto). Scopes, counters, and flows may be recorded from any thread. */
+
+enum iProfilerScope {
+    layout_ProfilerScope,
+    draw_ProfilerScope,
+    glyphCache_ProfilerScope,
+    events_ProfilerScope,
+    tickers_ProfilerScope,
+    request_ProfilerScope,
+    frame_ProfilerScope,
+    docLayout_ProfilerScope,
+    filter_ProfilerScope,
+    max_ProfilerScope
+};
+
+enum iProfilerFlow {
+    begin_ProfilerFlow,
+    step_ProfilerFlow,
+    end_ProfilerFlow,
+};
+
+void        init_Profiler           (void);
+void        deinit_Profiler         (void);
+
+iBool       isEnabled_Profiler      (void); /* overlay */
+void        setEnabled_Profiler     (iBool enable);
+iBool       isTracing_Profiler      (void);
+void        setTracing_Profiler     (iBool trace); /* starting discards earlier events */
+
+void        setThreadName_Profiler  (const char *name); /* string literal */
+uint64_t    begin_Profiler          (void); /* zero if not enabled */
+void        end_Profiler            (enum iProfilerScope scope, uint64_t beginTime);
+void        endFrame_Profiler       (uint64_t beginTime);
+void        counter_Profiler        (const char *name, int64_t value); /* string literal */
+void        flow_Profiler           (enum iProfilerFlow step, const char *name, uint32_t id);
+
+void        draw_Profiler           (void); /* overlay in the current window */
+iString *   traceEvents_Profiler    (void);
+
+#define start_ProfilerScope(scope)  const uint64_t _##scope##_ProfilerScope = begin_Profiler()
+#define stop_ProfilerScope(scope)   end_Profiler(scope##_ProfilerScope, _##scope##_ProfilerScope)
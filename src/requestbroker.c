@@ -0,0 +1,266 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "requestbroker.h"
+#include "app.h"
+#include "gmcerts.h"
+
+#include <the_Foundation/array.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/ptrarray.h>
+
+iDeclareType(BrokerConsumer)
+iDeclareType(BrokerEntry)
+
+struct Impl_BrokerConsumer {
+    iAnyObject *       object;
+    iRequestBrokerFunc updated;
+    iRequestBrokerFunc finished;
+};
+
+struct Impl_BrokerEntry {
+    iString            url;
+    const iGmIdentity *identity;
+    int                flags;
+    iGmRequest *       request;
+    iArray             consumers; /* iBrokerConsumer */
+    iBool              isSubmitted;
+    iBool              isFinished;
+};
+
+static void updated_BrokerEntry_(iAnyObject *, iGmRequest *);
+static void finished_BrokerEntry_(iAnyObject *, iGmRequest *);
+
+static void init_BrokerEntry(iBrokerEntry *d, const iString *url, const iGmIdentity *identity,
+                             int flags) {
+    initCopy_String(&d->url, url);
+    d->identity    = identity;
+    d->flags       = flags;
+    d->request     = new_GmRequest(certs_App());
+    d->isSubmitted = iFalse;
+    d->isFinished  = iFalse;
+    init_Array(&d->consumers, sizeof(iBrokerConsumer));
+    setUrl_GmRequest(d->request, url);
+    enableFilters_GmRequest(d->request, (flags & filtered_RequestBrokerFlag) != 0);
+    iConnect(GmRequest, d->request, updated, d, updated_BrokerEntry_);
+    iConnect(GmRequest, d->request, finished, d, finished_BrokerEntry_);
+}
+
+static void deinit_BrokerEntry(iBrokerEntry *d) {
+    iDisconnect(GmRequest, d->request, updated, d, updated_BrokerEntry_);
+    iDisconnect(GmRequest, d->request, finished, d, finished_BrokerEntry_);
+    if (!isFinished_GmRequest(d->request)) {
+        cancel_GmRequest(d->request);
+    }
+    iRelease(d->request);
+    deinit_Array(&d->consumers);
+    deinit_String(&d->url);
+}
+
+iDefineTypeConstructionArgs(BrokerEntry,
+                            (const iString *url, const iGmIdentity *identity, int flags),
+                            url, identity, flags)
+
+static size_t findConsumer_BrokerEntry_(const iBrokerEntry *d, const iAnyObject *object) {
+    iConstForEach(Array, i, &d->consumers) {
+        const iBrokerConsumer *c = i.value;
+        if (c->object == object) {
+            return index_ArrayConstIterator(&i);
+        }
+    }
+    return iInvalidPos;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(RequestBroker)
+
+struct Impl_RequestBroker {
+    iMutex *  mtx;
+    iPtrArray entries;
+};
+
+static iRequestBroker broker_;
+
+static size_t findRequest_RequestBroker_(const iRequestBroker *d, const iGmRequest *req) {
+    for (size_t i = 0; i < size_PtrArray(&d->entries); i++) {
+        const iBrokerEntry *entry = constAt_PtrArray(&d->entries, i);
+        if (entry->request == req) {
+            return i;
+        }
+    }
+    return iInvalidPos;
+}
+
+static iBool isValid_RequestBroker_(const iRequestBroker *d, const iBrokerEntry *entry) {
+    iConstForEach(PtrArray, i, &d->entries) {
+        if (i.ptr == entry) {
+            return iTrue;
+        }
+    }
+    return iFalse;
+}
+
+static void notify_BrokerEntry_(iBrokerEntry *d, iBool isFinished) {
+    /* Called from the request's thread. The consumers are notified with the broker locked, so
+       none of them can unsubscribe and be deleted meanwhile. */
+    iRequestBroker *broker = &broker_;
+    lock_Mutex(broker->mtx);
+    if (isValid_RequestBroker_(broker, d)) {
+        if (isFinished) {
+            d->isFinished = iTrue; /* no more consumers can join */
+        }
+        iConstForEach(Array, i, &d->consumers) {
+            const iBrokerConsumer *c = i.value;
+            const iRequestBrokerFunc func = isFinished ? c->finished : c->updated;
+            if (func) {
+                func(c->object);
+            }
+        }
+    }
+    unlock_Mutex(broker->mtx);
+}
+
+static void updated_BrokerEntry_(iAnyObject *entry, iGmRequest *req) {
+    iUnused(req);
+    notify_BrokerEntry_(entry, iFalse);
+}
+
+static void finished_BrokerEntry_(iAnyObject *entry, iGmRequest *req) {
+    iUnused(req);
+    notify_BrokerEntry_(entry, iTrue);
+}
+
+void init_RequestBroker(void) {
+    iRequestBroker *d = &broker_;
+    d->mtx = new_Mutex();
+    init_PtrArray(&d->entries);
+}
+
+void deinit_RequestBroker(void) {
+    iRequestBroker *d = &broker_;
+    iForEach(PtrArray, i, &d->entries) {
+        delete_BrokerEntry(i.ptr);
+    }
+    deinit_PtrArray(&d->entries);
+    delete_Mutex(d->mtx);
+}
+
+iGmRequest *subscribe_RequestBroker(const iString *url, int flags, iAnyObject *consumer,
+                                    iRequestBrokerFunc updated, iRequestBrokerFunc finished) {
+    iRequestBroker *   d        = &broker_;
+    const iGmIdentity *identity = identityForUrl_GmCerts(certs_App(), url);
+    iBrokerEntry *     found    = NULL;
+    lock_Mutex(d->mtx);
+    if (~flags & exclusive_RequestBrokerFlag) {
+        iConstForEach(PtrArray, i, &d->entries) {
+            iBrokerEntry *entry = i.ptr;
+            if (!entry->isFinished && entry->flags == flags && entry->identity == identity &&
+                equal_String(&entry->url, url)) {
+                found = entry;
+                break;
+            }
+        }
+    }
+    if (!found) {
+        found = new_BrokerEntry(url, identity, flags);
+        pushBack_PtrArray(&d->entries, found);
+    }
+    pushBack_Array(&found->consumers, &(iBrokerConsumer){ consumer, updated, finished });
+    iGmRequest *req = ref_Object(found->request);
+    unlock_Mutex(d->mtx);
+    return req;
+}
+
+void submit_RequestBroker(iGmRequest *req) {
+    /* Only the first consumer actually submits the shared request. */
+    iRequestBroker *d = &broker_;
+    iBool doSubmit = iFalse;
+    lock_Mutex(d->mtx);
+    const size_t index = findRequest_RequestBroker_(d, req);
+    if (index != iInvalidPos) {
+        iBrokerEntry *entry = at_PtrArray(&d->entries, index);
+        doSubmit = !entry->isSubmitted;
+        entry->isSubmitted = iTrue;
+    }
+    unlock_Mutex(d->mtx);
+    if (doSubmit) {
+        /* Local requests finish during the call and notify the consumers right away. */
+        submit_GmRequest(req);
+    }
+}
+
+static iBool remove_RequestBroker_(iRequestBroker *d, iGmRequest *req, const iAnyObject *consumer) {
+    iBrokerEntry *unused = NULL;
+    lock_Mutex(d->mtx);
+    const size_t index = findRequest_RequestBroker_(d, req);
+    if (index == iInvalidPos) {
+        unlock_Mutex(d->mtx);
+        return iFalse;
+    }
+    iBrokerEntry *entry = at_PtrArray(&d->entries, index);
+    const size_t  pos   = findConsumer_BrokerEntry_(entry, consumer);
+    if (pos != iInvalidPos) {
+        remove_Array(&entry->consumers, pos);
+    }
+    if (isEmpty_Array(&entry->consumers)) {
+        remove_PtrArray(&d->entries, index);
+        unused = entry;
+    }
+    unlock_Mutex(d->mtx);
+    /* Disconnecting waits for an ongoing notification, so the broker must not be locked. */
+    if (unused) {
+        delete_BrokerEntry(unused);
+    }
+    return iTrue;
+}
+
+void unsubscribe_RequestBroker(iGmRequest *req, const iAnyObject *consumer) {
+    if (req) {
+        remove_RequestBroker_(&broker_, req, consumer);
+    }
+}
+
+void cancel_RequestBroker(iGmRequest *req, const iAnyObject *consumer) {
+    /* Other consumers of a shared request keep receiving it. */
+    if (req && !remove_RequestBroker_(&broker_, req, consumer)) {
+        cancel_GmRequest(req); /* not brokered */
+    }
+}
+
+iBool makeExclusive_RequestBroker(iGmRequest *req) {
+    iRequestBroker *d = &broker_;
+    iBool isExclusive = iTrue;
+    lock_Mutex(d->mtx);
+    const size_t index = findRequest_RequestBroker_(d, req);
+    if (index != iInvalidPos) {
+        iBrokerEntry *entry = at_PtrArray(&d->entries, index);
+        if (size_Array(&entry->consumers) > 1) {
+            isExclusive = iFalse;
+        }
+        else {
+            entry->flags |= exclusive_RequestBrokerFlag; /* no longer matches new consumers */
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return isExclusive;
+}
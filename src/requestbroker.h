@@ -0,0 +1,47 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include "gmrequest.h"
+
+/* Concurrent consumers of the same URL share one in-flight GmRequest. Each consumer is
+   notified separately, and the request is only cancelled when its last consumer goes away.
+   Finished requests are never handed to new consumers. */
+
+typedef void (*iRequestBrokerFunc)(iAnyObject *consumer);
+
+enum iRequestBrokerFlag {
+    filtered_RequestBrokerFlag  = iBit(1), /* MIME hooks apply to the response */
+    exclusive_RequestBrokerFlag = iBit(2), /* body is consumed destructively; never shared */
+};
+
+void            init_RequestBroker          (void);
+void            deinit_RequestBroker        (void);
+
+iGmRequest *    subscribe_RequestBroker     (const iString *url, int flags, iAnyObject *consumer,
+                                             iRequestBrokerFunc updated,
+                                             iRequestBrokerFunc finished); /* caller gets a ref */
+void            submit_RequestBroker        (iGmRequest *);
+void            unsubscribe_RequestBroker   (iGmRequest *, const iAnyObject *consumer);
+void            cancel_RequestBroker        (iGmRequest *, const iAnyObject *consumer);
+iBool           makeExclusive_RequestBroker (iGmRequest *); /* false if already shared */
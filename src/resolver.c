@@ -0,0 +1,202 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "resolver.h"
+#include "gmutil.h"
+
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/ptrarray.h>
+#include <SDL_timer.h>
+
+static const uint32_t foundLifetime_Resolver_    = 5 * 60 * 1000; /* ms */
+static const uint32_t notFoundLifetime_Resolver_ = 15 * 1000;
+static const size_t   maxEntries_Resolver_       = 256;
+
+iDeclareType(ResolverEntry)
+
+struct Impl_ResolverEntry {
+    iString   key; /* host:port */
+    iAddress *address;
+    uint32_t  startTime;
+};
+
+static void init_ResolverEntry(iResolverEntry *d, const iString *key) {
+    initCopy_String(&d->key, key);
+    d->address   = new_Address();
+    d->startTime = SDL_GetTicks();
+}
+
+static void deinit_ResolverEntry(iResolverEntry *d) {
+    iRelease(d->address);
+    deinit_String(&d->key);
+}
+
+iDefineTypeConstructionArgs(ResolverEntry, (const iString *key), key)
+
+static iBool isExpired_ResolverEntry_(const iResolverEntry *d, uint32_t now) {
+    if (isPending_Address(d->address)) {
+        return iFalse;
+    }
+    const uint32_t lifetime = isHostFound_Address(d->address) ? foundLifetime_Resolver_
+                                                              : notFoundLifetime_Resolver_;
+    return now - d->startTime > lifetime;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(Resolver)
+
+struct Impl_Resolver {
+    iMutex *  mtx;
+    iPtrArray entries; /* oldest first */
+};
+
+static iResolver resolver_;
+
+static const iString *key_Resolver_(const iString *host, uint16_t port) {
+    iString *key = collect_String(lower_String(host));
+    appendFormat_String(key, ":%u", port);
+    return key;
+}
+
+static size_t find_Resolver_(const iResolver *d, const iString *key) {
+    for (size_t i = 0; i < size_PtrArray(&d->entries); i++) {
+        const iResolverEntry *entry = constAt_PtrArray(&d->entries, i);
+        if (equal_String(&entry->key, key)) {
+            return i;
+        }
+    }
+    return iInvalidPos;
+}
+
+static void removeExpired_Resolver_(iResolver *d) {
+    const uint32_t now = SDL_GetTicks();
+    iForEach(PtrArray, i, &d->entries) {
+        if (isExpired_ResolverEntry_(i.ptr, now)) {
+            delete_ResolverEntry(i.ptr);
+            remove_PtrArrayIterator(&i);
+        }
+    }
+}
+
+static iResolverEntry *entry_Resolver_(iResolver *d, const iString *host, uint16_t port,
+                                        iBool startLookup) {
+    /* Must be called with `mtx` locked. */
+    const iString *key   = key_Resolver_(host, port);
+    size_t         index = find_Resolver_(d, key);
+    if (index != iInvalidPos) {
+        iResolverEntry *entry = at_PtrArray(&d->entries, index);
+        if (!isExpired_ResolverEntry_(entry, SDL_GetTicks())) {
+            return entry;
+        }
+        remove_Array(&d->entries, index);
+        delete_ResolverEntry(entry);
+    }
+    if (!startLookup) {
+        return NULL;
+    }
+    if (size_PtrArray(&d->entries) >= maxEntries_Resolver_) {
+        removeExpired_Resolver_(d);
+        if (size_PtrArray(&d->entries) >= maxEntries_Resolver_) {
+            iResolverEntry *oldest;
+            take_PtrArray(&d->entries, 0, (void **) &oldest);
+            delete_ResolverEntry(oldest);
+        }
+    }
+    iResolverEntry *entry = new_ResolverEntry(key);
+    lookupTcp_Address(entry->address, host, port);
+    pushBack_PtrArray(&d->entries, entry);
+    return entry;
+}
+
+void init_Resolver(void) {
+    iResolver *d = &resolver_;
+    d->mtx = new_Mutex();
+    init_PtrArray(&d->entries);
+}
+
+void deinit_Resolver(void) {
+    iResolver *d = &resolver_;
+    iForEach(PtrArray, i, &d->entries) {
+        iResolverEntry *entry = i.ptr;
+        waitForFinished_Address(entry->address);
+        delete_ResolverEntry(entry);
+    }
+    deinit_PtrArray(&d->entries);
+    delete_Mutex(d->mtx);
+}
+
+void prefetch_Resolver(const iString *host, uint16_t port) {
+    iResolver *d = &resolver_;
+    if (isEmpty_String(host)) {
+        return;
+    }
+    iGuardMutex(d->mtx, entry_Resolver_(d, host, port, iTrue));
+}
+
+void prefetchUrl_Resolver(const iString *url) {
+    if (!url) {
+        return;
+    }
+    iUrl parts;
+    init_Url(&parts, url);
+    uint16_t port = toInt_String(collect_String(newRange_String(parts.port)));
+    if (port == 0) {
+        if (equalCase_Rangecc(parts.scheme, "gemini") || equalCase_Rangecc(parts.scheme, "titan")) {
+            port = GEMINI_DEFAULT_PORT;
+        }
+        else if (equalCase_Rangecc(parts.scheme, "gopher")) {
+            port = 70;
+        }
+        else if (equalCase_Rangecc(parts.scheme, "finger")) {
+            port = 79;
+        }
+        else {
+            return; /* not a network request */
+        }
+    }
+    prefetch_Resolver(collect_String(newRange_String(parts.host)), port);
+}
+
+iAddress *lookup_Resolver(const iString *host, uint16_t port) {
+    iResolver *d = &resolver_;
+    iAddress *address = NULL;
+    lock_Mutex(d->mtx);
+    const iResolverEntry *entry = entry_Resolver_(d, host, port, iFalse);
+    if (entry && !isPending_Address(entry->address) && isHostFound_Address(entry->address)) {
+        address = ref_Object(entry->address);
+    }
+    unlock_Mutex(d->mtx);
+    return address;
+}
+
+iBool isUnresolvable_Resolver(const iString *host, uint16_t port) {
+    iResolver *d = &resolver_;
+    iBool notFound = iFalse;
+    lock_Mutex(d->mtx);
+    const iResolverEntry *entry = entry_Resolver_(d, host, port, iFalse);
+    if (entry && !isPending_Address(entry->address) && !isHostFound_Address(entry->address)) {
+        notFound = iTrue;
+    }
+    unlock_Mutex(d->mtx);
+    return notFound;
+}
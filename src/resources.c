@@ -23,11 +23,13 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "resources.h"
 
 #include <the_Foundation/archive.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/version.h>
 
 #include <SDL_rwops.h>
 
 static iArchive *archive_;
+static iMutex    loadMutex_;
     
 iBlock blobAbout_Resources;
 iBlock blobHelp_Resources;
@@ -63,37 +65,38 @@ iBlock imageLagrange64_Resources;
 static struct {
     iBlock *data;
     const char *archivePath;
+    iBool isLoaded; /* entries are decompressed when first used */
 } entries_[] = {
-    { &blobAbout_Resources, "about/about.gmi" },
-    { &blobHelp_Resources, "about/help.gmi" },
-    { &blobLagrange_Resources, "about/lagrange.gmi" },
-    { &blobLicense_Resources, "about/license.gmi" },
-    { &blobVersion_Resources, "about/version.gmi" },
-    { &blobArghelp_Resources, "arg-help.txt" },
-    { &blobCs_Resources, "lang/cs.bin" },
-    { &blobDe_Resources, "lang/de.bin" },
-    { &blobEn_Resources, "lang/en.bin" },
-    { &blobEo_Resources, "lang/eo.bin" },
-    { &blobEs_Resources, "lang/es.bin" },
-    { &blobEs_MX_Resources, "lang/es_MX.bin" },
-    { &blobFi_Resources, "lang/fi.bin" },
-    { &blobFr_Resources, "lang/fr.bin" },
-    { &blobGl_Resources, "lang/gl.bin" },
-    { &blobHu_Resources, "lang/hu.bin" },
-    { &blobIa_Resources, "lang/ia.bin" },
-    { &blobIe_Resources, "lang/ie.bin" },
-    { &blobIsv_Resources, "lang/isv.bin" },
-    { &blobPl_Resources, "lang/pl.bin" },
-    { &blobRu_Resources, "lang/ru.bin" },
-    { &blobSk_Resources, "lang/sk.bin" },
-    { &blobSr_Resources, "lang/sr.bin" },
-    { &blobTok_Resources, "lang/tok.bin" },
-    { &blobTr_Resources, "lang/tr.bin" },
-    { &blobUk_Resources, "lang/uk.bin" },
-    { &blobZh_Hans_Resources, "lang/zh_Hans.bin" },
-    { &blobZh_Hant_Resources, "lang/zh_Hant.bin" },
-    { &imageShadow_Resources, "shadow.png" },
-    { &imageLagrange64_Resources, "lagrange-64.png" },
+    { &blobAbout_Resources, "about/about.gmi", iFalse },
+    { &blobHelp_Resources, "about/help.gmi", iFalse },
+    { &blobLagrange_Resources, "about/lagrange.gmi", iFalse },
+    { &blobLicense_Resources, "about/license.gmi", iFalse },
+    { &blobVersion_Resources, "about/version.gmi", iFalse },
+    { &blobArghelp_Resources, "arg-help.txt", iFalse },
+    { &blobCs_Resources, "lang/cs.bin", iFalse },
+    { &blobDe_Resources, "lang/de.bin", iFalse },
+    { &blobEn_Resources, "lang/en.bin", iFalse },
+    { &blobEo_Resources, "lang/eo.bin", iFalse },
+    { &blobEs_Resources, "lang/es.bin", iFalse },
+    { &blobEs_MX_Resources, "lang/es_MX.bin", iFalse },
+    { &blobFi_Resources, "lang/fi.bin", iFalse },
+    { &blobFr_Resources, "lang/fr.bin", iFalse },
+    { &blobGl_Resources, "lang/gl.bin", iFalse },
+    { &blobHu_Resources, "lang/hu.bin", iFalse },
+    { &blobIa_Resources, "lang/ia.bin", iFalse },
+    { &blobIe_Resources, "lang/ie.bin", iFalse },
+    { &blobIsv_Resources, "lang/isv.bin", iFalse },
+    { &blobPl_Resources, "lang/pl.bin", iFalse },
+    { &blobRu_Resources, "lang/ru.bin", iFalse },
+    { &blobSk_Resources, "lang/sk.bin", iFalse },
+    { &blobSr_Resources, "lang/sr.bin", iFalse },
+    { &blobTok_Resources, "lang/tok.bin", iFalse },
+    { &blobTr_Resources, "lang/tr.bin", iFalse },
+    { &blobUk_Resources, "lang/uk.bin", iFalse },
+    { &blobZh_Hans_Resources, "lang/zh_Hans.bin", iFalse },
+    { &blobZh_Hant_Resources, "lang/zh_Hant.bin", iFalse },
+    { &imageShadow_Resources, "shadow.png", iFalse },
+    { &imageLagrange64_Resources, "lagrange-64.png", iFalse },
 };
 
 iBool init_Resources(const char *path) {
@@ -119,11 +122,10 @@ iBool init_Resources(const char *path) {
         iVersion resVer;
         init_Version(&resVer, range_Block(dataCStr_Archive(archive_, "VERSION")));
         if (!cmp_Version(&resVer, &appVer)) {
+            init_Mutex(&loadMutex_);
             iForIndices(i, entries_) {
-                const iBlock *data = dataCStr_Archive(archive_, entries_[i].archivePath);
-                if (data) {
-                    initCopy_Block(entries_[i].data, data);
-                }
+                init_Block(entries_[i].data, 0);
+                entries_[i].isLoaded = iFalse;
             }
             return iTrue;
         }
@@ -138,9 +140,28 @@ void deinit_Resources(void) {
     iForIndices(i, entries_) {
         deinit_Block(entries_[i].data);
     }
+    deinit_Mutex(&loadMutex_);
     iRelease(archive_);
 }
 
+const iBlock *load_Resources(const iBlock *resource) {
+    iForIndices(i, entries_) {
+        if (entries_[i].data == resource) {
+            lock_Mutex(&loadMutex_);
+            if (!entries_[i].isLoaded) {
+                const iBlock *data = dataCStr_Archive(archive_, entries_[i].archivePath);
+                if (data) {
+                    set_Block(entries_[i].data, data);
+                }
+                entries_[i].isLoaded = iTrue;
+            }
+            unlock_Mutex(&loadMutex_);
+            break;
+        }
+    }
+    return resource;
+}
+
 const iArchive *archive_Resources(void) {
     return archive_;
 }
@@ -30,6 +30,7 @@ iBool               init_Resources      (const char *path);
 void                deinit_Resources    (void);
 
 const iArchive *    archive_Resources   (void);
+const iBlock *      load_Resources      (const iBlock *resource); /* decompressed on first use */
 
 extern iBlock blobAbout_Resources;
 extern iBlock blobHelp_Resources;
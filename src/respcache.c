@@ -0,0 +1,332 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+#include "respcache.h"
+#include "prefs.h"
+#include "defs.h"
+#include "app.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/path.h>
+#include <the_Foundation/sortedarray.h>
+
+static const char *magic_ResponseCache_      = "lgRC";
+static const char *indexFilename_ResponseCache_ = "index.txt";
+static const size_t diskSizeFactor_ResponseCache_ = 4; /* times the memory cache size */
+
+iDeclareType(ResponseCacheItem)
+
+struct Impl_ResponseCacheItem {
+    uint64_t key;
+    uint64_t size;     /* bytes on disk */
+    uint64_t lastUsed; /* seconds */
+    iResponseCacheItem *prev, *next; /* least recently used first */
+};
+
+static int cmp_ResponseCacheItemPtr_(const void *a, const void *b) {
+    return iCmp((*(const iResponseCacheItem **) a)->key,
+                (*(const iResponseCacheItem **) b)->key);
+}
+
+static int cmpLastUsed_ResponseCacheItemPtr_(const void *a, const void *b) {
+    return iCmp((*(const iResponseCacheItem **) a)->lastUsed,
+                (*(const iResponseCacheItem **) b)->lastUsed);
+}
+
+iDeclareType(ResponseCache)
+
+struct Impl_ResponseCache {
+    iMutex *     mtx;
+    iString      dir;
+    iSortedArray items; /* pointers, sorted by key */
+    iResponseCacheItem *oldest;
+    iResponseCacheItem *newest;
+    uint64_t     totalSize;
+    iBool        isIndexChanged; /* written when flushed or at shutdown */
+};
+
+static iResponseCache cache_;
+
+static uint64_t key_ResponseCache_(const iGmResponse *resp) {
+    /* FNV-1a over the meta and body. */
+    uint64_t hash = 0xcbf29ce484222325ull;
+    const iBlock *parts[2] = { &resp->meta.chars, &resp->body };
+    for (size_t p = 0; p < iElemCount(parts); p++) {
+        const uint8_t *bytes = constData_Block(parts[p]);
+        for (size_t i = 0; i < size_Block(parts[p]); i++) {
+            hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+        }
+        hash = (hash ^ 0xff) * 0x100000001b3ull; /* separator */
+    }
+    return hash ? hash : 1;
+}
+
+static const iString *path_ResponseCache_(const iResponseCache *d, uint64_t key) {
+    return collect_String(concat_Path(
+        &d->dir, collectNewFormat_String("%016llx.resp", (unsigned long long) key)));
+}
+
+static size_t maxSize_ResponseCache_(void) {
+    return diskSizeFactor_ResponseCache_ * (size_t) prefs_App()->maxCacheSize * 1000000;
+}
+
+static uint64_t now_ResponseCache_(void) {
+    iTime now;
+    initCurrent_Time(&now);
+    return integralSeconds_Time(&now);
+}
+
+static iBool locate_ResponseCache_(const iResponseCache *d, uint64_t key, size_t *pos) {
+    const iResponseCacheItem item = { .key = key };
+    const iResponseCacheItem *ptr = &item;
+    return locate_SortedArray(&d->items, &ptr, pos);
+}
+
+static iResponseCacheItem *find_ResponseCache_(iResponseCache *d, uint64_t key) {
+    size_t pos;
+    if (locate_ResponseCache_(d, key, &pos)) {
+        return *(iResponseCacheItem **) at_SortedArray(&d->items, pos);
+    }
+    return NULL;
+}
+
+static void unlink_ResponseCache_(iResponseCache *d, iResponseCacheItem *item) {
+    if (item->prev) item->prev->next = item->next; else d->oldest = item->next;
+    if (item->next) item->next->prev = item->prev; else d->newest = item->prev;
+    item->prev = item->next = NULL;
+}
+
+static void append_ResponseCache_(iResponseCache *d, iResponseCacheItem *item) {
+    item->prev = d->newest;
+    item->next = NULL;
+    if (d->newest) d->newest->next = item; else d->oldest = item;
+    d->newest = item;
+}
+
+static void touch_ResponseCache_(iResponseCache *d, iResponseCacheItem *item) {
+    item->lastUsed = now_ResponseCache_();
+    unlink_ResponseCache_(d, item);
+    append_ResponseCache_(d, item);
+    d->isIndexChanged = iTrue;
+}
+
+static void remove_ResponseCache_(iResponseCache *d, iResponseCacheItem *item) {
+    size_t pos;
+    if (locate_ResponseCache_(d, item->key, &pos)) {
+        remove_Array(&d->items.values, pos);
+    }
+    remove(cstr_String(path_ResponseCache_(d, item->key)));
+    d->totalSize -= iMin(d->totalSize, item->size);
+    unlink_ResponseCache_(d, item);
+    free(item);
+    d->isIndexChanged = iTrue;
+}
+
+static void evict_ResponseCache_(iResponseCache *d) {
+    /* Least recently used first. */
+    const size_t maxSize = maxSize_ResponseCache_();
+    while (d->totalSize > maxSize && d->oldest) {
+        remove_ResponseCache_(d, d->oldest);
+    }
+}
+
+static void loadIndex_ResponseCache_(iResponseCache *d) {
+    iFile *f = new_File(collect_String(concatCStr_Path(&d->dir, indexFilename_ResponseCache_)));
+    if (open_File(f, readOnly_FileMode | text_FileMode)) {
+        const iRangecc src  = range_Block(collect_Block(readAll_File(f)));
+        iRangecc       line = iNullRange;
+        iArray         byAge;
+        init_Array(&byAge, sizeof(iResponseCacheItem *));
+        while (nextSplit_Rangecc(src, "\n", &line)) {
+            unsigned long long key = 0, size = 0, lastUsed = 0;
+            if (sscanf(line.start, "%llx %llu %llu", &key, &size, &lastUsed) == 3 && key &&
+                !find_ResponseCache_(d, key)) {
+                iResponseCacheItem *item = calloc(1, sizeof(iResponseCacheItem));
+                item->key      = key;
+                item->size     = size;
+                item->lastUsed = lastUsed;
+                insert_SortedArray(&d->items, &item);
+                pushBack_Array(&byAge, &item);
+                d->totalSize += size;
+            }
+        }
+        sort_Array(&byAge, cmpLastUsed_ResponseCacheItemPtr_);
+        iConstForEach(Array, i, &byAge) {
+            append_ResponseCache_(d, *(iResponseCacheItem **) i.value);
+        }
+        deinit_Array(&byAge);
+    }
+    iRelease(f);
+}
+
+static void saveIndex_ResponseCache_(iResponseCache *d) {
+    iFile *f = new_File(collect_String(concatCStr_Path(&d->dir, indexFilename_ResponseCache_)));
+    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
+        iString *line = new_String();
+        for (const iResponseCacheItem *item = d->oldest; item; item = item->next) {
+            format_String(line, "%016llx %llu %llu\n",
+                          (unsigned long long) item->key,
+                          (unsigned long long) item->size,
+                          (unsigned long long) item->lastUsed);
+            write_File(f, utf8_String(line));
+        }
+        delete_String(line);
+        d->isIndexChanged = iFalse;
+    }
+    iRelease(f);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+void init_ResponseCache(const char *dir) {
+    iResponseCache *d = &cache_;
+    d->mtx = new_Mutex();
+    initCStr_String(&d->dir, dir);
+    init_SortedArray(&d->items, sizeof(iResponseCacheItem *), cmp_ResponseCacheItemPtr_);
+    d->oldest         = NULL;
+    d->newest         = NULL;
+    d->totalSize      = 0;
+    d->isIndexChanged = iFalse;
+    makeDirs_Path(&d->dir);
+    loadIndex_ResponseCache_(d);
+}
+
+void deinit_ResponseCache(void) {
+    iResponseCache *d = &cache_;
+    lock_Mutex(d->mtx);
+    evict_ResponseCache_(d);
+    if (d->isIndexChanged) {
+        saveIndex_ResponseCache_(d);
+    }
+    while (d->oldest) {
+        iResponseCacheItem *item = d->oldest;
+        d->oldest = item->next;
+        free(item);
+    }
+    d->newest = NULL;
+    deinit_SortedArray(&d->items);
+    deinit_String(&d->dir);
+    unlock_Mutex(d->mtx);
+    delete_Mutex(d->mtx);
+}
+
+void flush_ResponseCache(void) {
+    iResponseCache *d = &cache_;
+    lock_Mutex(d->mtx);
+    if (d->isIndexChanged) {
+        saveIndex_ResponseCache_(d);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+uint64_t store_ResponseCache(const iGmResponse *resp) {
+    iResponseCache *d = &cache_;
+    if (!resp || maxSize_ResponseCache_() == 0) {
+        return 0;
+    }
+    const uint64_t key = key_ResponseCache_(resp);
+    lock_Mutex(d->mtx);
+    iResponseCacheItem *item = find_ResponseCache_(d, key);
+    if (item) {
+        /* Same contents are already stored. */
+        touch_ResponseCache_(d, item);
+        unlock_Mutex(d->mtx);
+        return key;
+    }
+    uint64_t stored = 0;
+    iFile *f = new_File(path_ResponseCache_(d, key));
+    if (open_File(f, writeOnly_FileMode)) {
+        writeData_File(f, magic_ResponseCache_, 4);
+        writeU32_File(f, latest_FileVersion);
+        setVersion_Stream(stream_File(f), latest_FileVersion);
+        serialize_GmResponse(resp, stream_File(f));
+        item = calloc(1, sizeof(iResponseCacheItem));
+        item->key      = key;
+        item->size     = pos_Stream(stream_File(f));
+        item->lastUsed = now_ResponseCache_();
+        close_File(f);
+        insert_SortedArray(&d->items, &item);
+        append_ResponseCache_(d, item);
+        d->totalSize += item->size;
+        d->isIndexChanged = iTrue;
+        stored = key;
+        evict_ResponseCache_(d);
+        if (!find_ResponseCache_(d, key)) {
+            stored = 0; /* too large */
+        }
+    }
+    iRelease(f);
+    unlock_Mutex(d->mtx);
+    return stored;
+}
+
+void remove_ResponseCache(uint64_t key) {
+    iResponseCache *d = &cache_;
+    lock_Mutex(d->mtx);
+    iResponseCacheItem *item = find_ResponseCache_(d, key);
+    if (item) {
+        remove_ResponseCache_(d, item);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+iBool contains_ResponseCache(uint64_t key) {
+    iResponseCache *d = &cache_;
+    iBool found;
+    iGuardMutex(d->mtx, found = (find_ResponseCache_(d, key) != NULL));
+    return found;
+}
+
+iGmResponse *load_ResponseCache(uint64_t key) {
+    iResponseCache *d = &cache_;
+    iGmResponse *resp = NULL;
+    lock_Mutex(d->mtx);
+    iResponseCacheItem *item = find_ResponseCache_(d, key);
+    if (item) {
+        iFile *f = new_File(path_ResponseCache_(d, key));
+        char magic[4];
+        if (open_File(f, readOnly_FileMode) && readData_File(f, 4, magic) == 4 &&
+            !memcmp(magic, magic_ResponseCache_, 4)) {
+            const uint32_t version = readU32_File(f);
+            if (version <= latest_FileVersion) {
+                setVersion_Stream(stream_File(f), version);
+                resp = new_GmResponse();
+                deserialize_GmResponse(resp, stream_File(f));
+                touch_ResponseCache_(d, item);
+            }
+        }
+        iRelease(f);
+        if (!resp) {
+            /* The file is missing or unusable. */
+            remove_ResponseCache_(d, item);
+        }
+    }
+    unlock_Mutex(d->mtx);
+    return resp;
+}
+
+size_t size_ResponseCache(void) {
+    iResponseCache *d = &cache_;
+    size_t size;
+    iGuardMutex(d->mtx, size = d->totalSize);
+    return size;
+}
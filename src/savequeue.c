@@ -0,0 +1,203 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "savequeue.h"
+
+#include <the_Foundation/file.h>
+#include <the_Foundation/mutex.h>
+#include <the_Foundation/ptrarray.h>
+#include <the_Foundation/string.h>
+#include <the_Foundation/thread.h>
+#include <stdio.h>
+
+iDeclareType(SaveJob)
+iDeclareType(SaveQueue)
+
+struct Impl_SaveJob {
+    iString path;
+    iBlock  data;
+    iBool   isAppend;
+};
+
+static void init_SaveJob(iSaveJob *d, const char *path, const iBlock *data, iBool isAppend) {
+    initCStr_String(&d->path, path);
+    initCopy_Block(&d->data, data);
+    d->isAppend = isAppend;
+}
+
+static void deinit_SaveJob(iSaveJob *d) {
+    deinit_Block(&d->data);
+    deinit_String(&d->path);
+}
+
+iDefineTypeConstructionArgs(SaveJob,
+                            (const char *path, const iBlock *data, iBool isAppend),
+                            path, data, isAppend)
+
+static void run_SaveJob_(const iSaveJob *d) {
+    if (d->isAppend) {
+        iFile *f = new_File(&d->path);
+        if (open_File(f, append_FileMode)) {
+            write_File(f, &d->data);
+        }
+        else {
+            fprintf(stderr, "[SaveQueue] failed to append to %s\n", cstr_String(&d->path));
+        }
+        iRelease(f);
+        return;
+    }
+    /* The old file remains intact until the new contents have been fully written. */
+    iString *tmpPath = newFormat_String("%s.tmp", cstr_String(&d->path));
+    iFile *f = new_File(tmpPath);
+    iBool written = iFalse;
+    if (open_File(f, writeOnly_FileMode)) {
+        written = writeData_File(f, constData_Block(&d->data), size_Block(&d->data)) ==
+                  size_Block(&d->data);
+        close_File(f);
+    }
+    iRelease(f);
+    if (written) {
+#if defined (iPlatformMsys)
+        remove(cstr_String(&d->path)); /* rename doesn't replace existing files */
+#endif
+        written = rename(cstr_String(tmpPath), cstr_String(&d->path)) == 0;
+    }
+    if (!written) {
+        fprintf(stderr, "[SaveQueue] failed to write %s\n", cstr_String(&d->path));
+    }
+    delete_String(tmpPath);
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+struct Impl_SaveQueue {
+    iMutex     mtx;
+    iCondition jobAvailable;
+    iCondition idle;
+    iPtrArray  jobs; /* at most one per file, written in order of last queuing */
+    iThread *  thread;
+    iBool      isBusy;
+    iBool      isQuitting;
+};
+
+static iSaveQueue saveQueue_;
+
+static iThreadResult run_SaveQueue_(iThread *thread) {
+    iSaveQueue *d = userData_Thread(thread);
+    lock_Mutex(&d->mtx);
+    for (;;) {
+        while (isEmpty_PtrArray(&d->jobs) && !d->isQuitting) {
+            wait_Condition(&d->jobAvailable, &d->mtx);
+        }
+        if (isEmpty_PtrArray(&d->jobs)) {
+            break; /* quitting, and everything has been written */
+        }
+        iSaveJob *job = NULL;
+        take_PtrArray(&d->jobs, 0, (void **) &job);
+        d->isBusy = iTrue;
+        unlock_Mutex(&d->mtx);
+        run_SaveJob_(job);
+        delete_SaveJob(job);
+        lock_Mutex(&d->mtx);
+        d->isBusy = iFalse;
+        if (isEmpty_PtrArray(&d->jobs)) {
+            signal_Condition(&d->idle);
+        }
+    }
+    unlock_Mutex(&d->mtx);
+    return 0;
+}
+
+void init_SaveQueue(void) {
+    iSaveQueue *d = &saveQueue_;
+    init_Mutex(&d->mtx);
+    init_Condition(&d->jobAvailable);
+    init_Condition(&d->idle);
+    init_PtrArray(&d->jobs);
+    d->isBusy     = iFalse;
+    d->isQuitting = iFalse;
+    d->thread     = new_Thread(run_SaveQueue_);
+    setUserData_Thread(d->thread, d);
+    start_Thread(d->thread);
+}
+
+void deinit_SaveQueue(void) {
+    iSaveQueue *d = &saveQueue_;
+    lock_Mutex(&d->mtx);
+    d->isQuitting = iTrue;
+    signal_Condition(&d->jobAvailable);
+    unlock_Mutex(&d->mtx);
+    join_Thread(d->thread);
+    iRelease(d->thread);
+    iAssert(isEmpty_PtrArray(&d->jobs));
+    deinit_PtrArray(&d->jobs);
+    deinit_Condition(&d->idle);
+    deinit_Condition(&d->jobAvailable);
+    deinit_Mutex(&d->mtx);
+}
+
+static void enqueue_SaveQueue_(iSaveQueue *d, const char *path, const iBlock *data,
+                               iBool isAppend) {
+    lock_Mutex(&d->mtx);
+    iAssert(!d->isQuitting);
+    iForEach(PtrArray, i, &d->jobs) {
+        iSaveJob *job = i.ptr;
+        if (!cmp_String(&job->path, path)) {
+            /* The file hasn't been written yet, so the new data can be combined. The job
+               moves to the back of the queue: files written together, like a snapshot and
+               the header of its journal, must reach the disk in the order they were queued. */
+            if (isAppend) {
+                append_Block(&job->data, data);
+            }
+            else {
+                set_Block(&job->data, data);
+                job->isAppend = iFalse;
+            }
+            remove_PtrArrayIterator(&i);
+            pushBack_PtrArray(&d->jobs, job);
+            unlock_Mutex(&d->mtx);
+            return;
+        }
+    }
+    pushBack_PtrArray(&d->jobs, new_SaveJob(path, data, isAppend));
+    signal_Condition(&d->jobAvailable);
+    unlock_Mutex(&d->mtx);
+}
+
+void write_SaveQueue(const char *path, const iBlock *data) {
+    enqueue_SaveQueue_(&saveQueue_, path, data, iFalse);
+}
+
+void append_SaveQueue(const char *path, const iBlock *data) {
+    if (!isEmpty_Block(data)) {
+        enqueue_SaveQueue_(&saveQueue_, path, data, iTrue);
+    }
+}
+
+void flush_SaveQueue(void) {
+    iSaveQueue *d = &saveQueue_;
+    lock_Mutex(&d->mtx);
+    while (!isEmpty_PtrArray(&d->jobs) || d->isBusy) {
+        wait_Condition(&d->idle, &d->mtx);
+    }
+    unlock_Mutex(&d->mtx);
+}
@@ -21,6 +21,7 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "sitespec.h"
+#include "savequeue.h"
 
 #include <the_Foundation/file.h>
 #include <the_Foundation/path.h>
@@ -57,6 +58,10 @@ struct Impl_SiteSpec {
     iString     saveDir;
     iStringHash sites;
     iSiteParams *loadParams;
+    /* The same site is usually looked up many times in a row. */
+    iString     lastSite; /* as given, before case folding */
+    const iSiteParams *lastParams;
+    iBool       isLastValid;
 };
 
 static iSiteSpec   siteSpec_;
@@ -146,30 +151,38 @@ static iBool load_SiteSpec_(iSiteSpec *d) {
     return ok;
 }
 
+static const iSiteParams *find_SiteSpec_(iSiteSpec *d, iRangecc site) {
+    if (!d->isLastValid || !equal_Rangecc(site, cstr_String(&d->lastSite))) {
+        setRange_String(&d->lastSite, site);
+        iString *key = lower_String(&d->lastSite);
+        d->lastParams  = constValue_StringHash(&d->sites, key);
+        d->isLastValid = iTrue;
+        delete_String(key);
+    }
+    return d->lastParams;
+}
+
 static void save_SiteSpec_(iSiteSpec *d) {
-    iFile *f = new_File(collect_String(concatCStr_Path(&d->saveDir, fileName_SiteSpec_)));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        iString *buf = new_String();
-        iConstForEach(StringHash, i, &d->sites) {
-            const iBlock *     key    = &i.value->keyBlock;
-            const iSiteParams *params = i.value->object;
-            format_String(buf, "[%s]\n", cstr_Block(key));
-            if (params->titanPort) {
-                appendFormat_String(buf, "titanPort = %u\n", params->titanPort);
-            }
-            if (!isEmpty_String(&params->titanIdentity)) {
-                appendFormat_String(
-                    buf, "titanIdentity = \"%s\"\n", cstr_String(&params->titanIdentity));
-            }
-            if (params->dismissWarnings) {
-                appendFormat_String(buf, "dismissWarnings = 0x%x\n", params->dismissWarnings);
-            }
-            appendCStr_String(buf, "\n");
-            write_File(f, utf8_String(buf));
+    iString *buf = new_String();
+    iConstForEach(StringHash, i, &d->sites) {
+        const iBlock *     key    = &i.value->keyBlock;
+        const iSiteParams *params = i.value->object;
+        appendFormat_String(buf, "[%s]\n", cstr_Block(key));
+        if (params->titanPort) {
+            appendFormat_String(buf, "titanPort = %u\n", params->titanPort);
         }
-        delete_String(buf);
+        if (!isEmpty_String(&params->titanIdentity)) {
+            appendFormat_String(
+                buf, "titanIdentity = \"%s\"\n", cstr_String(&params->titanIdentity));
+        }
+        if (params->dismissWarnings) {
+            appendFormat_String(buf, "dismissWarnings = 0x%x\n", params->dismissWarnings);
+        }
+        appendCStr_String(buf, "\n");
     }
-    iRelease(f);
+    write_SaveQueue(cstrCollect_String(concatCStr_Path(&d->saveDir, fileName_SiteSpec_)),
+                    utf8_String(buf));
+    delete_String(buf);
 }
 
 void init_SiteSpec(const char *saveDir) {
@@ -177,6 +190,9 @@ void init_SiteSpec(const char *saveDir) {
     d->loadParams = NULL;
     init_StringHash(&d->sites);
     initCStr_String(&d->saveDir, saveDir);
+    init_String(&d->lastSite);
+    d->lastParams  = NULL;
+    d->isLastValid = iFalse;
     if (!load_SiteSpec_(d)) {
         loadOldFormat_SiteSpec_(d);
     }
@@ -185,6 +201,7 @@ void init_SiteSpec(const char *saveDir) {
 void deinit_SiteSpec(void) {
     iSiteSpec *d = &siteSpec_;
     deinit_StringHash(&d->sites);
+    deinit_String(&d->lastSite);
     deinit_String(&d->saveDir);
 }
 
@@ -195,6 +212,7 @@ void setValue_SiteSpec(const iString *site, enum iSiteSpecKey key, int value) {
     if (!params) {
         params = new_SiteParams();
         insert_StringHash(&d->sites, hashKey, params);
+        d->isLastValid = iFalse;
     }
     iBool needSave = iFalse;
     switch (key) {
@@ -221,6 +239,7 @@ void setValueString_SiteSpec(const iString *site, enum iSiteSpecKey key, const i
     if (!params) {
         params = new_SiteParams();
         insert_StringHash(&d->sites, hashKey, params);
+        d->isLastValid = iFalse;
     }
     iBool needSave = iFalse;
     switch (key) {
@@ -239,8 +258,11 @@ void setValueString_SiteSpec(const iString *site, enum iSiteSpecKey key, const i
 }
 
 int value_SiteSpec(const iString *site, enum iSiteSpecKey key) {
-    iSiteSpec *d = &siteSpec_;
-    const iSiteParams *params = constValue_StringHash(&d->sites, collect_String(lower_String(site)));
+    return valueRange_SiteSpec(range_String(site), key);
+}
+
+int valueRange_SiteSpec(iRangecc site, enum iSiteSpecKey key) {
+    const iSiteParams *params = find_SiteSpec_(&siteSpec_, site);
     if (!params) {
         return 0;
     }
@@ -255,8 +277,7 @@ int value_SiteSpec(const iString *site, enum iSiteSpecKey key) {
 }
 
 const iString *valueString_SiteSpec(const iString *site, enum iSiteSpecKey key) {
-    iSiteSpec *d = &siteSpec_;
-    const iSiteParams *params = constValue_StringHash(&d->sites, collect_String(lower_String(site)));
+    const iSiteParams *params = find_SiteSpec_(&siteSpec_, range_String(site));
     if (!params) {
         return 0;
     }
@@ -40,4 +40,5 @@ void    setValue_SiteSpec       (const iString *site, enum iSiteSpecKey key, int
 void    setValueString_SiteSpec (const iString *site, enum iSiteSpecKey key, const iString *value);
 
 int             value_SiteSpec          (const iString *site, enum iSiteSpecKey key);
+int             valueRange_SiteSpec     (iRangecc site, enum iSiteSpecKey key);
 const iString * valueString_SiteSpec    (const iString *site, enum iSiteSpecKey key);
@@ -0,0 +1,271 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "sourcescan.h"
+
+#include <stdint.h>
+#include <string.h>
+
+#if defined (__SSE2__) || defined (_M_X64) || (defined (_M_IX86_FP) && _M_IX86_FP >= 2)
+#   include <emmintrin.h>
+#   define LAGRANGE_SCAN_SSE2
+#elif defined (__ARM_NEON) || defined (__aarch64__)
+#   include <arm_neon.h>
+#   define LAGRANGE_SCAN_NEON
+#endif
+
+#define chunkSize_SourceScanner_ 16
+
+iDeclareType(ScanMasks)
+
+/* One bit per byte of the chunk (four with NEON), set where the byte is of the kind. */
+struct Impl_ScanMasks {
+    uint64_t newline;
+    uint64_t tabs;     /* \t \v */
+    uint64_t space;    /* normalizable: ' ' \t */
+    uint64_t escape;
+    uint64_t nonAscii;
+};
+
+#if defined (LAGRANGE_SCAN_SSE2)
+
+static const int stride_ScanMasks_ = 1;
+
+iLocalDef uint64_t mask_(__m128i cmp) {
+    return (uint64_t) _mm_movemask_epi8(cmp);
+}
+
+static void load_ScanMasks_(iScanMasks *d, const char *ptr) {
+    const __m128i v = _mm_loadu_si128((const __m128i *) ptr);
+    const __m128i tab = _mm_cmpeq_epi8(v, _mm_set1_epi8('\t'));
+    d->newline  = mask_(_mm_cmpeq_epi8(v, _mm_set1_epi8('\n')));
+    d->tabs     = mask_(_mm_or_si128(tab, _mm_cmpeq_epi8(v, _mm_set1_epi8('\v'))));
+    d->space    = mask_(_mm_or_si128(tab, _mm_cmpeq_epi8(v, _mm_set1_epi8(' '))));
+    d->escape   = mask_(_mm_cmpeq_epi8(v, _mm_set1_epi8(0x1b)));
+    d->nonAscii = mask_(v); /* high bits */
+}
+
+#elif defined (LAGRANGE_SCAN_NEON)
+
+static const int stride_ScanMasks_ = 4; /* there is no movemask; narrowing gives nibbles */
+
+iLocalDef uint64_t mask_(uint8x16_t cmp) {
+    return vget_lane_u64(vreinterpret_u64_u8(vshrn_n_u16(vreinterpretq_u16_u8(cmp), 4)), 0);
+}
+
+static void load_ScanMasks_(iScanMasks *d, const char *ptr) {
+    const uint8x16_t v   = vld1q_u8((const uint8_t *) ptr);
+    const uint8x16_t tab = vceqq_u8(v, vdupq_n_u8('\t'));
+    d->newline  = mask_(vceqq_u8(v, vdupq_n_u8('\n')));
+    d->tabs     = mask_(vorrq_u8(tab, vceqq_u8(v, vdupq_n_u8('\v'))));
+    d->space    = mask_(vorrq_u8(tab, vceqq_u8(v, vdupq_n_u8(' '))));
+    d->escape   = mask_(vceqq_u8(v, vdupq_n_u8(0x1b)));
+    d->nonAscii = mask_(vcgeq_u8(v, vdupq_n_u8(0x80)));
+}
+
+#else
+
+static const int stride_ScanMasks_ = 1;
+
+static void load_ScanMasks_(iScanMasks *d, const char *ptr) {
+    iZap(*d);
+    for (int i = 0; i < chunkSize_SourceScanner_; i++) {
+        const uint8_t  ch  = (uint8_t) ptr[i];
+        const uint64_t bit = (uint64_t) 1 << i;
+        if (ch == '\n') d->newline |= bit;
+        if (ch == '\t' || ch == '\v') d->tabs |= bit;
+        if (ch == '\t' || ch == ' ') d->space |= bit;
+        if (ch == 0x1b) d->escape |= bit;
+        if (ch >= 0x80) d->nonAscii |= bit;
+    }
+}
+
+#endif
+
+iLocalDef int firstBit_(uint64_t bits) {
+    iAssert(bits != 0);
+#if defined (__GNUC__)
+    return __builtin_ctzll(bits);
+#else
+    int n = 0;
+    while (!(bits & 1)) {
+        bits >>= 1;
+        n++;
+    }
+    return n;
+#endif
+}
+
+iLocalDef uint64_t bytesBelow_(int count) {
+    /* Mask that covers the first `count` bytes of a chunk. */
+    const int numBits = count * stride_ScanMasks_;
+    return numBits >= 64 ? ~(uint64_t) 0 : (((uint64_t) 1 << numBits) - 1);
+}
+
+static int validSequenceSize_(const uint8_t *ptr, const uint8_t *end) {
+    /* Size of the valid UTF-8 sequence at `ptr`, or zero. Overlong encodings, surrogates,
+       and code points beyond U+10FFFF are not valid. */
+    const uint8_t ch = ptr[0];
+    uint8_t lo = 0x80, hi = 0xbf; /* allowed range of the second byte */
+    int size;
+    if (ch < 0x80) {
+        return 1;
+    }
+    if (ch >= 0xc2 && ch <= 0xdf) {
+        size = 2;
+    }
+    else if (ch >= 0xe0 && ch <= 0xef) {
+        size = 3;
+        if (ch == 0xe0) lo = 0xa0;
+        if (ch == 0xed) hi = 0x9f;
+    }
+    else if (ch >= 0xf0 && ch <= 0xf4) {
+        size = 4;
+        if (ch == 0xf0) lo = 0x90;
+        if (ch == 0xf4) hi = 0x8f;
+    }
+    else {
+        return 0;
+    }
+    if (end - ptr < size || ptr[1] < lo || ptr[1] > hi) {
+        return 0;
+    }
+    for (int i = 2; i < size; i++) {
+        if ((ptr[i] & 0xc0) != 0x80) {
+            return 0;
+        }
+    }
+    return size;
+}
+
+static iBool isValidUtf8_(iRangecc text) {
+    const uint8_t *ptr = (const uint8_t *) text.start;
+    const uint8_t *end = (const uint8_t *) text.end;
+    while (ptr < end) {
+        if (*ptr < 0x80) {
+            ptr++;
+            continue;
+        }
+        const int size = validSequenceSize_(ptr, end);
+        if (!size) {
+            return iFalse;
+        }
+        ptr += size;
+    }
+    return iTrue;
+}
+
+void appendValidUtf8_String(iString *d, iRangecc text) {
+    const uint8_t *ptr   = (const uint8_t *) text.start;
+    const uint8_t *end   = (const uint8_t *) text.end;
+    const uint8_t *valid = ptr; /* start of bytes not yet appended */
+    while (ptr < end) {
+        const int size = validSequenceSize_(ptr, end);
+        if (size) {
+            ptr += size;
+            continue;
+        }
+        appendData_Block(&d->chars, valid, ptr - valid);
+        appendCStr_String(d, "\xef\xbf\xbd"); /* U+FFFD REPLACEMENT CHARACTER */
+        valid = ++ptr;
+    }
+    appendData_Block(&d->chars, valid, ptr - valid);
+}
+
+void init_SourceScanner(iSourceScanner *d, iRangecc source) {
+    d->pos = source.start;
+    d->end = source.end;
+}
+
+iBool nextLine_SourceScanner(iSourceScanner *d, iRangecc *line_out, int *flags_out) {
+    if (d->pos >= d->end) {
+        return iFalse;
+    }
+    const char *ptr      = d->pos;
+    int         flags    = 0;
+    iBool       isSpace  = iFalse; /* last byte of the previous chunk */
+    iBool       nonAscii = iFalse;
+    for (;;) {
+        iScanMasks m;
+        const size_t avail = d->end - ptr;
+        int          count = chunkSize_SourceScanner_;
+        if (avail >= chunkSize_SourceScanner_) {
+            load_ScanMasks_(&m, ptr);
+        }
+        else {
+            /* Never read past the end; the padding is masked out below. */
+            char tail[chunkSize_SourceScanner_] = { 0 };
+            memcpy(tail, ptr, avail);
+            load_ScanMasks_(&m, tail);
+            count = (int) avail;
+        }
+        iBool isLineEnd = iFalse;
+        if (m.newline & bytesBelow_(count)) {
+            count     = firstBit_(m.newline) / stride_ScanMasks_;
+            isLineEnd = iTrue;
+        }
+        const uint64_t within = bytesBelow_(count);
+        const uint64_t space  = m.space & within;
+        if (m.tabs & within) {
+            flags |= tabs_SourceLineFlag;
+        }
+        if ((space & (space >> stride_ScanMasks_)) || (isSpace && (space & 1))) {
+            flags |= spaces_SourceLineFlag;
+        }
+        if (m.escape & within) {
+            flags |= escape_SourceLineFlag;
+        }
+        if (m.nonAscii & within) {
+            nonAscii = iTrue;
+        }
+        isSpace = count > 0 && (space & ((uint64_t) 1 << ((count - 1) * stride_ScanMasks_))) != 0;
+        ptr += count;
+        if (isLineEnd || ptr >= d->end) {
+            break;
+        }
+    }
+    *line_out = (iRangecc){ d->pos, ptr };
+    if (nonAscii && !isValidUtf8_(*line_out)) {
+        flags |= invalidUtf8_SourceLineFlag;
+    }
+    d->pos     = ptr < d->end ? ptr + 1 : ptr; /* skip the newline */
+    *flags_out = flags;
+    return iTrue;
+}
+
+iBool isAnsiEscape_SourceScanner(iRangecc line) {
+    /* Same as the pattern `\x1b[[()][0-9;AB]*?[ABCDEFGHJKSTfimn]`. */
+    for (const char *ch = line.start; ch < line.end; ch++) {
+        if (*ch != 0x1b || line.end - ch < 3 || !ch[1] || !strchr("[()", ch[1])) {
+            continue;
+        }
+        for (const char *seq = ch + 2; seq < line.end && *seq; seq++) {
+            if (strchr("ABCDEFGHJKSTfimn", *seq)) {
+                return iTrue;
+            }
+            if (!strchr("0123456789;", *seq)) {
+                break;
+            }
+        }
+    }
+    return iFalse;
+}
@@ -0,0 +1,50 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/string.h>
+
+iDeclareType(SourceScanner)
+
+/* What a line contains that normalization or the document warnings care about. */
+enum iSourceLineFlag {
+    tabs_SourceLineFlag        = iBit(1), /* tab or vertical tab characters */
+    spaces_SourceLineFlag      = iBit(2), /* consecutive whitespace to be collapsed */
+    escape_SourceLineFlag      = iBit(3), /* ESC bytes; may be ANSI escape sequences */
+    invalidUtf8_SourceLineFlag = iBit(4),
+};
+
+/* Splits a source into lines like `nextSplit_Rangecc(src, "\n", ...)` does, and flags each
+   line in the same pass. The bytes are examined 16 at a time, so lines with nothing to flag
+   cost little more than finding their end. Only lines with non-ASCII bytes are decoded for
+   UTF-8 validation. */
+struct Impl_SourceScanner {
+    const char *pos; /* start of the next line */
+    const char *end;
+};
+
+void    init_SourceScanner      (iSourceScanner *, iRangecc source);
+iBool   nextLine_SourceScanner  (iSourceScanner *, iRangecc *line_out, int *flags_out);
+
+iBool   isAnsiEscape_SourceScanner  (iRangecc line); /* finds an ANSI escape sequence */
+void    appendValidUtf8_String      (iString *, iRangecc text); /* invalid bytes as U+FFFD */
@@ -0,0 +1,63 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#include "trigrams.h"
+
+#include <the_Foundation/string.h>
+
+static uint8_t foldCase_(uint8_t ch) {
+    return ch >= 'A' && ch <= 'Z' ? ch + ('a' - 'A') : ch;
+}
+
+static void set_Trigrams_(iTrigrams *d, const uint8_t *chars) {
+    uint32_t hash = 2166136261u; /* FNV-1a */
+    for (int i = 0; i < 3; i++) {
+        hash = (hash ^ foldCase_(chars[i])) * 16777619u;
+    }
+    hash &= 127;
+    d->bits[hash >> 6] |= (uint64_t) 1 << (hash & 63);
+}
+
+void init_Trigrams(iTrigrams *d) {
+    d->bits[0] = d->bits[1] = 0;
+}
+
+void add_Trigrams(iTrigrams *d, iRangecc text) {
+    for (const uint8_t *ch = (const uint8_t *) text.start; ch + 2 < (const uint8_t *) text.end;
+         ch++) {
+        set_Trigrams_(d, ch);
+    }
+}
+
+void initWords_Trigrams(iTrigrams *d, iRangecc words) {
+    init_Trigrams(d);
+    iRangecc word = iNullRange;
+    while (nextSplit_Rangecc(words, " ", &word)) {
+        for (const uint8_t *ch = (const uint8_t *) word.start; ch + 2 < (const uint8_t *) word.end;
+             ch++) {
+            if ((ch[0] | ch[1] | ch[2]) & 0x80) {
+                continue; /* non-ASCII may be case folded differently when matching */
+            }
+            set_Trigrams_(d, ch);
+        }
+    }
+}
@@ -0,0 +1,44 @@
+/* Copyright 2021 Jaakko Keränen <jaakko.keranen@iki.fi>
+
+Redistribution and use in source and binary forms, with or without
+modification, are permitted provided that the following conditions are met:
+
+1. Redistributions of source code must retain the above copyright notice, this
+   list of conditions and the following disclaimer.
+2. Redistributions in binary form must reproduce the above copyright notice,
+   this list of conditions and the following disclaimer in the documentation
+   and/or other materials provided with the distribution.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS" AND
+ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE IMPLIED
+WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE ARE
+DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT OWNER OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR SERVICES;
+LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER CAUSED AND ON
+ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
+(INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE OF THIS
+SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
+
+#pragma once
+
+#include <the_Foundation/range.h>
+
+/* Compact signature of the trigrams of a short text, such as a URL or a title. Characters
+   are ASCII case folded. A search term whose trigrams are not all present in the signature
+   cannot occur in the text, so the text does not need to be matched against the term. */
+
+iDeclareType(Trigrams)
+
+struct Impl_Trigrams {
+    uint64_t bits[2];
+};
+
+void    init_Trigrams           (iTrigrams *);
+void    add_Trigrams            (iTrigrams *, iRangecc text);
+void    initWords_Trigrams      (iTrigrams *, iRangecc words); /* required by space-separated words */
+
+iLocalDef iBool contains_Trigrams(const iTrigrams *d, const iTrigrams *required) {
+    return (d->bits[0] & required->bits[0]) == required->bits[0] &&
+           (d->bits[1] & required->bits[1]) == required->bits[1];
+}
@@ -44,6 +44,10 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "media.h"
 #include "paint.h"
 #include "periodic.h"
+#include "prefetch.h"
+#include "profiler.h"
+#include "requestbroker.h"
+#include "resolver.h"
 #include "root.h"
 #include "mediaui.h"
 #include "scrollwidget.h"
@@ -73,6 +77,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <SDL_render.h>
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
 
 /*----------------------------------------------------------------------------------------------*/
 
@@ -198,16 +203,43 @@ static void visBufInvalidated_(iVisBuf *d, size_t index) {
 
 /*----------------------------------------------------------------------------------------------*/
 
+iDeclareType(RetainedImages)
+
+/* Which images were last told to keep their textures. The document is rescanned for nearby
+   images only when this no longer matches. */
+struct Impl_RetainedImages {
+    const iGmDocument *doc;
+    iRangei            range;
+    int                docHeight;
+    size_t             numImages;
+};
+
+/*----------------------------------------------------------------------------------------------*/
+
 static void animate_DocumentWidget_             (void *ticker);
 static void animateMedia_DocumentWidget_        (iDocumentWidget *d);
 static void updateSideIconBuf_DocumentWidget_   (const iDocumentWidget *d);
 static void prerender_DocumentWidget_           (iAny *);
+static void preload_DocumentWidget_             (iAny *);
+static void updateWorkingSet_DocumentWidget_    (iDocumentWidget *);
+static iBool updateDocumentWidthRetainingScrollPosition_DocumentWidget_(iDocumentWidget *d,
+                                                                        iBool keepCenter);
+static void continueLayout_DocumentWidget_      (iAny *);
+static void applyPendingScroll_DocumentWidget_  (iAny *);
+static void updateVisible_DocumentWidget_       (iDocumentWidget *d);
+static void invalidate_DocumentWidget_          (iDocumentWidget *d);
 static void scrollBegan_DocumentWidget_         (iAnyObject *, int, uint32_t);
 
 static const int smoothDuration_DocumentWidget_(enum iScrollType type) {
     return 600 /* milliseconds */ * scrollSpeedFactor_Prefs(prefs_App(), type);
 }
 
+static const size_t backgroundLayoutMinSize_DocumentWidget_ = 256 * 1024; /* bytes of source */
+static const uint32_t releaseDelay_DocumentWidget_ = 5000; /* ms before extra VisBuf tiles are freed */
+static const uint32_t wakeBudget_DocumentWidget_   = 30; /* ms to restore a hibernated tab */
+static const size_t   numWarmTabs_DocumentWidget_  = 3; /* background tabs kept rendered */
+static const uint32_t maxScrollPrediction_DocumentWidget_ = 50; /* ms since input for predicting */
+
 enum iRequestState {
     blank_RequestState,
     fetching_RequestState,
@@ -231,6 +263,10 @@ enum iDocumentWidgetFlag {
     urlChanged_DocumentWidgetFlag            = iBit(13),
     openedFromSidebar_DocumentWidgetFlag     = iBit(14),
     drawDownloadCounter_DocumentWidgetFlag   = iBit(15),
+    pendingRestore_DocumentWidgetFlag        = iBit(16), /* state loaded; page shown later */
+    keepAwake_DocumentWidgetFlag             = iBit(17), /* waking up took too long */
+    warm_DocumentWidgetFlag                  = iBit(18), /* in the working set; kept rendered */
+    restoringScroll_DocumentWidgetFlag       = iBit(19), /* `initNormScrollY` follows the layout */
 };
 
 enum iDocumentLinkOrdinalMode {
@@ -265,6 +301,9 @@ struct Impl_DocumentWidget {
     enum iRequestState state;
     iGmRequest *   request;
     iAtomicInt     isRequestUpdated; /* request has new content, need to parse it */
+    uint32_t       paintFlowId; /* traced request waiting to be drawn */
+    uint32_t       lastShownTime; /* SDL ticks */
+    unsigned       numTimesShown; /* switched to as the current tab */
     int            certFlags;
     iBlock *       certFingerprint;
     iDate          certExpiry;
@@ -280,6 +319,7 @@ struct Impl_DocumentWidget {
     iString        sourceMime;
     iBlock         sourceContent; /* original content as received, for saving; set on request finish */
     iTime          sourceTime;
+    iGmTiming      sourceTiming;
     iGempub *      sourceGempub; /* NULL unless the page is Gempub content */
     iGmDocument *  doc;
     iBanner *      banner;
@@ -287,10 +327,18 @@ struct Impl_DocumentWidget {
     /* Rendering: */
     int            pageMargin;
     float          initNormScrollY;
+    int            restoredScrollY; /* where `initNormScrollY` was last applied */
     iSmoothScroll  scrollY;
+    int            pendingScroll;   /* per-pixel input not yet applied in this frame */
+    int            predictedScroll; /* scrolled ahead of input; taken from the next event */
+    float          scrollVelocity;  /* per-pixel input in pixels per ms */
+    uint32_t       lastWheelTime;
     iAnim          sideOpacity;
     iAnim          altTextOpacity;
     iGmRunRange    visibleRuns;
+    const char *   wakeAnchor; /* source position at the top of the view when hibernated */
+    int            wakeAnchorOffset;
+    iRetainedImages retainedImages;
     iPtrArray      visibleLinks;
     iPtrArray      visiblePre;
     iPtrArray      visibleMedia; /* currently playing audio / ongoing downloads */   
@@ -340,6 +388,9 @@ void init_DocumentWidget(iDocumentWidget *d) {
     d->titleUser        = new_String();
     d->request          = NULL;
     d->isRequestUpdated = iFalse;
+    d->paintFlowId      = 0;
+    d->lastShownTime    = SDL_GetTicks();
+    d->numTimesShown    = 0;
     d->media            = new_ObjectList();
     d->doc              = new_GmDocument();
     d->banner           = new_Banner();
@@ -347,7 +398,14 @@ void init_DocumentWidget(iDocumentWidget *d) {
     d->redirectCount    = 0;
     d->ordinalBase      = 0;
     d->initNormScrollY  = 0;
+    d->restoredScrollY  = 0;
+    d->wakeAnchor       = NULL;
+    d->wakeAnchorOffset = 0;
     init_SmoothScroll(&d->scrollY, w, scrollBegan_DocumentWidget_);
+    d->pendingScroll   = 0;
+    d->predictedScroll = 0;
+    d->scrollVelocity  = 0.0f;
+    d->lastWheelTime   = 0;
     d->animWideRunId = 0;
     init_Anim(&d->animWideRunOffset, 0);
     d->selectMark       = iNullRange;
@@ -359,11 +417,13 @@ void init_DocumentWidget(iDocumentWidget *d) {
     d->contextLink      = NULL;
     iZap(d->renderRuns);
     iZap(d->visibleRuns);
+    iZap(d->retainedImages);
     d->visBuf = new_VisBuf(); {
-        d->visBufMeta = malloc(sizeof(iVisBufMeta) * numBuffers_VisBuf);
+        d->visBufMeta = malloc(sizeof(iVisBufMeta) * maxBuffers_VisBuf);
         /* Additional metadata for each buffer. */
         d->visBuf->bufferInvalidated = visBufInvalidated_;
-        for (size_t i = 0; i < numBuffers_VisBuf; i++) {
+        d->visBuf->isAdaptive        = iTrue;
+        for (size_t i = 0; i < maxBuffers_VisBuf; i++) {
             d->visBuf->buffers[i].user = d->visBufMeta + i;
         }
     }
@@ -375,6 +435,7 @@ void init_DocumentWidget(iDocumentWidget *d) {
     init_String(&d->sourceMime);
     init_Block(&d->sourceContent, 0);
     iZap(d->sourceTime);
+    iZap(d->sourceTiming);
     d->sourceGempub = NULL;
     init_PtrArray(&d->visibleLinks);
     init_PtrArray(&d->visiblePre);
@@ -409,11 +470,9 @@ void init_DocumentWidget(iDocumentWidget *d) {
 void cancelAllRequests_DocumentWidget(iDocumentWidget *d) {
     iForEach(ObjectList, i, d->media) {
         iMediaRequest *mr = i.object;
-        cancel_GmRequest(mr->req);
-    }
-    if (d->request) {
-        cancel_GmRequest(d->request);
+        cancel_RequestBroker(mr->req, mr);
     }
+    cancel_RequestBroker(d->request, d);
 }
 
 void deinit_DocumentWidget(iDocumentWidget *d) {
@@ -421,6 +480,11 @@ void deinit_DocumentWidget(iDocumentWidget *d) {
     pauseAllPlayers_Media(media_GmDocument(d->doc), iTrue);
     removeTicker_App(animate_DocumentWidget_, d);
     removeTicker_App(prerender_DocumentWidget_, d);
+    removeTicker_App(preload_DocumentWidget_, d);
+    removeTicker_App(applyPendingScroll_DocumentWidget_, d);
+    removeTicker_App(continueLayout_DocumentWidget_, d);
+    removeTicker_App(prefetchHoverLink_DocumentWidget_, d);
+    cancel_Prefetch(d);
     remove_Periodic(periodic_App(), d);
     delete_Translation(d->translation);
     delete_DrawBufs(d->drawBufs);
@@ -636,6 +700,13 @@ static void addVisible_DocumentWidget_(void *context, const iGmRun *run) {
     }
 }
 
+static void addNearImage_DocumentWidget_(void *context, const iGmRun *run) {
+    if (run->mediaType == image_MediaType && run->mediaId) {
+        const uint16_t id = run->mediaId;
+        pushBack_Array(context, &id);
+    }
+}
+
 static const iGmRun *lastVisibleLink_DocumentWidget_(const iDocumentWidget *d) {
     iReverseConstForEach(PtrArray, i, &d->visibleLinks) {
         const iGmRun *run = i.ptr;
@@ -672,6 +743,33 @@ static void invalidateLink_DocumentWidget_(iDocumentWidget *d, iGmLinkId id) {
     }
 }
 
+iDeclareType(ChangedLinkParams)
+
+struct Impl_ChangedLinkParams {
+    iDocumentWidget *widget;
+    const iIntSet   *linkIds;
+};
+
+static void invalidateChangedLink_(void *params, const iGmRun *run) {
+    iChangedLinkParams *d = params;
+    if (run->linkId && contains_IntSet(d->linkIds, run->linkId)) {
+        insert_PtrSet(d->widget->invalidRuns, run);
+    }
+}
+
+static void invalidateLinks_DocumentWidget_(iDocumentWidget *d, const iIntSet *linkIds) {
+    /* Only the runs of the given links are redrawn, in all the buffers that are allocated
+       and not just the visible ones. */
+    if (isEmpty_IntSet(linkIds)) {
+        return;
+    }
+    render_GmDocument(d->doc,
+                      allocRange_VisBuf(d->visBuf),
+                      invalidateChangedLink_,
+                      &(iChangedLinkParams){ d, linkIds });
+    refresh_Widget(d);
+}
+
 static void invalidateVisibleLinks_DocumentWidget_(iDocumentWidget *d) {
     iConstForEach(PtrArray, i, &d->visibleLinks) {
         const iGmRun *run = i.ptr;
@@ -695,6 +793,29 @@ static int runOffset_DocumentWidget_(const iDocumentWidget *d, const iGmRun *run
     return 0;
 }
 
+static void updateFindCount_DocumentWidget_(iDocumentWidget *d, iBool isSearching) {
+    /* Shows "n/N" next to the find field. */
+    iLabelWidget *count = findWidget_App("find.count");
+    if (!count) {
+        return;
+    }
+    const iString *text = text_InputWidget(findWidget_App("find.input"));
+    if (!isSearching || isEmpty_String(text)) {
+        updateTextAndResizeWidthCStr_LabelWidget(count, "");
+    }
+    else if (!d->foundMark.start) {
+        updateTextAndResizeWidthCStr_LabelWidget(count, "0/0");
+    }
+    else {
+        updateTextAndResizeWidthCStr_LabelWidget(
+            count,
+            format_CStr("%zu/%zu",
+                        foundOrdinal_GmDocument(d->doc, d->foundMark.start) + 1,
+                        numFound_GmDocument(d->doc)));
+    }
+    arrange_Widget(parent_Widget(count));
+}
+
 static void invalidateWideRunsWithNonzeroOffset_DocumentWidget_(iDocumentWidget *d) {
     iConstForEach(PtrArray, i, &d->visibleWideRuns) {
         const iGmRun *run = i.ptr;
@@ -736,6 +857,23 @@ static iBool isHoverAllowed_DocumentWidget_(const iDocumentWidget *d) {
     return iTrue;
 }
 
+static const uint32_t prefetchDwellTime_DocumentWidget_ = 400; /* ms */
+
+static void prefetchHoverLink_DocumentWidget_(iAny *widget) {
+    iDocumentWidget *d = widget;
+    if (d->hoverLink) {
+        prefetch_Prefetch(linkUrl_GmDocument(d->doc, d->hoverLink->linkId), d);
+    }
+}
+
+static void schedulePrefetch_DocumentWidget_(iDocumentWidget *d) {
+    /* Only links that the user stays on for a moment are fetched ahead of time. */
+    removeTicker_App(prefetchHoverLink_DocumentWidget_, d);
+    if (d->hoverLink && prefs_App()->prefetchLinks) {
+        addDelayedTicker_App(prefetchHoverLink_DocumentWidget_, d, prefetchDwellTime_DocumentWidget_);
+    }
+}
+
 static void updateHover_DocumentWidget_(iDocumentWidget *d, iInt2 mouse) {
     const iWidget *w            = constAs_Widget(d);
     const iRect    docBounds    = documentBounds_DocumentWidget_(d);
@@ -760,7 +898,10 @@ static void updateHover_DocumentWidget_(iDocumentWidget *d, iInt2 mouse) {
         }
         if (d->hoverLink) {
             invalidateLink_DocumentWidget_(d, d->hoverLink->linkId);
+            /* The link may well be opened soon. */
+            prefetchUrl_Resolver(linkUrl_GmDocument(d->doc, d->hoverLink->linkId));
         }
+        schedulePrefetch_DocumentWidget_(d);
         refresh_Widget(w);
     }
     /* Hovering over preformatted blocks. */
@@ -901,6 +1042,83 @@ static int updateScrollMax_DocumentWidget_(iDocumentWidget *d) {
     return scrollMax;
 }
 
+static const iGmRun *firstRun_DocumentWidget_(const iDocumentWidget *d) {
+    return numRuns_GmDocument(d->doc) ? run_GmDocument(d->doc, 0) : NULL;
+}
+
+static void restoreScroll_DocumentWidget_(iDocumentWidget *d) {
+    /* A lazily laid out document has an estimated height, so the position is applied again
+       each time the layout is extended, until the layout is complete or the user scrolls. */
+    d->restoredScrollY = d->initNormScrollY * pageHeight_DocumentWidget_(d);
+    init_Anim(&d->scrollY.pos, d->restoredScrollY);
+    iChangeFlags(d->flags,
+                 restoringScroll_DocumentWidgetFlag,
+                 !isLayoutComplete_GmDocument(d->doc));
+}
+
+static void layoutWasExtended_DocumentWidget_(iDocumentWidget *d, const iGmRun *oldFirstRun,
+                                              int oldHeight) {
+    /* More runs were added to the end of the layout. */
+    d->hoverPre    = NULL;
+    d->hoverAltPre = NULL;
+    d->hoverLink   = NULL;
+    d->contextLink = NULL;
+    iZap(d->visibleRuns);
+    iZap(d->renderRuns);
+    if (firstRun_DocumentWidget_(d) != oldFirstRun) {
+        invalidate_DocumentWidget_(d); /* buffers refer to the old runs */
+    }
+    else {
+        invalidateFrom_VisBuf(d->visBuf, oldHeight);
+    }
+    if (d->flags & restoringScroll_DocumentWidgetFlag) {
+        if ((int) targetValue_Anim(&d->scrollY.pos) == d->restoredScrollY) {
+            restoreScroll_DocumentWidget_(d);
+        }
+        else {
+            d->flags &= ~restoringScroll_DocumentWidgetFlag; /* scrolled elsewhere */
+        }
+    }
+    if (isLayoutComplete_GmDocument(d->doc)) {
+        d->drawBufs->flags |= updateSideBuf_DrawBufsFlag;
+        postCommandf_Root(as_Widget(d)->root,
+                          "document.changed doc:%p status:%d url:%s",
+                          d,
+                          d->sourceStatus,
+                          cstr_String(d->mod.url));
+    }
+    refresh_Widget(as_Widget(d));
+}
+
+static void continueLayout_DocumentWidget_(iAny *context) {
+    if (current_Root() == NULL) {
+        return; /* see `prerender_DocumentWidget_` */
+    }
+    iDocumentWidget *d = context;
+    const iGmRun *oldFirstRun = firstRun_DocumentWidget_(d);
+    const int     oldHeight   = layoutHeight_GmDocument(d->doc);
+    /* Lay out the rest of a huge document a few pages at a time. */
+    if (continueLayout_GmDocument(d->doc, 8 * height_Widget(d))) {
+        layoutWasExtended_DocumentWidget_(d, oldFirstRun, oldHeight);
+        updateVisible_DocumentWidget_(d);
+    }
+}
+
+static const iGmRun *findRunAtLoc_DocumentWidget_(iDocumentWidget *d, const char *loc) {
+    const iGmRun *run = findRunAtLoc_GmDocument(d->doc, loc);
+    if (!run && loc && !isLayoutComplete_GmDocument(d->doc)) {
+        /* Only the part of the document up to `loc` is laid out, plus a page after it. */
+        const iGmRun *oldFirstRun = firstRun_DocumentWidget_(d);
+        const int     oldHeight   = layoutHeight_GmDocument(d->doc);
+        if (layoutUntil_GmDocument(d->doc, loc, height_Widget(d))) {
+            layoutWasExtended_DocumentWidget_(d, oldFirstRun, oldHeight);
+            updateVisible_DocumentWidget_(d);
+        }
+        run = findRunAtLoc_GmDocument(d->doc, loc);
+    }
+    return run;
+}
+
 static void updateVisible_DocumentWidget_(iDocumentWidget *d) {
     iChangeFlags(d->flags,
                  centerVertically_DocumentWidgetFlag,
@@ -909,6 +1127,16 @@ static void updateVisible_DocumentWidget_(iDocumentWidget *d) {
     const iRangei visRange  = visibleRange_DocumentWidget_(d);
 //    printf("visRange: %d...%d\n", visRange.start, visRange.end);
     const iRect   bounds    = bounds_Widget(as_Widget(d));
+    /* Huge documents are laid out lazily. The visible part must be ready. */ {
+        const iGmRun *oldFirstRun = firstRun_DocumentWidget_(d);
+        const int     oldHeight   = layoutHeight_GmDocument(d->doc);
+        if (extendLayout_GmDocument(d->doc, visRange.end + height_Rect(bounds))) {
+            layoutWasExtended_DocumentWidget_(d, oldFirstRun, oldHeight);
+        }
+        if (!isLayoutComplete_GmDocument(d->doc)) {
+            addBackgroundTicker_App(continueLayout_DocumentWidget_, d); /* within the frame budget */
+        }
+    }
     const int     scrollMax = updateScrollMax_DocumentWidget_(d);
     /* Reposition the footer buttons as appropriate. */
     /* TODO: You can just position `footerButtons` here completely without having to get
@@ -938,6 +1166,30 @@ static void updateVisible_DocumentWidget_(iDocumentWidget *d) {
         iZap(d->visibleRuns);
         render_GmDocument(d->doc, visRange, addVisible_DocumentWidget_, d);
     }
+    /* Images far outside the visible range don't need to keep their textures. The nearby
+       images are looked up again after scrolling about a viewport further. */ {
+        const int        viewHeight = height_Rect(bounds);
+        iRetainedImages *ret        = &d->retainedImages;
+        const iMedia    *media      = media_GmDocument(d->doc);
+        if (numImages_Media(media) == 0) {
+            iZap(*ret);
+        }
+        else if (ret->doc != d->doc || ret->docHeight != size_GmDocument(d->doc).y ||
+                 ret->numImages != numImages_Media(media) ||
+                 visRange.start < ret->range.start + viewHeight ||
+                 visRange.end > ret->range.end - viewHeight) {
+            iArray nearImages;
+            init_Array(&nearImages, sizeof(uint16_t));
+            ret->doc       = d->doc;
+            ret->range     = (iRangei){ visRange.start - 2 * viewHeight,
+                                        visRange.end + 2 * viewHeight };
+            ret->docHeight = size_GmDocument(d->doc).y;
+            ret->numImages = numImages_Media(media);
+            render_GmDocument(d->doc, ret->range, addNearImage_DocumentWidget_, &nearImages);
+            retainImages_Media(media_GmDocument(d->doc), &nearImages);
+            deinit_Array(&nearImages);
+        }
+    }
     const iRangecc newHeading = currentHeading_DocumentWidget_(d);
     if (memcmp(&oldHeading, &newHeading, sizeof(oldHeading))) {
         d->drawBufs->flags |= updateSideBuf_DrawBufsFlag;
@@ -1105,7 +1357,8 @@ static void showOrHidePinningIndicator_DocumentWidget_(iDocumentWidget *d) {
 }
 
 static void documentWasChanged_DocumentWidget_(iDocumentWidget *d) {
-    updateVisitedLinks_GmDocument(d->doc);
+    d->flags &= ~keepAwake_DocumentWidgetFlag;
+    updateVisitedLinks_GmDocument(d->doc, NULL);
     documentRunsInvalidated_DocumentWidget_(d);
     updateWindowTitle_DocumentWidget_(d);
     updateVisible_DocumentWidget_(d);
@@ -1127,16 +1380,53 @@ static void documentWasChanged_DocumentWidget_(iDocumentWidget *d) {
                               (d->flags & openedFromSidebar_DocumentWidgetFlag) != 0);
 }
 
+static void adoptSiblingLayout_DocumentWidget_(iDocumentWidget *d) {
+    /* When the same page is already open in another tab or in the other split root, its
+       measured text is reused instead of wrapping everything again. The snapshot is only
+       applied if the source and the text metrics match. Each view still has its own
+       document, so a fold or width change in one does not affect the other. */
+    iObjectList *docs = listDocuments_App(NULL);
+    iConstForEach(ObjectList, i, docs) {
+        const iDocumentWidget *other = i.object;
+        if (other != d && other->state == ready_RequestState &&
+            size_Block(&other->sourceContent) == size_Block(&d->sourceContent) &&
+            equal_String(other->mod.url, d->mod.url)) {
+            iBlock *snapshot = layoutSnapshot_GmDocument(other->doc);
+            if (snapshot) {
+                setLayoutSnapshot_GmDocument(d->doc, snapshot);
+                delete_Block(snapshot);
+                break;
+            }
+        }
+    }
+    iRelease(docs);
+}
+
 void setSource_DocumentWidget(iDocumentWidget *d, const iString *source) {
     setUrl_GmDocument(d->doc, d->mod.url);
-    const int docWidth = documentWidth_DocumentWidget_(d);
-    setSource_GmDocument(d->doc,
-                         source,
-                         docWidth,
-                         width_Widget(d),
-                         isFinished_GmRequest(d->request) ? final_GmDocumentUpdate
-                                                          : partial_GmDocumentUpdate);
+    const int   docWidth   = documentWidth_DocumentWidget_(d);
+    const iBool isFinished = isFinished_GmRequest(d->request);
+    if (isFinished) {
+        adoptSiblingLayout_DocumentWidget_(d);
+    }
     setWidth_Banner(d->banner, docWidth);
+    /* Huge documents are initially laid out only as far as they are visible. */
+    extendLayout_GmDocument(d->doc, visibleRange_DocumentWidget_(d).end + height_Widget(d));
+    if (isFinished && size_String(source) >= backgroundLayoutMinSize_DocumentWidget_ &&
+        size_GmDocument(d->doc).y > 0) {
+        /* Keep showing the current layout while the new one is being prepared. */
+        if (setSourceInBackground_GmDocument(d->doc, source, docWidth, width_Widget(d),
+                                             current_Text())) {
+            return; /* "document.layout.finished" will follow */
+        }
+    }
+    else {
+        setSource_GmDocument(d->doc,
+                             source,
+                             docWidth,
+                             width_Widget(d),
+                             isFinished ? final_GmDocumentUpdate : partial_GmDocumentUpdate);
+    }
     documentWasChanged_DocumentWidget_(d);
 }
 
@@ -1456,6 +1746,8 @@ static void postProcessRequestContent_DocumentWidget_(iDocumentWidget *d, iBool
                                 0,
                                 format_CStr("!open url:%s",
                                             cstr_String(navLinkUrl_Gempub(d->sourceGempub, navIndex + 1))) });
+                        /* Readers usually continue to the next chapter. */
+                        prefetch_Prefetch(navLinkUrl_Gempub(d->sourceGempub, navIndex + 1), d);
                     }
                     if (navIndex > 0) {
                         pushBack_Array(
@@ -1517,8 +1809,8 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
         return;
     }
     const iBool isRequestFinished = isFinished_GmRequest(d->request);
-    /* TODO: Do document update in the background. However, that requires a text metrics calculator
-       that does not try to cache the glyph bitmaps. */
+    /* Note: Large documents are laid out in the background once the request has finished
+       (see `setSource_DocumentWidget`). */
     const enum iGmStatusCode statusCode = response->statusCode;
     if (category_GmStatusCode(statusCode) != categoryInput_GmStatusCode) {
         iBool setSource = iTrue;
@@ -1529,6 +1821,7 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
         }
         clear_String(&d->sourceMime);
         d->sourceTime = response->when;
+        d->sourceTiming = response->timing;
         d->drawBufs->flags |= updateTimestampBuf_DrawBufsFlag;
         initBlock_String(&str, &response->body); /* Note: Body may be megabytes in size. */
         if (isSuccess_GmStatusCode(statusCode)) {
@@ -1734,12 +2027,15 @@ static void updateDocument_DocumentWidget_(iDocumentWidget *d,
     }
 }
 
+static void releaseRequest_DocumentWidget_(iDocumentWidget *d) {
+    unsubscribe_RequestBroker(d->request, d);
+    iReleasePtr(&d->request);
+}
+
 static void fetch_DocumentWidget_(iDocumentWidget *d) {
     /* Forget the previous request. */
-    if (d->request) {
-        iRelease(d->request);
-        d->request = NULL;
-    }
+    releaseRequest_DocumentWidget_(d);
+    cancel_Prefetch(d); /* the links are no longer relevant */
     postCommandf_Root(as_Widget(d)->root,
                       "document.request.started doc:%p url:%s",
                       d,
@@ -1750,11 +2046,13 @@ static void fetch_DocumentWidget_(iDocumentWidget *d) {
     d->flags &= ~drawDownloadCounter_DocumentWidgetFlag;
     d->state = fetching_RequestState;
     set_Atomic(&d->isRequestUpdated, iFalse);
-    d->request = new_GmRequest(certs_App());
-    setUrl_GmRequest(d->request, d->mod.url);
-    iConnect(GmRequest, d->request, updated, d, requestUpdated_DocumentWidget_);
-    iConnect(GmRequest, d->request, finished, d, requestFinished_DocumentWidget_);
-    submit_GmRequest(d->request);
+    /* Another tab may already be loading the same page. */
+    d->request = subscribe_RequestBroker(d->mod.url,
+                                         filtered_RequestBrokerFlag,
+                                         d,
+                                         requestUpdated_DocumentWidget_,
+                                         requestFinished_DocumentWidget_);
+    submit_RequestBroker(d->request);
 }
 
 static void updateTrust_DocumentWidget_(iDocumentWidget *d, const iGmResponse *response) {
@@ -1808,6 +2106,11 @@ static void cacheDocumentGlyphs_DocumentWidget_(const iDocumentWidget *d) {
 }
 
 static void addBannerWarnings_DocumentWidget_(iDocumentWidget *d) {
+    /* Saved copies were not fetched from the server, so there is no certificate to check. */
+    if (d->certFlags & mirrored_GmCertFlag) {
+        add_Banner(d->banner, warning_BannerType, offlineCopy_GmStatusCode, NULL, NULL);
+        return;
+    }
     /* Warnings related to certificates and trust. */
     const int certFlags = d->certFlags;
     const int req = timeVerified_GmCertFlag | domainVerified_GmCertFlag | trusted_GmCertFlag;
@@ -1851,8 +2154,7 @@ static void addBannerWarnings_DocumentWidget_(iDocumentWidget *d) {
     }
     /* Warnings related to page contents. */
     const int dismissed =
-        value_SiteSpec(collectNewRange_String(urlRoot_String(d->mod.url)),
-                       dismissWarnings_SiteSpecKey) |
+        valueRange_SiteSpec(urlRoot_String(d->mod.url), dismissWarnings_SiteSpecKey) |
         (!prefs_App()->warnAboutMissingGlyphs ? missingGlyphs_GmDocumentWarning : 0);
     const int warnings = warnings_GmDocument(d->doc) & ~dismissed;
     if (warnings & missingGlyphs_GmDocumentWarning) {
@@ -1865,8 +2167,10 @@ static void addBannerWarnings_DocumentWidget_(iDocumentWidget *d) {
 }
 
 static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float normScrollY,
-                                                     const iGmResponse *resp, iGmDocument *cachedDoc) {
+                                                     const iGmResponse *resp, iGmDocument *cachedDoc,
+                                                     const iBlock *cachedLayout) {
     setLinkNumberMode_DocumentWidget_(d, iFalse);
+    cancel_Prefetch(d);
     clear_ObjectList(d->media);
     delete_Gempub(d->sourceGempub);
     d->sourceGempub = NULL;
@@ -1875,6 +2179,9 @@ static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float n
     destroy_Widget(d->footerButtons);
     d->footerButtons = NULL;
     d->doc = new_GmDocument();
+    if (!cachedDoc && cachedLayout) {
+        setLayoutSnapshot_GmDocument(d->doc, cachedLayout); /* skips measuring the text */
+    }
     resetWideRuns_DocumentWidget_(d);
     d->state = fetching_RequestState;
     /* Do the fetch. */ {
@@ -1882,6 +2189,7 @@ static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float n
         /* Use the cached response data. */
         updateTrust_DocumentWidget_(d, resp);
         d->sourceTime   = resp->when;
+        d->sourceTiming = resp->timing;
         d->sourceStatus = success_GmStatusCode;
         format_String(&d->sourceHeader, cstr_Lang("pageinfo.header.cached"));
         set_Block(&d->sourceContent, &resp->body);
@@ -1907,6 +2215,19 @@ static void updateFromCachedResponse_DocumentWidget_(iDocumentWidget *d, float n
         as_Widget(d)->root, "document.changed doc:%p url:%s", d, cstr_String(d->mod.url));
 }
 
+static iBool updateFromPrefetch_DocumentWidget_(iDocumentWidget *d) {
+    iGmResponse *resp = take_Prefetch(d->mod.url);
+    if (!resp) {
+        return iFalse;
+    }
+    const iRecentUrl *recent = findUrl_History(d->mod.history, d->mod.url);
+    releaseRequest_DocumentWidget_(d);
+    updateFromCachedResponse_DocumentWidget_(d, recent ? recent->normScrollY : 0.0f, resp, NULL, NULL);
+    setCachedResponse_History(d->mod.history, resp);
+    delete_GmResponse(resp);
+    return iTrue;
+}
+
 static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d) {
     const iRecentUrl *recent = findUrl_History(d->mod.history, d->mod.url);
     if (recent && recent->cachedResponse) {
@@ -1914,7 +2235,7 @@ static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d) {
                      openedFromSidebar_DocumentWidgetFlag,
                      recent->flags.openedFromSidebar);
         updateFromCachedResponse_DocumentWidget_(
-            d, recent->normScrollY, recent->cachedResponse, recent->cachedDoc);
+            d, recent->normScrollY, recent->cachedResponse, recent->cachedDoc, recent->cachedLayout);
         return iTrue;
     }
     else if (!isEmpty_String(d->mod.url)) {
@@ -1927,6 +2248,35 @@ static iBool updateFromHistory_DocumentWidget_(iDocumentWidget *d) {
     return iFalse;
 }
 
+static void restorePending_DocumentWidget_(iDocumentWidget *d) {
+    /* Tabs restored from the saved state get their page when they are first shown. */
+    if (d->flags & pendingRestore_DocumentWidgetFlag) {
+        d->flags &= ~pendingRestore_DocumentWidgetFlag;
+        updateFromHistory_DocumentWidget_(d);
+    }
+}
+
+static void wake_DocumentWidget_(iDocumentWidget *d) {
+    /* Hibernated tabs are laid out again when shown. The layout snapshot means the text
+       doesn't need to be measured, unless the window width or fonts have changed. */
+    if (!isHibernating_GmDocument(d->doc)) {
+        return;
+    }
+    const uint32_t startTime = SDL_GetTicks();
+    if (!updateDocumentWidthRetainingScrollPosition_DocumentWidget_(d, iFalse)) {
+        redoLayout_GmDocument(d->doc);
+        documentRunsInvalidated_DocumentWidget_(d);
+    }
+    d->wakeAnchor = NULL;
+    d->drawBufs->flags |= updateSideBuf_DrawBufsFlag;
+    updateVisible_DocumentWidget_(d);
+    invalidate_DocumentWidget_(d);
+    refresh_Widget(d);
+    if (SDL_GetTicks() - startTime > wakeBudget_DocumentWidget_) {
+        d->flags |= keepAwake_DocumentWidgetFlag; /* not worth the wait */
+    }
+}
+
 static void refreshWhileScrolling_DocumentWidget_(iAny *ptr) {
     iDocumentWidget *d = ptr;
     updateVisible_DocumentWidget_(d);
@@ -1978,6 +2328,52 @@ static void immediateScroll_DocumentWidget_(iDocumentWidget *d, int offset) {
     move_SmoothScroll(&d->scrollY, offset);
 }
 
+static void applyPendingScroll_DocumentWidget_(iAny *ptr) {
+    /* Per-pixel input is applied once per frame. When the device reports less often than
+       the display refreshes, one frame of motion is predicted from the recent velocity. */
+    iDocumentWidget *d = ptr;
+    int offset = d->pendingScroll;
+    d->pendingScroll = 0;
+    if (offset) {
+        /* The following frame may need a prediction. */
+        addTicker_App(applyPendingScroll_DocumentWidget_, d);
+    }
+    else if (!d->predictedScroll &&
+             SDL_GetTicks() - d->lastWheelTime < maxScrollPrediction_DocumentWidget_) {
+        offset = d->predictedScroll =
+            iRound(d->scrollVelocity * iMax(1u, elapsedSinceLastTicker_App()));
+    }
+    if (offset) {
+        immediateScroll_DocumentWidget_(d, offset);
+    }
+}
+
+static void addPerPixelScroll_DocumentWidget_(iDocumentWidget *d, int offset) {
+    const uint32_t now     = SDL_GetTicks();
+    const uint32_t elapsed = now - d->lastWheelTime;
+    if (elapsed >= maxScrollPrediction_DocumentWidget_) {
+        d->scrollVelocity  = 0.0f; /* a new gesture */
+        d->predictedScroll = 0;
+    }
+    else if (elapsed > 0) {
+        d->scrollVelocity = 0.7f * d->scrollVelocity + 0.3f * offset / (float) elapsed;
+    }
+    d->lastWheelTime = now;
+    /* Motion that was already predicted is not scrolled again. */
+    if (d->predictedScroll) {
+        if (iSign(d->predictedScroll) == iSign(offset)) {
+            const int taken = iSign(offset) * iMin(iAbs(offset), iAbs(d->predictedScroll));
+            offset -= taken;
+            d->predictedScroll -= taken;
+        }
+        else {
+            d->predictedScroll = 0;
+        }
+    }
+    d->pendingScroll += offset;
+    addTicker_App(applyPendingScroll_DocumentWidget_, d);
+}
+
 static void smoothScroll_DocumentWidget_(iDocumentWidget *d, int offset, int duration) {
     moveSpan_SmoothScroll(&d->scrollY, offset, duration);
 }
@@ -2127,7 +2523,7 @@ static void checkResponse_DocumentWidget_(iDocumentWidget *d) {
             clear_Banner(d->banner);
             updateTheme_DocumentWidget_(d);
         }
-        if (~d->certFlags & trusted_GmCertFlag &&
+        if (!(d->certFlags & (trusted_GmCertFlag | mirrored_GmCertFlag)) &&
             isSuccess_GmStatusCode(statusCode) &&
             equalCase_Rangecc(urlScheme_String(d->mod.url), "gemini")) {
             statusCode = tlsServerCertificateNotVerified_GmStatusCode;
@@ -2240,7 +2636,7 @@ static void checkResponse_DocumentWidget_(iDocumentWidget *d) {
                         showErrorPage_DocumentWidget_(d, schemeChangeRedirect_GmStatusCode, dstUrl);
                     }
                     unlockResponse_GmRequest(d->request);
-                    iReleasePtr(&d->request);
+                    releaseRequest_DocumentWidget_(d);
                 }
                 break;
             default:
@@ -2307,6 +2703,72 @@ static const iGmRun *middleRun_DocumentWidget_(const iDocumentWidget *d) {
     return params.closest;
 }
 
+enum iMediaSchedule {
+    maxActive_MediaSchedule = 4, /* concurrent inline media fetches per document */
+};
+
+static int viewportDistance_(const iGmRun *run, iRangei visRange) {
+    const int top    = top_Rect(run->visBounds);
+    const int bottom = bottom_Rect(run->visBounds);
+    if (bottom < visRange.start) {
+        /* Content above the viewport is less likely to be looked at. */
+        return 2 * (visRange.start - bottom);
+    }
+    return iMax(0, top - visRange.end);
+}
+
+static void scheduleMedia_DocumentWidget_(iDocumentWidget *d) {
+    /* Inline media is fetched a few requests at a time, closest to the viewport first.
+       Requests far outside the viewport stay queued until the nearer ones are done. */
+    size_t numActive  = 0;
+    size_t numPending = 0;
+    iConstForEach(ObjectList, i, d->media) {
+        const iMediaRequest *req = i.object;
+        if (isActive_MediaRequest(req)) {
+            numActive++;
+        }
+        else if (!req->isSubmitted) {
+            numPending++;
+        }
+    }
+    const iRangei visRange = visibleRange_DocumentWidget_(d);
+    while (numPending > 0 && numActive < maxActive_MediaSchedule) {
+        iMediaRequest *best     = NULL;
+        int            bestDist = INT_MAX;
+        for (size_t i = 0; i < numRuns_GmDocument(d->doc); i++) {
+            const iGmRun *run = run_GmDocument(d->doc, i);
+            if (!run->linkId || run->flags & decoration_GmRunFlag) {
+                continue;
+            }
+            const int dist = viewportDistance_(run, visRange);
+            if (dist >= bestDist) {
+                continue;
+            }
+            iForEach(ObjectList, j, d->media) {
+                iMediaRequest *req = j.object;
+                if (!req->isSubmitted && req->linkId == run->linkId) {
+                    best     = req;
+                    bestDist = dist;
+                    break;
+                }
+            }
+        }
+        if (!best) {
+            /* The link has no laid-out runs; fetch in request order. */
+            iForEach(ObjectList, j, d->media) {
+                iMediaRequest *req = j.object;
+                if (!req->isSubmitted) {
+                    best = req;
+                    break;
+                }
+            }
+        }
+        submit_MediaRequest(best);
+        numActive++;
+        numPending--;
+    }
+}
+
 static void removeMediaRequest_DocumentWidget_(iDocumentWidget *d, iGmLinkId linkId) {
     iForEach(ObjectList, i, d->media) {
         iMediaRequest *req = (iMediaRequest *) i.object;
@@ -2315,6 +2777,7 @@ static void removeMediaRequest_DocumentWidget_(iDocumentWidget *d, iGmLinkId lin
             break;
         }
     }
+    scheduleMedia_DocumentWidget_(d);
 }
 
 static iMediaRequest *findMediaRequest_DocumentWidget_(const iDocumentWidget *d, iGmLinkId linkId) {
@@ -2329,8 +2792,15 @@ static iMediaRequest *findMediaRequest_DocumentWidget_(const iDocumentWidget *d,
 
 static iBool requestMedia_DocumentWidget_(iDocumentWidget *d, iGmLinkId linkId, iBool enableFilters) {
     if (!findMediaRequest_DocumentWidget_(d, linkId)) {
-        const iString *mediaUrl = absoluteUrl_String(d->mod.url, linkUrl_GmDocument(d->doc, linkId));
-        pushBack_ObjectList(d->media, iClob(new_MediaRequest(d, linkId, mediaUrl, enableFilters)));
+        const iString *mediaUrl = linkUrl_GmDocument(d->doc, linkId);
+        iMediaRequest *req      = new_MediaRequest(d, linkId, mediaUrl, enableFilters);
+        pushBack_ObjectList(d->media, iClob(req));
+        if (findMediaForLink_Media(constMedia_GmDocument(d->doc), linkId, download_MediaType).type) {
+            submit_MediaRequest(req); /* downloads are not queued */
+        }
+        else {
+            scheduleMedia_DocumentWidget_(d);
+        }
         invalidate_DocumentWidget_(d);
         return iTrue;
     }
@@ -2341,6 +2811,43 @@ static iBool isDownloadRequest_DocumentWidget(const iDocumentWidget *d, const iM
     return findMediaForLink_Media(constMedia_GmDocument(d->doc), req->linkId, download_MediaType).type != 0;
 }
 
+static void updateDownload_DocumentWidget_(iDocumentWidget *d, iMediaRequest *req,
+                                           iBool isFinished) {
+    /* The request writes the received data directly to the file so it can be of any size. */
+    iMedia  *media = media_GmDocument(d->doc);
+    iString *mime  = copy_String(&lockResponse_GmRequest(req->req)->meta);
+    unlockResponse_GmRequest(req->req); /* allows further update notifications */
+    if (!isDownloading_GmRequest(req->req)) {
+        iFile *file = openDownload_Media(media, req->linkId, mime);
+        if (file) {
+            setDownloadFile_GmRequest(req->req, file);
+        }
+    }
+    delete_String(mime);
+    updateDownload_Media(media, req->linkId, bodySize_GmRequest(req->req), isFinished);
+}
+
+static iBool streamAudio_DocumentWidget_(iDocumentWidget *d, iMediaRequest *req,
+                                         iBool isFinished) {
+    /* Long audio streams are handed over to the player piece by piece, so neither the request
+       nor the player needs to keep all of it in memory. */
+    static const size_t streamingThreshold_ = 4 * 1024 * 1024; /* bytes */
+    iMedia *media = media_GmDocument(d->doc);
+    if (!req->isStreaming) {
+        if (bodySize_GmRequest(req->req) < streamingThreshold_ ||
+            !findLinkAudio_Media(media, req->linkId).id ||
+            !makeExclusive_RequestBroker(req->req) /* taking the body would starve others */) {
+            return iFalse;
+        }
+        req->isStreaming = iTrue;
+    }
+    iBlock *data = new_Block(0);
+    const size_t offset = takeBody_GmRequest(req->req, data);
+    streamData_Media(media, req->linkId, offset, data, isFinished);
+    delete_Block(data);
+    return iTrue;
+}
+
 static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd) {
     iMediaRequest *req = pointerLabel_Command(cmd, "request");
     iBool isOurRequest = iFalse;
@@ -2357,10 +2864,13 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
     if (equal_Command(cmd, "media.updated")) {
         /* Pass new data to media players. */
         const enum iGmStatusCode code = status_GmRequest(req->req);
-        if (isSuccess_GmStatusCode(code)) {
+        if (isSuccess_GmStatusCode(code) && isDownloadRequest_DocumentWidget(d, req)) {
+            updateDownload_DocumentWidget_(d, req, iFalse);
+        }
+        else if (isSuccess_GmStatusCode(code)) {
             iGmResponse *resp = lockResponse_GmRequest(req->req);
-            if (isDownloadRequest_DocumentWidget(d, req) ||
-                startsWith_String(&resp->meta, "audio/")) {
+            const iBool isAudio = startsWith_String(&resp->meta, "audio/");
+            if ((isAudio && !req->isStreaming) || startsWith_String(&resp->meta, "image/")) {
                 /* TODO: Use a helper? This is same as below except for the partialData flag. */
                 if (setData_Media(media_GmDocument(d->doc),
                                   req->linkId,
@@ -2374,6 +2884,9 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
                 refresh_Widget(as_Widget(d));
             }
             unlockResponse_GmRequest(req->req);
+            if (isAudio) {
+                streamAudio_DocumentWidget_(d, req, iFalse);
+            }
         }
         /* Update the link's progress. */
         invalidateLink_DocumentWidget_(d, req->linkId);
@@ -2384,14 +2897,23 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
         const enum iGmStatusCode code = status_GmRequest(req->req);
         /* Give the media to the document for presentation. */
         if (isSuccess_GmStatusCode(code)) {
-            if (isDownloadRequest_DocumentWidget(d, req) ||
+            const iBool isDownload = isDownloadRequest_DocumentWidget(d, req);
+            if (isDownload ||
                 startsWith_String(meta_GmRequest(req->req), "image/") ||
                 startsWith_String(meta_GmRequest(req->req), "audio/")) {
-                setData_Media(media_GmDocument(d->doc),
-                              req->linkId,
-                              meta_GmRequest(req->req),
-                              body_GmRequest(req->req),
-                              allowHide_MediaFlag);
+                if (isDownload) {
+                    updateDownload_DocumentWidget_(d, req, iTrue);
+                }
+                else if (req->isStreaming) {
+                    streamAudio_DocumentWidget_(d, req, iTrue);
+                }
+                else {
+                    setData_Media(media_GmDocument(d->doc),
+                                  req->linkId,
+                                  meta_GmRequest(req->req),
+                                  body_GmRequest(req->req),
+                                  allowHide_MediaFlag);
+                }
                 redoLayout_GmDocument(d->doc);
                 iZap(d->visibleRuns); /* pointers invalidated */
                 updateVisible_DocumentWidget_(d);
@@ -2404,6 +2926,7 @@ static iBool handleMediaCommand_DocumentWidget_(iDocumentWidget *d, const char *
             makeSimpleMessage_Widget(format_CStr(uiTextCaution_ColorEscape "%s", err->title), err->info);
             removeMediaRequest_DocumentWidget_(d, req->linkId);
         }
+        scheduleMedia_DocumentWidget_(d);
         return iTrue;
     }
     return iFalse;
@@ -2413,7 +2936,7 @@ static void allocVisBuffer_DocumentWidget_(const iDocumentWidget *d) {
     const iWidget *w         = constAs_Widget(d);
     const iBool    isVisible = isVisible_Widget(w);
     const iInt2    size      = bounds_Widget(w).size;
-    if (isVisible) {
+    if (isVisible || d->flags & warm_DocumentWidgetFlag) {
         alloc_VisBuf(d->visBuf, size, 1);
     }
     else {
@@ -2529,11 +3052,16 @@ static iBool updateDocumentWidthRetainingScrollPosition_DocumentWidget_(iDocumen
         /* TODO: First *fully* visible run? */
         voffset = visibleRange_DocumentWidget_(d).start - top_Rect(run->visBounds);
     }
+    else if (!keepCenter && isHibernating_GmDocument(d->doc)) {
+        /* The runs were released, but the position was saved. */
+        runLoc  = d->wakeAnchor;
+        voffset = d->wakeAnchorOffset;
+    }
     setWidth_GmDocument(d->doc, newWidth, width_Widget(d));
     setWidth_Banner(d->banner, newWidth);
     documentRunsInvalidated_DocumentWidget_(d);
     if (runLoc && !keepCenter) {
-        run = findRunAtLoc_GmDocument(d->doc, runLoc);
+        run = findRunAtLoc_DocumentWidget_(d, runLoc);
         if (run) {
             scrollTo_DocumentWidget_(d,
                                      top_Rect(run->visBounds) +
@@ -2542,7 +3070,7 @@ static iBool updateDocumentWidthRetainingScrollPosition_DocumentWidget_(iDocumen
         }
     }
     else if (runLoc && keepCenter) {
-        run = findRunAtLoc_GmDocument(d->doc, runLoc);
+        run = findRunAtLoc_DocumentWidget_(d, runLoc);
         if (run) {
             scrollTo_DocumentWidget_(d, mid_Rect(run->bounds).y, iTrue);
         }
@@ -2724,7 +3252,7 @@ static iBool cancelRequest_DocumentWidget_(iDocumentWidget *d, iBool postBack) {
         iWidget *w = as_Widget(d);
         postCommandf_Root(w->root,
                           "document.request.cancelled doc:%p url:%s", d, cstr_String(d->mod.url));
-        iReleasePtr(&d->request);
+        releaseRequest_DocumentWidget_(d);
         if (d->state != ready_RequestState) {
             d->state = ready_RequestState;
             if (postBack) {
@@ -2741,24 +3269,36 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     iWidget *w = as_Widget(d);
     if (equal_Command(cmd, "document.openurls.changed")) {
         /* When any tab changes its document URL, update the open link indicators. */
-        if (updateOpenURLs_GmDocument(d->doc)) {
-            invalidate_DocumentWidget_(d);
-            refresh_Widget(d);
+        iIntSet changed;
+        init_IntSet(&changed);
+        if (updateOpenURLs_GmDocument(d->doc, &changed)) {
+            invalidateLinks_DocumentWidget_(d, &changed);
         }
+        deinit_IntSet(&changed);
         return iFalse;
     }
     if (equal_Command(cmd, "visited.changed")) {
-        updateVisitedLinks_GmDocument(d->doc);
-        invalidateVisibleLinks_DocumentWidget_(d);
+        iIntSet changed;
+        init_IntSet(&changed);
+        updateVisitedLinks_GmDocument(d->doc, &changed);
+        invalidateLinks_DocumentWidget_(d, &changed);
+        deinit_IntSet(&changed);
         return iFalse;
     }
     if (equal_Command(cmd, "document.render")) /* `Periodic` makes direct dispatch to here */ {
 //        printf("%u: document.render\n", SDL_GetTicks());
         if (SDL_GetTicks() - d->drawBufs->lastRenderTime > 150) {
-            remove_Periodic(periodic_App(), d);
+            /* Buffers added during fast scrolling are released after a while. */
+            if (d->visBuf->numBuffers > minBuffers_VisBuf &&
+                idleTime_VisBuf(d->visBuf) > releaseDelay_DocumentWidget_) {
+                shrink_VisBuf(d->visBuf);
+            }
+            if (d->visBuf->numBuffers <= minBuffers_VisBuf) {
+                remove_Periodic(periodic_App(), d);
+            }
             /* Scrolling has stopped, begin filling up the buffer. */
             if (d->visBuf->buffers[0].texture) {
-                addTicker_App(prerender_DocumentWidget_, d);
+                addBackgroundTicker_App(prerender_DocumentWidget_, d);
             }
         }
         return iTrue;
@@ -2768,6 +3308,17 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         if (equal_Command(cmd, "font.changed")) {
             invalidateCachedLayout_History(d->mod.history);   
         }
+        if (isHibernating_GmDocument(d->doc)) {
+            return iFalse; /* laid out when woken up */
+        }
+        if (!isVisible_Widget(w) && !equal_Command(cmd, "font.changed")) {
+            /* Background tabs are laid out when shown; the working set is done on idle. */
+            invalidate_DocumentWidget_(d);
+            if (d->flags & warm_DocumentWidgetFlag) {
+                addBackgroundTicker_App(preload_DocumentWidget_, d);
+            }
+            return iFalse;
+        }
         /* Alt/Option key may be involved in window size changes. */
         setLinkNumberMode_DocumentWidget_(d, iFalse);
         d->phoneToolbar = findWidget_App("toolbar");
@@ -2818,10 +3369,19 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     else if (equal_Command(cmd, "tabs.changed")) {
         setLinkNumberMode_DocumentWidget_(d, iFalse);
         if (cmp_String(id_Widget(w), suffixPtr_Command(cmd, "id")) == 0) {
+            d->numTimesShown++;
             /* Set palette for our document. */
             updateTheme_DocumentWidget_(d);
             updateTrust_DocumentWidget_(d, NULL);
-            updateSize_DocumentWidget(d);
+            if (d->flags & warm_DocumentWidgetFlag &&
+                documentWidth_DocumentWidget_(d) == size_GmDocument(d->doc).x) {
+                /* Already laid out and rendered in the background. */
+                updateVisible_DocumentWidget_(d);
+                arrange_Widget(d->footerButtons);
+            }
+            else {
+                updateSize_DocumentWidget(d);
+            }
             showOrHidePinningIndicator_DocumentWidget_(d);
             updateFetchProgress_DocumentWidget_(d);
             updateHover_Window(window_Widget(w));
@@ -2830,6 +3390,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         init_Anim(&d->altTextOpacity, 0);
         updateSideOpacity_DocumentWidget_(d, iFalse);
         updateWindowTitle_DocumentWidget_(d);
+        updateWorkingSet_DocumentWidget_(d);
         allocVisBuffer_DocumentWidget_(d);
         animateMedia_DocumentWidget_(d);
         remove_Periodic(periodic_App(), d);
@@ -2888,6 +3449,15 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
                     msg, "%s\n", formatCStrs_Lang("num.bytes.n", size_Block(&d->sourceContent)));
             }
         }
+        if (d->sourceTiming.finished) {
+            const iGmTiming *tm = &d->sourceTiming;
+            appendFormat_String(msg,
+                                cstr_Lang("pageinfo.timing"),
+                                tm->connected,
+                                tm->firstByte,
+                                tm->finished);
+            appendCStr_String(msg, "\n");
+        }
         /* TODO: On mobile, omit the CA status. */
         appendFormat_String(
             msg,
@@ -3009,8 +3579,8 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     }
     else if (equal_Command(cmd, "document.copylink") && document_App() == d) {
         if (d->contextLink) {
-            SDL_SetClipboardText(cstr_String(canonicalUrl_String(absoluteUrl_String(
-                d->mod.url, linkUrl_GmDocument(d->doc, d->contextLink->linkId)))));
+            SDL_SetClipboardText(
+                cstr_String(linkUrl_GmDocument(d->doc, d->contextLink->linkId)));
         }
         else {
             SDL_SetClipboardText(cstr_String(canonicalUrl_String(d->mod.url)));
@@ -3053,7 +3623,9 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         if (document_App() == d) {
             updateFetchProgress_DocumentWidget_(d);
         }
+        start_ProfilerScope(request);
         checkResponse_DocumentWidget_(d);
+        stop_ProfilerScope(request);
         set_Atomic(&d->isRequestUpdated, iFalse); /* ready to be notified again */
         return iFalse;
     }
@@ -3068,9 +3640,13 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
                           cstr_String(meta_GmRequest(d->request)));
         }
         updateFetchProgress_DocumentWidget_(d);
+        start_ProfilerScope(request);
+        flow_Profiler(step_ProfilerFlow, "request", id_GmRequest(d->request));
         checkResponse_DocumentWidget_(d);
+        stop_ProfilerScope(request);
+        d->paintFlowId = id_GmRequest(d->request);
         if (category_GmStatusCode(status_GmRequest(d->request)) == categorySuccess_GmStatusCode) {
-            init_Anim(&d->scrollY.pos, d->initNormScrollY * pageHeight_DocumentWidget_(d)); /* TODO: unless user already scrolled! */
+            restoreScroll_DocumentWidget_(d); /* TODO: unless user already scrolled! */
         }
         addBannerWarnings_DocumentWidget_(d);
         iChangeFlags(d->flags,
@@ -3087,7 +3663,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
                 unlockResponse_GmRequest(d->request);
             }
         }
-        iReleasePtr(&d->request);
+        releaseRequest_DocumentWidget_(d);
         updateVisible_DocumentWidget_(d);
         d->drawBufs->flags |= updateSideBuf_DrawBufsFlag;
         postCommandf_Root(w->root,
@@ -3096,13 +3672,30 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
                           d->sourceStatus,
                           cstr_String(d->mod.url));
         /* Check for a pending goto. */
-        if (!isEmpty_String(&d->pendingGotoHeading)) {
+        if (!isEmpty_String(&d->pendingGotoHeading) && !isLayoutPending_GmDocument(d->doc)) {
             scrollToHeading_DocumentWidget_(d, cstr_String(&d->pendingGotoHeading));
             clear_String(&d->pendingGotoHeading);
         }
         cacheDocumentGlyphs_DocumentWidget_(d);
         return iFalse;
     }
+    else if (equal_Command(cmd, "document.layout.finished") &&
+             pointerLabel_Command(cmd, "doc") == d->doc) {
+        if (finishLayout_GmDocument(d->doc)) {
+            documentWasChanged_DocumentWidget_(d);
+            postCommandf_Root(w->root,
+                              "document.changed doc:%p status:%d url:%s",
+                              d,
+                              d->sourceStatus,
+                              cstr_String(d->mod.url));
+            if (!isEmpty_String(&d->pendingGotoHeading)) {
+                scrollToHeading_DocumentWidget_(d, cstr_String(&d->pendingGotoHeading));
+                clear_String(&d->pendingGotoHeading);
+            }
+            cacheDocumentGlyphs_DocumentWidget_(d);
+        }
+        return iFalse;
+    }
     else if (equal_Command(cmd, "document.translate") && d == document_App()) {
         if (!d->translation) {
             d->translation = new_Translation(d);
@@ -3136,6 +3729,14 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     else if (equal_Command(cmd, "media.updated") || equal_Command(cmd, "media.finished")) {
         return handleMediaCommand_DocumentWidget_(d, cmd);
     }
+    else if (equal_Command(cmd, "media.decoded")) {
+        /* Other documents may also have images waiting to be uploaded. */
+        if (finishDecoding_Media(media_GmDocument(d->doc))) {
+            invalidate_DocumentWidget_(d);
+            refresh_Widget(w);
+        }
+        return iFalse;
+    }
     else if (equal_Command(cmd, "media.player.started")) {
         /* When one media player starts, pause the others that may be playing. */
         const iPlayer *startedPlr = pointerLabel_Command(cmd, "player");
@@ -3245,7 +3846,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         if (d->request) {
             postCommandf_Root(w->root,
                 "document.request.cancelled doc:%p url:%s", d, cstr_String(d->mod.url));
-            iReleasePtr(&d->request);
+            releaseRequest_DocumentWidget_(d);
             updateFetchProgress_DocumentWidget_(d);
         }
         goBack_History(d->mod.history);
@@ -3336,7 +3937,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
             return iTrue;
         }
         const char *loc = pointerLabel_Command(cmd, "loc");
-        const iGmRun *run = findRunAtLoc_GmDocument(d->doc, loc);
+        const iGmRun *run = findRunAtLoc_DocumentWidget_(d, loc);
         if (run) {
             scrollTo_DocumentWidget_(d, run->visBounds.pos.y, iFalse);
         }
@@ -3345,7 +3946,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     else if ((equal_Command(cmd, "find.next") || equal_Command(cmd, "find.prev")) &&
              document_App() == d) {
         const int dir = equal_Command(cmd, "find.next") ? +1 : -1;
-        iRangecc (*finder)(const iGmDocument *, const iString *, const char *) =
+        iRangecc (*finder)(const iGmDocument *, const char *) =
             dir > 0 ? findText_GmDocument : findTextBefore_GmDocument;
         iInputWidget *find = findWidget_App("find.input");
         if (isEmpty_String(text_InputWidget(find))) {
@@ -3353,19 +3954,20 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         }
         else {
             const iBool wrap = d->foundMark.start != NULL;
-            d->foundMark     = finder(d->doc, text_InputWidget(find), dir > 0 ? d->foundMark.end
-                                                                          : d->foundMark.start);
+            setFindText_GmDocument(d->doc, text_InputWidget(find));
+            d->foundMark = finder(d->doc, dir > 0 ? d->foundMark.end : d->foundMark.start);
             if (!d->foundMark.start && wrap) {
                 /* Wrap around. */
-                d->foundMark = finder(d->doc, text_InputWidget(find), NULL);
+                d->foundMark = finder(d->doc, NULL);
             }
             if (d->foundMark.start) {
                 const iGmRun *found;
-                if ((found = findRunAtLoc_GmDocument(d->doc, d->foundMark.start)) != NULL) {
+                if ((found = findRunAtLoc_DocumentWidget_(d, d->foundMark.start)) != NULL) {
                     scrollTo_DocumentWidget_(d, mid_Rect(found->bounds).y, iTrue);
                 }
             }
         }
+        updateFindCount_DocumentWidget_(d, iTrue);
         if (flags_Widget(w) & touchDrag_WidgetFlag) {
             postCommand_Root(w->root, "document.select arg:0"); /* we can't handle both at the same time */
         }
@@ -3377,6 +3979,7 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
     else if (equal_Command(cmd, "find.clearmark")) {
         if (d->foundMark.start) {
             d->foundMark = iNullRange;
+            updateFindCount_DocumentWidget_(d, iFalse);
             refresh_Widget(w);
         }
         return iTrue;
@@ -3385,11 +3988,18 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
         iPtrArray *links = collectNew_PtrArray();
         render_GmDocument(d->doc, (iRangei){ 0, size_GmDocument(d->doc).y }, addAllLinks_, links);
         /* Find links that aren't already bookmarked. */
+        const size_t    numLinks = size_PtrArray(links);
+        const iString **urls     = malloc(sizeof(const iString *) * iMax(1u, numLinks));
+        uint32_t       *bmids    = malloc(sizeof(uint32_t) * iMax(1u, numLinks));
+        iConstForEach(PtrArray, u, links) {
+            const iGmRun *run = u.ptr;
+            urls[index_PtrArrayConstIterator(&u)] = linkUrl_GmDocument(d->doc, run->linkId);
+        }
+        findUrls_Bookmarks(bookmarks_App(), numLinks, urls, bmids);
+        size_t linkIndex = 0;
         iForEach(PtrArray, i, links) {
-            const iGmRun *run = i.ptr;
-            uint32_t      bmid;
-            if ((bmid = findUrl_Bookmarks(bookmarks_App(),
-                                          linkUrl_GmDocument(d->doc, run->linkId))) != 0) {
+            const uint32_t bmid = bmids[linkIndex++];
+            if (bmid) {
                 const iBookmark *bm = get_Bookmarks(bookmarks_App(), bmid);
                 /* We can import local copies of remote bookmarks. */
                 if (!hasTag_Bookmark(bm, remote_BookmarkTag)) {
@@ -3397,6 +4007,8 @@ static iBool handleCommand_DocumentWidget_(iDocumentWidget *d, const char *cmd)
                 }
             }
         }
+        free(bmids);
+        free(urls);
         if (!isEmpty_PtrArray(links)) {
             if (argLabel_Command(cmd, "confirm")) {
                 const size_t count = size_PtrArray(links);
@@ -3574,7 +4186,7 @@ static iBool processMediaEvents_DocumentWidget_(iDocumentWidget *d, const SDL_Ev
                 return iTrue;
             }
             else if (contains_Rect(ui.rewindRect, mouse)) {
-                if (isStarted_Player(plr) && time_Player(plr) > 0.5f) {
+                if (isStarted_Player(plr) && time_Player(plr) > 0.5f && !isStreaming_Player(plr)) {
                     stop_Player(plr);
                     start_Player(plr);
                     setPaused_Player(plr, iTrue);
@@ -3582,6 +4194,14 @@ static iBool processMediaEvents_DocumentWidget_(iDocumentWidget *d, const SDL_Ev
                 refresh_Widget(d);
                 return iTrue;
             }
+            else if (contains_Rect(ui.scrubberRect, mouse)) {
+                const float seekTime = scrubberTime_PlayerUI(&ui, mouse);
+                if (seekTime >= 0 && seek_Player(plr, seekTime)) {
+                    animateMedia_DocumentWidget_(d);
+                }
+                refresh_Widget(d);
+                return iTrue;
+            }
             else if (contains_Rect(ui.volumeRect, mouse)) {
                 setFlags_Player(plr,
                                 adjustingVolume_PlayerFlag,
@@ -3684,6 +4304,12 @@ static void beginMarkingSelection_DocumentWidget_(iDocumentWidget *d, iInt2 pos)
 
 static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *ev) {
     iWidget *w = as_Widget(d);
+    if (d->flags & pendingRestore_DocumentWidgetFlag && isVisible_Widget(w)) {
+        restorePending_DocumentWidget_(d);
+    }
+    if (isHibernating_GmDocument(d->doc) && isVisible_Widget(w)) {
+        wake_DocumentWidget_(d);
+    }
     if (isMetricsChange_UserEvent(ev)) {
         updateSize_DocumentWidget(d);
     }
@@ -3709,6 +4335,7 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                     visibleLinkOrdinal_DocumentWidget_(d, run->linkId) == ord) {
                     if (d->flags & setHoverViaKeys_DocumentWidgetFlag) {
                         d->hoverLink = run;
+                        schedulePrefetch_DocumentWidget_(d);
                     }
                     else {
                         postCommandf_Root(w->root,
@@ -3718,8 +4345,7 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                                                  numbersAndAlphabet_DocumentLinkOrdinalMode
                                              ? openTabMode_Sym(modState_Keys())
                                              : (d->flags & newTabViaHomeKeys_DocumentWidgetFlag ? 1 : 0)),
-                                          cstr_String(absoluteUrl_String(
-                                             d->mod.url, linkUrl_GmDocument(d->doc, run->linkId))));
+                                          cstr_String(linkUrl_GmDocument(d->doc, run->linkId)));
                     }
                     setLinkNumberMode_DocumentWidget_(d, iFalse);
                     invalidateVisibleLinks_DocumentWidget_(d);
@@ -3779,7 +4405,12 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
         if (isPerPixel_MouseWheelEvent(&ev->wheel)) {
             const iInt2 wheel = init_I2(ev->wheel.x, ev->wheel.y);
             stop_Anim(&d->scrollY.pos);
-            immediateScroll_DocumentWidget_(d, -wheel.y);
+            if (ev->wheel.which == SDL_TOUCH_MOUSEID) {
+                immediateScroll_DocumentWidget_(d, -wheel.y); /* already once per frame */
+            }
+            else {
+                addPerPixelScroll_DocumentWidget_(d, -wheel.y);
+            }
             scrollWideBlock_DocumentWidget_(d, mouseCoord, -wheel.x, 0);
         }
         else {
@@ -3985,6 +4616,7 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                             { "---" },
                             { book_Icon " ${menu.page.import}", 0, 0, "bookmark.links confirm:1" },
                             { globe_Icon " ${menu.page.translate}", 0, 0, "document.translate" },
+                            { download_Icon " ${menu.page.mirror}", 0, 0, "mirror.start" },
                             { upload_Icon " ${menu.page.upload}", 0, 0, "document.upload" },
                             { "---" },
                             { "${menu.page.copyurl}", 0, 0, "document.copylink" } },
@@ -4212,7 +4844,7 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                                 /* Cancel a partially received request. */ {
                                     iMediaRequest *req = findMediaRequest_DocumentWidget_(d, linkId);
                                     if (!isFinished_GmRequest(req->req)) {
-                                        cancel_GmRequest(req->req);
+                                        cancel_RequestBroker(req->req, req);
                                         removeMediaRequest_DocumentWidget_(d, linkId);
                                         /* Note: Some of the audio IDs have changed now, layout must
                                            be redone. */
@@ -4258,12 +4890,10 @@ static iBool processEvent_DocumentWidget_(iDocumentWidget *d, const SDL_Event *e
                         }
                         postCommandf_Root(w->root, "open newtab:%d url:%s",
                                          tabMode,
-                                         cstr_String(absoluteUrl_String(
-                                             d->mod.url, linkUrl_GmDocument(d->doc, linkId))));
+                                         cstr_String(linkUrl_GmDocument(d->doc, linkId)));
                     }
                     else {
-                        const iString *url = absoluteUrl_String(
-                            d->mod.url, linkUrl_GmDocument(d->doc, linkId));
+                        const iString *url = linkUrl_GmDocument(d->doc, linkId);
                         makeQuestion_Widget(
                             uiTextCaution_ColorEscape "${heading.openlink}",
                             format_CStr(
@@ -4307,6 +4937,7 @@ struct Impl_DrawContext {
     iPaint paint;
     iBool inSelectMark;
     iBool inFoundMark;
+    iBool          isFinding; /* all matches are framed while a find mark is shown */
     iBool showLinkNumbers;
     iRect firstMarkRect;
     iRect lastMarkRect;
@@ -4369,14 +5000,113 @@ static void fillRange_DrawContext_(iDrawContext *d, const iGmRun *run, enum iCol
     }
 }
 
+typedef struct {
+    iDrawContext *context;
+    const iGmRun *run;
+} iFoundFrameContext_;
+
+static void frameFound_DrawContext_(void *context, iRangecc found) {
+    const iFoundFrameContext_ *frame = context;
+    const iDrawContext        *d     = frame->context;
+    const iGmRun              *run   = frame->run;
+    const iRangecc             mark  = { iMax(found.start, run->text.start),
+                                         iMin(found.end, run->text.end) };
+    if (isEmpty_Range(&mark)) {
+        return;
+    }
+    const int x = measureRange_Text(run->font, (iRangecc){ run->text.start, mark.start }).advance.x;
+    const int w = iMin(measureRange_Text(run->font, mark).advance.x,
+                       width_Rect(run->visBounds) - x);
+    if (w > 0) {
+        const iInt2 visPos =
+            add_I2(run->bounds.pos, addY_I2(d->viewPos, viewPos_DocumentWidget_(d->widget)));
+        drawRect_Paint(&d->paint,
+                       (iRect){ addX_I2(visPos, x), init_I2(w, height_Rect(run->bounds)) },
+                       uiMatching_ColorId);
+    }
+}
+
 static void drawMark_DrawContext_(void *context, const iGmRun *run) {
     iDrawContext *d = context;
     if (!isMedia_GmRun(run)) {
+        if (d->isFinding && ~run->flags & decoration_GmRunFlag) {
+            foundInRange_GmDocument(d->widget->doc, run->text, frameFound_DrawContext_,
+                                    &(iFoundFrameContext_){ d, run });
+        }
         fillRange_DrawContext_(d, run, uiMatching_ColorId, d->widget->foundMark, &d->inFoundMark);
         fillRange_DrawContext_(d, run, uiMarked_ColorId, d->widget->selectMark, &d->inSelectMark);
     }
 }
 
+static void drawRunBackground_DrawContext_(void *context, const iGmRun *run) {
+    /* Solid fills and lines under the run. These are drawn for all runs in a buffer before
+       any text, so they can be batched. The plain background of a run is cleared with its
+       text instead (see `drawRun_DrawContext_`). */
+    iDrawContext *d      = context;
+    const iInt2   origin = d->viewPos;
+    if (run->mediaType == image_MediaType) {
+        const iRect dst = moved_Rect(run->visBounds, origin);
+        if (imageTexture_Media(media_GmDocument(d->widget->doc), mediaId_GmRun(run))) {
+            fillRect_Paint(&d->paint, dst, tmBackground_ColorId); /* in case the image has alpha */
+        }
+        else {
+            drawRect_Paint(&d->paint, dst, tmQuoteIcon_ColorId); /* placeholder */
+        }
+        return;
+    }
+    else if (isMedia_GmRun(run)) {
+        return;
+    }
+    const int linkFlags = linkFlags_GmDocument(d->widget->doc, run->linkId);
+    /* Visible (scrolled) position of the run. */
+    const iInt2 visPos = addX_I2(add_I2(run->visBounds.pos, origin),
+                                 /* Preformatted runs can be scrolled. */
+                                 runOffset_DocumentWidget_(d->widget, run));
+    const iRect visRect = { visPos, run->visBounds.size };
+    /* Fill the background. */ {
+        if (run->linkId && linkFlags & isOpen_GmLinkFlag && ~linkFlags & content_GmLinkFlag) {
+            /* Open links get a highlighted background. */
+            int       bg       = tmBackgroundOpenLink_ColorId;
+            const int frame    = tmFrameOpenLink_ColorId;
+            iRect     wideRect = { init_I2(left_Rect(d->widgetBounds), visPos.y),
+                                   init_I2(width_Rect(d->widgetBounds) +
+                                           width_Widget(d->widget->scroll),
+                                           height_Rect(run->visBounds)) };
+            /* The first line is composed of two runs that may be drawn in either order, so
+               only draw half of the background. */
+            if (run->flags & decoration_GmRunFlag) {
+                wideRect.size.x = right_Rect(visRect) - left_Rect(wideRect);
+            }
+            else if (run->flags & startOfLine_GmRunFlag) {
+                wideRect.size.x = right_Rect(wideRect) - left_Rect(visRect);
+                wideRect.pos.x  = left_Rect(visRect);
+            }
+            fillRect_Paint(&d->paint, wideRect, bg);
+            if (run->flags & (startOfLine_GmRunFlag | decoration_GmRunFlag)) {
+                drawHLine_Paint(&d->paint, topLeft_Rect(wideRect), width_Rect(wideRect), frame);
+            }
+            /* TODO: The decoration is not marked as endOfLine, so it lacks the bottom line. */
+//            if (run->flags & endOfLine_GmRunFlag) {
+//                drawHLine_Paint(
+//                    &d->paint, addY_I2(bottomLeft_Rect(wideRect), -1), width_Rect(wideRect), frame);
+//            }
+        }
+    }
+    if (run->flags & altText_GmRunFlag) {
+        fillRect_Paint(&d->paint, visRect, tmBackgroundAltText_ColorId);
+        drawRect_Paint(&d->paint, visRect, tmFrameAltText_ColorId);
+    }
+    else if (run->flags & quoteBorder_GmRunFlag) {
+        drawVLine_Paint(&d->paint,
+                        addX_I2(visPos,
+                                !run->isRTL
+                                    ? -gap_Text * 5 / 2
+                                    : (width_Rect(run->visBounds) + gap_Text * 5 / 2)),
+                        height_Rect(run->visBounds),
+                        tmQuoteIcon_ColorId);
+    }
+}
+
 static void drawRun_DrawContext_(void *context, const iGmRun *run) {
     iDrawContext *d      = context;
     const iInt2   origin = d->viewPos;
@@ -4392,12 +5122,10 @@ static void drawRun_DrawContext_(void *context, const iGmRun *run) {
         SDL_Texture *tex = imageTexture_Media(media_GmDocument(d->widget->doc), mediaId_GmRun(run));
         const iRect dst = moved_Rect(run->visBounds, origin);
         if (tex) {
-            fillRect_Paint(&d->paint, dst, tmBackground_ColorId); /* in case the image has alpha */
             SDL_RenderCopy(d->paint.dst->render, tex, NULL,
                            &(SDL_Rect){ dst.pos.x, dst.pos.y, dst.size.x, dst.size.y });
         }
-        else {
-            drawRect_Paint(&d->paint, dst, tmQuoteIcon_ColorId);
+        else if (!isImageDecoding_Media(media_GmDocument(d->widget->doc), mediaId_GmRun(run))) {
             drawCentered_Text(uiLabel_FontId,
                               dst,
                               iFalse,
@@ -4421,7 +5149,15 @@ static void drawRun_DrawContext_(void *context, const iGmRun *run) {
     const iInt2 visPos = addX_I2(add_I2(run->visBounds.pos, origin),
                                  /* Preformatted runs can be scrolled. */
                                  runOffset_DocumentWidget_(d->widget, run));
-    const iRect visRect = { visPos, run->visBounds.size };
+    if (~run->flags & altText_GmRunFlag &&
+        !(run->linkId && linkFlags & isOpen_GmLinkFlag && ~linkFlags & content_GmLinkFlag)) {
+        /* Normal background for other runs. There are cases when runs get drawn multiple times,
+           e.g., at the buffer boundary, and there are slightly overlapping characters in
+           monospace blocks. Clearing the background right before the text ensures a cleaner
+           visual appearance since only one glyph is visible at any given point. This is not
+           part of the batched backgrounds, which would be drawn before any of the text. */
+        fillRect_Paint(&d->paint, (iRect){ visPos, run->visBounds.size }, tmBackground_ColorId);
+    }
 #if 0
     if (run->flags & footer_GmRunFlag) {
         iRect footerBack =
@@ -4431,42 +5167,6 @@ static void drawRun_DrawContext_(void *context, const iGmRun *run) {
         return;
     }
 #endif
-    /* Fill the background. */ {
-        if (run->linkId && linkFlags & isOpen_GmLinkFlag && ~linkFlags & content_GmLinkFlag) {
-            /* Open links get a highlighted background. */
-            int       bg       = tmBackgroundOpenLink_ColorId;
-            const int frame    = tmFrameOpenLink_ColorId;
-            iRect     wideRect = { init_I2(left_Rect(d->widgetBounds), visPos.y),
-                                   init_I2(width_Rect(d->widgetBounds) +
-                                           width_Widget(d->widget->scroll),
-                                           height_Rect(run->visBounds)) };
-            /* The first line is composed of two runs that may be drawn in either order, so
-               only draw half of the background. */
-            if (run->flags & decoration_GmRunFlag) {
-                wideRect.size.x = right_Rect(visRect) - left_Rect(wideRect);
-            }
-            else if (run->flags & startOfLine_GmRunFlag) {
-                wideRect.size.x = right_Rect(wideRect) - left_Rect(visRect);
-                wideRect.pos.x  = left_Rect(visRect);
-            }
-            fillRect_Paint(&d->paint, wideRect, bg);
-            if (run->flags & (startOfLine_GmRunFlag | decoration_GmRunFlag)) {
-                drawHLine_Paint(&d->paint, topLeft_Rect(wideRect), width_Rect(wideRect), frame);
-            }
-            /* TODO: The decoration is not marked as endOfLine, so it lacks the bottom line. */
-//            if (run->flags & endOfLine_GmRunFlag) {
-//                drawHLine_Paint(
-//                    &d->paint, addY_I2(bottomLeft_Rect(wideRect), -1), width_Rect(wideRect), frame);
-//            }
-        }
-        else { 
-            /* Normal background for other runs. There are cases when runs get drawn multiple times,
-               e.g., at the buffer boundary, and there are slightly overlapping characters in
-               monospace blocks. Clearing the background here ensures a cleaner visual appearance
-               since only one glyph is visible at any given point. */
-            fillRect_Paint(&d->paint, (iRect){ visPos, run->visBounds.size }, tmBackground_ColorId);
-        }
-    }
     if (run->linkId && ~run->flags & decoration_GmRunFlag) {
         fg = linkColor_GmDocument(doc, run->linkId, isHover ? textHover_GmLinkPart : text_GmLinkPart);
         if (linkFlags & content_GmLinkFlag) {
@@ -4475,8 +5175,6 @@ static void drawRun_DrawContext_(void *context, const iGmRun *run) {
     }
     if (run->flags & altText_GmRunFlag) {
         const iInt2 margin = preRunMargin_GmDocument(doc, preId_GmRun(run));
-        fillRect_Paint(&d->paint, (iRect){ visPos, run->visBounds.size }, tmBackgroundAltText_ColorId);
-        drawRect_Paint(&d->paint, (iRect){ visPos, run->visBounds.size }, tmFrameAltText_ColorId);
         drawWrapRange_Text(run->font,
                            add_I2(visPos, margin),
                            run->visBounds.size.x - 2 * margin.x,
@@ -4518,15 +5216,6 @@ static void drawRun_DrawContext_(void *context, const iGmRun *run) {
                 }
             }
         }
-        if (run->flags & quoteBorder_GmRunFlag) {
-            drawVLine_Paint(&d->paint,
-                            addX_I2(visPos,
-                                    !run->isRTL
-                                        ? -gap_Text * 5 / 2
-                                        : (width_Rect(run->visBounds) + gap_Text * 5 / 2)),
-                            height_Rect(run->visBounds),
-                            tmQuoteIcon_ColorId);
-        }
         /* Base attributes. */ {
             int f, c;
             runBaseAttributes_GmDocument(doc, run, &f, &c);
@@ -4688,6 +5377,25 @@ static void drawRun_DrawContext_(void *context, const iGmRun *run) {
     }
 }
 
+static void drawRuns_DrawContext_(iDrawContext *d, iRangei visRange) {
+    /* The backgrounds of all the runs are submitted as one batch before the text. */
+    beginBatch_Paint(&d->paint);
+    render_GmDocument(d->widget->doc, visRange, drawRunBackground_DrawContext_, d);
+    endBatch_Paint(&d->paint);
+    render_GmDocument(d->widget->doc, visRange, drawRun_DrawContext_, d);
+}
+
+static const iGmRun *drawRunsProgressive_DrawContext_(iDrawContext *d, const iGmRun *first,
+                                                      int dir, size_t maxCount,
+                                                      iRangei visRange) {
+    beginBatch_Paint(&d->paint);
+    renderProgressive_GmDocument(d->widget->doc, first, dir, maxCount, visRange,
+                                 drawRunBackground_DrawContext_, d);
+    endBatch_Paint(&d->paint);
+    return renderProgressive_GmDocument(d->widget->doc, first, dir, maxCount, visRange,
+                                        drawRun_DrawContext_, d);
+}
+
 static int drawSideRect_(iPaint *p, iRect rect) {
     int bg = tmBannerBackground_ColorId;
     int fg = tmBannerIcon_ColorId;
@@ -4778,7 +5486,9 @@ static void drawSideElements_DocumentWidget_(const iDocumentWidget *d) {
     iDrawBufs *    dbuf      = d->drawBufs;
     iPaint         p;
     init_Paint(&p);
-    setClip_Paint(&p, boundsWithoutVisualOffset_Widget(w));
+    if (!setClip_Paint(&p, boundsWithoutVisualOffset_Widget(w))) {
+        return;
+    }
     /* Side icon and current heading. */
     if (prefs_App()->sideIcon && opacity > 0 && dbuf->sideIconBuf) {
         const iInt2 texSize = size_SDLTexture(dbuf->sideIconBuf);
@@ -4835,6 +5545,32 @@ static void extend_GmRunRange_(iGmRunRange *runs) {
     }
 }
 
+static void prerenderOrder_DocumentWidget_(const iVisBuf *visBuf, size_t *order) {
+    /* Buffers are prerendered starting from the visible ones, then the ones ahead in the
+       direction of motion (nearest first), and finally the ones left behind. */
+    const size_t num     = visBuf->numBuffers;
+    const iBool  isDown  = visBuf->moveDir >= 0;
+    size_t       n       = 0;
+    for (size_t i = 0; i < num; i++) {
+        if (isOverlapping_Rangei(bufferRange_VisBuf(visBuf, i), visBuf->vis)) {
+            order[n++] = i;
+        }
+    }
+    for (int pass = 0; pass < 2; pass++) {
+        const iBool isAhead = (pass == 0);
+        /* Below the visible range in top-down order, above it in bottom-up order. */
+        const iBool isBelow = (isAhead == isDown);
+        for (size_t k = 0; k < num; k++) {
+            const size_t  i = isBelow ? k : num - 1 - k;
+            const iRangei r = bufferRange_VisBuf(visBuf, i);
+            if (isBelow ? r.start >= visBuf->vis.end : r.end <= visBuf->vis.start) {
+                order[n++] = i;
+            }
+        }
+    }
+    iAssert(n == num);
+}
+
 static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx, iBool prerenderExtra) {
     iBool didDraw = iFalse;
     const iRect bounds = bounds_Widget(constAs_Widget(d));
@@ -4847,11 +5583,16 @@ static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx,
     /* Swap buffers around to have room available both before and after the visible region. */
     allocVisBuffer_DocumentWidget_(d);
     reposition_VisBuf(visBuf, vis);
+    predict_VisBuf(visBuf, predictedTarget_SmoothScroll(&d->scrollY) -
+                               (int) pos_SmoothScroll(&d->scrollY));
     /* Redraw the invalid ranges. */
     if (~flags_Widget(constAs_Widget(d)) & destroyPending_WidgetFlag) {
         iPaint *p = &ctx->paint;
         init_Paint(p);
-        iForIndices(i, visBuf->buffers) {
+        size_t order[maxBuffers_VisBuf];
+        prerenderOrder_DocumentWidget_(visBuf, order);
+        for (size_t k = 0; k < visBuf->numBuffers; k++) {
+            const size_t    i           = prerenderExtra ? order[k] : k;
             iVisBufTexture *buf         = &visBuf->buffers[i];
             iVisBufMeta    *meta        = buf->user;
             const iRangei   bufRange    = intersect_Rangei(bufferRange_VisBuf(visBuf, i), full);
@@ -4861,6 +5602,9 @@ static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx,
 //            printf("  buffer %zu: buf vis range %d...%d\n", i, bufVisRange.start, bufVisRange.end);
             if (!prerenderExtra && !isEmpty_Range(&bufVisRange)) {
                 didDraw = iTrue;
+                countAccess_VisBuf(visBuf,
+                                   buf->validRange.start <= bufVisRange.start &&
+                                       buf->validRange.end >= bufVisRange.end);
                 if (isEmpty_Rangei(buf->validRange)) {
                     /* Fill the required currently visible range (vis). */
                     const iRangei bufVisRange = intersect_Rangei(bufRange, vis);
@@ -4868,7 +5612,7 @@ static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx,
                         beginTarget_Paint(p, buf->texture);
                         fillRect_Paint(p, (iRect){ zero_I2(), visBuf->texSize }, tmBackground_ColorId);
                         iZap(ctx->runsDrawn);
-                        render_GmDocument(d->doc, bufVisRange, drawRun_DrawContext_, ctx);
+                        drawRuns_DrawContext_(ctx, bufVisRange);
                         meta->runsDrawn = ctx->runsDrawn;
                         extend_GmRunRange_(&meta->runsDrawn);
                         buf->validRange = bufVisRange;
@@ -4879,20 +5623,14 @@ static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx,
                     /* Progressively fill the required runs. */
                     if (meta->runsDrawn.start) {
                         beginTarget_Paint(p, buf->texture);
-                        meta->runsDrawn.start = renderProgressive_GmDocument(d->doc, meta->runsDrawn.start,
-                                                                             -1, iInvalidSize,
-                                                                             bufVisRange,
-                                                                             drawRun_DrawContext_,
-                                                                             ctx);
+                        meta->runsDrawn.start = drawRunsProgressive_DrawContext_(
+                            ctx, meta->runsDrawn.start, -1, iInvalidSize, bufVisRange);
                         buf->validRange.start = bufVisRange.start;
                     }
                     if (meta->runsDrawn.end) {
                         beginTarget_Paint(p, buf->texture);
-                        meta->runsDrawn.end = renderProgressive_GmDocument(d->doc, meta->runsDrawn.end,
-                                                                           +1, iInvalidSize,
-                                                                           bufVisRange,
-                                                                           drawRun_DrawContext_,
-                                                                           ctx);
+                        meta->runsDrawn.end = drawRunsProgressive_DrawContext_(
+                            ctx, meta->runsDrawn.end, +1, iInvalidSize, bufVisRange);
                         buf->validRange.end = bufVisRange.end;
                     }
                 }
@@ -4904,12 +5642,12 @@ static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx,
                 if (meta->runsDrawn.start == NULL) {
                     /* Haven't drawn anything yet in this buffer, so let's try seeding it. */
                     const int rh = lineHeight_Text(paragraph_FontId);
-                    const int y = i >= iElemCount(visBuf->buffers) / 2 ? bufRange.start : (bufRange.end - rh);
+                    const int y = buf->origin >= vis.start ? bufRange.start : (bufRange.end - rh);
                     beginTarget_Paint(p, buf->texture);
                     fillRect_Paint(p, (iRect){ zero_I2(), visBuf->texSize }, tmBackground_ColorId);
                     buf->validRange = (iRangei){ y, y + rh };
                     iZap(ctx->runsDrawn);
-                    render_GmDocument(d->doc, buf->validRange, drawRun_DrawContext_, ctx);
+                    drawRuns_DrawContext_(ctx, buf->validRange);
                     meta->runsDrawn = ctx->runsDrawn;
                     extend_GmRunRange_(&meta->runsDrawn);
 //                    printf("%zu: seeded, next %p:%p\n", i, meta->runsDrawn.start, meta->runsDrawn.end);
@@ -4920,10 +5658,8 @@ static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx,
                         const iRangei upper = intersect_Rangei(bufRange, (iRangei){ full.start, buf->validRange.start });
                         if (upper.end > upper.start) {
                             beginTarget_Paint(p, buf->texture);
-                            next = renderProgressive_GmDocument(d->doc, meta->runsDrawn.start,
-                                                                -1, 1, upper,
-                                                                drawRun_DrawContext_,
-                                                                ctx);
+                            next = drawRunsProgressive_DrawContext_(
+                                ctx, meta->runsDrawn.start, -1, 1, upper);
                             if (next && meta->runsDrawn.start != next) {
                                 meta->runsDrawn.start = next;
                                 buf->validRange.start = bottom_Rect(next->visBounds);
@@ -4938,10 +5674,8 @@ static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx,
                         const iRangei lower = intersect_Rangei(bufRange, (iRangei){ buf->validRange.end, full.end });
                         if (lower.end > lower.start) {
                             beginTarget_Paint(p, buf->texture);
-                            next = renderProgressive_GmDocument(d->doc, meta->runsDrawn.end,
-                                                                +1, 1, lower,
-                                                                drawRun_DrawContext_,
-                                                                ctx);
+                            next = drawRunsProgressive_DrawContext_(
+                                ctx, meta->runsDrawn.end, +1, 1, lower);
                             if (next && meta->runsDrawn.end != next) {
                                 meta->runsDrawn.end = next;
                                 buf->validRange.end = top_Rect(next->visBounds);
@@ -4957,25 +5691,38 @@ static iBool render_DocumentWidget_(const iDocumentWidget *d, iDrawContext *ctx,
             /* Draw any invalidated runs that fall within this buffer. */
             if (!prerenderExtra) {
                 const iRangei bufRange = { buf->origin, buf->origin + visBuf->texSize.y };
-                /* Clear full-width backgrounds first in case there are any dynamic elements. */ {
+                /* Clear full-width backgrounds first in case there are any dynamic elements.
+                   These and the run backgrounds go in one batch. */
+                iBool isBatching = iFalse;
+                iConstForEach(PtrSet, r, d->invalidRuns) {
+                    const iGmRun *run = *r.value;
+                    if (isOverlapping_Rangei(bufRange, ySpan_Rect(run->visBounds))) {
+                        if (!isBatching) {
+                            beginTarget_Paint(p, buf->texture);
+                            beginBatch_Paint(p);
+                            isBatching = iTrue;
+                        }
+                        fillRect_Paint(p,
+                                       init_Rect(0,
+                                                 run->visBounds.pos.y - buf->origin,
+                                                 visBuf->texSize.x,
+                                                 run->visBounds.size.y),
+                                       tmBackground_ColorId);
+                    }
+                }
+                if (isBatching) {
                     iConstForEach(PtrSet, r, d->invalidRuns) {
                         const iGmRun *run = *r.value;
                         if (isOverlapping_Rangei(bufRange, ySpan_Rect(run->visBounds))) {
-                            beginTarget_Paint(p, buf->texture);
-                            fillRect_Paint(p,
-                                           init_Rect(0,
-                                                     run->visBounds.pos.y - buf->origin,
-                                                     visBuf->texSize.x,
-                                                     run->visBounds.size.y),
-                                           tmBackground_ColorId);
+                            drawRunBackground_DrawContext_(ctx, run);
                         }
                     }
+                    endBatch_Paint(p);
                 }
                 setAnsiFlags_Text(ansiEscapes_GmDocument(d->doc));
                 iConstForEach(PtrSet, r, d->invalidRuns) {
                     const iGmRun *run = *r.value;
                     if (isOverlapping_Rangei(bufRange, ySpan_Rect(run->visBounds))) {
-                        beginTarget_Paint(p, buf->texture);
                         drawRun_DrawContext_(ctx, run);
                     }
                 }
@@ -5011,11 +5758,78 @@ static void prerender_DocumentWidget_(iAny *context) {
     if (d->visBuf->buffers[0].texture) {
         if (render_DocumentWidget_(d, &ctx, iTrue /* just fill up progressively */)) {
             /* Something was drawn, should check if there is still more to do. */
-            addTicker_App(prerender_DocumentWidget_, context);
+            addBackgroundTicker_App(prerender_DocumentWidget_, context);
         }
     }
 }
 
+static iBool isInWorkingSet_DocumentWidget_(const iDocumentWidget *d) {
+    /* The working set has the most recently shown tabs that the user keeps returning to.
+       Tabs visited only once are not worth keeping rendered. */
+    if (d->numTimesShown < 2 || d->state != ready_RequestState ||
+        isHibernating_GmDocument(d->doc)) {
+        return iFalse;
+    }
+    size_t numNewer = 0;
+    iConstForEach(ObjectList, i, children_Widget(constAs_Widget(d)->parent)) {
+        if (i.object == d || !isInstance_Object(i.object, &Class_DocumentWidget)) {
+            continue;
+        }
+        const iDocumentWidget *other = i.object;
+        if (!isVisible_Widget(other) && other->numTimesShown >= 2 &&
+            other->lastShownTime > d->lastShownTime) {
+            if (++numNewer == numWarmTabs_DocumentWidget_) {
+                return iFalse;
+            }
+        }
+    }
+    return iTrue;
+}
+
+static void updateWorkingSet_DocumentWidget_(iDocumentWidget *d) {
+    if (isVisible_Widget(d)) {
+        return;
+    }
+    iChangeFlags(d->flags, warm_DocumentWidgetFlag, isInWorkingSet_DocumentWidget_(d));
+    if (d->flags & warm_DocumentWidgetFlag) {
+        addBackgroundTicker_App(preload_DocumentWidget_, d);
+    }
+}
+
+static void preload_DocumentWidget_(iAny *context) {
+    /* Keeps a background tab of the working set laid out at the current width, with the
+       visible area rendered, so switching to it only needs to draw the VisBuf. */
+    if (current_Root() == NULL) {
+        return; /* see `prerender_DocumentWidget_` */
+    }
+    iDocumentWidget *d = context;
+    if (isVisible_Widget(d) || ~d->flags & warm_DocumentWidgetFlag ||
+        d->state != ready_RequestState || isHibernating_GmDocument(d->doc)) {
+        return;
+    }
+    if (updateDocumentWidthRetainingScrollPosition_DocumentWidget_(d, iFalse)) {
+        resetWideRuns_DocumentWidget_(d);
+        setWidth_Banner(d->banner, documentWidth_DocumentWidget(d));
+        updateVisible_DocumentWidget_(d);
+        invalidate_DocumentWidget_(d);
+        addBackgroundTicker_App(preload_DocumentWidget_, d); /* render in a later frame */
+        return;
+    }
+    iDrawContext ctx = {
+        .widget          = d,
+        .docBounds       = documentBounds_DocumentWidget_(d),
+        .vis             = visibleRange_DocumentWidget_(d),
+        .showLinkNumbers = iFalse,
+    };
+    /* The tab's own colors are used, not the ones of the current tab. */
+    iColor *globalPalette = get_Root()->tmPalette;
+    iColor  savedPalette[tmMax_ColorId];
+    memcpy(savedPalette, globalPalette, sizeof(savedPalette));
+    makePaletteGlobal_GmDocument(d->doc);
+    render_DocumentWidget_(d, &ctx, iFalse);
+    memcpy(globalPalette, savedPalette, sizeof(savedPalette));
+}
+
 static void draw_DocumentWidget_(const iDocumentWidget *d) {
     const iWidget *w                   = constAs_Widget(d);
     const iRect    bounds              = bounds_Widget(w);
@@ -5024,6 +5838,7 @@ static void draw_DocumentWidget_(const iDocumentWidget *d) {
     if (width_Rect(bounds) <= 0) {
         return;
     }
+    iConstCast(iDocumentWidget *, d)->lastShownTime = SDL_GetTicks();
     /* TODO: Come up with a better palette caching system.
        It should be able to recompute cached colors in `History` when the theme has changed.
        Cache the theme seed in `GmDocument`? */
@@ -5047,12 +5862,16 @@ static void draw_DocumentWidget_(const iDocumentWidget *d) {
     int         yTop             = docBounds.pos.y + viewPos_DocumentWidget_(d);
     const iBool isDocEmpty       = size_GmDocument(d->doc).y == 0;
     const iBool isTouchSelecting = (flags_Widget(w) & touchDrag_WidgetFlag) != 0;
-    if (!isDocEmpty || !isEmpty_Banner(d->banner)) {
+    if ((!isDocEmpty || !isEmpty_Banner(d->banner)) && setClip_Paint(&ctx.paint, clipBounds)) {
         const int docBgColor = isDocEmpty ? tmBannerBackground_ColorId : tmBackground_ColorId;
-        setClip_Paint(&ctx.paint, clipBounds);
         if (!isDocEmpty) {
             draw_VisBuf(d->visBuf, init_I2(bounds.pos.x, yTop), ySpan_Rect(bounds));
         }
+        if (d->paintFlowId) {
+            /* First paint of the finished request. */
+            flow_Profiler(end_ProfilerFlow, "request", d->paintFlowId);
+            iConstCast(iDocumentWidget *, d)->paintFlowId = 0;
+        }
         /* Text markers. */
         if (!isEmpty_Range(&d->foundMark) || !isEmpty_Range(&d->selectMark)) {
             SDL_Renderer *render = renderer_Window(get_Window());
@@ -5062,6 +5881,9 @@ static void draw_DocumentWidget_(const iDocumentWidget *d) {
                                        isDark_ColorTheme(colorTheme_App()) ? SDL_BLENDMODE_ADD
                                                                            : SDL_BLENDMODE_BLEND);
             ctx.viewPos = topLeft_Rect(docBounds);
+            if (!isEmpty_Range(&d->foundMark)) {
+                ctx.isFinding = iTrue;
+            }
             /* Marker starting outside the visible range? */
             if (d->visibleRuns.start) {
                 if (!isEmpty_Range(&d->selectMark) &&
@@ -5075,7 +5897,9 @@ static void draw_DocumentWidget_(const iDocumentWidget *d) {
                     ctx.inFoundMark = iTrue;
                 }
             }
+            beginBatch_Paint(&ctx.paint);
             render_GmDocument(d->doc, vis, drawMark_DrawContext_, &ctx);
+            endBatch_Paint(&ctx.paint);
             SDL_SetRenderDrawBlendMode(render, SDL_BLENDMODE_NONE);
             /* Selection range pins. */
             if (isTouchSelecting) {
@@ -5185,12 +6009,13 @@ static void draw_DocumentWidget_(const iDocumentWidget *d) {
     if (w->offsetRef) {
         const int offX = visualOffsetByReference_Widget(w);
         if (offX) {
-            setClip_Paint(&ctx.paint, clipBounds);
-            SDL_SetRenderDrawBlendMode(renderer_Window(get_Window()), SDL_BLENDMODE_BLEND);
-            ctx.paint.alpha = iAbs(offX) / (float) get_Window()->size.x * 300;
-            fillRect_Paint(&ctx.paint, bounds, backgroundFadeColor_Widget());
-            SDL_SetRenderDrawBlendMode(renderer_Window(get_Window()), SDL_BLENDMODE_NONE);
-            unsetClip_Paint(&ctx.paint);
+            if (setClip_Paint(&ctx.paint, clipBounds)) {
+                SDL_SetRenderDrawBlendMode(renderer_Window(get_Window()), SDL_BLENDMODE_BLEND);
+                ctx.paint.alpha = iAbs(offX) / (float) get_Window()->size.x * 300;
+                fillRect_Paint(&ctx.paint, bounds, backgroundFadeColor_Widget());
+                SDL_SetRenderDrawBlendMode(renderer_Window(get_Window()), SDL_BLENDMODE_NONE);
+                unsetClip_Paint(&ctx.paint);
+            }
         }
         else {
             /* TODO: Should have a better place to do this; drawing is supposed to be immutable. */
@@ -5224,6 +6049,74 @@ int documentWidth_DocumentWidget(const iDocumentWidget *d) {
     return documentWidth_DocumentWidget_(d);
 }
 
+iString *renderInfo_DocumentWidget(const iDocumentWidget *d) {
+    const iVisBuf *vb = d->visBuf;
+    return newFormat_String("VisBuf: %zu tiles of %d px, %u hits, %u misses\n",
+                            vb->numBuffers, vb->texSize.y, vb->numHits, vb->numMisses);
+}
+
+size_t textureSize_DocumentWidget(const iDocumentWidget *d) {
+    size_t size = memorySize_VisBuf(d->visBuf);
+    if (d->drawBufs->sideIconBuf) {
+        const iInt2 texSize = size_SDLTexture(d->drawBufs->sideIconBuf);
+        size += (size_t) texSize.x * texSize.y * 4;
+    }
+    if (d->drawBufs->timestampBuf) {
+        size += (size_t) d->drawBufs->timestampBuf->size.x * d->drawBufs->timestampBuf->size.y * 4;
+    }
+    return size;
+}
+
+size_t memorySize_DocumentWidget(const iDocumentWidget *d) {
+    return textureSize_DocumentWidget(d) + memorySize_GmDocument(d->doc);
+}
+
+uint32_t lastShownTime_DocumentWidget(const iDocumentWidget *d) {
+    return d->lastShownTime;
+}
+
+iBool hibernate_DocumentWidget(iDocumentWidget *d) {
+    /* Only the source and the scroll position are kept. Tabs that are loading, playing
+       audio, or were slow to wake up the last time are left alone. */
+    if (isVisible_Widget(d) || d->state != ready_RequestState ||
+        d->flags & (pendingRestore_DocumentWidgetFlag | keepAwake_DocumentWidgetFlag) ||
+        numAudio_Media(media_GmDocument(d->doc))) {
+        return iFalse;
+    }
+    /* The runs are released, so the view's anchor is needed if the width changes before
+       waking up. The source text stays in place. */
+    const iGmRun *anchor = d->visibleRuns.start;
+    const char *  loc    = anchor ? anchor->text.start : NULL;
+    const int     offset =
+        anchor ? visibleRange_DocumentWidget_(d).start - top_Rect(anchor->visBounds) : 0;
+    if (!hibernate_GmDocument(d->doc)) {
+        return iFalse;
+    }
+    d->wakeAnchor       = loc;
+    d->wakeAnchorOffset = offset;
+    documentRunsInvalidated_DocumentWidget_(d);
+    clear_PtrArray(&d->visibleLinks);
+    clear_PtrArray(&d->visiblePre);
+    clear_PtrArray(&d->visibleMedia);
+    clear_PtrArray(&d->visibleWideRuns);
+    iZap(d->animWideRunRange);
+    d->animWideRunId = 0;
+    d->grabbedPlayer = NULL;
+    releaseBuffers_DocumentWidget(d);
+    retainImages_Media(media_GmDocument(d->doc), collectNew_Array(sizeof(uint16_t)));
+    removeTicker_App(prerender_DocumentWidget_, d);
+    removeTicker_App(preload_DocumentWidget_, d);
+    d->flags &= ~warm_DocumentWidgetFlag;
+    return iTrue;
+}
+
+void releaseBuffers_DocumentWidget(iDocumentWidget *d) {
+    /* The visible area is rendered again when the document is next drawn. */
+    invalidate_DocumentWidget_(d);
+    dealloc_VisBuf(d->visBuf);
+    remove_Periodic(periodic_App(), d);
+}
+
 const iString *feedTitle_DocumentWidget(const iDocumentWidget *d) {
     if (!isEmpty_String(title_GmDocument(d->doc))) {
         return title_GmDocument(d->doc);
@@ -5256,10 +6149,16 @@ void serializeState_DocumentWidget(const iDocumentWidget *d, iStream *outs) {
     serialize_PersistentDocumentState(&d->mod, outs);
 }
 
-void deserializeState_DocumentWidget(iDocumentWidget *d, iStream *ins) {
+void deserializeState_DocumentWidget(iDocumentWidget *d, iStream *ins, iBool isDeferred) {
     deserialize_PersistentDocumentState(&d->mod, ins);
     parseUser_DocumentWidget_(d);
-    updateFromHistory_DocumentWidget_(d);
+    if (isDeferred) {
+        /* Restored when first shown. Until then, the tab shows the URL's host as its title. */
+        d->flags |= pendingRestore_DocumentWidgetFlag;
+    }
+    else {
+        updateFromHistory_DocumentWidget_(d);
+    }
 }
 
 static void setUrl_DocumentWidget_(iDocumentWidget *d, const iString *url) {
@@ -5274,12 +6173,16 @@ void setUrlFlags_DocumentWidget(iDocumentWidget *d, const iString *url, int setU
     iChangeFlags(d->flags, openedFromSidebar_DocumentWidgetFlag,
                  (setUrlFlags & openedFromSidebar_DocumentWidgetSetUrlFlag) != 0);
     const iBool isFromCache = (setUrlFlags & useCachedContentIfAvailable_DocumentWidgetSetUrlFlag) != 0;
+    d->flags &= ~(pendingRestore_DocumentWidgetFlag | /* replaced by the new page */
+                  restoringScroll_DocumentWidgetFlag);
     setLinkNumberMode_DocumentWidget_(d, iFalse);
     setUrl_DocumentWidget_(d, urlFragmentStripped_String(url));
     /* See if there a username in the URL. */
     parseUser_DocumentWidget_(d);
     if (!isFromCache || !updateFromHistory_DocumentWidget_(d)) {
-        fetch_DocumentWidget_(d);
+        if (!updateFromPrefetch_DocumentWidget_(d)) {
+            fetch_DocumentWidget_(d);
+        }
     }
 }
 
@@ -5294,7 +6197,7 @@ void setUrlAndSource_DocumentWidget(iDocumentWidget *d, const iString *url, cons
     initCurrent_Time(&resp->when);
     set_String(&resp->meta, mime);
     set_Block(&resp->body, source);
-    updateFromCachedResponse_DocumentWidget_(d, 0, resp, NULL);
+    updateFromCachedResponse_DocumentWidget_(d, 0, resp, NULL, NULL);
     delete_GmResponse(resp);
 }
 
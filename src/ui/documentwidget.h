@@ -35,7 +35,7 @@ iDeclareObjectConstruction(DocumentWidget)
 void    cancelAllRequests_DocumentWidget(iDocumentWidget *);
 
 void    serializeState_DocumentWidget   (const iDocumentWidget *, iStream *outs);
-void    deserializeState_DocumentWidget (iDocumentWidget *, iStream *ins);
+void    deserializeState_DocumentWidget (iDocumentWidget *, iStream *ins, iBool isDeferred);
 
 iDocumentWidget *   duplicate_DocumentWidget        (const iDocumentWidget *);
 iHistory *          history_DocumentWidget          (iDocumentWidget *);
@@ -47,6 +47,12 @@ const iGmDocument * document_DocumentWidget         (const iDocumentWidget *);
 const iString *     bookmarkTitle_DocumentWidget    (const iDocumentWidget *);
 const iString *     feedTitle_DocumentWidget        (const iDocumentWidget *);
 int                 documentWidth_DocumentWidget    (const iDocumentWidget *);
+iString *           renderInfo_DocumentWidget       (const iDocumentWidget *);
+size_t              textureSize_DocumentWidget      (const iDocumentWidget *); /* bytes */
+void                releaseBuffers_DocumentWidget   (iDocumentWidget *); /* in a background tab */
+size_t              memorySize_DocumentWidget       (const iDocumentWidget *); /* bytes */
+uint32_t            lastShownTime_DocumentWidget    (const iDocumentWidget *); /* SDL ticks */
+iBool               hibernate_DocumentWidget        (iDocumentWidget *); /* only if not visible */
 
 //iBool   findCachedContent_DocumentWidget(const iDocumentWidget *, const iString *url,
 //                                         iString *mime_out, iBlock *data_out);
@@ -164,18 +164,95 @@ iDefineTypeConstruction(InputLine)
 iDeclareType(InputUndo)
 
 struct Impl_InputUndo {
-    iString text;
-    iInt2 cursor;
+    iArray lines;    /* iString[]; the entire text, or just the lines replaced by the newer text */
+    size_t pos;      /* index of the first replaced line */
+    size_t numLines; /* number of replacing lines in the newer text; iInvalidSize if entire */
+    iInt2  cursor;
 };
 
-static void init_InputUndo_(iInputUndo *d, const iArray *lines, iInt2 cursor) {
-    init_String(&d->text);
-    mergeLines_(lines, &d->text);
-    d->cursor = cursor;
+static void init_InputUndo_(iInputUndo *d, const iArray *inputLines, iInt2 cursor) {
+    /* The copies share their data with the originals until either one is modified,
+       so this doesn't actually copy the text. */
+    init_Array(&d->lines, sizeof(iString));
+    iConstForEach(Array, i, inputLines) {
+        iString copy;
+        initCopy_String(&copy, &((const iInputLine *) i.value)->text);
+        pushBack_Array(&d->lines, &copy);
+    }
+    d->pos      = 0;
+    d->numLines = iInvalidSize;
+    d->cursor   = cursor;
 }
 
 static void deinit_InputUndo_(iInputUndo *d) {
-    deinit_String(&d->text);
+    iForEach(Array, i, &d->lines) {
+        deinit_String(i.value);
+    }
+    deinit_Array(&d->lines);
+}
+
+static void commonLines_InputUndo_(const iInputUndo *d, const iArray *inputLines,
+                                   size_t *prefix, size_t *suffix) {
+    iAssert(d->numLines == iInvalidSize);
+    const size_t oldSize   = size_Array(&d->lines);
+    const size_t newSize   = size_Array(inputLines);
+    const size_t maxCommon = iMin(oldSize, newSize);
+    size_t       p         = 0;
+    size_t       s         = 0;
+    while (p < maxCommon &&
+           equal_String(constAt_Array(&d->lines, p),
+                        &((const iInputLine *) constAt_Array(inputLines, p))->text)) {
+        p++;
+    }
+    while (s < maxCommon - p &&
+           equal_String(constAt_Array(&d->lines, oldSize - 1 - s),
+                        &((const iInputLine *) constAt_Array(inputLines, newSize - 1 - s))->text)) {
+        s++;
+    }
+    *prefix = p;
+    *suffix = s;
+}
+
+static void makeDelta_InputUndo_(iInputUndo *d, const iArray *inputLines) {
+    /* Only keep the lines that are different in the newer text. */
+    size_t prefix, suffix;
+    commonLines_InputUndo_(d, inputLines, &prefix, &suffix);
+    const size_t oldSize = size_Array(&d->lines);
+    for (size_t i = 0; i < oldSize; i++) {
+        if (i < prefix || i >= oldSize - suffix) {
+            deinit_String(at_Array(&d->lines, i));
+        }
+    }
+    removeRange_Array(&d->lines, (iRanges){ oldSize - suffix, oldSize });
+    removeRange_Array(&d->lines, (iRanges){ 0, prefix });
+    d->pos      = prefix;
+    d->numLines = size_Array(inputLines) - prefix - suffix;
+}
+
+static void applyDelta_InputUndo_(iInputUndo *d, const iInputUndo *newer) {
+    /* Reconstruct the entire text by applying the delta to the newer text. */
+    iAssert(d->numLines != iInvalidSize);
+    iAssert(newer->numLines == iInvalidSize);
+    iArray entire;
+    init_Array(&entire, sizeof(iString));
+    for (size_t i = 0; i < size_Array(&newer->lines); i++) {
+        if (i == d->pos) {
+            /* Ownership of the replaced lines moves to the new array. */
+            pushBackN_Array(&entire, constData_Array(&d->lines), size_Array(&d->lines));
+        }
+        if (i < d->pos || i >= d->pos + d->numLines) {
+            iString copy;
+            initCopy_String(&copy, constAt_Array(&newer->lines, i));
+            pushBack_Array(&entire, &copy);
+        }
+    }
+    if (d->pos >= size_Array(&newer->lines)) {
+        pushBackN_Array(&entire, constData_Array(&d->lines), size_Array(&d->lines));
+    }
+    deinit_Array(&d->lines);
+    d->lines    = entire;
+    d->pos      = 0;
+    d->numLines = iInvalidSize;
 }
 
 enum iInputWidgetFlag {
@@ -438,9 +515,30 @@ static iRangecc rangeSize_String(const iString *d, size_t size) {
     };
 }
 
+static size_t findLineIndexByWrapY_InputWidget_(const iInputWidget *d, int wrapY) {
+    /* Wrap ranges of consecutive lines are contiguous, so they can be searched by bisection. */
+    size_t first = 0;
+    size_t last  = size_Array(&d->lines);
+    while (first < last) {
+        const size_t     mid  = (first + last) / 2;
+        const iInputLine *line = constAt_Array(&d->lines, mid);
+        if (wrapY < line->wrapLines.start) {
+            last = mid;
+        }
+        else if (wrapY >= line->wrapLines.end) {
+            first = mid + 1;
+        }
+        else {
+            return mid;
+        }
+    }
+    return first; /* the line after `wrapY`; may be past the end */
+}
+
 static const iInputLine *findLineByWrapY_InputWidget_(const iInputWidget *d, int wrapY) {
-    iConstForEach(Array, i, &d->lines) {
-        const iInputLine *line = i.value;
+    const size_t index = findLineIndexByWrapY_InputWidget_(d, wrapY);
+    if (index < size_Array(&d->lines)) {
+        const iInputLine *line = constAt_Array(&d->lines, index);
         if (contains_Range(&line->wrapLines, wrapY)) {
             return line;
         }
@@ -470,13 +568,14 @@ static iWrapText wrap_InputWidget_(const iInputWidget *d, int y) {
 }
 
 static iRangei visibleLineRange_InputWidget_(const iInputWidget *d) {
-    iRangei vis = { -1, -1 };
     /* Determine which lines are in the potentially visible range. */
-    for (int i = 0; i < size_Array(&d->lines); i++) {
+    const int start = (int) findLineIndexByWrapY_InputWidget_(d, iMax(0, d->visWrapLines.start));
+    if (start >= size_Array(&d->lines)) {
+        return (iRangei){ -1, -1 };
+    }
+    iRangei vis = { start, start };
+    for (int i = start; i < size_Array(&d->lines); i++) {
         const iInputLine *line = constAt_Array(&d->lines, i);
-        if (vis.start < 0 && line->wrapLines.end > d->visWrapLines.start) {
-            vis.start = vis.end = i;
-        }
         if (line->wrapLines.start < d->visWrapLines.end) {
             vis.end = i + 1;
         }
@@ -754,6 +853,10 @@ void setFont_InputWidget(iInputWidget *d, int fontId) {
 }
 
 static void pushUndo_InputWidget_(iInputWidget *d) {
+    /* Only the most recent undo state is a full copy of the text. */
+    if (!isEmpty_Array(&d->undoStack)) {
+        makeDelta_InputUndo_(back_Array(&d->undoStack), &d->lines);
+    }
     iInputUndo undo;
     init_InputUndo_(&undo, &d->lines, d->cursor);
     pushBack_Array(&d->undoStack, &undo);
@@ -763,16 +866,44 @@ static void pushUndo_InputWidget_(iInputWidget *d) {
     }
 }
 
+static void restoreUndo_InputWidget_(iInputWidget *d, const iInputUndo *undo) {
+    /* Replace and rewrap only the lines that differ. */
+    size_t prefix, suffix;
+    commonLines_InputUndo_(undo, &d->lines, &prefix, &suffix);
+    for (size_t i = prefix; i < size_Array(&d->lines) - suffix; i++) {
+        deinit_InputLine(at_Array(&d->lines, i));
+    }
+    removeRange_Array(&d->lines, (iRanges){ prefix, size_Array(&d->lines) - suffix });
+    const size_t numRestored = size_Array(&undo->lines) - prefix - suffix;
+    for (size_t i = 0; i < numRestored; i++) {
+        iInputLine line;
+        init_InputLine(&line);
+        set_String(&line.text, constAt_Array(&undo->lines, prefix + i));
+        insert_Array(&d->lines, prefix + i, &line);
+        updateLine_InputWidget_(d, at_Array(&d->lines, prefix + i));
+    }
+    if (prefix == 0) {
+        iInputLine *first = front_Array(&d->lines);
+        first->range.start = 0;
+        first->wrapLines   = (iRangei){ 0, numWrapLines_InputLine_(first) };
+    }
+    updateLineRangesStartingFrom_InputWidget_(d, prefix > 0 ? prefix - 1 : 0);
+}
+
 static iBool popUndo_InputWidget_(iInputWidget *d) {
     if (!isEmpty_Array(&d->undoStack)) {
         iInputUndo *undo = back_Array(&d->undoStack);
-        //setCopy_Array(&d->text, &undo->text);
-        splitToLines_(&undo->text, &d->lines);
+        restoreUndo_InputWidget_(d, undo);
         d->cursor = undo->cursor;
+        if (size_Array(&d->undoStack) > 1) {
+            applyDelta_InputUndo_(at_Array(&d->undoStack, size_Array(&d->undoStack) - 2), undo);
+        }
         deinit_InputUndo_(undo);
         popBack_Array(&d->undoStack);
         iZap(d->mark);
-        updateAllLinesAndResizeHeight_InputWidget_(d);
+        updateVisible_InputWidget_(d);
+        updateMetrics_InputWidget_(d);
+        restartBackupTimer_InputWidget_(d);
         return iTrue;
     }
     return iFalse;
@@ -2324,8 +2455,11 @@ static void draw_InputWidget_(const iInputWidget *d) {
                             isFocused ? gap_UI / 4 : 1,
                             isFocused ? uiInputFrameFocused_ColorId
                                       : isHover ? uiInputFrameHover_ColorId : uiInputFrame_ColorId);
-    setClip_Paint(&p, adjusted_Rect(bounds, init_I2(d->leftPadding, 0),
-                                    init_I2(-d->rightPadding, w->flags & extraPadding_WidgetFlag ? -gap_UI / 2 : 0)));
+    if (!setClip_Paint(&p, adjusted_Rect(bounds, init_I2(d->leftPadding, 0),
+                                         init_I2(-d->rightPadding, w->flags & extraPadding_WidgetFlag ? -gap_UI / 2 : 0)))) {
+        drawChildren_Widget(w);
+        return;
+    }
     const iRect contentBounds = contentBounds_InputWidget_(d);
     iInt2       drawPos    = topLeft_Rect(contentBounds);
     const int   fg         = isHint                                   ? uiAnnotation_ColorId
@@ -255,6 +255,9 @@ static const struct { int id; iMenuItem bind; int flags; } defaultBindings_[] =
     { 1009, { NULL, SDLK_AC_STOP, 0,                    "document.stop"                 }, 0 },
     { 1010, { NULL, SDLK_AC_REFRESH, 0,                 "document.reload"               }, 0 },
     { 1011, { NULL, SDLK_AC_BOOKMARKS, 0,               "sidebar.mode arg:0 toggle:1"   }, 0 },
+    /* Diagnostics. */
+    { 1012, { NULL, SDLK_F12, 0,                        "profiler.toggle"               }, 0 },
+    { 1013, { NULL, SDLK_F12, KMOD_SHIFT,               "profiler.save"                 }, 0 },
 };
 
 static iBinding *findId_Keys_(iKeys *d, int id) {
@@ -360,7 +360,10 @@ static void draw_LabelWidget_(const iLabelWidget *d) {
                             frame);
         }
     }
-    setClip_Paint(&p, rect);
+    if (!setClip_Paint(&p, rect)) {
+        drawChildren_Widget(w);
+        return;
+    }
     const int iconPad = iconPadding_LabelWidget_(d);
 //    const int iconColor = isCaution ? uiTextCaution_ColorId
 //                          : flags & (disabled_WidgetFlag | pressed_WidgetFlag) ? fg
@@ -49,6 +49,118 @@ iDefineClass(ListItem)
 
 iDefineObjectConstruction(ListWidget)
 
+/*----------------------------------------------------------------------------------------------*/
+
+/* Recently drawn items are kept in a texture atlas. When an item scrolls back into view,
+   it is copied from the atlas to the VisBuf instead of being laid out and drawn again. */
+
+iDeclareType(ItemCache)
+iDeclareType(ItemCacheSlot)
+
+struct Impl_ItemCacheSlot {
+    const iListItem *item;
+    uint32_t         lastUsed;
+};
+
+struct Impl_ItemCache {
+    SDL_Texture *   atlas;
+    iInt2           itemSize;
+    int             blankWidth; /* scrollbar area is part of the cached item */
+    size_t          numSlots;
+    iItemCacheSlot *slots;
+    uint32_t        counter;
+};
+
+static const size_t maxSlots_ItemCache_ = 128;
+
+static void init_ItemCache(iItemCache *d) {
+    iZap(*d);
+}
+
+static void release_ItemCache_(iItemCache *d) {
+    if (d->atlas) {
+        SDL_DestroyTexture(d->atlas);
+        d->atlas = NULL;
+    }
+    free(d->slots);
+    d->slots    = NULL;
+    d->numSlots = 0;
+    d->itemSize = zero_I2();
+}
+
+static void deinit_ItemCache(iItemCache *d) {
+    release_ItemCache_(d);
+}
+
+static void clear_ItemCache(iItemCache *d) {
+    for (size_t i = 0; i < d->numSlots; i++) {
+        d->slots[i].item = NULL;
+    }
+}
+
+static iBool alloc_ItemCache_(iItemCache *d, iInt2 itemSize, int blankWidth) {
+    if (!isEqual_I2(d->itemSize, itemSize) || d->blankWidth != blankWidth) {
+        release_ItemCache_(d);
+        const iInt2 maxSize = maxTextureSize_Window(get_Window());
+        if (itemSize.x <= 0 || itemSize.y <= 0 || itemSize.x > maxSize.x) {
+            return iFalse;
+        }
+        d->itemSize   = itemSize;
+        d->blankWidth = blankWidth;
+        d->numSlots   = iMin(maxSlots_ItemCache_, (size_t) (maxSize.y / itemSize.y));
+        d->slots      = calloc(d->numSlots, sizeof(iItemCacheSlot));
+        d->atlas      = SDL_CreateTexture(renderer_Window(get_Window()),
+                                          SDL_PIXELFORMAT_RGBA8888,
+                                          SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
+                                          itemSize.x,
+                                          itemSize.y * (int) d->numSlots);
+        if (!d->atlas) {
+            release_ItemCache_(d);
+            return iFalse;
+        }
+        SDL_SetTextureBlendMode(d->atlas, SDL_BLENDMODE_NONE);
+    }
+    return d->atlas != NULL;
+}
+
+static iRect slotRect_ItemCache_(const iItemCache *d, size_t slot) {
+    return (iRect){ init_I2(0, d->itemSize.y * (int) slot), d->itemSize };
+}
+
+static size_t find_ItemCache_(const iItemCache *d, const iListItem *item) {
+    for (size_t i = 0; i < d->numSlots; i++) {
+        if (d->slots[i].item == item) {
+            return i;
+        }
+    }
+    return iInvalidPos;
+}
+
+static void remove_ItemCache(iItemCache *d, const iListItem *item) {
+    const size_t slot = find_ItemCache_(d, item);
+    if (slot != iInvalidPos) {
+        d->slots[slot].item = NULL;
+    }
+}
+
+static size_t reserve_ItemCache_(iItemCache *d, const iListItem *item) {
+    size_t oldest = 0;
+    for (size_t i = 0; i < d->numSlots; i++) {
+        if (!d->slots[i].item) {
+            oldest = i;
+            break;
+        }
+        if (d->slots[i].lastUsed < d->slots[oldest].lastUsed) {
+            oldest = i;
+        }
+    }
+    d->slots[oldest].item     = item;
+    d->slots[oldest].lastUsed = ++d->counter;
+    return oldest;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
 struct Impl_ListWidget {
     iWidget widget;
     iScrollWidget *scroll;
@@ -60,7 +172,9 @@ struct Impl_ListWidget {
     iInt2 dragOrigin; /* offset from mouse to drag item's top-left corner */
     iClick click;
     iIntSet invalidItems;
+    iIntSet movedItems; /* redrawn in a new position, but cached appearance is still valid */
     iVisBuf *visBuf;
+    iItemCache itemCache;
     iBool noHoverWhileScrolling;
 };
 
@@ -103,7 +217,9 @@ void init_ListWidget(iListWidget *d) {
     d->dragOrigin = zero_I2();
     init_Click(&d->click, d, SDL_BUTTON_LEFT);
     init_IntSet(&d->invalidItems);
+    init_IntSet(&d->movedItems);
     d->visBuf = new_VisBuf();
+    init_ItemCache(&d->itemCache);
 }
 
 void deinit_ListWidget(iListWidget *d) {
@@ -111,11 +227,16 @@ void deinit_ListWidget(iListWidget *d) {
     clear_ListWidget(d);
     deinit_PtrArray(&d->items);
     delete_VisBuf(d->visBuf);
+    deinit_ItemCache(&d->itemCache);
+    deinit_IntSet(&d->movedItems);
+    deinit_IntSet(&d->invalidItems);
 }
 
 void invalidate_ListWidget(iListWidget *d) {
     invalidate_VisBuf(d->visBuf);
+    clear_ItemCache(&d->itemCache);
     clear_IntSet(&d->invalidItems); /* all will be drawn */
+    clear_IntSet(&d->movedItems);
     refresh_Widget(as_Widget(d));
 }
 
@@ -129,6 +250,7 @@ void clear_ListWidget(iListWidget *d) {
         deref_Object(i.ptr);
     }
     clear_PtrArray(&d->items);
+    clear_ItemCache(&d->itemCache); /* items may be reallocated at the same addresses */
     d->hoverItem = iInvalidPos;
 }
 
@@ -136,6 +258,84 @@ void addItem_ListWidget(iListWidget *d, iAnyObject *item) {
     pushBack_PtrArray(&d->items, ref_Object(item));
 }
 
+static size_t findEqualItem_ListWidget_(const iListWidget *d, const iListItem *item,
+                                        size_t index, size_t start, const iBool *isTaken,
+                                        iListItemEqualFunc isEqual) {
+    const size_t lookAhead = 32; /* typical edits insert or remove a handful of items */
+    for (size_t i = start; i < iMin(start + lookAhead, size_PtrArray(&d->items)); i++) {
+        /* The top row may be drawn differently (e.g., no separator line above it). */
+        if (!isTaken[i] && (i == 0) == (index == 0) &&
+            isEqual(constAt_PtrArray(&d->items, i), item)) {
+            return i;
+        }
+    }
+    return iInvalidPos;
+}
+
+void updateItems_ListWidget(iListWidget *d, const iPtrArray *items,
+                            iListItemEqualFunc isEqual) {
+    /* Existing items that are equal to new ones are kept, so their cached appearance remains
+       valid. Only new and changed items need to be drawn again; moved ones are copied from
+       the item cache. */
+    const size_t oldCount = size_PtrArray(&d->items);
+    iBool *      isTaken  = calloc(iMax(1, oldCount), sizeof(iBool));
+    iPtrArray    merged;
+    size_t       numRedrawn = 0;
+    size_t       cursor     = 0;
+    size_t       hoverItem  = iInvalidPos;
+    init_PtrArray(&merged);
+    clear_IntSet(&d->movedItems);
+    iConstForEach(PtrArray, i, items) {
+        const size_t index = index_PtrArrayConstIterator(&i);
+        const size_t found = findEqualItem_ListWidget_(d, i.ptr, index, cursor, isTaken, isEqual);
+        if (found != iInvalidPos) {
+            isTaken[found] = iTrue;
+            pushBack_PtrArray(&merged, at_PtrArray(&d->items, found)); /* keeps the reference */
+            if (found != index) {
+                insert_IntSet(&d->movedItems, index);
+                numRedrawn++;
+            }
+            if (found == d->hoverItem) {
+                hoverItem = index;
+            }
+            cursor = found + 1;
+        }
+        else {
+            pushBack_PtrArray(&merged, ref_Object(i.ptr));
+            insert_IntSet(&d->invalidItems, index);
+            numRedrawn++;
+        }
+    }
+    /* Dropped items. */
+    for (size_t i = 0; i < oldCount; i++) {
+        if (!isTaken[i]) {
+            iAnyObject *item = at_PtrArray(&d->items, i);
+            remove_ItemCache(&d->itemCache, item);
+            deref_Object(item);
+        }
+    }
+    free(isTaken);
+    clear_PtrArray(&d->items);
+    iConstForEach(PtrArray, m, &merged) {
+        pushBack_PtrArray(&d->items, m.ptr);
+    }
+    deinit_PtrArray(&merged);
+    d->hoverItem = hoverItem;
+    d->dragItem  = iInvalidPos;
+    if (size_PtrArray(items) < oldCount ||
+        (d->itemHeight && numRedrawn > (size_t) visCount_ListWidget(d) + 1)) {
+        /* Rows past the new end must be cleared, and with many changes it's cheaper to just
+           redraw the visible region (mostly from the item cache). */
+        invalidate_VisBuf(d->visBuf);
+        clear_IntSet(&d->invalidItems);
+        clear_IntSet(&d->movedItems);
+        numRedrawn = 1;
+    }
+    if (numRedrawn) {
+        refresh_Widget(as_Widget(d));
+    }
+}
+
 iScrollWidget *scroll_ListWidget(iListWidget *d) {
     return d->scroll;
 }
@@ -499,6 +699,48 @@ iRect itemRect_ListWidget(const iListWidget *d, size_t index) {
                     init_I2(width_Rect(bounds), d->itemHeight) };
 }
 
+static void drawItemContents_ListWidget_(const iListWidget *d, iPaint *p, size_t index,
+                                        iRect itemRect, int blankWidth) {
+    const int        bg   = constAs_Widget(d)->bgColor;
+    const iListItem *item = constAt_PtrArray(&d->items, index);
+    fillRect_Paint(p, itemRect, bg);
+    if (index != d->dragItem) {
+        class_ListItem(item)->draw(item, p, itemRect, d);
+    }
+    fillRect_Paint(p,
+                   (iRect){ init_I2(right_Rect(itemRect) - blankWidth, top_Rect(itemRect)),
+                            init_I2(blankWidth, height_Rect(itemRect)) },
+                   bg);
+}
+
+static void drawItem_ListWidget_(const iListWidget *d, iPaint *p, SDL_Texture *target,
+                                 size_t index, iRect itemRect, int blankWidth) {
+    iItemCache *     cache = &iConstCast(iListWidget *, d)->itemCache;
+    const iListItem *item  = constAt_PtrArray(&d->items, index);
+    if (index == d->dragItem || !cache->atlas) {
+        beginTarget_Paint(p, target);
+        drawItemContents_ListWidget_(d, p, index, itemRect, blankWidth);
+        return;
+    }
+    size_t slot = find_ItemCache_(cache, item);
+    if (slot == iInvalidPos) {
+        slot = reserve_ItemCache_(cache, item);
+        endTarget_Paint(p);
+        beginTarget_Paint(p, cache->atlas);
+        drawItemContents_ListWidget_(d, p, index, slotRect_ItemCache_(cache, slot), blankWidth);
+        endTarget_Paint(p);
+    }
+    else {
+        cache->slots[slot].lastUsed = ++cache->counter;
+    }
+    const iRect slotRect = slotRect_ItemCache_(cache, slot);
+    beginTarget_Paint(p, target);
+    SDL_RenderCopy(renderer_Window(get_Window()),
+                   cache->atlas,
+                   (const SDL_Rect *) &slotRect,
+                   (const SDL_Rect *) &itemRect);
+}
+
 static void draw_ListWidget_(const iListWidget *d) {
     const iWidget *w      = constAs_Widget(d);
     const iRect    bounds = innerBounds_Widget(w);
@@ -515,46 +757,48 @@ static void draw_ListWidget_(const iListWidget *d) {
         /* TODO: This seems to draw two items per each shift of the visible region, even though
            one should be enough. Probably an off-by-one error in the calculation of the
            invalid range. */
-        iForIndices(i, d->visBuf->buffers) {
+        for (size_t i = 0; i < d->visBuf->numBuffers; i++) {
             iAssert(d->visBuf->buffers[i].texture);
         }
-        const int bg[iElemCount(d->visBuf->buffers)] = {
-            w->bgColor, w->bgColor, w->bgColor, w->bgColor
-        };
+        const int bg = w->bgColor;
         const int bottom = numItems_ListWidget(d) * d->itemHeight;
+#if defined (iPlatformApple)
+        const int blankWidth = 0; /* scrollbars fade away */
+#else
+        const int blankWidth = scrollBarWidth_ListWidget(d);
+#endif
+        iItemCache *cache = &iConstCast(iListWidget *, d)->itemCache;
+        alloc_ItemCache_(cache, init_I2(d->visBuf->texSize.x, d->itemHeight), blankWidth);
+        iConstForEach(IntSet, v, &d->invalidItems) {
+            const size_t index = *v.value;
+            if (index < size_PtrArray(&d->items)) {
+                remove_ItemCache(cache, constAt_PtrArray(&d->items, index));
+            }
+        }
+        iConstForEach(IntSet, m, &d->movedItems) {
+            insert_IntSet(&iConstCast(iListWidget *, d)->invalidItems, *m.value);
+        }
+        clear_IntSet(&iConstCast(iListWidget *, d)->movedItems);
         const iRangei vis = { scrollY / d->itemHeight * d->itemHeight,
                              ((scrollY + bounds.size.y) / d->itemHeight + 1) * d->itemHeight };
         reposition_VisBuf(d->visBuf, vis);
         /* Check which parts are invalid. */
-        iRangei invalidRange[iElemCount(d->visBuf->buffers)];
+        iRangei invalidRange[maxBuffers_VisBuf];
         invalidRanges_VisBuf(d->visBuf, (iRangei){ 0, bottom }, invalidRange);
-        iForIndices(i, d->visBuf->buffers) {
+        for (size_t i = 0; i < d->visBuf->numBuffers; i++) {
             iVisBufTexture *buf = &d->visBuf->buffers[i];
             iRanges drawItems = { iMax(0, buf->origin) / d->itemHeight,
                                   iMax(0, buf->origin + d->visBuf->texSize.y) / d->itemHeight };
             if (isEmpty_Rangei(buf->validRange)) {
                 beginTarget_Paint(&p, buf->texture);
-                fillRect_Paint(&p, (iRect){ zero_I2(), d->visBuf->texSize }, bg[i]);
+                fillRect_Paint(&p, (iRect){ zero_I2(), d->visBuf->texSize }, bg);
             }
-#if defined (iPlatformApple)
-            const int blankWidth = 0; /* scrollbars fade away */
-#else
-            const int blankWidth = scrollBarWidth_ListWidget(d);
-#endif
-            const iRect sbBlankRect = { init_I2(d->visBuf->texSize.x - blankWidth, 0),
-                                        init_I2(blankWidth, d->itemHeight) };
             iConstForEach(IntSet, v, &d->invalidItems) {
                 const size_t index = *v.value;
                 if (contains_Range(&drawItems, index) && index < size_PtrArray(&d->items)) {
-                    const iListItem *item = constAt_PtrArray(&d->items, index);
-                    const iRect      itemRect = { init_I2(0, index * d->itemHeight - buf->origin),
-                                                  init_I2(d->visBuf->texSize.x, d->itemHeight) };
-                    beginTarget_Paint(&p, buf->texture);
-                    fillRect_Paint(&p, itemRect, bg[i]);
-                    if (index != d->dragItem) {
-                        class_ListItem(item)->draw(item, &p, itemRect, d);
-                    }
-                    fillRect_Paint(&p, moved_Rect(sbBlankRect, init_I2(0, top_Rect(itemRect))), bg[i]);
+                    const iRect itemRect = { init_I2(0, index * d->itemHeight - buf->origin),
+                                             init_I2(d->visBuf->texSize.x, d->itemHeight) };
+                    drawItem_ListWidget_(d, &p, buf->texture, index, itemRect, blankWidth);
                 }
             }
             /* Visible range is not fully covered. Fill in the new items. */
@@ -563,14 +807,9 @@ static void draw_ListWidget_(const iListWidget *d) {
                 drawItems.start = invalidRange[i].start / d->itemHeight;
                 drawItems.end   = invalidRange[i].end   / d->itemHeight + 1;
                 for (size_t j = drawItems.start; j < drawItems.end && j < size_PtrArray(&d->items); j++) {
-                    const iListItem *item     = constAt_PtrArray(&d->items, j);
-                    const iRect      itemRect = { init_I2(0, j * d->itemHeight - buf->origin),
-                                                  init_I2(d->visBuf->texSize.x, d->itemHeight) };
-                    fillRect_Paint(&p, itemRect, bg[i]);
-                    if (j != d->dragItem) {
-                        class_ListItem(item)->draw(item, &p, itemRect, d);
-                    }
-                    fillRect_Paint(&p, moved_Rect(sbBlankRect, init_I2(0, top_Rect(itemRect))), bg[i]);
+                    const iRect itemRect = { init_I2(0, j * d->itemHeight - buf->origin),
+                                             init_I2(d->visBuf->texSize.x, d->itemHeight) };
+                    drawItem_ListWidget_(d, &p, buf->texture, j, itemRect, blankWidth);
                 }
             }
             endTarget_Paint(&p);
@@ -578,7 +817,10 @@ static void draw_ListWidget_(const iListWidget *d) {
         validate_VisBuf(d->visBuf);
         clear_IntSet(&iConstCast(iListWidget *, d)->invalidItems);
     }
-    setClip_Paint(&p, bounds_Widget(w));
+    if (!setClip_Paint(&p, bounds_Widget(w))) {
+        drawChildren_Widget(w);
+        return;
+    }
     draw_VisBuf(d->visBuf, addY_I2(topLeft_Rect(bounds), -scrollY), ySpan_Rect(bounds));
     const iInt2 mousePos = mouseCoord_Window(get_Window(), 0);
     if (d->dragItem != iInvalidPos && contains_Rect(bounds, mousePos)) {
@@ -45,6 +45,9 @@ struct Impl_ListItem {
 
 iDeclareObjectConstruction(ListItem)
 
+/* Compares everything that affects an item's appearance. */
+typedef iBool (*iListItemEqualFunc)(const iListItem *, const iListItem *);
+
 iDeclareWidgetClass(ListWidget)
 iDeclareObjectConstruction(ListWidget)
 
@@ -54,6 +57,8 @@ void    invalidate_ListWidget       (iListWidget *);
 void    invalidateItem_ListWidget   (iListWidget *, size_t index);
 void    clear_ListWidget            (iListWidget *);
 void    addItem_ListWidget          (iListWidget *, iAnyObject *item);
+void    updateItems_ListWidget      (iListWidget *, const iPtrArray *items,
+                                     iListItemEqualFunc isEqual);
 
 iScrollWidget * scroll_ListWidget   (iListWidget *);
 
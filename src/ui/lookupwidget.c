@@ -34,6 +34,8 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "listwidget.h"
 #include "lang.h"
 #include "lookup.h"
+#include "profiler.h"
+#include "trigrams.h"
 #include "util.h"
 #include "visited.h"
 
@@ -41,6 +43,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #   include "../ios.h"
 #endif
 
+#include <the_Foundation/atomic.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/thread.h>
 #include <the_Foundation/regexp.h>
@@ -49,6 +52,11 @@ iDeclareType(LookupJob)
 
 struct Impl_LookupJob {
     iRegExp *term;
+    iString words; /* as typed, separated by spaces */
+    iTrigrams required; /* of the words; rules out most visited URLs and feed entries */
+    iAtomicInt *latestSerial;
+    int serial;
+    size_t numChecked;
     iTime now;
     iObjectList *docs;
     iPtrArray results;
@@ -56,6 +64,11 @@ struct Impl_LookupJob {
 
 static void init_LookupJob(iLookupJob *d) {
     d->term = NULL;
+    init_String(&d->words);
+    init_Trigrams(&d->required);
+    d->latestSerial = NULL;
+    d->serial = 0;
+    d->numChecked = 0;
     initCurrent_Time(&d->now);
     d->docs = NULL;
     init_PtrArray(&d->results);
@@ -68,10 +81,32 @@ static void deinit_LookupJob(iLookupJob *d) {
     deinit_PtrArray(&d->results);
     iRelease(d->docs);
     iRelease(d->term);
+    deinit_String(&d->words);
 }
 
 iDefineTypeConstruction(LookupJob)
 
+static iBool isStale_LookupJob_(const iLookupJob *d) {
+    /* A newer term has been submitted, so these results would not be shown anyway. */
+    return d->latestSerial && value_Atomic(d->latestSerial) != d->serial;
+}
+
+static iBool checkNext_LookupJob_(iLookupJob *d) {
+    /* Returns False if the search should be abandoned. */
+    return (++d->numChecked & 0xff) != 0 || !isStale_LookupJob_(d);
+}
+
+static iLookupJob *copy_LookupJob_(const iLookupJob *d) {
+    /* Only the results are needed for presenting. */
+    iLookupJob *copy = new_LookupJob();
+    copy->latestSerial = d->latestSerial;
+    copy->serial       = d->serial;
+    iConstForEach(PtrArray, i, &d->results) {
+        pushBack_PtrArray(&copy->results, copy_LookupResult(i.ptr));
+    }
+    return copy;
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 iDeclareType(LookupItem)
@@ -157,6 +192,8 @@ struct Impl_LookupWidget {
     iString      pendingTerm;
     iObjectList *pendingDocs;
     iLookupJob * finishedJob;
+    iAtomicInt   serial; /* incremented for each submitted term */
+    iBool        isStopping;
 };
 
 static float scoreMatch_(const iRegExp *pattern, iRangecc text) {
@@ -234,13 +271,10 @@ static void searchBookmarks_LookupJob_(iLookupJob *d) {
     }
 }
 
-static void searchFeeds_LookupJob_(iLookupJob *d) {
-    iConstForEach(PtrArray, i, listEntries_Feeds()) {
-        const iFeedEntry *entry = i.ptr;
-        const iBookmark *bm = get_Bookmarks(bookmarks_App(), entry->bookmarkId);
-        if (!bm) {
-            continue;
-        }
+static iBool matchFeedEntry_LookupJob_(void *context, const iFeedEntry *entry) {
+    iLookupJob *d = context;
+    const iBookmark *bm = get_Bookmarks(bookmarks_App(), entry->bookmarkId);
+    if (bm) {
         const float relevance = feedEntryRelevance_LookupJob_(d, entry);
         if (relevance > 0) {
             iLookupResult *res = new_LookupResult();
@@ -254,32 +288,43 @@ static void searchFeeds_LookupJob_(iLookupJob *d) {
             pushBack_PtrArray(&d->results, res);
         }
     }
+    return checkNext_LookupJob_(d);
 }
 
-static void searchVisited_LookupJob_(iLookupJob *d) {
+static void searchFeeds_LookupJob_(iLookupJob *d) {
     /* Note: Called in a background thread. */
-    /* TODO: Thread safety! Visited URLs may be deleted while being accessed here. */
-    iConstForEach(PtrArray, i, list_Visited(visited_App(), 0)) {
-        const iVisitedUrl *vis = i.ptr;
-        const float relevance = visitedRelevance_LookupJob_(d, vis);
-        if (relevance > 0) {
-            iLookupResult *res = new_LookupResult();
-            res->type = history_LookupResultType;
-            res->relevance = relevance;
-            set_String(&res->label, &vis->url);
-            set_String(&res->url, &vis->url);
-            res->when = vis->when;
-            pushBack_PtrArray(&d->results, res);
-        }
+    search_Feeds(&d->required, matchFeedEntry_LookupJob_, d);
+}
+
+static iBool matchVisited_LookupJob_(void *context, const iVisitedUrl *vis) {
+    iLookupJob *d = context;
+    const float relevance = visitedRelevance_LookupJob_(d, vis);
+    if (relevance > 0) {
+        iLookupResult *res = new_LookupResult();
+        res->type = history_LookupResultType;
+        res->relevance = relevance;
+        set_String(&res->label, &vis->url);
+        set_String(&res->url, &vis->url);
+        res->when = vis->when;
+        pushBack_PtrArray(&d->results, res);
     }
+    return checkNext_LookupJob_(d);
+}
+
+static void searchVisited_LookupJob_(iLookupJob *d) {
+    /* Note: Called in a background thread. */
+    search_Visited(visited_App(), &d->required, matchVisited_LookupJob_, d);
 }
 
 static void searchHistory_LookupJob_(iLookupJob *d) {
     /* Note: Called in a background thread. */
     size_t index = 0;
     iForEach(ObjectList, i, d->docs) {
+        if (isStale_LookupJob_(d)) {
+            break;
+        }
         iConstForEach(StringArray, j,
-                      searchContents_History(history_DocumentWidget(i.object), d->term)) {
+                      searchContents_History(history_DocumentWidget(i.object), d->term, &d->words)) {
             const char *match = cstr_String(j.value);
             const size_t matchLen = argLabel_Command(match, "len");
             iRangecc text;
@@ -316,16 +361,35 @@ static void searchIdentities_LookupJob_(iLookupJob *d) {
     }
 }
 
+static void publish_LookupWidget_(iLookupWidget *d, iLookupJob *job) {
+    /* Note: `mtx` must be locked. Takes ownership of `job`. */
+    if (isStale_LookupJob_(job)) {
+        delete_LookupJob(job); /* a newer term is pending */
+        return;
+    }
+    if (d->finishedJob) {
+        /* Previous results haven't been taken yet. */
+        delete_LookupJob(d->finishedJob);
+    }
+    d->finishedJob = job;
+    postCommand_Widget(as_Widget(d), "lookup.ready");
+}
+
 static iThreadResult worker_LookupWidget_(iThread *thread) {
     iLookupWidget *d = userData_Thread(thread);
+    setThreadName_Profiler("lookup");
 //    printf("[LookupWidget] worker is running\n"); fflush(stdout);
     lock_Mutex(d->mtx);
     for (;;) {
-        wait_Condition(&d->jobAvailable, d->mtx);
-        if (isEmpty_String(&d->pendingTerm)) {
+        while (isEmpty_String(&d->pendingTerm) && !d->isStopping) {
+            wait_Condition(&d->jobAvailable, d->mtx);
+        }
+        if (d->isStopping) {
             break; /* Time to quit. */
         }
         iLookupJob *job = new_LookupJob();
+        job->latestSerial = &d->serial;
+        job->serial = value_Atomic(&d->serial);
         /* Make a regular expression to search for multiple alternative words. */ {
             iString *pattern = new_String();
             iRangecc word = iNullRange;
@@ -351,29 +415,29 @@ static iThreadResult worker_LookupWidget_(iThread *thread) {
             delete_String(pattern);
         }
         const size_t termLen = length_String(&d->pendingTerm); /* characters */
+        set_String(&job->words, &d->pendingTerm);
+        initWords_Trigrams(&job->required, range_String(&job->words));
         clear_String(&d->pendingTerm);
         job->docs = d->pendingDocs;
         d->pendingDocs = NULL;
         unlock_Mutex(d->mtx);
-        /* Do the lookup. */ {
+        /* Do the lookup. The quick sources are presented first while the rest are
+           being searched. */ {
             searchBookmarks_LookupJob_(job);
             searchFeeds_LookupJob_(job);
+            searchIdentities_LookupJob_(job);
+            if (!isEmpty_PtrArray(&job->results)) {
+                iGuardMutex(d->mtx, publish_LookupWidget_(d, copy_LookupJob_(job)));
+            }
             searchVisited_LookupJob_(job);
             if (termLen >= 3) {
                 searchHistory_LookupJob_(job);
             }
-            searchIdentities_LookupJob_(job);
         }
         /* Submit the result. */
         lock_Mutex(d->mtx);
-        if (d->finishedJob) {
-            /* Previous results haven't been taken yet. */
-            delete_LookupJob(d->finishedJob);
-        }
 //        printf("[LookupWidget] worker has %zu results\n", size_PtrArray(&job->results));
-        fflush(stdout);
-        d->finishedJob = job;
-        postCommand_Widget(as_Widget(d), "lookup.ready");
+        publish_LookupWidget_(d, job);
     }
     unlock_Mutex(d->mtx);
 //    printf("[LookupWidget] worker has quit\n"); fflush(stdout);
@@ -405,6 +469,8 @@ void init_LookupWidget(iLookupWidget *d) {
     init_String(&d->pendingTerm);
     d->pendingDocs = NULL;
     d->finishedJob = NULL;
+    set_Atomic(&d->serial, 0);
+    d->isStopping = iFalse;
     updateMetrics_LookupWidget_(d);
     start_Thread(d->work);
 }
@@ -414,6 +480,8 @@ void deinit_LookupWidget(iLookupWidget *d) {
         iGuardMutex(d->mtx, {
             iReleasePtr(&d->pendingDocs);
             clear_String(&d->pendingTerm);
+            add_Atomic(&d->serial, 1);
+            d->isStopping = iTrue;
             signal_Condition(&d->jobAvailable);
         });
         join_Thread(d->work);
@@ -429,6 +497,7 @@ void submit_LookupWidget(iLookupWidget *d, const iString *term) {
     iGuardMutex(d->mtx, {
         set_String(&d->pendingTerm, term);
         trim_String(&d->pendingTerm);
+        add_Atomic(&d->serial, 1); /* abandon the current lookup */
         iReleasePtr(&d->pendingDocs);
         if (!isEmpty_String(&d->pendingTerm)) {
             d->pendingDocs = listDocuments_App(get_Root()); /* holds reference to all open tabs */
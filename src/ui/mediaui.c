@@ -84,22 +84,35 @@ static const uint32_t sevenSegmentDigit_ = 0x1fbf0;
 
 static const char *sevenSegmentStr_ = "\U0001fbf0";
 
-static int drawSevenSegmentTime_(iInt2 pos, int color, int align, int seconds) { /* returns width */
+static void makeSevenSegmentTime_(iString *num, int seconds) {
     const int hours = seconds / 3600;
     const int mins  = (seconds / 60) % 60;
     const int secs  = seconds % 60;
+    if (hours) {
+        appendChar_String(num, sevenSegmentDigit_ + (hours % 10));
+        appendChar_String(num, ':');
+    }
+    appendChar_String(num, sevenSegmentDigit_ + (mins / 10) % 10);
+    appendChar_String(num, sevenSegmentDigit_ + (mins % 10));
+    appendChar_String(num, ':');
+    appendChar_String(num, sevenSegmentDigit_ + (secs / 10) % 10);
+    appendChar_String(num, sevenSegmentDigit_ + (secs % 10));
+}
+
+static int sevenSegmentTimeWidth_(int seconds) {
+    iString num;
+    init_String(&num);
+    makeSevenSegmentTime_(&num, seconds);
+    const int width = measureRange_Text(uiLabelBig_FontId, range_String(&num)).bounds.size.x;
+    deinit_String(&num);
+    return width;
+}
+
+static int drawSevenSegmentTime_(iInt2 pos, int color, int align, int seconds) { /* returns width */
     const int font  = uiLabelBig_FontId;
     iString   num;
     init_String(&num);
-    if (hours) {
-        appendChar_String(&num, sevenSegmentDigit_ + (hours % 10));
-        appendChar_String(&num, ':');
-    }
-    appendChar_String(&num, sevenSegmentDigit_ + (mins / 10) % 10);
-    appendChar_String(&num, sevenSegmentDigit_ + (mins % 10));
-    appendChar_String(&num, ':');
-    appendChar_String(&num, sevenSegmentDigit_ + (secs / 10) % 10);
-    appendChar_String(&num, sevenSegmentDigit_ + (secs % 10));
+    makeSevenSegmentTime_(&num, seconds);
     iInt2 size = measureRange_Text(font, range_String(&num)).bounds.size;
     if (align == right_Alignment) {
         pos.x -= size.x;
@@ -109,6 +122,29 @@ static int drawSevenSegmentTime_(iInt2 pos, int color, int align, int seconds) {
     return size.x;
 }
 
+static iRangei scrubberSpan_PlayerUI_(const iPlayerUI *d) {
+    /* The scrubber line is between the elapsed and total times. */
+    const float totalTime  = duration_Player(d->player);
+    const int   leftWidth  = sevenSegmentTimeWidth_(iRound(time_Player(d->player)));
+    const int   rightWidth = totalTime > 0 ? sevenSegmentTimeWidth_(iRound(totalTime)) : 0;
+    return (iRangei){ left_Rect(d->scrubberRect) + leftWidth + 6 * gap_UI,
+                      right_Rect(d->scrubberRect) - rightWidth - 6 * gap_UI };
+}
+
+float scrubberTime_PlayerUI(const iPlayerUI *d, iInt2 coord) {
+    const float totalTime = duration_Player(d->player);
+    if (totalTime <= 0 || !contains_Rect(d->scrubberRect, coord)) {
+        return -1.0f;
+    }
+    const iRangei span = scrubberSpan_PlayerUI_(d);
+    if (span.end <= span.start || coord.x < span.start - gap_UI || coord.x > span.end + gap_UI) {
+        return -1.0f;
+    }
+    const float norm = iClamp((float) (coord.x - span.start) / (float) (span.end - span.start),
+                              0.0f, 1.0f);
+    return norm * totalTime;
+}
+
 void draw_PlayerUI(iPlayerUI *d, iPaint *p) {
     const int   playerBackground_ColorId = uiBackground_ColorId;
     const int   playerFrame_ColorId      = uiSeparator_ColorId;
@@ -131,22 +167,20 @@ void draw_PlayerUI(iPlayerUI *d, iPaint *p) {
     const float totalTime = duration_Player(d->player);
     const int   bright    = uiHeading_ColorId;
     const int   dim       = uiAnnotation_ColorId;
-    int leftWidth = drawSevenSegmentTime_(
-        init_I2(left_Rect(d->scrubberRect) + 2 * gap_UI, yMid - hgt / 2),
-        isPaused_Player(d->player) ? dim : bright,
-        left_Alignment,
-        iRound(playTime));
-    int rightWidth = 0;
+    drawSevenSegmentTime_(init_I2(left_Rect(d->scrubberRect) + 2 * gap_UI, yMid - hgt / 2),
+                          isPaused_Player(d->player) ? dim : bright,
+                          left_Alignment,
+                          iRound(playTime));
     if (totalTime > 0) {
-        rightWidth =
-            drawSevenSegmentTime_(init_I2(right_Rect(d->scrubberRect) - 2 * gap_UI, yMid - hgt / 2),
-                                  dim,
-                                  right_Alignment,
-                                  iRound(totalTime));
+        drawSevenSegmentTime_(init_I2(right_Rect(d->scrubberRect) - 2 * gap_UI, yMid - hgt / 2),
+                              dim,
+                              right_Alignment,
+                              iRound(totalTime));
     }
     /* Scrubber. */
-    const int   s1       = left_Rect(d->scrubberRect) + leftWidth + 6 * gap_UI;
-    const int   s2       = right_Rect(d->scrubberRect) - rightWidth - 6 * gap_UI;
+    const iRangei span   = scrubberSpan_PlayerUI_(d);
+    const int   s1       = span.start;
+    const int   s2       = span.end;
     const float normPos  = totalTime > 0 ? playTime / totalTime : 0.0f;
     const int   part     = (s2 - s1) * normPos;
     const int   scrubMax = (s2 - s1) * streamProgress_Player(d->player);
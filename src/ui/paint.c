@@ -22,34 +22,153 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "paint.h"
 
+#include <the_Foundation/array.h>
 #include <SDL_version.h>
 
 iInt2 origin_Paint;
 
+iDeclareType(PaintBatchRect)
+
+struct Impl_PaintBatchRect {
+    SDL_Rect  rect;
+    SDL_Color color;
+};
+
+struct Impl_PaintBatch {
+    iArray rects; /* PaintBatchRect; in drawing order */
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    iArray vertices; /* SDL_Vertex */
+    iArray indices;  /* int */
+#endif
+};
+
+static iPaintBatch batch_; /* only the main thread paints; memory is reused */
+static iBool       isBatchInitialized_;
+
 iLocalDef SDL_Renderer *renderer_Paint_(const iPaint *d) {
     iAssert(d->dst);
     return d->dst->render;
 }
 
-static void setColor_Paint_(const iPaint *d, int color) {
+static SDL_Color drawColor_Paint_(const iPaint *d, int color) {
     const iColor clr = get_Color(color & mask_ColorId);
-    SDL_SetRenderDrawColor(renderer_Paint_(d), clr.r, clr.g, clr.b,
-                           (color & opaque_ColorId ? 255 : clr.a) * d->alpha / 255);
+    return (SDL_Color){ clr.r, clr.g, clr.b,
+                        (color & opaque_ColorId ? 255 : clr.a) * d->alpha / 255 };
+}
+
+static void setColor_Paint_(const iPaint *d, int color) {
+    const SDL_Color clr = drawColor_Paint_(d, color);
+    SDL_SetRenderDrawColor(renderer_Paint_(d), clr.r, clr.g, clr.b, clr.a);
+}
+
+static void addRect_PaintBatch_(iPaintBatch *d, SDL_Rect rect, SDL_Color color) {
+    /* `rect` already includes the paint origin. */
+    if (rect.w > 0 && rect.h > 0) {
+        pushBack_Array(&d->rects, &(iPaintBatchRect){ rect, color });
+    }
+}
+
+static void submit_PaintBatch_(iPaintBatch *d, SDL_Renderer *render) {
+    if (isEmpty_Array(&d->rects)) {
+        return;
+    }
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+    /* Two triangles per rectangle, all in one draw call. */
+    clear_Array(&d->vertices);
+    clear_Array(&d->indices);
+    iConstForEach(Array, i, &d->rects) {
+        const iPaintBatchRect *br = i.value;
+        const float x0 = br->rect.x, y0 = br->rect.y;
+        const float x1 = x0 + br->rect.w, y1 = y0 + br->rect.h;
+        const int   base = (int) size_Array(&d->vertices);
+        pushBack_Array(&d->vertices, &(SDL_Vertex){ { x0, y0 }, br->color, { 0, 0 } });
+        pushBack_Array(&d->vertices, &(SDL_Vertex){ { x1, y0 }, br->color, { 0, 0 } });
+        pushBack_Array(&d->vertices, &(SDL_Vertex){ { x1, y1 }, br->color, { 0, 0 } });
+        pushBack_Array(&d->vertices, &(SDL_Vertex){ { x0, y1 }, br->color, { 0, 0 } });
+        const int quad[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+        pushBackN_Array(&d->indices, quad, 6);
+    }
+    SDL_RenderGeometry(render,
+                       NULL,
+                       constData_Array(&d->vertices),
+                       (int) size_Array(&d->vertices),
+                       constData_Array(&d->indices),
+                       (int) size_Array(&d->indices));
+#else
+    /* Consecutive rectangles of the same color are filled with one call. */
+    const iPaintBatchRect *rects = constData_Array(&d->rects);
+    const size_t           count = size_Array(&d->rects);
+    SDL_Rect              *group = malloc(sizeof(SDL_Rect) * count);
+    for (size_t i = 0; i < count; ) {
+        const SDL_Color clr = rects[i].color;
+        size_t n = 0;
+        while (i < count && !memcmp(&rects[i].color, &clr, sizeof(clr))) {
+            group[n++] = rects[i++].rect;
+        }
+        SDL_SetRenderDrawColor(render, clr.r, clr.g, clr.b, clr.a);
+        SDL_RenderFillRects(render, group, (int) n);
+    }
+    free(group);
+#endif
+    clear_Array(&d->rects);
+}
+
+void beginBatch_Paint(iPaint *d) {
+    iAssert(!d->batch);
+    if (!isBatchInitialized_) {
+        init_Array(&batch_.rects, sizeof(iPaintBatchRect));
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+        init_Array(&batch_.vertices, sizeof(SDL_Vertex));
+        init_Array(&batch_.indices, sizeof(int));
+#endif
+        isBatchInitialized_ = iTrue;
+    }
+    d->batch = &batch_;
+}
+
+void endBatch_Paint(iPaint *d) {
+    if (d->batch) {
+        submit_PaintBatch_(d->batch, renderer_Paint_(d));
+        d->batch = NULL;
+    }
+}
+
+static void flushBatch_Paint_(const iPaint *d) {
+    /* State changes like clipping and render targets must not affect what was batched. */
+    if (d->batch) {
+        submit_PaintBatch_(d->batch, renderer_Paint_(d));
+    }
+}
+
+void set_RenderTarget(iRenderTarget *old, SDL_Renderer *render, SDL_Texture *target) {
+    old->texture   = SDL_GetRenderTarget(render);
+    old->isClipped = SDL_RenderIsClipEnabled(render);
+    SDL_RenderGetClipRect(render, &old->clip);
+    SDL_SetRenderTarget(render, target);
+}
+
+void restore_RenderTarget(const iRenderTarget *d, SDL_Renderer *render) {
+    SDL_SetRenderTarget(render, d->texture);
+    SDL_RenderSetClipRect(render, d->isClipped ? &d->clip : NULL);
 }
 
 void init_Paint(iPaint *d) {
     d->dst       = get_Window();
     d->setTarget = NULL;
-    d->oldTarget = NULL;
+    iZap(d->oldTarget);
+    d->oldOrigin = zero_I2();
     d->alpha     = 255;
+    d->batch     = NULL;
 }
 
 void beginTarget_Paint(iPaint *d, SDL_Texture *target) {
     SDL_Renderer *rend = renderer_Paint_(d);
     if (!d->setTarget) {
-        d->oldTarget = SDL_GetRenderTarget(rend);
-        SDL_SetRenderTarget(rend, target);
+        flushBatch_Paint_(d);
+        set_RenderTarget(&d->oldTarget, rend, target);
         d->setTarget = target;
+        d->oldOrigin = origin_Paint;
+        origin_Paint = zero_I2(); /* target has its own coordinates */
     }
     else {
         iAssert(d->setTarget == target);
@@ -58,32 +177,46 @@ void beginTarget_Paint(iPaint *d, SDL_Texture *target) {
 
 void endTarget_Paint(iPaint *d) {
     if (d->setTarget) {
-        SDL_SetRenderTarget(renderer_Paint_(d), d->oldTarget);
-        d->oldTarget = NULL;
+        flushBatch_Paint_(d);
+        restore_RenderTarget(&d->oldTarget, renderer_Paint_(d));
+        iZap(d->oldTarget);
         d->setTarget = NULL;
+        origin_Paint = d->oldOrigin;
     }
 }
 
-void setClip_Paint(iPaint *d, iRect rect) {
+iBool setClip_Paint(iPaint *d, iRect rect) {
+    flushBatch_Paint_(d);
     addv_I2(&rect.pos, origin_Paint);
-    if (isEmpty_Rect(rect)) {
-        rect = init_Rect(0, 0, 1, 1);
-    }
     iRect targetRect = zero_Rect();
     SDL_Texture *target = SDL_GetRenderTarget(renderer_Paint_(d));
-    if (target) {
+    if (target && target != d->dst->frame) {
         SDL_QueryTexture(target, NULL, NULL, &targetRect.size.x, &targetRect.size.y);
         rect = intersect_Rect(rect, targetRect);
     }
     else {
         rect = intersect_Rect(rect, rect_Root(get_Root()));
+        if (!isEmpty_Rect(d->dst->drawClip)) {
+            /* Only the damaged region is being redrawn. */
+            rect = intersect_Rect(rect, d->dst->drawClip);
+        }
+    }
+    if (isEmpty_Rect(rect)) {
+        /* SDL would treat an empty clip as no clipping at all. */
+        return iFalse;
     }
     SDL_RenderSetClipRect(renderer_Paint_(d), (const SDL_Rect *) &rect);
+    return iTrue;
 }
 
 void unsetClip_Paint(iPaint *d) {
-    if (numRoots_Window(get_Window()) > 1) {
-        setClip_Paint(d, rect_Root(get_Root()));
+    flushBatch_Paint_(d);
+    if (numRoots_Window(get_Window()) > 1 || !isEmpty_Rect(d->dst->drawClip)) {
+        if (!setClip_Paint(d, rect_Root(get_Root()))) {
+            /* The damaged region is outside this root; widgets here are skipped anyway. */
+            const iRect none = { d->dst->drawClip.pos, one_I2() };
+            SDL_RenderSetClipRect(renderer_Paint_(d), (const SDL_Rect *) &none);
+        }
         return;
     }
 #if SDL_VERSION_ATLEAST(2, 0, 12)
@@ -108,6 +241,17 @@ void drawRect_Paint(const iPaint *d, iRect rect, int color) {
         { left_Rect(rect),  br.y },
         { left_Rect(rect),  top_Rect(rect) }
     };
+    if (d->batch) {
+        /* The same pixels as the lines: the bottom right corner is inclusive. */
+        const SDL_Color clr = drawColor_Paint_(d, color);
+        const int       w   = br.x - left_Rect(rect) + 1;
+        const int       h   = br.y - top_Rect(rect) + 1;
+        addRect_PaintBatch_(d->batch, (SDL_Rect){ left_Rect(rect), top_Rect(rect), w, 1 }, clr);
+        addRect_PaintBatch_(d->batch, (SDL_Rect){ left_Rect(rect), br.y, w, 1 }, clr);
+        addRect_PaintBatch_(d->batch, (SDL_Rect){ left_Rect(rect), top_Rect(rect) + 1, 1, h - 2 }, clr);
+        addRect_PaintBatch_(d->batch, (SDL_Rect){ br.x, top_Rect(rect) + 1, 1, h - 2 }, clr);
+        return;
+    }
 #if SDL_VERSION_ATLEAST(2, 0, 16)
     if (isOpenGLRenderer_Window()) {
         /* A very curious regression in SDL 2.0.16. */
@@ -128,12 +272,17 @@ void drawRectThickness_Paint(const iPaint *d, iRect rect, int thickness, int col
 
 void fillRect_Paint(const iPaint *d, iRect rect, int color) {
     addv_I2(&rect.pos, origin_Paint);
+    if (d->batch) {
+        addRect_PaintBatch_(d->batch, *(const SDL_Rect *) &rect, drawColor_Paint_(d, color));
+        return;
+    }
     setColor_Paint_(d, color);
 //    printf("fillRect_Paint: %d,%d %dx%d (%d)\n", rect.pos.x, rect.pos.y, rect.size.x, rect.size.y, color);
     SDL_RenderFillRect(renderer_Paint_(d), (SDL_Rect *) &rect);
 }
 
 void drawSoftShadow_Paint(const iPaint *d, iRect inner, int thickness, int color, int alpha) {
+    flushBatch_Paint_(d);
     addv_I2(&inner.pos, origin_Paint);
     SDL_Renderer *render = renderer_Paint_(d);
     SDL_Texture *shadow = get_Window()->borderShadow;
@@ -164,7 +313,43 @@ void drawSoftShadow_Paint(const iPaint *d, iRect inner, int thickness, int color
                    &(SDL_Rect){ outer.pos.x, inner.pos.y, thickness, inner.size.y });
 }
 
+static iBool batchLines_Paint_(const iPaint *d, const iInt2 *points, size_t n, int color) {
+    /* Horizontal and vertical segments become one pixel wide rects. Each segment includes
+       both of its end points, like with SDL_RenderDrawLines. */
+    for (size_t i = 1; i < n; i++) {
+        if (points[i].x != points[i - 1].x && points[i].y != points[i - 1].y) {
+            return iFalse; /* diagonal */
+        }
+    }
+    const SDL_Color clr = drawColor_Paint_(d, color);
+    for (size_t i = 1; i < n; i++) {
+        const iInt2 a = add_I2(min_I2(points[i - 1], points[i]), origin_Paint);
+        const iInt2 b = add_I2(max_I2(points[i - 1], points[i]), origin_Paint);
+        SDL_Rect    seg = { a.x, a.y, b.x - a.x + 1, b.y - a.y + 1 };
+        if (i > 1) {
+            /* The shared corner is already covered by the previous segment. */
+            const iInt2 prev = add_I2(points[i - 1], origin_Paint);
+            if (seg.h == 1) {
+                seg.x += (prev.x == seg.x);
+                seg.w--;
+            }
+            else {
+                seg.y += (prev.y == seg.y);
+                seg.h--;
+            }
+        }
+        addRect_PaintBatch_(d->batch, seg, clr);
+    }
+    return iTrue;
+}
+
 void drawLines_Paint(const iPaint *d, const iInt2 *points, size_t n, int color) {
+    if (d->batch) {
+        if (batchLines_Paint_(d, points, n, color)) {
+            return;
+        }
+        flushBatch_Paint_(d);
+    }
     setColor_Paint_(d, color);
     iInt2 *offsetPoints = malloc(sizeof(iInt2) * n);
     for (size_t i = 0; i < n; i++) {
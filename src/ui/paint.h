@@ -28,12 +28,27 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "window.h"
 
 iDeclareType(Paint)
+iDeclareType(PaintBatch)
+iDeclareType(RenderTarget)
+
+/* SDL resets the clip rect when switching to a texture target, so the previous
+   target is saved together with its clip. */
+struct Impl_RenderTarget {
+    SDL_Texture *texture;
+    SDL_Rect     clip;
+    iBool        isClipped;
+};
+
+void    set_RenderTarget    (iRenderTarget *old, SDL_Renderer *render, SDL_Texture *target);
+void    restore_RenderTarget(const iRenderTarget *, SDL_Renderer *render);
 
 struct Impl_Paint {
-    iWindow *    dst;
-    SDL_Texture *setTarget;
-    SDL_Texture *oldTarget;
-    uint8_t      alpha;
+    iWindow *     dst;
+    SDL_Texture * setTarget;
+    iRenderTarget oldTarget;
+    iInt2         oldOrigin;
+    uint8_t       alpha;
+    iPaintBatch * batch; /* solid rects and lines are collected here until submitted */
 };
 
 extern iInt2 origin_Paint; /* add this to all drawn positions so buffered graphics are correctly offset */
@@ -43,9 +58,15 @@ void    init_Paint          (iPaint *);
 void    beginTarget_Paint   (iPaint *, SDL_Texture *target);
 void    endTarget_Paint     (iPaint *);
 
-void    setClip_Paint       (iPaint *, iRect rect);
+iBool   setClip_Paint       (iPaint *, iRect rect); /* returns iFalse if nothing would be visible */
 void    unsetClip_Paint     (iPaint *);
 
+/* While batching, filled rects, outlines, and straight lines are not drawn right away but
+   collected and submitted together as one piece of geometry. Anything else drawn in the
+   meantime ends up below the batch, so text and images are drawn after `endBatch`. */
+void    beginBatch_Paint    (iPaint *);
+void    endBatch_Paint      (iPaint *);
+
 void    drawRect_Paint          (const iPaint *, iRect rect, int color);
 void    drawRectThickness_Paint (const iPaint *, iRect rect, int thickness, int color);
 void    fillRect_Paint          (const iPaint *, iRect rect, int color);
@@ -1244,6 +1244,7 @@ void createUserInterface_Root(iRoot *d) {
                         { star_Icon " ${menu.page.subscribe}", subscribeToPage_KeyModifier, "feeds.subscribe" },
                         { book_Icon " ${menu.page.import}", 0, 0, "bookmark.links confirm:1" },
                         { globe_Icon " ${menu.page.translate}", 0, 0, "document.translate" },
+                        { download_Icon " ${menu.page.mirror}", 0, 0, "mirror.start" },
                         { upload_Icon " ${menu.page.upload}", 0, 0, "document.upload" },
                         { "---" },
                         { "${menu.page.copyurl}", 0, 0, "document.copylink" },
@@ -1367,6 +1368,10 @@ void createUserInterface_Root(iRoot *d) {
         setLineBreaksEnabled_InputWidget(input, iFalse);
         setId_Widget(addChildFlags_Widget(searchBar, iClob(input), expand_WidgetFlag),
                      "find.input");
+        iLabelWidget *count = new_LabelWidget("", NULL);
+        setTextColor_LabelWidget(count, uiAnnotation_ColorId);
+        setId_Widget(addChildFlags_Widget(searchBar, iClob(count), frameless_WidgetFlag),
+                     "find.count");
         addChild_Widget(searchBar, iClob(newIcon_LabelWidget("  \u2b9f  ", 'g', KMOD_PRIMARY, "find.next")));
         addChild_Widget(searchBar, iClob(newIcon_LabelWidget("  \u2b9d  ", 'g', KMOD_PRIMARY | KMOD_SHIFT, "find.prev")));
         addChild_Widget(searchBar, iClob(newIcon_LabelWidget(close_Icon, SDLK_ESCAPE, 0, "find.close")));
@@ -86,6 +86,20 @@ iEndDefineSubclass(SidebarItem)
 
 iDefineObjectConstruction(SidebarItem)
 
+static iBool isEqual_SidebarItem_(const iListItem *item, const iListItem *otherItem) {
+    /* Everything that affects the item's appearance. */
+    const iSidebarItem *d     = (const iSidebarItem *) item;
+    const iSidebarItem *other = (const iSidebarItem *) otherItem;
+    return d->id == other->id && d->indent == other->indent && d->icon == other->icon &&
+           d->isBold == other->isBold &&
+           d->listItem.isSeparator == other->listItem.isSeparator &&
+           d->listItem.isSelected == other->listItem.isSelected &&
+           d->listItem.isDraggable == other->listItem.isDraggable &&
+           d->listItem.isDropTarget == other->listItem.isDropTarget &&
+           equal_String(&d->label, &other->label) && equal_String(&d->meta, &other->meta) &&
+           equal_String(&d->url, &other->url);
+}
+
 /*----------------------------------------------------------------------------------------------*/
 
 struct Impl_SidebarWidget {
@@ -97,6 +111,7 @@ struct Impl_SidebarWidget {
     iWidget *         blank;
     iListWidget *     list;
     iWidget *         actions; /* below the list, area for buttons */
+    iLabelWidget *    mirrorStatus; /* offline mirroring progress; click to stop */
     int               modeScroll[max_SidebarMode];
     iLabelWidget *    modeButtons[max_SidebarMode];
     int               maxButtonLabelWidth;
@@ -265,7 +280,7 @@ static iBool isBookmarkFolded_SidebarWidget_(const iSidebarWidget *d, const iBoo
 }
 
 static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepActions) {
-    clear_ListWidget(d->list);
+    iPtrArray *items = collectNew_PtrArray(); /* compared against the current items */
     releaseChildren_Widget(d->blank);
     if (!keepActions) {
     releaseChildren_Widget(d->actions);
@@ -327,7 +342,7 @@ static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepAct
                         }
                         set_String(&sep->meta, text);
                         delete_String(text);
-                        addItem_ListWidget(d->list, sep);
+                        pushBack_PtrArray(items, ref_Object(sep));
                         iRelease(sep);
                     }
                 }
@@ -342,7 +357,7 @@ static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepAct
                     item->icon = bm->icon;
                     append_String(&item->meta, &bm->title);
                 }
-                addItem_ListWidget(d->list, item);
+                pushBack_PtrArray(items, ref_Object(item));
                 iRelease(item);
                 if (++numItems == 100) {
                     /* For more items, one can always see "about:feeds". A large number of items
@@ -410,7 +425,7 @@ static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepAct
                 setRange_String(&item->label, head->text);
                 item->indent = head->level * 5 * gap_UI;
                 item->isBold = head->level == 0;
-                addItem_ListWidget(d->list, item);
+                pushBack_PtrArray(items, ref_Object(item));
                 iRelease(item);
             }
             break;
@@ -463,7 +478,7 @@ static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepAct
                         appendChar_String(&item->meta, 0x25e7);
                     }
                 }
-                addItem_ListWidget(d->list, item);
+                pushBack_PtrArray(items, ref_Object(item));
                 iRelease(item);
             }
             d->menu = makeMenu_Widget(
@@ -526,17 +541,17 @@ static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepAct
                     set_String(&sep->meta, text);
                     const int yOffset = itemHeight_ListWidget(d->list) * 2 / 3;
                     sep->id = yOffset;
-                    addItem_ListWidget(d->list, sep);
+                    pushBack_PtrArray(items, ref_Object(sep));
                     iRelease(sep);
                     /* Date separators are two items tall. */
                     sep = new_SidebarItem();
                     sep->listItem.isSeparator = iTrue;
                     sep->id = -itemHeight_ListWidget(d->list) + yOffset;
                     set_String(&sep->meta, text);
-                    addItem_ListWidget(d->list, sep);
+                    pushBack_PtrArray(items, ref_Object(sep));
                     iRelease(sep);
                 }
-                addItem_ListWidget(d->list, item);
+                pushBack_PtrArray(items, ref_Object(item));
                 iRelease(item);
             }
             d->menu = makeMenu_Widget(
@@ -593,7 +608,7 @@ static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepAct
                 if (isUsedOnDomain_GmIdentity(ident, tabHost)) {
                     item->indent = 1; /* will be highlighted */
                 }
-                addItem_ListWidget(d->list, item);
+                pushBack_PtrArray(items, ref_Object(item));
                 iRelease(item);
                 isEmpty = iFalse;
             }
@@ -607,9 +622,12 @@ static void updateItemsWithFlags_SidebarWidget_(iSidebarWidget *d, iBool keepAct
         default:
             break;
     }
+    updateItems_ListWidget(d->list, items, isEqual_SidebarItem_);
+    iForEach(PtrArray, i, items) {
+        deref_Object(i.ptr);
+    }
     scrollOffset_ListWidget(d->list, 0);
     updateVisible_ListWidget(d->list);
-    invalidate_ListWidget(d->list);
     /* Content for a blank tab. */
     if (isEmpty) {
         if (d->mode == feeds_SidebarMode) {
@@ -698,6 +716,8 @@ iBool setMode_SidebarWidget(iSidebarWidget *d, enum iSidebarMode mode) {
     setBackgroundColor_Widget(as_Widget(d->list),
                               d->mode == documentOutline_SidebarMode ? tmBannerBackground_ColorId
                                                                      : uiBackgroundSidebar_ColorId);
+    clear_ListWidget(d->list); /* items of different modes are drawn differently */
+    invalidate_ListWidget(d->list);
     updateItemHeight_SidebarWidget_(d);
     /* Restore previous scroll position. */
     setScrollPos_ListWidget(d->list, d->modeScroll[mode]);
@@ -844,6 +864,12 @@ void init_SidebarWidget(iSidebarWidget *d, enum iSidebarSide side) {
     addChildFlags_Widget(listAndActions,
                          iClob(d->list),
                          expand_WidgetFlag); // | drawBackgroundToHorizontalSafeArea_WidgetFlag);
+    d->mirrorStatus = new_LabelWidget("", "mirror.stop");
+    setBackgroundColor_Widget(as_Widget(d->mirrorStatus), uiBackgroundSidebar_ColorId);
+    addChildFlags_Widget(listAndActions,
+                         iClob(d->mirrorStatus),
+                         borderTop_WidgetFlag | alignLeft_WidgetFlag | frameless_WidgetFlag |
+                             hidden_WidgetFlag | collapse_WidgetFlag);
     setId_Widget(addChildPosFlags_Widget(listAndActions,
                                          iClob(d->actions = new_Widget()),
                                          isPhone ? front_WidgetAddPos : back_WidgetAddPos,
@@ -1053,7 +1079,7 @@ iBool handleBookmarkEditorCommands_SidebarWidget_(iWidget *editor, const char *c
             iBookmark *bm = get_Bookmarks(bookmarks_App(), item->id);
             set_String(&bm->title, title);
             if (!isFolder_Bookmark(bm)) {
-                set_String(&bm->url, url);
+                setUrl_Bookmarks(bookmarks_App(), item->id, url);
                 set_String(&bm->tags, tags);
                 if (isEmpty_String(icon)) {
                     removeTag_Bookmark(bm, userIcon_BookmarkTag);
@@ -1478,6 +1504,20 @@ static iBool processEvent_SidebarWidget_(iSidebarWidget *d, const SDL_Event *ev)
             }
             return iTrue;
         }
+        else if (equal_Command(cmd, "mirror.progress")) {
+            updateTextCStr_LabelWidget(
+                d->mirrorStatus,
+                format_CStr(download_Icon " ${status.mirror} %s %d/%d  " close_Icon,
+                            suffixPtr_Command(cmd, "host"),
+                            arg_Command(cmd),
+                            argLabel_Command(cmd, "total")));
+            showCollapsed_Widget(as_Widget(d->mirrorStatus), iTrue);
+            return iFalse;
+        }
+        else if (equal_Command(cmd, "mirror.finished")) {
+            showCollapsed_Widget(as_Widget(d->mirrorStatus), iFalse);
+            return iFalse;
+        }
         else if (equal_Command(cmd, "feeds.update.finished")) {
             d->numUnreadEntries = argLabel_Command(cmd, "unread");
             checkModeButtonLayout_SidebarWidget_(d);
@@ -27,18 +27,22 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "window.h"
 #include "paint.h"
 #include "app.h"
+#include "jobs.h"
+#include "profiler.h"
 
 #define STB_TRUETYPE_IMPLEMENTATION
 #include "../stb_truetype.h"
 
 #include <the_Foundation/array.h>
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/fileinfo.h>
 #include <the_Foundation/hash.h>
 #include <the_Foundation/math.h>
 #include <the_Foundation/stringlist.h>
-#include <the_Foundation/regexp.h>
+#include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
+#include <the_Foundation/ptrarray.h>
 #include <the_Foundation/ptrset.h>
 #include <the_Foundation/vec2.h>
 
@@ -46,6 +50,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <SDL_hints.h>
 #include <SDL_version.h>
 #include <stdarg.h>
+#include <stdatomic.h>
 
 #if defined (LAGRANGE_ENABLE_HARFBUZZ)
 #   include <hb.h>
@@ -55,6 +60,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #   include <fribidi/fribidi.h>
 #endif
 
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+#   define LAGRANGE_GLYPH_BATCH     1 /* glyph quads are drawn with SDL_RenderGeometry */
+#endif
+
+#if defined (iPlatformMsys)
+#   define LAGRANGE_GLYPH_BACKING   1 /* render targets are lost when the window is resized */
+#endif
+
 #if SDL_VERSION_ATLEAST(2, 0, 10)
 #   define LAGRANGE_RASTER_DEPTH    8
 #   define LAGRANGE_RASTER_FORMAT   SDL_PIXELFORMAT_INDEX8
@@ -65,59 +78,90 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 iDeclareType(Font)
 iDeclareType(Glyph)
-iDeclareTypeConstructionArgs(Glyph, iChar ch)
 
 static const float contentScale_Text_ = 1.3f;
 
 int gap_Text;                           /* cf. gap_UI in metrics.h */
 int enableHalfPixelGlyphs_Text = iTrue; /* debug setting */
-int enableKerning_Text         = iTrue; /* looking up kern pairs is slow */
+int enableKerning_Text         = iTrue; /* debug setting */
 
 enum iGlyphFlag {
     rasterized0_GlyphFlag = iBit(1),    /* zero offset */
     rasterized1_GlyphFlag = iBit(2),    /* half-pixel offset */
 };
 
+iDeclareType(GlyphBitmaps)
+
+/* Glyph bitmaps rasterized by a worker thread or loaded from the disk cache, waiting to be
+   copied to the glyph cache. */
+struct Impl_GlyphBitmaps {
+    int      mask; /* bit for each available offset */
+    uint8_t *pixels[2]; /* zero and half pixel offset */
+    iInt2    size[2];
+};
+
+static void delete_GlyphBitmaps_(iGlyphBitmaps *d) {
+    if (d) {
+        free(d->pixels[0]);
+        free(d->pixels[1]);
+        free(d);
+    }
+}
+
+/* Glyph metrics are determined when a glyph is first looked up, but a position in the
+   glyph cache texture is only assigned when the glyph is rasterized for drawing. This means
+   measuring text never touches the texture and can be done in a background thread. */
 struct Impl_Glyph {
-    iHashNode node;
-    int flags;
-    iFont *font; /* may come from symbols/emoji */
+    uint32_t index; /* glyph index in the font */
+    _Atomic(int) flags; /* set by the main thread, checked by the raster pool */
+    _Atomic(iFont *) font; /* may come from symbols/emoji; set when the metrics are ready */
     iRect rect[2]; /* zero and half pixel offset */
+    uint8_t page[2]; /* glyph cache page of each `rect` */
+    iGlyphBitmaps *bitmaps; /* rasterized ahead of drawing */
     iInt2 d[2];
     float advance; /* scaled */
 };
 
 void init_Glyph(iGlyph *d, uint32_t glyphIndex) {
-    d->node.key   = glyphIndex;
-    d->flags      = 0;
+    d->index      = glyphIndex;
+    atomic_init(&d->flags, 0);
     d->font       = NULL;
     d->rect[0]    = zero_Rect();
     d->rect[1]    = zero_Rect();
+    d->page[0]    = 0;
+    d->page[1]    = 0;
+    d->bitmaps    = NULL;
     d->advance    = 0.0f;
 }
 
 void deinit_Glyph(iGlyph *d) {
-    iUnused(d);
+    delete_GlyphBitmaps_(d->bitmaps);
 }
 
 static uint32_t index_Glyph_(const iGlyph *d) {
-    return d->node.key;
+    return d->index;
+}
+
+iLocalDef int flags_Glyph_(const iGlyph *d) {
+    return atomic_load_explicit(&d->flags, memory_order_relaxed);
 }
 
 iLocalDef iBool isRasterized_Glyph_(const iGlyph *d, int hoff) {
-    return (d->flags & (rasterized0_GlyphFlag << hoff)) != 0;
+    return (flags_Glyph_(d) & (rasterized0_GlyphFlag << hoff)) != 0;
 }
 
 iLocalDef iBool isFullyRasterized_Glyph_(const iGlyph *d) {
-    return (d->flags & (rasterized0_GlyphFlag | rasterized1_GlyphFlag)) ==
+    return (flags_Glyph_(d) & (rasterized0_GlyphFlag | rasterized1_GlyphFlag)) ==
            (rasterized0_GlyphFlag | rasterized1_GlyphFlag);
 }
 
 iLocalDef void setRasterized_Glyph_(iGlyph *d, int hoff) {
-    d->flags |= rasterized0_GlyphFlag << hoff;
+    atomic_fetch_or_explicit(&d->flags, rasterized0_GlyphFlag << hoff, memory_order_relaxed);
 }
 
-iDefineTypeConstructionArgs(Glyph, (iChar ch), ch)
+iLocalDef void setUnrasterized_Glyph_(iGlyph *d, int hoff) {
+    atomic_fetch_and_explicit(&d->flags, ~(rasterized0_GlyphFlag << hoff), memory_order_relaxed);
+}
 
 /*-----------------------------------------------------------------------------------------------*/
 
@@ -125,30 +169,158 @@ static iGlyph *glyph_Font_(iFont *d, iChar ch);
 
 iDeclareType(GlyphTable)
 
+iDeclareType(FallbackEntry)
+
+/* Resolved fallback font of a character that is missing from the font itself. If no font
+   has the character, `glyphIndex` is zero. */
+struct Impl_FallbackEntry {
+    iChar    ch; /* zero if the slot is free */
+    int      fontId;
+    uint32_t glyphIndex;
+};
+
+/* Glyphs are stored in pages of consecutive glyph indices. Pages are allocated when the
+   first glyph on them is looked up. A glyph is in use if its `font` is set. */
+/* Glyph indices are 16-bit in sfnt fonts, so the page directory has a fixed size and pages
+   can be looked up without locking. */
+enum { glyphPageShift_GlyphTable_ = 8, glyphPageSize_GlyphTable_ = 1 << glyphPageShift_GlyphTable_ };
+enum { maxPages_GlyphTable_ = 0x10000 >> glyphPageShift_GlyphTable_ };
+
 struct Impl_GlyphTable {
-    iHash          glyphs; /* key is glyph index in the font */
-    /* TODO: `glyphs` does not need to be a Hash.
-       We could lazily allocate an array with glyphCount elements instead. */
+    _Atomic(iGlyph *) pages[maxPages_GlyphTable_];
     uint32_t       indexTable[128 - 32]; /* quick ASCII lookup */
+    iGlyph *       asciiGlyphs[128 - 32]; /* ASCII glyphs found in the font itself */
+#if defined (LAGRANGE_ENABLE_KERNING) && !defined (LAGRANGE_ENABLE_HARFBUZZ)
+    _Atomic(int16_t *) asciiKerning; /* pairs of printable ASCII characters, set up when needed */
+#endif
+    iFallbackEntry *fallbacks; /* open addressing, power-of-two capacity */
+    size_t         fallbackCapacity;
+    size_t         numFallbacks;
 };
 
 static void clearGlyphs_GlyphTable_(iGlyphTable *d) {
     if (d) {
-        iForEach(Hash, i, &d->glyphs) {
-            delete_Glyph((iGlyph *) i.value);
+        for (size_t p = 0; p < maxPages_GlyphTable_; p++) {
+            iGlyph *page = atomic_load_explicit(&d->pages[p], memory_order_relaxed);
+            if (page) {
+                for (size_t i = 0; i < glyphPageSize_GlyphTable_; i++) {
+                    if (page[i].font) {
+                        deinit_Glyph(&page[i]);
+                    }
+                }
+                free(page);
+                atomic_store_explicit(&d->pages[p], NULL, memory_order_relaxed);
+            }
+        }
+    }
+}
+
+static void uncachePage_GlyphTable_(iGlyphTable *d, int page) {
+    /* Metrics remain valid, the bitmaps on `page` need to be rasterized again. */
+    if (d) {
+        for (size_t p = 0; p < maxPages_GlyphTable_; p++) {
+            iGlyph *page = atomic_load_explicit(&d->pages[p], memory_order_relaxed);
+            if (!page) continue;
+            for (size_t i = 0; i < glyphPageSize_GlyphTable_; i++) {
+                iGlyph *glyph = &page[i];
+                for (int hoff = 0; hoff < 2; hoff++) {
+                    if (isRasterized_Glyph_(glyph, hoff) && glyph->page[hoff] == page) {
+                        setUnrasterized_Glyph_(glyph, hoff);
+                    }
+                }
+            }
+        }
+    }
+}
+
+static iGlyph *findGlyph_GlyphTable_(iGlyphTable *d, uint32_t glyphIndex) {
+    /* Returns the glyph if its metrics are ready, otherwise NULL. Does not need locking. */
+    const size_t p = (glyphIndex & 0xffff) >> glyphPageShift_GlyphTable_;
+    iGlyph *page = atomic_load_explicit(&d->pages[p], memory_order_acquire);
+    if (page) {
+        iGlyph *glyph = &page[glyphIndex & (glyphPageSize_GlyphTable_ - 1)];
+        if (atomic_load_explicit(&glyph->font, memory_order_acquire)) {
+            return glyph;
+        }
+    }
+    return NULL;
+}
+
+static iGlyph *glyph_GlyphTable_(iGlyphTable *d, uint32_t glyphIndex) {
+    /* Returns the slot of the glyph, allocating its page if needed. Called with the glyph
+       mutex locked. */
+    const size_t p = (glyphIndex & 0xffff) >> glyphPageShift_GlyphTable_;
+    iGlyph *page = atomic_load_explicit(&d->pages[p], memory_order_relaxed);
+    if (!page) {
+        page = calloc(glyphPageSize_GlyphTable_, sizeof(iGlyph));
+        atomic_store_explicit(&d->pages[p], page, memory_order_release);
+    }
+    return &page[glyphIndex & (glyphPageSize_GlyphTable_ - 1)];
+}
+
+static iFallbackEntry *findFallback_GlyphTable_(const iGlyphTable *d, iChar ch) {
+    /* Returns the entry of `ch` or the free slot where it should be inserted. */
+    const size_t mask = d->fallbackCapacity - 1;
+    for (size_t i = (ch * 2654435761u) & mask; ; i = (i + 1) & mask) {
+        iFallbackEntry *entry = &d->fallbacks[i];
+        if (entry->ch == ch || entry->ch == 0) {
+            return entry;
+        }
+    }
+}
+
+static const iFallbackEntry *fallback_GlyphTable_(const iGlyphTable *d, iChar ch) {
+    if (d->numFallbacks) {
+        const iFallbackEntry *entry = findFallback_GlyphTable_(d, ch);
+        if (entry->ch) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static void insertFallback_GlyphTable_(iGlyphTable *d, iChar ch, int fontId,
+                                       uint32_t glyphIndex) {
+    if ((d->numFallbacks + 1) * 2 > d->fallbackCapacity) {
+        /* Keep the table at most half full. */
+        iFallbackEntry *old         = d->fallbacks;
+        const size_t    oldCapacity = d->fallbackCapacity;
+        d->fallbackCapacity = iMax(64, oldCapacity * 2);
+        d->fallbacks        = calloc(d->fallbackCapacity, sizeof(iFallbackEntry));
+        for (size_t i = 0; i < oldCapacity; i++) {
+            if (old[i].ch) {
+                *findFallback_GlyphTable_(d, old[i].ch) = old[i];
+            }
         }
-        clear_Hash(&d->glyphs);
+        free(old);
     }
+    iFallbackEntry *entry = findFallback_GlyphTable_(d, ch);
+    if (!entry->ch) {
+        d->numFallbacks++;
+    }
+    *entry = (iFallbackEntry){ ch, fontId, glyphIndex };
 }
 
 static void init_GlyphTable(iGlyphTable *d) {
-    init_Hash(&d->glyphs);
+    for (size_t p = 0; p < maxPages_GlyphTable_; p++) {
+        atomic_init(&d->pages[p], NULL);
+    }
     memset(d->indexTable, 0xff, sizeof(d->indexTable));
+    memset(d->asciiGlyphs, 0, sizeof(d->asciiGlyphs));
+#if defined (LAGRANGE_ENABLE_KERNING) && !defined (LAGRANGE_ENABLE_HARFBUZZ)
+    atomic_init(&d->asciiKerning, NULL);
+#endif
+    d->fallbacks        = NULL;
+    d->fallbackCapacity = 0;
+    d->numFallbacks     = 0;
 }
 
 static void deinit_GlyphTable(iGlyphTable *d) {
     clearGlyphs_GlyphTable_(d);
-    deinit_Hash(&d->glyphs);
+#if defined (LAGRANGE_ENABLE_KERNING) && !defined (LAGRANGE_ENABLE_HARFBUZZ)
+    free(atomic_load_explicit(&d->asciiKerning, memory_order_relaxed));
+#endif
+    free(d->fallbacks);
 }
 
 iDefineTypeConstruction(GlyphTable)
@@ -220,18 +392,19 @@ static void deinit_Font(iFont *d) {
     delete_GlyphTable(d->table);
 }
 
+static iGlyphTable *table_Font_(iFont *d);
+
 static uint32_t glyphIndex_Font_(iFont *d, iChar ch) {
     /* TODO: Add a small cache of ~5 most recently found indices. */
     const size_t entry = ch - 32;
-    if (!d->table) {
-        d->table = new_GlyphTable();
-    }
-    iGlyphTable *table = d->table;
+    iGlyphTable *table = table_Font_(d);
     if (entry < iElemCount(table->indexTable)) {
-        if (table->indexTable[entry] == ~0u) {
-            table->indexTable[entry] = findGlyphIndex_FontFile(d->fontFile, ch);
+        uint32_t index = table->indexTable[entry];
+        if (index == ~0u) {
+            /* Concurrent lookups will find the same index. */
+            index = table->indexTable[entry] = findGlyphIndex_FontFile(d->fontFile, ch);
         }
-        return table->indexTable[entry];
+        return index;
     }
     return findGlyphIndex_FontFile(d->fontFile, ch);
 }
@@ -240,12 +413,113 @@ static uint32_t glyphIndex_Font_(iFont *d, iChar ch) {
 
 iDeclareType(Text)
 iDeclareType(CacheRow)
+iDeclareType(GlyphCachePage)
 
 struct Impl_CacheRow {
     int   height;
     iInt2 pos;
 };
 
+/* The glyph cache consists of equally sized texture pages. New glyphs are placed on the
+   current page, and when all pages are full, the least recently drawn page is cleared and
+   reused. Glyphs are drawn a string at a time, so they tend to be on the same page and the
+   renderer can batch the copies. */
+struct Impl_GlyphCachePage {
+    SDL_Texture *texture;
+#if defined (LAGRANGE_GLYPH_BACKING)
+    SDL_Surface *backing; /* copy of the texture contents for restoring lost render targets */
+#endif
+    iArray       rows; /* CacheRow */
+    int          bottom;
+    int          numGlyphs;
+    uint32_t     lastUsed; /* value of `cacheUseCounter` */
+};
+
+static const int maxCachePages_Text_ = 4;
+static const int maxZoomRatio_Text_  = 2; /* zooming further than this recreates the cache */
+
+iDeclareType(GlyphRasterPool)
+
+/* Glyphs are rasterized ahead of drawing by background jobs. Glyphs are usually first looked
+   up when text is measured, e.g., in a document layout, so by the time they get drawn, the
+   bitmaps are often ready and only need to be uploaded to the glyph cache texture. Each job
+   keeps rasterizing until the queue is empty, or until too many bitmaps are waiting to be
+   uploaded; glyphs that are measured but never drawn would otherwise keep theirs forever. */
+struct Impl_GlyphRasterPool {
+    iMutex     mutex;
+    iCondition idle;
+    iPtrArray  jobs; /* glyphs, rasterized in order starting from `nextJob` */
+    size_t     nextJob;
+    int        numDrainers; /* submitted jobs that haven't returned */
+    int        numBusy;
+    size_t     numReady; /* glyphs with bitmaps that haven't been taken */
+    iBool      isQuitting;
+};
+
+static const size_t maxQueued_GlyphRasterPool_    = 4096;
+static const size_t maxReady_GlyphRasterPool_     = 2048;
+static const int    maxDrainers_GlyphRasterPool_  = 4;
+
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+iDeclareType(ShapedRun)
+iDeclareType(ShapeCache)
+
+/* HarfBuzz output for a run of text in one font. Clusters are relative to the first
+   character of the run, so the same text is found regardless of where it appears. */
+struct Impl_ShapedRun {
+    iHashNode            node; /* key is a hash of the input */
+    iShapedRun *         prev; /* more recently used */
+    iShapedRun *         next; /* less recently used */
+    const iFont *        font;
+    hb_script_t          script;
+    unsigned int         inputLen;
+    unsigned int         glyphCount;
+    uint32_t *           input; /* codepoint and relative cluster of each input character */
+    hb_glyph_info_t *    glyphInfo;
+    hb_glyph_position_t *glyphPos;
+};
+
+/* Least recently used shaping results are discarded when the total size exceeds `budget`.
+   Layout and drawing shape the same runs, and UI labels are drawn every frame. */
+struct Impl_ShapeCache {
+    iMutex      mutex; /* text is also measured in background threads */
+    iHash       runs;
+    iShapedRun *first;
+    iShapedRun *last;
+    size_t      size;
+    size_t      budget;
+};
+
+static const size_t defaultBudget_ShapeCache_ = 2 * 1024 * 1024;
+#else
+iDeclareType(MeasuredText)
+iDeclareType(MeasureCache)
+
+enum {
+    maxTextLength_MeasureCache_ = 96,
+    numEntries_MeasureCache_    = 128, /* power of two */
+};
+
+/* Metrics of a short string, e.g., a UI label or a line of wrapped text. */
+struct Impl_MeasuredText {
+    uint32_t     hash; /* zero if the slot is free */
+    uint32_t     fontGeneration;
+    int          fontId;
+    int          overrideFontId;
+    uint16_t     len;
+    iBool        missingGlyphs;
+    iTextMetrics metrics;
+    char         text[maxTextLength_MeasureCache_];
+};
+
+/* Without HarfBuzz there are no cached shaping results, so the most recently measured
+   strings are kept instead. Slots are picked by hash; a newer string replaces an older one. */
+struct Impl_MeasureCache {
+    iMutex        mutex; /* text is also measured in background threads */
+    iMeasuredText entries[numEntries_MeasureCache_];
+};
+#endif
+
 struct Impl_Text {
 //    enum iTextFont contentFont;
 //    enum iTextFont headingFont;
@@ -253,23 +527,325 @@ struct Impl_Text {
     iArray         fonts; /* fonts currently selected for use (incl. all styles/sizes) */
     int            overrideFontId; /* always checked for glyphs first, regardless of which font is used */
     SDL_Renderer * render;
-    SDL_Texture *  cache;
-    iInt2          cacheSize;
+    iArray         cachePages; /* GlyphCachePage */
+    int            cachePage; /* new glyphs are placed here */
+    iInt2          cacheSize; /* of each page */
     int            cacheRowAllocStep;
-    int            cacheBottom;
-    iArray         cacheRows;
+    int            cacheTextSize; /* content text size when the pages were created */
+    uint32_t       cacheUseCounter;
+    int            cacheEvictions;
+    iColor         cacheColor; /* texture state shared by all pages */
+    uint8_t        cacheAlpha;
+    SDL_BlendMode  cacheBlendMode;
     SDL_Palette *  grayscale;
     SDL_Palette *  blackAndWhite; /* unsmoothed glyph palette */
-    iRegExp *      ansiEscape;
-    int            ansiFlags;
-    int            baseFontId; /* base attributes (for restoring via escapes) */
-    int            baseFgColorId;
-    iBool          missingGlyphs; /* true if a glyph couldn't be found */
+    iMutex         glyphMutex; /* glyph tables may be accessed by background layout */
+    iMutex         fontsMutex;
+    iCondition     fontsReleased;
+    int            numMetricsUsers; /* threads using font metrics outside the main thread */
+    uint32_t       fontGeneration; /* incremented when fonts are reset */
+    uint32_t       metricsKey; /* identifies the fonts and sizes in use */
+    iGlyphRasterPool rasterPool;
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+    iShapeCache    shapeCache;
+#else
+    iMeasureCache  measureCache;
+#endif
+    iBuffer *      glyphRecording; /* bitmaps uploaded to the cache, saved on disk */
+    uint32_t       numRecordedGlyphs;
+#if defined (LAGRANGE_GLYPH_BATCH)
+    SDL_Texture *  batchTexture; /* cache page of the queued glyph quads */
+    iArray         batchVertices; /* SDL_Vertex */
+    iArray         batchIndices; /* int */
+#endif
 };
 
 iDefineTypeConstructionArgs(Text, (SDL_Renderer *render), render)
 
-static iText  *activeText_;
+/*----------------------------------------------------------------------------------------------*/
+
+static void init_GlyphRasterPool_(iGlyphRasterPool *d) {
+    init_Mutex(&d->mutex);
+    init_Condition(&d->idle);
+    init_PtrArray(&d->jobs);
+    d->nextJob     = 0;
+    d->numDrainers = 0;
+    d->numBusy     = 0;
+    d->numReady    = 0;
+    d->isQuitting  = iFalse;
+}
+
+static void deinit_GlyphRasterPool_(iGlyphRasterPool *d) {
+    lock_Mutex(&d->mutex);
+    d->isQuitting = iTrue;
+    clear_PtrArray(&d->jobs);
+    d->nextJob = 0;
+    while (d->numDrainers > 0) {
+        wait_Condition(&d->idle, &d->mutex);
+    }
+    unlock_Mutex(&d->mutex);
+    deinit_PtrArray(&d->jobs);
+    deinit_Condition(&d->idle);
+    deinit_Mutex(&d->mutex);
+}
+
+static void run_GlyphRasterPool_(iJob *job, void *context) {
+    iGlyphRasterPool *d = context;
+    iUnused(job);
+    lock_Mutex(&d->mutex);
+    while (!d->isQuitting && d->nextJob < size_PtrArray(&d->jobs) &&
+           d->numReady < maxReady_GlyphRasterPool_) {
+        iGlyph *glyph = at_PtrArray(&d->jobs, d->nextJob++);
+        if (d->nextJob == size_PtrArray(&d->jobs)) {
+            clear_PtrArray(&d->jobs);
+            d->nextJob = 0;
+        }
+        if (glyph->bitmaps || isFullyRasterized_Glyph_(glyph)) {
+            continue; /* loaded from the disk cache, or already in the glyph cache */
+        }
+        d->numBusy++;
+        unlock_Mutex(&d->mutex);
+        /* Fonts are not reset while glyphs are being rasterized. */
+        const iFont   *font    = glyph->font;
+        iGlyphBitmaps *bitmaps = malloc(sizeof(iGlyphBitmaps));
+        bitmaps->mask = 3;
+        for (int hoff = 0; hoff < 2; hoff++) {
+            bitmaps->pixels[hoff] = rasterizeGlyph_FontFile(font->fontFile,
+                                                            font->xScale,
+                                                            font->yScale,
+                                                            hoff * 0.5f,
+                                                            index_Glyph_(glyph),
+                                                            &bitmaps->size[hoff].x,
+                                                            &bitmaps->size[hoff].y);
+        }
+        lock_Mutex(&d->mutex);
+        if (!glyph->bitmaps && !isFullyRasterized_Glyph_(glyph)) {
+            glyph->bitmaps = bitmaps;
+            d->numReady++;
+        }
+        else {
+            delete_GlyphBitmaps_(bitmaps); /* was rasterized on the main thread already */
+        }
+        if (--d->numBusy == 0) {
+            signal_Condition(&d->idle);
+        }
+    }
+    d->numDrainers--;
+    signal_Condition(&d->idle);
+    unlock_Mutex(&d->mutex);
+}
+
+static void enqueue_GlyphRasterPool_(iGlyphRasterPool *d, iGlyph *glyph) {
+    lock_Mutex(&d->mutex);
+    if (!d->isQuitting && size_PtrArray(&d->jobs) - d->nextJob < maxQueued_GlyphRasterPool_) {
+        pushBack_PtrArray(&d->jobs, glyph);
+        if (d->numDrainers < iMin((int) numWorkers_Jobs(), maxDrainers_GlyphRasterPool_)) {
+            d->numDrainers++;
+            release_Job(submit_Jobs(prefetch_JobPriority, run_GlyphRasterPool_, d, NULL));
+        }
+    }
+    unlock_Mutex(&d->mutex);
+}
+
+static void cancel_GlyphRasterPool_(iGlyphRasterPool *d) {
+    /* Queued glyphs are dropped, and glyphs being rasterized are waited for. */
+    lock_Mutex(&d->mutex);
+    clear_PtrArray(&d->jobs);
+    d->nextJob = 0;
+    while (d->numBusy > 0) {
+        wait_Condition(&d->idle, &d->mutex);
+    }
+    d->numReady = 0; /* the glyphs are about to be reset */
+    unlock_Mutex(&d->mutex);
+}
+
+static iGlyphBitmaps *takeBitmaps_GlyphRasterPool_(iGlyphRasterPool *d, iGlyph *glyph) {
+    lock_Mutex(&d->mutex);
+    iGlyphBitmaps *bitmaps = glyph->bitmaps;
+    glyph->bitmaps = NULL;
+    if (bitmaps && d->numReady > 0) {
+        d->numReady--;
+    }
+    unlock_Mutex(&d->mutex);
+    return bitmaps;
+}
+
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+static void unlink_ShapeCache_(iShapeCache *d, iShapedRun *run) {
+    if (run->prev) run->prev->next = run->next; else d->first = run->next;
+    if (run->next) run->next->prev = run->prev; else d->last = run->prev;
+    run->prev = run->next = NULL;
+}
+
+static void pushFront_ShapeCache_(iShapeCache *d, iShapedRun *run) {
+    run->prev = NULL;
+    run->next = d->first;
+    if (d->first) d->first->prev = run; else d->last = run;
+    d->first = run;
+}
+
+static size_t size_ShapedRun_(const iShapedRun *d) {
+    return sizeof(iShapedRun) + sizeof(uint32_t) * 2 * d->inputLen +
+           (sizeof(hb_glyph_info_t) + sizeof(hb_glyph_position_t)) * d->glyphCount;
+}
+
+static void remove_ShapeCache_(iShapeCache *d, iShapedRun *run) {
+    unlink_ShapeCache_(d, run);
+    remove_Hash(&d->runs, run->node.key);
+    d->size -= size_ShapedRun_(run);
+    free(run);
+}
+
+static void clear_ShapeCache_(iShapeCache *d) {
+    lock_Mutex(&d->mutex);
+    while (d->first) {
+        remove_ShapeCache_(d, d->first);
+    }
+    unlock_Mutex(&d->mutex);
+}
+
+static void init_ShapeCache_(iShapeCache *d) {
+    init_Mutex(&d->mutex);
+    init_Hash(&d->runs);
+    d->first  = NULL;
+    d->last   = NULL;
+    d->size   = 0;
+    d->budget = defaultBudget_ShapeCache_;
+}
+
+static void deinit_ShapeCache_(iShapeCache *d) {
+    clear_ShapeCache_(d);
+    deinit_Hash(&d->runs);
+    deinit_Mutex(&d->mutex);
+}
+#else
+static void init_MeasureCache_(iMeasureCache *d) {
+    init_Mutex(&d->mutex);
+    iZap(d->entries);
+}
+
+static void deinit_MeasureCache_(iMeasureCache *d) {
+    deinit_Mutex(&d->mutex);
+}
+#endif
+
+iDeclareType(TextContext)
+
+/* Attributes of the text currently being measured or drawn. These are separate for each
+   thread so that a background layout does not interfere with drawing. */
+struct Impl_TextContext {
+    int   ansiFlags;
+    int   baseFontId; /* base attributes (for restoring via escapes) */
+    int   baseFgColorId;
+    iBool missingGlyphs; /* true if a glyph couldn't be found */
+};
+
+static _Thread_local iText *       activeText_;
+static _Thread_local iTextContext  context_Text_ = { 0, -1, -1, iFalse };
+
+static iGlyphTable *table_Font_(iFont *d) {
+    if (!d->table) {
+        lock_Mutex(&activeText_->glyphMutex);
+        if (!d->table) {
+            d->table = new_GlyphTable();
+        }
+        unlock_Mutex(&activeText_->glyphMutex);
+    }
+    return d->table;
+}
+
+static uint32_t hashCStr_(uint32_t hash, const char *str) {
+    /* FNV-1a */
+    for (const uint8_t *ch = (const uint8_t *) str; *ch; ch++) {
+        hash = (hash ^ *ch) * 16777619u;
+    }
+    return hash;
+}
+
+/* ANSI escape sequences are tokenized by hand instead of with a regular expression, and
+   the colors they select are remembered, because the same handful of sequences is seen
+   again every time a line is measured or drawn. */
+iDeclareType(AnsiEscape)
+iDeclareType(AnsiColors)
+
+struct Impl_AnsiEscape {
+    iRangecc params;  /* between the introducer and the final character */
+    char     command; /* final character */
+};
+
+struct Impl_AnsiColors {
+    char   params[24]; /* NUL-terminated; empty if the slot is unused */
+    int    fgDefault;
+    int    bgDefault;
+    iColor themeBg; /* palette changes invalidate the colors */
+    iColor themeFg;
+    iColor fg; /* A is zero if not set */
+    iColor bg;
+};
+
+enum { numAnsiColors_Text_ = 32 };
+
+static _Thread_local iAnsiColors ansiColors_Text_[numAnsiColors_Text_];
+
+/* Equivalent to matching "[[()][?]?([0-9;AB]*?)([ABCDEFGHJKSTfhilmn])" at `pos`, which is
+   just past the ESC character. Returns the length of the sequence, or zero. */
+static size_t parseAnsiEscape_(const char *pos, const char *end, iAnsiEscape *esc_out) {
+    const char *ch = pos;
+    if (ch == end || (*ch != '[' && *ch != '(' && *ch != ')')) {
+        return 0;
+    }
+    if (++ch < end && *ch == '?') {
+        ch++;
+    }
+    esc_out->params.start = ch;
+    for (; ch < end; ch++) {
+        if (*ch && strchr("ABCDEFGHJKSTfhilmn", *ch)) {
+            esc_out->params.end = ch;
+            esc_out->command    = *ch;
+            return ch + 1 - pos;
+        }
+        if ((*ch < '0' || *ch > '9') && *ch != ';') {
+            break;
+        }
+    }
+    return 0;
+}
+
+static void ansiColors_Text_(iRangecc params, int fgDefault, int bgDefault, iColor *fg_out,
+                             iColor *bg_out) {
+    const size_t len = size_Range(&params);
+    if (len == 0 || len >= sizeof(ansiColors_Text_[0].params)) {
+        ansiColors_Color(params, fgDefault, bgDefault, fg_out, bg_out);
+        return;
+    }
+    uint32_t hash = 2166136261u;
+    for (const char *ch = params.start; ch < params.end; ch++) {
+        hash = (hash ^ (uint8_t) *ch) * 16777619u;
+    }
+    hash = (hash ^ (uint32_t) fgDefault) * 16777619u;
+    iAnsiColors *slot    = &ansiColors_Text_[hash % numAnsiColors_Text_];
+    const iColor themeBg = get_Color(tmBackground_ColorId);
+    const iColor themeFg = get_Color(fgDefault);
+    if (!slot->params[0] || slot->fgDefault != fgDefault || slot->bgDefault != bgDefault ||
+        !equal_Color(slot->themeBg, themeBg) || !equal_Color(slot->themeFg, themeFg) ||
+        strlen(slot->params) != len || memcmp(slot->params, params.start, len)) {
+        memcpy(slot->params, params.start, len);
+        slot->params[len] = 0;
+        slot->fgDefault = fgDefault;
+        slot->bgDefault = bgDefault;
+        slot->themeBg   = themeBg;
+        slot->themeFg   = themeFg;
+        iZap(slot->fg);
+        iZap(slot->bg);
+        ansiColors_Color(params, fgDefault, bgDefault, &slot->fg, &slot->bg);
+    }
+    if (slot->fg.a && fg_out) {
+        *fg_out = slot->fg;
+    }
+    if (slot->bg.a && bg_out) {
+        *bg_out = slot->bg;
+    }
+}
 
 static void setupFontVariants_Text_(iText *d, const iFontSpec *spec, int baseId) {
 #if defined (iPlatformMobile)
@@ -317,6 +893,18 @@ static const iFontSpec *tryFindSpec_(enum iPrefsString ps, const char *fallback)
     return spec ? spec : findSpec_Fonts(fallback);
 }
 
+static void updateMetricsKey_Text_(iText *d) {
+    d->metricsKey = hashCStr_(2166136261u,
+                              cstrCollect_String(newFormat_String(
+                                  "%.3f;%.3f;", fontSize_UI, d->contentFontSize)));
+    for (size_t baseId = 0; baseId < size_Array(&d->fonts); baseId += maxVariants_Fonts) {
+        const iFont *font = constAt_Array(&d->fonts, baseId);
+        if (font->fontSpec) {
+            d->metricsKey = hashCStr_(d->metricsKey, cstr_String(&font->fontSpec->id));
+        }
+    }
+}
+
 static void initFonts_Text_(iText *d) {
     /* The `fonts` array has precomputed scaling factors and other parameters in all sizes
        and styles for each available font. Indices to `fonts` act as font runtime IDs. */
@@ -340,6 +928,27 @@ static void initFonts_Text_(iText *d) {
 #if !defined (NDEBUG)
     printf("[Text] %zu font variants ready\n", size_Array(&d->fonts));
 #endif
+    updateMetricsKey_Text_(d);
+    gap_Text = iRound(gap_UI * d->contentFontSize);
+}
+
+static void rescaleContentFonts_Text_(iText *d) {
+    /* Only the document fonts depend on the zoom level. Their glyphs are deleted and
+       the UI fonts keep their glyphs, bitmaps, and cache positions. Cached shaping results
+       remain valid because HarfBuzz positions are in font units. */
+    const float textSize = fontSize_UI * d->contentFontSize;
+    for (size_t i = 0; i < size_Array(&d->fonts); i++) {
+        iFont *font = at_Array(&d->fonts, i);
+        const enum iFontSize sizeId = (enum iFontSize) (i % max_FontSize);
+        if (sizeId < contentRegular_FontSize || !font->fontSpec) {
+            continue;
+        }
+        const iFontSpec *spec     = font->fontSpec;
+        const iFontFile *fontFile = font->fontFile;
+        deinit_Font(font);
+        init_Font(font, spec, fontFile, sizeId, textSize * scale_FontSize(sizeId));
+    }
+    updateMetricsKey_Text_(d);
     gap_Text = iRound(gap_UI * d->contentFontSize);
 }
 
@@ -355,8 +964,71 @@ static int maxGlyphHeight_Text_(const iText *d) {
     return 4 * d->contentFontSize * fontSize_UI;
 }
 
+static void resetRows_GlyphCachePage_(iGlyphCachePage *d, const iText *text) {
+    const int textSize = text->contentFontSize * fontSize_UI;
+    clear_Array(&d->rows);
+    /* Allocate initial (empty) rows. These will be assigned actual locations in the cache
+       once at least one glyph is stored. */
+    for (int h = text->cacheRowAllocStep;
+         h <= 5 * textSize + text->cacheRowAllocStep;
+         h += text->cacheRowAllocStep) {
+        pushBack_Array(&d->rows, &(iCacheRow){ .height = 0 });
+    }
+    d->bottom    = 0;
+    d->numGlyphs = 0;
+}
+
+static void init_GlyphCachePage_(iGlyphCachePage *d, const iText *text) {
+    init_Array(&d->rows, sizeof(iCacheRow));
+    resetRows_GlyphCachePage_(d, text);
+    d->lastUsed = text->cacheUseCounter;
+    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
+    d->texture = SDL_CreateTexture(text->render,
+                                   SDL_PIXELFORMAT_RGBA4444,
+                                   SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
+                                   text->cacheSize.x,
+                                   text->cacheSize.y);
+    SDL_SetTextureBlendMode(d->texture, text->cacheBlendMode);
+    SDL_SetTextureAlphaMod(d->texture, text->cacheAlpha);
+    SDL_SetTextureColorMod(d->texture, text->cacheColor.r, text->cacheColor.g, text->cacheColor.b);
+#if defined (LAGRANGE_GLYPH_BACKING)
+    d->backing = SDL_CreateRGBSurfaceWithFormat(0, text->cacheSize.x, text->cacheSize.y,
+                                                LAGRANGE_RASTER_DEPTH, LAGRANGE_RASTER_FORMAT);
+    SDL_SetSurfaceBlendMode(d->backing, SDL_BLENDMODE_NONE);
+#endif
+}
+
+static void deinit_GlyphCachePage_(iGlyphCachePage *d) {
+#if defined (LAGRANGE_GLYPH_BACKING)
+    SDL_FreeSurface(d->backing);
+#endif
+    SDL_DestroyTexture(d->texture);
+    deinit_Array(&d->rows);
+}
+
+iLocalDef iGlyphCachePage *cachePage_Text_(iText *d, int page) {
+    return at_Array(&d->cachePages, page);
+}
+
+#if defined (LAGRANGE_GLYPH_BACKING)
+static void updateBacking_GlyphCachePage_(iGlyphCachePage *d, const SDL_Surface *src,
+                                          const iRect *srcRect, iInt2 dstPos) {
+    /* Both surfaces have the same format, so rows are copied as is. */
+    const int bpp = src->format->BytesPerPixel;
+    iAssert(dstPos.x + srcRect->size.x <= d->backing->w);
+    iAssert(dstPos.y + srcRect->size.y <= d->backing->h);
+    for (int y = 0; y < srcRect->size.y; y++) {
+        memcpy((uint8_t *) d->backing->pixels + (dstPos.y + y) * d->backing->pitch +
+                   dstPos.x * bpp,
+               (const uint8_t *) src->pixels + (srcRect->pos.y + y) * src->pitch +
+                   srcRect->pos.x * bpp,
+               srcRect->size.x * bpp);
+    }
+}
+#endif
+
 static void initCache_Text_(iText *d) {
-    init_Array(&d->cacheRows, sizeof(iCacheRow));
+    init_Array(&d->cachePages, sizeof(iGlyphCachePage));
     const int textSize = d->contentFontSize * fontSize_UI;
     iAssert(textSize > 0);
     const iInt2 cacheDims = init_I2(16, 40);
@@ -368,37 +1040,135 @@ static void initCache_Text_(iText *d) {
         d->cacheSize.x = renderInfo.max_texture_width;
     }
     d->cacheRowAllocStep = iMax(2, textSize / 6);
-    /* Allocate initial (empty) rows. These will be assigned actual locations in the cache
-       once at least one glyph is stored. */
-    for (int h = d->cacheRowAllocStep;
-         h <= 5 * textSize + d->cacheRowAllocStep;
-         h += d->cacheRowAllocStep) {
-        pushBack_Array(&d->cacheRows, &(iCacheRow){ .height = 0 });
-    }
-    d->cacheBottom = 0;
-    SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
-    d->cache = SDL_CreateTexture(d->render,
-                                 SDL_PIXELFORMAT_RGBA4444,
-                                 SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
-                                 d->cacheSize.x,
-                                 d->cacheSize.y);
-    SDL_SetTextureBlendMode(d->cache, SDL_BLENDMODE_BLEND);
+    d->cacheTextSize     = textSize;
+    d->cacheUseCounter   = 0;
+    d->cacheEvictions    = 0;
+    /* More pages are added as needed. */
+    iGlyphCachePage page;
+    init_GlyphCachePage_(&page, d);
+    pushBack_Array(&d->cachePages, &page);
+    d->cachePage = 0;
 }
 
 static void deinitCache_Text_(iText *d) {
-    deinit_Array(&d->cacheRows);
-    SDL_DestroyTexture(d->cache);
+    iForEach(Array, i, &d->cachePages) {
+        deinit_GlyphCachePage_(i.value);
+    }
+    deinit_Array(&d->cachePages);
+}
+
+static void setCacheColor_Text_(iText *d, iColor color) {
+    d->cacheColor = color;
+    iForEach(Array, i, &d->cachePages) {
+        SDL_SetTextureColorMod(((iGlyphCachePage *) i.value)->texture, color.r, color.g, color.b);
+    }
+}
+
+static void setCacheBlendMode_Text_(iText *d, SDL_BlendMode mode) {
+    d->cacheBlendMode = mode;
+    iForEach(Array, i, &d->cachePages) {
+        SDL_SetTextureBlendMode(((iGlyphCachePage *) i.value)->texture, mode);
+    }
+}
+
+static void flushGlyphs_Text_(iText *d) {
+#if defined (LAGRANGE_GLYPH_BATCH)
+    if (isEmpty_Array(&d->batchIndices)) {
+        return;
+    }
+    /* Modulation is in the vertex colors. */
+    SDL_Texture *tex = d->batchTexture;
+    uint8_t      r, g, b, a;
+    SDL_GetTextureColorMod(tex, &r, &g, &b);
+    SDL_GetTextureAlphaMod(tex, &a);
+    SDL_SetTextureColorMod(tex, 255, 255, 255);
+    SDL_SetTextureAlphaMod(tex, 255);
+    SDL_RenderGeometry(d->render,
+                       tex,
+                       constData_Array(&d->batchVertices),
+                       size_Array(&d->batchVertices),
+                       constData_Array(&d->batchIndices),
+                       size_Array(&d->batchIndices));
+    SDL_SetTextureColorMod(tex, r, g, b);
+    SDL_SetTextureAlphaMod(tex, a);
+    clear_Array(&d->batchVertices);
+    clear_Array(&d->batchIndices);
+    d->batchTexture = NULL;
+#else
+    iUnused(d);
+#endif
 }
 
+static void drawGlyph_Text_(iText *d, iGlyphCachePage *page, const SDL_Rect *src,
+                            const SDL_Rect *dst, const iColor *color) {
+    /* If `color` is NULL, the current modulation of the page texture is used. Glyphs are
+       queued and drawn with one call per page; `flushGlyphs_Text_()` must be called before
+       anything else is drawn or the cache is modified. */
+#if defined (LAGRANGE_GLYPH_BATCH)
+    if (d->batchTexture != page->texture) {
+        flushGlyphs_Text_(d);
+        d->batchTexture = page->texture;
+    }
+    SDL_Color clr;
+    if (color) {
+        clr = (SDL_Color){ color->r, color->g, color->b, 255 };
+    }
+    else {
+        SDL_GetTextureColorMod(page->texture, &clr.r, &clr.g, &clr.b);
+    }
+    SDL_GetTextureAlphaMod(page->texture, &clr.a);
+    const float u0 = (float) src->x / d->cacheSize.x;
+    const float v0 = (float) src->y / d->cacheSize.y;
+    const float u1 = (float) (src->x + src->w) / d->cacheSize.x;
+    const float v1 = (float) (src->y + src->h) / d->cacheSize.y;
+    const float x0 = dst->x, y0 = dst->y, x1 = dst->x + dst->w, y1 = dst->y + dst->h;
+    const int   base = (int) size_Array(&d->batchVertices);
+    pushBack_Array(&d->batchVertices, &(SDL_Vertex){ { x0, y0 }, clr, { u0, v0 } });
+    pushBack_Array(&d->batchVertices, &(SDL_Vertex){ { x1, y0 }, clr, { u1, v0 } });
+    pushBack_Array(&d->batchVertices, &(SDL_Vertex){ { x1, y1 }, clr, { u1, v1 } });
+    pushBack_Array(&d->batchVertices, &(SDL_Vertex){ { x0, y1 }, clr, { u0, v1 } });
+    const int quad[6] = { base, base + 1, base + 2, base, base + 2, base + 3 };
+    pushBackN_Array(&d->batchIndices, quad, 6);
+#else
+    if (color) {
+        SDL_SetTextureColorMod(page->texture, color->r, color->g, color->b);
+    }
+    SDL_RenderCopy(d->render, page->texture, src, dst);
+#endif
+}
+
+static void loadGlyphs_Text_(iText *d);
+static void saveGlyphs_Text_(iText *d);
+static void startRecording_Text_(iText *d);
+
 void init_Text(iText *d, SDL_Renderer *render) {
     iText *oldActive = activeText_;
     activeText_ = d;
     init_Array(&d->fonts, sizeof(iFont));
     d->contentFontSize = contentScale_Text_;
-    d->ansiEscape      = new_RegExp("[[()][?]?([0-9;AB]*?)([ABCDEFGHJKSTfhilmn])", 0);
-    d->baseFontId      = -1;
-    d->baseFgColorId   = -1;
     d->render          = render;
+    init_Mutex(&d->glyphMutex);
+    init_Mutex(&d->fontsMutex);
+    init_Condition(&d->fontsReleased);
+    d->numMetricsUsers = 0;
+    d->fontGeneration  = 0;
+    d->metricsKey      = 0;
+    init_GlyphRasterPool_(&d->rasterPool);
+    d->glyphRecording    = NULL;
+    d->numRecordedGlyphs = 0;
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+    init_ShapeCache_(&d->shapeCache);
+#else
+    init_MeasureCache_(&d->measureCache);
+#endif
+#if defined (LAGRANGE_GLYPH_BATCH)
+    d->batchTexture = NULL;
+    init_Array(&d->batchVertices, sizeof(SDL_Vertex));
+    init_Array(&d->batchIndices, sizeof(int));
+#endif
+    d->cacheColor      = (iColor){ 255, 255, 255, 255 };
+    d->cacheAlpha      = 255;
+    d->cacheBlendMode  = SDL_BLENDMODE_BLEND;
     /* A grayscale palette for rasterized glyphs. */ {
         SDL_Color colors[256];
         for (int i = 0; i < 256; ++i) {
@@ -417,35 +1187,78 @@ void init_Text(iText *d, SDL_Renderer *render) {
     }
     initCache_Text_(d);
     initFonts_Text_(d);
+    loadGlyphs_Text_(d);
+    startRecording_Text_(d);
     activeText_ = oldActive;
 }
 
 void deinit_Text(iText *d) {
+    saveGlyphs_Text_(d);
+    iRelease(d->glyphRecording);
+    deinit_GlyphRasterPool_(&d->rasterPool);
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+    deinit_ShapeCache_(&d->shapeCache);
+#else
+    deinit_MeasureCache_(&d->measureCache);
+#endif
+#if defined (LAGRANGE_GLYPH_BATCH)
+    deinit_Array(&d->batchIndices);
+    deinit_Array(&d->batchVertices);
+#endif
     SDL_FreePalette(d->blackAndWhite);
     SDL_FreePalette(d->grayscale);
     deinitFonts_Text_(d);
     deinitCache_Text_(d);
     d->render = NULL;
-    iRelease(d->ansiEscape);
     deinit_Array(&d->fonts);
+    deinit_Condition(&d->fontsReleased);
+    deinit_Mutex(&d->fontsMutex);
+    deinit_Mutex(&d->glyphMutex);
 }
 
 void setCurrent_Text(iText *d) {
     activeText_ = d;
 }
 
+void beginMetrics_Text(iText *d) {
+    /* Only glyph metrics are available; drawing is not possible in a background thread.
+       Any number of threads may be measuring text at the same time. */
+    lock_Mutex(&d->fontsMutex);
+    d->numMetricsUsers++;
+    unlock_Mutex(&d->fontsMutex);
+    activeText_   = d;
+    context_Text_ = (iTextContext){ 0, -1, -1, iFalse };
+}
+
+void endMetrics_Text(void) {
+    iText *d = activeText_;
+    activeText_ = NULL;
+    lock_Mutex(&d->fontsMutex);
+    if (--d->numMetricsUsers == 0) {
+        signal_Condition(&d->fontsReleased);
+    }
+    unlock_Mutex(&d->fontsMutex);
+}
+
+iText *current_Text(void) {
+    return activeText_;
+}
+
 void setOpacity_Text(float opacity) {
-    SDL_SetTextureAlphaMod(activeText_->cache, iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f);
+    iText *d = activeText_;
+    d->cacheAlpha = iClamp(opacity, 0.0f, 1.0f) * 255 + 0.5f;
+    iForEach(Array, i, &d->cachePages) {
+        SDL_SetTextureAlphaMod(((iGlyphCachePage *) i.value)->texture, d->cacheAlpha);
+    }
 }
 
 void setBaseAttributes_Text(int fontId, int fgColorId) {
-    iText *d = activeText_;
-    d->baseFontId    = fontId;
-    d->baseFgColorId = fgColorId;
+    context_Text_.baseFontId    = fontId;
+    context_Text_.baseFgColorId = fgColorId;
 }
 
 void setAnsiFlags_Text(int ansiFlags) {
-    activeText_->ansiFlags = ansiFlags;
+    context_Text_.ansiFlags = ansiFlags;
 }
 
 void setDocumentFontSize_Text(iText *d, float fontSizeFactor) {
@@ -453,33 +1266,140 @@ void setDocumentFontSize_Text(iText *d, float fontSizeFactor) {
     iAssert(fontSizeFactor > 0);
     if (iAbs(d->contentFontSize - fontSizeFactor) > 0.001f) {
         d->contentFontSize = fontSizeFactor;
-        resetFonts_Text(d);
+        if (fontSize_UI * fontSizeFactor > maxZoomRatio_Text_ * d->cacheTextSize ||
+            fontSize_UI * fontSizeFactor * maxZoomRatio_Text_ < d->cacheTextSize) {
+            /* The cache pages are badly sized for the new text size. */
+            resetFonts_Text(d);
+            return;
+        }
+        lock_Mutex(&d->fontsMutex);
+        while (d->numMetricsUsers > 0) {
+            wait_Condition(&d->fontsReleased, &d->fontsMutex);
+        }
+        cancel_GlyphRasterPool_(&d->rasterPool);
+        lock_Mutex(&d->glyphMutex);
+        rescaleContentFonts_Text_(d);
+        unlock_Mutex(&d->glyphMutex);
+        startRecording_Text_(d); /* different key */
+        d->fontGeneration++;
+        unlock_Mutex(&d->fontsMutex);
+    }
+}
+
+static void nextCachePage_Text_(iText *d) {
+    /* The current page is full. */
+    if (size_Array(&d->cachePages) < (size_t) maxCachePages_Text_) {
+        iGlyphCachePage page;
+        init_GlyphCachePage_(&page, d);
+        pushBack_Array(&d->cachePages, &page);
+        d->cachePage = size_Array(&d->cachePages) - 1;
+        return;
+    }
+    /* Clear the least recently used page. Glyphs are not deleted because a background
+       layout may be using their metrics. */
+    int evicted = d->cachePage;
+    for (int i = 0; i < (int) size_Array(&d->cachePages); i++) {
+        if (i != d->cachePage &&
+            (evicted == d->cachePage ||
+             cachePage_Text_(d, i)->lastUsed < cachePage_Text_(d, evicted)->lastUsed)) {
+            evicted = i;
+        }
     }
-}
-
-static void resetCache_Text_(iText *d) {
-    deinitCache_Text_(d);
+    lock_Mutex(&d->glyphMutex);
     iForEach(Array, i, &d->fonts) {
-        clearGlyphs_GlyphTable_(((iFont *) i.value)->table);
+        uncachePage_GlyphTable_(((iFont *) i.value)->table, evicted);
     }
-    initCache_Text_(d);
+    unlock_Mutex(&d->glyphMutex);
+    resetRows_GlyphCachePage_(cachePage_Text_(d, evicted), d);
+    d->cachePage = evicted;
+    d->cacheEvictions++;
+#if !defined (NDEBUG)
+    printf("[Text] glyph cache is full, evicted page %d (%d evictions so far)\n",
+           evicted, d->cacheEvictions);
+    fflush(stdout);
+#endif
+}
+
+void clearShapeCache_Text(iText *d) {
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+    clear_ShapeCache_(&d->shapeCache);
+#else
+    lock_Mutex(&d->measureCache.mutex);
+    iZap(d->measureCache.entries);
+    unlock_Mutex(&d->measureCache.mutex);
+#endif
 }
 
 void resetFonts_Text(iText *d) {
+    /* Background layouts must be finished before the fonts are reset. */
+    lock_Mutex(&d->fontsMutex);
+    while (d->numMetricsUsers > 0) {
+        wait_Condition(&d->fontsReleased, &d->fontsMutex);
+    }
+    cancel_GlyphRasterPool_(&d->rasterPool);
+#if defined (LAGRANGE_ENABLE_HARFBUZZ)
+    clear_ShapeCache_(&d->shapeCache); /* keyed by font */
+#endif
     deinitFonts_Text_(d);
     deinitCache_Text_(d);
     initCache_Text_(d);
     initFonts_Text_(d);
+    startRecording_Text_(d); /* different key */
+    d->fontGeneration++;
+    unlock_Mutex(&d->fontsMutex);
+}
+
+uint32_t fontGeneration_Text(const iText *d) {
+    return d->fontGeneration;
+}
+
+uint32_t metricsKey_Text(const iText *d) {
+    return d->metricsKey;
 }
 
 static SDL_Palette *glyphPalette_(void) {
     return prefs_App()->fontSmoothing ? activeText_->grayscale : activeText_->blackAndWhite;
 }
 
-static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, float xShift) {
-    int w, h;
-    uint8_t *bmp = rasterizeGlyph_FontFile(d->fontFile, d->xScale, d->yScale, xShift, glyphIndex,
-                                           &w, &h);
+void restoreGlyphCache_Text(iText *d) {
+#if defined (LAGRANGE_GLYPH_BACKING)
+    /* The glyphs and their metrics remain valid, only the texture contents were lost. */
+    iText *oldActive = activeText_;
+    activeText_ = d;
+    flushGlyphs_Text_(d);
+    iRenderTarget oldTarget;
+    iBool         isTargetChanged = iFalse;
+    iForEach(Array, i, &d->cachePages) {
+        iGlyphCachePage *page = i.value;
+#if LAGRANGE_RASTER_DEPTH == 8
+        SDL_SetSurfacePalette(page->backing, glyphPalette_());
+#endif
+        SDL_Texture *tex = SDL_CreateTextureFromSurface(d->render, page->backing);
+        if (!tex) {
+            continue;
+        }
+        SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_NONE);
+        if (!isTargetChanged) {
+            isTargetChanged = iTrue;
+            set_RenderTarget(&oldTarget, d->render, page->texture);
+        }
+        else {
+            SDL_SetRenderTarget(d->render, page->texture);
+        }
+        SDL_RenderCopy(d->render, tex, NULL, NULL);
+        SDL_DestroyTexture(tex);
+    }
+    if (isTargetChanged) {
+        restore_RenderTarget(&oldTarget, d->render);
+    }
+    activeText_ = oldActive;
+#else
+    resetFonts_Text(d); /* glyphs must be rasterized again */
+#endif
+}
+
+static SDL_Surface *glyphSurface_(uint8_t *bmp, int w, int h) {
+    /* The surface takes ownership of `bmp`. */
     SDL_Surface *surface8 =
         SDL_CreateRGBSurfaceWithFormatFrom(bmp, w, h, 8, w, SDL_PIXELFORMAT_INDEX8);
     SDL_SetSurfaceBlendMode(surface8, SDL_BLENDMODE_NONE);
@@ -496,30 +1416,58 @@ static SDL_Surface *rasterizeGlyph_Font_(const iFont *d, uint32_t glyphIndex, fl
 #endif
 }
 
-iLocalDef iCacheRow *cacheRow_Text_(iText *d, int height) {
-    return at_Array(&d->cacheRows, (height - 1) / d->cacheRowAllocStep);
+static void recordGlyph_Text_(iText *d, const iGlyph *glyph, int hoff, const uint8_t *pixels,
+                              iInt2 size);
+
+static SDL_Surface *bitmapSurface_Glyph_(iGlyph *d, iGlyphBitmaps *bitmaps, int hoff) {
+    /* Bitmaps rasterized in advance are used if available. */
+    uint8_t *pixels;
+    iInt2    size;
+    if (bitmaps && bitmaps->mask & (1 << hoff)) {
+        pixels = bitmaps->pixels[hoff];
+        size   = bitmaps->size[hoff];
+        bitmaps->pixels[hoff] = NULL;
+    }
+    else {
+        const iFont *font = d->font;
+        pixels = rasterizeGlyph_FontFile(font->fontFile, font->xScale, font->yScale, hoff * 0.5f,
+                                         index_Glyph_(d), &size.x, &size.y);
+    }
+    recordGlyph_Text_(activeText_, d, hoff, pixels, size);
+    return glyphSurface_(pixels, size.x, size.y);
+}
+
+static iBool isFull_GlyphCachePage_(const iGlyphCachePage *d, const iText *text) {
+    return d->bottom > text->cacheSize.y - maxGlyphHeight_Text_(text);
 }
 
 static iInt2 assignCachePos_Text_(iText *d, iInt2 size) {
-    iCacheRow *cur = cacheRow_Text_(d, size.y);
+    /* Places a glyph on the current page, advancing in rows. */
+    iGlyphCachePage *page   = cachePage_Text_(d, d->cachePage);
+    const size_t     rowIdx = (size.y - 1) / d->cacheRowAllocStep;
+    while (size_Array(&page->rows) <= rowIdx) {
+        /* Zoomed in after the page was created. */
+        pushBack_Array(&page->rows, &(iCacheRow){ .height = 0 });
+    }
+    iCacheRow *cur = at_Array(&page->rows, rowIdx);
     if (cur->height == 0) {
         /* Begin a new row height. */
         cur->height = (1 + (size.y - 1) / d->cacheRowAllocStep) * d->cacheRowAllocStep;
-        cur->pos.y = d->cacheBottom;
-        d->cacheBottom = cur->pos.y + cur->height;
+        cur->pos.y = page->bottom;
+        page->bottom = cur->pos.y + cur->height;
     }
     iAssert(cur->height >= size.y);
-    /* TODO: Automatically enlarge the cache if running out of space?
-       Maybe make it paged, but beware of texture swapping too often inside a text string. */
     if (cur->pos.x + size.x > d->cacheSize.x) {
         /* Does not fit on this row, advance to a new location in the cache. */
-        cur->pos.y = d->cacheBottom;
+        cur->pos.y = page->bottom;
         cur->pos.x = 0;
-        d->cacheBottom += cur->height;
-        iAssert(d->cacheBottom <= d->cacheSize.y);
+        page->bottom += cur->height;
+        iAssert(page->bottom <= d->cacheSize.y);
     }
     const iInt2 assigned = cur->pos;
     cur->pos.x += size.x;
+    page->numGlyphs++;
+    page->lastUsed = ++d->cacheUseCounter;
     return assigned;
 }
 
@@ -529,8 +1477,7 @@ static void allocate_Font_(iFont *d, iGlyph *glyph, int hoff) {
     measureGlyph_FontFile(d->fontFile, index_Glyph_(glyph), d->xScale, d->yScale, hoff * 0.5f,
                           &x0, &y0, &x1, &y1);
     glRect->size = init_I2(x1 - x0, y1 - y0);
-    /* Determine placement in the glyph cache texture, advancing in rows. */
-    glRect->pos    = assignCachePos_Text_(activeText_, glRect->size);
+    glRect->pos    = zero_I2(); /* assigned when rasterized */
     glyph->d[hoff] = init_I2(x0, y0);
     glyph->d[hoff].y += d->vertOffset;
     if (hoff == 0) { /* hoff==1 uses same metrics as `glyph` */
@@ -540,7 +1487,9 @@ static void allocate_Font_(iFont *d, iGlyph *glyph, int hoff) {
     }
 }
 
-iLocalDef iFont *characterFont_Font_(iFont *d, iChar ch, uint32_t *glyphIndex) {
+static iFont *findFallback_Font_(iFont *d, iFont *overrideFont, iChar ch, uint32_t *glyphIndex);
+
+static iFont *characterFont_Font_(iFont *d, iChar ch, uint32_t *glyphIndex) {
     if (isVariationSelector_Char(ch)) {
         return d;
     }
@@ -558,6 +1507,32 @@ iLocalDef iFont *characterFont_Font_(iFont *d, iChar ch, uint32_t *glyphIndex) {
     if ((*glyphIndex = glyphIndex_Font_(d, ch)) != 0) {
         return d;
     }
+    if (ch == 0) {
+        return findFallback_Font_(d, overrideFont, ch, glyphIndex);
+    }
+    /* Characters missing from the font are resolved only once. */
+    iGlyphTable *table = table_Font_(d);
+    lock_Mutex(&activeText_->glyphMutex);
+    const iFallbackEntry *cached = fallback_GlyphTable_(table, ch);
+    const iFallbackEntry  entry  = cached ? *cached : (iFallbackEntry){ 0 };
+    unlock_Mutex(&activeText_->glyphMutex);
+    if (entry.ch) {
+        *glyphIndex = entry.glyphIndex;
+        if (!*glyphIndex) {
+            context_Text_.missingGlyphs = iTrue;
+        }
+        return font_Text_(entry.fontId);
+    }
+    iFont *fallback = findFallback_Font_(d, overrideFont, ch, glyphIndex);
+    lock_Mutex(&activeText_->glyphMutex);
+    insertFallback_GlyphTable_(table, ch, fontId_Text_(fallback), *glyphIndex);
+    unlock_Mutex(&activeText_->glyphMutex);
+    return fallback;
+}
+
+static iFont *findFallback_Font_(iFont *d, iFont *overrideFont, iChar ch, uint32_t *glyphIndex) {
+    const enum iFontStyle styleId = styleId_Text_(d);
+    const enum iFontSize  sizeId  = sizeId_Text_(d);
     /* As a fallback, check all other available fonts of this size. */
     for (int aux = 0; aux < 2; aux++) {
         for (iFont *font = font_Text_(FONT_ID(0, styleId, sizeId));
@@ -580,45 +1555,207 @@ iLocalDef iFont *characterFont_Font_(iFont *d, iChar ch, uint32_t *glyphIndex) {
         }
     }
     if (!*glyphIndex) {
-        activeText_->missingGlyphs = iTrue;
+        context_Text_.missingGlyphs = iTrue;
         fprintf(stderr, "failed to find %08x (%lc)\n", ch, (int)ch); fflush(stderr);
     }
     return d;
 }
 
-static iGlyph *glyphByIndex_Font_(iFont *d, uint32_t glyphIndex) {
-    if (!d->table) {
-        d->table = new_GlyphTable();
-    }   
-    iGlyph* glyph = NULL;
-    void *  node = value_Hash(&d->table->glyphs, glyphIndex);
-    if (node) {
-        glyph = node;
+static iGlyph *findGlyph_Font_(iFont *d, uint32_t glyphIndex, iBool isRasterQueued) {
+    iGlyphTable *table = table_Font_(d);
+    iGlyph *glyph = findGlyph_GlyphTable_(table, glyphIndex);
+    if (glyph) {
+        return glyph;
     }
-    else {
-        /* If the cache is running out of space, clear it and we'll recache what's needed currently. */
-        if (activeText_->cacheBottom > activeText_->cacheSize.y - maxGlyphHeight_Text_(activeText_)) {
-#if !defined (NDEBUG)
-            printf("[Text] glyph cache is full, clearing!\n"); fflush(stdout);
-#endif
-            resetCache_Text_(activeText_);
-        }
-        glyph       = new_Glyph(glyphIndex);
-        glyph->font = d;
-        /* New glyphs are always allocated at least. This reserves a position in the cache
-           and updates the glyph metrics. */
+    lock_Mutex(&activeText_->glyphMutex);
+    glyph = glyph_GlyphTable_(table, glyphIndex);
+    if (!glyph->font) {
+        init_Glyph(glyph, glyphIndex);
+        /* New glyphs are always allocated at least. This updates the glyph metrics. */
         allocate_Font_(d, glyph, 0);
         allocate_Font_(d, glyph, 1);
-        insert_Hash(&d->table->glyphs, &glyph->node);
+        /* Lock-free lookups see the glyph once the font is set. */
+        atomic_store_explicit(&glyph->font, d, memory_order_release);
+        if (isRasterQueued) {
+            enqueue_GlyphRasterPool_(&activeText_->rasterPool, glyph);
+        }
     }
+    unlock_Mutex(&activeText_->glyphMutex);
     return glyph;
 }
 
+static iGlyph *glyphByIndex_Font_(iFont *d, uint32_t glyphIndex) {
+    return findGlyph_Font_(d, glyphIndex, iTrue);
+}
+
 static iGlyph *glyph_Font_(iFont *d, iChar ch) {
+    /* Glyph slots are never moved, so ASCII glyphs can be remembered. The override font
+       takes precedence when set, though. */
+    const size_t entry = ch - 32;
+    iGlyphTable *table = NULL;
+    if (entry < 128 - 32 && activeText_->overrideFontId < 0) {
+        table = table_Font_(d);
+        if (table->asciiGlyphs[entry]) {
+            return table->asciiGlyphs[entry];
+        }
+    }
     /* The glyph may actually come from a different font; look up the right font. */
     uint32_t glyphIndex = 0;
     iFont *font = characterFont_Font_(d, ch, &glyphIndex);
-    return glyphByIndex_Font_(font, glyphIndex);
+    iGlyph *glyph = glyphByIndex_Font_(font, glyphIndex);
+    if (table && font == d && glyphIndex) {
+        table->asciiGlyphs[entry] = glyph; /* concurrent lookups find the same glyph */
+    }
+    return glyph;
+}
+
+/*----------------------------------------------------------------------------------------------*/
+
+/* Glyph bitmaps uploaded to the cache are recorded and saved when the Text is deinitialized.
+   When the same fonts and sizes are used again, the bitmaps are loaded in bulk at startup, so
+   the first frames only need to upload them. */
+
+static const char  *fileName_GlyphDiskCache_ = "glyphs.binary";
+static const char  *magic_GlyphDiskCache_    = "lgG1";
+static const size_t maxSize_GlyphDiskCache_  = 4 * 1024 * 1024;
+
+static uint32_t hashData_(uint32_t hash, const void *data, size_t size) {
+    /* FNV-1a */
+    for (const uint8_t *ch = data, *end = ch + size; ch != end; ch++) {
+        hash = (hash ^ *ch) * 16777619u;
+    }
+    return hash;
+}
+
+static const size_t diskCacheSampleSize_Text_ = 4096;
+
+static uint32_t diskCacheKey_Text_(const iText *d) {
+    /* Font files are identified by their ID, size, and contents. The beginning of a font file
+       has the table directory, which includes a checksum of each table, so hashing it and the
+       end of the file is enough to notice when a file with the same name has been updated. */
+    uint32_t key = d->metricsKey;
+    const iFontFile *prev = NULL;
+    iConstForEach(Array, i, &d->fonts) {
+        const iFontFile *file = ((const iFont *) i.value)->fontFile;
+        if (file != prev) {
+            const uint8_t *data   = data_FontFile(file);
+            const size_t   size   = size_FontFile(file);
+            const size_t   sample = iMin(size, diskCacheSampleSize_Text_);
+            key = hashCStr_(key, cstr_String(&file->id));
+            key = hashCStr_(key, format_CStr("%zu", size));
+            key = hashData_(key, data, sample);
+            key = hashData_(key, data + size - sample, sample);
+            prev = file;
+        }
+    }
+    return key;
+}
+
+static const char *diskCachePath_Text_(void) {
+    return concatPath_CStr(cstr_String(dataDir_App()), fileName_GlyphDiskCache_);
+}
+
+static void startRecording_Text_(iText *d) {
+    if (!d->glyphRecording) {
+        d->glyphRecording = new_Buffer();
+    }
+    openEmpty_Buffer(d->glyphRecording);
+    d->numRecordedGlyphs = 0;
+}
+
+static void recordGlyph_Text_(iText *d, const iGlyph *glyph, int hoff, const uint8_t *pixels,
+                              iInt2 size) {
+    if (!d->glyphRecording ||
+        size_Block(data_Buffer(d->glyphRecording)) + size.x * size.y > maxSize_GlyphDiskCache_) {
+        return;
+    }
+    iStream *outs = stream_Buffer(d->glyphRecording);
+    writeU16_Stream(outs, glyph->font - (const iFont *) constData_Array(&d->fonts));
+    writeU32_Stream(outs, index_Glyph_(glyph));
+    write8_Stream(outs, hoff);
+    writeU16_Stream(outs, size.x);
+    writeU16_Stream(outs, size.y);
+    if (pixels) {
+        writeData_Stream(outs, pixels, size.x * size.y);
+    }
+    d->numRecordedGlyphs++;
+}
+
+static void saveGlyphs_Text_(iText *d) {
+    if (!d->glyphRecording || d->numRecordedGlyphs == 0) {
+        return;
+    }
+    iFile *f = newCStr_File(diskCachePath_Text_());
+    if (open_File(f, writeOnly_FileMode)) {
+        writeData_File(f, magic_GlyphDiskCache_, 4);
+        writeU32_File(f, diskCacheKey_Text_(d));
+        writeU32_File(f, d->numRecordedGlyphs);
+        write_File(f, data_Buffer(d->glyphRecording));
+    }
+    iRelease(f);
+}
+
+static void loadGlyphs_Text_(iText *d) {
+    iFile *f = newCStr_File(diskCachePath_Text_());
+    if (!open_File(f, readOnly_FileMode)) {
+        iRelease(f);
+        return;
+    }
+    iBlock  *data = readAll_File(f); /* all at once */
+    iBuffer *buf  = new_Buffer();
+    iStream *ins  = stream_Buffer(buf);
+    char     magic[4];
+    iRelease(f);
+    open_Buffer(buf, data);
+    if (readData_Stream(ins, 4, magic) == 4 && !memcmp(magic, magic_GlyphDiskCache_, 4) &&
+        readU32_Stream(ins) == diskCacheKey_Text_(d)) {
+        const uint32_t count = readU32_Stream(ins);
+        for (uint32_t i = 0; i < count && !atEnd_Buffer(buf); i++) {
+            const size_t   fontIndex  = readU16_Stream(ins);
+            const uint32_t glyphIndex = readU32_Stream(ins);
+            const int      hoff       = read8_Stream(ins);
+            iInt2          size;
+            size.x = readU16_Stream(ins);
+            size.y = readU16_Stream(ins);
+            const size_t numBytes  = (size_t) size.x * (size_t) size.y;
+            const size_t remaining = size_Block(data) - pos_Stream(ins);
+            if (fontIndex >= size_Array(&d->fonts) || hoff < 0 || hoff > 1 ||
+                pos_Stream(ins) > size_Block(data) || numBytes > remaining) {
+                break; /* corrupt or truncated */
+            }
+            uint8_t *pixels = NULL;
+            if (numBytes > 0) {
+                pixels = malloc(numBytes);
+                if (readData_Stream(ins, numBytes, pixels) != numBytes) {
+                    free(pixels);
+                    break;
+                }
+            }
+            /* The bitmaps are attached here, so the glyph is not queued for rasterizing. A glyph
+               appears once for each half-pixel offset. */
+            iGlyph *glyph = findGlyph_Font_(at_Array(&d->fonts, fontIndex), glyphIndex, iFalse);
+            if (isRasterized_Glyph_(glyph, hoff)) {
+                free(pixels); /* already in the glyph cache */
+                continue;
+            }
+            iGlyphRasterPool *pool = &d->rasterPool;
+            lock_Mutex(&pool->mutex);
+            if (!glyph->bitmaps) {
+                glyph->bitmaps = calloc(1, sizeof(iGlyphBitmaps));
+                pool->numReady++;
+            }
+            if (~glyph->bitmaps->mask & (1 << hoff)) {
+                glyph->bitmaps->mask |= 1 << hoff;
+                glyph->bitmaps->pixels[hoff] = pixels;
+                glyph->bitmaps->size[hoff]   = size;
+                pixels = NULL;
+            }
+            unlock_Mutex(&pool->mutex);
+            free(pixels); /* duplicate */
+        }
+    }
+    iRelease(buf);
+    delete_Block(data);
 }
 
 static iChar nextChar_(const char **chPos, const char *end) {
@@ -767,13 +1904,49 @@ int fontWithFamily_Text(int font, enum iFontId familyId) {
     return FONT_ID(familyId, styleId, sizeId);
 }
 
+static iBool isAscii_(iRangecc text) {
+    /* Checks eight bytes at a time for set high bits. */
+    const char *pos = text.start;
+    for (; pos + 8 <= text.end; pos += 8) {
+        uint64_t word;
+        memcpy(&word, pos, 8);
+        if (word & 0x8080808080808080ull) {
+            return iFalse;
+        }
+    }
+    for (; pos < text.end; pos++) {
+        if (*pos & 0x80) {
+            return iFalse;
+        }
+    }
+    return iTrue;
+}
+
+static void setIdentityMapping_AttributedText_(iAttributedText *d, size_t length) {
+    /* 1:1 mapping. */
+    setCopy_Array(&d->visual, &d->logical);
+    resize_Array(&d->logicalToVisual, length);
+    for (size_t i = 0; i < length; i++) {
+        set_Array(&d->logicalToVisual, i, &(int){ i });
+    }
+    setCopy_Array(&d->visualToLogical, &d->logicalToVisual);
+}
+
 static void prepare_AttributedText_(iAttributedText *d, int overrideBaseDir, iChar overrideChar) {
     iAssert(isEmpty_Array(&d->runs));
     size_t length = 0;
+    /* ASCII text in a left-to-right paragraph needs no reordering. */
+    const iBool isAscii = overrideBaseDir >= 0 && overrideChar < 0x80 && isAscii_(d->source);
     /* Prepare the UTF-32 logical string. */ {
         for (const char *ch = d->source.start; ch < d->source.end; ) {
             iChar u32;
-            int len = decodeBytes_MultibyteChar(ch, d->source.end, &u32);
+            int len = 1;
+            if (isAscii) {
+                u32 = (uint8_t) *ch;
+            }
+            else {
+                len = decodeBytes_MultibyteChar(ch, d->source.end, &u32);
+            }
             if (len <= 0) break;
             if (overrideChar) {
                 u32 = overrideChar;
@@ -790,29 +1963,29 @@ static void prepare_AttributedText_(iAttributedText *d, int overrideBaseDir, iCh
             ch += len;
         }
 #if defined (LAGRANGE_ENABLE_FRIBIDI)
-        /* Use FriBidi to reorder the codepoints. */
-        resize_Array(&d->visual, length);
-        resize_Array(&d->logicalToVisual, length);
-        resize_Array(&d->visualToLogical, length);
-        d->bidiLevels = length ? malloc(length) : NULL;
-        FriBidiParType baseDir = (FriBidiParType) FRIBIDI_TYPE_ON;
-        /* TODO: If this returns zero (error occurred), act like everything is LTR. */
-        fribidi_log2vis(constData_Array(&d->logical),
-                        length,
-                        &baseDir,
-                        data_Array(&d->visual),
-                        data_Array(&d->logicalToVisual),
-                        data_Array(&d->visualToLogical),
-                        (FriBidiLevel *) d->bidiLevels);
-        d->isBaseRTL = (overrideBaseDir == 0 ? FRIBIDI_IS_RTL(baseDir) : (overrideBaseDir < 0));
-#else
-        /* 1:1 mapping. */
-        setCopy_Array(&d->visual, &d->logical);
-        resize_Array(&d->logicalToVisual, length);
-        for (size_t i = 0; i < length; i++) {
-            set_Array(&d->logicalToVisual, i, &(int){ i });
+        if (isAscii) {
+            setIdentityMapping_AttributedText_(d, length);
+            d->isBaseRTL = iFalse;
+        }
+        else {
+            /* Use FriBidi to reorder the codepoints. */
+            resize_Array(&d->visual, length);
+            resize_Array(&d->logicalToVisual, length);
+            resize_Array(&d->visualToLogical, length);
+            d->bidiLevels = length ? malloc(length) : NULL;
+            FriBidiParType baseDir = (FriBidiParType) FRIBIDI_TYPE_ON;
+            /* TODO: If this returns zero (error occurred), act like everything is LTR. */
+            fribidi_log2vis(constData_Array(&d->logical),
+                            length,
+                            &baseDir,
+                            data_Array(&d->visual),
+                            data_Array(&d->logicalToVisual),
+                            data_Array(&d->visualToLogical),
+                            (FriBidiLevel *) d->bidiLevels);
+            d->isBaseRTL = (overrideBaseDir == 0 ? FRIBIDI_IS_RTL(baseDir) : (overrideBaseDir < 0));
         }
-        setCopy_Array(&d->visualToLogical, &d->logicalToVisual);
+#else
+        setIdentityMapping_AttributedText_(d, length);
         d->isBaseRTL = iFalse;
 #endif
     }
@@ -856,15 +2029,13 @@ static void prepare_AttributedText_(iAttributedText *d, int overrideBaseDir, iCh
         if (ch == 0x1b) { /* ANSI escape. */
             pos++;
             const char *srcPos = d->source.start + logToSource[pos];
-            /* Do a regexp match in the source text. */
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (match_RegExp(activeText_->ansiEscape, srcPos, d->source.end - srcPos, &m)) {
+            iAnsiEscape esc;
+            const size_t escLen = parseAnsiEscape_(srcPos, d->source.end, &esc);
+            if (escLen) {
                 finishRun_AttributedText_(d, &run, pos - 1);
-                const int ansi = activeText_->ansiFlags;
-                if (ansi && capturedRange_RegExpMatch(&m, 2).start[0] ==
-                                'm' /* Select Graphic Rendition */) {
-                    const iRangecc sequence = capturedRange_RegExpMatch(&m, 1);
+                const int ansi = context_Text_.ansiFlags;
+                if (ansi && esc.command == 'm' /* Select Graphic Rendition */) {
+                    const iRangecc sequence = esc.params;
                     /* Note: This styling is hardcoded to match `typesetOneLine_RunTypesetter_()`. */
                     if (ansi & allowFontStyle_AnsiFlag && equal_Rangecc(sequence, "1")) {
                         run.attrib.bold = iTrue;
@@ -894,13 +2065,12 @@ static void prepare_AttributedText_(iAttributedText *d, int overrideBaseDir, iCh
                         setBgColor_AttributedRun_(&run, none_ColorId);
                     }
                     else {
-                        ansiColors_Color(sequence, d->baseFgColorId, none_ColorId,
+                        ansiColors_Text_(sequence, d->baseFgColorId, none_ColorId,
                                          ansi & allowFg_AnsiFlag ? &run.fgColor_ : NULL,
                                          ansi & allowBg_AnsiFlag ? &run.bgColor_ : NULL);
                     }
                 }
-                pos += length_Rangecc(capturedRange_RegExpMatch(&m, 0));
-//                iAssert(logToSource[pos] == end_RegExpMatch(&m) - d->source.start);
+                pos += escLen;
                 /* The run continues after the escape sequence. */
                 run.logical.start = pos--; /* loop increments `pos` */
                 continue;
@@ -958,7 +2128,7 @@ static void prepare_AttributedText_(iAttributedText *d, int overrideBaseDir, iCh
 #endif
         }
 #if defined (LAGRANGE_ENABLE_FRIBIDI)
-        if (fribidi_get_bidi_type(ch) == FRIBIDI_TYPE_AL) {
+        if (!isAscii && fribidi_get_bidi_type(ch) == FRIBIDI_TYPE_AL) {
             run.flags.isArabic = iTrue; /* Arabic letter */
         }
 #endif
@@ -1022,30 +2192,30 @@ struct Impl_RasterGlyph {
 };
 
 static void cacheGlyphs_Font_(iFont *d, const iArray *glyphIndices) {
+    flushGlyphs_Text_(activeText_); /* queued glyphs may be on a page that gets evicted */
     /* TODO: Make this an object so it can be used sequentially without reallocating buffers. */
     SDL_Surface *buf     = NULL;
     const iInt2  bufSize = init_I2(iMin(512, d->height * iMin(2 * size_Array(glyphIndices), 20)),
                                    d->height * 4 / 3);
     int          bufX    = 0;
     iArray *     rasters = NULL;
-    SDL_Texture *oldTarget = NULL;
+    iRenderTarget oldTarget;
     iBool        isTargetChanged = iFalse;
     iAssert(isExposed_Window(get_Window()));
+    start_ProfilerScope(glyphCache);
     /* We'll flush the buffered rasters periodically until everything is cached. */
     size_t index = 0;
     while (index < size_Array(glyphIndices)) {
+        iBool isPageFull = iFalse;
         for (; index < size_Array(glyphIndices); index++) {
             const uint32_t glyphIndex = constValue_Array(glyphIndices, index, uint32_t);
-            const int lastCacheBottom = activeText_->cacheBottom;
             iGlyph *glyph = glyphByIndex_Font_(d, glyphIndex);
-            if (activeText_->cacheBottom < lastCacheBottom) {
-                /* The cache was reset due to running out of space. We need to restart from
-                   the beginning! */
-                bufX = 0;
-                if (rasters) {
-                    clear_Array(rasters);
-                }
-                index = 0;
+            if (!isFullyRasterized_Glyph_(glyph) &&
+                isFull_GlyphCachePage_(cachePage_Text_(activeText_, activeText_->cachePage),
+                                       activeText_)) {
+                /* The buffered rasters are copied to the current page before moving on to
+                   another one. `index` does not get incremented. */
+                isPageFull = iTrue;
                 break;
             }
             if (!isFullyRasterized_Glyph_(glyph)) {
@@ -1059,12 +2229,13 @@ static void cacheGlyphs_Font_(iFont *d, const iArray *glyphIndices) {
                     SDL_SetSurfaceBlendMode(buf, SDL_BLENDMODE_NONE);
                     SDL_SetSurfacePalette(buf, glyphPalette_());
                 }
+                iGlyphBitmaps *bitmaps =
+                    takeBitmaps_GlyphRasterPool_(&activeText_->rasterPool, glyph);
                 SDL_Surface *surfaces[2] = {
-                    !isRasterized_Glyph_(glyph, 0) ?
-                            rasterizeGlyph_Font_(glyph->font, index_Glyph_(glyph), 0) : NULL,
-                    !isRasterized_Glyph_(glyph, 1) ?
-                            rasterizeGlyph_Font_(glyph->font, index_Glyph_(glyph), 0.5f) : NULL
+                    !isRasterized_Glyph_(glyph, 0) ? bitmapSurface_Glyph_(glyph, bitmaps, 0) : NULL,
+                    !isRasterized_Glyph_(glyph, 1) ? bitmapSurface_Glyph_(glyph, bitmaps, 1) : NULL
                 };
+                delete_GlyphBitmaps_(bitmaps);
                 iBool outOfSpace = iFalse;
                 iForIndices(i, surfaces) {
                     if (surfaces[i]) {
@@ -1077,6 +2248,10 @@ static void cacheGlyphs_Font_(iFont *d, const iArray *glyphIndices) {
                                             &(SDL_Rect){ bufX, 0, w, h });
                             pushBack_Array(rasters,
                                            &(iRasterGlyph){ glyph, i, init_Rect(bufX, 0, w, h) });
+                            /* Determine placement in the glyph cache texture. */
+                            glyph->rect[i].pos =
+                                assignCachePos_Text_(activeText_, glyph->rect[i].size);
+                            glyph->page[i] = activeText_->cachePage;
                             bufX += w;
                         }
                         else {
@@ -1103,10 +2278,14 @@ static void cacheGlyphs_Font_(iFont *d, const iArray *glyphIndices) {
         if (!isEmpty_Array(rasters)) {
             SDL_Texture *bufTex = SDL_CreateTextureFromSurface(activeText_->render, buf);
             SDL_SetTextureBlendMode(bufTex, SDL_BLENDMODE_NONE);
+            iGlyphCachePage *page = cachePage_Text_(activeText_, activeText_->cachePage);
+            SDL_Texture *pageTex = page->texture;
             if (!isTargetChanged) {
                 isTargetChanged = iTrue;
-                oldTarget = SDL_GetRenderTarget(activeText_->render);
-                SDL_SetRenderTarget(activeText_->render, activeText_->cache);
+                set_RenderTarget(&oldTarget, activeText_->render, pageTex);
+            }
+            else {
+                SDL_SetRenderTarget(activeText_->render, pageTex);
             }
 //            printf("copying %zu rasters from %p\n", size_Array(rasters), bufTex); fflush(stdout);
             iConstForEach(Array, i, rasters) {
@@ -1117,6 +2296,9 @@ static void cacheGlyphs_Font_(iFont *d, const iArray *glyphIndices) {
                                bufTex,
                                (const SDL_Rect *) &rg->rect,
                                (const SDL_Rect *) glRect);
+#if defined (LAGRANGE_GLYPH_BACKING)
+                updateBacking_GlyphCachePage_(page, buf, &rg->rect, glRect->pos);
+#endif
                 setRasterized_Glyph_(rg->glyph, rg->hoff);
 //                printf(" - %u (hoff %d)\n", index_Glyph_(rg->glyph), rg->hoff);
             }
@@ -1125,6 +2307,9 @@ static void cacheGlyphs_Font_(iFont *d, const iArray *glyphIndices) {
             clear_Array(rasters);
             bufX = 0;
         }
+        if (isPageFull) {
+            nextCachePage_Text_(activeText_);
+        }
     }
     if (rasters) {
         delete_Array(rasters);
@@ -1133,8 +2318,9 @@ static void cacheGlyphs_Font_(iFont *d, const iArray *glyphIndices) {
         SDL_FreeSurface(buf);
     }
     if (isTargetChanged) {
-        SDL_SetRenderTarget(activeText_->render, oldTarget);
+        restore_RenderTarget(&oldTarget, activeText_->render);
     }
+    stop_ProfilerScope(glyphCache);
 }
 
 static void cacheSingleGlyph_Font_(iFont *d, uint32_t glyphIndex) {
@@ -1207,6 +2393,14 @@ struct Impl_RunArgs {
     int *         runAdvance_out;
 };
 
+static void flushRunGlyphs_(const iRunArgs *args) {
+    /* Measuring queues no glyphs, and may happen in a background thread that must not touch
+       the batch of the main thread. */
+    if (args->mode & draw_RunMode) {
+        flushGlyphs_Text_(activeText_);
+    }
+}
+
 static iBool notify_WrapText_(iWrapText *d, const char *ending, iTextAttrib attrib,
                               int origin, int advance) {
     if (d && d->wrapFunc && d->wrapRange_.start) {
@@ -1263,6 +2457,7 @@ struct Impl_GlyphBuffer {
     hb_glyph_info_t *    glyphInfo;
     hb_glyph_position_t *glyphPos;
     unsigned int         glyphCount;
+    void *               cachedCopy; /* `glyphInfo` and `glyphPos` from the shape cache */
 };
 
 static void init_GlyphBuffer_(iGlyphBuffer *d, iFont *font, const iChar *logicalText) {
@@ -1272,17 +2467,132 @@ static void init_GlyphBuffer_(iGlyphBuffer *d, iFont *font, const iChar *logical
     d->glyphInfo   = NULL;
     d->glyphPos    = NULL;
     d->glyphCount  = 0;
+    d->cachedCopy  = NULL;
 }
 
 static void deinit_GlyphBuffer_(iGlyphBuffer *d) {
+    free(d->cachedCopy);
     hb_buffer_destroy(d->hb);
 }
 
+static uint32_t inputHash_GlyphBuffer_(const iGlyphBuffer *d, const hb_glyph_info_t *input,
+                                       unsigned int len, uint32_t base) {
+    uint32_t hash = 0x811c9dc5; /* FNV-1a */
+    const uint32_t words[2] = { (uint32_t) (intptr_t) d->font, hb_buffer_get_script(d->hb) };
+    for (size_t i = 0; i < iElemCount(words); i++) {
+        hash = (hash ^ words[i]) * 0x01000193;
+    }
+    for (unsigned int i = 0; i < len; i++) {
+        hash = (hash ^ input[i].codepoint) * 0x01000193;
+        hash = (hash ^ (input[i].cluster - base)) * 0x01000193;
+    }
+    return hash;
+}
+
+static iBool isInput_ShapedRun_(const iShapedRun *d, const iGlyphBuffer *buf,
+                               const hb_glyph_info_t *input, unsigned int len, uint32_t base) {
+    if (d->font != buf->font || d->script != hb_buffer_get_script(buf->hb) ||
+        d->inputLen != len) {
+        return iFalse;
+    }
+    for (unsigned int i = 0; i < len; i++) {
+        if (d->input[2 * i] != input[i].codepoint ||
+            d->input[2 * i + 1] != input[i].cluster - base) {
+            return iFalse;
+        }
+    }
+    return iTrue;
+}
+
+static iBool lookup_ShapeCache_(iShapeCache *d, iGlyphBuffer *buf, uint32_t hash, uint32_t base,
+                                const hb_glyph_info_t *input, unsigned int len) {
+    lock_Mutex(&d->mutex);
+    iShapedRun *run = (iShapedRun *) value_Hash(&d->runs, hash);
+    if (!run || !isInput_ShapedRun_(run, buf, input, len, base)) {
+        unlock_Mutex(&d->mutex);
+        return iFalse;
+    }
+    unlink_ShapeCache_(d, run);
+    pushFront_ShapeCache_(d, run);
+    /* The buffer gets its own copy because the positions may be adjusted afterwards. */
+    const size_t infoSize = sizeof(hb_glyph_info_t) * run->glyphCount;
+    buf->cachedCopy = malloc(iMax(1, infoSize + sizeof(hb_glyph_position_t) * run->glyphCount));
+    buf->glyphInfo  = buf->cachedCopy;
+    buf->glyphPos   = (hb_glyph_position_t *) ((char *) buf->cachedCopy + infoSize);
+    buf->glyphCount = run->glyphCount;
+    memcpy(buf->glyphInfo, run->glyphInfo, infoSize);
+    memcpy(buf->glyphPos, run->glyphPos, sizeof(hb_glyph_position_t) * run->glyphCount);
+    unlock_Mutex(&d->mutex);
+    for (unsigned int i = 0; i < buf->glyphCount; i++) {
+        buf->glyphInfo[i].cluster += base;
+    }
+    return iTrue;
+}
+
+static void insert_ShapeCache_(iShapeCache *d, const iGlyphBuffer *buf, hb_script_t script,
+                               uint32_t hash, uint32_t base, const uint32_t *input,
+                               unsigned int len) {
+    const size_t inputSize = sizeof(uint32_t) * 2 * len;
+    const size_t infoSize  = sizeof(hb_glyph_info_t) * buf->glyphCount;
+    const size_t posSize   = sizeof(hb_glyph_position_t) * buf->glyphCount;
+    const size_t size      = sizeof(iShapedRun) + inputSize + infoSize + posSize;
+    if (size > d->budget / 16) {
+        return; /* not worth caching */
+    }
+    iShapedRun *run = malloc(size);
+    run->node.key   = hash;
+    run->font       = buf->font;
+    run->script     = script;
+    run->inputLen   = len;
+    run->glyphCount = buf->glyphCount;
+    run->input      = (uint32_t *) (run + 1);
+    run->glyphInfo  = (hb_glyph_info_t *) ((char *) run->input + inputSize);
+    run->glyphPos   = (hb_glyph_position_t *) ((char *) run->glyphInfo + infoSize);
+    memcpy(run->input, input, inputSize);
+    memcpy(run->glyphInfo, buf->glyphInfo, infoSize);
+    memcpy(run->glyphPos, buf->glyphPos, posSize);
+    for (unsigned int i = 0; i < run->glyphCount; i++) {
+        run->glyphInfo[i].cluster -= base;
+    }
+    lock_Mutex(&d->mutex);
+    iShapedRun *old = (iShapedRun *) value_Hash(&d->runs, hash);
+    if (old) {
+        remove_ShapeCache_(d, old); /* same hash, replaced */
+    }
+    insert_Hash(&d->runs, &run->node);
+    pushFront_ShapeCache_(d, run);
+    d->size += size;
+    while (d->size > d->budget && d->last) {
+        remove_ShapeCache_(d, d->last);
+    }
+    unlock_Mutex(&d->mutex);
+}
+
 static void shape_GlyphBuffer_(iGlyphBuffer *d) {
     if (!d->glyphInfo) {
-        hb_shape(d->font->fontFile->hbFont, d->hb, NULL, 0);
+        iShapeCache           *cache = &activeText_->shapeCache;
+        unsigned int           len   = 0;
+        const hb_glyph_info_t *in    = hb_buffer_get_glyph_infos(d->hb, &len);
+        uint32_t               base  = UINT32_MAX;
+        for (unsigned int i = 0; i < len; i++) {
+            base = iMin(base, in[i].cluster);
+        }
+        const uint32_t hash = inputHash_GlyphBuffer_(d, in, len, base);
+        if (lookup_ShapeCache_(cache, d, hash, base, in, len)) {
+            return;
+        }
+        /* Shaping replaces the input, so keep a copy of it for the cache. */
+        const hb_script_t script = hb_buffer_get_script(d->hb);
+        uint32_t *input = malloc(sizeof(uint32_t) * 2 * iMax(1u, len));
+        for (unsigned int i = 0; i < len; i++) {
+            input[2 * i]     = in[i].codepoint;
+            input[2 * i + 1] = in[i].cluster - base;
+        }
+        hb_shape(hbFont_FontFile(d->font->fontFile), d->hb, NULL, 0);
         d->glyphInfo = hb_buffer_get_glyph_infos(d->hb, &d->glyphCount);
         d->glyphPos  = hb_buffer_get_glyph_positions(d->hb, &d->glyphCount);
+        insert_ShapeCache_(cache, d, script, hash, base, input, len);
+        free(input);
     }
 }
 
@@ -1343,8 +2653,8 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
     iAttributedText attrText;
     init_AttributedText(&attrText, args->text, args->maxLen, d, args->color,
                         args->baseDir,
-                        activeText_->baseFontId >= 0 ? font_Text_(activeText_->baseFontId) : d,
-                        activeText_->baseFgColorId, 
+                        context_Text_.baseFontId >= 0 ? font_Text_(context_Text_.baseFontId) : d,
+                        context_Text_.baseFgColorId,
                         wrap ? wrap->overrideChar : 0);
     if (wrap) {
         wrap->baseDir = attrText.isBaseRTL ? -1 : +1;
@@ -1626,6 +2936,7 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
             }
         }
         /* Make a callback for each wrapped line. */
+        flushRunGlyphs_(args); /* the callback may draw */
         if (wrap && wrap->wrapFunc &&
             !notify_WrapText_(args->wrap,
                               sourcePtr_AttributedText_(&attrText, wrapResumePos),
@@ -1716,16 +3027,16 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
                 if (mode & draw_RunMode && (isBgFilled || !isSpace)) {
                     /* Draw the glyph. */
                     if (!isSpace && !isRasterized_Glyph_(glyph, hoff)) {
-                        cacheSingleGlyph_Font_(run->font, glyphId); /* may cause cache reset */
+                        cacheSingleGlyph_Font_(run->font, glyphId); /* may evict a page */
                         glyph = glyphByIndex_Font_(run->font, glyphId);
                         iAssert(isRasterized_Glyph_(glyph, hoff));
                     }
-                    if (~mode & permanentColorFlag_RunMode) {
-                        SDL_SetTextureColorMod(activeText_->cache, fgClr.r, fgClr.g, fgClr.b);
-                    }
+                    iGlyphCachePage *page = cachePage_Text_(activeText_, glyph->page[hoff]);
+                    page->lastUsed = ++activeText_->cacheUseCounter;
                     dst.x += origin_Paint.x;
                     dst.y += origin_Paint.y;
                     if (isBgFilled) {
+                        flushGlyphs_Text_(activeText_);
                         /* TODO: Backgrounds of all glyphs should be cleared before drawing anything else. */
                         if (bgClr.a) {
                             SDL_SetRenderDrawColor(activeText_->render, bgClr.r, bgClr.g, bgClr.b, 255);
@@ -1747,7 +3058,8 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
                     if (!isSpace) {
                         SDL_Rect src;
                         memcpy(&src, &glyph->rect[hoff], sizeof(SDL_Rect));
-                        SDL_RenderCopy(activeText_->render, activeText_->cache, &src, &dst);
+                        drawGlyph_Text_(activeText_, page, &src, &dst,
+                                        mode & permanentColorFlag_RunMode ? NULL : &fgClr);
                     }
 #if 0
                     /* Show spaces and direction. */
@@ -1795,6 +3107,7 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
     if (args->runAdvance_out) {
         *args->runAdvance_out = xCursorMax;
     }
+    flushRunGlyphs_(args);
     iForEach(Array, b, &buffers) {
         deinit_GlyphBuffer_(b.value);
     }
@@ -1809,6 +3122,53 @@ static iRect run_Font_(iFont *d, const iRunArgs *args) {
 #   define run_Font_    runSimple_Font_
 #   include "text_simple.c"
 
+static uint32_t hash_MeasuredText_(int fontId, iRangecc text) {
+    uint32_t hash = 2166136261u ^ (uint32_t) fontId; /* FNV-1a */
+    for (const char *ch = text.start; ch != text.end; ch++) {
+        hash = (hash ^ (uint8_t) *ch) * 16777619u;
+    }
+    return hash ? hash : 1;
+}
+
+static iBool isMatch_MeasuredText_(const iMeasuredText *d, uint32_t hash, int fontId,
+                                   iRangecc text) {
+    return d->hash == hash && d->fontId == fontId && d->len == size_Range(&text) &&
+           d->fontGeneration == activeText_->fontGeneration &&
+           d->overrideFontId == activeText_->overrideFontId &&
+           memcmp(d->text, text.start, d->len) == 0;
+}
+
+static iBool lookup_MeasureCache_(iMeasureCache *d, uint32_t hash, int fontId, iRangecc text,
+                                  iTextMetrics *tm_out) {
+    const iMeasuredText *entry = &d->entries[hash & (numEntries_MeasureCache_ - 1)];
+    iBool found = iFalse;
+    lock_Mutex(&d->mutex);
+    if (isMatch_MeasuredText_(entry, hash, fontId, text)) {
+        *tm_out = entry->metrics;
+        if (entry->missingGlyphs) {
+            context_Text_.missingGlyphs = iTrue;
+        }
+        found = iTrue;
+    }
+    unlock_Mutex(&d->mutex);
+    return found;
+}
+
+static void insert_MeasureCache_(iMeasureCache *d, uint32_t hash, int fontId, iRangecc text,
+                                 const iTextMetrics *tm, iBool missingGlyphs) {
+    iMeasuredText *entry = &d->entries[hash & (numEntries_MeasureCache_ - 1)];
+    lock_Mutex(&d->mutex);
+    entry->hash           = hash;
+    entry->fontGeneration = activeText_->fontGeneration;
+    entry->fontId         = fontId;
+    entry->overrideFontId = activeText_->overrideFontId;
+    entry->len            = (uint16_t) size_Range(&text);
+    entry->missingGlyphs  = missingGlyphs;
+    entry->metrics        = *tm;
+    memcpy(entry->text, text.start, entry->len);
+    unlock_Mutex(&d->mutex);
+}
+
 #endif /* defined (LAGRANGE_ENABLE_HARFBUZZ) */
 
 int lineHeight_Text(int fontId) {
@@ -1825,11 +3185,29 @@ iTextMetrics measureRange_Text(int fontId, iRangecc text) {
         return (iTextMetrics){ init_Rect(0, 0, 0, lineHeight_Text(fontId)), zero_I2() };
     }
     iTextMetrics tm;
+#if !defined (LAGRANGE_ENABLE_HARFBUZZ)
+    const iBool    isCached = size_Range(&text) <= maxTextLength_MeasureCache_;
+    const uint32_t hash     = isCached ? hash_MeasuredText_(fontId, text) : 0;
+    const iBool    wasMissing = context_Text_.missingGlyphs;
+    if (isCached) {
+        if (lookup_MeasureCache_(&activeText_->measureCache, hash, fontId, text, &tm)) {
+            return tm;
+        }
+        context_Text_.missingGlyphs = iFalse;
+    }
+#endif
     tm.bounds = run_Font_(font_Text_(fontId), &(iRunArgs){
         .mode = measure_RunMode,
         .text = text,
         .cursorAdvance_out = &tm.advance
     });
+#if !defined (LAGRANGE_ENABLE_HARFBUZZ)
+    if (isCached) {
+        insert_MeasureCache_(&activeText_->measureCache, hash, fontId, text, &tm,
+                             context_Text_.missingGlyphs);
+        context_Text_.missingGlyphs |= wasMissing;
+    }
+#endif
     return tm;
 }
 
@@ -1903,7 +3281,7 @@ static void drawBoundedN_Text_(int fontId, iInt2 pos, int xposBound, int color,
     iText *      d    = activeText_;
     iFont *      font = font_Text_(fontId);
     const iColor clr  = get_Color(color & mask_ColorId);
-    SDL_SetTextureColorMod(d->cache, clr.r, clr.g, clr.b);
+    setCacheColor_Text_(d, clr);
     run_Font_(font,
               &(iRunArgs){ .mode = draw_RunMode |
                                    (color & permanent_ColorId ? permanentColorFlag_RunMode : 0) |
@@ -2094,14 +3472,38 @@ iTextMetrics draw_WrapText(iWrapText *d, int fontId, iInt2 pos, int color) {
 }
 
 iBool checkMissing_Text(void) {
-    iText *d = activeText_;
-    const iBool missing = d->missingGlyphs;
-    d->missingGlyphs = iFalse;
+    const iBool missing = context_Text_.missingGlyphs;
+    context_Text_.missingGlyphs = iFalse;
     return missing;
 }
 
-SDL_Texture *glyphCache_Text(void) {
-    return activeText_->cache;
+SDL_Texture *glyphCache_Text(int page) {
+    if (page < 0 || page >= (int) size_Array(&activeText_->cachePages)) {
+        return NULL;
+    }
+    return cachePage_Text_(activeText_, page)->texture;
+}
+
+void glyphCacheInfo_Text(const iText *d, int *numPages_out, float *occupancy_out,
+                         int *numEvictions_out) {
+    int used = 0;
+    iConstForEach(Array, i, &d->cachePages) {
+        used += ((const iGlyphCachePage *) i.value)->bottom;
+    }
+    if (numPages_out) {
+        *numPages_out = size_Array(&d->cachePages);
+    }
+    if (occupancy_out) {
+        *occupancy_out = (float) used / (maxCachePages_Text_ * d->cacheSize.y);
+    }
+    if (numEvictions_out) {
+        *numEvictions_out = d->cacheEvictions;
+    }
+}
+
+size_t glyphCacheMemorySize_Text(const iText *d) {
+    /* Pages are RGBA4444. */
+    return size_Array(&d->cachePages) * (size_t) d->cacheSize.x * d->cacheSize.y * 2;
 }
 
 static void freeBitmap_(void *ptr) {
@@ -2228,17 +3630,17 @@ void init_TextBuf(iTextBuf *d, iWrapText *wrapText, int font, int color) {
         d->texture = NULL;
     }
     if (d->texture) {
-        SDL_Texture *oldTarget = SDL_GetRenderTarget(render);
+        iRenderTarget oldTarget;
         const iInt2 oldOrigin = origin_Paint;
         origin_Paint = zero_I2();
-        SDL_SetRenderTarget(render, d->texture);
+        set_RenderTarget(&oldTarget, render, d->texture);
         SDL_SetRenderDrawBlendMode(render, SDL_BLENDMODE_NONE);
         SDL_SetRenderDrawColor(render, 255, 255, 255, 0);
         SDL_RenderClear(render);
-        SDL_SetTextureBlendMode(activeText_->cache, SDL_BLENDMODE_NONE); /* blended when TextBuf is drawn */
+        setCacheBlendMode_Text_(activeText_, SDL_BLENDMODE_NONE); /* blended when TextBuf is drawn */
         draw_WrapText(wrapText, font, zero_I2(), color | fillBackground_ColorId);
-        SDL_SetTextureBlendMode(activeText_->cache, SDL_BLENDMODE_BLEND);
-        SDL_SetRenderTarget(render, oldTarget);
+        setCacheBlendMode_Text_(activeText_, SDL_BLENDMODE_BLEND);
+        restore_RenderTarget(&oldTarget, render);
         origin_Paint = oldOrigin;
         SDL_SetTextureBlendMode(d->texture, SDL_BLENDMODE_BLEND);
     }
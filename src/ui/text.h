@@ -110,9 +110,20 @@ void    init_Text               (iText *, SDL_Renderer *);
 void    deinit_Text             (iText *);
 
 void    setCurrent_Text         (iText *);
+iText * current_Text            (void);
+
+/* Measuring text in a background thread. Fonts are kept unchanged until `endMetrics_Text`
+   is called. Measuring never touches the glyph cache texture. */
+void    beginMetrics_Text       (iText *);
+void    endMetrics_Text         (void);
+
+uint32_t fontGeneration_Text   (const iText *); /* changes when metrics may have changed */
+uint32_t metricsKey_Text       (const iText *); /* same fonts and sizes in every session */
 
 void    setDocumentFontSize_Text(iText *, float fontSizeFactor); /* affects all except `default*` fonts */
 void    resetFonts_Text         (iText *);
+void    clearShapeCache_Text    (iText *); /* forget shaped and measured runs (benchmarking) */
+void    restoreGlyphCache_Text  (iText *); /* after render targets were reset */
 
 int     lineHeight_Text         (int fontId);
 float   emRatio_Text            (int fontId); /* em advance to line height ratio */
@@ -222,7 +233,10 @@ iTextMetrics    measure_WrapText    (iWrapText *, int fontId);
 iTextMetrics    draw_WrapText       (iWrapText *, int fontId, iInt2 pos, int color);
 
 iBool           checkMissing_Text   (void); /* returns the flag, and clears it */
-SDL_Texture *   glyphCache_Text     (void);
+SDL_Texture *   glyphCache_Text     (int page); /* NULL if there is no such page */
+void            glyphCacheInfo_Text (const iText *, int *numPages_out, float *occupancy_out,
+                                     int *numEvictions_out);
+size_t          glyphCacheMemorySize_Text   (const iText *); /* bytes of texture memory */
 
 enum iTextBlockMode { quadrants_TextBlockMode, shading_TextBlockMode };
 
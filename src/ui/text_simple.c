@@ -31,7 +31,52 @@ iLocalDef iBool isClosingBracket_(iChar c) {
     return (c == ')' || c == ']' || c == '}' || c == '>');
 }
 
+enum iAsciiWrapClass {
+    space_AsciiWrapClass          = iBit(1),
+    punct_AsciiWrapClass          = iBit(2), /* see `isWrapPunct_` */
+    closingBracket_AsciiWrapClass = iBit(3),
+    breaksAfter_AsciiWrapClass    = iBit(4), /* unless followed by punctuation */
+};
+
+/* Wrap classes of printable ASCII characters, so the common case is a table lookup. */
+static const uint8_t asciiWrapClass_[128] = {
+    [' ']  = space_AsciiWrapClass,
+    ['/']  = punct_AsciiWrapClass | breaksAfter_AsciiWrapClass,
+    ['\\'] = punct_AsciiWrapClass | breaksAfter_AsciiWrapClass,
+    ['-']  = punct_AsciiWrapClass | breaksAfter_AsciiWrapClass,
+    ['=']  = punct_AsciiWrapClass,
+    [',']  = punct_AsciiWrapClass,
+    [';']  = punct_AsciiWrapClass,
+    ['.']  = punct_AsciiWrapClass,
+    [':']  = punct_AsciiWrapClass,
+    ['_']  = breaksAfter_AsciiWrapClass,
+    ['+']  = breaksAfter_AsciiWrapClass,
+    [')']  = closingBracket_AsciiWrapClass,
+    [']']  = closingBracket_AsciiWrapClass,
+    ['}']  = closingBracket_AsciiWrapClass,
+    ['>']  = closingBracket_AsciiWrapClass,
+};
+
+iLocalDef iBool isPrintableAscii_(iChar c) {
+    return c >= 0x20 && c < 0x7f;
+}
+
 iLocalDef iBool isWrapBoundary_(iChar prevC, iChar c) {
+    if (isPrintableAscii_(prevC) && isPrintableAscii_(c)) {
+        /* Same rules as below. */
+        const int prev = asciiWrapClass_[prevC];
+        const int cur  = asciiWrapClass_[c];
+        if (prev & closingBracket_AsciiWrapClass && ~cur & punct_AsciiWrapClass) {
+            return iTrue;
+        }
+        if (prev & space_AsciiWrapClass) {
+            return iFalse;
+        }
+        if (prev & breaksAfter_AsciiWrapClass && ~cur & punct_AsciiWrapClass) {
+            return iTrue;
+        }
+        return (cur & space_AsciiWrapClass) != 0;
+    }
     /* Line wrapping boundaries are determined by looking at a character and the
        last character processed. We want to wrap at natural word boundaries where
        possible, so normally we wrap at a space followed a non-space character. As
@@ -52,6 +97,41 @@ iLocalDef iBool isWrapBoundary_(iChar prevC, iChar c) {
     return isSpace_Char(c);
 }
 
+#if defined (LAGRANGE_ENABLE_KERNING)
+static int kernAdvance_Font_(iFont *d, const iGlyph *glyph, iChar ch, iChar next) {
+    /* Kerning of ASCII pairs is looked up from the font file only once. The table is filled
+       in full before it is published, so other threads can read it without locking. */
+    if (isPrintableAscii_(ch) && isPrintableAscii_(next)) {
+        iGlyphTable *table   = table_Font_(d);
+        int16_t *    kerning = atomic_load_explicit(&table->asciiKerning, memory_order_acquire);
+        if (!kerning) {
+            uint32_t glyphs[95];
+            for (int i = 0; i < 95; i++) {
+                glyphs[i] = glyphIndex_Font_(d, 0x20 + i);
+            }
+            kerning = malloc(sizeof(int16_t) * 95 * 95);
+            for (int i = 0; i < 95; i++) {
+                for (int j = 0; j < 95; j++) {
+                    kerning[i * 95 + j] =
+                        (int16_t) kernAdvance_FontFile(d->fontFile, glyphs[i], glyphs[j]);
+                }
+            }
+            int16_t *expected = NULL;
+            if (!atomic_compare_exchange_strong_explicit(&table->asciiKerning,
+                                                         &expected,
+                                                         kerning,
+                                                         memory_order_acq_rel,
+                                                         memory_order_acquire)) {
+                free(kerning); /* another thread was faster */
+                kerning = expected;
+            }
+        }
+        return kerning[(ch - 0x20) * 95 + (next - 0x20)];
+    }
+    return kernAdvance_FontFile(d->fontFile, index_Glyph_(glyph), glyphIndex_Font_(d, next));
+}
+#endif
+
 iLocalDef iBool isMeasuring_(enum iRunMode mode) {
     return (mode & modeMask_RunMode) == measure_RunMode;
 }
@@ -113,20 +193,19 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
         }
         if (*chPos == 0x1b) { /* ANSI escape. */
             chPos++;
-            iRegExpMatch m;
-            init_RegExpMatch(&m);
-            if (match_RegExp(activeText_->ansiEscape, chPos, args->text.end - chPos, &m)) {
+            iAnsiEscape esc;
+            const size_t escLen = parseAnsiEscape_(chPos, args->text.end, &esc);
+            if (escLen) {
                 if (mode & draw_RunMode && ~mode & permanentColorFlag_RunMode) {
                     /* Change the color. */
                     iColor clr;
-                    ansiColors_Color(capturedRange_RegExpMatch(&m, 1), tmParagraph_ColorId,
-                                     none_ColorId, &clr, NULL);
-                    SDL_SetTextureColorMod(activeText_->cache, clr.r, clr.g, clr.b);
+                    ansiColors_Text_(esc.params, tmParagraph_ColorId, none_ColorId, &clr, NULL);
+                    setCacheColor_Text_(activeText_, clr);
                     if (args->mode & fillBackground_RunMode) {
                         SDL_SetRenderDrawColor(activeText_->render, clr.r, clr.g, clr.b, 0);
                     }
                 }
-                chPos = end_RegExpMatch(&m);
+                chPos += escLen;
                 continue;
             }
         }
@@ -168,6 +247,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
             /* TODO: Check out if `uc_wordbreak_property()` from libunistring can be used here. */
             if (ch == '\n') {
                 /* Notify about the wrap. */
+                flushRunGlyphs_(args);
                 if (!notify_WrapText_(wrap, chPos, attrib, 0, iMax(xpos, xposExtend) - orig.x)) {
                     break;
                 }
@@ -207,7 +287,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
                 }
                 if (mode & draw_RunMode && ~mode & permanentColorFlag_RunMode) {
                     const iColor clr = get_Color(colorNum);
-                    SDL_SetTextureColorMod(activeText_->cache, clr.r, clr.g, clr.b);
+                    setCacheColor_Text_(activeText_, clr);
                     if (args->mode & fillBackground_RunMode) {
                         SDL_SetRenderDrawColor(activeText_->render, clr.r, clr.g, clr.b, 0);
                     }
@@ -228,7 +308,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
 //            printf("[Text] missing from cache: %lc (%x)\n", (int) ch, ch);
             //cacheTextGlyphs_Font_(d, args->text);
             cacheSingleGlyph_Font_(glyph->font, index_Glyph_(glyph));
-            glyph = glyph_Font_(d, ch); /* cache may have been reset */
+            glyph = glyph_Font_(d, ch); /* a cache page may have been evicted */
         }
         int x2 = x1 + glyph->rect[hoff].size.x;
         if (isHitPointOnThisLine) {
@@ -248,6 +328,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
                 wrapPos = iMin(wrapPos, args->text.end);
                 advance = wrapAdvance;
             }
+            flushRunGlyphs_(args);
             if (!notify_WrapText_(wrap, wrapPos, attrib, 0, advance)) {
                 break;
             }
@@ -312,9 +393,12 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
             if (args->mode & fillBackground_RunMode) {
                 /* Alpha blending looks much better if the RGB components don't change in
                    the partially transparent pixels. */
+                flushRunGlyphs_(args);
                 SDL_RenderFillRect(activeText_->render, &dst);
             }
-            SDL_RenderCopy(activeText_->render, activeText_->cache, &src, &dst);
+            iGlyphCachePage *page = cachePage_Text_(activeText_, glyph->page[hoff]);
+            page->lastUsed = ++activeText_->cacheUseCounter;
+            drawGlyph_Text_(activeText_, page, &src, &dst, NULL);
         }
         xpos += advance;
         if (!isSpace_Char(ch)) {
@@ -327,9 +411,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
             const char *peek = chPos;
             const iChar next = nextChar_(&peek, args->text.end);
             if (enableKerning_Text && next) {
-                const uint32_t nextGlyphIndex = glyphIndex_Font_(glyph->font, next);
-                int kern = stbtt_GetGlyphKernAdvance(
-                    &glyph->font->fontFile->stbInfo, index_Glyph_(glyph), nextGlyphIndex);
+                int kern = kernAdvance_Font_(glyph->font, glyph, ch, next);
                 /* Nunito needs some kerning fixes. */
                 if (glyph->font->fontSpec->flags & fixNunitoKerning_FontSpecFlag) {
                     if (ch == 'W' && (next == 'i' || next == 'h')) {
@@ -363,6 +445,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
             break;
         }
     }
+    flushRunGlyphs_(args);
     notify_WrapText_(wrap, chPos, attrib, 0, xpos - orig.x);
     if (checkHitChar && wrap->hitChar == args->text.end) {
         wrap->hitAdvance_out = sub_I2(init_I2(xpos, ypos), orig);
@@ -374,6 +457,7 @@ static iRect runSimple_Font_(iFont *d, const iRunArgs *args) {
         *args->runAdvance_out = xposMax - orig.x;
     }
 //    fflush(stdout);
+    flushRunGlyphs_(args);
     return bounds;
 }
 
@@ -85,12 +85,14 @@ iLocalDef void pushPos_Touch_(iTouch *d, const iFloat3 pos, uint32_t time) {
     d->posCount++;
 }
 
+/* Momentum decays exponentially, so the offset at any moment is computed directly from
+   the release velocity and the time elapsed since release, independent of the frame rate. */
 struct Impl_Momentum {
     iWidget *affinity;
-    uint32_t releaseTime;
+    double releaseTime; /* accurate ticks */
     iFloat3 pos;
-    iFloat3 velocity;
-    iFloat3 accum;
+    iFloat3 velocity; /* at release, pixels per second */
+    iFloat3 dispatched; /* offset already sent as wheel events */
 };
 
 struct Impl_Pinch {
@@ -103,9 +105,7 @@ struct Impl_TouchState {
     iArray *touches;
     iArray *pinches;
     iArray *moms;
-    double stepDurationMs;
-    double momFrictionPerStep;
-    double lastMomTime;
+    double momDecayPerMs;
     iInt2 currentTouchPos; /* for emulating SDL_GetMouseState() */
 };
 
@@ -116,12 +116,8 @@ static iTouchState *touchState_(void) {
         d->touches        = new_Array(sizeof(iTouch));
         d->pinches        = new_Array(sizeof(iPinch));
         d->moms           = new_Array(sizeof(iMomentum));
-        d->lastMomTime    = 0.0;
-        d->stepDurationMs = 1000.0 / 60.0; /* TODO: Ask SDL about the display refresh rate. */
-#if defined (iPlatformAppleMobile)
-        d->stepDurationMs = 1000.0 / (double) displayRefreshRate_iOS();
-#endif
-        d->momFrictionPerStep = pow(0.985, 120.0 / (1000.0 / d->stepDurationMs));
+        /* Same deceleration as the old per-step friction of 0.985 at 120 Hz. */
+        d->momDecayPerMs  = -log(0.985) * 120.0 / 1000.0;
     }
     return d;
 }
@@ -251,6 +247,33 @@ iLocalDef double accurateTicks_(void) {
     return 1000.0 * (double) count / (double) freq;
 }
 
+static const float minMomentumSpeed_Touch_ = 15.0f; /* pixels per second */
+
+static float decay_Momentum_(double elapsedMs) {
+    return (float) exp(-touchState_()->momDecayPerMs * iMax(0.0, elapsedMs));
+}
+
+static double duration_Momentum_(const iMomentum *d) {
+    /* Time until the speed drops below the minimum. */
+    const float speed = length_F3(d->velocity);
+    if (speed <= minMomentumSpeed_Touch_) {
+        return 0.0;
+    }
+    return log(speed / minMomentumSpeed_Touch_) / touchState_()->momDecayPerMs;
+}
+
+static iFloat3 offset_Momentum_(const iMomentum *d, double elapsedMs) {
+    /* Integral of the exponentially decaying velocity. */
+    elapsedMs = iMin(elapsedMs, duration_Momentum_(d));
+    const float travel = (1.0f - decay_Momentum_(elapsedMs)) /
+                         (float) touchState_()->momDecayPerMs / 1000.0f;
+    return mulf_F3(d->velocity, travel);
+}
+
+static iFloat3 remaining_Momentum_(const iMomentum *d) {
+    return sub_F3(offset_Momentum_(d, duration_Momentum_(d)), d->dispatched);
+}
+
 static iFloat3 gestureVector_Touch_(const iTouch *d) {
     const size_t lastIndex = iMin(d->posCount - 1, lastIndex_Touch_);
     return sub_F3(d->pos[0], d->pos[lastIndex]);
@@ -323,32 +346,18 @@ static void update_TouchState_(void *ptr) {
         }
     }
     /* Update/cancel momentum scrolling. */ {
-        const float minSpeed = 15.0f;
-        if (d->lastMomTime < 0.001) {
-            d->lastMomTime = accurateTicks_();
-        }
-        const double momAvailMs = accurateTicks_() - d->lastMomTime;
-        /* Display refresh is vsynced and we'll be here at most once per frame.
-           However, we may come here TOO early, which would cause a hiccup in the scrolling,
-           so always do at least one step. */
-        int numSteps = iMax(1, momAvailMs / d->stepDurationMs);
-        d->lastMomTime += numSteps * d->stepDurationMs;
-        numSteps = iMin(numSteps, 10); /* don't spend too much time here */
-//        printf("mom steps:%d\n", numSteps);
+        const double now = accurateTicks_();
         iForEach(Array, m, d->moms) {
-            if (numSteps == 0) break;
             iMomentum *mom = m.value;
             if (!mom->affinity) {
                 remove_ArrayIterator(&m);
                 continue;
             }
-            for (int step = 0; step < numSteps; step++) {
-                mulvf_F3(&mom->velocity, d->momFrictionPerStep);
-                addv_F3(&mom->accum, mulf_F3(mom->velocity, d->stepDurationMs / 1000.0f));
-            }
-            const iInt2 pixels = initF3_I2(mom->accum);
+            const double  elapsed = now - mom->releaseTime;
+            const iFloat3 delta   = sub_F3(offset_Momentum_(mom, elapsed), mom->dispatched);
+            const iInt2   pixels  = initF3_I2(delta);
             if (pixels.x || pixels.y) {
-                subv_F3(&mom->accum, initI2_F3(pixels));
+                addv_F3(&mom->dispatched, initI2_F3(pixels));
                 dispatchMotion_Touch_(mom->pos, 0);
                 iAssert(mom->affinity);
                 setCurrent_Root(mom->affinity->root);
@@ -362,7 +371,7 @@ static void update_TouchState_(void *ptr) {
                                                         .direction = perPixel_MouseWheelFlag
                                                     });
             }
-            if (length_F3(mom->velocity) < minSpeed) {
+            if (elapsed >= duration_Momentum_(mom)) {
                 setHover_Widget(NULL);
                 remove_ArrayIterator(&m);
             }
@@ -725,13 +734,10 @@ iBool processEvent_Touch(const SDL_Event *ev) {
                     clearWidgetMomentum_TouchState_(d, touch->affinity);
                     iMomentum mom = {
                         .affinity = touch->affinity,
-                        .releaseTime = nowTime,
+                        .releaseTime = accurateTicks_(),
                         .pos = touch->startPos, // pos[0],
                         .velocity = velocity
                     };
-                    if (isEmpty_Array(d->moms)) {
-                        d->lastMomTime = accurateTicks_();
-                    }
                     pushBack_Array(d->moms, &mom);
                     //dispatchMotion_Touch_(touch->startPos, 0);
                 }
@@ -755,13 +761,26 @@ float stopWidgetMomentum_Touch(const iWidget *widget) {
     iForEach(Array, i, d->moms) {
         iMomentum *mom = i.value;
         if (mom->affinity == widget) {
-            remaining = length_F3(mom->velocity);
+            /* Current speed of the momentum. */
+            remaining = length_F3(mom->velocity) *
+                        decay_Momentum_(accurateTicks_() - mom->releaseTime);
             remove_ArrayIterator(&i);
         }
     }
     return remaining;
 }
 
+iInt2 momentumTarget_Touch(const iWidget *widget) {
+    iTouchState *d = touchState_();
+    iConstForEach(Array, i, d->moms) {
+        const iMomentum *mom = i.value;
+        if (mom->affinity == widget) {
+            return initF3_I2(remaining_Momentum_(mom));
+        }
+    }
+    return zero_I2();
+}
+
 enum iWidgetTouchMode widgetMode_Touch(const iWidget *widget) {
     iTouchState *d = touchState_();
     iConstForEach(Array, i, d->touches) {
@@ -37,6 +37,7 @@ iBool   processEvent_Touch      (const SDL_Event *);
 void    update_Touch            (void);
 
 float                   stopWidgetMomentum_Touch    (const iWidget *widget);
+iInt2                   momentumTarget_Touch        (const iWidget *widget); /* remaining travel */
 enum iWidgetTouchMode   widgetMode_Touch            (const iWidget *widget);
 void                    widgetDestroyed_Touch       (iWidget *widget);
 
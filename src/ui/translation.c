@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "app.h"
 #include "defs.h"
 #include "gmdocument.h"
+#include "lang.h"
 #include "ui/command.h"
 #include "ui/documentwidget.h"
 #include "ui/labelwidget.h"
@@ -266,33 +267,78 @@ static iString *unquote_String_(const iString *d) {
     return unquot;
 }
 
+/* The page is translated in parts of a few paragraphs each. Several parts are requested at
+   the same time, and each translation replaces its original in the document as soon as it
+   arrives. The parts not yet translated are shown in the original language. */
+
+enum iTranslationPartStatus {
+    pending_TranslationPartStatus,
+    submitted_TranslationPartStatus,
+    finished_TranslationPartStatus,
+    failed_TranslationPartStatus,
+};
+
+struct Impl_TranslationPart {
+    enum iTranslationPartStatus status;
+    iTlsRequest *request;
+    size_t       firstLine; /* index in `lineTypes` */
+    iRangecc     original;  /* shown if the translation fails */
+    iString      text;      /* markup stripped; replaced with the marked up translation */
+};
+
+static const size_t minPartSize_Translation_     = 1024; /* split at the next blank line */
+static const size_t maxPartSize_Translation_     = 8192;
+static const size_t maxConcurrent_Translation_   = 4;
+
 static void finished_Translation_(iTlsRequest *d, iTlsRequest *req) {
     iUnused(req);
-    postCommandf_App("translation.finished ptr:%p", userData_Object(d));
+    postCommandf_App("translation.finished ptr:%p req:%p", userData_Object(d), d);
 }
 
 void init_Translation(iTranslation *d, iDocumentWidget *doc) {
     d->dlg       = makeTranslation_Widget(as_Widget(doc));
     d->startTime = 0;
     d->doc       = doc; /* owner */
-    d->request   = new_TlsRequest();
+    d->target    = NULL;
     d->timer     = 0;
+    d->isAborted = iFalse;
     init_Array(&d->lineTypes, sizeof(int));
-    setUserData_Object(d->request, d->doc);
-    setHost_TlsRequest(d->request,
-                       collectNewCStr_String(translationServiceHost),
-                       translationServicePort);
-    iConnect(TlsRequest, d->request, finished, d->request, finished_Translation_);
+    init_Array(&d->parts, sizeof(iTranslationPart));
+    d->numSpliced = 0;
+    init_String(&d->langFrom);
+    init_String(&d->langTo);
+    init_String(&d->source);
+    init_String(&d->marked);
+}
+
+static void cancel_Translation_(iTranslation *d) {
+    iForEach(Array, i, &d->parts) {
+        iTranslationPart *part = i.value;
+        if (part->status == submitted_TranslationPartStatus) {
+            cancel_TlsRequest(part->request);
+            part->status = failed_TranslationPartStatus;
+        }
+    }
 }
 
 void deinit_Translation(iTranslation *d) {
     if (d->timer) {
         SDL_RemoveTimer(d->timer);
     }
-    cancel_TlsRequest(d->request);
-    iRelease(d->request);
+    cancel_Translation_(d);
+    iForEach(Array, i, &d->parts) {
+        iTranslationPart *part = i.value;
+        iRelease(part->request);
+        deinit_String(&part->text);
+    }
+    deinit_Array(&d->parts);
     destroy_Widget(d->dlg);
     deinit_Array(&d->lineTypes);
+    deinit_String(&d->marked);
+    deinit_String(&d->source);
+    deinit_String(&d->langTo);
+    deinit_String(&d->langFrom);
+    iRelease(d->target);
 }
 
 static uint32_t animate_Translation_(uint32_t interval, iAny *ptr) {
@@ -300,8 +346,75 @@ static uint32_t animate_Translation_(uint32_t interval, iAny *ptr) {
     return interval;
 }
 
+static iBool isRunning_Translation_(const iTranslation *d) {
+    iConstForEach(Array, i, &d->parts) {
+        const iTranslationPart *part = i.value;
+        if (part->status == submitted_TranslationPartStatus) {
+            return iTrue;
+        }
+    }
+    return iFalse;
+}
+
+static void addPart_Translation_(iTranslation *d, size_t firstLine, iRangecc original,
+                                 const iString *text) {
+    iTranslationPart part = { .status    = pending_TranslationPartStatus,
+                              .request   = new_TlsRequest(),
+                              .firstLine = firstLine,
+                              .original  = original };
+    initCopy_String(&part.text, text);
+    setUserData_Object(part.request, d->doc);
+    setHost_TlsRequest(part.request,
+                       collectNewCStr_String(translationServiceHost),
+                       translationServicePort);
+    iConnect(TlsRequest, part.request, finished, part.request, finished_Translation_);
+    pushBack_Array(&d->parts, &part);
+}
+
+static void submitPart_Translation_(iTranslation *d, iTranslationPart *part) {
+    iBlock *json = collect_Block(new_Block(0));
+    printf_Block(json,
+                 "{\"q\":\"%s\",\"source\":\"%s\",\"target\":\"%s\"}",
+                 cstrCollect_String(quote_String_(&part->text)),
+                 cstr_String(&d->langFrom),
+                 cstr_String(&d->langTo));
+    iBlock *msg = collect_Block(new_Block(0));
+    printf_Block(msg,
+                 "POST /translate HTTP/1.1\r\n"
+                 "Host: %s\r\n"
+                 "Connection: close\r\n"
+                 "Content-Type: application/json; charset=utf-8\r\n"
+                 "Content-Length: %zu\r\n\r\n",
+                 translationServiceHost,
+                 size_Block(json));
+    append_Block(msg, json);
+    setContent_TlsRequest(part->request, msg);
+    part->status = submitted_TranslationPartStatus;
+    submit_TlsRequest(part->request);
+}
+
+static void submitPending_Translation_(iTranslation *d) {
+    size_t numRunning = 0;
+    iForEach(Array, i, &d->parts) {
+        iTranslationPart *part = i.value;
+        if (part->status == submitted_TranslationPartStatus) {
+            numRunning++;
+        }
+    }
+    iForEach(Array, j, &d->parts) {
+        if (numRunning >= maxConcurrent_Translation_) {
+            break;
+        }
+        iTranslationPart *part = j.value;
+        if (part->status == pending_TranslationPartStatus) {
+            submitPart_Translation_(d, part);
+            numRunning++;
+        }
+    }
+}
+
 void submit_Translation(iTranslation *d) {
-    iAssert(status_TlsRequest(d->request) != submitted_TlsRequestStatus);
+    iAssert(isEmpty_Array(&d->parts));
     /* Check the selected languages from the dialog. */
     const char *idFrom = languageId_String(text_LabelWidget(findChild_Widget(d->dlg, "xlt.from")));
     const char *idTo   = languageId_String(text_LabelWidget(findChild_Widget(d->dlg, "xlt.to")));
@@ -309,14 +422,19 @@ void submit_Translation(iTranslation *d) {
     postCommandf_App("translation.languages from:%d to:%d",
                      languageIndex_CStr(idFrom),
                      languageIndex_CStr(idTo));
-    iBlock * json   = collect_Block(new_Block(0));
-    iString *docSrc = collectNew_String();
+    setCStr_String(&d->langFrom, idFrom);
+    setCStr_String(&d->langTo, idTo);
+    const iGmDocument *doc = document_DocumentWidget(d->doc);
+    d->target = ref_Object(doc);
+    set_String(&d->source, source_GmDocument(doc));
+    iString *partSrc = collectNew_String();
     /* The translation engine doesn't preserve Gemtext markup so we'll strip all of it and
        remember each line's type. These are reapplied when reading the response. Newlines seem
        to be preserved pretty well. */ {
-        iRangecc line = iNullRange;
-        while (nextSplit_Rangecc(
-            range_String(source_GmDocument(document_DocumentWidget(d->doc))), "\n", &line)) {
+        iRangecc line      = iNullRange;
+        iRangecc original  = iNullRange;
+        size_t   firstLine = 0;
+        while (nextSplit_Rangecc(range_String(&d->source), "\n", &line)) {
             iRangecc cleanLine = trimmed_Rangecc(line);
             const int lineType = lineType_Rangecc(cleanLine);
             pushBack_Array(&d->lineTypes, &lineType);
@@ -326,31 +444,30 @@ void submit_Translation(iTranslation *d) {
             else {
                 trimLine_Rangecc(&cleanLine, lineType, iTrue); /* removes the prefix */
             }
-            if (!isEmpty_String(docSrc)) {
-                appendCStr_String(docSrc, "\n");
+            if (!original.start) {
+                original.start = line.start;
+            }
+            original.end = line.end;
+            if (size_Array(&d->lineTypes) - 1 > firstLine) {
+                appendCStr_String(partSrc, "\n");
             }
-            appendRange_String(docSrc, cleanLine);
+            appendRange_String(partSrc, cleanLine);
+            /* Parts end at paragraph breaks. */
+            if ((isEmpty_Range(&cleanLine) && size_String(partSrc) >= minPartSize_Translation_) ||
+                size_String(partSrc) >= maxPartSize_Translation_) {
+                addPart_Translation_(d, firstLine, original, partSrc);
+                clear_String(partSrc);
+                original  = iNullRange;
+                firstLine = size_Array(&d->lineTypes);
+            }
+        }
+        if (firstLine < size_Array(&d->lineTypes)) {
+            addPart_Translation_(d, firstLine, original, partSrc);
         }
     }
-    printf_Block(json,
-                 "{\"q\":\"%s\",\"source\":\"%s\",\"target\":\"%s\"}",
-                 cstrCollect_String(quote_String_(docSrc)),
-                 idFrom,
-                 idTo);
-    iBlock *msg = collect_Block(new_Block(0));
-    printf_Block(msg,
-                 "POST /translate HTTP/1.1\r\n"
-                 "Host: %s\r\n"
-                 "Connection: close\r\n"
-                 "Content-Type: application/json; charset=utf-8\r\n"
-                 "Content-Length: %zu\r\n\r\n",
-                 translationServiceHost,
-                 size_Block(json));
-    append_Block(msg, json);
-    setContent_TlsRequest(d->request, msg);
-    submit_TlsRequest(d->request);
     d->startTime = SDL_GetTicks();
     d->timer     = SDL_AddTimer(1000 / 30, animate_Translation_, d);
+    submitPending_Translation_(d);
 }
 
 static void setFailed_Translation_(iTranslation *d, const char *msg) {
@@ -360,70 +477,146 @@ static void setFailed_Translation_(iTranslation *d, const char *msg) {
     }
 }
 
-static iBool processResult_Translation_(iTranslation *d) {
-    SDL_RemoveTimer(d->timer);
-    d->timer = 0;
-    if (status_TlsRequest(d->request) == error_TlsRequestStatus) {
-        setFailed_Translation_(d, explosion_Icon "  ${dlg.translate.fail}");
+static void closeDialog_Translation_(iTranslation *d) {
+    if (d->timer) {
+        SDL_RemoveTimer(d->timer);
+        d->timer = 0;
+    }
+    if (d->dlg) {
+        setupSheetTransition_Mobile(d->dlg, iFalse);
+        destroy_Widget(d->dlg);
+        d->dlg = NULL;
+    }
+}
+
+static void abort_Translation_(iTranslation *d, const char *msg) {
+    cancel_Translation_(d);
+    d->isAborted = iTrue;
+    if (d->timer) {
+        SDL_RemoveTimer(d->timer);
+        d->timer = 0;
+    }
+    if (msg) {
+        setFailed_Translation_(d, msg);
+    }
+}
+
+static iBool processResult_Translation_(iTranslation *d, iTranslationPart *part) {
+    if (status_TlsRequest(part->request) == error_TlsRequestStatus) {
         return iFalse;
     }
-    iBlock *resultData = collect_Block(readAll_TlsRequest(d->request));
+    iBlock *resultData = collect_Block(readAll_TlsRequest(part->request));
 //    printf("result(%zu):\n%s\n", size_Block(resultData), cstr_Block(resultData));
 //    fflush(stdout);
     iRegExp *pattern = iClob(new_RegExp(".*translatedText\":\"(.*)\"\\}", caseSensitive_RegExpOption));
     iRegExpMatch m;
     init_RegExpMatch(&m);
-    if (matchRange_RegExp(pattern, range_Block(resultData), &m)) {
-        iString *translation = unquote_String_(collect_String(captured_RegExpMatch(&m, 1)));
-        iString *marked = collectNew_String();
-        iRangecc line = iNullRange;
-        size_t lineIndex = 0;
-        while (nextSplit_Rangecc(range_String(translation), "\n", &line)) {
-            iRangecc cleanLine = trimmed_Rangecc(line);
-            if (!isEmpty_String(marked)) {
-                appendCStr_String(marked, "\n");
-            }
-            if (lineIndex < size_Array(&d->lineTypes)) {
-                switch (value_Array(&d->lineTypes, lineIndex, int)) {
-                    case bullet_GmLineType:
-                        appendCStr_String(marked, "* ");
-                        break;
-                    case link_GmLineType:
-                        appendCStr_String(marked, "=> ");
-                        break;
-                    case quote_GmLineType:
-                        appendCStr_String(marked, "> ");
-                        break;
-                    case preformatted_GmLineType:
-                        appendCStr_String(marked, "```");
-                        break;
-                    case heading1_GmLineType:
-                        appendCStr_String(marked, "# ");
-                        break;
-                    case heading2_GmLineType:
-                        appendCStr_String(marked, "## ");
-                        break;
-                    case heading3_GmLineType:
-                        appendCStr_String(marked, "### ");
-                        break;
-                    default:
-                        break;
-                }
+    if (!matchRange_RegExp(pattern, range_Block(resultData), &m)) {
+        return iFalse;
+    }
+    iString *translation = unquote_String_(collect_String(captured_RegExpMatch(&m, 1)));
+    iString *marked    = &part->text;
+    iRangecc line      = iNullRange;
+    size_t   lineIndex = part->firstLine;
+    clear_String(marked);
+    while (nextSplit_Rangecc(range_String(translation), "\n", &line)) {
+        iRangecc cleanLine = trimmed_Rangecc(line);
+        if (lineIndex < size_Array(&d->lineTypes)) {
+            switch (value_Array(&d->lineTypes, lineIndex, int)) {
+                case bullet_GmLineType:
+                    appendCStr_String(marked, "* ");
+                    break;
+                case link_GmLineType:
+                    appendCStr_String(marked, "=> ");
+                    break;
+                case quote_GmLineType:
+                    appendCStr_String(marked, "> ");
+                    break;
+                case preformatted_GmLineType:
+                    appendCStr_String(marked, "```");
+                    break;
+                case heading1_GmLineType:
+                    appendCStr_String(marked, "# ");
+                    break;
+                case heading2_GmLineType:
+                    appendCStr_String(marked, "## ");
+                    break;
+                case heading3_GmLineType:
+                    appendCStr_String(marked, "### ");
+                    break;
+                default:
+                    break;
             }
-            appendRange_String(marked, cleanLine);
-            lineIndex++;
         }
-        setSource_DocumentWidget(d->doc, marked);
-        postCommand_App("sidebar.update");
-        delete_String(translation);
-    }
-    else {
-        setFailed_Translation_(d, unhappy_Icon "  ${dlg.translate.unavail}");
-        return iFalse;
+        appendRange_String(marked, cleanLine);
+        appendCStr_String(marked, "\n");
+        lineIndex++;
     }
+    delete_String(translation);
     return iTrue;
 }
 
+static void splice_Translation_(iTranslation *d) {
+    size_t numDone   = 0;
+    size_t numFailed = 0;
+    iConstForEach(Array, i, &d->parts) {
+        const iTranslationPart *part = i.value;
+        if (part->status == finished_TranslationPartStatus) {
+            numDone++;
+        }
+        else if (part->status == failed_TranslationPartStatus) {
+            numDone++;
+            numFailed++;
+        }
+    }
+    if (numDone == d->numSpliced) {
+        return; /* nothing new to show */
+    }
+    d->numSpliced = numDone;
+    if (document_DocumentWidget(d->doc) != d->target) {
+        abort_Translation_(d, NULL); /* user has moved on to another page */
+        return;
+    }
+    clear_String(&d->marked);
+    /* A note at the top tells if the page is still being translated or if some parts
+       are left in the original language. */
+    if (numDone < size_Array(&d->parts)) {
+        appendFormat_String(&d->marked,
+                            "> " hourglass_Icon " %s\n\n",
+                            format_Lang("${dlg.translate.progress}",
+                                        (unsigned) (numDone - numFailed),
+                                        (unsigned) size_Array(&d->parts)));
+    }
+    else if (numFailed) {
+        appendFormat_String(&d->marked,
+                            "> " warning_Icon " %s\n\n",
+                            cstr_Lang("dlg.translate.partial"));
+    }
+    iConstForEach(Array, j, &d->parts) {
+        const iTranslationPart *part = j.value;
+        if (part->status == finished_TranslationPartStatus) {
+            append_String(&d->marked, &part->text);
+        }
+        else {
+            appendRange_String(&d->marked, part->original);
+            appendCStr_String(&d->marked, "\n");
+        }
+    }
+    setSource_DocumentWidget(d->doc, &d->marked);
+    postCommand_App("sidebar.update");
+    closeDialog_Translation_(d); /* first part is visible */
+}
+
+static iTranslationPart *findPart_Translation_(iTranslation *d, const iTlsRequest *request) {
+    iForEach(Array, i, &d->parts) {
+        iTranslationPart *part = i.value;
+        if (part->request == request) {
+            return part;
+        }
+    }
+    return NULL;
+}
+
 static iLabelWidget *acceptButton_Translation_(const iTranslation *d) {
     return dialogAcceptButton_Widget(d->dlg);
 }
@@ -431,7 +624,7 @@ static iLabelWidget *acceptButton_Translation_(const iTranslation *d) {
 iBool handleCommand_Translation(iTranslation *d, const char *cmd) {
     iWidget *w = as_Widget(d->doc);
     if (equalWidget_Command(cmd, w, "translation.submit")) {
-        if (status_TlsRequest(d->request) == initialized_TlsRequestStatus) {
+        if (isEmpty_Array(&d->parts)) {
             iWidget *langs = findChild_Widget(d->dlg, "xlt.langs");
             if (langs) {
                 setFlags_Widget(langs, hidden_WidgetFlag, iTrue);
@@ -452,6 +645,9 @@ iBool handleCommand_Translation(iTranslation *d, const char *cmd) {
         return iTrue;
     }
     if (equalWidget_Command(cmd, w, "translation.update")) {
+        if (!d->dlg) {
+            return iTrue; /* already showing the translation */
+        }
         const uint32_t elapsed = SDL_GetTicks() - d->startTime;
         const unsigned seconds = (elapsed / 1000) % 60;
         const unsigned minutes = (elapsed / 60000);
@@ -460,28 +656,38 @@ iBool handleCommand_Translation(iTranslation *d, const char *cmd) {
         return iTrue;
     }
     if (equalWidget_Command(cmd, w, "translation.finished")) {
-        if (!isFinished_Translation(d)) {
-            if (processResult_Translation_(d)) {
-                setupSheetTransition_Mobile(d->dlg, iFalse);
-                destroy_Widget(d->dlg);
-                d->dlg = NULL;
+        iTranslationPart *part = findPart_Translation_(d, pointerLabel_Command(cmd, "req"));
+        if (!d->isAborted && part && part->status == submitted_TranslationPartStatus) {
+            if (processResult_Translation_(d, part)) {
+                part->status = finished_TranslationPartStatus;
+            }
+            else if (d->dlg) {
+                /* Nothing has been shown yet. */
+                part->status = failed_TranslationPartStatus;
+                abort_Translation_(d,
+                                   status_TlsRequest(part->request) == error_TlsRequestStatus
+                                       ? explosion_Icon "  ${dlg.translate.fail}"
+                                       : unhappy_Icon "  ${dlg.translate.unavail}");
+                return iTrue;
+            }
+            else {
+                part->status = failed_TranslationPartStatus; /* keeps the original text */
             }
+            submitPending_Translation_(d);
+            splice_Translation_(d);
         }
         return iTrue;
     }
     if (equalWidget_Command(cmd, d->dlg, "translation.cancel")) {
-        if (status_TlsRequest(d->request) == submitted_TlsRequestStatus) {
-            setFailed_Translation_(d, "Cancelled");
+        if (isRunning_Translation_(d)) {
+            abort_Translation_(d, "Cancelled");
             updateTextCStr_LabelWidget(
                 findMenuItem_Widget(findChild_Widget(d->dlg, "dialogbuttons"),
                                     "translation.cancel"),
                 "${close}");
-            cancel_TlsRequest(d->request);
         }
         else {
-            setupSheetTransition_Mobile(d->dlg, iFalse);
-            destroy_Widget(d->dlg);
-            d->dlg = NULL;
+            closeDialog_Translation_(d);
         }
         return iTrue;
     }
@@ -489,5 +695,5 @@ iBool handleCommand_Translation(iTranslation *d, const char *cmd) {
 }
 
 iBool isFinished_Translation(const iTranslation *d) {
-    return d->dlg == NULL;
+    return d->dlg == NULL && (d->isAborted || d->numSpliced == size_Array(&d->parts));
 }
@@ -27,16 +27,25 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include <the_Foundation/tlsrequest.h>
 
 iDeclareType(Translation)
+iDeclareType(TranslationPart)
 iDeclareType(DocumentWidget)
+iDeclareType(GmDocument)
 iDeclareType(Widget)
 
 struct Impl_Translation {
-    iTlsRequest *    request;
     iWidget *        dlg;
     uint32_t         startTime;
     iDocumentWidget *doc;
+    iGmDocument *    target; /* the document being translated */
     int              timer;
+    iBool            isAborted;
     iArray           lineTypes;
+    iArray           parts; /* TranslationPart, in document order */
+    size_t           numSpliced; /* parts finished or failed as of the last update of `marked` */
+    iString          langFrom;
+    iString          langTo;
+    iString          source;
+    iString          marked; /* document with the translated parts spliced in */
 };
 
 iDeclareTypeConstructionArgs(Translation, iDocumentWidget *)
@@ -496,19 +496,16 @@ static iBool processEvent_UploadWidget_(iUploadWidget *d, const SDL_Event *ev) {
         }
         else {
             /* Uploading a file. */
-            iFile *f = iClob(new_File(&d->filePath));
-            if (!open_File(f, readOnly_FileMode)) {
+            if (!setTitanFile_GmRequest(d->request,
+                                        text_InputWidget(d->mime),
+                                        &d->filePath,
+                                        text_InputWidget(d->token))) {
                 makeMessage_Widget("${heading.upload.error.file}",
                                    "${upload.error.msg}",
                                    (iMenuItem[]){ "${dlg.message.ok}", 0, 0, "message.ok" }, 1);
                 iReleasePtr(&d->request);
                 return iTrue;
             }
-            setTitanData_GmRequest(d->request,
-                                   text_InputWidget(d->mime),
-                                   collect_Block(readAll_File(f)),
-                                   text_InputWidget(d->token));
-            close_File(f);
         }
 //        iConnect(GmRequest, d->request, updated,  d, requestUpdated_UploadWidget_);
         iConnect(GmRequest, d->request, finished, d, requestFinished_UploadWidget_);
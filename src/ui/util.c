@@ -514,6 +514,12 @@ float pos_SmoothScroll(const iSmoothScroll *d) {
     return value_Anim(&d->pos) - overscroll_SmoothScroll_(d) * 0.667f;
 }
 
+int predictedTarget_SmoothScroll(const iSmoothScroll *d) {
+    /* Touch momentum arrives as per-pixel wheel events, where positive Y scrolls up. */
+    const int target = targetValue_Anim(&d->pos) - momentumTarget_Touch(d->widget).y;
+    return iClamp(target, 0, d->max);
+}
+
 iBool isFinished_SmoothScroll(const iSmoothScroll *d) {
     return isFinished_Anim(&d->pos);
 }
@@ -1182,7 +1188,7 @@ void closeMenu_Widget(iWidget *d) {
         addChild_Widget(originalParent, d);
         setFlags_Widget(d, keepOnTop_WidgetFlag, iTrue);
         SDL_HideWindow(win->win);
-        collect_Garbage(win, (iDeleteFunc) delete_Window); /* get rid of it after event processing */
+        collect_Garbage(win, (iDeleteFunc) recyclePopup_Window); /* after event processing */
     }
     setFlags_Widget(d, hidden_WidgetFlag, iTrue);
     setFlags_Widget(findChild_Widget(d, "menu.cancel"), disabled_WidgetFlag, iTrue);
@@ -1372,6 +1378,7 @@ iWidget *makeTabs_Widget(iWidget *parent) {
                         arrangeHeight_WidgetFlag,
                     iTrue);
     setId_Widget(buttons, "tabs.buttons");
+    setDrawBufferEnabled_Widget(buttons, iTrue);
     iWidget *content = addChildFlags_Widget(tabs, iClob(makeHDiv_Widget()), expand_WidgetFlag);
     setId_Widget(content, "tabs.content");
     iWidget *pages = addChildFlags_Widget(
@@ -1574,6 +1581,9 @@ void useSheetStyle_Widget(iWidget *d) {
                         keepOnTop_WidgetFlag | arrangeVertical_WidgetFlag | arrangeSize_WidgetFlag |
                         centerHorizontal_WidgetFlag | overflowScrollable_WidgetFlag,
                     iTrue);
+    if (deviceType_App() == desktop_AppDeviceType) {
+        setDrawBufferEnabled_Widget(d, iTrue); /* mobile panels are buffered separately */
+    }
 }
 
 static void acceptValueInput_(iWidget *dlg) {
@@ -2418,9 +2428,12 @@ iWidget *makePreferences_Widget(void) {
         const iMenuItem networkPanelItems[] = {
             { "title id:heading.prefs.network" },
             { "toggle id:prefs.decodeurls" },
+            { "toggle id:prefs.prefetchlinks" },
             { "padding" },
             { "input id:prefs.cachesize maxlen:4 selectall:1 unit:mb" },
             { "input id:prefs.memorysize maxlen:4 selectall:1 unit:mb" },
+            { "input id:prefs.hibernate maxlen:3 selectall:1 unit:min" },
+            { "input id:prefs.mirrordepth maxlen:1 selectall:1" },
             { "heading text:${prefs.proxy.gemini}" },
             { "input id:prefs.proxy.gemini noheading:1" },
             { "heading text:${prefs.proxy.gopher}" },
@@ -2747,6 +2760,8 @@ iWidget *makePreferences_Widget(void) {
         appendTwoColumnTabPage_Widget(tabs, "${heading.prefs.network}", '6', &headings, &values);
         addChild_Widget(headings, iClob(makeHeading_Widget("${prefs.decodeurls}")));
         addChild_Widget(values, iClob(makeToggle_Widget("prefs.decodeurls")));
+        addChild_Widget(headings, iClob(makeHeading_Widget("${prefs.prefetchlinks}")));
+        addChild_Widget(values, iClob(makeToggle_Widget("prefs.prefetchlinks")));
         /* Cache size. */ {
             iInputWidget *cache = new_InputWidget(4);
             setSelectAllOnFocus_InputWidget(cache, iTrue);
@@ -2769,6 +2784,22 @@ iWidget *makePreferences_Widget(void) {
                                          resizeToParentHeight_WidgetFlag);
             setContentPadding_InputWidget(mem, 0, width_Widget(unit) - 4 * gap_UI);
         }
+        /* Tab hibernation. */ {
+            iInputWidget *hib = new_InputWidget(3);
+            setSelectAllOnFocus_InputWidget(hib, iTrue);
+            addPrefsInputWithHeading_(headings, values, "prefs.hibernate", iClob(hib));
+            iWidget *unit =
+                addChildFlags_Widget(as_Widget(hib),
+                                     iClob(new_LabelWidget("${min}", NULL)),
+                                     frameless_WidgetFlag | moveToParentRightEdge_WidgetFlag |
+                                         resizeToParentHeight_WidgetFlag);
+            setContentPadding_InputWidget(hib, 0, width_Widget(unit) - 4 * gap_UI);
+        }
+        /* Offline mirroring. */ {
+            iInputWidget *depth = new_InputWidget(1);
+            setSelectAllOnFocus_InputWidget(depth, iTrue);
+            addPrefsInputWithHeading_(headings, values, "prefs.mirrordepth", iClob(depth));
+        }
         makeTwoColumnHeading_("${heading.prefs.certs}", headings, values);
         addPrefsInputWithHeading_(headings, values, "prefs.ca.file", iClob(new_InputWidget(0)));
         addPrefsInputWithHeading_(headings, values, "prefs.ca.path", iClob(new_InputWidget(0)));
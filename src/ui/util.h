@@ -196,6 +196,7 @@ void    moveSpan_SmoothScroll       (iSmoothScroll *, int offset, uint32_t span)
 iBool   processEvent_SmoothScroll   (iSmoothScroll *, const SDL_Event *ev);
 
 float   pos_SmoothScroll            (const iSmoothScroll *);
+int     predictedTarget_SmoothScroll(const iSmoothScroll *); /* where ongoing motion ends */
 iBool   isFinished_SmoothScroll     (const iSmoothScroll *);
 
 /*-----------------------------------------------------------------------------------------------*/
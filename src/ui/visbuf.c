@@ -21,16 +21,28 @@ ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY, OR TORT
 SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "visbuf.h"
+#include "paint.h"
 #include "window.h"
 #include "util.h"
 
+#include <SDL_timer.h>
+
 iDefineTypeConstruction(VisBuf)
 
+static const float fastSpeed_VisBuf_ = 4.0f; /* buffer heights per second */
+
 void init_VisBuf(iVisBuf *d) {
     d->texSize = zero_I2();
+    d->numBuffers = minBuffers_VisBuf;
     iZap(d->buffers);
     iZap(d->vis);
     d->bufferInvalidated = NULL;
+    d->isAdaptive   = iFalse;
+    d->moveDir      = 0;
+    d->lastMoveTime = 0;
+    d->speed        = 0.0f;
+    d->numHits      = 0;
+    d->numMisses    = 0;
 }
 
 void deinit_VisBuf(iVisBuf *d) {
@@ -39,7 +51,7 @@ void deinit_VisBuf(iVisBuf *d) {
 
 void invalidate_VisBuf(iVisBuf *d) {
     int origin = iMax(0, d->vis.start - d->texSize.y);
-    iForIndices(i, d->buffers) {
+    for (size_t i = 0; i < d->numBuffers; i++) {
         d->buffers[i].origin = origin;
         origin += d->texSize.y;
         iZap(d->buffers[i].validRange);
@@ -49,23 +61,41 @@ void invalidate_VisBuf(iVisBuf *d) {
     }
 }
 
+void invalidateFrom_VisBuf(iVisBuf *d, int y) {
+    for (size_t i = 0; i < d->numBuffers; i++) {
+        iRangei *valid = &d->buffers[i].validRange;
+        if (valid->end > y) {
+            valid->end = iMax(valid->start, y);
+            if (isEmpty_Rangei(*valid)) {
+                iZap(*valid);
+                if (d->bufferInvalidated) {
+                    d->bufferInvalidated(d, i);
+                }
+            }
+        }
+    }
+}
+
+static SDL_Texture *newTexture_VisBuf_(const iVisBuf *d) {
+    SDL_Texture *tex = SDL_CreateTexture(renderer_Window(get_Window()),
+                                         SDL_PIXELFORMAT_RGBA8888,
+                                         SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
+                                         d->texSize.x,
+                                         d->texSize.y);
+    SDL_SetTextureBlendMode(tex, SDL_BLENDMODE_NONE);
+    return tex;
+}
+
 void alloc_VisBuf(iVisBuf *d, const iInt2 size, int granularity) {
     const iInt2 texSize = init_I2(size.x, (size.y / 2 / granularity + 1) * granularity);
     if (!d->buffers[0].texture || !isEqual_I2(texSize, d->texSize)) {
         d->texSize = texSize;
-        iForIndices(i, d->buffers) {
+        for (size_t i = 0; i < d->numBuffers; i++) {
             iVisBufTexture *tex = &d->buffers[i];
             if (tex->texture) {
                 SDL_DestroyTexture(tex->texture);
             }
-            SDL_Renderer *rend = renderer_Window(get_Window());
-            tex->texture =
-                SDL_CreateTexture(rend,
-                                  SDL_PIXELFORMAT_RGBA8888,
-                                  SDL_TEXTUREACCESS_STATIC | SDL_TEXTUREACCESS_TARGET,
-                                  texSize.x,
-                                  texSize.y);
-            SDL_SetTextureBlendMode(tex->texture, SDL_BLENDMODE_NONE);
+            tex->texture = newTexture_VisBuf_(d);
         }
         invalidate_VisBuf(d);
     }
@@ -77,10 +107,91 @@ void dealloc_VisBuf(iVisBuf *d) {
         SDL_DestroyTexture(d->buffers[i].texture);
         d->buffers[i].texture = NULL;
     }
+    d->numBuffers = minBuffers_VisBuf;
+}
+
+static void grow_VisBuf_(iVisBuf *d, int dir) {
+    /* A new buffer is added ahead of the others in the direction of motion. */
+    iAssert(d->numBuffers < maxBuffers_VisBuf);
+    iVisBufTexture added = d->buffers[d->numBuffers];
+    added.texture = newTexture_VisBuf_(d);
+    iZap(added.validRange);
+    size_t pos = d->numBuffers;
+    if (dir < 0) {
+        memmove(d->buffers + 1, d->buffers, sizeof(iVisBufTexture) * d->numBuffers);
+        added.origin = d->buffers[1].origin - d->texSize.y;
+        pos = 0;
+    }
+    else {
+        added.origin = d->buffers[pos - 1].origin + d->texSize.y;
+    }
+    d->buffers[pos] = added;
+    d->numBuffers++;
+    if (d->bufferInvalidated) {
+        d->bufferInvalidated(d, pos);
+    }
+}
+
+void shrink_VisBuf(iVisBuf *d) {
+    /* Buffers farthest from the visible range are released first. */
+    while (d->numBuffers > minBuffers_VisBuf) {
+        const size_t   last   = d->numBuffers - 1;
+        const int      above  = d->vis.start - d->buffers[0].origin;
+        const int      below  = d->buffers[last].origin + d->texSize.y - d->vis.end;
+        iVisBufTexture removed;
+        if (above > below) {
+            removed = d->buffers[0];
+            memmove(d->buffers, d->buffers + 1, sizeof(iVisBufTexture) * last);
+        }
+        else {
+            removed = d->buffers[last];
+        }
+        SDL_DestroyTexture(removed.texture);
+        removed.texture = NULL;
+        iZap(removed.validRange);
+        d->buffers[last] = removed; /* keeps its `user` data for reuse */
+        d->numBuffers--;
+    }
+}
+
+uint32_t idleTime_VisBuf(const iVisBuf *d) {
+    return SDL_GetTicks() - d->lastMoveTime;
+}
+
+size_t memorySize_VisBuf(const iVisBuf *d) {
+    size_t numTextures = 0;
+    iForIndices(i, d->buffers) {
+        if (d->buffers[i].texture) {
+            numTextures++;
+        }
+    }
+    return numTextures * (size_t) d->texSize.x * d->texSize.y * 4; /* RGBA8888 */
+}
+
+void countAccess_VisBuf(iVisBuf *d, iBool wasValid) {
+    if (wasValid) {
+        d->numHits++;
+    }
+    else {
+        d->numMisses++;
+    }
+}
+
+static void updateSpeed_VisBuf_(iVisBuf *d, const iRangei vis) {
+    const uint32_t now = SDL_GetTicks();
+    const uint32_t elapsed = now - d->lastMoveTime;
+    const float    moved   = iAbs(vis.start - d->vis.start);
+    if (elapsed > 0 && elapsed < 500) {
+        d->speed = 0.5f * d->speed + 0.5f * (1000.0f * moved / elapsed);
+    }
+    else if (elapsed > 0) {
+        d->speed = 0.0f; /* motion started after a pause */
+    }
+    d->lastMoveTime = now;
 }
 
 static void roll_VisBuf_(iVisBuf *d, int dir) {
-    const size_t lastPos = iElemCount(d->buffers) - 1;
+    const size_t lastPos = d->numBuffers - 1;
     if (dir < 0) {
         /* Last buffer is moved to the beginning. */
         SDL_Texture *last = d->buffers[lastPos].texture;
@@ -114,9 +225,16 @@ iBool reposition_VisBuf(iVisBuf *d, const iRangei vis) {
         return iFalse;
     }
     const int moveDir = vis.end > d->vis.end ? +1 : -1;
+    updateSpeed_VisBuf_(d, vis);
+    d->moveDir = moveDir;
     d->vis = vis;
     iBool wasChanged = iFalse;
-    const size_t lastPos = iElemCount(d->buffers) - 1;
+    if (d->isAdaptive && d->texSize.y > 0 && d->buffers[0].texture &&
+        d->numBuffers < maxBuffers_VisBuf && d->speed > fastSpeed_VisBuf_ * d->texSize.y) {
+        /* Fast scrolling needs more room ahead. */
+        grow_VisBuf_(d, moveDir);
+    }
+    const size_t lastPos = d->numBuffers - 1;
     if (d->buffers[0].origin > vis.end || d->buffers[lastPos].origin + d->texSize.y <= vis.start) {
         /* All buffers outside the visible region. */
         invalidate_VisBuf(d);
@@ -148,7 +266,7 @@ iBool reposition_VisBuf(iVisBuf *d, const iRangei vis) {
 #if 0
     if (wasChanged) {
         printf("\nVISIBLE RANGE: %d ... %d\n", vis.start, vis.end);
-        iForIndices(i, d->buffers) {
+        for (size_t i = 0; i < d->numBuffers; i++) {
             const iVisBufTexture *bt = &d->buffers[i];
             printf(" %zu: buf %5d ... %5d  valid %5d ... %5d\n", i, bt->origin,
                    bt->origin + d->texSize.y,
@@ -160,9 +278,9 @@ iBool reposition_VisBuf(iVisBuf *d, const iRangei vis) {
 #endif
 #if !defined (NDEBUG)
     /* Buffers must not overlap. */
-    iForIndices(m, d->buffers) {
+    for (size_t m = 0; m < d->numBuffers; m++) {
         const iRangei M = { d->buffers[m].origin, d->buffers[m].origin + d->texSize.y };
-        iForIndices(n, d->buffers) {
+        for (size_t n = 0; n < d->numBuffers; n++) {
             if (m == n) continue;
             const iRangei N = { d->buffers[n].origin, d->buffers[n].origin + d->texSize.y };
             const iRangei is = intersect_Rangei(M, N);
@@ -180,7 +298,7 @@ iBool reposition_VisBuf(iVisBuf *d, const iRangei vis) {
 
 iRangei allocRange_VisBuf(const iVisBuf *d) {
     return (iRangei){ d->buffers[0].origin,
-                      d->buffers[iElemCount(d->buffers) - 1].origin + d->texSize.y };
+                      d->buffers[d->numBuffers - 1].origin + d->texSize.y };
 }
 
 iRangei bufferRange_VisBuf(const iVisBuf *d, size_t index) {
@@ -188,7 +306,7 @@ iRangei bufferRange_VisBuf(const iVisBuf *d, size_t index) {
 }
 
 void invalidRanges_VisBuf(const iVisBuf *d, const iRangei full, iRangei *out_invalidRanges) {
-    iForIndices(i, d->buffers) {
+    for (size_t i = 0; i < d->numBuffers; i++) {
         const iVisBufTexture *buf = d->buffers + i;
         const iRangei before = { full.start, buf->validRange.start };
         const iRangei after  = { buf->validRange.end, full.end };
@@ -201,8 +319,21 @@ void invalidRanges_VisBuf(const iVisBuf *d, const iRangei full, iRangei *out_inv
     }
 }
 
+void predict_VisBuf(iVisBuf *d, int remaining) {
+    /* The scroll animation knows where the motion will end, so the buffers ahead can be
+       prepared before the measured speed catches up. */
+    if (remaining == 0) {
+        return;
+    }
+    d->moveDir = remaining > 0 ? +1 : -1;
+    if (d->isAdaptive && d->texSize.y > 0 && d->buffers[0].texture &&
+        d->numBuffers < maxBuffers_VisBuf && iAbs(remaining) > d->texSize.y) {
+        grow_VisBuf_(d, d->moveDir);
+    }
+}
+
 void validate_VisBuf(iVisBuf *d) {
-    iForIndices(i, d->buffers) {
+    for (size_t i = 0; i < d->numBuffers; i++) {
         iVisBufTexture *buf = &d->buffers[i];
         buf->validRange =
             intersect_Rangei(d->vis, (iRangei){ buf->origin, buf->origin + d->texSize.y });
@@ -213,13 +344,15 @@ void validate_VisBuf(iVisBuf *d) {
 
 void draw_VisBuf(const iVisBuf *d, const iInt2 topLeft, const iRangei yClipBounds) {
     SDL_Renderer *render = renderer_Window(get_Window());
-    iForIndices(i, d->buffers) {
+    /* The owner may be drawn inside a widget draw buffer. */
+    const iRangei yClip = { yClipBounds.start + origin_Paint.y, yClipBounds.end + origin_Paint.y };
+    for (size_t i = 0; i < d->numBuffers; i++) {
         const iVisBufTexture *buf = d->buffers + i;
-        SDL_Rect dst = { topLeft.x,
-                         topLeft.y + buf->origin,
+        SDL_Rect dst = { topLeft.x + origin_Paint.x,
+                         topLeft.y + origin_Paint.y + buf->origin,
                          d->texSize.x,
                          d->texSize.y };
-        if (dst.y >= yClipBounds.end || dst.y + dst.h < yClipBounds.start) {
+        if (dst.y >= yClip.end || dst.y + dst.h < yClip.start) {
 #if !defined (DEBUG_SCALE)
             continue; /* Outside the clipping area. */
 #endif
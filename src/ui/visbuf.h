@@ -36,23 +36,41 @@ struct Impl_VisBufTexture {
     void *user;
 };
 
-#define numBuffers_VisBuf   ((size_t) 4)
+#define minBuffers_VisBuf   ((size_t) 4)
+#define maxBuffers_VisBuf   ((size_t) 8)
 
+/* Buffers are ordered by `origin`. Only the first `numBuffers` are in use. An adaptive VisBuf
+   gets more buffers in the direction of motion when scrolling fast, and releases them with
+   `shrink_VisBuf()` when idle. */
 struct Impl_VisBuf {
     iInt2 texSize;
     iRangei vis;
-    iVisBufTexture buffers[numBuffers_VisBuf];
+    size_t numBuffers;
+    iVisBufTexture buffers[maxBuffers_VisBuf];
     void (*bufferInvalidated)(iVisBuf *, size_t index);
+    iBool isAdaptive;
+    int moveDir;
+    uint32_t lastMoveTime; /* SDL ticks */
+    float speed; /* pixels per second, smoothed */
+    /* Statistics: */
+    uint32_t numHits; /* visible buffers that were already valid when drawn */
+    uint32_t numMisses; /* visible buffers that had to be drawn first */
 };
 
 iDeclareTypeConstruction(VisBuf)
 
 void    invalidate_VisBuf       (iVisBuf *);
+void    invalidateFrom_VisBuf   (iVisBuf *, int y); /* contents below `y` have changed */
 void    alloc_VisBuf            (iVisBuf *, const iInt2 size, int granularity);
 void    dealloc_VisBuf          (iVisBuf *);
 iBool   reposition_VisBuf       (iVisBuf *, const iRangei vis); /* returns true if `vis` changes */
+void    predict_VisBuf          (iVisBuf *, int remaining); /* scroll distance still ahead */
 void    validate_VisBuf         (iVisBuf *);
+void    shrink_VisBuf           (iVisBuf *); /* release extra buffers */
+void    countAccess_VisBuf      (iVisBuf *, iBool wasValid);
 
+uint32_t idleTime_VisBuf        (const iVisBuf *); /* milliseconds since last move */
+size_t  memorySize_VisBuf       (const iVisBuf *); /* bytes of texture memory */
 iRangei allocRange_VisBuf       (const iVisBuf *);
 iRangei bufferRange_VisBuf      (const iVisBuf *, size_t index);
 void    invalidRanges_VisBuf    (const iVisBuf *, const iRangei full, iRangei *out_invalidRanges);
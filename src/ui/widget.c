@@ -24,6 +24,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "app.h"
 #include "periodic.h"
+#include "profiler.h"
 #include "touch.h"
 #include "command.h"
 #include "paint.h"
@@ -45,15 +46,19 @@ struct Impl_WidgetDrawBuffer {
     SDL_Texture *texture;
     iInt2        size;
     iBool        isValid;
-    SDL_Texture *oldTarget;
+    uint32_t     layoutHash; /* children's geometry and flags when drawn */
+    iRenderTarget oldTarget;
     iInt2        oldOrigin;
+    iRect        oldDrawClip;
 };
 
 static void init_WidgetDrawBuffer(iWidgetDrawBuffer *d) {
-    d->texture   = NULL;
-    d->size      = zero_I2();
-    d->isValid   = iFalse;
-    d->oldTarget = NULL;
+    d->texture    = NULL;
+    d->size       = zero_I2();
+    d->isValid    = iFalse;
+    d->layoutHash = 0;
+    iZap(d->oldTarget);
+    d->oldDrawClip = zero_Rect();
 }
 
 static void deinit_WidgetDrawBuffer(iWidgetDrawBuffer *d) {
@@ -95,9 +100,69 @@ static iRect boundsForDraw_Widget_(const iWidget *d) {
     return bounds;
 }
 
+static iRect damageBounds_Widget_(const iWidget *d) {
+    /* Area affected by drawing the widget, including layer effects. */
+    iRect bounds = boundsForDraw_Widget_(d);
+    if (d->flags & keepOnTop_WidgetFlag) {
+        if (d->flags & mouseModal_WidgetFlag) {
+            return rect_Root(d->root); /* may fade the background */
+        }
+        bounds = expanded_Rect(bounds, init1_I2(12 * gap_UI)); /* soft shadow */
+    }
+    return bounds;
+}
+
+static void markDrawn_Widget_(const iWidget *d) {
+    iConstCast(iWidget *, d)->drawnRect = damageBounds_Widget_(d);
+}
+
+static uint32_t treeGeneration_Widget_ = 1; /* changed when hit test geometry may be affected */
+
+iLocalDef void treeChanged_Widget_(void) {
+    treeGeneration_Widget_++;
+}
+
+iLocalDef uint32_t mixHash_Widget_(uint32_t hash, uint32_t value) {
+    return (hash ^ value) * 16777619u; /* FNV-1a */
+}
+
+static uint32_t layoutHash_Widget_(const iWidget *d, uint32_t hash) {
+    /* Changes in the children's flags, positions, or sizes invalidate a draw buffer,
+       even if the children themselves did not ask for a refresh. */
+    iConstForEach(ObjectList, i, d->children) {
+        const iWidget *child = constAs_Widget(i.object);
+        hash = mixHash_Widget_(hash, (uint32_t) child->flags);
+        hash = mixHash_Widget_(hash, (uint32_t) (child->flags >> 32));
+        if (child->flags & hidden_WidgetFlag) {
+            continue;
+        }
+        hash = mixHash_Widget_(hash, (uint32_t) child->rect.pos.x);
+        hash = mixHash_Widget_(hash, (uint32_t) child->rect.pos.y);
+        hash = mixHash_Widget_(hash, (uint32_t) child->rect.size.x);
+        hash = mixHash_Widget_(hash, (uint32_t) child->rect.size.y);
+        if (child->flags & visualOffset_WidgetFlag) {
+            hash = mixHash_Widget_(hash, (uint32_t) iRound(value_Anim(&child->visualOffset)));
+        }
+        hash = layoutHash_Widget_(child, hash);
+    }
+    return hash;
+}
+
+static iBool fitsDrawBuffer_Widget_(const iWidget *d) {
+    const iInt2 size    = boundsForDraw_Widget_(d).size;
+    const iInt2 maxSize = maxTextureSize_Window(window_Widget(d));
+    return size.x > 0 && size.y > 0 && size.x <= maxSize.x && size.y <= maxSize.y;
+}
+
 static iBool checkDrawBuffer_Widget_(const iWidget *d) {
-    return d->drawBuf && d->drawBuf->isValid &&
-           isEqual_I2(d->drawBuf->size, boundsForDraw_Widget_(d).size);
+    if (!d->drawBuf) {
+        return iFalse;
+    }
+    const uint32_t hash    = layoutHash_Widget_(d, 2166136261u);
+    const iBool    isValid = d->drawBuf->isValid && d->drawBuf->layoutHash == hash &&
+                             isEqual_I2(d->drawBuf->size, boundsForDraw_Widget_(d).size);
+    d->drawBuf->layoutHash = hash;
+    return isValid;
 }
 
 /*----------------------------------------------------------------------------------------------*/
@@ -114,6 +179,7 @@ void releaseChildren_Widget(iWidget *d) {
         }
     }
     iReleasePtr(&d->children);
+    treeChanged_Widget_();
 }
 
 iDefineObjectConstruction(Widget)
@@ -133,7 +199,9 @@ void init_Widget(iWidget *d) {
     d->parent         = NULL;
     d->commandHandler = NULL;
     d->drawBuf        = NULL;
+    d->drawnRect      = zero_Rect();
     iZap(d->padding);
+    iZap(d->arrangement);
 }
 
 static void visualOffsetAnimation_Widget_(void *ptr) {
@@ -168,6 +236,7 @@ void deinit_Widget(iWidget *d) {
     if (win->hover == d) {
         win->hover = NULL;
     }
+    treeChanged_Widget_();
     if (d->flags & nativeMenu_WidgetFlag) {
         releaseNativeMenu_Widget(d);
     }
@@ -224,7 +293,11 @@ void setFlags_Widget(iWidget *d, int64_t flags, iBool set) {
             /* TODO: Tablets should detect if a hardware keyboard is available. */
             flags &= ~drawKey_WidgetFlag;
         }
+        const int64_t oldFlags = d->flags;
         iChangeFlags(d->flags, flags, set);
+        if (d->flags != oldFlags) {
+            treeChanged_Widget_();
+        }
         if (flags & keepOnTop_WidgetFlag) {
             iPtrArray *onTop = onTop_Root(d->root);
             if (set) {
@@ -525,7 +598,115 @@ static void boundsOfChildren_Widget_(const iWidget *d, iRect *bounds_out) {
 #endif
 }
 
+static uint32_t arrangePass_Widget_  = 0;
+static int      arrangeDepth_Widget_ = 0;
+
+iLocalDef iBool isIncrementalArrangement_Widget_(void) {
+    /* Arrangements started inside an arrangement (e.g., from `sizeChanged`) are done fully. */
+    return arrangeDepth_Widget_ == 1;
+}
+
+static void resetChildren_Widget_(iWidget *d) {
+    d->arrangement.pass = arrangePass_Widget_;
+    iForEach(ObjectList, i, children_Widget(d)) {
+        iWidget *child = as_Widget(i.object);
+        if (isArrangedPos_Widget_(child)) {
+            if (d->flags & arrangeHorizontal_WidgetFlag) {
+                child->rect.pos.x = 0;
+            }
+            if (d->flags & resizeWidthOfChildren_WidgetFlag && child->flags & expand_WidgetFlag &&
+                ~child->flags & fixedWidth_WidgetFlag) {
+                child->rect.size.x = 0;
+            }
+            if (d->flags & arrangeVertical_WidgetFlag) {
+                child->rect.pos.y = 0;
+            }
+            if (d->flags & resizeHeightOfChildren_WidgetFlag && child->flags & expand_WidgetFlag &&
+                ~child->flags & fixedHeight_WidgetFlag) {
+                child->rect.size.y = 0;
+            }
+        }
+    }
+}
+
+static uint32_t updateArrangementHash_Widget_(iWidget *d, iBool isArranged) {
+    /* Everything in the subtree that affects arrangement, except the widget's own rect
+       that is determined by the parent. Referenced sizes are included, too. */
+    uint32_t hash = 2166136261u;
+    hash = mixHash_Widget_(hash, (uint32_t) d->flags);
+    hash = mixHash_Widget_(hash, (uint32_t) (d->flags >> 32));
+    for (int i = 0; i < 4; i++) {
+        hash = mixHash_Widget_(hash, (uint32_t) d->padding[i]);
+    }
+    hash = mixHash_Widget_(hash, (uint32_t) d->minSize.x);
+    hash = mixHash_Widget_(hash, (uint32_t) d->minSize.y);
+    if (d->sizeRef) {
+        /* The referenced widget may be outside this subtree. */
+        hash = mixHash_Widget_(hash, (uint32_t) (uintptr_t) d->sizeRef);
+        hash = mixHash_Widget_(hash, (uint32_t) height_Widget(d->sizeRef));
+    }
+    iForEach(ObjectList, i, d->children) {
+        iWidget *child = as_Widget(i.object);
+        hash = mixHash_Widget_(hash, (uint32_t) (uintptr_t) child);
+        hash = mixHash_Widget_(hash, (uint32_t) child->rect.pos.x);
+        hash = mixHash_Widget_(hash, (uint32_t) child->rect.pos.y);
+        hash = mixHash_Widget_(hash, (uint32_t) child->rect.size.x);
+        hash = mixHash_Widget_(hash, (uint32_t) child->rect.size.y);
+        hash = mixHash_Widget_(hash, updateArrangementHash_Widget_(child, isArranged));
+    }
+    if (isArranged) {
+        d->arrangement.stateHash = hash;
+    }
+    else {
+        d->arrangement.currentHash = hash;
+        d->arrangement.hashPass    = arrangePass_Widget_;
+    }
+    return hash;
+}
+
+static iBool restoreArrangement_Widget_(iWidget *d, iInt2 parentSize, int refHeight) {
+    iWidgetArrangement *arr = &d->arrangement;
+    if (!isIncrementalArrangement_Widget_() || !arr->isCached ||
+        !isEqual_I2(arr->inputSize, d->rect.size) || !isEqual_I2(arr->parentSize, parentSize) ||
+        arr->refHeight != refHeight) {
+        return iFalse;
+    }
+    /* The subtree must be unchanged since it was last arranged. */
+    if (arr->pass != arrangePass_Widget_ &&
+        (arr->hashPass != arrangePass_Widget_ || arr->currentHash != arr->stateHash)) {
+        return iFalse;
+    }
+    d->rect.size = arr->result.size;
+    if (d->flags & (moveToParentLeftEdge_WidgetFlag | moveToParentRightEdge_WidgetFlag |
+                    moveToParentBottomEdge_WidgetFlag | centerHorizontal_WidgetFlag)) {
+        d->rect.pos = arr->result.pos;
+    }
+    arr->pass = arrangePass_Widget_; /* as if reset and arranged */
+    TRACE(d, "unchanged, using cached arrangement %dx%d", d->rect.size.x, d->rect.size.y);
+    return iTrue;
+}
+
+static void doArrange_Widget_(iWidget *d);
+
 static void arrange_Widget_(iWidget *d) {
+    const iInt2 parentSize = d->parent ? innerRect_Widget_(d->parent).size : size_Root(d->root);
+    const int   refHeight  = d->sizeRef ? height_Widget(d->sizeRef) : 0;
+    if (restoreArrangement_Widget_(d, parentSize, refHeight)) {
+        return;
+    }
+    iWidgetArrangement *arr = &d->arrangement;
+    arr->inputSize = d->rect.size;
+    if (isIncrementalArrangement_Widget_() && arr->pass != arrangePass_Widget_) {
+        resetChildren_Widget_(d); /* back to initial default sizes */
+    }
+    doArrange_Widget_(d);
+    arr->isCached   = isIncrementalArrangement_Widget_();
+    arr->parentSize = parentSize;
+    arr->refHeight  = refHeight;
+    arr->result     = d->rect;
+}
+
+static void doArrange_Widget_(iWidget *d) {
     TRACE(d, "arranging...");
     if (d->sizeRef) {
         d->rect.size.y = height_Widget(d->sizeRef);
@@ -837,25 +1018,9 @@ static void arrange_Widget_(iWidget *d) {
 
 static void resetArrangement_Widget_(iWidget *d) {
     iForEach(ObjectList, i, children_Widget(d)) {
-        iWidget *child = as_Widget(i.object);
-        resetArrangement_Widget_(child);
-        if (isArrangedPos_Widget_(child)) {
-            if (d->flags & arrangeHorizontal_WidgetFlag) {
-                child->rect.pos.x = 0;
-            }
-            if (d->flags & resizeWidthOfChildren_WidgetFlag && child->flags & expand_WidgetFlag &&
-                ~child->flags & fixedWidth_WidgetFlag) {
-                child->rect.size.x = 0;
-            }
-            if (d->flags & arrangeVertical_WidgetFlag) {
-                child->rect.pos.y = 0;
-            }
-            if (d->flags & resizeHeightOfChildren_WidgetFlag && child->flags & expand_WidgetFlag &&
-                ~child->flags & fixedHeight_WidgetFlag) {
-                child->rect.size.y = 0;
-            }
-        }
+        resetArrangement_Widget_(as_Widget(i.object));
     }
+    resetChildren_Widget_(d);
 }
 
 void arrange_Widget(iWidget *d) {
@@ -865,8 +1030,23 @@ void arrange_Widget(iWidget *d) {
             puts("\n==== NEW WIDGET ARRANGEMENT ====\n");
         }
 #endif
-        resetArrangement_Widget_(d); /* back to initial default sizes */
-        arrange_Widget_(d);
+        start_ProfilerScope(layout);
+        if (arrangeDepth_Widget_++ == 0) {
+            arrangePass_Widget_++;
+        }
+        if (isIncrementalArrangement_Widget_()) {
+            /* Children are reset only when their parent actually needs rearranging. */
+            updateArrangementHash_Widget_(d, iFalse);
+            arrange_Widget_(d);
+            updateArrangementHash_Widget_(d, iTrue);
+        }
+        else {
+            resetArrangement_Widget_(d); /* back to initial default sizes */
+            arrange_Widget_(d);
+        }
+        arrangeDepth_Widget_--;
+        stop_ProfilerScope(layout);
+        treeChanged_Widget_();
     }
 }
 
@@ -1564,11 +1744,14 @@ void drawChildren_Widget(const iWidget *d) {
     if (!isDrawn_Widget_(d)) {
         return;
     }
+    const iWindow *win = window_Widget(d);
     iConstForEach(ObjectList, i, d->children) {
         const iWidget *child = constAs_Widget(i.object);
-        if (~child->flags & keepOnTop_WidgetFlag && isDrawn_Widget_(child)) {
+        if (~child->flags & keepOnTop_WidgetFlag && isDrawn_Widget_(child) &&
+            isDamaged_Window(win, damageBounds_Widget_(child))) {
             incrementDrawCount_(child);
             class_Widget(child)->draw(child);
+            markDrawn_Widget_(child);
         }
     }
 }
@@ -1579,9 +1762,14 @@ void drawRoot_Widget(const iWidget *d) {
     iPtrArray pvs;
     init_PtrArray(&pvs);
     findPotentiallyVisible_Widget_(d, &pvs);
+    const iWindow *win = window_Widget(d);
     iReverseConstForEach(PtrArray, i, &pvs) {
+        if (!isDamaged_Window(win, damageBounds_Widget_(i.ptr))) {
+            continue; /* previous frame is still valid here */
+        }
         incrementDrawCount_(i.ptr);
         class_Widget(i.ptr)->draw(i.ptr);
+        markDrawn_Widget_(i.ptr);
     }
     deinit_PtrArray(&pvs);
 }
@@ -1608,10 +1796,12 @@ static void beginBufferDraw_Widget_(const iWidget *d) {
         }
         const iRect bounds = bounds_Widget(d);
         SDL_Renderer *render = renderer_Window(get_Window());
-        d->drawBuf->oldTarget = SDL_GetRenderTarget(render);
+        iWindow *win = window_Widget(d);
         d->drawBuf->oldOrigin = origin_Paint;
+        d->drawBuf->oldDrawClip = win->drawClip;
+        win->drawClip = zero_Rect(); /* the entire buffer is redrawn */
         realloc_WidgetDrawBuffer(d->drawBuf, render, boundsForDraw_Widget_(d).size);
-        SDL_SetRenderTarget(render, d->drawBuf->texture);
+        set_RenderTarget(&d->drawBuf->oldTarget, render, d->drawBuf->texture);
 //        SDL_SetRenderDrawColor(render, 255, 0, 0, 128);
         SDL_SetRenderDrawColor(render, 0, 0, 0, 0);
         SDL_RenderClear(render);
@@ -1624,8 +1814,9 @@ static void beginBufferDraw_Widget_(const iWidget *d) {
 static void endBufferDraw_Widget_(const iWidget *d) {
     if (d->drawBuf) {
         d->drawBuf->isValid = iTrue;
-        SDL_SetRenderTarget(renderer_Window(get_Window()), d->drawBuf->oldTarget);
+        restore_RenderTarget(&d->drawBuf->oldTarget, renderer_Window(get_Window()));
         origin_Paint = d->drawBuf->oldOrigin;
+        window_Widget(d)->drawClip = d->drawBuf->oldDrawClip;
 //        printf("endBufferDraw: origin %d,%d\n", origin_Paint.x, origin_Paint.y);
 //        fflush(stdout);
     }    
@@ -1641,15 +1832,20 @@ void draw_Widget(const iWidget *d) {
         return;
     }
     drawLayerEffects_Widget(d);
-    if (!d->drawBuf || !checkDrawBuffer_Widget_(d)) {
-        beginBufferDraw_Widget_(d);
+    const iBool isBuffered = d->drawBuf && fitsDrawBuffer_Widget_(d);
+    if (!isBuffered || !checkDrawBuffer_Widget_(d)) {
+        if (isBuffered) {
+            beginBufferDraw_Widget_(d);
+        }
         drawBackground_Widget(d);
         drawChildren_Widget(d);
-        endBufferDraw_Widget_(d);
+        if (isBuffered) {
+            endBufferDraw_Widget_(d);
+        }
     }
-    if (d->drawBuf) {
+    if (isBuffered) {
         //iAssert(d->drawBuf->isValid);
-        const iRect bounds = bounds_Widget(d);
+        const iRect bounds = moved_Rect(bounds_Widget(d), origin_Paint); /* may be nested */
         SDL_RenderCopy(renderer_Window(get_Window()), d->drawBuf->texture, NULL,
                        &(SDL_Rect){ bounds.pos.x, bounds.pos.y,
                                     d->drawBuf->size.x, d->drawBuf->size.y });
@@ -1701,6 +1897,7 @@ iAny *addChildPosFlags_Widget(iWidget *d, iAnyObject *child, enum iWidgetAddPos
         pushFront_ObjectList(d->children, widget); /* ref */
     }
     widget->parent = d;
+    treeChanged_Widget_();
     if (flags) {
         setFlags_Widget(child, flags, iTrue);
     }
@@ -1727,6 +1924,7 @@ iAny *insertChildAfter_Widget(iWidget *d, iAnyObject *child, size_t afterIndex)
         pushBack_ObjectList(d->children, child);
     }
     widget->parent = d;
+    treeChanged_Widget_();
     return child;
 }
 
@@ -1759,6 +1957,7 @@ iAny *removeChild_Widget(iWidget *d, iAnyObject *child) {
 //    }
 //    printf("%s:%d [%p] parent = NULL\n", __FILE__, __LINE__, d);
     childWidget->parent = NULL;
+    treeChanged_Widget_();
     postRefresh_App();
     return child;
 }
@@ -1783,6 +1982,12 @@ size_t indexOfChild_Widget(const iWidget *d, const iAnyObject *child) {
     return iInvalidPos;
 }
 
+iLocalDef iBool isHittable_Widget_(const iWidget *d) {
+    return (d->flags & (overflowScrollable_WidgetFlag | hittable_WidgetFlag) ||
+            class_Widget(d) != &Class_Widget || d->flags & mouseModal_WidgetFlag) &&
+           ~d->flags & unhittable_WidgetFlag;
+}
+
 iAny *hitChild_Widget(const iWidget *d, iInt2 coord) {
     if (isHidden_Widget_(d)) {
         return NULL;
@@ -1806,14 +2011,112 @@ iAny *hitChild_Widget(const iWidget *d, iInt2 coord) {
             if (found) return found;
         }
     }
-    if ((d->flags & (overflowScrollable_WidgetFlag | hittable_WidgetFlag) ||
-         class_Widget(d) != &Class_Widget || d->flags & mouseModal_WidgetFlag) &&
-        ~d->flags & unhittable_WidgetFlag && contains_Widget(d, coord)) {
+    if (isHittable_Widget_(d) && contains_Widget(d, coord)) {
         return iConstCast(iWidget *, d);
     }
     return NULL;
 }
 
+/*----------------------------------------------------------------------------------------------*/
+
+iDeclareType(WidgetHitEntry)
+
+struct Impl_WidgetHitEntry {
+    const iWidget *widget;
+    iRect          rect;  /* window coordinates */
+    size_t         guard; /* nonzero: number of entries to skip if the widget is hidden */
+};
+
+struct Impl_WidgetHitIndex {
+    iArray   entries; /* in the order hitChild_Widget() checks them */
+    uint32_t generation;
+};
+
+void init_WidgetHitIndex(iWidgetHitIndex *d) {
+    init_Array(&d->entries, sizeof(iWidgetHitEntry));
+    d->generation = 0;
+}
+
+void deinit_WidgetHitIndex(iWidgetHitIndex *d) {
+    deinit_Array(&d->entries);
+}
+
+iDefineTypeConstruction(WidgetHitIndex)
+
+void clear_WidgetHitIndex(iWidgetHitIndex *d) {
+    clear_Array(&d->entries);
+    d->generation = 0;
+}
+
+void invalidate_WidgetHitIndex(iWidgetHitIndex *d) {
+    d->generation = 0;
+}
+
+static void addWidget_WidgetHitIndex_(iWidgetHitIndex *d, const iWidget *w) {
+    size_t guardPos = iInvalidPos;
+    if (w->flags & visibleOnParentHover_WidgetFlag) {
+        /* Visibility depends on the current hover, so it is checked during the hit test. */
+        guardPos = size_Array(&d->entries);
+        pushBack_Array(&d->entries, &(iWidgetHitEntry){ w, zero_Rect(), 0 });
+    }
+    else if (isHidden_Widget_(w)) {
+        return;
+    }
+    if (!w->parent) {
+        iReverseForEach(PtrArray, i, onTop_Root(w->root)) {
+            addWidget_WidgetHitIndex_(d, i.ptr);
+        }
+    }
+    iReverseForEach(ObjectList, i, w->children) {
+        const iWidget *child = constAs_Widget(i.object);
+        if (~child->flags & keepOnTop_WidgetFlag) {
+            addWidget_WidgetHitIndex_(d, child);
+        }
+    }
+    if (isHittable_Widget_(w)) {
+        iRect rect = { innerToWindow_Widget(w, zero_I2()), w->rect.size };
+        if (w->flags & drawBackgroundToBottom_WidgetFlag) {
+            rect.size.y += size_Root(w->root).y;
+        }
+        pushBack_Array(&d->entries, &(iWidgetHitEntry){ w, rect, 0 });
+    }
+    if (guardPos != iInvalidPos) {
+        ((iWidgetHitEntry *) at_Array(&d->entries, guardPos))->guard =
+            size_Array(&d->entries) - guardPos;
+    }
+}
+
+void addRoot_WidgetHitIndex(iWidgetHitIndex *d, const iWidget *root) {
+    if (root) {
+        addWidget_WidgetHitIndex_(d, root);
+    }
+}
+
+void validate_WidgetHitIndex(iWidgetHitIndex *d) {
+    d->generation = treeGeneration_Widget_;
+}
+
+iBool isValid_WidgetHitIndex(const iWidgetHitIndex *d) {
+    return d->generation == treeGeneration_Widget_;
+}
+
+iAny *hit_WidgetHitIndex(const iWidgetHitIndex *d, iInt2 coord) {
+    const iWidgetHitEntry *entries = constData_Array(&d->entries);
+    const size_t           count   = size_Array(&d->entries);
+    for (size_t i = 0; i < count; ) {
+        const iWidgetHitEntry *entry = &entries[i];
+        if (entry->guard) {
+            i += (isHidden_Widget_(entry->widget) ? entry->guard : 1);
+            continue;
+        }
+        if (contains_Rect(entry->rect, coord)) {
+            return iConstCast(iWidget *, entry->widget);
+        }
+        i++;
+    }
+    return NULL;
+}
+
 iAny *findChild_Widget(const iWidget *d, const char *id) {
     if (!d) return NULL;
     if (cmp_String(id_Widget(d), id) == 0) {
@@ -2082,6 +2385,24 @@ void postCommand_Widget(const iAnyObject *d, const char *cmd, ...) {
     deinit_String(&str);
 }
 
+static void damageOverflowingChildren_Widget_(const iWidget *d, iWindow *win, iRect bounds) {
+    /* Children are redrawn with their parent, but they may extend outside of it. */
+    iConstForEach(ObjectList, i, d->children) {
+        const iWidget *child = constAs_Widget(i.object);
+        if (!isDrawn_Widget_(child)) {
+            continue;
+        }
+        const iRect childBounds = damageBounds_Widget_(child);
+        if (!isFullyContainedByOther_Rect(child->drawnRect, bounds)) {
+            damage_Window(win, child->drawnRect);
+        }
+        if (!isFullyContainedByOther_Rect(childBounds, bounds)) {
+            damage_Window(win, childBounds);
+        }
+        damageOverflowingChildren_Widget_(child, win, bounds);
+    }
+}
+
 void refresh_Widget(const iAnyObject *d) {
     if (!d) return;
     /* TODO: Could be widget specific, if parts of the tree are cached. */
@@ -2097,7 +2418,17 @@ void refresh_Widget(const iAnyObject *d) {
             w->drawBuf->isValid = iFalse;
         }
     }
-    postRefresh_App();
+    /* Only the widget's (and its children's) old and new areas need to be redrawn. */ {
+        const iWidget *w = d;
+        iWindow *win = window_Widget(w);
+        if (win) {
+            const iRect bounds = damageBounds_Widget_(w);
+            damage_Window(win, w->drawnRect);
+            damage_Window(win, bounds);
+            damageOverflowingChildren_Widget_(w, win, bounds);
+        }
+    }
+    postDamagedRefresh_App();
 }
 
 void raise_Widget(iWidget *d) {
@@ -2106,6 +2437,7 @@ void raise_Widget(iWidget *d) {
         iAssert(indexOf_PtrArray(onTop, d) != iInvalidPos);
         removeOne_PtrArray(onTop, d);
         pushBack_PtrArray(onTop, d);
+        treeChanged_Widget_();
     }
 }
 
@@ -134,6 +134,21 @@ enum iWidgetFocusDir {
 };
 
 iDeclareType(WidgetDrawBuffer)
+iDeclareType(WidgetArrangement)
+
+struct Impl_WidgetArrangement {
+    /* Memoized arrangement: a subtree whose state and constraints have not changed since it
+       was last arranged keeps its previous layout. */
+    iBool    isCached;
+    uint32_t pass;        /* arrangement pass when the children were last reset/arranged */
+    uint32_t hashPass;    /* pass of `currentHash` */
+    uint32_t currentHash; /* subtree state at the beginning of the pass */
+    uint32_t stateHash;   /* subtree state after it was last arranged */
+    iInt2    inputSize;   /* own size when arrangement began */
+    iInt2    parentSize;  /* inner size of the parent (or root size) */
+    int      refHeight;   /* height of `sizeRef` */
+    iRect    result;
+};
 
 struct Impl_Widget {
     iObject      object;
@@ -152,6 +167,8 @@ struct Impl_Widget {
     iBool      (*commandHandler)(iWidget *, const char *);
     iRoot *      root;
     iWidgetDrawBuffer *drawBuf;
+    iRect        drawnRect;  /* where the widget was last drawn (damage tracking) */
+    iWidgetArrangement arrangement;
 };
 
 iDeclareObjectConstruction(Widget)
@@ -288,6 +305,19 @@ void    refresh_Widget              (const iAnyObject *);
 
 iBool   equalWidget_Command (const char *cmd, const iWidget *widget, const char *checkCommand);
 
+/* A flattened index of the hittable widgets of one or more roots, in hit test order.
+   It becomes stale when the widget tree is rearranged or widget flags change. */
+
+iDeclareType(WidgetHitIndex)
+iDeclareTypeConstruction(WidgetHitIndex)
+
+void    clear_WidgetHitIndex        (iWidgetHitIndex *);
+void    invalidate_WidgetHitIndex   (iWidgetHitIndex *);
+void    addRoot_WidgetHitIndex      (iWidgetHitIndex *, const iWidget *root);
+void    validate_WidgetHitIndex     (iWidgetHitIndex *);
+iBool   isValid_WidgetHitIndex      (const iWidgetHitIndex *);
+iAny *  hit_WidgetHitIndex          (const iWidgetHitIndex *, iInt2 windowCoord);
+
 iDeclareType(WidgetScrollInfo)
 
 struct Impl_WidgetScrollInfo {
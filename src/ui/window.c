@@ -26,12 +26,14 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "bookmarks.h"
 #include "command.h"
 #include "defs.h"
+#include "framepacer.h"
 #include "resources.h"
 #include "keys.h"
 #include "labelwidget.h"
 #include "documentwidget.h"
 #include "sidebarwidget.h"
 #include "paint.h"
+#include "profiler.h"
 #include "root.h"
 #include "touch.h"
 #include "util.h"
@@ -301,6 +303,25 @@ static float displayScale_Window_(const iWindow *d) {
 #endif
 }
 
+static void present_Window_(iWindow *d) {
+    iFramePacer *pacer = framePacer_App();
+    beginPresent_FramePacer(pacer);
+    SDL_RenderPresent(d->render);
+    endPresent_FramePacer(pacer);
+}
+
+static void updateFramePacing_Window_(const iWindow *d) {
+    /* Frames are paced according to the display the window is on. */
+    SDL_DisplayMode  mode;
+    SDL_RendererInfo info;
+    const int refreshRate =
+        (SDL_GetWindowDisplayMode(d->win, &mode) == 0 ? mode.refresh_rate : 0);
+    const iBool isVsync =
+        (SDL_GetRendererInfo(d->render, &info) == 0 &&
+         (info.flags & SDL_RENDERER_PRESENTVSYNC) != 0);
+    setDisplay_FramePacer(framePacer_App(), refreshRate, isVsync);
+}
+
 static void drawBlank_Window_(iWindow *d) {
 //    const iColor bg = get_Color(uiBackground_ColorId);
     const iColor bg = { 128, 128, 128, 255 }; /* TODO: Have no root yet. */
@@ -424,6 +445,9 @@ void create_Window_(iWindow *d, iRect rect, uint32_t flags) {
             exit(-4);
         }
     }
+    if (type_Window(d) == main_WindowType) {
+        updateFramePacing_Window_(d);
+    }
 #if defined(LAGRANGE_ENABLE_CUSTOM_FRAME)
     if (type_Window(d) == main_WindowType && prefs_App()->customFrame) {
         /* Register a handler for window hit testing (drag, resize). */
@@ -467,6 +491,12 @@ void init_Window(iWindow *d, enum iWindowType type, iRect rect, uint32_t flags)
     d->frameTime     = SDL_GetTicks();
     d->keyRoot       = NULL;
     d->borderShadow  = NULL;
+    d->frame         = NULL;
+    d->damageLock    = 0;
+    d->isFullyDamaged = iTrue;
+    d->damage        = zero_Rect();
+    d->drawClip      = zero_Rect();
+    d->hitIndex      = new_WidgetHitIndex();
     iZap(d->roots);
     iZap(d->cursors);
     create_Window_(d, rect, flags);
@@ -520,7 +550,11 @@ void deinit_Window(iWindow *d) {
         removePopup_App(d);
     }
     deinitRoots_Window_(d);
+    delete_WidgetHitIndex(d->hitIndex);
     delete_Text(d->text);
+    if (d->frame) {
+        SDL_DestroyTexture(d->frame);
+    }
     SDL_DestroyRenderer(d->render);
     SDL_DestroyWindow(d->win);
     iForIndices(i, d->cursors) {
@@ -586,7 +620,7 @@ void init_MainWindow(iMainWindow *d, iRect rect) {
 #if defined (iPlatformLinux)
     SDL_SetWindowMinimumSize(d->base.win, minSize.x * d->base.pixelRatio, minSize.y * d->base.pixelRatio);
     /* Load the window icon. */ {
-        SDL_Surface *surf = loadImage_(&imageLagrange64_Resources, 0);
+        SDL_Surface *surf = loadImage_(load_Resources(&imageLagrange64_Resources), 0);
         SDL_SetWindowIcon(d->base.win, surf);
         free(surf->pixels);
         SDL_FreeSurface(surf);
@@ -600,7 +634,7 @@ void init_MainWindow(iMainWindow *d, iRect rect) {
     setupUserInterface_MainWindow(d);
     postCommand_App("~bindings.changed"); /* update from bindings */
     /* Load the border shadow texture. */ {
-        SDL_Surface *surf = loadImage_(&imageShadow_Resources, 0);
+        SDL_Surface *surf = loadImage_(load_Resources(&imageShadow_Resources), 0);
         d->base.borderShadow = SDL_CreateTextureFromSurface(d->base.render, surf);
         SDL_SetTextureBlendMode(d->base.borderShadow, SDL_BLENDMODE_BLEND);
         free(surf->pixels);
@@ -610,7 +644,7 @@ void init_MainWindow(iMainWindow *d, iRect rect) {
 #if defined (LAGRANGE_ENABLE_CUSTOM_FRAME)
     /* Load the app icon for drawing in the title bar. */
     if (prefs_App()->customFrame) {
-        SDL_Surface *surf = loadImage_(&imageLagrange64_Resources, appIconSize_Root());
+        SDL_Surface *surf = loadImage_(load_Resources(&imageLagrange64_Resources), appIconSize_Root());
         SDL_SetHint(SDL_HINT_RENDER_SCALE_QUALITY, "0");
         d->appIcon = SDL_CreateTextureFromSurface(d->base.render, surf);
         free(surf->pixels);
@@ -685,6 +719,25 @@ void invalidate_Window(iAnyWindow *d) {
     }
 }
 
+void damage_Window(iWindow *d, iRect rect) {
+    if (isEmpty_Rect(rect)) {
+        return;
+    }
+    SDL_AtomicLock(&d->damageLock);
+    d->damage = isEmpty_Rect(d->damage) ? rect : union_Rect(d->damage, rect);
+    SDL_AtomicUnlock(&d->damageLock);
+}
+
+void damageAll_Window(iWindow *d) {
+    SDL_AtomicLock(&d->damageLock);
+    d->isFullyDamaged = iTrue;
+    SDL_AtomicUnlock(&d->damageLock);
+}
+
+iBool isDamaged_Window(const iWindow *d, iRect rect) {
+    return isEmpty_Rect(d->drawClip) || !isEmpty_Rect(intersect_Rect(d->drawClip, rect));
+}
+
 static iBool isNormalPlacement_MainWindow_(const iMainWindow *d) {
     if (d->isDrawFrozen) return iFalse;
 #if defined (iPlatformApple)
@@ -831,6 +884,7 @@ static iBool handleWindowEvent_MainWindow_(iMainWindow *d, const SDL_WindowEvent
             }
             closePopups_App();
             checkPixelRatioChange_Window_(as_Window(d));
+            updateFramePacing_Window_(as_Window(d)); /* may be on another display */
             const iInt2 newPos = init_I2(ev->data1, ev->data2);
             if (isEqual_I2(newPos, init1_I2(-32000))) { /* magic! */
                 /* Maybe minimized? Seems like a Windows constant of some kind. */
@@ -980,8 +1034,17 @@ iBool processEvent_Window(iWindow *d, const SDL_Event *ev) {
                 return handleWindowEvent_Window_(d, &ev->window);
             }
         }
-        case SDL_RENDER_TARGETS_RESET:
+        case SDL_RENDER_TARGETS_RESET: {
+            /* Textures remain valid, only their contents were lost. */
+            damageAll_Window(d);
+            if (mw) {
+                restoreGlyphCache_Text(text_Window(mw));
+                postCommand_App("theme.changed auto:1"); /* redraw UI buffers */
+            }
+            break;
+        }
         case SDL_RENDER_DEVICE_RESET: {
+            damageAll_Window(d); /* frame contents were lost */
             if (mw) {
                 invalidate_MainWindow_(mw, iTrue /* force full reset */);
             }
@@ -1159,15 +1222,18 @@ iAnyObject *hitChild_Window(const iWindow *d, iInt2 coord) {
     if (coord.x < 0 || coord.y < 0) {
         return NULL;
     }
-    iForIndices(i, d->roots) {
-        if (d->roots[i]) {
-            iAnyObject *hit = hitChild_Widget(d->roots[i]->widget, coord);
-            if (hit) {
-                return hit;
+    /* Mouse motion is much more frequent than changes in the widget tree, so the hittable
+       widgets are kept in a flattened index instead of traversing the tree every time. */
+    if (!isValid_WidgetHitIndex(d->hitIndex)) {
+        clear_WidgetHitIndex(d->hitIndex);
+        iForIndices(i, d->roots) {
+            if (d->roots[i]) {
+                addRoot_WidgetHitIndex(d->hitIndex, d->roots[i]->widget);
             }
         }
+        validate_WidgetHitIndex(d->hitIndex);
     }
-    return NULL;
+    return hit_WidgetHitIndex(d->hitIndex, coord);
 }
 
 iBool postContextClick_Window(iWindow *d, const SDL_MouseButtonEvent *ev) {
@@ -1199,6 +1265,7 @@ void draw_Window(iWindow *d) {
     SDL_SetRenderDrawColor(d->render, back.r, back.g, back.b, 255);
     SDL_RenderClear(d->render);
     d->frameTime = SDL_GetTicks();
+    invalidate_WidgetHitIndex(d->hitIndex);
     if (isExposed_Window(d)) {
         d->isInvalidated = iFalse;
         extern int drawCount_;
@@ -1211,10 +1278,65 @@ void draw_Window(iWindow *d) {
     drawRectThickness_Paint(&p, (iRect){ zero_I2(), sub_I2(d->size, one_I2()) }, gap_UI / 4,
                             uiBackgroundSelected_ColorId);
     setCurrent_Root(NULL);
-    SDL_RenderPresent(d->render);
+    present_Window_(d);
     isDrawing_ = iFalse;
 }
 
+static iBool beginFrame_Window_(iWindow *d) {
+    /* Widgets are drawn into a persistent frame texture so that the undamaged parts of
+       the previous frame can be kept as is. Returns iFalse if nothing needs drawing. */
+    if (SDL_RenderTargetSupported(d->render)) {
+        iInt2 frameSize = zero_I2();
+        if (d->frame) {
+            SDL_QueryTexture(d->frame, NULL, NULL, &frameSize.x, &frameSize.y);
+        }
+        if (!isEqual_I2(frameSize, d->size)) {
+            if (d->frame) {
+                SDL_DestroyTexture(d->frame);
+            }
+            d->frame = SDL_CreateTexture(d->render,
+                                         SDL_PIXELFORMAT_RGBA8888,
+                                         SDL_TEXTUREACCESS_TARGET,
+                                         d->size.x,
+                                         d->size.y);
+            d->isFullyDamaged = iTrue;
+        }
+    }
+    iBool isChanged = iTrue;
+    SDL_AtomicLock(&d->damageLock);
+    d->drawClip = zero_Rect();
+    if (d->frame && !d->isFullyDamaged) {
+        d->drawClip = intersect_Rect(d->damage, (iRect){ zero_I2(), d->size });
+        isChanged   = !isEmpty_Rect(d->drawClip);
+    }
+    d->damage         = zero_Rect();
+    d->isFullyDamaged = iFalse;
+    SDL_AtomicUnlock(&d->damageLock);
+    if (isChanged) {
+        /* Widget geometry may have been modified directly. */
+        invalidate_WidgetHitIndex(d->hitIndex);
+    }
+    if (d->frame) {
+        SDL_SetTextureBlendMode(d->frame, SDL_BLENDMODE_NONE);
+        SDL_SetRenderTarget(d->render, d->frame);
+    }
+    return isChanged;
+}
+
+static void endFrame_Window_(iWindow *d) {
+    d->drawClip = zero_Rect();
+    if (d->frame) {
+        iInt2 outputSize;
+        SDL_SetRenderTarget(d->render, NULL);
+        SDL_RenderSetClipRect(d->render, NULL);
+        SDL_GetRendererOutputSize(d->render, &outputSize.x, &outputSize.y);
+        if (!isEqual_I2(outputSize, d->size)) {
+            SDL_RenderClear(d->render); /* e.g., area under a software keyboard */
+        }
+        SDL_RenderCopy(d->render, d->frame, NULL, &(SDL_Rect){ 0, 0, d->size.x, d->size.y });
+    }
+}
+
 void draw_MainWindow(iMainWindow *d) {
     if (isDrawing_) {
         /* Already drawing! */
@@ -1239,9 +1361,11 @@ void draw_MainWindow(iMainWindow *d) {
     const iBool gotFocus = (winFlags & SDL_WINDOW_INPUT_FOCUS) != 0;
     iPaint p;
     init_Paint(&p);
+    setCurrent_Root(w->roots[0]);
+    const iBool isChanged = beginFrame_Window_(w);
     /* Clear the window. The clear color is visible as a border around the window
-       when the custom frame is being used. */ {
-        setCurrent_Root(w->roots[0]);
+       when the custom frame is being used. */
+    if (isChanged) {
 #if defined (iPlatformMobile)
         iColor back = get_Color(uiBackground_ColorId);
         if (deviceType_App() == phone_AppDeviceType) {
@@ -1254,15 +1378,19 @@ void draw_MainWindow(iMainWindow *d) {
                                           ? uiAnnotation_ColorId
                                           : uiSeparator_ColorId);
 #endif
-        unsetClip_Paint(&p); /* update clip to full window */
+        unsetClip_Paint(&p); /* update clip to full window or the damaged region */
         SDL_SetRenderDrawColor(w->render, back.r, back.g, back.b, 255);
-        SDL_RenderClear(w->render);
+        if (isEmpty_Rect(w->drawClip)) {
+            SDL_RenderClear(w->render);
+        }
+        else {
+            SDL_RenderFillRect(w->render, NULL); /* clear ignores the clip */
+        }
     }
     /* Draw widgets. */
     w->frameTime = SDL_GetTicks();
-    if (isExposed_Window(w)) {
+    if (isChanged && isExposed_Window(w)) {
         w->isInvalidated = iFalse;
-        extern int drawCount_;
         iForIndices(i, w->roots) {
             iRoot *root = w->roots[i];
             if (root) {
@@ -1307,21 +1435,32 @@ void draw_MainWindow(iMainWindow *d) {
                 }
             }
         }
-        setCurrent_Root(NULL);
+    }
+    endFrame_Window_(w);
+    /* Overlays are drawn after the frame so they don't linger in undamaged regions. */
+    if (isExposed_Window(w)) {
+        setCurrent_Root(w->roots[0]);
+        unsetClip_Paint(&p);
 #if !defined (NDEBUG)
+        extern int drawCount_;
         draw_Text(uiLabelBold_FontId, safeRect_Root(w->roots[0]).pos, red_ColorId, "%d", drawCount_);
         drawCount_ = 0;
 #endif
+        draw_Profiler();
     }
+    setCurrent_Root(NULL);
 #if 0
-    /* Text cache debugging. */ {
-        SDL_Rect rect = { d->roots[0]->widget->rect.size.x - 640, 0, 640, 2.5 * 640 };
-        SDL_SetRenderDrawColor(d->render, 0, 0, 0, 255);
-        SDL_RenderFillRect(d->render, &rect);
-        SDL_RenderCopy(d->render, glyphCache_Text(), NULL, &rect);
+    /* Text cache debugging. The pages are shown side by side. */ {
+        SDL_Texture *page;
+        for (int i = 0; (page = glyphCache_Text(i)) != NULL; i++) {
+            SDL_Rect rect = { d->roots[0]->widget->rect.size.x - 320 * (i + 1), 0, 320, 2.5 * 320 };
+            SDL_SetRenderDrawColor(d->render, 0, 0, 0, 255);
+            SDL_RenderFillRect(d->render, &rect);
+            SDL_RenderCopy(d->render, page, NULL, &rect);
+        }
     }
 #endif
-    SDL_RenderPresent(w->render);
+    present_Window_(w);
     isDrawing_ = iFalse;
 }
 
@@ -1686,6 +1825,65 @@ int snap_MainWindow(const iMainWindow *d) {
 
 /*----------------------------------------------------------------------------------------------*/
 
+/* A closed popup is kept hidden for reuse. SDL renderers can't share textures, so creating a
+   new popup window would also mean rasterizing all the UI glyphs again into a new cache. */
+static iWindow *sparePopup_Window_;
+static uint32_t sparePopupFontGeneration_Window_; /* of the main window when recycled */
+
+static iWindow *reuseSparePopup_Window_(iRect rect) {
+    iWindow *d = sparePopup_Window_;
+    if (!d) {
+        return NULL;
+    }
+    sparePopup_Window_ = NULL;
+    if (fontGeneration_Text(text_Window(get_MainWindow())) != sparePopupFontGeneration_Window_) {
+        resetFonts_Text(d->text); /* fonts or UI scale have changed since */
+    }
+    SDL_SetWindowPosition(d->win, left_Rect(rect), top_Rect(rect));
+    SDL_SetWindowSize(d->win, width_Rect(rect), height_Rect(rect));
+    SDL_GetRendererOutputSize(d->render, &d->size.x, &d->size.y);
+    d->pixelRatio     = pixelRatio_Window_(d);
+    d->displayScale   = displayScale_Window_(d);
+    d->isExposed      = iFalse;
+    d->isMouseInside  = iTrue;
+    d->ignoreClick    = iFalse;
+    d->focusGainedAt  = SDL_GetTicks();
+    d->frameTime      = SDL_GetTicks();
+    d->isFullyDamaged = iTrue;
+    invalidate_WidgetHitIndex(d->hitIndex);
+    return d;
+}
+
+void recyclePopup_Window(iWindow *d) {
+    iAssert(type_Window(d) == popup_WindowType);
+    if (!get_MainWindow()) {
+        delete_Window(d); /* shutting down */
+        return;
+    }
+    removePopup_App(d);
+    deinitRoots_Window_(d);
+    d->hover         = NULL;
+    d->lastHover     = NULL;
+    d->mouseGrab     = NULL;
+    d->focus         = NULL;
+    d->pendingCursor = NULL;
+    d->keyRoot       = NULL;
+    clear_WidgetHitIndex(d->hitIndex);
+    if (sparePopup_Window_) {
+        delete_Window(sparePopup_Window_);
+    }
+    sparePopup_Window_ = d;
+    sparePopupFontGeneration_Window_ = fontGeneration_Text(text_Window(get_MainWindow()));
+}
+
+void deleteSparePopup_Window(void) {
+    if (sparePopup_Window_) {
+        iWindow *spare = sparePopup_Window_;
+        sparePopup_Window_ = NULL;
+        delete_Window(spare);
+    }
+}
+
 iWindow *newPopup_Window(iInt2 screenPos, iWidget *rootWidget) {
     start_PerfTimer(newPopup_Window);
     const iBool oldSw = forceSoftwareRender_App();
@@ -1696,19 +1894,23 @@ iWindow *newPopup_Window(iInt2 screenPos, iWidget *rootWidget) {
     SDL_Rect usableRect;
     SDL_GetDisplayUsableBounds(SDL_GetWindowDisplayIndex(get_MainWindow()->base.win),
                                &usableRect);
-    iWindow *win =
-        new_Window(popup_WindowType,
-                   (iRect){ screenPos, min_I2(divf_I2(rootWidget->rect.size, get_Window()->pixelRatio),
-                                              init_I2(usableRect.w, usableRect.h)) },
-                   SDL_WINDOW_ALWAYS_ON_TOP |
+    const iRect winRect = { screenPos,
+                            min_I2(divf_I2(rootWidget->rect.size, get_Window()->pixelRatio),
+                                   init_I2(usableRect.w, usableRect.h)) };
+    iWindow *win = reuseSparePopup_Window_(winRect);
+    if (!win) {
+        win = new_Window(popup_WindowType,
+                         winRect,
+                         SDL_WINDOW_ALWAYS_ON_TOP |
 #if !defined (iPlatformAppleDesktop)
-                   SDL_WINDOW_BORDERLESS |
+                         SDL_WINDOW_BORDERLESS |
 #endif
-                   SDL_WINDOW_POPUP_MENU |
-                   SDL_WINDOW_SKIP_TASKBAR);
+                         SDL_WINDOW_POPUP_MENU |
+                         SDL_WINDOW_SKIP_TASKBAR);
 #if defined (iPlatformAppleDesktop)
-    hideTitleBar_MacOS(win); /* make it a borderless window, but retain shadow */
+        hideTitleBar_MacOS(win); /* make it a borderless window, but retain shadow */
 #endif
+    }
     iRoot *root   = new_Root();
     win->roots[0] = root;
     win->keyRoot  = root;
@@ -25,6 +25,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #include "root.h"
 
 #include <the_Foundation/rect.h>
+#include <SDL_atomic.h>
 #include <SDL_events.h>
 #include <SDL_render.h>
 #include <SDL_video.h>
@@ -105,6 +106,12 @@ struct Impl_Window {
     iRoot *       keyRoot;      /* root that has the current keyboard input focus */
     SDL_Texture * borderShadow;
     iText *       text;
+    SDL_Texture * frame;        /* contents of the previous frame, for partial redraws */
+    SDL_SpinLock  damageLock;   /* widgets may be refreshed from timer callbacks */
+    iBool         isFullyDamaged;
+    iRect         damage;       /* union of regions to redraw in the next frame */
+    iRect         drawClip;     /* damaged region being drawn; empty when drawing everything */
+    iWidgetHitIndex *hitIndex;  /* hittable widgets of all roots */
 };
 
 struct Impl_MainWindow {
@@ -147,6 +154,9 @@ void        setCursor_Window        (iWindow *, int cursor);
 iBool       setKeyRoot_Window       (iWindow *, iRoot *root);
 iBool       postContextClick_Window (iWindow *, const SDL_MouseButtonEvent *);
 void        updateHover_Window      (iWindow *);
+void        damage_Window           (iWindow *, iRect rect);
+void        damageAll_Window        (iWindow *);
+iBool       isDamaged_Window        (const iWindow *, iRect rect); /* while drawing */
 
 iWindow *   get_Window              (void);
 iBool       isOpenGLRenderer_Window (void);
@@ -214,4 +224,6 @@ iLocalDef const iMainWindow *constAs_MainWindow(const iAnyWindow *d) {
 
 /*----------------------------------------------------------------------------------------------*/
 
-iWindow *   newPopup_Window    (iInt2 screenPos, iWidget *rootWidget);
+iWindow *   newPopup_Window         (iInt2 screenPos, iWidget *rootWidget);
+void        recyclePopup_Window     (iWindow *); /* hidden and kept for the next popup */
+void        deleteSparePopup_Window (void);
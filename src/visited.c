@@ -22,25 +22,49 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 
 #include "visited.h"
 #include "app.h"
+#include "jobs.h"
+#include "savequeue.h"
 
+#include <the_Foundation/buffer.h>
 #include <the_Foundation/file.h>
 #include <the_Foundation/mutex.h>
 #include <the_Foundation/path.h>
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/sortedarray.h>
+#include <ctype.h>
+
+#if !defined (iPlatformMsys)
+#   define LAGRANGE_MMAP_VISITED
+#   include <fcntl.h>
+#   include <sys/mman.h>
+#   include <sys/stat.h>
+#   include <unistd.h>
+#endif
 
 const int maxAge_Visited = 6 * 3600 * 24 * 30; /* six months */
 
+static const char  *snapshotFilename_Visited_ = "visited.2.txt";
+static const char  *journalFilename_Visited_  = "visited.journal";
+static const char  *magicJournal_Visited_     = "lgVJ";
+static const int    journalVersion_Visited_   = 1;
+static const size_t maxJournalSize_Visited_   = 1024 * 1024;
+
 void init_VisitedUrl(iVisitedUrl *d) {
     initCurrent_Time(&d->when);
     init_String(&d->url);
     d->flags = 0;
+    init_Trigrams(&d->trigrams);
 }
 
 void deinit_VisitedUrl(iVisitedUrl *d) {
     deinit_String(&d->url);
 }
 
+static void updateTrigrams_VisitedUrl_(iVisitedUrl *d) {
+    init_Trigrams(&d->trigrams);
+    add_Trigrams(&d->trigrams, range_String(&d->url));
+}
+
 static int cmpUrl_VisitedUrl_(const void *a, const void *b) {
     return cmpString_String(&((const iVisitedUrl *) a)->url, &((const iVisitedUrl *) b)->url);
 }
@@ -52,83 +76,427 @@ static int cmpNewer_VisitedUrl_(const void *insert, const void *existing) {
 
 /*----------------------------------------------------------------------------------------------*/
 
+/* Visit times are looked up via a hash of the canonical URL, so checking a link doesn't need
+   a copy of the URL or string comparisons. There is a tiny chance of two URLs having the same
+   64-bit hash; the worst outcome is a link shown as visited when it isn't. */
+
+iDeclareType(VisitedSlot)
+
+struct Impl_VisitedSlot {
+    uint64_t hash; /* 0: empty, 1: removed */
+    iTime    when;
+};
+
+enum { empty_VisitedSlot = 0, removed_VisitedSlot = 1 };
+
+static uint64_t slotHash_Visited_(uint64_t urlHash) {
+    return urlHash <= removed_VisitedSlot ? urlHash + 2 : urlHash;
+}
+
+static uint64_t urlHash_Visited_(const iString *canonicalUrl) {
+    return slotHash_Visited_(urlHash_String(canonicalUrl));
+}
+
 struct Impl_Visited {
     iMutex *mtx;
     iSortedArray visited;
+    uint32_t generation; /* incremented on every change */
+    iVisitedSlot *index; /* open addressing, linear probing */
+    size_t indexCapacity; /* power of two */
+    size_t indexUsed; /* including removed slots */
+    /* Changes since visited.2.txt was written are appended to visited.journal. */
+    iBuffer *journal; /* pending records */
+    size_t journalSize; /* bytes in the journal file; zero if there is no valid journal */
+    uint32_t snapshotCount;
+    uint32_t snapshotHash; /* identifies the snapshot that the journal applies to */
+    /* The files are parsed in the background after startup, or when first needed. */
+    iString *loadDir; /* NULL when nothing remains to be loaded */
+    iJob *loader;
 };
 
+enum iVisitedJournalRecord {
+    visit_VisitedJournalRecord = 1, /* URL's time and flags */
+    removed_VisitedJournalRecord,
+    cleared_VisitedJournalRecord,
+};
+
+static uint32_t snapshotHash_Visited_(uint32_t hash, unsigned long long ts, uint32_t flags,
+                                      iRangecc url) {
+    /* FNV-1a over the contents of the snapshot, independent of the text formatting. */
+    hash = (hash ^ (uint32_t) ts) * 0x01000193;
+    hash = (hash ^ flags) * 0x01000193;
+    for (const char *ch = url.start; ch != url.end; ch++) {
+        hash = (hash ^ (uint8_t) *ch) * 0x01000193;
+    }
+    return hash;
+}
+
+static void journalVisit_Visited_(iVisited *d, const iVisitedUrl *item) {
+    iStream *outs = stream_Buffer(d->journal);
+    write8_Stream(outs, visit_VisitedJournalRecord);
+    writeU64_Stream(outs, integralSeconds_Time(&item->when));
+    writeU16_Stream(outs, item->flags);
+    serialize_String(&item->url, outs);
+}
+
+static void journalRemoval_Visited_(iVisited *d, const iString *url) {
+    iStream *outs = stream_Buffer(d->journal);
+    write8_Stream(outs, removed_VisitedJournalRecord);
+    serialize_String(url, outs);
+}
+
+static const iVisitedSlot *findSlot_Visited_(const iVisited *d, uint64_t hash) {
+    if (!d->indexCapacity) {
+        return NULL;
+    }
+    const size_t mask = d->indexCapacity - 1;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        const iVisitedSlot *slot = &d->index[i];
+        if (slot->hash == hash) {
+            return slot;
+        }
+        if (slot->hash == empty_VisitedSlot) {
+            return NULL;
+        }
+    }
+}
+
+static void rebuildIndex_Visited_(iVisited *d, size_t capacity);
+
+static void setIndex_Visited_(iVisited *d, uint64_t hash, iTime when) {
+    if ((d->indexUsed + 1) * 2 > d->indexCapacity) {
+        rebuildIndex_Visited_(d, iMax(1024, size_SortedArray(&d->visited) * 4));
+    }
+    const size_t mask = d->indexCapacity - 1;
+    iVisitedSlot *reuse = NULL;
+    for (size_t i = hash & mask; ; i = (i + 1) & mask) {
+        iVisitedSlot *slot = &d->index[i];
+        if (slot->hash == hash) {
+            slot->when = when;
+            return;
+        }
+        if (slot->hash == removed_VisitedSlot && !reuse) {
+            reuse = slot;
+        }
+        if (slot->hash == empty_VisitedSlot) {
+            if (!reuse) {
+                reuse = slot;
+                d->indexUsed++;
+            }
+            reuse->hash = hash;
+            reuse->when = when;
+            return;
+        }
+    }
+}
+
+static void removeIndex_Visited_(iVisited *d, uint64_t hash) {
+    iVisitedSlot *slot = (iVisitedSlot *) findSlot_Visited_(d, hash);
+    if (slot) {
+        slot->hash = removed_VisitedSlot;
+    }
+}
+
+static void rebuildIndex_Visited_(iVisited *d, size_t capacity) {
+    size_t cap = 1024;
+    while (cap < capacity) {
+        cap <<= 1;
+    }
+    free(d->index);
+    d->index         = calloc(cap, sizeof(iVisitedSlot));
+    d->indexCapacity = cap;
+    d->indexUsed     = 0;
+    iConstForEach(Array, i, &d->visited.values) {
+        const iVisitedUrl *item = i.value;
+        setIndex_Visited_(d, urlHash_Visited_(&item->url), item->when);
+    }
+}
+
 iDefineTypeConstruction(Visited)
 
 void init_Visited(iVisited *d) {
     d->mtx = new_Mutex();
     init_SortedArray(&d->visited, sizeof(iVisitedUrl), cmpUrl_VisitedUrl_);
+    d->generation = 0;
+    d->index = NULL;
+    d->indexCapacity = 0;
+    d->indexUsed = 0;
+    d->journal = new_Buffer();
+    openEmpty_Buffer(d->journal);
+    d->journalSize = 0;
+    d->snapshotCount = 0;
+    d->snapshotHash = 0;
+    d->loadDir = NULL;
+    d->loader = NULL;
+}
+
+static void clearItems_Visited_(iVisited *d) {
+    iForEach(Array, v, &d->visited.values) {
+        deinit_VisitedUrl(v.value);
+    }
+    clear_SortedArray(&d->visited);
 }
 
 void deinit_Visited(iVisited *d) {
+    release_Job(d->loader); /* the job pool has already been shut down */
     iGuardMutex(d->mtx, {
-        clear_Visited(d);
+        clearItems_Visited_(d);
         deinit_SortedArray(&d->visited);
     });
+    delete_String(d->loadDir);
+    free(d->index);
+    iRelease(d->journal);
     delete_Mutex(d->mtx);
 }
 
-void save_Visited(const iVisited *d, const char *dirPath) {
-    iString *line = new_String();
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
-    if (open_File(f, writeOnly_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        iConstForEach(Array, i, &d->visited.values) {
-            const iVisitedUrl *item = i.value;
-            format_String(line,
-                          "%llu %04x %s\n",
-                          (unsigned long long) integralSeconds_Time(&item->when),
-                          item->flags,
-                          cstr_String(&item->url));
-            writeData_File(f, cstr_String(line), size_String(line));
+static void lock_Visited_(const iVisited *d);
+
+static void writeSnapshot_Visited_(iVisited *d, const char *dirPath) {
+    /* `mtx` must be held. */
+    iString *str = new_String();
+    uint32_t hash = 0x811c9dc5;
+    iConstForEach(Array, i, &d->visited.values) {
+        const iVisitedUrl *item = i.value;
+        const unsigned long long ts = integralSeconds_Time(&item->when);
+        appendFormat_String(str, "%llu %04x %s\n", ts, item->flags, cstr_String(&item->url));
+        hash = snapshotHash_Visited_(hash, ts, item->flags, range_String(&item->url));
+    }
+    write_SaveQueue(concatPath_CStr(dirPath, snapshotFilename_Visited_), utf8_String(str));
+    delete_String(str);
+    d->snapshotCount = size_SortedArray(&d->visited);
+    d->snapshotHash  = hash;
+    /* Start a new journal for this snapshot. */
+    iBuffer *header = new_Buffer();
+    openEmpty_Buffer(header);
+    iStream *outs = stream_Buffer(header);
+    writeData_Stream(outs, magicJournal_Visited_, 4);
+    writeU32_Stream(outs, journalVersion_Visited_);
+    writeU32_Stream(outs, d->snapshotCount);
+    writeU32_Stream(outs, d->snapshotHash);
+    write_SaveQueue(concatPath_CStr(dirPath, journalFilename_Visited_), data_Buffer(header));
+    d->journalSize = size_Block(data_Buffer(header));
+    iRelease(header);
+    openEmpty_Buffer(d->journal); /* included in the snapshot */
+}
+
+void save_Visited(iVisited *d, const char *dirPath) {
+    /* Usually only the changes since the last save need to be written. */
+    lock_Visited_(d);
+    if (d->journalSize == 0 || d->journalSize > maxJournalSize_Visited_) {
+        writeSnapshot_Visited_(d, dirPath);
+    }
+    else if (!isEmpty_Block(data_Buffer(d->journal))) {
+        append_SaveQueue(concatPath_CStr(dirPath, journalFilename_Visited_),
+                         data_Buffer(d->journal));
+        d->journalSize += size_Block(data_Buffer(d->journal));
+        openEmpty_Buffer(d->journal);
+    }
+    unlock_Mutex(d->mtx);
+}
+
+static void insertLoaded_Visited_(iVisited *d, iVisitedUrl *item) {
+    /* The snapshot is sorted, so most items can simply be appended. */
+    const size_t count = size_SortedArray(&d->visited);
+    if (count == 0 || cmpUrl_VisitedUrl_(constAt_SortedArray(&d->visited, count - 1), item) < 0) {
+        updateTrigrams_VisitedUrl_(item);
+        pushBack_Array(&d->visited.values, item);
+    }
+    else {
+        size_t pos;
+        if (locate_SortedArray(&d->visited, item, &pos)) {
+            iVisitedUrl *old = at_SortedArray(&d->visited, pos);
+            old->when  = item->when;
+            old->flags = item->flags;
+            deinit_VisitedUrl(item);
+        }
+        else {
+            updateTrigrams_VisitedUrl_(item);
+            insert_SortedArray(&d->visited, item);
         }
-        unlock_Mutex(d->mtx);
     }
+}
+
+static void replayJournal_Visited_(iVisited *d, const char *dirPath) {
+    iFile *f = newCStr_File(concatPath_CStr(dirPath, journalFilename_Visited_));
+    if (!open_File(f, readOnly_FileMode)) {
+        iRelease(f);
+        return;
+    }
+    iBlock  *data = readAll_File(f);
+    iBuffer *buf  = new_Buffer();
+    iStream *ins  = stream_Buffer(buf);
+    char     magic[4];
     iRelease(f);
-    delete_String(line);
+    open_Buffer(buf, data);
+    if (readData_Stream(ins, 4, magic) == 4 && !memcmp(magic, magicJournal_Visited_, 4) &&
+        readU32_Stream(ins) == (uint32_t) journalVersion_Visited_ &&
+        readU32_Stream(ins) == d->snapshotCount && readU32_Stream(ins) == d->snapshotHash) {
+        iBool ok = iTrue;
+        while (ok && !atEnd_Buffer(buf)) {
+            switch (read8_Stream(ins)) {
+                case visit_VisitedJournalRecord: {
+                    iVisitedUrl item;
+                    init_VisitedUrl(&item);
+                    item.when.ts = (struct timespec){ .tv_sec = readU64_Stream(ins) };
+                    item.flags   = readU16_Stream(ins);
+                    deserialize_String(&item.url, ins);
+                    size_t pos;
+                    if (locate_SortedArray(&d->visited, &item, &pos)) {
+                        iVisitedUrl *old = at_SortedArray(&d->visited, pos);
+                        old->when  = item.when;
+                        old->flags = item.flags;
+                        deinit_VisitedUrl(&item);
+                    }
+                    else {
+                        updateTrigrams_VisitedUrl_(&item);
+                        insert_SortedArray(&d->visited, &item);
+                    }
+                    break;
+                }
+                case removed_VisitedJournalRecord: {
+                    iVisitedUrl item;
+                    init_VisitedUrl(&item);
+                    deserialize_String(&item.url, ins);
+                    size_t pos;
+                    if (locate_SortedArray(&d->visited, &item, &pos)) {
+                        deinit_VisitedUrl(at_SortedArray(&d->visited, pos));
+                        remove_Array(&d->visited.values, pos);
+                    }
+                    deinit_VisitedUrl(&item);
+                    break;
+                }
+                case cleared_VisitedJournalRecord:
+                    clearItems_Visited_(d);
+                    break;
+                default:
+                    ok = iFalse; /* corrupt */
+                    break;
+            }
+        }
+        d->journalSize = size_Block(data);
+    }
+    iRelease(buf);
+    delete_Block(data);
 }
 
-void load_Visited(iVisited *d, const char *dirPath) {
-    iFile *f = newCStr_File(concatPath_CStr(dirPath, "visited.2.txt"));
-    if (open_File(f, readOnly_FileMode | text_FileMode)) {
-        lock_Mutex(d->mtx);
-        const iRangecc src  = range_Block(collect_Block(readAll_File(f)));
-        iRangecc       line = iNullRange;
-        iTime          now;
-        initCurrent_Time(&now);
-        while (nextSplit_Rangecc(src, "\n", &line)) {
-            if (size_Range(&line) < 8) continue;
-            char *endp = NULL;
-            const unsigned long long ts = strtoull(line.start, &endp, 10);
-            if (ts == 0) break;
-            const uint32_t flags = strtoul(skipSpace_CStr(endp), &endp, 16);
-            const char *urlStart = skipSpace_CStr(endp);
-            iVisitedUrl item;
-            item.when.ts = (struct timespec){ .tv_sec = ts };
-            if (~flags & kept_VisitedUrlFlag &&
-                secondsSince_Time(&now, &item.when) > maxAge_Visited) {
-                continue; /* Too old. */
+static const char *skipSpaces_(const char *pos, const char *end) {
+    while (pos < end && *pos == ' ') {
+        pos++;
+    }
+    return pos;
+}
+
+static void parseSnapshot_Visited_(iVisited *d, iRangecc src) {
+    /* `src` must end with a newline or a NUL. Numbers are only parsed where a digit
+       follows, so parsing doesn't continue past the end of the line. */
+    iRangecc line  = iNullRange;
+    iTime    now;
+    uint32_t hash  = 0x811c9dc5;
+    uint32_t count = 0;
+    initCurrent_Time(&now);
+    while (nextSplit_Rangecc(src, "\n", &line)) {
+        if (size_Range(&line) < 8) continue;
+        if (!isdigit((unsigned char) *line.start)) break;
+        char *endp = NULL;
+        const unsigned long long ts = strtoull(line.start, &endp, 10);
+        if (ts == 0) break;
+        const char *flagsStart = skipSpaces_(endp, line.end);
+        if (!isxdigit((unsigned char) *flagsStart)) continue;
+        const uint32_t flags = strtoul(flagsStart, &endp, 16);
+        const char *urlStart = skipSpaces_(endp, line.end);
+        hash = snapshotHash_Visited_(hash, ts, flags, (iRangecc){ urlStart, line.end });
+        count++;
+        iVisitedUrl item;
+        item.when.ts = (struct timespec){ .tv_sec = ts };
+        if (~flags & kept_VisitedUrlFlag &&
+            secondsSince_Time(&now, &item.when) > maxAge_Visited) {
+            continue; /* Too old. */
+        }
+        item.flags = flags;
+        initRange_String(&item.url, (iRangecc){ urlStart, line.end });
+        set_String(&item.url, &item.url);
+        insertLoaded_Visited_(d, &item);
+    }
+    d->snapshotCount = count;
+    d->snapshotHash  = hash;
+}
+
+static void loadSnapshot_Visited_(iVisited *d, const char *path) {
+    /* The snapshot is parsed straight out of a read-only mapping when possible. */
+#if defined (LAGRANGE_MMAP_VISITED)
+    const int fd = open(path, O_RDONLY);
+    if (fd >= 0) {
+        struct stat st;
+        void *mapped = MAP_FAILED;
+        if (fstat(fd, &st) == 0 && st.st_size > 0) {
+            mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        }
+        close(fd); /* the mapping remains */
+        if (mapped != MAP_FAILED) {
+            const char *chars = mapped;
+            if (chars[st.st_size - 1] == '\n') {
+                parseSnapshot_Visited_(d, (iRangecc){ chars, chars + st.st_size });
+                munmap(mapped, st.st_size);
+                return;
             }
-            item.flags = flags;
-            initRange_String(&item.url, (iRangecc){ urlStart, line.end });
-            set_String(&item.url, &item.url);
-            insert_SortedArray(&d->visited, &item);
+            munmap(mapped, st.st_size); /* truncated; read normally below */
         }
-        unlock_Mutex(d->mtx);
+    }
+#endif
+    iFile *f = newCStr_File(path);
+    if (open_File(f, readOnly_FileMode | text_FileMode)) {
+        parseSnapshot_Visited_(d, range_Block(collect_Block(readAll_File(f))));
     }
     iRelease(f);
 }
 
-void clear_Visited(iVisited *d) {
+static void ensureLoaded_Visited_(iVisited *d) {
+    /* `mtx` must be held. */
+    if (d->loadDir) {
+        iString *dir = d->loadDir;
+        d->loadDir = NULL;
+        iBeginCollect();
+        loadSnapshot_Visited_(d, concatPath_CStr(cstr_String(dir), snapshotFilename_Visited_));
+        replayJournal_Visited_(d, cstr_String(dir));
+        rebuildIndex_Visited_(d, size_SortedArray(&d->visited) * 4);
+        d->generation++;
+        iEndCollect();
+        delete_String(dir);
+    }
+}
+
+static void lock_Visited_(const iVisited *d) {
     lock_Mutex(d->mtx);
-    iForEach(Array, v, &d->visited.values) {
-        deinit_VisitedUrl(v.value);
+    ensureLoaded_Visited_(iConstCast(iVisited *, d));
+}
+
+static void runLoader_Visited_(iJob *job, void *context) {
+    iVisited *d = context;
+    iUnused(job);
+    lock_Visited_(d);
+    unlock_Mutex(d->mtx);
+}
+
+void load_Visited(iVisited *d, const char *dirPath) {
+    lock_Mutex(d->mtx);
+    if (!d->loadDir) {
+        d->loadDir = newCStr_String(dirPath);
     }
-    clear_SortedArray(&d->visited);
+    unlock_Mutex(d->mtx);
+    /* Links already shown are updated when the visits are known. */
+    release_Job(d->loader);
+    d->loader = submit_Jobs(background_JobPriority, runLoader_Visited_, d, "visited.changed");
+}
+
+void clear_Visited(iVisited *d) {
+    lock_Visited_(d);
+    clearItems_Visited_(d);
+    write8_Stream(stream_Buffer(d->journal), cleared_VisitedJournalRecord);
+    free(d->index);
+    d->index = NULL;
+    d->indexCapacity = 0;
+    d->indexUsed = 0;
+    d->generation++;
     unlock_Mutex(d->mtx);
 }
 
@@ -138,6 +506,7 @@ static size_t find_Visited_(const iVisited *d, const iString *url) {
     set_String(&visit.url, url);
     size_t pos = iInvalidPos;
     iGuardMutex(d->mtx, {
+        ensureLoaded_Visited_(iConstCast(iVisited *, d));
         locate_SortedArray(&d->visited, &visit, &pos);
         deinit_VisitedUrl(&visit);
     });
@@ -152,7 +521,8 @@ void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
     visit.flags = visitFlags;
     set_String(&visit.url, url);
     size_t pos;
-    lock_Mutex(d->mtx);
+    lock_Visited_(d);
+    d->generation++;
     if (locate_SortedArray(&d->visited, &visit, &pos)) {
         iVisitedUrl *old = at_SortedArray(&d->visited, pos);
         if (old->flags & kept_VisitedUrlFlag) {
@@ -161,12 +531,17 @@ void visitUrl_Visited(iVisited *d, const iString *url, uint16_t visitFlags) {
         if (cmpNewer_VisitedUrl_(&visit, old)) {
             old->when = visit.when;
             old->flags = visitFlags;
+            setIndex_Visited_(d, urlHash_Visited_(&old->url), old->when);
+            journalVisit_Visited_(d, old);
             unlock_Mutex(d->mtx);
             deinit_VisitedUrl(&visit);
             return;
         }
     }
+    updateTrigrams_VisitedUrl_(&visit);
     insert_SortedArray(&d->visited, &visit);
+    setIndex_Visited_(d, urlHash_Visited_(&visit.url), visit.when);
+    journalVisit_Visited_(d, &visit);
     unlock_Mutex(d->mtx);
 }
 
@@ -176,10 +551,13 @@ void setUrlKept_Visited(iVisited *d, const iString *url, iBool isKept) {
     init_VisitedUrl(&visit);
     set_String(&visit.url, canonicalUrl_String(url));
     size_t pos;
-    lock_Mutex(d->mtx);
+    lock_Visited_(d);
     if (locate_SortedArray(&d->visited, &visit, &pos)) {
         iVisitedUrl *vis = at_SortedArray(&d->visited, pos);
-        iChangeFlags(vis->flags, kept_VisitedUrlFlag, isKept);
+        if (((vis->flags & kept_VisitedUrlFlag) != 0) != isKept) {
+            iChangeFlags(vis->flags, kept_VisitedUrlFlag, isKept);
+            journalVisit_Visited_(d, vis);
+        }
     }
     unlock_Mutex(d->mtx);
     deinit_VisitedUrl(&visit);
@@ -188,29 +566,63 @@ void setUrlKept_Visited(iVisited *d, const iString *url, iBool isKept) {
 void removeUrl_Visited(iVisited *d, const iString *url) {
     url = canonicalUrl_String(url);
     iGuardMutex(d->mtx, {
+        ensureLoaded_Visited_(d);
         size_t pos = find_Visited_(d, url);
         if (pos < size_SortedArray(&d->visited)) {
             iVisitedUrl *visUrl = at_SortedArray(&d->visited, pos);
             if (equal_String(&visUrl->url, url)) {
+                removeIndex_Visited_(d, urlHash_Visited_(url));
+                journalRemoval_Visited_(d, url);
                 deinit_VisitedUrl(visUrl);
                 remove_Array(&d->visited.values, pos);
+                d->generation++;
             }
         }
     });
 }
 
+uint32_t generation_Visited(const iVisited *d) {
+    uint32_t gen;
+    iGuardMutex(d->mtx, gen = d->generation);
+    return gen;
+}
+
 iTime urlVisitTime_Visited(const iVisited *d, const iString *url) {
-    iVisitedUrl item;
-    size_t pos;
-    iZap(item);
-    initCopy_String(&item.url, canonicalUrl_String(url));
-    lock_Mutex(d->mtx);
-    if (locate_SortedArray(&d->visited, &item, &pos)) {
-        item.when = ((const iVisitedUrl *) constAt_SortedArray(&d->visited, pos))->when;
+    return urlHashVisitTime_Visited(d, urlHash_String(canonicalUrl_String(url)));
+}
+
+iTime urlHashVisitTime_Visited(const iVisited *d, uint64_t urlHash) {
+    iTime when;
+    urlHashVisitTimes_Visited(d, 1, &urlHash, &when);
+    return when;
+}
+
+void urlVisitTimes_Visited(const iVisited *d, size_t count, const iString **urls,
+                           iTime *when_out) {
+    /* Hashing is done before locking. */
+    uint64_t *hashes = malloc(sizeof(uint64_t) * iMax(1, count));
+    iBeginCollect();
+    for (size_t i = 0; i < count; i++) {
+        hashes[i] = urlHash_String(canonicalUrl_String(urls[i]));
+    }
+    iEndCollect();
+    urlHashVisitTimes_Visited(d, count, hashes, when_out);
+    free(hashes);
+}
+
+void urlHashVisitTimes_Visited(const iVisited *d, size_t count, const uint64_t *urlHashes,
+                               iTime *when_out) {
+    lock_Visited_(d);
+    for (size_t i = 0; i < count; i++) {
+        const iVisitedSlot *slot = findSlot_Visited_(d, slotHash_Visited_(urlHashes[i]));
+        if (slot) {
+            when_out[i] = slot->when;
+        }
+        else {
+            iZap(when_out[i]);
+        }
     }
     unlock_Mutex(d->mtx);
-    deinit_String(&item.url);
-    return item.when;
 }
 
 iBool containsUrl_Visited(const iVisited *d, const iString *url) {
@@ -218,6 +630,18 @@ iBool containsUrl_Visited(const iVisited *d, const iString *url) {
     return isValid_Time(&time);
 }
 
+size_t memorySize_Visited(const iVisited *d) {
+    size_t size = 0;
+    iGuardMutex(d->mtx, {
+        size = size_Array(&d->visited.values) * sizeof(iVisitedUrl) +
+               d->indexCapacity * sizeof(iVisitedSlot);
+        iConstForEach(Array, i, &d->visited.values) {
+            size += size_String(&((const iVisitedUrl *) i.value)->url);
+        }
+    });
+    return size;
+}
+
 static int cmpWhenDescending_VisitedUrlPtr_(const void *a, const void *b) {
     const iVisitedUrl *s = *(const void **) a, *t = *(const void **) b;
     return -cmp_Time(&s->when, &t->when);
@@ -226,6 +650,7 @@ static int cmpWhenDescending_VisitedUrlPtr_(const void *a, const void *b) {
 const iPtrArray *list_Visited(const iVisited *d, size_t count) {
     iPtrArray *urls = collectNew_PtrArray();
     iGuardMutex(d->mtx, {
+        ensureLoaded_Visited_(iConstCast(iVisited *, d));
         iConstForEach(Array, i, &d->visited.values) {
             const iVisitedUrl *vis = i.value;
             if (~vis->flags & transient_VisitedUrlFlag) {
@@ -243,6 +668,7 @@ const iPtrArray *list_Visited(const iVisited *d, size_t count) {
 const iPtrArray *listKept_Visited(const iVisited *d) {
     iPtrArray *urls = collectNew_PtrArray();
     iGuardMutex(d->mtx, {
+        ensureLoaded_Visited_(iConstCast(iVisited *, d));
         iConstForEach(Array, i, &d->visited.values) {
             const iVisitedUrl *vis = i.value;
             if (vis->flags & kept_VisitedUrlFlag) {
@@ -252,3 +678,17 @@ const iPtrArray *listKept_Visited(const iVisited *d) {
     });
     return urls;
 }
+
+void search_Visited(const iVisited *d, const iTrigrams *required, iVisitedSearchFunc func,
+                    void *context) {
+    lock_Visited_(d);
+    iConstForEach(Array, i, &d->visited.values) {
+        const iVisitedUrl *vis = i.value;
+        if (~vis->flags & transient_VisitedUrlFlag && contains_Trigrams(&vis->trigrams, required)) {
+            if (!func(context, vis)) {
+                break;
+            }
+        }
+    }
+    unlock_Mutex(d->mtx);
+}
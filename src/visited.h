@@ -23,6 +23,7 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE. */
 #pragma once
 
 #include "gmrequest.h"
+#include "trigrams.h"
 
 #include <the_Foundation/ptrarray.h>
 #include <the_Foundation/string.h>
@@ -37,6 +38,7 @@ struct Impl_VisitedUrl {
     iString  url;
     iTime    when;
     uint16_t flags;
+    iTrigrams trigrams; /* of the URL, for lookups */
 };
 
 enum iVisitedUrlFlag {
@@ -49,13 +51,23 @@ iDeclareTypeConstruction(Visited)
 
 void    clear_Visited           (iVisited *);
 void    load_Visited            (iVisited *, const char *dirPath);
-void    save_Visited            (const iVisited *, const char *dirPath);
+void    save_Visited            (iVisited *, const char *dirPath);
 
 iTime   urlVisitTime_Visited    (const iVisited *, const iString *url);
+void    urlVisitTimes_Visited   (const iVisited *, size_t count, const iString **urls, iTime *when_out);
+iTime   urlHashVisitTime_Visited(const iVisited *, uint64_t urlHash); /* see urlHash_String() */
+void    urlHashVisitTimes_Visited(const iVisited *, size_t count, const uint64_t *urlHashes, iTime *when_out);
 void    visitUrl_Visited        (iVisited *, const iString *url, uint16_t visitFlags); /* adds URL to the visited URLs set */
 void    setUrlKept_Visited      (iVisited *, const iString *url, iBool isKept); /* URL is marked as (non)discardable */
 void    removeUrl_Visited       (iVisited *, const iString *url);
 iBool   containsUrl_Visited     (const iVisited *, const iString *url);
+size_t  memorySize_Visited      (const iVisited *); /* bytes, approximate */
+uint32_t generation_Visited     (const iVisited *); /* changes whenever the visits change */
 
 const iPtrArray *   list_Visited        (const iVisited *, size_t count); /* returns collected */
 const iPtrArray *   listKept_Visited    (const iVisited *);
+
+typedef iBool (*iVisitedSearchFunc)(void *context, const iVisitedUrl *); /* return False to stop */
+
+void    search_Visited          (const iVisited *, const iTrigrams *required,
+                                 iVisitedSearchFunc func, void *context);